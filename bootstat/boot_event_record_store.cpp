@@ -18,23 +18,250 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <utime.h>
 
 #include <chrono>
+#include <cstddef>
 #include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
+#include <android-base/unique_fd.h>
 
 namespace {
 
 const char BOOTSTAT_DATA_DIR[] = "/data/misc/bootstat/";
 
+// The record log holds every boot event in a single file of fixed-size
+// records, so reading the store takes one open and one mmap rather than a
+// stat per event. It lives alongside the legacy one-file-per-event records,
+// which are migrated into it the first time the whole store is read.
+const char RECORD_LOG_NAME[] = ".boot_events";
+
+const uint32_t RECORD_LOG_MAGIC = 0x54534254;  // "TBST"
+const uint32_t RECORD_LOG_VERSION = 1;
+
+// Roughly 30 events are recorded per boot, so the log is compacted down to one
+// record per event every couple of dozen boots.
+const off_t RECORD_LOG_COMPACT_SIZE = 64 * 1024;
+
+struct RecordLogHeader {
+  uint32_t magic;
+  uint32_t version;
+};
+
+// The name is NUL-padded so that the checksum covers a well-defined value.
+struct RecordLogEntry {
+  char name[88];
+  int32_t value;
+  uint32_t checksum;
+};
+
+static_assert(sizeof(RecordLogEntry) == 96, "RecordLogEntry must not contain padding");
+
+// Computes the FNV-1a hash of every field of |entry| but the checksum.
+uint32_t ComputeChecksum(const RecordLogEntry& entry) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&entry);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(RecordLogEntry, checksum); ++i) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Fills |entry| with a record of |event| and |value|. Returns false if |event|
+// is too long to fit in a record.
+bool MakeRecordLogEntry(const std::string& event, int32_t value, RecordLogEntry* entry) {
+  if (event.size() >= sizeof(entry->name)) {
+    return false;
+  }
+
+  memset(entry, 0, sizeof(*entry));
+  memcpy(entry->name, event.data(), event.size());
+  entry->value = value;
+  entry->checksum = ComputeChecksum(*entry);
+  return true;
+}
+
+// Reads every valid record of the log at |path| into |records|. Later records
+// of an event replace earlier ones. A missing log is treated as empty.
+void ReadRecordLog(const std::string& path, std::map<std::string, int32_t>* records) {
+  android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+  if (fd == -1) {
+    if (errno != ENOENT) {
+      PLOG(ERROR) << "Failed to open " << path;
+    }
+    return;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd.get(), &file_stat) == -1) {
+    PLOG(ERROR) << "Failed to read " << path;
+    return;
+  }
+
+  const size_t size = file_stat.st_size;
+  if (size < sizeof(RecordLogHeader)) {
+    return;
+  }
+
+  void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+  if (map == MAP_FAILED) {
+    PLOG(ERROR) << "Failed to map " << path;
+    return;
+  }
+
+  const uint8_t* data = static_cast<const uint8_t*>(map);
+  RecordLogHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != RECORD_LOG_MAGIC || header.version != RECORD_LOG_VERSION) {
+    LOG(ERROR) << "Unrecognized record log header in " << path;
+    munmap(map, size);
+    return;
+  }
+
+  // A trailing partial record is an append that was interrupted, and is
+  // ignored just like a record that fails its checksum.
+  for (size_t offset = sizeof(header); offset + sizeof(RecordLogEntry) <= size;
+       offset += sizeof(RecordLogEntry)) {
+    RecordLogEntry entry;
+    memcpy(&entry, data + offset, sizeof(entry));
+    if (entry.checksum != ComputeChecksum(entry)) {
+      LOG(ERROR) << "Skipping corrupt record at offset " << offset << " of " << path;
+      continue;
+    }
+    (*records)[std::string(entry.name, strnlen(entry.name, sizeof(entry.name)))] = entry.value;
+  }
+
+  munmap(map, size);
+}
+
+// Opens the log at |path| for appending with an exclusive lock held, creating
+// it if needed. A partial trailing record left by an interrupted append is
+// truncated away so that subsequent records stay aligned.
+android::base::unique_fd OpenRecordLogForAppend(const std::string& path) {
+  while (true) {
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(
+        open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR)));
+    if (fd == -1) {
+      PLOG(ERROR) << "Failed to open " << path;
+      return {};
+    }
+
+    if (TEMP_FAILURE_RETRY(flock(fd.get(), LOCK_EX)) == -1) {
+      PLOG(ERROR) << "Failed to lock " << path;
+      return {};
+    }
+
+    struct stat file_stat;
+    if (fstat(fd.get(), &file_stat) == -1) {
+      PLOG(ERROR) << "Failed to read " << path;
+      return {};
+    }
+
+    // The log was replaced by a compaction while we waited for the lock.
+    if (file_stat.st_nlink == 0) {
+      continue;
+    }
+
+    off_t valid_size = file_stat.st_size;
+    if (valid_size < static_cast<off_t>(sizeof(RecordLogHeader))) {
+      valid_size = 0;
+    } else {
+      valid_size -= (valid_size - sizeof(RecordLogHeader)) % sizeof(RecordLogEntry);
+    }
+
+    if (valid_size != file_stat.st_size && ftruncate(fd.get(), valid_size) == -1) {
+      PLOG(ERROR) << "Failed to truncate " << path;
+      return {};
+    }
+
+    if (valid_size == 0) {
+      const RecordLogHeader header = {RECORD_LOG_MAGIC, RECORD_LOG_VERSION};
+      if (!android::base::WriteFully(fd.get(), &header, sizeof(header))) {
+        PLOG(ERROR) << "Failed to write " << path;
+        return {};
+      }
+    }
+
+    return fd;
+  }
+}
+
+// Rewrites the log at |path| with a single record per event. The caller must
+// hold the lock of the log.
+void CompactRecordLog(const std::string& path) {
+  std::map<std::string, int32_t> records;
+  ReadRecordLog(path, &records);
+
+  std::string contents;
+  const RecordLogHeader header = {RECORD_LOG_MAGIC, RECORD_LOG_VERSION};
+  contents.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const auto& [event, value] : records) {
+    RecordLogEntry entry;
+    if (MakeRecordLogEntry(event, value, &entry)) {
+      contents.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    }
+  }
+
+  const std::string tmp_path = path + ".tmp";
+  android::base::unique_fd tmp_fd(TEMP_FAILURE_RETRY(open(
+      tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR)));
+  if (tmp_fd == -1) {
+    PLOG(ERROR) << "Failed to create " << tmp_path;
+    return;
+  }
+
+  if (!android::base::WriteStringToFd(contents, tmp_fd.get()) || fsync(tmp_fd.get()) == -1) {
+    PLOG(ERROR) << "Failed to write " << tmp_path;
+    unlink(tmp_path.c_str());
+    return;
+  }
+
+  // Appenders that are waiting on the lock of the old log notice that it was
+  // unlinked by the rename and reopen |path|.
+  if (rename(tmp_path.c_str(), path.c_str()) == -1) {
+    PLOG(ERROR) << "Failed to replace " << path;
+    unlink(tmp_path.c_str());
+  }
+}
+
+// Appends |entries| to the log at |path| in a single write, compacting the log
+// if it grew past RECORD_LOG_COMPACT_SIZE. Returns true iff the entries were
+// written.
+bool AppendRecordLog(const std::string& path, const std::vector<RecordLogEntry>& entries) {
+  android::base::unique_fd fd = OpenRecordLogForAppend(path);
+  if (fd == -1) {
+    return false;
+  }
+
+  if (!android::base::WriteFully(fd.get(), entries.data(),
+                                 entries.size() * sizeof(RecordLogEntry))) {
+    PLOG(ERROR) << "Failed to write " << path;
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd.get(), &file_stat) == 0 && file_stat.st_size > RECORD_LOG_COMPACT_SIZE) {
+    CompactRecordLog(path);
+  }
+
+  return true;
+}
+
 // Given a boot even record file at |path|, extracts the event's relative time
 // from the record into |uptime|.
 bool ParseRecordEventTime(const std::string& path, int32_t* uptime) {
@@ -51,34 +278,20 @@ bool ParseRecordEventTime(const std::string& path, int32_t* uptime) {
   return true;
 }
 
-}  // namespace
-
-BootEventRecordStore::BootEventRecordStore() {
-  SetStorePath(BOOTSTAT_DATA_DIR);
-}
-
-void BootEventRecordStore::AddBootEvent(const std::string& event) {
-  auto uptime = std::chrono::duration_cast<std::chrono::seconds>(
-      android::base::boot_clock::now().time_since_epoch());
-  AddBootEventWithValue(event, uptime.count());
-}
-
-// The implementation of AddBootEventValue makes use of the mtime file
-// attribute to store the value associated with a boot event in order to
-// optimize on-disk size requirements and small-file thrashing.
-void BootEventRecordStore::AddBootEventWithValue(const std::string& event, int32_t value) {
-  std::string record_path = GetBootEventPath(event);
-  int record_fd = creat(record_path.c_str(), S_IRUSR | S_IWUSR);
+// Persists a legacy boot event record file at |path|. The mtime file attribute
+// stores the value associated with the boot event.
+void WriteLegacyRecord(const std::string& path, int32_t value) {
+  int record_fd = creat(path.c_str(), S_IRUSR | S_IWUSR);
   if (record_fd == -1) {
-    PLOG(ERROR) << "Failed to create " << record_path;
+    PLOG(ERROR) << "Failed to create " << path;
     return;
   }
 
-  // Fill out the stat structure for |record_path| in order to get the atime to
-  // set in the utime() call.
+  // Fill out the stat structure for |path| in order to get the atime to set in
+  // the utime() call.
   struct stat file_stat;
-  if (stat(record_path.c_str(), &file_stat) == -1) {
-    PLOG(ERROR) << "Failed to read " << record_path;
+  if (stat(path.c_str(), &file_stat) == -1) {
+    PLOG(ERROR) << "Failed to read " << path;
     close(record_fd);
     return;
   }
@@ -86,8 +299,8 @@ void BootEventRecordStore::AddBootEventWithValue(const std::string& event, int32
   // Set the |modtime| of the file to store the value of the boot event while
   // preserving the |actime| (as read by stat).
   struct utimbuf times = {/* actime */ file_stat.st_atime, /* modtime */ value};
-  if (utime(record_path.c_str(), &times) == -1) {
-    PLOG(ERROR) << "Failed to set mtime for " << record_path;
+  if (utime(path.c_str(), &times) == -1) {
+    PLOG(ERROR) << "Failed to set mtime for " << path;
     close(record_fd);
     return;
   }
@@ -95,10 +308,43 @@ void BootEventRecordStore::AddBootEventWithValue(const std::string& event, int32
   close(record_fd);
 }
 
+}  // namespace
+
+BootEventRecordStore::BootEventRecordStore() {
+  SetStorePath(BOOTSTAT_DATA_DIR);
+}
+
+void BootEventRecordStore::AddBootEvent(const std::string& event) {
+  auto uptime = std::chrono::duration_cast<std::chrono::seconds>(
+      android::base::boot_clock::now().time_since_epoch());
+  AddBootEventWithValue(event, uptime.count());
+}
+
+// Events whose names do not fit in a record log entry fall back to the legacy
+// one-file-per-event layout.
+void BootEventRecordStore::AddBootEventWithValue(const std::string& event, int32_t value) {
+  RecordLogEntry entry;
+  if (!MakeRecordLogEntry(event, value, &entry)) {
+    WriteLegacyRecord(GetBootEventPath(event), value);
+    return;
+  }
+
+  AppendRecordLog(GetRecordLogPath(), {entry});
+}
+
 bool BootEventRecordStore::GetBootEvent(const std::string& event, BootEventRecord* record) const {
   CHECK_NE(static_cast<BootEventRecord*>(nullptr), record);
   CHECK(!event.empty());
 
+  std::map<std::string, int32_t> records;
+  ReadRecordLog(GetRecordLogPath(), &records);
+  auto it = records.find(event);
+  if (it != records.end()) {
+    *record = *it;
+    return true;
+  }
+
+  // Fall back to a legacy record that has not been migrated yet.
   const std::string record_path = GetBootEventPath(event);
   int32_t uptime;
   if (!ParseRecordEventTime(record_path, &uptime)) {
@@ -111,14 +357,21 @@ bool BootEventRecordStore::GetBootEvent(const std::string& event, BootEventRecor
 }
 
 std::vector<BootEventRecordStore::BootEventRecord> BootEventRecordStore::GetAllBootEvents() const {
-  std::vector<BootEventRecord> events;
+  std::map<std::string, int32_t> records;
+  ReadRecordLog(GetRecordLogPath(), &records);
+  MigrateLegacyRecords(&records);
+  return std::vector<BootEventRecord>(records.begin(), records.end());
+}
 
+void BootEventRecordStore::MigrateLegacyRecords(std::map<std::string, int32_t>* records) const {
   std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(store_path_.c_str()), closedir);
 
   // This case could happen due to external manipulation of the filesystem,
   // so crash out if the record store doesn't exist.
   CHECK_NE(static_cast<DIR*>(nullptr), dir.get());
 
+  std::vector<std::string> migrated;
+  std::vector<RecordLogEntry> entries;
   struct dirent* entry;
   while ((entry = readdir(dir.get())) != NULL) {
     // Only parse regular files.
@@ -126,17 +379,45 @@ std::vector<BootEventRecordStore::BootEventRecord> BootEventRecordStore::GetAllB
       continue;
     }
 
+    // Skip the record log, and the temporary file that an interrupted
+    // CompactRecordLog() may have left beside it.
     const std::string event = entry->d_name;
-    BootEventRecord record;
-    if (!GetBootEvent(event, &record)) {
+    if (event[0] == '.') {
+      continue;
+    }
+
+    // A record already in the log is newer than the legacy one.
+    if (records->count(event) != 0) {
+      migrated.push_back(event);
+      continue;
+    }
+
+    int32_t value;
+    if (!ParseRecordEventTime(GetBootEventPath(event), &value)) {
       LOG(ERROR) << "Failed to parse boot time event: " << event;
       continue;
     }
 
-    events.push_back(record);
+    (*records)[event] = value;
+
+    // Records that are too long for the log stay in the legacy layout.
+    RecordLogEntry log_entry;
+    if (MakeRecordLogEntry(event, value, &log_entry)) {
+      entries.push_back(log_entry);
+      migrated.push_back(event);
+    }
+  }
+
+  if (!entries.empty() && !AppendRecordLog(GetRecordLogPath(), entries)) {
+    return;
   }
 
-  return events;
+  for (const auto& event : migrated) {
+    const std::string record_path = GetBootEventPath(event);
+    if (unlink(record_path.c_str()) == -1) {
+      PLOG(ERROR) << "Failed to remove migrated record " << record_path;
+    }
+  }
 }
 
 void BootEventRecordStore::SetStorePath(const std::string& path) {
@@ -148,3 +429,8 @@ std::string BootEventRecordStore::GetBootEventPath(const std::string& event) con
   DCHECK_EQ('/', store_path_.back());
   return store_path_ + event;
 }
+
+std::string BootEventRecordStore::GetRecordLogPath() const {
+  DCHECK_EQ('/', store_path_.back());
+  return store_path_ + RECORD_LOG_NAME;
+}
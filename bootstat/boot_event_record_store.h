@@ -20,12 +20,15 @@
 #include <android-base/macros.h>
 #include <gtest/gtest_prod.h>
 #include <cstdint>
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
 // BootEventRecordStore manages the persistence of boot events to the record
-// store and the retrieval of all boot event records from the store.
+// store and the retrieval of all boot event records from the store. Events are
+// appended as checksummed fixed-size records to a single log file; event files
+// written by older versions are migrated into the log when all events are read.
 class BootEventRecordStore {
  public:
   // A BootEventRecord consists of the event name and the timestamp the event
@@ -56,6 +59,11 @@ class BootEventRecordStore {
   FRIEND_TEST(BootEventRecordStoreTest, AddBootEventWithValue);
   FRIEND_TEST(BootEventRecordStoreTest, GetBootEvent);
   FRIEND_TEST(BootEventRecordStoreTest, GetBootEventNoFileContent);
+  FRIEND_TEST(BootEventRecordStoreTest, AddBootEventReplacesValue);
+  FRIEND_TEST(BootEventRecordStoreTest, MigrateLegacyRecords);
+  FRIEND_TEST(BootEventRecordStoreTest, MigrateSkipsInterruptedCompaction);
+  FRIEND_TEST(BootEventRecordStoreTest, SkipCorruptRecords);
+  FRIEND_TEST(BootEventRecordStoreTest, CompactRecordLog);
 
   // Sets the filesystem path of the record store.
   void SetStorePath(const std::string& path);
@@ -63,6 +71,13 @@ class BootEventRecordStore {
   // Constructs the full path of the given boot |event|.
   std::string GetBootEventPath(const std::string& event) const;
 
+  // Constructs the full path of the record log.
+  std::string GetRecordLogPath() const;
+
+  // Moves the legacy one-file-per-event records into the record log, adding
+  // them to |records|, which holds the contents of the log.
+  void MigrateLegacyRecords(std::map<std::string, int32_t>* records) const;
+
   // The filesystem path of the record store.
   std::string store_path_;
 
@@ -223,3 +223,100 @@ TEST_F(BootEventRecordStoreTest, GetBootEventNoFileContent) {
   EXPECT_EQ("devonian", record.first);
   EXPECT_EQ(2718, record.second);
 }
+
+TEST_F(BootEventRecordStoreTest, AddBootEventReplacesValue) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  store.AddBootEventWithValue("silurian", 1);
+  store.AddBootEventWithValue("silurian", 2);
+
+  auto events = store.GetAllBootEvents();
+  ASSERT_EQ(1U, events.size());
+  EXPECT_EQ("silurian", events[0].first);
+  EXPECT_EQ(2, events[0].second);
+}
+
+// Tests that records in the legacy one-file-per-event layout are moved into
+// the record log, and that records already in the log take precedence.
+TEST_F(BootEventRecordStoreTest, MigrateLegacyRecords) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  store.AddBootEventWithValue("ordovician", 485);
+  EXPECT_TRUE(CreateEmptyBootEventRecord(store.GetBootEventPath("ordovician"), 1));
+  EXPECT_TRUE(CreateEmptyBootEventRecord(store.GetBootEventPath("cambrian"), 541));
+
+  auto events = store.GetAllBootEvents();
+  ASSERT_EQ(2U, events.size());
+  EXPECT_THAT(events, UnorderedElementsAreArray({BootEventRecordStore::BootEventRecord(
+                                                    "ordovician", 485),
+                                                BootEventRecordStore::BootEventRecord(
+                                                    "cambrian", 541)}));
+
+  EXPECT_NE(0, access(store.GetBootEventPath("ordovician").c_str(), F_OK));
+  EXPECT_NE(0, access(store.GetBootEventPath("cambrian").c_str(), F_OK));
+
+  BootEventRecordStore::BootEventRecord record;
+  ASSERT_TRUE(store.GetBootEvent("cambrian", &record));
+  EXPECT_EQ(541, record.second);
+}
+
+TEST_F(BootEventRecordStoreTest, MigrateSkipsInterruptedCompaction) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  store.AddBootEventWithValue("silurian", 443);
+  const std::string tmp_path = store.GetRecordLogPath() + ".tmp";
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(store.GetRecordLogPath(), &contents));
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, tmp_path));
+
+  auto events = store.GetAllBootEvents();
+  ASSERT_EQ(1U, events.size());
+  EXPECT_EQ("silurian", events[0].first);
+}
+
+TEST_F(BootEventRecordStoreTest, SkipCorruptRecords) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  store.AddBootEventWithValue("ediacaran", 635);
+  store.AddBootEventWithValue("cryogenian", 720);
+
+  // Flip a bit in the value of the last record.
+  const std::string log_path = store.GetRecordLogPath();
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(log_path, &contents));
+  contents[contents.size() - 8] ^= 1;
+  // Leave a partial record behind, as an interrupted append would.
+  contents.append(10, 'x');
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, log_path));
+
+  auto events = store.GetAllBootEvents();
+  ASSERT_EQ(1U, events.size());
+  EXPECT_EQ("ediacaran", events[0].first);
+
+  // Appends after the partial record are still readable.
+  store.AddBootEventWithValue("tonian", 1000);
+  BootEventRecordStore::BootEventRecord record;
+  ASSERT_TRUE(store.GetBootEvent("tonian", &record));
+  EXPECT_EQ(1000, record.second);
+}
+
+TEST_F(BootEventRecordStoreTest, CompactRecordLog) {
+  BootEventRecordStore store;
+  store.SetStorePath(GetStorePathForTesting());
+
+  for (int32_t i = 0; i < 1000; i++) {
+    store.AddBootEventWithValue("stenian", i);
+  }
+
+  struct stat log_stat;
+  ASSERT_EQ(0, stat(store.GetRecordLogPath().c_str(), &log_stat));
+  EXPECT_LE(log_stat.st_size, 64 * 1024);
+
+  BootEventRecordStore::BootEventRecord record;
+  ASSERT_TRUE(store.GetBootEvent("stenian", &record));
+  EXPECT_EQ(999, record.second);
+}
@@ -18,8 +18,10 @@
 // timestamp, dump the persisted events, and log all events to EventLog to be
 // uploaded to Android log storage via Tron.
 
+#include <fcntl.h>
 #include <getopt.h>
 #include <sys/klog.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <chrono>
@@ -43,6 +45,7 @@
 #include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <android/log.h>
 #include <cutils/android_reboot.h>
 #include <cutils/properties.h>
@@ -560,11 +563,28 @@ bool isBluntRebootReason(const std::string& r) {
   return true;
 }
 
+// The refinement hints we look for are the last messages the kernel logged
+// before the reboot, so only the tail of large ramoops consoles is inspected.
+constexpr off_t kPstoreConsoleWindow = 256 * 1024;
+
+bool readPstoreConsoleTail(const char* path, std::string& console) {
+  android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC)));
+  if (fd == -1) return false;
+
+  struct stat st;
+  if (fstat(fd.get(), &st) == -1) return false;
+  if ((st.st_size > kPstoreConsoleWindow) &&
+      (lseek(fd.get(), st.st_size - kPstoreConsoleWindow, SEEK_SET) == -1)) {
+    return false;
+  }
+  return android::base::ReadFdToString(fd.get(), &console);
+}
+
 bool readPstoreConsole(std::string& console) {
-  if (android::base::ReadFileToString("/sys/fs/pstore/console-ramoops-0", &console)) {
+  if (readPstoreConsoleTail("/sys/fs/pstore/console-ramoops-0", console)) {
     return true;
   }
-  return android::base::ReadFileToString("/sys/fs/pstore/console-ramoops", &console);
+  return readPstoreConsoleTail("/sys/fs/pstore/console-ramoops", console);
 }
 
 // Implement a variant of std::string::rfind that is resilient to errors in
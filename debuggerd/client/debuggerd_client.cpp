@@ -234,7 +234,13 @@ bool debuggerd_trigger_dump(pid_t tid, DebuggerdDumpType dump_type, unsigned int
 
   // Send the signal.
   const int signal = (dump_type == kDebuggerdJavaBacktrace) ? SIGQUIT : BIONIC_SIGNAL_DEBUGGER;
-  sigval val = {.sival_int = (dump_type == kDebuggerdNativeBacktrace) ? 1 : 0};
+  // See the si_value values in crash_dump.
+  sigval val = {.sival_int = 0};
+  if (dump_type == kDebuggerdNativeBacktrace) {
+    val.sival_int = 1;
+  } else if (dump_type == kDebuggerdNativeBacktraceProto) {
+    val.sival_int = 2;
+  }
   if (sigqueue(pid, signal, val) != 0) {
     log_error(output_fd, errno, "failed to send signal to pid %d", pid);
     return false;
@@ -308,11 +314,16 @@ int dump_backtrace_to_file_timeout(pid_t tid, DebuggerdDumpType dump_type, int t
     return -1;
   }
 
+  int timeout_ms = timeout_secs > 0 ? timeout_secs * 1000 : 0;
+  if (dump_type == kDebuggerdNativeBacktraceProto) {
+    // The output is a single proto, so there's nothing to append to it.
+    return debuggerd_trigger_dump(tid, dump_type, timeout_ms, std::move(copy)) ? 0 : -1;
+  }
+
   // debuggerd_trigger_dump results in every thread in the process being interrupted
   // by a signal, so we need to fetch the wchan data before calling that.
   std::string wchan_data = get_wchan_data(fd, tid);
 
-  int timeout_ms = timeout_secs > 0 ? timeout_secs * 1000 : 0;
   int ret = debuggerd_trigger_dump(tid, dump_type, timeout_ms, std::move(copy)) ? 0 : -1;
 
   // Dump wchan data, since only privileged processes (CAP_SYS_ADMIN) can read
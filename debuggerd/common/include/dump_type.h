@@ -26,6 +26,7 @@ enum DebuggerdDumpType : uint8_t {
   kDebuggerdJavaBacktrace,
   kDebuggerdAnyIntercept,
   kDebuggerdTombstoneProto,
+  kDebuggerdNativeBacktraceProto,
 };
 
 inline std::ostream& operator<<(std::ostream& stream, const DebuggerdDumpType& rhs) {
@@ -45,6 +46,9 @@ inline std::ostream& operator<<(std::ostream& stream, const DebuggerdDumpType& r
     case kDebuggerdTombstoneProto:
       stream << "kDebuggerdTombstoneProto";
       break;
+    case kDebuggerdNativeBacktraceProto:
+      stream << "kDebuggerdNativeBacktraceProto";
+      break;
     default:
       stream << "[unknown]";
   }
@@ -25,6 +25,8 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <limits>
 #include <map>
 #include <memory>
@@ -51,6 +53,7 @@
 #include <utils/Trace.h>
 
 #include <unwindstack/AndroidUnwinder.h>
+#include <unwindstack/Elf.h>
 #include <unwindstack/Error.h>
 #include <unwindstack/Regs.h>
 
@@ -68,6 +71,8 @@ using android::base::ErrnoRestorer;
 using android::base::StringPrintf;
 using android::base::unique_fd;
 
+using namespace std::chrono_literals;
+
 static bool pid_contains_tid(int pid_proc_fd, pid_t tid) {
   struct stat st;
   std::string task_path = StringPrintf("task/%d", tid);
@@ -209,6 +214,7 @@ static bool g_tombstoned_connected = false;
 static unique_fd g_tombstoned_socket;
 static unique_fd g_output_fd;
 static unique_fd g_proto_fd;
+static bool g_text_deferrable = false;
 
 static void DefuseSignalHandlers() {
   // Don't try to dump ourselves.
@@ -271,6 +277,7 @@ static void ParseArgs(int argc, char** argv, pid_t* pseudothread_tid, DebuggerdD
     case kDebuggerdNativeBacktrace:
     case kDebuggerdTombstone:
     case kDebuggerdTombstoneProto:
+    case kDebuggerdNativeBacktraceProto:
       break;
 
     default:
@@ -471,7 +478,11 @@ int main(int argc, char** argv) {
   OpenFilesList open_files;
   {
     ATRACE_NAME("open files");
-    populate_open_files_list(&open_files, g_target_thread);
+    // Processes with tens of thousands of fds can spend seconds here; this lets the list be
+    // capped on devices that run such processes.
+    size_t max_open_files = android::base::GetUintProperty<size_t>(
+        "debug.debuggerd.max_open_files", std::numeric_limits<size_t>::max());
+    populate_open_files_list(&open_files, g_target_thread, max_open_files);
   }
 
   // In order to reduce the duration that we pause the process for, we ptrace
@@ -603,8 +614,9 @@ int main(int argc, char** argv) {
   {
     ATRACE_NAME("tombstoned_connect");
     LOG(INFO) << "obtaining output fd from tombstoned, type: " << dump_type;
-    g_tombstoned_connected = connect_tombstone_server(g_target_thread, &g_tombstoned_socket,
-                                                      &g_output_fd, &g_proto_fd, dump_type);
+    g_tombstoned_connected =
+        connect_tombstone_server(g_target_thread, &g_tombstoned_socket, &g_output_fd, &g_proto_fd,
+                                 dump_type, &g_text_deferrable);
   }
 
   if (g_tombstoned_connected) {
@@ -623,16 +635,20 @@ int main(int argc, char** argv) {
   int signo = siginfo.si_signo;
   bool fatal_signal = signo != BIONIC_SIGNAL_DEBUGGER;
   bool backtrace = false;
+  bool backtrace_proto = false;
 
   // si_value is special when used with BIONIC_SIGNAL_DEBUGGER.
   //   0: dump tombstone
   //   1: dump backtrace
+  //   2: dump backtrace proto
   if (!fatal_signal) {
     int si_val = siginfo.si_value.sival_int;
     if (si_val == 0) {
       backtrace = false;
     } else if (si_val == 1) {
       backtrace = true;
+    } else if (si_val == 2) {
+      backtrace_proto = true;
     } else {
       LOG(WARNING) << "unknown si_value value " << si_val;
     }
@@ -640,6 +656,11 @@ int main(int argc, char** argv) {
 
   // TODO: Use seccomp to lock ourselves down.
 
+  // Libraries are usually mapped several times (one map per segment), and
+  // every thread of a big process goes through the same few of them. Parse
+  // each file's unwind info and symbol tables once, not once per map.
+  unwindstack::Elf::SetCachingEnabled(true);
+
   unwindstack::AndroidRemoteUnwinder unwinder(vm_pid, unwindstack::Regs::CurrentArch());
   unwindstack::ErrorData error_data;
   if (!unwinder.Initialize(error_data)) {
@@ -647,10 +668,26 @@ int main(int argc, char** argv) {
                << unwindstack::GetErrorCodeString(error_data.code);
   }
 
+  // The unwinder reads from the snapshot in vm_pid through a per-thread
+  // memory cache, so big processes can be unwound on several threads at once.
+  // Stop unwinding well before the alarm above, so that a tombstone with
+  // whatever was unwound still gets written.
+  UnwindOptions unwind_options;
+  unwind_options.max_workers = std::clamp(sysconf(_SC_NPROCESSORS_ONLN), 1L, 4L);
+  unwind_options.time_budget = 10s * android::base::HwTimeoutMultiplier();
+
+  // When tombstoned renders the text tombstone from the proto, the process
+  // isn't kept waiting while every thread's backtrace is formatted.
+  bool text_deferred = false;
   std::string amfd_data;
   if (backtrace) {
     ATRACE_NAME("dump_backtrace");
-    dump_backtrace(std::move(g_output_fd), &unwinder, thread_info, g_target_thread);
+    dump_backtrace(std::move(g_output_fd), &unwinder, thread_info, g_target_thread,
+                   unwind_options);
+  } else if (backtrace_proto) {
+    ATRACE_NAME("dump_backtrace_proto");
+    dump_backtrace_proto(std::move(g_output_fd), &unwinder, thread_info, g_target_thread,
+                         unwind_options);
   } else {
     {
       ATRACE_NAME("fdsan table dump");
@@ -660,8 +697,10 @@ int main(int argc, char** argv) {
 
     {
       ATRACE_NAME("engrave_tombstone");
+      text_deferred = g_text_deferrable && g_proto_fd != -1;
       engrave_tombstone(std::move(g_output_fd), std::move(g_proto_fd), &unwinder, thread_info,
-                        g_target_thread, process_info, &open_files, &amfd_data);
+                        g_target_thread, process_info, &open_files, &amfd_data, unwind_options,
+                        !text_deferred);
     }
   }
 
@@ -688,7 +727,8 @@ int main(int argc, char** argv) {
   // Close stdout before we notify tombstoned of completion.
   close(STDOUT_FILENO);
   if (g_tombstoned_connected &&
-      !notify_completion(g_tombstoned_socket.get(), g_output_fd.get(), g_proto_fd.get())) {
+      !notify_completion(g_tombstoned_socket.get(), g_output_fd.get(), g_proto_fd.get(),
+                         text_deferred)) {
     LOG(ERROR) << "failed to notify tombstoned of completion";
   }
 
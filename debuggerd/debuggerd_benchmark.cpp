@@ -21,8 +21,10 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <chrono>
 #include <thread>
+#include <vector>
 
 #include <benchmark/benchmark.h>
 #include <debuggerd/client.h>
@@ -63,7 +65,7 @@ static std::chrono::duration<double> GetMaximumPause(std::atomic<ThreadState>& s
   return max_diff;
 }
 
-static void PerformDump() {
+static void PerformDump(DebuggerdDumpType dump_type = kDebuggerdNativeBacktrace) {
   pid_t target = getpid();
   pid_t forkpid = fork();
   if (forkpid == -1) {
@@ -84,7 +86,7 @@ static void PerformDump() {
       err(1, "failed to open /dev/null");
     }
 
-    if (!debuggerd_trigger_dump(target, kDebuggerdNativeBacktrace, 1000, std::move(output_fd))) {
+    if (!debuggerd_trigger_dump(target, dump_type, 10000, std::move(output_fd))) {
       errx(1, "failed to trigger dump");
     }
 
@@ -122,7 +124,50 @@ static void BM_maximum_pause_debuggerd(benchmark::State& state) {
   BM_maximum_pause_impl(state, []() { PerformDump(); });
 }
 
+// Dumps the process while state.range(0) extra threads are alive, since the
+// time spent unwinding grows with the number of threads.
+static void BM_dump_many_threads_impl(benchmark::State& state, DebuggerdDumpType dump_type) {
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> threads;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    threads.emplace_back([&stop]() {
+      while (!stop) {
+        std::this_thread::sleep_for(10ms);
+      }
+    });
+  }
+
+  for (auto _ : state) {
+    PerformDump(dump_type);
+  }
+
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+static void BM_backtrace_many_threads(benchmark::State& state) {
+  BM_dump_many_threads_impl(state, kDebuggerdNativeBacktrace);
+}
+
+static void BM_tombstone_many_threads(benchmark::State& state) {
+  BM_dump_many_threads_impl(state, kDebuggerdTombstone);
+}
+
 BENCHMARK(BM_maximum_pause_noop)->Iterations(128)->UseManualTime();
 BENCHMARK(BM_maximum_pause_debuggerd)->Iterations(128)->UseManualTime();
+BENCHMARK(BM_backtrace_many_threads)
+    ->Arg(1)
+    ->Arg(64)
+    ->Arg(256)
+    ->Iterations(8)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_tombstone_many_threads)
+    ->Arg(1)
+    ->Arg(64)
+    ->Arg(256)
+    ->Iterations(8)
+    ->Unit(benchmark::kMillisecond);
 
 BENCHMARK_MAIN();
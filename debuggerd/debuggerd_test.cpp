@@ -31,6 +31,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <regex>
 #include <set>
@@ -72,6 +73,8 @@
 #include "tombstoned/tombstoned.h"
 #include "util.h"
 
+#include "tombstone.pb.h"
+
 using namespace std::chrono_literals;
 
 using android::base::SendFileDescriptors;
@@ -1087,6 +1090,46 @@ TEST_F(CrasherTest, backtrace) {
   ASSERT_BACKTRACE_FRAME(result, "abort");
 }
 
+TEST_F(CrasherTest, backtrace_proto) {
+  std::string result;
+  int intercept_result;
+  unique_fd output_fd;
+
+  StartProcess([]() {
+    abort();
+  });
+  StartIntercept(&output_fd, kDebuggerdNativeBacktraceProto);
+
+  std::this_thread::sleep_for(500ms);
+
+  sigval val;
+  val.sival_int = 2;
+  ASSERT_EQ(0, sigqueue(crasher_pid, BIONIC_SIGNAL_DEBUGGER, val)) << strerror(errno);
+  FinishIntercept(&intercept_result);
+  ASSERT_EQ(1, intercept_result) << "tombstoned reported failure";
+  ConsumeFd(std::move(output_fd), &result);
+
+  BacktraceSample sample;
+  ASSERT_TRUE(sample.ParseFromString(result));
+  ASSERT_EQ(static_cast<uint32_t>(crasher_pid), sample.pid());
+  ASSERT_EQ(1U, sample.threads().count(crasher_pid));
+  for (const auto& [tid, thread] : sample.threads()) {
+    ASSERT_EQ(static_cast<int32_t>(tid), thread.id());
+    ASSERT_FALSE(thread.current_backtrace().empty()) << "tid " << tid;
+    for (const auto& frame : thread.current_backtrace()) {
+      // Symbolization is left to the caller.
+      ASSERT_TRUE(frame.function_name().empty());
+    }
+    ASSERT_FALSE(thread.current_backtrace(0).build_id().empty()) << "tid " << tid;
+  }
+
+  StartIntercept(&output_fd);
+  FinishCrasher();
+  AssertDeath(SIGABRT);
+  FinishIntercept(&intercept_result);
+  ASSERT_EQ(1, intercept_result) << "tombstoned reported failure";
+}
+
 TEST_F(CrasherTest, PR_SET_DUMPABLE_0_crash) {
   int intercept_result;
   unique_fd output_fd;
@@ -1335,12 +1378,21 @@ __attribute__((__noinline__)) extern "C" bool raise_debugger_signal(DebuggerdDum
   siginfo.si_pid = getpid();
   siginfo.si_uid = getuid();
 
-  if (dump_type != kDebuggerdNativeBacktrace && dump_type != kDebuggerdTombstone) {
-    PLOG(FATAL) << "invalid dump type";
+  // See the si_value values in crash_dump.
+  switch (dump_type) {
+    case kDebuggerdTombstone:
+      siginfo.si_value.sival_int = 0;
+      break;
+    case kDebuggerdNativeBacktrace:
+      siginfo.si_value.sival_int = 1;
+      break;
+    case kDebuggerdNativeBacktraceProto:
+      siginfo.si_value.sival_int = 2;
+      break;
+    default:
+      PLOG(FATAL) << "invalid dump type";
   }
 
-  siginfo.si_value.sival_int = dump_type == kDebuggerdNativeBacktrace;
-
   if (syscall(__NR_rt_tgsigqueueinfo, getpid(), gettid(), BIONIC_SIGNAL_DEBUGGER, &siginfo) != 0) {
     PLOG(ERROR) << "libdebuggerd_client: failed to send signal to self";
     return false;
@@ -1473,6 +1525,44 @@ TEST_F(CrasherTest, seccomp_backtrace) {
   ASSERT_BACKTRACE_FRAME(result, "bar");
 }
 
+TEST_F(CrasherTest, seccomp_backtrace_proto) {
+  int intercept_result;
+  unique_fd output_fd;
+
+  static const auto dump_type = kDebuggerdNativeBacktraceProto;
+  StartProcess(
+      []() {
+        std::thread a(foo);
+        std::thread b(bar);
+
+        std::this_thread::sleep_for(100ms);
+
+        raise_debugger_signal(dump_type);
+        _exit(0);
+      },
+      &seccomp_fork);
+
+  StartIntercept(&output_fd, dump_type);
+  FinishCrasher();
+  AssertDeath(0);
+  FinishIntercept(&intercept_result);
+  ASSERT_EQ(1, intercept_result) << "tombstoned reported failure";
+
+  std::string result;
+  ConsumeFd(std::move(output_fd), &result);
+
+  // One sample per thread, which parse as a single sample of the three threads.
+  BacktraceSample sample;
+  ASSERT_TRUE(sample.ParseFromString(result));
+  ASSERT_EQ(static_cast<uint32_t>(crasher_pid), sample.pid());
+  ASSERT_EQ(3U, sample.threads().size());
+  ASSERT_EQ(1U, sample.threads().count(crasher_pid));
+  for (const auto& [tid, thread] : sample.threads()) {
+    ASSERT_EQ(static_cast<int32_t>(tid), thread.id());
+    ASSERT_FALSE(thread.current_backtrace().empty()) << "tid " << tid;
+  }
+}
+
 TEST_F(CrasherTest, seccomp_backtrace_from_thread) {
   int intercept_result;
   unique_fd output_fd;
@@ -2094,27 +2184,12 @@ TEST_F(CrasherTest, unreadable_elf) {
   ASSERT_MATCH(result, match_str);
 }
 
-TEST(tombstoned, proto) {
-  const pid_t self = getpid();
-  unique_fd tombstoned_socket, text_fd, proto_fd;
-  ASSERT_TRUE(
-      tombstoned_connect(self, &tombstoned_socket, &text_fd, &proto_fd, kDebuggerdTombstoneProto));
-
-  tombstoned_notify_completion(tombstoned_socket.get());
-
-  ASSERT_NE(-1, text_fd.get());
-  ASSERT_NE(-1, proto_fd.get());
-
-  struct stat text_st;
-  ASSERT_EQ(0, fstat(text_fd.get(), &text_st));
-
-  // Give tombstoned some time to link the files into place.
-  std::this_thread::sleep_for(100ms);
-
-  // Find the tombstone.
-  std::optional<std::string> tombstone_file;
+// Finds the tombstone in /data/tombstones that is the same file as text_st.
+static std::optional<std::string> FindTombstoneFile(const struct stat& text_st) {
   std::unique_ptr<DIR, decltype(&closedir)> dir_h(opendir("/data/tombstones"), closedir);
-  ASSERT_TRUE(dir_h != nullptr);
+  if (dir_h == nullptr) {
+    return {};
+  }
   std::regex tombstone_re("tombstone_\\d+");
   dirent* entry;
   while ((entry = readdir(dir_h.get())) != nullptr) {
@@ -2129,11 +2204,30 @@ TEST(tombstoned, proto) {
     }
 
     if (st.st_dev == text_st.st_dev && st.st_ino == text_st.st_ino) {
-      tombstone_file = path;
-      break;
+      return path;
     }
   }
+  return {};
+}
 
+TEST(tombstoned, proto) {
+  const pid_t self = getpid();
+  unique_fd tombstoned_socket, text_fd, proto_fd;
+  ASSERT_TRUE(
+      tombstoned_connect(self, &tombstoned_socket, &text_fd, &proto_fd, kDebuggerdTombstoneProto));
+
+  tombstoned_notify_completion(tombstoned_socket.get());
+
+  ASSERT_NE(-1, text_fd.get());
+  ASSERT_NE(-1, proto_fd.get());
+
+  struct stat text_st;
+  ASSERT_EQ(0, fstat(text_fd.get(), &text_st));
+
+  // Give tombstoned some time to link the files into place.
+  std::this_thread::sleep_for(100ms);
+
+  std::optional<std::string> tombstone_file = FindTombstoneFile(text_st);
   ASSERT_TRUE(tombstone_file);
   std::string proto_path = tombstone_file.value() + ".pb";
 
@@ -2146,6 +2240,47 @@ TEST(tombstoned, proto) {
   ASSERT_EQ(proto_fd_st.st_ino, proto_file_st.st_ino);
 }
 
+// tombstoned renders the text tombstone from the proto when crash_dump leaves it
+// to it, using the libdebuggerd it links in.
+TEST(tombstoned, proto_deferred_text) {
+  const pid_t self = getpid();
+  unique_fd tombstoned_socket, text_fd, proto_fd;
+  bool text_deferrable = false;
+  ASSERT_TRUE(tombstoned_connect(self, &tombstoned_socket, &text_fd, &proto_fd,
+                                 kDebuggerdTombstoneProto, &text_deferrable));
+  if (!text_deferrable) {
+    GTEST_SKIP() << "tombstoned.defer_text_tombstones is disabled";
+  }
+
+  Tombstone tombstone;
+  tombstone.set_build_fingerprint("deferred_text_fingerprint");
+  tombstone.set_pid(self);
+  tombstone.set_tid(self);
+  Thread thread;
+  thread.set_id(self);
+  thread.set_name("deferred_text");
+  (*tombstone.mutable_threads())[self] = thread;
+  ASSERT_TRUE(tombstone.SerializeToFileDescriptor(proto_fd.get()));
+  tombstoned_notify_completion(tombstoned_socket.get(), true);
+
+  struct stat text_st;
+  ASSERT_EQ(0, fstat(text_fd.get(), &text_st));
+
+  // The text is rendered before the files are linked into place.
+  std::optional<std::string> tombstone_file;
+  for (int i = 0; i < 50 && !tombstone_file; i++) {
+    std::this_thread::sleep_for(100ms);
+    tombstone_file = FindTombstoneFile(text_st);
+  }
+  ASSERT_TRUE(tombstone_file);
+
+  std::string text;
+  ASSERT_TRUE(android::base::ReadFileToString(tombstone_file.value(), &text));
+  ASSERT_THAT(text, HasSubstr("Build fingerprint: 'deferred_text_fingerprint'"));
+  ASSERT_THAT(text, HasSubstr(android::base::StringPrintf("pid: %d, tid: %d, name: deferred_text",
+                                                          self, self)));
+}
+
 TEST(tombstoned, proto_intercept) {
   const pid_t self = getpid();
   unique_fd intercept_fd, output_fd;
@@ -2193,6 +2328,45 @@ TEST_F(CrasherTest, intercept_for_main_thread_signal_on_side_thread) {
   ASSERT_BACKTRACE_FRAME(result, "raise_debugger_signal");
 }
 
+// All the threads of a big process get a backtrace, even though crash_dump
+// spreads the unwinding over several workers.
+TEST_F(CrasherTest, backtrace_many_threads) {
+  static constexpr size_t kThreadCount = 64;
+  StartProcess([]() {
+    for (size_t i = 0; i < kThreadCount; ++i) {
+      std::thread([]() {
+        while (true) {
+          pause();
+        }
+      }).detach();
+    }
+    raise_debugger_signal(kDebuggerdNativeBacktrace);
+    _exit(0);
+  });
+
+  unique_fd output_fd;
+  StartIntercept(&output_fd, kDebuggerdNativeBacktrace);
+  FinishCrasher();
+  AssertDeath(0);
+
+  int intercept_result;
+  FinishIntercept(&intercept_result);
+  ASSERT_EQ(1, intercept_result) << "tombstoned reported failure";
+
+  std::string result;
+  ConsumeFd(std::move(output_fd), &result);
+  std::vector<std::string> lines = android::base::Split(result, "\n");
+  size_t threads = std::count_if(lines.begin(), lines.end(), [](const std::string& line) {
+    return line.find("sysTid=") != std::string::npos;
+  });
+  size_t backtraces = std::count_if(lines.begin(), lines.end(), [](const std::string& line) {
+    return android::base::StartsWith(line, "  #00 pc ");
+  });
+  ASSERT_EQ(kThreadCount + 1, threads) << result;
+  ASSERT_EQ(kThreadCount + 1, backtraces) << result;
+  ASSERT_BACKTRACE_FRAME(result, "raise_debugger_signal");
+}
+
 static std::string format_pointer(uintptr_t ptr) {
 #if defined(__LP64__)
   return android::base::StringPrintf("%08x'%08x", static_cast<uint32_t>(ptr >> 32),
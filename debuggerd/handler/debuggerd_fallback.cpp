@@ -54,7 +54,8 @@ extern "C" void __linker_disable_fallback_allocator();
 //
 // This isn't the default method of dumping because it can fail in cases such as address space
 // exhaustion.
-static void debuggerd_fallback_trace(int output_fd, ucontext_t* ucontext) {
+static void debuggerd_fallback_trace(int output_fd, ucontext_t* ucontext,
+                                     DebuggerdDumpType dump_type) {
   if (!__linker_enable_fallback_allocator()) {
     async_safe_format_log(ANDROID_LOG_ERROR, "libc", "fallback allocator already in use");
     return;
@@ -77,7 +78,11 @@ static void debuggerd_fallback_trace(int output_fd, ucontext_t* ucontext) {
     auto process_memory = unwindstack::Memory::CreateProcessMemoryCached(getpid());
     // TODO: Create this once and store it in a global?
     unwindstack::AndroidLocalUnwinder unwinder(process_memory);
-    dump_backtrace_thread(output_fd, &unwinder, thread);
+    if (dump_type == kDebuggerdNativeBacktraceProto) {
+      dump_backtrace_thread_proto(output_fd, &unwinder, std::move(thread));
+    } else {
+      dump_backtrace_thread(output_fd, &unwinder, thread);
+    }
   }
   __linker_disable_fallback_allocator();
 }
@@ -155,6 +160,8 @@ static std::pair<pid_t, int> unpack_thread_fd(uint64_t value) {
 
 static void trace_handler(siginfo_t* info, ucontext_t* ucontext) {
   static std::atomic<uint64_t> trace_output(pack_thread_fd(-1, -1));
+  // Set by the thread that received the request, before it asks its siblings to dump.
+  static std::atomic<DebuggerdDumpType> trace_dump_type(kDebuggerdNativeBacktrace);
 
   if (info->si_value.sival_ptr == kDebuggerdFallbackSivalPtrRequestDump) {
     // Asked to dump by the original signal recipient.
@@ -176,7 +183,7 @@ static void trace_handler(siginfo_t* info, ucontext_t* ucontext) {
 
     // Write our tid to the output fd to let the main thread know that we're working.
     if (TEMP_FAILURE_RETRY(write(fd, &tid, sizeof(tid))) == sizeof(tid)) {
-      debuggerd_fallback_trace(fd, ucontext);
+      debuggerd_fallback_trace(fd, ucontext, trace_dump_type.load());
     } else {
       async_safe_format_log(ANDROID_LOG_ERROR, "libc", "failed to write to output fd");
     }
@@ -194,19 +201,28 @@ static void trace_handler(siginfo_t* info, ucontext_t* ucontext) {
 
   std::lock_guard<std::mutex> scoped_lock(trace_mutex, std::adopt_lock);
 
+  // See the si_value values in crash_dump.
+  const DebuggerdDumpType dump_type = info->si_value.sival_int == 2
+                                          ? kDebuggerdNativeBacktraceProto
+                                          : kDebuggerdNativeBacktrace;
+  trace_dump_type.store(dump_type);
+
   // Fetch output fd from tombstoned.
   unique_fd tombstone_socket, output_fd;
-  if (!tombstoned_connect(getpid(), &tombstone_socket, &output_fd, nullptr,
-                          kDebuggerdNativeBacktrace)) {
+  if (!tombstoned_connect(getpid(), &tombstone_socket, &output_fd, nullptr, dump_type)) {
     async_safe_format_log(ANDROID_LOG_ERROR, "libc",
                           "missing crash_dump_fallback() in selinux policy?");
     return;
   }
 
-  dump_backtrace_header(output_fd.get());
+  // Each thread writes a sample of its own stack, and the samples concatenate into one.
+  const bool proto = dump_type == kDebuggerdNativeBacktraceProto;
+  if (!proto) {
+    dump_backtrace_header(output_fd.get());
+  }
 
   // Dump our own stack.
-  debuggerd_fallback_trace(output_fd.get(), ucontext);
+  debuggerd_fallback_trace(output_fd.get(), ucontext, dump_type);
 
   // Send a signal to all of our siblings, asking them to dump their stack.
   pid_t current_tid = gettid();
@@ -267,7 +283,9 @@ static void trace_handler(siginfo_t* info, ucontext_t* ucontext) {
                           current_tid, strerror(errno));
   }
 
-  dump_backtrace_footer(output_fd.get());
+  if (!proto) {
+    dump_backtrace_footer(output_fd.get());
+  }
   tombstoned_notify_completion(tombstone_socket.get());
 }
 
@@ -332,7 +332,8 @@ static void* pseudothread_stack;
 static DebuggerdDumpType get_dump_type(const debugger_thread_info* thread_info) {
   if (thread_info->siginfo->si_signo == BIONIC_SIGNAL_DEBUGGER &&
       thread_info->siginfo->si_value.sival_int) {
-    return kDebuggerdNativeBacktrace;
+    return thread_info->siginfo->si_value.sival_int == 2 ? kDebuggerdNativeBacktraceProto
+                                                          : kDebuggerdNativeBacktrace;
   }
 
   return kDebuggerdTombstoneProto;
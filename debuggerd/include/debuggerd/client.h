@@ -26,6 +26,10 @@
 
 // Trigger a dump of specified process to output_fd.
 // output_fd is consumed, timeout of 0 will wait forever.
+// kDebuggerdNativeBacktraceProto writes a serialized BacktraceSample (see
+// tombstone.proto): the pcs and build ids of the frames of every thread, for
+// symbolizing offline. It is much cheaper than kDebuggerdNativeBacktrace, and
+// meant for callers that sample stacks often.
 bool debuggerd_trigger_dump(pid_t pid, enum DebuggerdDumpType dump_type, unsigned int timeout_ms,
                             android::base::unique_fd output_fd);
 
@@ -33,6 +33,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
@@ -40,10 +41,13 @@
 #include <unwindstack/AndroidUnwinder.h>
 #include <unwindstack/Unwinder.h>
 
+#include "libdebuggerd/tombstone.h"
 #include "libdebuggerd/types.h"
 #include "libdebuggerd/utility.h"
 #include "util.h"
 
+#include "tombstone.pb.h"
+
 static void dump_process_header(log_t* log, pid_t pid,
                                 const std::vector<std::string>& command_line) {
   _LOG(log, logtype::BACKTRACE, "\n\n----- pid %d at %s -----\n", pid, get_timestamp().c_str());
@@ -58,26 +62,53 @@ static void dump_process_footer(log_t* log, pid_t pid) {
   _LOG(log, logtype::BACKTRACE, "\n----- end %d -----\n", pid);
 }
 
+static void log_thread_backtrace(log_t* log, unwindstack::AndroidUnwinder* unwinder,
+                                 const ThreadInfo& thread, UnwindResult unwind_result,
+                                 unwindstack::AndroidUnwinderData& data) {
+  _LOG(log, logtype::BACKTRACE, "\n\"%s\" sysTid=%d\n", thread.thread_name.c_str(), thread.tid);
+
+  switch (unwind_result) {
+    case UnwindResult::kUnwound:
+      log_backtrace(log, unwinder, data, "  ");
+      break;
+    case UnwindResult::kFailed:
+      _LOG(log, logtype::THREAD, "Unwind failed: tid = %d: Error %s\n", thread.tid,
+           data.GetErrorString().c_str());
+      break;
+    case UnwindResult::kSkipped:
+      _LOG(log, logtype::THREAD, "Not unwound: tid = %d: out of time\n", thread.tid);
+      break;
+  }
+}
+
 void dump_backtrace_thread(int output_fd, unwindstack::AndroidUnwinder* unwinder,
                            const ThreadInfo& thread) {
   log_t log;
   log.tfd = output_fd;
   log.amfd_data = nullptr;
 
-  _LOG(&log, logtype::BACKTRACE, "\n\"%s\" sysTid=%d\n", thread.thread_name.c_str(), thread.tid);
-
   unwindstack::AndroidUnwinderData data;
-  if (!unwinder->Unwind(thread.registers.get(), data)) {
-    _LOG(&log, logtype::THREAD, "Unwind failed: tid = %d: Error %s\n", thread.tid,
-         data.GetErrorString().c_str());
-    return;
-  }
+  UnwindResult result = unwinder->Unwind(thread.registers.get(), data) ? UnwindResult::kUnwound
+                                                                       : UnwindResult::kFailed;
+  log_thread_backtrace(&log, unwinder, thread, result, data);
+}
+
+void dump_backtrace_thread_proto(int output_fd, unwindstack::AndroidUnwinder* unwinder,
+                                 ThreadInfo thread) {
+  pid_t tid = thread.tid;
+  std::map<pid_t, ThreadInfo> threads;
+  threads.emplace(tid, std::move(thread));
 
-  log_backtrace(&log, unwinder, data, "  ");
+  BacktraceSample sample;
+  engrave_backtrace_sample_proto(&sample, unwinder, threads, tid);
+  if (!sample.SerializeToFileDescriptor(output_fd)) {
+    ALOGE("failed to write backtrace proto: %s", strerror(errno));
+  }
 }
 
 void dump_backtrace(android::base::unique_fd output_fd, unwindstack::AndroidUnwinder* unwinder,
-                    const std::map<pid_t, ThreadInfo>& thread_info, pid_t target_thread) {
+                    const std::map<pid_t, ThreadInfo>& thread_info, pid_t target_thread,
+                    const UnwindOptions& unwind_options) {
   log_t log;
   log.tfd = output_fd.get();
   log.amfd_data = nullptr;
@@ -90,16 +121,37 @@ void dump_backtrace(android::base::unique_fd output_fd, unwindstack::AndroidUnwi
 
   dump_process_header(&log, target->second.pid, target->second.command_line);
 
-  dump_backtrace_thread(output_fd.get(), unwinder, target->second);
+  std::vector<const ThreadInfo*> threads = {&target->second};
   for (const auto& [tid, info] : thread_info) {
     if (tid != target_thread) {
-      dump_backtrace_thread(output_fd.get(), unwinder, info);
+      threads.push_back(&info);
     }
   }
+  std::vector<unwindstack::AndroidUnwinderData> unwinds(threads.size());
+  std::vector<UnwindResult> results = unwind_threads(unwinder, threads, &unwinds, unwind_options);
+  for (size_t i = 0; i < threads.size(); ++i) {
+    log_thread_backtrace(&log, unwinder, *threads[i], results[i], unwinds[i]);
+  }
 
   dump_process_footer(&log, target->second.pid);
 }
 
+void dump_backtrace_proto(android::base::unique_fd output_fd,
+                          unwindstack::AndroidUnwinder* unwinder,
+                          const std::map<pid_t, ThreadInfo>& thread_info, pid_t target_thread,
+                          const UnwindOptions& unwind_options) {
+  if (thread_info.find(target_thread) == thread_info.end()) {
+    ALOGE("failed to find target thread in thread info");
+    return;
+  }
+
+  BacktraceSample sample;
+  engrave_backtrace_sample_proto(&sample, unwinder, thread_info, target_thread, unwind_options);
+  if (!sample.SerializeToFileDescriptor(output_fd.get())) {
+    ALOGE("failed to write backtrace proto: %s", strerror(errno));
+  }
+}
+
 void dump_backtrace_header(int output_fd) {
   log_t log;
   log.tfd = output_fd;
@@ -18,6 +18,8 @@
 #include "libdebuggerd/tombstone.h"
 #include "libdebuggerd/utility.h"
 
+#include <sys/mman.h>
+
 #include "gwp_asan/common.h"
 #include "gwp_asan/crash_handler.h"
 
@@ -34,17 +36,23 @@ static bool retrieve_gwp_asan_state(unwindstack::Memory* process_memory, uintptr
   return process_memory->ReadFully(state_addr, state, sizeof(*state));
 }
 
-// Retrieve the GWP-ASan metadata pool from `metadata_addr` inside the process
-// at `process_memory`. The number of metadata slots is retrieved from the
-// allocator state provided. This function returns a heap-allocated copy of the
-// metadata pool whose ownership should be managed by the caller. Returns
-// nullptr on failure.
-static const gwp_asan::AllocationMetadata* retrieve_gwp_asan_metadata(
-    unwindstack::Memory* process_memory, const gwp_asan::AllocatorState& state,
-    uintptr_t metadata_addr) {
-  // 1 million GWP-ASan slots would take 4.1GiB of space. Thankfully, copying
-  // the metadata for that amount of slots is only 532MiB, and this really will
-  // only be used with some ridiculous torture-tests.
+void GwpAsanCrashData::MetadataUnmapper::operator()(gwp_asan::AllocationMetadata* meta) const {
+  munmap(meta, size);
+}
+
+// Retrieve the GWP-ASan metadata for the slot nearest to `crash_address`. Only
+// that slot is copied out of the process at `process_memory`, as it is all the
+// GWP-ASan crash handler looks at. It is placed at its own index in a
+// zero-filled mapping the size of the whole pool, so that the crash handler can
+// index it like the original. Only the pages touched take up memory. This
+// function returns nullptr on failure.
+std::unique_ptr<gwp_asan::AllocationMetadata[], GwpAsanCrashData::MetadataUnmapper>
+GwpAsanCrashData::RetrieveMetadata(unwindstack::Memory* process_memory,
+                                   const gwp_asan::AllocatorState& state,
+                                   uintptr_t metadata_addr, uintptr_t crash_address) {
+  // 1 million GWP-ASan slots would take 4.1GiB of space, and their metadata
+  // 532MiB. Only one slot is read, but keep the limit as a sanity check on
+  // the state.
   if (state.MaxSimultaneousAllocations > 1000000) {
     ALOGE(
         "Error when retrieving GWP-ASan metadata, MSA from state (%zu) "
@@ -53,16 +61,25 @@ static const gwp_asan::AllocationMetadata* retrieve_gwp_asan_metadata(
     return nullptr;
   }
 
-  gwp_asan::AllocationMetadata* meta =
-      new gwp_asan::AllocationMetadata[state.MaxSimultaneousAllocations];
-  if (!process_memory->ReadFully(metadata_addr, meta,
-                                 sizeof(*meta) * state.MaxSimultaneousAllocations)) {
-    ALOGE(
-        "Error when retrieving GWP-ASan metadata, could not retrieve %zu "
-        "pieces of metadata.",
-        state.MaxSimultaneousAllocations);
-    delete[] meta;
-    meta = nullptr;
+  size_t slot = state.getNearestSlot(crash_address);
+  if (slot >= state.MaxSimultaneousAllocations) {
+    ALOGE("Error when retrieving GWP-ASan metadata, slot %zu is out of range.", slot);
+    return nullptr;
+  }
+
+  size_t size = sizeof(gwp_asan::AllocationMetadata) * state.MaxSimultaneousAllocations;
+  void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    ALOGE("Error when retrieving GWP-ASan metadata, could not map %zu bytes.", size);
+    return nullptr;
+  }
+  std::unique_ptr<gwp_asan::AllocationMetadata[], MetadataUnmapper> meta(
+      static_cast<gwp_asan::AllocationMetadata*>(map), MetadataUnmapper{size});
+
+  if (!process_memory->ReadFully(metadata_addr + slot * sizeof(gwp_asan::AllocationMetadata),
+                                 &meta[slot], sizeof(gwp_asan::AllocationMetadata))) {
+    ALOGE("Error when retrieving GWP-ASan metadata, could not retrieve slot %zu.", slot);
+    return nullptr;
   }
   return meta;
 }
@@ -70,10 +87,8 @@ static const gwp_asan::AllocationMetadata* retrieve_gwp_asan_metadata(
 GwpAsanCrashData::GwpAsanCrashData(unwindstack::Memory* process_memory,
                                    const ProcessInfo& process_info, const ThreadInfo& thread_info) {
   if (!process_memory || !process_info.gwp_asan_metadata || !process_info.gwp_asan_state) return;
-  // Extract the GWP-ASan regions from the dead process.
+  // Extract the GWP-ASan state from the dead process.
   if (!retrieve_gwp_asan_state(process_memory, process_info.gwp_asan_state, &state_)) return;
-  metadata_.reset(retrieve_gwp_asan_metadata(process_memory, state_, process_info.gwp_asan_metadata));
-  if (!metadata_.get()) return;
 
   // Get the external crash address from the thread info.
   crash_address_ = 0u;
@@ -81,18 +96,23 @@ GwpAsanCrashData::GwpAsanCrashData(unwindstack::Memory* process_memory,
     crash_address_ = process_info.untagged_fault_address;
   }
 
-  // Ensure the error belongs to GWP-ASan.
+  // Ensure the error belongs to GWP-ASan. This only needs the state, so most
+  // crashes never read any metadata.
   if (!__gwp_asan_error_is_mine(&state_, crash_address_)) return;
 
-  is_gwp_asan_responsible_ = true;
-  thread_id_ = thread_info.tid;
-
   // Grab the internal error address, if it exists.
   uintptr_t internal_crash_address = __gwp_asan_get_internal_crash_address(&state_, crash_address_);
   if (internal_crash_address) {
     crash_address_ = internal_crash_address;
   }
 
+  metadata_ = RetrieveMetadata(process_memory, state_, process_info.gwp_asan_metadata,
+                               crash_address_);
+  if (!metadata_) return;
+
+  is_gwp_asan_responsible_ = true;
+  thread_id_ = thread_info.tid;
+
   // Get other information from the internal state.
   error_ = __gwp_asan_diagnose_error(&state_, metadata_.get(), crash_address_);
   error_string_ = gwp_asan::ErrorToString(error_);
@@ -36,11 +36,23 @@ class AndroidUnwinder;
 // Dumps a backtrace using a format similar to what Dalvik uses so that the result
 // can be intermixed in a bug report.
 void dump_backtrace(android::base::unique_fd output_fd, unwindstack::AndroidUnwinder* unwinder,
-                    const std::map<pid_t, ThreadInfo>& thread_info, pid_t target_thread);
+                    const std::map<pid_t, ThreadInfo>& thread_info, pid_t target_thread,
+                    const UnwindOptions& unwind_options = {});
+
+// Writes a BacktraceSample proto of all the threads instead, for
+// kDebuggerdNativeBacktraceProto requests.
+void dump_backtrace_proto(android::base::unique_fd output_fd,
+                          unwindstack::AndroidUnwinder* unwinder,
+                          const std::map<pid_t, ThreadInfo>& thread_info, pid_t target_thread,
+                          const UnwindOptions& unwind_options = {});
 
 void dump_backtrace_header(int output_fd);
 void dump_backtrace_thread(int output_fd, unwindstack::AndroidUnwinder* unwinder,
                            const ThreadInfo& thread);
+// Writes a BacktraceSample proto of |thread| alone. Samples written one after
+// the other parse as a single sample of all of their threads.
+void dump_backtrace_thread_proto(int output_fd, unwindstack::AndroidUnwinder* unwinder,
+                                 ThreadInfo thread);
 void dump_backtrace_footer(int output_fd);
 
 #endif // _DEBUGGERD_BACKTRACE_H
@@ -80,7 +80,17 @@ class GwpAsanCrashData {
   // doesn't exist.
   const gwp_asan::AllocationMetadata* responsible_allocation_ = nullptr;
 
+  struct MetadataUnmapper {
+    size_t size = 0;
+    void operator()(gwp_asan::AllocationMetadata* meta) const;
+  };
+
+  static std::unique_ptr<gwp_asan::AllocationMetadata[], MetadataUnmapper> RetrieveMetadata(
+      unwindstack::Memory* process_memory, const gwp_asan::AllocatorState& state,
+      uintptr_t metadata_addr, uintptr_t crash_address);
+
   // Internal state.
   gwp_asan::AllocatorState state_;
-  std::unique_ptr<const gwp_asan::AllocationMetadata> metadata_;
+  // Only the slot of crash_address_ is filled in.
+  std::unique_ptr<gwp_asan::AllocationMetadata[], MetadataUnmapper> metadata_;
 };
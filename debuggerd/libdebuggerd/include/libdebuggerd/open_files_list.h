@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <limits>
 #include <map>
 #include <optional>
 #include <string>
@@ -33,8 +34,9 @@ struct FDInfo {
 
 using OpenFilesList = std::map<int, FDInfo>;
 
-// Populates the given list with open files for the given process.
-void populate_open_files_list(OpenFilesList* list, pid_t pid);
+// Populates the given list with open files for the given process, up to |max_fds| of them.
+void populate_open_files_list(OpenFilesList* list, pid_t pid,
+                              size_t max_fds = std::numeric_limits<size_t>::max());
 
 // Populates the given list with the target process's fdsan table.
 void populate_fdsan_table(OpenFilesList* list, std::shared_ptr<unwindstack::Memory> memory,
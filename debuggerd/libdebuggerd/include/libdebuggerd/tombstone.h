@@ -32,6 +32,7 @@
 
 // Forward declarations
 class BacktraceFrame;
+class BacktraceSample;
 class Cause;
 class Tombstone;
 
@@ -49,24 +50,43 @@ constexpr size_t kMaxFrames = 256;
  */
 int open_tombstone(std::string* path);
 
-/* Creates a tombstone file and writes the crash dump to it. */
+/* Creates a tombstone file and writes the crash dump to it.
+ * If write_text is false, only the proto is written out, and only the lines
+ * meant for logcat and amfd_data are rendered.
+ */
 void engrave_tombstone(android::base::unique_fd output_fd, android::base::unique_fd proto_fd,
                        unwindstack::AndroidUnwinder* unwinder,
                        const std::map<pid_t, ThreadInfo>& thread_info, pid_t target_thread,
                        const ProcessInfo& process_info, OpenFilesList* open_files,
-                       std::string* amfd_data);
+                       std::string* amfd_data, const UnwindOptions& unwind_options = {},
+                       bool write_text = true);
 
 void engrave_tombstone_ucontext(int tombstone_fd, int proto_fd, uint64_t abort_msg_address,
                                 siginfo_t* siginfo, ucontext_t* ucontext);
 
 void engrave_tombstone_proto(Tombstone* tombstone, unwindstack::AndroidUnwinder* unwinder,
                              const std::map<pid_t, ThreadInfo>& threads, pid_t target_thread,
-                             const ProcessInfo& process_info, const OpenFilesList* open_files);
+                             const ProcessInfo& process_info, const OpenFilesList* open_files,
+                             const UnwindOptions& unwind_options = {});
+
+// Fills in only the pcs and mappings of the frames of every thread, to be
+// symbolized offline.
+void engrave_backtrace_sample_proto(BacktraceSample* sample,
+                                    unwindstack::AndroidUnwinder* unwinder,
+                                    const std::map<pid_t, ThreadInfo>& threads,
+                                    pid_t target_thread, const UnwindOptions& unwind_options = {});
 
 bool tombstone_proto_to_text(
     const Tombstone& tombstone,
     std::function<void(const std::string& line, bool should_log)> callback);
 
+// Produces only the lines of tombstone_proto_to_text() that are meant for the
+// log: the header, and the signal, registers and backtrace of the crashing
+// thread. The other threads, memory and logs are not rendered at all.
+bool tombstone_proto_to_log(
+    const Tombstone& tombstone,
+    std::function<void(const std::string& line, bool should_log)> callback);
+
 void fill_in_backtrace_frame(BacktraceFrame* f, const unwindstack::FrameData& frame);
 void set_human_readable_cause(Cause* cause, uint64_t fault_addr);
 
@@ -16,6 +16,9 @@
  * limitations under the License.
  */
 
+#include <stddef.h>
+
+#include <chrono>
 #include <memory>
 #include <string>
 #include <vector>
@@ -41,6 +44,17 @@ struct ThreadInfo {
   siginfo_t* siginfo = nullptr;
 };
 
+// How the threads of a process are unwound when it is dumped.
+struct UnwindOptions {
+  // Number of threads that may be unwound at once. Anything above one starts
+  // worker threads, so it must stay at one when dumping from inside the
+  // crashing process.
+  size_t max_workers = 1;
+  // Threads not yet unwound once this much time has passed are dumped without
+  // a backtrace. The first thread is always unwound. Zero means no limit.
+  std::chrono::milliseconds time_budget{0};
+};
+
 // This struct is written into a pipe from inside the crashing process.
 struct ProcessInfo {
   uintptr_t abort_msg_address = 0;
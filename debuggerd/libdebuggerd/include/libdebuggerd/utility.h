@@ -23,6 +23,7 @@
 #include <sys/types.h>
 
 #include <string>
+#include <vector>
 
 #include <android-base/macros.h>
 
@@ -77,9 +78,26 @@ class Memory;
 struct AndroidUnwinderData;
 }
 
+struct ThreadInfo;
+struct UnwindOptions;
+
 void log_backtrace(log_t* log, unwindstack::AndroidUnwinder* unwinder,
                    unwindstack::AndroidUnwinderData& data, const char* prefix);
 
+enum class UnwindResult {
+  kUnwound,
+  kFailed,
+  kSkipped,
+};
+
+// Unwinds each of |threads| into the matching entry of |results|, which must
+// be the same size, running up to options.max_workers unwinds at once. The
+// workers share |unwinder|, and so its maps and process memory.
+std::vector<UnwindResult> unwind_threads(unwindstack::AndroidUnwinder* unwinder,
+                                         const std::vector<const ThreadInfo*>& threads,
+                                         std::vector<unwindstack::AndroidUnwinderData>* results,
+                                         const UnwindOptions& options);
+
 ssize_t dump_memory(void* out, size_t len, uint8_t* tags, size_t tags_len, uint64_t* addr,
                     unwindstack::Memory* memory);
 void dump_memory(log_t* log, unwindstack::Memory* backtrace, uint64_t addr, const std::string&);
@@ -21,6 +21,8 @@
 #include <android/fdsan.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +33,7 @@
 #include <utility>
 #include <vector>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <log/log.h>
 #include <unwindstack/Memory.h>
@@ -38,7 +41,8 @@
 #include "libdebuggerd/utility.h"
 #include "private/bionic_fdsan.h"
 
-void populate_open_files_list(OpenFilesList* list, pid_t pid) {
+void populate_open_files_list(OpenFilesList* list, pid_t pid, size_t max_fds) {
+  android::base::Timer timer;
   std::string fd_dir_name = "/proc/" + std::to_string(pid) + "/fd";
   std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(fd_dir_name.c_str()), closedir);
   if (dir == nullptr) {
@@ -46,22 +50,40 @@ void populate_open_files_list(OpenFilesList* list, pid_t pid) {
     return;
   }
 
+  // Links are read relative to the directory, so that the kernel doesn't have to look up
+  // /proc/<pid>/fd again for each of them.
+  int dir_fd = dirfd(dir.get());
+  char target[PATH_MAX];
+  size_t count = 0;
+  size_t skipped = 0;
   struct dirent* de;
   while ((de = readdir(dir.get())) != nullptr) {
     if (*de->d_name == '.') {
       continue;
     }
+    if (count == max_fds) {
+      skipped++;
+      continue;
+    }
+    count++;
 
     int fd = atoi(de->d_name);
-    std::string path = fd_dir_name + "/" + std::string(de->d_name);
-    std::string target;
-    if (android::base::Readlink(path, &target)) {
-      (*list)[fd].path = target;
+    ssize_t length = readlinkat(dir_fd, de->d_name, target, sizeof(target));
+    if (length >= 0) {
+      (*list)[fd].path = std::string(target, length);
     } else {
       (*list)[fd].path = "???";
-      ALOGE("failed to readlink %s: %s", path.c_str(), strerror(errno));
+      ALOGE("failed to readlink %s/%s: %s", fd_dir_name.c_str(), de->d_name, strerror(errno));
     }
   }
+
+  if (skipped) {
+    ALOGW("listed %zu open files of process %d, skipped %zu more", count, pid, skipped);
+  }
+  if (timer.duration() >= std::chrono::milliseconds(100)) {
+    ALOGI("listing %zu open files of process %d took %lld ms", count, pid,
+          static_cast<long long>(timer.duration().count()));
+  }
 }
 
 void populate_fdsan_table(OpenFilesList* list, std::shared_ptr<unwindstack::Memory> memory,
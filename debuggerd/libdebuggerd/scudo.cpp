@@ -40,19 +40,6 @@ ScudoCrashData::ScudoCrashData(unwindstack::Memory* process_memory,
     return;
   }
 
-  auto stack_depot = AllocAndReadFully(process_memory, process_info.scudo_stack_depot,
-                                       __scudo_get_stack_depot_size());
-  auto region_info = AllocAndReadFully(process_memory, process_info.scudo_region_info,
-                                       __scudo_get_region_info_size());
-  std::unique_ptr<char[]> ring_buffer;
-  if (process_info.scudo_ring_buffer_size != 0) {
-    ring_buffer = AllocAndReadFully(process_memory, process_info.scudo_ring_buffer,
-                                    process_info.scudo_ring_buffer_size);
-  }
-  if (!stack_depot || !region_info) {
-    return;
-  }
-
   untagged_fault_addr_ = process_info.untagged_fault_address;
   uintptr_t fault_page = untagged_fault_addr_ & ~(PAGE_SIZE - 1);
 
@@ -66,16 +53,38 @@ ScudoCrashData::ScudoCrashData(unwindstack::Memory* process_memory,
     return;
   }
 
+  // Look at the tags around the fault first. They are cheap to read, and
+  // without any of them and without a ring buffer there is nothing for Scudo
+  // to attribute the fault to, so the allocator metadata needn't be copied.
+  auto memory_tags = std::make_unique<char[]>((memory_end - memory_begin) / kTagGranuleSize);
+  bool tagged = (process_info.maybe_tagged_fault_address >> 56) & 0xf;
+  for (auto i = memory_begin; i != memory_end; i += kTagGranuleSize) {
+    long tag = process_memory->ReadTag(i);
+    memory_tags[(i - memory_begin) / kTagGranuleSize] = tag;
+    tagged |= tag > 0;
+  }
+  if (!tagged && process_info.scudo_ring_buffer_size == 0) {
+    return;
+  }
+
+  auto stack_depot = AllocAndReadFully(process_memory, process_info.scudo_stack_depot,
+                                       __scudo_get_stack_depot_size());
+  auto region_info = AllocAndReadFully(process_memory, process_info.scudo_region_info,
+                                       __scudo_get_region_info_size());
+  std::unique_ptr<char[]> ring_buffer;
+  if (process_info.scudo_ring_buffer_size != 0) {
+    ring_buffer = AllocAndReadFully(process_memory, process_info.scudo_ring_buffer,
+                                    process_info.scudo_ring_buffer_size);
+  }
+  if (!stack_depot || !region_info) {
+    return;
+  }
+
   auto memory = std::make_unique<char[]>(memory_end - memory_begin);
   for (auto i = memory_begin; i != memory_end; i += PAGE_SIZE) {
     process_memory->ReadFully(i, memory.get() + i - memory_begin, PAGE_SIZE);
   }
 
-  auto memory_tags = std::make_unique<char[]>((memory_end - memory_begin) / kTagGranuleSize);
-  for (auto i = memory_begin; i != memory_end; i += kTagGranuleSize) {
-    memory_tags[(i - memory_begin) / kTagGranuleSize] = process_memory->ReadTag(i);
-  }
-
   __scudo_get_error_info(&error_info_, process_info.maybe_tagged_fault_address, stack_depot.get(),
                          region_info.get(), ring_buffer.get(), memory.get(), memory_tags.get(),
                          memory_begin, memory_end - memory_begin);
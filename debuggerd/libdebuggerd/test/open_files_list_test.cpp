@@ -46,3 +46,20 @@ TEST(OpenFilesListTest, BasicTest) {
   }
   EXPECT_TRUE(found);
 }
+
+// Check that the list stops at the given number of files.
+TEST(OpenFilesListTest, MaxFds) {
+  TemporaryFile tf1;
+  TemporaryFile tf2;
+
+  OpenFilesList list;
+  populate_open_files_list(&list, getpid(), 2);
+  ASSERT_EQ(2U, list.size());
+  for (auto& [fd, entry] : list) {
+    EXPECT_TRUE(entry.path.has_value()) << "fd " << fd;
+  }
+
+  list.clear();
+  populate_open_files_list(&list, getpid(), 0);
+  EXPECT_TRUE(list.empty());
+}
@@ -125,10 +125,12 @@ void engrave_tombstone(unique_fd output_fd, unique_fd proto_fd,
                        unwindstack::AndroidUnwinder* unwinder,
                        const std::map<pid_t, ThreadInfo>& threads, pid_t target_thread,
                        const ProcessInfo& process_info, OpenFilesList* open_files,
-                       std::string* amfd_data) {
+                       std::string* amfd_data, const UnwindOptions& unwind_options,
+                       bool write_text) {
   // Don't copy log messages to tombstone unless this is a development device.
   Tombstone tombstone;
-  engrave_tombstone_proto(&tombstone, unwinder, threads, target_thread, process_info, open_files);
+  engrave_tombstone_proto(&tombstone, unwinder, threads, target_thread, process_info, open_files,
+                          unwind_options);
 
   if (proto_fd != -1) {
     if (!tombstone.SerializeToFileDescriptor(proto_fd.get())) {
@@ -140,10 +142,17 @@ void engrave_tombstone(unique_fd output_fd, unique_fd proto_fd,
   log_t log;
   log.current_tid = target_thread;
   log.crashed_tid = target_thread;
-  log.tfd = output_fd.get();
+  log.tfd = write_text ? output_fd.get() : -1;
   log.amfd_data = amfd_data;
 
-  tombstone_proto_to_text(tombstone, [&log](const std::string& line, bool should_log) {
+  auto callback = [&log](const std::string& line, bool should_log) {
     _LOG(&log, should_log ? logtype::HEADER : logtype::LOGS, "%s\n", line.c_str());
-  });
+  };
+  if (write_text) {
+    tombstone_proto_to_text(tombstone, callback);
+  } else {
+    // tombstoned renders the text from the proto later; don't hold up the
+    // crashing process formatting it here too.
+    tombstone_proto_to_log(tombstone, callback);
+  }
 }
@@ -37,6 +37,7 @@
 #include <optional>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <async_safe/log.h>
 
@@ -434,8 +435,10 @@ static void dump_thread_backtrace(std::vector<unwindstack::FrameData>& frames, T
   }
 }
 
+// Records a thread already unwound by unwind_threads() into |data|.
 static void dump_thread(Tombstone* tombstone, unwindstack::AndroidUnwinder* unwinder,
-                        const ThreadInfo& thread_info, bool memory_dump = false) {
+                        const ThreadInfo& thread_info, UnwindResult unwind_result,
+                        unwindstack::AndroidUnwinderData& data, bool memory_dump = false) {
   Thread thread;
 
   thread.set_id(thread_info.tid);
@@ -443,22 +446,24 @@ static void dump_thread(Tombstone* tombstone, unwindstack::AndroidUnwinder* unwi
   thread.set_tagged_addr_ctrl(thread_info.tagged_addr_ctrl);
   thread.set_pac_enabled_keys(thread_info.pac_enabled_keys);
 
-  unwindstack::AndroidUnwinderData data;
-  // Indicate we want a copy of the initial registers.
-  data.saved_initial_regs = std::make_optional<std::unique_ptr<unwindstack::Regs>>();
-  bool unwind_ret;
-  if (thread_info.registers != nullptr) {
-    unwind_ret = unwinder->Unwind(thread_info.registers.get(), data);
-  } else {
-    unwind_ret = unwinder->Unwind(thread_info.tid, data);
+  switch (unwind_result) {
+    case UnwindResult::kUnwound:
+      dump_thread_backtrace(data.frames, thread);
+      break;
+    case UnwindResult::kFailed:
+      async_safe_format_log(ANDROID_LOG_ERROR, LOG_TAG, "Unwind failed for tid %d: Error %s",
+                            thread_info.tid, data.GetErrorString().c_str());
+      break;
+    case UnwindResult::kSkipped:
+      *thread.mutable_backtrace_note()->Add() =
+          "Not unwound, the time allowed for unwinding threads ran out.";
+      break;
   }
-  if (!unwind_ret) {
-    async_safe_format_log(ANDROID_LOG_ERROR, LOG_TAG, "Unwind failed for tid %d: Error %s",
-                          thread_info.tid, data.GetErrorString().c_str());
+  if (unwind_result == UnwindResult::kSkipped) {
+    dump_registers(unwinder, thread_info.registers, thread, memory_dump);
   } else {
-    dump_thread_backtrace(data.frames, thread);
+    dump_registers(unwinder, *data.saved_initial_regs, thread, memory_dump);
   }
-  dump_registers(unwinder, *data.saved_initial_regs, thread, memory_dump);
 
   auto& threads = *tombstone->mutable_threads();
   threads[thread_info.tid] = thread;
@@ -618,7 +623,8 @@ static void dump_tags_around_fault_addr(Signal* signal, const Tombstone& tombsto
 
 void engrave_tombstone_proto(Tombstone* tombstone, unwindstack::AndroidUnwinder* unwinder,
                              const std::map<pid_t, ThreadInfo>& threads, pid_t target_thread,
-                             const ProcessInfo& process_info, const OpenFilesList* open_files) {
+                             const ProcessInfo& process_info, const OpenFilesList* open_files,
+                             const UnwindOptions& unwind_options) {
   Tombstone result;
 
   result.set_arch(get_arch());
@@ -679,14 +685,29 @@ void engrave_tombstone_proto(Tombstone* tombstone, unwindstack::AndroidUnwinder*
 
   dump_abort_message(&result, unwinder->GetProcessMemory(), process_info);
 
-  // Dump the main thread, but save the memory around the registers.
-  dump_thread(&result, unwinder, main_thread, /* memory_dump */ true);
-
+  // Unwind every thread up front, the main one first, so that the others can
+  // be spread over several workers.
+  std::vector<const ThreadInfo*> unwind_order = {&main_thread};
   for (const auto& [tid, thread_info] : threads) {
     if (tid != target_thread) {
-      dump_thread(&result, unwinder, thread_info);
+      unwind_order.push_back(&thread_info);
     }
   }
+  std::vector<unwindstack::AndroidUnwinderData> unwinds(unwind_order.size());
+  for (auto& data : unwinds) {
+    // Indicate we want a copy of the initial registers.
+    data.saved_initial_regs = std::make_optional<std::unique_ptr<unwindstack::Regs>>();
+  }
+  std::vector<UnwindResult> unwind_results =
+      unwind_threads(unwinder, unwind_order, &unwinds, unwind_options);
+
+  // Dump the main thread, but save the memory around the registers.
+  dump_thread(&result, unwinder, main_thread, unwind_results[0], unwinds[0],
+              /* memory_dump */ true);
+
+  for (size_t i = 1; i < unwind_order.size(); ++i) {
+    dump_thread(&result, unwinder, *unwind_order[i], unwind_results[i], unwinds[i]);
+  }
 
   dump_probable_cause(&result, unwinder, process_info, main_thread);
 
@@ -708,3 +729,66 @@ void engrave_tombstone_proto(Tombstone* tombstone, unwindstack::AndroidUnwinder*
 
   *tombstone = std::move(result);
 }
+
+// Only what offline symbolization needs: no function names, which are the
+// expensive part of a frame, and no registers or memory.
+static void fill_in_sampled_frame(BacktraceFrame* f, const unwindstack::FrameData& frame) {
+  f->set_rel_pc(frame.rel_pc);
+  f->set_pc(frame.pc);
+
+  if (frame.map_info == nullptr) {
+    return;
+  }
+  f->set_file_name(frame.map_info->GetFullName());
+  f->set_file_map_offset(frame.map_info->elf_start_offset());
+  f->set_build_id(frame.map_info->GetPrintableBuildID());
+}
+
+void engrave_backtrace_sample_proto(BacktraceSample* sample,
+                                    unwindstack::AndroidUnwinder* unwinder,
+                                    const std::map<pid_t, ThreadInfo>& threads,
+                                    pid_t target_thread, const UnwindOptions& unwind_options) {
+  BacktraceSample result;
+
+  result.set_arch(get_arch());
+  result.set_build_fingerprint(android::base::GetProperty("ro.build.fingerprint", "unknown"));
+  result.set_timestamp(get_timestamp());
+
+  const ThreadInfo& main_thread = threads.at(target_thread);
+  result.set_pid(main_thread.pid);
+
+  std::vector<const ThreadInfo*> unwind_order = {&main_thread};
+  for (const auto& [tid, thread_info] : threads) {
+    if (tid != target_thread) {
+      unwind_order.push_back(&thread_info);
+    }
+  }
+  std::vector<unwindstack::AndroidUnwinderData> unwinds(unwind_order.size());
+  std::vector<UnwindResult> unwind_results =
+      unwind_threads(unwinder, unwind_order, &unwinds, unwind_options);
+
+  auto& sampled_threads = *result.mutable_threads();
+  for (size_t i = 0; i < unwind_order.size(); ++i) {
+    const ThreadInfo& thread_info = *unwind_order[i];
+    Thread& thread = sampled_threads[thread_info.tid];
+    thread.set_id(thread_info.tid);
+    thread.set_name(thread_info.thread_name);
+
+    switch (unwind_results[i]) {
+      case UnwindResult::kUnwound:
+        for (const auto& frame : unwinds[i].frames) {
+          fill_in_sampled_frame(thread.add_current_backtrace(), frame);
+        }
+        break;
+      case UnwindResult::kFailed:
+        *thread.mutable_backtrace_note()->Add() = "Unwind failed: " + unwinds[i].GetErrorString();
+        break;
+      case UnwindResult::kSkipped:
+        *thread.mutable_backtrace_note()->Add() =
+            "Not unwound, the time allowed for unwinding threads ran out.";
+        break;
+    }
+  }
+
+  *sample = std::move(result);
+}
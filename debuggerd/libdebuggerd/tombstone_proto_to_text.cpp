@@ -387,7 +387,7 @@ static void print_memory_maps(CallbackType callback, const Tombstone& tombstone)
 }
 
 static void print_main_thread(CallbackType callback, const Tombstone& tombstone,
-                              const Thread& thread) {
+                              const Thread& thread, bool logged_only) {
   print_thread_header(callback, tombstone, thread, true);
 
   const Signal& signal_info = tombstone.signal_info();
@@ -466,7 +466,9 @@ static void print_main_thread(CallbackType callback, const Tombstone& tombstone,
     }
   }
 
-  print_tag_dump(callback, tombstone);
+  if (!logged_only) {
+    print_tag_dump(callback, tombstone);
+  }
 
   if (is_mte_crash) {
     CBS("");
@@ -474,6 +476,11 @@ static void print_main_thread(CallbackType callback, const Tombstone& tombstone,
         "https://source.android.com/docs/security/test/memory-safety/mte-reports");
   }
 
+  // Nothing below is logged.
+  if (logged_only) {
+    return;
+  }
+
   print_thread_memory_dump(callback, tombstone, thread);
 
   CBS("");
@@ -510,7 +517,8 @@ void print_logs(CallbackType callback, const Tombstone& tombstone, int tail) {
   }
 }
 
-bool tombstone_proto_to_text(const Tombstone& tombstone, CallbackType callback) {
+// Prints the process header and the crashing thread.
+static bool print_header(CallbackType callback, const Tombstone& tombstone, bool logged_only) {
   CBL("*** *** *** *** *** *** *** *** *** *** *** *** *** *** *** ***");
   CBL("Pixelstar Version: '%s'", tombstone.pixelstar_version().c_str());
   CBL("Build fingerprint: '%s'", tombstone.build_fingerprint().c_str());
@@ -529,10 +537,23 @@ bool tombstone_proto_to_text(const Tombstone& tombstone, CallbackType callback)
 
   const auto& main_thread = main_thread_it->second;
 
-  print_main_thread(callback, tombstone, main_thread);
+  print_main_thread(callback, tombstone, main_thread, logged_only);
+  return true;
+}
+
+bool tombstone_proto_to_log(const Tombstone& tombstone, CallbackType callback) {
+  return print_header(callback, tombstone, true);
+}
+
+bool tombstone_proto_to_text(const Tombstone& tombstone, CallbackType callback) {
+  if (!print_header(callback, tombstone, false)) {
+    return false;
+  }
 
   print_logs(callback, tombstone, 50);
 
+  const auto& threads = tombstone.threads();
+
   // protobuf's map is unordered, so sort the keys first.
   std::set<int> thread_ids;
   for (const auto& [tid, _] : threads) {
@@ -28,8 +28,11 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <set>
 #include <string>
+#include <thread>
 
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
@@ -43,6 +46,8 @@
 #include <unwindstack/Memory.h>
 #include <unwindstack/Unwinder.h>
 
+#include "libdebuggerd/types.h"
+
 using android::base::StringPrintf;
 using android::base::unique_fd;
 
@@ -509,3 +514,36 @@ void log_backtrace(log_t* log, unwindstack::AndroidUnwinder* unwinder,
     _LOG(log, logtype::BACKTRACE, "%s%s\n", prefix, unwinder->FormatFrame(frame).c_str());
   }
 }
+
+std::vector<UnwindResult> unwind_threads(unwindstack::AndroidUnwinder* unwinder,
+                                         const std::vector<const ThreadInfo*>& threads,
+                                         std::vector<unwindstack::AndroidUnwinderData>* results,
+                                         const UnwindOptions& options) {
+  std::vector<UnwindResult> status(threads.size(), UnwindResult::kSkipped);
+  const auto start = std::chrono::steady_clock::now();
+  std::atomic<size_t> next = 0;
+  auto unwind = [&]() {
+    for (size_t i; (i = next++) < threads.size();) {
+      if (i > 0 && options.time_budget.count() > 0 &&
+          std::chrono::steady_clock::now() - start >= options.time_budget) {
+        continue;
+      }
+      const ThreadInfo* thread = threads[i];
+      unwindstack::AndroidUnwinderData& data = (*results)[i];
+      bool unwound = thread->registers != nullptr
+                         ? unwinder->Unwind(thread->registers.get(), data)
+                         : unwinder->Unwind(thread->tid, data);
+      status[i] = unwound ? UnwindResult::kUnwound : UnwindResult::kFailed;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(options.max_workers, threads.size()); ++i) {
+    workers.emplace_back(unwind);
+  }
+  unwind();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  return status;
+}
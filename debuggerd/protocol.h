@@ -49,11 +49,25 @@ struct DumpRequest {
   int32_t pid;
 };
 
+struct PerformDump {
+  // Set when tombstoned can render the text tombstone from the proto itself,
+  // so the dumper may skip writing it to the text fd.
+  bool text_deferrable;
+};
+
+struct CompletedDump {
+  // Set by a dumper that took up the offer in PerformDump and left the text
+  // fd empty. Old dumpers send zero and keep writing text themselves.
+  bool text_deferred;
+};
+
 // The full packet must always be written, regardless of whether the union is used.
 struct TombstonedCrashPacket {
   CrashPacketType packet_type;
   union {
     DumpRequest dump_request;
+    PerformDump perform_dump;
+    CompletedDump completed_dump;
   } packet;
 };
 
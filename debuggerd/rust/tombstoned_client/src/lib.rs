@@ -106,6 +106,9 @@ mod ffi {
         /// A tombstone proto.
         #[cxx_name = "kDebuggerdTombstoneProto"]
         TombstoneProto,
+        /// A native backtrace proto, with only the pcs and build ids of the frames.
+        #[cxx_name = "kDebuggerdNativeBacktraceProto"]
+        NativeBacktraceProto,
     }
 
     unsafe extern "C++" {
@@ -50,6 +50,7 @@ static bool connect_tombstone_server_microdroid(unique_fd* text_output_fd,
   // supports limited dump types. Java traces and incept management are not supported.
   switch (dump_type) {
     case kDebuggerdNativeBacktrace:
+    case kDebuggerdNativeBacktraceProto:
     case kDebuggerdTombstone:
     case kDebuggerdTombstoneProto:
       break;
@@ -98,16 +99,21 @@ static bool notify_completion_microdroid(int vsock_out, int vsock_proto) {
   return true;
 }
 bool connect_tombstone_server(pid_t pid, unique_fd* tombstoned_socket, unique_fd* text_output_fd,
-                              unique_fd* proto_output_fd, DebuggerdDumpType dump_type) {
+                              unique_fd* proto_output_fd, DebuggerdDumpType dump_type,
+                              bool* text_deferrable) {
   if (is_microdroid()) {
+    // The host only ever sees what we write, so the text is always rendered here.
+    if (text_deferrable) *text_deferrable = false;
     return connect_tombstone_server_microdroid(text_output_fd, proto_output_fd, dump_type);
   }
-  return tombstoned_connect(pid, tombstoned_socket, text_output_fd, proto_output_fd, dump_type);
+  return tombstoned_connect(pid, tombstoned_socket, text_output_fd, proto_output_fd, dump_type,
+                            text_deferrable);
 }
 
-bool notify_completion(int tombstoned_socket, int vsock_out, int vsock_proto) {
+bool notify_completion(int tombstoned_socket, int vsock_out, int vsock_proto,
+                       bool text_deferred) {
   if (is_microdroid()) {
     return notify_completion_microdroid(vsock_out, vsock_proto);
   }
-  return tombstoned_notify_completion(tombstoned_socket);
+  return tombstoned_notify_completion(tombstoned_socket, text_deferred);
 }
@@ -26,7 +26,18 @@ bool tombstoned_connect(pid_t pid, android::base::unique_fd* tombstoned_socket,
                         android::base::unique_fd* text_output_fd,
                         android::base::unique_fd* proto_output_fd, DebuggerdDumpType dump_type);
 
+// As above, and sets *text_deferrable when tombstoned offers to render the
+// text tombstone from the proto after the dump has completed.
+bool tombstoned_connect(pid_t pid, android::base::unique_fd* tombstoned_socket,
+                        android::base::unique_fd* text_output_fd,
+                        android::base::unique_fd* proto_output_fd, DebuggerdDumpType dump_type,
+                        bool* text_deferrable);
+
 bool tombstoned_connect(pid_t pid, android::base::unique_fd* tombstoned_socket,
                         android::base::unique_fd* text_output_fd, DebuggerdDumpType dump_type);
 
 bool tombstoned_notify_completion(int tombstoned_socket);
+
+// As above; text_deferred tells tombstoned that the text fd was left empty and
+// must be rendered from the proto.
+bool tombstoned_notify_completion(int tombstoned_socket, bool text_deferred);
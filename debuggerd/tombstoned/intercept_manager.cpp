@@ -74,11 +74,16 @@ static bool is_intercept_request_valid(const InterceptRequest& request) {
     return false;
   }
 
-  if (request.dump_type < 0 || request.dump_type > kDebuggerdJavaBacktrace) {
-    return false;
+  switch (request.dump_type) {
+    case kDebuggerdNativeBacktrace:
+    case kDebuggerdTombstone:
+    case kDebuggerdJavaBacktrace:
+    case kDebuggerdNativeBacktraceProto:
+      return true;
+
+    default:
+      return false;
   }
-
-  return true;
 }
 
 static void intercept_request_cb(evutil_socket_t sockfd, short ev, void* arg) {
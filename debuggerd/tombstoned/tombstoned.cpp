@@ -21,9 +21,13 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <condition_variable>
 #include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 
@@ -32,6 +36,7 @@
 #include <event2/thread.h>
 
 #include <android-base/cmsg.h>
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
@@ -40,12 +45,16 @@
 
 #include "debuggerd/handler.h"
 #include "dump_type.h"
+#include "libdebuggerd/tombstone.h"
 #include "protocol.h"
 #include "util.h"
 
 #include "intercept_manager.h"
 
-using android::base::GetIntProperty;
+#include "tombstone.pb.h"
+
+using android::base::GetBoolProperty;
+using android::base::GetUintProperty;
 using android::base::SendFileDescriptors;
 using android::base::StringPrintf;
 
@@ -92,6 +101,9 @@ struct Crash {
   event* crash_event = nullptr;
 
   DebuggerdDumpType crash_type;
+
+  // Whether crash_dump was told it may leave the text tombstone to us.
+  bool text_deferrable = false;
 };
 
 class CrashQueue {
@@ -126,30 +138,37 @@ class CrashQueue {
   }
 
   static CrashQueue* for_tombstones() {
+    size_t max_tombstones = get_max_artifacts("tombstoned.max_tombstone_count", 32);
     static CrashQueue queue("/data/tombstones", "tombstone_" /* file_name_prefix */,
-                            GetIntProperty("tombstoned.max_tombstone_count", 32),
-                            1 /* max_concurrent_dumps */, true /* supports_proto */);
+                            max_tombstones,
+                            get_max_concurrent_dumps("tombstoned.max_concurrent_tombstones", 1,
+                                                     max_tombstones),
+                            true /* supports_proto */);
     return &queue;
   }
 
   static CrashQueue* for_anrs() {
-    static CrashQueue queue("/data/anr", "trace_" /* file_name_prefix */,
-                            GetIntProperty("tombstoned.max_anr_count", 64),
-                            4 /* max_concurrent_dumps */, false /* supports_proto */);
+    size_t max_anrs = get_max_artifacts("tombstoned.max_anr_count", 64);
+    static CrashQueue queue("/data/anr", "trace_" /* file_name_prefix */, max_anrs,
+                            get_max_concurrent_dumps("tombstoned.max_concurrent_anrs", 4,
+                                                     max_anrs),
+                            false /* supports_proto */);
     return &queue;
   }
 
-  CrashArtifact create_temporary_file() const {
+  // Protos are opened for reading too, so that the text tombstone can be
+  // rendered from them once crash_dump is done.
+  CrashArtifact create_temporary_file(int access_mode = O_WRONLY) const {
     CrashArtifact result;
 
     std::optional<std::string> path;
-    result.fd.reset(openat(dir_fd_, ".", O_WRONLY | O_APPEND | O_TMPFILE | O_CLOEXEC, 0660));
+    result.fd.reset(openat(dir_fd_, ".", access_mode | O_APPEND | O_TMPFILE | O_CLOEXEC, 0660));
     if (result.fd == -1) {
       // We might not have O_TMPFILE. Try creating with an arbitrary filename instead.
       static size_t counter = 0;
       std::string tmp_filename = StringPrintf(".temporary%zu", counter++);
       result.fd.reset(openat(dir_fd_, tmp_filename.c_str(),
-                             O_WRONLY | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC, 0660));
+                             access_mode | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC, 0660));
       if (result.fd == -1) {
         PLOG(FATAL) << "failed to create temporary tombstone in " << dir_path_;
       }
@@ -165,6 +184,7 @@ class CrashQueue {
 
     switch (dump_type) {
       case kDebuggerdNativeBacktrace:
+      case kDebuggerdNativeBacktraceProto:
         // Don't generate tombstones for native backtrace requests.
         return {};
 
@@ -173,7 +193,7 @@ class CrashQueue {
           LOG(ERROR) << "received kDebuggerdTombstoneProto on a queue that doesn't support proto";
           return {};
         }
-        result.proto = create_temporary_file();
+        result.proto = create_temporary_file(O_RDWR);
         result.text = create_temporary_file();
         break;
 
@@ -227,6 +247,18 @@ class CrashQueue {
   void on_crash_completed() { --num_concurrent_dumps_; }
 
  private:
+  // The limits are clamped so that at least one dump can run, and there is always an artifact
+  // more than there are concurrent dumps (see the CHECK in the constructor).
+  static size_t get_max_artifacts(const std::string& property, size_t default_value) {
+    return std::max<size_t>(GetUintProperty<size_t>(property, default_value), 2);
+  }
+
+  static size_t get_max_concurrent_dumps(const std::string& property, size_t default_value,
+                                         size_t max_artifacts) {
+    return std::clamp<size_t>(GetUintProperty<size_t>(property, default_value), 1,
+                              max_artifacts - 1);
+  }
+
   void find_oldest_artifact() {
     size_t oldest_tombstone = 0;
     time_t oldest_time = std::numeric_limits<time_t>::max();
@@ -275,6 +307,13 @@ class CrashQueue {
 // Whether java trace dumps are produced via tombstoned.
 static constexpr bool kJavaTraceDumpsEnabled = true;
 
+// Whether crash_dump may hand text rendering of proto tombstones over to us,
+// so that the crashing process is let go as soon as the proto is written.
+static bool text_rendering_deferred() {
+  static bool deferred = GetBoolProperty("tombstoned.defer_text_tombstones", true);
+  return deferred;
+}
+
 // Forward declare the callbacks so they can be placed in a sensible order.
 static void crash_accept_cb(evconnlistener* listener, evutil_socket_t sockfd, sockaddr*, int,
                             void*);
@@ -299,7 +338,13 @@ static void perform_request(std::unique_ptr<Crash> crash) {
     }
   }
 
+  // Intercepts get the text as it's produced, so only tombstones headed for
+  // disk can have it rendered later.
+  crash->text_deferrable = !intercepted && crash->crash_type == kDebuggerdTombstoneProto &&
+                           text_rendering_deferred();
+
   TombstonedCrashPacket response = {.packet_type = CrashPacketType::kPerformDump};
+  response.packet.perform_dump.text_deferrable = crash->text_deferrable;
 
   ssize_t rc = -1;
   if (crash->output.proto) {
@@ -376,7 +421,7 @@ static void crash_request_cb(evutil_socket_t sockfd, short ev, void* arg) {
   }
 
   crash->crash_type = request.packet.dump_request.dump_type;
-  if (crash->crash_type < 0 || crash->crash_type > kDebuggerdTombstoneProto) {
+  if (crash->crash_type < 0 || crash->crash_type > kDebuggerdNativeBacktraceProto) {
     LOG(WARNING) << "unexpected crash dump type: " << crash->crash_type;
     return;
   }
@@ -409,6 +454,12 @@ static void crash_request_cb(evutil_socket_t sockfd, short ev, void* arg) {
 }
 
 static bool rename_tombstone_fd(borrowed_fd fd, borrowed_fd dirfd, const std::string& path) {
+  // Make sure the contents are on disk before the file shows up under its
+  // final name, so that a reboot can't leave an empty tombstone behind.
+  if (fsync(fd.get()) != 0) {
+    PLOG(WARNING) << "failed to sync tombstone for " << path;
+  }
+
   // Always try to unlink the tombstone file.
   // linkat doesn't let us replace a file, so we need to unlink before linking
   // our results onto disk, and if we fail for some reason, we should delete
@@ -428,65 +479,165 @@ static bool rename_tombstone_fd(borrowed_fd fd, borrowed_fd dirfd, const std::st
   return true;
 }
 
-static void crash_completed(borrowed_fd sockfd, std::unique_ptr<Crash> crash) {
-  TombstonedCrashPacket request = {};
-  CrashQueue* queue = CrashQueue::for_crash(crash);
+// A dump that crash_dump has finished writing, waiting to be put in place.
+struct CompletedCrash {
+  CrashOutput output;
+  CrashArtifactPaths paths;
+  borrowed_fd dir_fd;
+  pid_t crash_pid;
+  DebuggerdDumpType crash_type;
 
-  ssize_t rc = TEMP_FAILURE_RETRY(read(sockfd.get(), &request, sizeof(request)));
-  if (rc == -1) {
-    PLOG(WARNING) << "failed to read from crash socket";
-    return;
-  } else if (rc != sizeof(request)) {
-    LOG(WARNING) << "crash socket received short read of length " << rc << " (expected "
-                 << sizeof(request) << ")";
-    return;
+  // crash_dump left the text tombstone empty; it has to be rendered from the proto.
+  bool render_text;
+};
+
+static bool render_text_tombstone(borrowed_fd proto_fd, borrowed_fd text_fd) {
+  std::string proto;
+  if (lseek(proto_fd.get(), 0, SEEK_SET) != 0 ||
+      !android::base::ReadFdToString(proto_fd, &proto)) {
+    PLOG(ERROR) << "failed to read proto tombstone";
+    return false;
   }
 
-  if (request.packet_type != CrashPacketType::kCompletedDump) {
-    LOG(WARNING) << "unexpected crash packet type, expected kCompletedDump, received "
-                 << uint32_t(request.packet_type);
-    return;
+  Tombstone tombstone;
+  if (!tombstone.ParseFromString(proto)) {
+    LOG(ERROR) << "failed to parse proto tombstone";
+    return false;
   }
 
-  if (crash->output.text.fd == -1) {
-    LOG(WARNING) << "skipping tombstone file creation due to intercept";
-    return;
+  std::string text;
+  bool result = tombstone_proto_to_text(tombstone, [&text](const std::string& line, bool) {
+    text += line;
+    text += '\n';
+  });
+  if (!android::base::WriteStringToFd(text, text_fd)) {
+    PLOG(ERROR) << "failed to write text tombstone";
+    return false;
   }
+  return result;
+}
 
-  CrashArtifactPaths paths = queue->get_next_artifact_paths();
+static void persist_crash(CompletedCrash& crash) {
+  if (crash.render_text && crash.output.proto) {
+    render_text_tombstone(crash.output.proto->fd, crash.output.text.fd);
+  }
 
-  if (rename_tombstone_fd(crash->output.text.fd, queue->dir_fd(), paths.text)) {
-    if (crash->crash_type == kDebuggerdJavaBacktrace) {
-      LOG(ERROR) << "Traces for pid " << crash->crash_pid << " written to: " << paths.text;
+  if (rename_tombstone_fd(crash.output.text.fd, crash.dir_fd, crash.paths.text)) {
+    if (crash.crash_type == kDebuggerdJavaBacktrace) {
+      LOG(ERROR) << "Traces for pid " << crash.crash_pid << " written to: " << crash.paths.text;
     } else {
       // NOTE: Several tools parse this log message to figure out where the
       // tombstone associated with a given native crash was written. Any changes
       // to this message must be carefully considered.
-      LOG(ERROR) << "Tombstone written to: " << paths.text;
+      LOG(ERROR) << "Tombstone written to: " << crash.paths.text;
     }
   }
 
-  if (crash->output.proto && crash->output.proto->fd != -1) {
-    if (!paths.proto) {
+  if (crash.output.proto && crash.output.proto->fd != -1) {
+    if (!crash.paths.proto) {
       LOG(ERROR) << "missing path for proto tombstone";
     } else {
-      rename_tombstone_fd(crash->output.proto->fd, queue->dir_fd(), *paths.proto);
+      rename_tombstone_fd(crash.output.proto->fd, crash.dir_fd, *crash.paths.proto);
     }
   }
 
   // If we don't have O_TMPFILE, we need to clean up after ourselves.
-  if (crash->output.text.temporary_path) {
-    rc = unlinkat(queue->dir_fd().get(), crash->output.text.temporary_path->c_str(), 0);
+  if (crash.output.text.temporary_path) {
+    int rc = unlinkat(crash.dir_fd.get(), crash.output.text.temporary_path->c_str(), 0);
     if (rc != 0) {
-      PLOG(ERROR) << "failed to unlink temporary tombstone at " << paths.text;
+      PLOG(ERROR) << "failed to unlink temporary tombstone at " << crash.paths.text;
     }
   }
-  if (crash->output.proto && crash->output.proto->temporary_path) {
-    rc = unlinkat(queue->dir_fd().get(), crash->output.proto->temporary_path->c_str(), 0);
+  if (crash.output.proto && crash.output.proto->temporary_path) {
+    int rc = unlinkat(crash.dir_fd.get(), crash.output.proto->temporary_path->c_str(), 0);
     if (rc != 0) {
       PLOG(ERROR) << "failed to unlink temporary proto tombstone";
     }
   }
+
+  // Persist the new directory entries too.
+  if (fsync(crash.dir_fd.get()) != 0) {
+    PLOG(WARNING) << "failed to sync tombstone directory";
+  }
+}
+
+// Renders, syncs and links finished dumps into place on a thread of its own.
+// Those are the slow parts of handling a crash, and doing them on the event
+// loop would hold up every other crash waiting to be dumped. Dumps are
+// persisted in the order they completed in, so artifact names are still
+// reused oldest first.
+class ArtifactWriter {
+ public:
+  static ArtifactWriter* instance() {
+    static ArtifactWriter* writer = new ArtifactWriter();
+    return writer;
+  }
+
+  void enqueue(CompletedCrash crash) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.emplace_back(std::move(crash));
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  ArtifactWriter() { std::thread(&ArtifactWriter::run, this).detach(); }
+
+  void run() {
+    while (true) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return !pending_.empty(); });
+      CompletedCrash crash = std::move(pending_.front());
+      pending_.pop_front();
+      lock.unlock();
+
+      persist_crash(crash);
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<CompletedCrash> pending_;
+
+  DISALLOW_COPY_AND_ASSIGN(ArtifactWriter);
+};
+
+static void crash_completed(borrowed_fd sockfd, std::unique_ptr<Crash> crash) {
+  TombstonedCrashPacket request = {};
+  CrashQueue* queue = CrashQueue::for_crash(crash);
+
+  ssize_t rc = TEMP_FAILURE_RETRY(read(sockfd.get(), &request, sizeof(request)));
+  if (rc == -1) {
+    PLOG(WARNING) << "failed to read from crash socket";
+    return;
+  } else if (rc != sizeof(request)) {
+    LOG(WARNING) << "crash socket received short read of length " << rc << " (expected "
+                 << sizeof(request) << ")";
+    return;
+  }
+
+  if (request.packet_type != CrashPacketType::kCompletedDump) {
+    LOG(WARNING) << "unexpected crash packet type, expected kCompletedDump, received "
+                 << uint32_t(request.packet_type);
+    return;
+  }
+
+  if (crash->output.text.fd == -1) {
+    LOG(WARNING) << "skipping tombstone file creation due to intercept";
+    return;
+  }
+
+  // Names are handed out here, in completion order, so that concurrent dumps
+  // never end up with the same one.
+  ArtifactWriter::instance()->enqueue(CompletedCrash{
+      .output = std::move(crash->output),
+      .paths = queue->get_next_artifact_paths(),
+      .dir_fd = queue->dir_fd(),
+      .crash_pid = crash->crash_pid,
+      .crash_type = crash->crash_type,
+      .render_text = crash->text_deferrable && request.packet.completed_dump.text_deferred,
+  });
 }
 
 static void crash_completed_cb(evutil_socket_t sockfd, short ev, void* arg) {
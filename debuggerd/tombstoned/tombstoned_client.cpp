@@ -39,6 +39,13 @@ bool tombstoned_connect(pid_t pid, unique_fd* tombstoned_socket, unique_fd* text
 
 bool tombstoned_connect(pid_t pid, unique_fd* tombstoned_socket, unique_fd* text_output_fd,
                         unique_fd* proto_output_fd, DebuggerdDumpType dump_type) {
+  return tombstoned_connect(pid, tombstoned_socket, text_output_fd, proto_output_fd, dump_type,
+                            nullptr);
+}
+
+bool tombstoned_connect(pid_t pid, unique_fd* tombstoned_socket, unique_fd* text_output_fd,
+                        unique_fd* proto_output_fd, DebuggerdDumpType dump_type,
+                        bool* text_deferrable) {
   unique_fd sockfd(
       socket_local_client((dump_type != kDebuggerdJavaBacktrace ? kTombstonedCrashSocketName
                                                                 : kTombstonedJavaTraceSocketName),
@@ -94,12 +101,23 @@ bool tombstoned_connect(pid_t pid, unique_fd* tombstoned_socket, unique_fd* text
   if (proto_output_fd) {
     *proto_output_fd = std::move(tmp_proto_fd);
   }
+  if (text_deferrable) {
+    // Rendering later needs the proto, so only offer it to callers that take one.
+    *text_deferrable = proto_output_fd && *proto_output_fd != -1 &&
+                       packet.packet_type == CrashPacketType::kPerformDump &&
+                       packet.packet.perform_dump.text_deferrable;
+  }
   return true;
 }
 
 bool tombstoned_notify_completion(int tombstoned_socket) {
+  return tombstoned_notify_completion(tombstoned_socket, false);
+}
+
+bool tombstoned_notify_completion(int tombstoned_socket, bool text_deferred) {
   TombstonedCrashPacket packet = {};
   packet.packet_type = CrashPacketType::kCompletedDump;
+  packet.packet.completed_dump.text_deferred = text_deferred;
   if (TEMP_FAILURE_RETRY(write(tombstoned_socket, &packet, sizeof(packet))) != sizeof(packet)) {
     return false;
   }
@@ -36,6 +36,8 @@
 #define FB_CMD_GSI "gsi"
 #define FB_CMD_SNAPSHOT_UPDATE "snapshot-update"
 #define FB_CMD_FETCH "fetch"
+#define FB_CMD_STREAM_FLASH "stream-flash"
+#define FB_CMD_DOWNLOAD_LZ4 "download-lz4"
 
 #define RESPONSE_OKAY "OKAY"
 #define RESPONSE_FAIL "FAIL"
@@ -80,4 +82,6 @@
 #define FB_VAR_SECURITY_PATCH_LEVEL "security-patch-level"
 #define FB_VAR_TREBLE_ENABLED "treble-enabled"
 #define FB_VAR_MAX_FETCH_SIZE "max-fetch-size"
+#define FB_VAR_STREAM_FLASH "stream-flash"
+#define FB_VAR_DOWNLOAD_COMPRESSION "download-compression"
 #define FB_VAR_DMESG "dmesg"
@@ -16,6 +16,8 @@
 
 #include "commands.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -37,6 +39,7 @@
 #include <liblp/builder.h>
 #include <liblp/liblp.h>
 #include <libsnapshot/snapshot.h>
+#include <lz4frame.h>
 #include <storage_literals/storage_literals.h>
 #include <uuid/uuid.h>
 
@@ -146,6 +149,8 @@ const std::unordered_map<std::string, VariableHandlers> kVariableMap = {
         {FB_VAR_SECURITY_PATCH_LEVEL, {GetSecurityPatchLevel, nullptr}},
         {FB_VAR_TREBLE_ENABLED, {GetTrebleEnabled, nullptr}},
         {FB_VAR_MAX_FETCH_SIZE, {GetMaxFetchSize, nullptr}},
+        {FB_VAR_STREAM_FLASH, {GetStreamFlash, nullptr}},
+        {FB_VAR_DOWNLOAD_COMPRESSION, {GetDownloadCompression, nullptr}},
 };
 
 static bool GetVarAll(FastbootDevice* device) {
@@ -314,6 +319,93 @@ bool DownloadHandler(FastbootDevice* device, const std::vector<std::string>& arg
     return device->WriteStatus(FastbootResult::FAIL, "Couldn't download data");
 }
 
+bool DownloadLz4Handler(FastbootDevice* device, const std::vector<std::string>& args) {
+    if (args.size() < 3) {
+        return device->WriteStatus(FastbootResult::FAIL, "size arguments unspecified");
+    }
+
+    if (GetDeviceLockStatus()) {
+        return device->WriteStatus(FastbootResult::FAIL,
+                                   "Download is not allowed on locked devices");
+    }
+
+    // arg[1] is the size of the compressed payload and arg[2] the size it
+    // decompresses to, which is what has to fit in the download buffer.
+    if (args[1].length() != 8 || args[2].length() != 8) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size (length of size != 8)");
+    }
+    unsigned int compressed_size, size;
+    if (!android::base::ParseUint("0x" + args[1], &compressed_size, kMaxDownloadSizeDefault) ||
+        !android::base::ParseUint("0x" + args[2], &size, kMaxDownloadSizeDefault)) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size");
+    }
+    if (compressed_size == 0 || size == 0) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size (0)");
+    }
+
+    LZ4F_dctx* dctx_raw;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx_raw, LZ4F_VERSION))) {
+        return device->WriteStatus(FastbootResult::FAIL, "Unable to create lz4 context");
+    }
+    std::unique_ptr<LZ4F_dctx, decltype(&LZ4F_freeDecompressionContext)> dctx(
+            dctx_raw, LZ4F_freeDecompressionContext);
+
+    auto& data = device->download_data();
+    data.resize(size);
+    if (!device->WriteStatus(FastbootResult::DATA,
+                             android::base::StringPrintf("%08x", compressed_size))) {
+        return false;
+    }
+
+    // Decompress straight into the download buffer as the payload arrives. On
+    // a decoding error the rest of the payload is still read, so the protocol
+    // stays in sync and the host sees the failure in the response.
+    std::vector<char> buffer(std::min<size_t>(compressed_size, 1_MiB));
+    size_t decoded = 0;
+    size_t hint = 1;
+    std::string error;
+    for (uint32_t remaining = compressed_size; remaining > 0;) {
+        size_t len = std::min<size_t>(remaining, buffer.size());
+        if (!device->HandleData(true, buffer.data(), len)) {
+            PLOG(ERROR) << "Couldn't download data";
+            data.clear();
+            return device->WriteStatus(FastbootResult::FAIL, "Couldn't download data");
+        }
+        remaining -= len;
+
+        const char* src = buffer.data();
+        while (error.empty() && len > 0) {
+            size_t src_len = len;
+            size_t dst_len = size - decoded;
+            hint = LZ4F_decompress(dctx.get(), data.data() + decoded, &dst_len, src, &src_len,
+                                   nullptr);
+            if (LZ4F_isError(hint)) {
+                error = std::string("Invalid lz4 data: ") + LZ4F_getErrorName(hint);
+                break;
+            }
+            if (src_len == 0 && dst_len == 0) {
+                error = "Data decompresses to more than " + std::to_string(size) + " bytes";
+                break;
+            }
+            decoded += dst_len;
+            src += src_len;
+            len -= src_len;
+        }
+    }
+    if (error.empty() && hint != 0) {
+        error = "Truncated lz4 data";
+    } else if (error.empty() && decoded != size) {
+        error = "Data decompresses to " + std::to_string(decoded) + " bytes, expected " +
+                std::to_string(size);
+    }
+    if (!error.empty()) {
+        LOG(ERROR) << error;
+        data.clear();
+        return device->WriteStatus(FastbootResult::FAIL, error);
+    }
+    return device->WriteStatus(FastbootResult::OKAY, "");
+}
+
 bool SetActiveHandler(FastbootDevice* device, const std::vector<std::string>& args) {
     if (args.size() < 2) {
         return device->WriteStatus(FastbootResult::FAIL, "Missing slot argument");
@@ -626,6 +718,50 @@ bool FlashHandler(FastbootDevice* device, const std::vector<std::string>& args)
     return device->WriteStatus(FastbootResult::OKAY, "Flashing succeeded");
 }
 
+bool StreamFlashHandler(FastbootDevice* device, const std::vector<std::string>& args) {
+    if (args.size() < 3) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid arguments");
+    }
+
+    if (GetDeviceLockStatus()) {
+        return device->WriteStatus(FastbootResult::FAIL,
+                                   "Flashing is not allowed on locked devices");
+    }
+
+    // The image never has to fit in RAM, so unlike "download" the size is only
+    // bounded by the 8 hex digits of the protocol.
+    if (args[2].length() != 8) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size (length of size != 8)");
+    }
+    uint32_t size;
+    if (!android::base::ParseUint("0x" + args[2], &size)) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size");
+    }
+    if (size == 0) {
+        return device->WriteStatus(FastbootResult::FAIL, "Invalid size (0)");
+    }
+
+    const auto& partition_name = args[1];
+    if (IsProtectedPartitionDuringMerge(device, partition_name)) {
+        auto message = "Cannot flash " + partition_name + " while a snapshot update is in progress";
+        return device->WriteFail(message);
+    }
+
+    if (LogicalPartitionExists(device, partition_name)) {
+        CancelPartitionSnapshot(device, partition_name);
+    }
+
+    int ret = StreamFlash(device, partition_name, size);
+    if (ret < 0) {
+        return device->WriteStatus(FastbootResult::FAIL, strerror(-ret));
+    }
+    if (partition_name == "userdata") {
+        PostWipeData();
+    }
+
+    return device->WriteStatus(FastbootResult::OKAY, "Flashing succeeded");
+}
+
 bool UpdateSuperHandler(FastbootDevice* device, const std::vector<std::string>& args) {
     if (args.size() < 2) {
         return device->WriteFail("Invalid arguments");
@@ -863,8 +999,16 @@ class PartitionFetcher {
             return;
         }
         uint64_t end_offset = start_offset_ + total_size_to_read_;
-        std::vector<char> buf(1_MiB);
         uint64_t current_offset = start_offset_;
+        if (!SendFromFd(&current_offset, end_offset)) {
+            ret_ = false;
+            return;
+        }
+
+        // The transport can't send from the partition directly; copy it over.
+        posix_fadvise(handle_.fd(), current_offset, end_offset - current_offset,
+                      POSIX_FADV_SEQUENTIAL);
+        std::vector<char> buf(1_MiB);
         while (current_offset < end_offset) {
             // On any error, exit. We can't return a status message to the driver because
             // we are in the middle of writing data, so just let the driver guess what's wrong
@@ -891,6 +1035,32 @@ class PartitionFetcher {
                 start_offset_, total_size_to_read_));
     }
 
+    // Sends the partition data with Transport::WriteFromFd(), which keeps it
+    // out of user space. Returns false on error. On success, |*current_offset|
+    // is either |end_offset|, or unchanged if the transport has no such path.
+    bool SendFromFd(uint64_t* current_offset, uint64_t end_offset) {
+        while (*current_offset < end_offset) {
+            // On any error, exit; see Fetch().
+            uint64_t chunk_size = std::min<uint64_t>(kFetchChunkSize, end_offset - *current_offset);
+            ssize_t sent = device_->get_transport()->WriteFromFd(handle_.fd(), *current_offset,
+                                                                 chunk_size);
+            if (sent < 0 && errno == EOPNOTSUPP && *current_offset == start_offset_) {
+                return true;
+            }
+            if (sent < 0 || static_cast<uint64_t>(sent) != chunk_size) {
+                PLOG(ERROR) << std::hex << "Unable to send 0x" << chunk_size << " bytes of "
+                            << partition_name_ << " @ offset 0x" << *current_offset;
+                return false;
+            }
+            *current_offset += chunk_size;
+        }
+        return true;
+    }
+
+    // Per WriteFromFd() call; large enough that the per-message overhead is
+    // negligible.
+    static constexpr uint64_t kFetchChunkSize = 64_MiB;
+
     static constexpr std::array<const char*, 3> kAllowedPartitions{
             "vendor_boot",
             "vendor_boot_a",
@@ -52,3 +52,5 @@ bool OemCmdHandler(FastbootDevice* device, const std::vector<std::string>& args)
 bool GsiHandler(FastbootDevice* device, const std::vector<std::string>& args);
 bool SnapshotUpdateHandler(FastbootDevice* device, const std::vector<std::string>& args);
 bool FetchHandler(FastbootDevice* device, const std::vector<std::string>& args);
+bool StreamFlashHandler(FastbootDevice* device, const std::vector<std::string>& args);
+bool DownloadLz4Handler(FastbootDevice* device, const std::vector<std::string>& args);
@@ -109,6 +109,8 @@ FastbootDevice::FastbootDevice()
               {FB_CMD_GSI, GsiHandler},
               {FB_CMD_SNAPSHOT_UPDATE, SnapshotUpdateHandler},
               {FB_CMD_FETCH, FetchHandler},
+              {FB_CMD_STREAM_FLASH, StreamFlashHandler},
+              {FB_CMD_DOWNLOAD_LZ4, DownloadLz4Handler},
       }),
       boot_control_hal_(BootControlClient::WaitForService()),
       health_hal_(get_health_service()),
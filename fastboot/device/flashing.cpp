@@ -16,19 +16,28 @@
 #include "flashing.h"
 
 #include <fcntl.h>
+#include <linux/fs.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <string>
+#include <thread>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <ext4_utils/ext4_utils.h>
 #include <fs_mgr_overlayfs.h>
@@ -37,6 +46,7 @@
 #include <liblp/builder.h>
 #include <liblp/liblp.h>
 #include <libsnapshot/snapshot.h>
+#include <liburing.h>
 #include <sparse/sparse.h>
 
 #include "fastboot_device.h"
@@ -49,6 +59,43 @@ namespace {
 
 constexpr uint32_t SPARSE_HEADER_MAGIC = 0xed26ff3a;
 
+// Sparse image layout, mirroring the private libsparse/sparse_format.h.
+struct SparseHeader {
+    uint32_t magic;
+    uint16_t major_version;
+    uint16_t minor_version;
+    uint16_t file_hdr_sz;
+    uint16_t chunk_hdr_sz;
+    uint32_t blk_sz;
+    uint32_t total_blks;
+    uint32_t total_chunks;
+    uint32_t image_checksum;
+} __attribute__((packed));
+
+struct SparseChunkHeader {
+    uint16_t chunk_type;
+    uint16_t reserved1;
+    uint32_t chunk_sz;
+    uint32_t total_sz;
+} __attribute__((packed));
+
+constexpr uint16_t CHUNK_TYPE_RAW = 0xCAC1;
+constexpr uint16_t CHUNK_TYPE_FILL = 0xCAC2;
+constexpr uint16_t CHUNK_TYPE_DONT_CARE = 0xCAC3;
+constexpr uint16_t CHUNK_TYPE_CRC32 = 0xCAC4;
+
+// Size and number of the buffers handed from the transport to the writer
+// thread by StreamFlash().
+constexpr size_t kStreamBufferSize = 1048576;
+constexpr size_t kStreamBufferCount = 4;
+
+// Size and number of the aligned buffers BlockWriter keeps in flight, and the
+// shortest run of zeroes it hands to BLKZEROOUT rather than writing out.
+constexpr size_t kWriteBufferSize = 2 * 1048576;
+constexpr size_t kWriteBufferCount = 4;
+constexpr uint64_t kZeroOutThreshold = 1048576;
+constexpr uint64_t kDirectIoAlignment = 4096;
+
 void WipeOverlayfsForPartition(FastbootDevice* device, const std::string& partition_name) {
     // May be called, in the case of sparse data, multiple times so cache/skip.
     static std::set<std::string> wiped;
@@ -74,64 +121,568 @@ void WipeOverlayfsForPartition(FastbootDevice* device, const std::string& partit
     }
 }
 
-}  // namespace
+// Writes an image to a partition at explicit offsets. Output is staged in
+// large aligned buffers that are handed to io_uring as they fill, so several
+// O_DIRECT writes are outstanding while the next buffer is being filled.
+// Skipped ranges cost nothing, and long runs of zeroes are issued as
+// BLKZEROOUT, which the storage can usually complete without any data being
+// transferred. Falls back to synchronous writes if io_uring is unavailable.
+class BlockWriter {
+  public:
+    explicit BlockWriter(PartitionHandle* handle) : handle_(handle) {}
+
+    ~BlockWriter() {
+        if (ring_ok_) {
+            Drain();
+            io_uring_queue_exit(&ring_);
+        }
+    }
+
+    bool Init() {
+        for (auto& buffer : buffers_) {
+            void* data;
+            if (posix_memalign(&data, kDirectIoAlignment, kWriteBufferSize)) {
+                PLOG(ERROR) << "Failed to allocate write buffer";
+                return false;
+            }
+            buffer.data.reset(static_cast<char*>(data));
+            free_.push_back(&buffer);
+        }
+        int ret = io_uring_queue_init(kWriteBufferCount, &ring_, 0);
+        if (ret < 0) {
+            LOG(WARNING) << "io_uring unavailable, writing synchronously: " << strerror(-ret);
+        } else {
+            ring_ok_ = true;
+        }
+        return true;
+    }
 
-int FlashRawDataChunk(PartitionHandle* handle, const char* data, size_t len) {
-    size_t ret = 0;
-    const size_t max_write_size = 1048576;
-    void* aligned_buffer;
+    // Bytes of output written, queued or skipped so far.
+    uint64_t offset() const { return offset_; }
 
-    if (posix_memalign(&aligned_buffer, 4096, max_write_size)) {
-        PLOG(ERROR) << "Failed to allocate write buffer";
-        return -ENOMEM;
+    // All of these return 0 or a negative errno, which may come from an
+    // earlier write that has only now completed.
+    int Write(const char* data, size_t len) {
+        while (len > 0) {
+            int ret = Current();
+            if (ret < 0) {
+                return ret;
+            }
+            size_t n = std::min(kWriteBufferSize - current_->len, len);
+            memcpy(current_->data.get() + current_->len, data, n);
+            current_->len += n;
+            offset_ += n;
+            data += n;
+            len -= n;
+            if (current_->len == kWriteBufferSize) {
+                ret = Submit();
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+        }
+        return 0;
+    }
+
+    // Writes |len| bytes of the repeated 32-bit |value|. Sparse output is
+    // always a multiple of 4 bytes, so the pattern stays in phase.
+    int Fill(uint32_t value, uint64_t len) {
+        if (value == 0 && zero_out_) {
+            // Pad up to an aligned offset through the buffers, so that the
+            // bulk of the run can be zeroed in place.
+            uint64_t head = std::min(len, -offset_ & (kDirectIoAlignment - 1));
+            int ret = Pattern(0, head);
+            if (ret < 0) {
+                return ret;
+            }
+            len -= head;
+            uint64_t body = len & ~(kDirectIoAlignment - 1);
+            if (body >= kZeroOutThreshold) {
+                ret = ZeroOut(body);
+                if (ret < 0) {
+                    return ret;
+                }
+                if (ret > 0) {
+                    len -= body;
+                }
+            }
+        }
+        return Pattern(value, len);
+    }
+
+    int Skip(uint64_t len) {
+        int ret = Submit();
+        if (ret < 0) {
+            return ret;
+        }
+        offset_ += len;
+        return 0;
+    }
+
+    // Writes out whatever is still staged and waits for every outstanding
+    // write.
+    int Finish() {
+        int ret = Submit();
+        Drain();
+        return ret < 0 ? ret : error_;
+    }
+
+  private:
+    struct Buffer {
+        std::unique_ptr<char, decltype(&free)> data{nullptr, free};
+        size_t len = 0;
+        uint64_t offset = 0;
+        // Must stay valid until the write completes.
+        struct iovec iov = {};
+    };
+
+    // Makes sure there is a buffer to stage output at |offset_| into, waiting
+    // for an outstanding write to finish if they are all in use.
+    int Current() {
+        if (error_) {
+            return error_;
+        }
+        if (current_) {
+            return 0;
+        }
+        while (free_.empty()) {
+            int ret = WaitOne();
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        current_ = free_.back();
+        free_.pop_back();
+        current_->len = 0;
+        current_->offset = offset_;
+        return error_;
+    }
+
+    int Pattern(uint32_t value, uint64_t len) {
+        while (len > 0) {
+            int ret = Current();
+            if (ret < 0) {
+                return ret;
+            }
+            size_t n = std::min<uint64_t>(kWriteBufferSize - current_->len, len);
+            char* out = current_->data.get() + current_->len;
+            for (size_t i = 0; i < n; i += sizeof(value)) {
+                memcpy(out + i, &value, std::min(sizeof(value), n - i));
+            }
+            current_->len += n;
+            offset_ += n;
+            len -= n;
+            if (current_->len == kWriteBufferSize) {
+                ret = Submit();
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+        }
+        return 0;
     }
 
-    auto aligned_buffer_unique_ptr = std::unique_ptr<void, decltype(&free)>{aligned_buffer, free};
+    // Zeroes |len| bytes at the aligned |offset_|. Returns 1 if it did, 0 if
+    // the caller should write the zeroes itself, or a negative errno.
+    int ZeroOut(uint64_t len) {
+        int ret = Submit();
+        if (ret < 0) {
+            return ret;
+        }
+        uint64_t range[2] = {offset_, len};
+        if (ioctl(handle_->fd(), BLKZEROOUT, range) < 0) {
+            PLOG(WARNING) << "BLKZEROOUT failed, writing zeroes instead";
+            zero_out_ = false;
+            return 0;
+        }
+        offset_ += len;
+        return 1;
+    }
 
-    while (ret < len) {
-        int this_len = std::min(max_write_size, len - ret);
-        memcpy(aligned_buffer_unique_ptr.get(), data, this_len);
-        // In case of non 4KB aligned writes, reopen without O_DIRECT flag
-        if (this_len & 0xFFF) {
-            if (handle->Reset(O_WRONLY) != true) {
+    // Starts writing the current buffer, if there is one.
+    int Submit() {
+        Buffer* buffer = current_;
+        if (!buffer) {
+            return error_;
+        }
+        current_ = nullptr;
+        if (buffer->len == 0) {
+            free_.push_back(buffer);
+            return error_;
+        }
+        if ((buffer->offset | buffer->len) & (kDirectIoAlignment - 1)) {
+            // In case of non 4KB aligned writes, reopen without O_DIRECT flag.
+            // Nothing may be in flight on the old descriptor.
+            Drain();
+            if (!handle_->Reset(O_WRONLY)) {
                 PLOG(ERROR) << "Failed to reset file descriptor";
-                return -1;
+                free_.push_back(buffer);
+                return -EIO;
+            }
+        }
+        if (!ring_ok_) {
+            int ret = 0;
+            if (!android::base::WriteFullyAtOffset(handle_->fd(), buffer->data.get(), buffer->len,
+                                                   buffer->offset)) {
+                ret = -errno;
+                PLOG(ERROR) << "Failed to flash data of len " << buffer->len;
             }
+            free_.push_back(buffer);
+            return ret;
         }
+        // The ring has an entry for every buffer, so there is always room.
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+        buffer->iov = {buffer->data.get(), buffer->len};
+        io_uring_prep_writev(sqe, handle_->fd(), &buffer->iov, 1, buffer->offset);
+        io_uring_sqe_set_data(sqe, buffer);
+        int ret = io_uring_submit(&ring_);
+        if (ret < 0) {
+            LOG(ERROR) << "io_uring_submit failed: " << strerror(-ret);
+            free_.push_back(buffer);
+            return ret;
+        }
+        in_flight_++;
+        return error_;
+    }
 
-        int this_ret = write(handle->fd(), aligned_buffer_unique_ptr.get(), this_len);
-        if (this_ret < 0) {
-            PLOG(ERROR) << "Failed to flash data of len " << len;
-            return -1;
+    // Reaps one completed write. Failed writes are recorded in error_; only a
+    // failure to wait at all is returned.
+    int WaitOne() {
+        struct io_uring_cqe* cqe;
+        int ret = TEMP_FAILURE_RETRY(io_uring_wait_cqe(&ring_, &cqe));
+        if (ret < 0) {
+            LOG(ERROR) << "io_uring_wait_cqe failed: " << strerror(-ret);
+            error_ = ret;
+            return ret;
+        }
+        Buffer* buffer = static_cast<Buffer*>(io_uring_cqe_get_data(cqe));
+        if (cqe->res < 0) {
+            LOG(ERROR) << "Failed to flash data of len " << buffer->len << ": "
+                       << strerror(-cqe->res);
+            if (!error_) error_ = cqe->res;
+        } else if (static_cast<size_t>(cqe->res) != buffer->len) {
+            LOG(ERROR) << "Short write of " << cqe->res << " bytes, expected " << buffer->len;
+            if (!error_) error_ = -EIO;
         }
-        data += this_ret;
-        ret += this_ret;
+        io_uring_cqe_seen(&ring_, cqe);
+        in_flight_--;
+        free_.push_back(buffer);
+        return 0;
     }
-    return 0;
-}
 
-int FlashRawData(PartitionHandle* handle, const std::vector<char>& downloaded_data) {
-    int ret = FlashRawDataChunk(handle, downloaded_data.data(), downloaded_data.size());
-    if (ret < 0) {
-        return -errno;
+    void Drain() {
+        while (in_flight_ > 0 && WaitOne() == 0) {
+        }
+    }
+
+    PartitionHandle* handle_;
+    struct io_uring ring_ = {};
+    bool ring_ok_ = false;
+    // Cleared once BLKZEROOUT has failed, e.g. because the partition is not
+    // a block device.
+    bool zero_out_ = true;
+
+    std::array<Buffer, kWriteBufferCount> buffers_;
+    std::vector<Buffer*> free_;
+    Buffer* current_ = nullptr;
+    size_t in_flight_ = 0;
+    uint64_t offset_ = 0;
+    int error_ = 0;
+};
+
+// Decodes a raw or sparse image, in pieces of any size, and writes it to the
+// partition through a BlockWriter, so the block device keeps seeing large
+// O_DIRECT writes even though the pieces do not line up with sparse chunks.
+// FILL chunks of zeroes become BLKZEROOUT and DONT_CARE chunks are skipped.
+// CRC32 chunks are not checked here; FlashSparseData() validates them up
+// front when the whole image is available.
+class StreamWriter {
+  public:
+    StreamWriter(PartitionHandle* handle, uint64_t block_device_size, bool copy_avb_footer)
+        : writer_(handle), block_device_size_(block_device_size), copy_avb_footer_(copy_avb_footer) {}
+
+    bool Init() { return writer_.Init(); }
+
+    // Consumes the next |len| bytes of the image. Returns 0 or a negative errno.
+    int Write(const char* data, size_t len) {
+        while (len > 0) {
+            int ret = 0;
+            switch (state_) {
+                case State::kStart:
+                    ret = Start(&data, &len);
+                    break;
+                case State::kRaw:
+                    ret = WriteRaw(&data, &len);
+                    break;
+                case State::kFileHeader:
+                    ret = ParseFileHeader(&data, &len);
+                    break;
+                case State::kChunkHeader:
+                    ret = ParseChunkHeader(&data, &len);
+                    break;
+                case State::kChunkData:
+                    ret = WriteChunkData(&data, &len);
+                    break;
+                case State::kDone:
+                    LOG(ERROR) << "Trailing data after the last sparse chunk";
+                    ret = -EINVAL;
+                    break;
+            }
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        return 0;
+    }
+
+    // Called once the whole image has been consumed.
+    int Finish() {
+        if (state_ == State::kStart) {
+            // Too short to hold a sparse header, so it can only be raw data.
+            int ret = StartRaw();
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        if (state_ == State::kRaw) {
+            int ret = MaybeCopyAVBFooter();
+            if (ret < 0) {
+                return ret;
+            }
+        } else if (state_ != State::kDone) {
+            LOG(ERROR) << "Sparse image is truncated";
+            return -EINVAL;
+        }
+        return writer_.Finish();
+    }
+
+  private:
+    enum class State {
+        kStart,
+        kRaw,
+        kFileHeader,
+        kChunkHeader,
+        kChunkData,
+        kDone,
+    };
+
+    // Accumulates |want| bytes of header into header_. Returns true once they
+    // are all there.
+    bool Gather(const char** data, size_t* len, size_t want) {
+        size_t n = std::min(want - header_.size(), *len);
+        header_.append(*data, n);
+        *data += n;
+        *len -= n;
+        return header_.size() == want;
+    }
+
+    // Advances past |*skip| bytes of input that carry no image data.
+    static void Discard(const char** data, size_t* len, size_t* skip) {
+        size_t n = std::min(*skip, *len);
+        *data += n;
+        *len -= n;
+        *skip -= n;
+    }
+
+    int Start(const char** data, size_t* len) {
+        if (!Gather(data, len, sizeof(SPARSE_HEADER_MAGIC))) {
+            return 0;
+        }
+        uint32_t magic;
+        memcpy(&magic, header_.data(), sizeof(magic));
+        if (magic == SPARSE_HEADER_MAGIC) {
+            state_ = State::kFileHeader;
+            return 0;
+        }
+        return StartRaw();
+    }
+
+    // Writes out the bytes gathered while looking for the sparse magic.
+    int StartRaw() {
+        state_ = State::kRaw;
+        std::string head = std::move(header_);
+        header_.clear();
+        const char* head_data = head.data();
+        size_t head_len = head.size();
+        return WriteRaw(&head_data, &head_len);
+    }
+
+    int WriteRaw(const char** data, size_t* len) {
+        if (copy_avb_footer_) {
+            // Remember the last AVB_FOOTER_SIZE bytes seen, the candidate footer.
+            if (*len >= AVB_FOOTER_SIZE) {
+                tail_.assign(*data + *len - AVB_FOOTER_SIZE, AVB_FOOTER_SIZE);
+            } else {
+                tail_.append(*data, *len);
+                if (tail_.size() > AVB_FOOTER_SIZE) {
+                    tail_.erase(0, tail_.size() - AVB_FOOTER_SIZE);
+                }
+            }
+        }
+        int ret = writer_.Write(*data, *len);
+        *data += *len;
+        *len = 0;
+        return ret;
+    }
+
+    int ParseFileHeader(const char** data, size_t* len) {
+        if (header_skip_ == 0) {
+            if (!Gather(data, len, sizeof(SparseHeader))) {
+                return 0;
+            }
+            memcpy(&sparse_header_, header_.data(), sizeof(sparse_header_));
+            header_.clear();
+            if (sparse_header_.major_version != 1 ||
+                sparse_header_.file_hdr_sz < sizeof(SparseHeader) ||
+                sparse_header_.chunk_hdr_sz < sizeof(SparseChunkHeader) ||
+                sparse_header_.blk_sz == 0 || sparse_header_.blk_sz % 4 != 0) {
+                LOG(ERROR) << "Unable to open sparse data for flashing";
+                return -EINVAL;
+            }
+            uint64_t image_size =
+                    static_cast<uint64_t>(sparse_header_.total_blks) * sparse_header_.blk_sz;
+            if (image_size > block_device_size_) {
+                LOG(ERROR) << "Cannot flash " << image_size << " bytes to block device of size "
+                           << block_device_size_;
+                return -EOVERFLOW;
+            }
+            chunks_left_ = sparse_header_.total_chunks;
+            header_skip_ = sparse_header_.file_hdr_sz - sizeof(SparseHeader);
+        }
+        Discard(data, len, &header_skip_);
+        if (header_skip_ == 0) {
+            state_ = chunks_left_ ? State::kChunkHeader : State::kDone;
+        }
+        return 0;
+    }
+
+    int ParseChunkHeader(const char** data, size_t* len) {
+        if (header_skip_ == 0 && !chunk_header_valid_) {
+            if (!Gather(data, len, sizeof(SparseChunkHeader))) {
+                return 0;
+            }
+            memcpy(&chunk_header_, header_.data(), sizeof(chunk_header_));
+            header_.clear();
+            chunk_header_valid_ = true;
+            header_skip_ = sparse_header_.chunk_hdr_sz - sizeof(SparseChunkHeader);
+        }
+        Discard(data, len, &header_skip_);
+        if (header_skip_ != 0) {
+            return 0;
+        }
+        chunk_header_valid_ = false;
+
+        if (chunk_header_.total_sz < sparse_header_.chunk_hdr_sz) {
+            LOG(ERROR) << "Invalid sparse chunk size " << chunk_header_.total_sz;
+            return -EINVAL;
+        }
+        uint64_t out_len = static_cast<uint64_t>(chunk_header_.chunk_sz) * sparse_header_.blk_sz;
+        uint64_t data_len = chunk_header_.total_sz - sparse_header_.chunk_hdr_sz;
+        switch (chunk_header_.chunk_type) {
+            case CHUNK_TYPE_RAW:
+                if (data_len != out_len) break;
+                chunk_left_ = out_len;
+                state_ = State::kChunkData;
+                return 0;
+            case CHUNK_TYPE_FILL:
+            case CHUNK_TYPE_CRC32:
+                if (data_len != sizeof(uint32_t)) break;
+                chunk_left_ = sizeof(uint32_t);
+                state_ = State::kChunkData;
+                return 0;
+            case CHUNK_TYPE_DONT_CARE:
+                if (data_len != 0) break;
+                return NextChunk(writer_.Skip(out_len));
+            default:
+                LOG(ERROR) << "Unknown sparse chunk type " << chunk_header_.chunk_type;
+                return -EINVAL;
+        }
+        LOG(ERROR) << "Invalid size for sparse chunk of type " << chunk_header_.chunk_type;
+        return -EINVAL;
+    }
+
+    int WriteChunkData(const char** data, size_t* len) {
+        if (chunk_header_.chunk_type == CHUNK_TYPE_RAW) {
+            size_t n = std::min<uint64_t>(chunk_left_, *len);
+            int ret = writer_.Write(*data, n);
+            *data += n;
+            *len -= n;
+            chunk_left_ -= n;
+            return chunk_left_ ? ret : NextChunk(ret);
+        }
+        if (!Gather(data, len, sizeof(uint32_t))) {
+            return 0;
+        }
+        uint32_t value;
+        memcpy(&value, header_.data(), sizeof(value));
+        header_.clear();
+        if (chunk_header_.chunk_type == CHUNK_TYPE_CRC32) {
+            return NextChunk(0);
+        }
+        uint64_t out_len = static_cast<uint64_t>(chunk_header_.chunk_sz) * sparse_header_.blk_sz;
+        return NextChunk(writer_.Fill(value, out_len));
     }
-    return ret;
-}
 
-int WriteCallback(void* priv, const void* data, size_t len) {
-    PartitionHandle* handle = reinterpret_cast<PartitionHandle*>(priv);
-    if (!data) {
-        if (lseek64(handle->fd(), len, SEEK_CUR) < 0) {
-            int rv = -errno;
-            PLOG(ERROR) << "lseek failed";
-            return rv;
+    int NextChunk(int ret) {
+        if (ret < 0) {
+            return ret;
         }
+        state_ = --chunks_left_ ? State::kChunkHeader : State::kDone;
         return 0;
     }
-    return FlashRawDataChunk(handle, reinterpret_cast<const char*>(data), len);
+
+    // Same layout as CopyAVBFooter(): zeroes up to the end of the block device,
+    // with the footer at the very end.
+    int MaybeCopyAVBFooter() {
+        if (!copy_avb_footer_ || tail_.size() < AVB_FOOTER_SIZE ||
+            tail_.compare(0, AVB_FOOTER_MAGIC_LEN, AVB_FOOTER_MAGIC) != 0) {
+            return 0;
+        }
+        // The writer can't go back, so the copy may not overlap what is already written.
+        if (writer_.offset() > block_device_size_ ||
+            block_device_size_ - writer_.offset() < AVB_FOOTER_SIZE) {
+            LOG(ERROR) << "Cannot copy the AVB footer of a " << writer_.offset()
+                       << " byte image to the end of a block device of size "
+                       << block_device_size_;
+            return -EOVERFLOW;
+        }
+        int ret = writer_.Fill(0, block_device_size_ - AVB_FOOTER_SIZE - writer_.offset());
+        if (ret < 0) {
+            return ret;
+        }
+        return writer_.Write(tail_.data(), tail_.size());
+    }
+
+    BlockWriter writer_;
+    uint64_t block_device_size_;
+    bool copy_avb_footer_;
+
+    State state_ = State::kStart;
+    std::string header_;
+    size_t header_skip_ = 0;
+    std::string tail_;
+    SparseHeader sparse_header_ = {};
+    SparseChunkHeader chunk_header_ = {};
+    bool chunk_header_valid_ = false;
+    uint32_t chunks_left_ = 0;
+    uint64_t chunk_left_ = 0;
+};
+
+}  // namespace
+
+int FlashRawData(PartitionHandle* handle, const std::vector<char>& downloaded_data) {
+    BlockWriter writer(handle);
+    if (!writer.Init()) {
+        return -ENOMEM;
+    }
+    int ret = writer.Write(downloaded_data.data(), downloaded_data.size());
+    int finish_ret = writer.Finish();
+    return ret < 0 ? ret : finish_ret;
 }
 
 int FlashSparseData(PartitionHandle* handle, std::vector<char>& downloaded_data) {
+    // Parse the image once up front so that a corrupt one, including a bad
+    // CRC32 chunk, is rejected before anything is written.
     struct sparse_file* file = sparse_file_import_buf(downloaded_data.data(),
                                                       downloaded_data.size(), true, false);
     if (!file) {
@@ -139,11 +690,18 @@ int FlashSparseData(PartitionHandle* handle, std::vector<char>& downloaded_data)
         LOG(ERROR) << "Unable to open sparse data for flashing";
         return -EINVAL;
     }
-    return sparse_file_callback(file, false, false, WriteCallback, reinterpret_cast<void*>(handle));
+    sparse_file_destroy(file);
+
+    StreamWriter writer(handle, get_block_device_size(handle->fd()), false);
+    if (!writer.Init()) {
+        return -ENOMEM;
+    }
+    int ret = writer.Write(downloaded_data.data(), downloaded_data.size());
+    int finish_ret = writer.Finish();
+    return ret < 0 ? ret : finish_ret;
 }
 
 int FlashBlockDevice(PartitionHandle* handle, std::vector<char>& downloaded_data) {
-    lseek64(handle->fd(), 0, SEEK_SET);
     if (downloaded_data.size() >= sizeof(SPARSE_HEADER_MAGIC) &&
         *reinterpret_cast<uint32_t*>(downloaded_data.data()) == SPARSE_HEADER_MAGIC) {
         return FlashSparseData(handle, downloaded_data);
@@ -152,6 +710,12 @@ int FlashBlockDevice(PartitionHandle* handle, std::vector<char>& downloaded_data
     }
 }
 
+static bool IsBootPartition(const std::string& partition_name) {
+    return partition_name == "boot" || partition_name == "boot_a" || partition_name == "boot_b" ||
+           partition_name == "init_boot" || partition_name == "init_boot_a" ||
+           partition_name == "init_boot_b";
+}
+
 static void CopyAVBFooter(std::vector<char>* data, const uint64_t block_device_size) {
     if (data->size() < AVB_FOOTER_SIZE) {
         return;
@@ -189,10 +753,7 @@ int Flash(FastbootDevice* device, const std::string& partition_name) {
         LOG(ERROR) << "Cannot flash " << data.size() << " bytes to block device of size "
                    << block_device_size;
         return -EOVERFLOW;
-    } else if (data.size() < block_device_size &&
-               (partition_name == "boot" || partition_name == "boot_a" ||
-                partition_name == "boot_b" || partition_name == "init_boot" ||
-                partition_name == "init_boot_a" || partition_name == "init_boot_b")) {
+    } else if (data.size() < block_device_size && IsBootPartition(partition_name)) {
         CopyAVBFooter(&data, block_device_size);
     }
     if (android::base::GetProperty("ro.system.build.type", "") != "user") {
@@ -203,6 +764,116 @@ int Flash(FastbootDevice* device, const std::string& partition_name) {
     return result;
 }
 
+namespace {
+
+// Buffers filled by the transport, or returned to it by the writer. A null
+// buffer marks the end of the stream.
+struct StreamBuffer {
+    std::vector<char> data;
+    size_t size = 0;
+};
+
+class StreamBufferQueue {
+  public:
+    void Push(StreamBuffer* buffer) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(buffer);
+        }
+        cv_.notify_one();
+    }
+
+    StreamBuffer* Pop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return !queue_.empty(); });
+        StreamBuffer* buffer = queue_.front();
+        queue_.pop_front();
+        return buffer;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<StreamBuffer*> queue_;
+};
+
+}  // namespace
+
+int StreamFlash(FastbootDevice* device, const std::string& partition_name, uint32_t size) {
+    PartitionHandle handle;
+    if (!OpenPartition(device, partition_name, &handle, O_WRONLY | O_DIRECT)) {
+        return -ENOENT;
+    }
+
+    if (size == 0) {
+        LOG(ERROR) << "Cannot flash empty data vector";
+        return -EINVAL;
+    }
+    uint64_t block_device_size = get_block_device_size(handle.fd());
+    if (size > block_device_size) {
+        LOG(ERROR) << "Cannot flash " << size << " bytes to block device of size "
+                   << block_device_size;
+        return -EOVERFLOW;
+    }
+    StreamWriter writer(&handle, block_device_size,
+                        size < block_device_size && IsBootPartition(partition_name));
+    if (!writer.Init()) {
+        return -ENOMEM;
+    }
+    if (android::base::GetProperty("ro.system.build.type", "") != "user") {
+        WipeOverlayfsForPartition(device, partition_name);
+    }
+
+    if (!device->WriteStatus(FastbootResult::DATA, android::base::StringPrintf("%08x", size))) {
+        return -EIO;
+    }
+
+    // The transport fills buffers on this thread while the writer thread
+    // decodes and writes the previous ones. If writing fails, the writer keeps
+    // recycling buffers so the rest of the payload is still drained and the
+    // host sees the failure in the final response.
+    std::vector<StreamBuffer> buffers(kStreamBufferCount);
+    StreamBufferQueue free_buffers, full_buffers;
+    for (auto& buffer : buffers) {
+        buffer.data.resize(kStreamBufferSize);
+        free_buffers.Push(&buffer);
+    }
+
+    int write_result = 0;
+    std::thread writer_thread([&] {
+        while (StreamBuffer* buffer = full_buffers.Pop()) {
+            if (write_result == 0) {
+                write_result = writer.Write(buffer->data.data(), buffer->size);
+            }
+            free_buffers.Push(buffer);
+        }
+        if (write_result == 0) {
+            write_result = writer.Finish();
+        }
+    });
+
+    bool read_ok = true;
+    for (uint32_t remaining = size; remaining > 0;) {
+        StreamBuffer* buffer = free_buffers.Pop();
+        buffer->size = std::min<size_t>(remaining, kStreamBufferSize);
+        if (!device->HandleData(true, buffer->data.data(), buffer->size)) {
+            read_ok = false;
+            break;
+        }
+        remaining -= buffer->size;
+        full_buffers.Push(buffer);
+    }
+    full_buffers.Push(nullptr);
+    writer_thread.join();
+    sync();
+
+    if (!read_ok) {
+        PLOG(ERROR) << "Couldn't download data";
+        return -EIO;
+    }
+    return write_result;
+}
+
 static void RemoveScratchPartition() {
     AutoMountMetadata mount_metadata;
     android::fs_mgr::TeardownAllOverlayForMountPoint();
@@ -16,10 +16,17 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include <string>
 #include <vector>
 
 class FastbootDevice;
 
 int Flash(FastbootDevice* device, const std::string& partition_name);
+// Receives a |size| byte image from the transport and writes it to the
+// partition while it is still arriving, instead of staging it in
+// download_data(). Sends the DATA response itself; returns 0 or a negative
+// errno once the whole payload has been consumed.
+int StreamFlash(FastbootDevice* device, const std::string& partition_name, uint32_t size);
 bool UpdateSuper(FastbootDevice* device, const std::string& super_name, bool wipe);
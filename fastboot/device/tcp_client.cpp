@@ -123,6 +123,28 @@ ssize_t ClientTcpTransport::Write(const void* data, size_t len) {
     return len;
 }
 
+ssize_t ClientTcpTransport::WriteFromFd(int fd, int64_t offset, size_t len) {
+    if (socket_ == nullptr || len > SSIZE_MAX) {
+        return -1;
+    }
+
+    char header[8];
+    EncodeMessageLength(len, header);
+    if (!socket_->Send(header, sizeof(header))) {
+        socket_.reset(nullptr);
+        return -1;
+    }
+    if (!socket_->SendFile(fd, offset, len)) {
+        // The header is already out, so there is no falling back to Write().
+        socket_.reset(nullptr);
+        return -1;
+    }
+
+    // File contents are never a DATA response.
+    downloading_ = false;
+    return len;
+}
+
 int ClientTcpTransport::Close() {
     if (socket_ == nullptr) {
         return -1;
@@ -27,6 +27,7 @@ class ClientTcpTransport : public Transport {
 
     ssize_t Read(void* data, size_t len) override;
     ssize_t Write(const void* data, size_t len) override;
+    ssize_t WriteFromFd(int fd, int64_t offset, size_t len) override;
     int Close() override;
     int Reset() override;
 
@@ -62,9 +62,9 @@ static void aio_block_init(aio_block* aiob, unsigned num_bufs) {
     for (unsigned i = 0; i < num_bufs; i++) {
         aiob->iocbs[i] = &aiob->iocb[i];
     }
-    memset(&aiob->ctx, 0, sizeof(aiob->ctx));
-    if (io_setup(num_bufs, &aiob->ctx)) {
-        D("[ aio: got error on io_setup (%d) ]", errno);
+    aiob->ctx = nullptr;
+    if (asyncio_setup(num_bufs, 0, &aiob->ctx)) {
+        D("[ aio: got error on asyncio_setup (%d) ]", errno);
     }
 }
 
@@ -149,12 +149,14 @@ static int usb_ffs_do_aio(usb_handle* h, const void* data, int len, bool read) {
     }
 
     while (true) {
-        if (TEMP_FAILURE_RETRY(io_submit(aiob->ctx, num_bufs, aiob->iocbs.data())) < num_bufs) {
+        if (aiob->ctx == nullptr ||
+            TEMP_FAILURE_RETRY(asyncio_submit(aiob->ctx, num_bufs, aiob->iocbs.data())) <
+                    num_bufs) {
             PLOG(ERROR) << "aio: got error submitting " << (read ? "read" : "write");
             return -1;
         }
-        if (TEMP_FAILURE_RETRY(io_getevents(aiob->ctx, num_bufs, num_bufs, aiob->events.data(),
-                                            nullptr)) < num_bufs) {
+        if (TEMP_FAILURE_RETRY(asyncio_getevents(aiob->ctx, num_bufs, num_bufs,
+                                                 aiob->events.data(), nullptr)) < num_bufs) {
             PLOG(ERROR) << "aio: got error waiting " << (read ? "read" : "write");
             return -1;
         }
@@ -243,7 +245,8 @@ std::unique_ptr<usb_handle> create_usb_handle(unsigned num_bufs, unsigned io_siz
         aio_block_init(&h->read_aiob, num_bufs);
         aio_block_init(&h->write_aiob, num_bufs);
         h->aio_type = AIOType::AIO;
-        LOG(INFO) << "Using aio for usb ffs";
+        const bool io_uring = h->read_aiob.ctx && asyncio_is_io_uring(h->read_aiob.ctx);
+        LOG(INFO) << "Using " << (io_uring ? "io_uring" : "aio") << " context for usb ffs";
     }
     h->io_size = io_size;
     h->close = usb_ffs_close;
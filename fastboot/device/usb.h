@@ -32,7 +32,7 @@ struct aio_block {
     std::vector<struct iocb> iocb;
     std::vector<struct iocb*> iocbs;
     std::vector<struct io_event> events;
-    aio_context_t ctx;
+    asyncio_context* ctx;
     int num_submitted;
     int fd;
 };
@@ -515,6 +515,18 @@ bool GetMaxFetchSize(FastbootDevice* /* device */, const std::vector<std::string
     return true;
 }
 
+bool GetStreamFlash(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                    std::string* message) {
+    *message = "yes";
+    return true;
+}
+
+bool GetDownloadCompression(FastbootDevice* /* device */,
+                            const std::vector<std::string>& /* args */, std::string* message) {
+    *message = "lz4";
+    return true;
+}
+
 bool GetDmesg(FastbootDevice* device) {
     if (GetDeviceLockStatus()) {
         return device->WriteFail("Cannot use when device flashing is locked");
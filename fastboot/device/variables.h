@@ -84,6 +84,10 @@ bool GetTrebleEnabled(FastbootDevice* device, const std::vector<std::string>& ar
                       std::string* message);
 bool GetMaxFetchSize(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
                      std::string* message);
+bool GetStreamFlash(FastbootDevice* /* device */, const std::vector<std::string>& /* args */,
+                    std::string* message);
+bool GetDownloadCompression(FastbootDevice* /* device */,
+                            const std::vector<std::string>& /* args */, std::string* message);
 
 // Complex cases.
 bool GetDmesg(FastbootDevice* device);
@@ -41,13 +41,19 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <regex>
 #include <sstream>
 #include <string>
@@ -98,6 +104,7 @@ using namespace std::placeholders;
 static const char* serial = nullptr;
 
 static bool g_long_listing = false;
+static bool g_all_devices = false;
 // Don't resparse files in too-big chunks.
 // libsparse will support INT_MAX, but this results in large allocations, so
 // let's keep it at 1GB to avoid memory pressure on the host.
@@ -111,6 +118,8 @@ static std::string g_cmdline;
 static std::string g_dtb_path;
 
 static bool g_disable_verity = false;
+static bool g_stream_flash = false;
+static bool g_compress_download = false;
 static bool g_disable_verification = false;
 
 fastboot::FastBootDriver* fb = nullptr;
@@ -201,30 +210,65 @@ std::string find_item(const std::string& item) {
 
 double last_start_time;
 
+// In multi-device mode, the serial number that starts each line printed for
+// this process's device. Status lines are then printed whole once the step
+// finishes, so lines for different devices are not mixed up.
+static std::string g_device_tag;
+static std::string g_status;
+
 static void Status(const std::string& message) {
     if (!message.empty()) {
         static constexpr char kStatusFormat[] = "%-50s ";
-        fprintf(stderr, kStatusFormat, message.c_str());
+        if (g_device_tag.empty()) {
+            fprintf(stderr, kStatusFormat, message.c_str());
+        } else {
+            g_status = android::base::StringPrintf(kStatusFormat, message.c_str());
+        }
     }
     last_start_time = now();
 }
 
+// Ends the line started by Status() with |result|.
+static void StatusResult(const std::string& result) {
+    if (g_device_tag.empty()) {
+        fprintf(stderr, "%s\n", result.c_str());
+    } else {
+        fprintf(stderr, "%s: %s%s\n", g_device_tag.c_str(), g_status.c_str(), result.c_str());
+        g_status.clear();
+    }
+}
+
 static void Epilog(int status) {
     if (status) {
-        fprintf(stderr, "FAILED (%s)\n", fb->Error().c_str());
+        StatusResult("FAILED (" + fb->Error() + ")");
         die("Command failed");
     } else {
         double split = now();
-        fprintf(stderr, "OKAY [%7.3fs]\n", (split - last_start_time));
+        StatusResult(android::base::StringPrintf("OKAY [%7.3fs]", (split - last_start_time)));
     }
 }
 
+// Prints a status line for a step that has already finished, in the same
+// format as Status() followed by Epilog().
+static void StatusWithTime(const std::string& message, double seconds) {
+    Status(message);
+    StatusResult(android::base::StringPrintf("OKAY [%7.3fs]", seconds));
+}
+
 static void InfoMessage(const std::string& info) {
-    fprintf(stderr, "(bootloader) %s\n", info.c_str());
+    if (g_device_tag.empty()) {
+        fprintf(stderr, "(bootloader) %s\n", info.c_str());
+    } else {
+        fprintf(stderr, "%s: (bootloader) %s\n", g_device_tag.c_str(), info.c_str());
+    }
 }
 
 static void TextMessage(const std::string& text) {
-    fprintf(stderr, "%s", text.c_str());
+    if (g_device_tag.empty()) {
+        fprintf(stderr, "%s", text.c_str());
+    } else {
+        fprintf(stderr, "%s: %s", g_device_tag.c_str(), text.c_str());
+    }
 }
 
 bool ReadFileToVector(const std::string& file, std::vector<char>* out) {
@@ -518,6 +562,19 @@ static int Disconnect(int argc, char* argv[]) {
     return 0;
 }
 
+// Serial numbers of the USB devices in fastboot mode.
+static std::vector<std::string> list_usb_serials() {
+    std::vector<std::string> serials;
+    usb_open([&serials](usb_ifc_info* info) -> int {
+        if (match_fastboot_with_serial(info, nullptr) == 0 && info->serial_number[0]) {
+            serials.emplace_back(info->serial_number);
+        }
+        // Don't open anything.
+        return -1;
+    });
+    return serials;
+}
+
 static void list_devices() {
     // We don't actually open a USB device here,
     // just getting our callback called so we can
@@ -619,6 +676,9 @@ static int show_help() {
             " -w                         Wipe userdata.\n"
             " -s SERIAL                  Specify a USB device.\n"
             " -s tcp|udp:HOST[:PORT]     Specify a network device.\n"
+            " -s SERIAL,SERIAL...        Run the commands on several devices at once,\n"
+            "                            preparing flashall/update images only once.\n"
+            " --all                      Like -s, with every USB device in fastboot mode.\n"
             " -S SIZE[K|M|G]             Break into sparse files no larger than SIZE.\n"
             " --force                    Force a flash operation that may be unsafe.\n"
             " --slot SLOT                Use SLOT; 'all' for both slots, 'other' for\n"
@@ -626,6 +686,10 @@ static int show_help() {
             " --set-active[=SLOT]        Sets the active slot before rebooting.\n"
             " --skip-secondary           Don't flash secondary slots in flashall/update.\n"
             " --skip-reboot              Don't reboot device after flashing.\n"
+            " --stream-flash             Write images while they are being sent, on\n"
+            "                            devices that support it.\n"
+            " --compress                 Compress images with lz4 while sending them, on\n"
+            "                            devices that support it.\n"
             " --disable-verity           Sets disable-verity when flashing vbmeta.\n"
             " --disable-verification     Sets disable-verification when flashing vbmeta.\n"
             " --fs-options=OPTION[,OPTION]\n"
@@ -773,6 +837,10 @@ static int make_temporary_fd(const char* what) {
 
 #endif
 
+// Set on FlashAllTool's preparation threads; the main thread reports their
+// progress instead, so it does not interleave with the status lines.
+static thread_local bool g_quiet_unzip = false;
+
 static unique_fd unzip_to_file(ZipArchiveHandle zip, const char* entry_name) {
     unique_fd fd(make_temporary_fd(entry_name));
 
@@ -783,8 +851,10 @@ static unique_fd unzip_to_file(ZipArchiveHandle zip, const char* entry_name) {
         return unique_fd();
     }
 
-    fprintf(stderr, "extracting %s (%" PRIu64 " MB) to disk...", entry_name,
-            zip_entry.uncompressed_length / 1024 / 1024);
+    if (!g_quiet_unzip) {
+        fprintf(stderr, "extracting %s (%" PRIu64 " MB) to disk...", entry_name,
+                zip_entry.uncompressed_length / 1024 / 1024);
+    }
     double start = now();
     int error = ExtractEntryToFile(zip, &zip_entry, fd.get());
     if (error != 0) {
@@ -795,7 +865,9 @@ static unique_fd unzip_to_file(ZipArchiveHandle zip, const char* entry_name) {
         die("\nlseek on extracted file '%s' failed: %s", entry_name, strerror(errno));
     }
 
-    fprintf(stderr, " took %.3fs\n", now() - start);
+    if (!g_quiet_unzip) {
+        fprintf(stderr, " took %.3fs\n", now() - start);
+    }
 
     return fd;
 }
@@ -1014,16 +1086,24 @@ static uint64_t get_uint_var(const char* var_name) {
     return value;
 }
 
-int64_t get_sparse_limit(int64_t size) {
+// Returns the target device's max-download-size, querying it the first time,
+// or 0 if it did not report one. Only needed when -S was not given.
+static int64_t get_target_sparse_limit() {
+    // TODO: shouldn't we apply this limit even if you've used -S?
+    if (sparse_limit == 0 && target_sparse_limit == -1) {
+        target_sparse_limit = static_cast<int64_t>(get_uint_var("max-download-size"));
+    }
+    return target_sparse_limit;
+}
+
+// Like get_sparse_limit(), with the device's limit already known, so it is
+// safe to call away from the main thread.
+static int64_t get_sparse_limit(int64_t size, int64_t target_limit) {
     int64_t limit = sparse_limit;
     if (limit == 0) {
         // Unlimited, so see what the target device's limit is.
-        // TODO: shouldn't we apply this limit even if you've used -S?
-        if (target_sparse_limit == -1) {
-            target_sparse_limit = static_cast<int64_t>(get_uint_var("max-download-size"));
-        }
-        if (target_sparse_limit > 0) {
-            limit = target_sparse_limit;
+        if (target_limit > 0) {
+            limit = target_limit;
         } else {
             return 0;
         }
@@ -1036,7 +1116,11 @@ int64_t get_sparse_limit(int64_t size) {
     return 0;
 }
 
-static bool load_buf_fd(unique_fd fd, struct fastboot_buffer* buf) {
+int64_t get_sparse_limit(int64_t size) {
+    return get_sparse_limit(size, get_target_sparse_limit());
+}
+
+static bool load_buf_fd(unique_fd fd, struct fastboot_buffer* buf, int64_t target_limit) {
     int64_t sz = get_file_size(fd);
     if (sz == -1) {
         return false;
@@ -1054,7 +1138,7 @@ static bool load_buf_fd(unique_fd fd, struct fastboot_buffer* buf) {
     }
 
     lseek(fd.get(), 0, SEEK_SET);
-    int64_t limit = get_sparse_limit(sz);
+    int64_t limit = get_sparse_limit(sz, target_limit);
     buf->fd = std::move(fd);
     if (limit) {
         buf->files = load_sparse_files(buf->fd.get(), limit);
@@ -1070,6 +1154,44 @@ static bool load_buf_fd(unique_fd fd, struct fastboot_buffer* buf) {
     return true;
 }
 
+static bool load_buf_fd(unique_fd fd, struct fastboot_buffer* buf) {
+    return load_buf_fd(std::move(fd), buf, get_target_sparse_limit());
+}
+
+// Loads the image stored at [offset, offset + size) of |fd| without copying it
+// out. Only sparse images and images that must be resparsed anyway can be sent
+// this way; for anything else this returns false and the image should be
+// extracted and loaded with load_buf_fd() instead.
+static bool load_buf_region(unique_fd fd, int64_t offset, int64_t size,
+                            struct fastboot_buffer* buf, int64_t target_limit) {
+    int64_t limit = get_sparse_limit(size, target_limit);
+    bool sparse = is_sparse_file(fd, offset);
+    if (!sparse && !limit) {
+        return false;
+    }
+
+    SparsePtr s(sparse_file_import_region(fd.get(), offset, size, false, true),
+                sparse_file_destroy);
+    if (!s) {
+        return false;
+    }
+    buf->image_size = sparse ? sparse_file_len(s.get(), false, false) : size;
+    if (buf->image_size < 0) {
+        LOG(ERROR) << "Could not compute length of sparse file";
+        return false;
+    }
+
+    if (limit) {
+        buf->files = resparse_file(s.get(), limit);
+    } else {
+        buf->files.emplace_back(std::move(s));
+    }
+    // The sparse files read their data from |fd|.
+    buf->fd = std::move(fd);
+    buf->type = FB_BUFFER_SPARSE;
+    return true;
+}
+
 static bool load_buf(const char* fname, struct fastboot_buffer* buf) {
     unique_fd fd(TEMP_FAILURE_RETRY(open(fname, O_RDONLY | O_BINARY)));
 
@@ -1091,6 +1213,13 @@ static bool load_buf(const char* fname, struct fastboot_buffer* buf) {
     return load_buf_fd(std::move(fd), buf);
 }
 
+// Reads the whole of an FB_BUFFER_FD buffer. This does not use or move the
+// file offset, which is shared with other devices in multi-device mode.
+static bool read_buffer(const struct fastboot_buffer& buf, std::string* data) {
+    data->resize(buf.sz);
+    return android::base::ReadFullyAtOffset(buf.fd, data->data(), data->size(), 0);
+}
+
 static void rewrite_vbmeta_buffer(struct fastboot_buffer* buf, bool vbmeta_in_boot) {
     // Buffer needs to be at least the size of the VBMeta struct which
     // is 256 bytes.
@@ -1099,7 +1228,7 @@ static void rewrite_vbmeta_buffer(struct fastboot_buffer* buf, bool vbmeta_in_bo
     }
 
     std::string data;
-    if (!android::base::ReadFdToString(buf->fd, &data)) {
+    if (!read_buffer(*buf, &data)) {
         die("Failed reading from vbmeta");
     }
 
@@ -1204,16 +1333,13 @@ static void copy_avb_footer(const std::string& partition, struct fastboot_buffer
         return;
     }
 
-    // IMPORTANT: after the following read, we need to reset buf->fd before return (if not die).
-    // Because buf->fd will still be used afterwards.
     std::string data;
-    if (!android::base::ReadFdToString(buf->fd, &data)) {
+    if (!read_buffer(*buf, &data)) {
         die("Failed reading from %s", partition.c_str());
     }
 
     uint64_t footer_offset = buf->sz - AVB_FOOTER_SIZE;
     if (0 != data.compare(footer_offset, AVB_FOOTER_MAGIC_LEN, AVB_FOOTER_MAGIC)) {
-        lseek(buf->fd.get(), 0, SEEK_SET);  // IMPORTANT: resets buf->fd before return.
         return;
     }
 
@@ -1774,6 +1900,10 @@ std::vector<std::unique_ptr<Task>> ParseFastbootInfo(const FlashingPlan* fp, std
 FlashAllTool::FlashAllTool(FlashingPlan* fp) : fp_(fp) {}
 
 void FlashAllTool::Flash() {
+    // Flashing queries the same handful of variables for every partition;
+    // answer them from one "getvar all" instead.
+    fb->set_cache_vars(true);
+
     DumpInfo();
     CheckRequirements();
 
@@ -1892,24 +2022,187 @@ void FlashAllTool::HardcodedFlash() {
     FlashImages(os_images_);
 }
 
+// An image extracted and loaded ready for flash_buf(), with its signature.
+struct PreparedImage {
+    bool ok = false;
+    int error = 0;
+    fastboot_buffer buf;
+    // Empty if the image has no signature.
+    std::vector<char> signature;
+    double extract_time = 0;
+    double load_time = 0;
+    // True if the image is read straight from the source, with no copy.
+    bool in_place = false;
+};
+
+// Prepares |image| from |source| without talking to the device, so it can run
+// on any thread. Returns the bytes extracted to a temporary file for it.
+static uint64_t prepare_image(const ImageSource* source, const Image& image,
+                              int64_t target_sparse_limit, PreparedImage* prepared) {
+    uint64_t size = 0;
+    double start = now();
+    if (!source->ReadFile(image.sig_name, &prepared->signature)) {
+        prepared->signature.clear();
+    }
+    // Stored images are read from the archive itself when possible, so
+    // nothing is copied.
+    int64_t offset, region_size;
+    unique_fd fd = source->OpenFileRegion(image.img_name, &offset, &region_size);
+    if (fd >= 0) {
+        prepared->ok = load_buf_region(std::move(fd), offset, region_size, &prepared->buf,
+                                       target_sparse_limit);
+        prepared->in_place = prepared->ok;
+        prepared->load_time = now() - start;
+    }
+    if (!prepared->in_place) {
+        prepared->buf = {};
+        start = now();
+        fd = source->OpenFile(image.img_name);
+        prepared->extract_time = now() - start;
+    }
+    if (!prepared->in_place && fd >= 0) {
+        size = std::max<int64_t>(get_file_size(fd), 0);
+        start = now();
+        prepared->ok = load_buf_fd(std::move(fd), &prepared->buf, target_sparse_limit);
+        prepared->load_time = now() - start;
+    }
+    if (!prepared->ok) {
+        prepared->error = errno;
+    }
+    return size;
+}
+
+// Extracts and loads the images for FlashAllTool::FlashImages() on worker
+// threads, so that preparing the next images overlaps with sending the current
+// one. Only host-side work happens here; the steps of flash_buf() that query
+// the device (AVB footer copy, vbmeta rewrite) still run on the main thread.
+//
+// Images are started in order. A worker only starts another image while the
+// images that are prepared but not yet flashed use less than |budget| bytes,
+// so at most |budget| plus one image per worker is held in temporary files.
+class ImagePreparer {
+  public:
+    ImagePreparer(const ImageSource* source, const std::vector<ImageEntry>& images,
+                  int64_t target_sparse_limit, size_t threads, uint64_t budget)
+        : source_(source),
+          images_(images),
+          target_sparse_limit_(target_sparse_limit),
+          budget_(budget),
+          prepared_(images.size()),
+          sizes_(images.size()) {
+        for (size_t i = 0; i < std::min(threads, images.size()); i++) {
+            threads_.emplace_back([this] { Worker(); });
+        }
+    }
+
+    ~ImagePreparer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    // Waits for image |index| and hands it over. Images must be taken in
+    // order; taking one releases the budget held by the one before it.
+    std::unique_ptr<PreparedImage> Take(size_t index) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (; released_ < index; released_++) {
+            in_use_ -= sizes_[released_];
+            in_flight_--;
+        }
+        cv_.notify_all();
+        cv_.wait(lock, [&, this] { return prepared_[index] != nullptr; });
+        return std::move(prepared_[index]);
+    }
+
+  private:
+    void Worker() {
+        g_quiet_unzip = true;
+        for (;;) {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] {
+                    return stopping_ || next_ == images_.size() || in_flight_ == 0 ||
+                           in_use_ < budget_;
+                });
+                if (stopping_ || next_ == images_.size()) {
+                    return;
+                }
+                index = next_++;
+                in_flight_++;
+            }
+
+            // The signature is read here too, so the main thread never waits
+            // on the source. Images read in place take no budget.
+            auto prepared = std::make_unique<PreparedImage>();
+            uint64_t size = prepare_image(source_, *images_[index].first, target_sparse_limit_,
+                                          prepared.get());
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                sizes_[index] = size;
+                in_use_ += size;
+                prepared_[index] = std::move(prepared);
+            }
+            cv_.notify_all();
+        }
+    }
+
+    const ImageSource* source_;
+    const std::vector<ImageEntry>& images_;
+    const int64_t target_sparse_limit_;
+    const uint64_t budget_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::unique_ptr<PreparedImage>> prepared_;
+    std::vector<uint64_t> sizes_;
+    // Next image to start, and first image whose budget is still held.
+    size_t next_ = 0;
+    size_t released_ = 0;
+    // Images started and not yet released, and the bytes they use.
+    size_t in_flight_ = 0;
+    uint64_t in_use_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+
 void FlashAllTool::FlashImages(const std::vector<std::pair<const Image*, std::string>>& images) {
-    for (const auto& [image, slot] : images) {
-        fastboot_buffer buf;
-        unique_fd fd = fp_->source->OpenFile(image->img_name);
-        if (fd < 0 || !load_buf_fd(std::move(fd), &buf)) {
+    // Preparing an image must not talk to the device, so settle the limit here.
+    ImagePreparer preparer(fp_->source, images, get_target_sparse_limit(), kPrepareThreads,
+                           kPrepareBudget);
+    for (size_t i = 0; i < images.size(); i++) {
+        const auto& [image, slot] = images[i];
+        double start = now();
+        std::unique_ptr<PreparedImage> prepared = preparer.Take(i);
+        if (!prepared->ok) {
             if (image->optional_if_no_image) {
                 continue;
             }
-            die("could not load '%s': %s", image->img_name.c_str(), strerror(errno));
+            die("could not load '%s': %s", image->img_name.c_str(), strerror(prepared->error));
         }
-        FlashImage(*image, slot, &buf);
+        // The time shown is how long flashing had to wait for the image.
+        std::string status =
+                prepared->in_place
+                        ? android::base::StringPrintf("Prepared '%s' in place (load %.3fs)",
+                                                      image->img_name.c_str(), prepared->load_time)
+                        : android::base::StringPrintf("Prepared '%s' (extract %.3fs, load %.3fs)",
+                                                      image->img_name.c_str(),
+                                                      prepared->extract_time, prepared->load_time);
+        StatusWithTime(status, now() - start);
+        FlashImage(*image, slot, prepared->signature, &prepared->buf);
     }
 }
 
-void FlashAllTool::FlashImage(const Image& image, const std::string& slot, fastboot_buffer* buf) {
+void FlashAllTool::FlashImage(const Image& image, const std::string& slot,
+                              const std::vector<char>& signature_data, fastboot_buffer* buf) {
     auto flash = [&, this](const std::string& partition_name) {
-        std::vector<char> signature_data;
-        if (fp_->source->ReadFile(image.sig_name, &signature_data)) {
+        if (!signature_data.empty()) {
             fb->Download("signature", signature_data);
             fb->RawCommand("signature", "installing signature");
         }
@@ -1925,29 +2218,59 @@ void FlashAllTool::FlashImage(const Image& image, const std::string& slot, fastb
 
 class ZipImageSource final : public ImageSource {
   public:
-    explicit ZipImageSource(ZipArchiveHandle zip) : zip_(zip) {}
+    ZipImageSource(ZipArchiveHandle zip, const std::string& path) : zip_(zip), path_(path) {}
     bool ReadFile(const std::string& name, std::vector<char>* out) const override;
     unique_fd OpenFile(const std::string& name) const override;
+    unique_fd OpenFileRegion(const std::string& name, int64_t* offset,
+                             int64_t* size) const override;
 
   private:
     ZipArchiveHandle zip_;
+    // The archive itself, reopened for each stored entry read in place.
+    std::string path_;
+    // FlashAllTool prepares images on several threads.
+    mutable std::mutex mutex_;
 };
 
 bool ZipImageSource::ReadFile(const std::string& name, std::vector<char>* out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
     return UnzipToMemory(zip_, name, out);
 }
 
 unique_fd ZipImageSource::OpenFile(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mutex_);
     return unzip_to_file(zip_, name.c_str());
 }
 
+unique_fd ZipImageSource::OpenFileRegion(const std::string& name, int64_t* offset,
+                                         int64_t* size) const {
+    ZipEntry64 entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (FindEntry(zip_, name, &entry) != 0) {
+            return {};
+        }
+    }
+    if (entry.method != kCompressStored) {
+        return {};
+    }
+    // A separate fd, since reading the image moves the file offset.
+    unique_fd fd(TEMP_FAILURE_RETRY(open(path_.c_str(), O_RDONLY | O_BINARY)));
+    if (fd < 0) {
+        return {};
+    }
+    *offset = entry.offset;
+    *size = entry.uncompressed_length;
+    return fd;
+}
+
 static void do_update(const char* filename, FlashingPlan* fp) {
     ZipArchiveHandle zip;
     int error = OpenArchive(filename, &zip);
     if (error != 0) {
         die("failed to open zip file '%s': %s", filename, ErrorCodeString(error));
     }
-    ZipImageSource zp = ZipImageSource(zip);
+    ZipImageSource zp = ZipImageSource(zip, filename);
     fp->source = &zp;
     FlashAllTool tool(fp);
     tool.Flash();
@@ -2210,173 +2533,16 @@ static void FastbootAborter(const char* message) {
     die("%s", message);
 }
 
-int FastBootTool::Main(int argc, char* argv[]) {
-    android::base::InitLogging(argv, FastbootLogger, FastbootAborter);
-    std::unique_ptr<FlashingPlan> fp = std::make_unique<FlashingPlan>();
-
-    int longindex;
-    std::string next_active;
-
-    g_boot_img_hdr.kernel_addr = 0x00008000;
-    g_boot_img_hdr.ramdisk_addr = 0x01000000;
-    g_boot_img_hdr.second_addr = 0x00f00000;
-    g_boot_img_hdr.tags_addr = 0x00000100;
-    g_boot_img_hdr.page_size = 2048;
-    g_boot_img_hdr.dtb_addr = 0x01100000;
-
-    const struct option longopts[] = {{"base", required_argument, 0, 0},
-                                      {"cmdline", required_argument, 0, 0},
-                                      {"disable-verification", no_argument, 0, 0},
-                                      {"disable-verity", no_argument, 0, 0},
-                                      {"force", no_argument, 0, 0},
-                                      {"fs-options", required_argument, 0, 0},
-                                      {"header-version", required_argument, 0, 0},
-                                      {"help", no_argument, 0, 'h'},
-                                      {"kernel-offset", required_argument, 0, 0},
-                                      {"os-patch-level", required_argument, 0, 0},
-                                      {"os-version", required_argument, 0, 0},
-                                      {"page-size", required_argument, 0, 0},
-                                      {"ramdisk-offset", required_argument, 0, 0},
-                                      {"set-active", optional_argument, 0, 'a'},
-                                      {"skip-reboot", no_argument, 0, 0},
-                                      {"skip-secondary", no_argument, 0, 0},
-                                      {"slot", required_argument, 0, 0},
-                                      {"tags-offset", required_argument, 0, 0},
-                                      {"dtb", required_argument, 0, 0},
-                                      {"dtb-offset", required_argument, 0, 0},
-                                      {"unbuffered", no_argument, 0, 0},
-                                      {"verbose", no_argument, 0, 'v'},
-                                      {"version", no_argument, 0, 0},
-                                      {0, 0, 0, 0}};
-
-    serial = getenv("ANDROID_SERIAL");
-
-    int c;
-    while ((c = getopt_long(argc, argv, "a::hls:S:vw", longopts, &longindex)) != -1) {
-        if (c == 0) {
-            std::string name{longopts[longindex].name};
-            if (name == "base") {
-                g_base_addr = strtoul(optarg, 0, 16);
-            } else if (name == "cmdline") {
-                g_cmdline = optarg;
-            } else if (name == "disable-verification") {
-                g_disable_verification = true;
-            } else if (name == "disable-verity") {
-                g_disable_verity = true;
-            } else if (name == "force") {
-                fp->force_flash = true;
-            } else if (name == "fs-options") {
-                fp->fs_options = ParseFsOption(optarg);
-            } else if (name == "header-version") {
-                g_boot_img_hdr.header_version = strtoul(optarg, nullptr, 0);
-            } else if (name == "dtb") {
-                g_dtb_path = optarg;
-            } else if (name == "kernel-offset") {
-                g_boot_img_hdr.kernel_addr = strtoul(optarg, 0, 16);
-            } else if (name == "os-patch-level") {
-                ParseOsPatchLevel(&g_boot_img_hdr, optarg);
-            } else if (name == "os-version") {
-                ParseOsVersion(&g_boot_img_hdr, optarg);
-            } else if (name == "page-size") {
-                g_boot_img_hdr.page_size = strtoul(optarg, nullptr, 0);
-                if (g_boot_img_hdr.page_size == 0) die("invalid page size");
-            } else if (name == "ramdisk-offset") {
-                g_boot_img_hdr.ramdisk_addr = strtoul(optarg, 0, 16);
-            } else if (name == "skip-reboot") {
-                fp->skip_reboot = true;
-            } else if (name == "skip-secondary") {
-                fp->skip_secondary = true;
-            } else if (name == "slot") {
-                fp->slot_override = optarg;
-            } else if (name == "dtb-offset") {
-                g_boot_img_hdr.dtb_addr = strtoul(optarg, 0, 16);
-            } else if (name == "tags-offset") {
-                g_boot_img_hdr.tags_addr = strtoul(optarg, 0, 16);
-            } else if (name == "unbuffered") {
-                setvbuf(stdout, nullptr, _IONBF, 0);
-                setvbuf(stderr, nullptr, _IONBF, 0);
-            } else if (name == "version") {
-                fprintf(stdout, "fastboot version %s-%s\n", PLATFORM_TOOLS_VERSION,
-                        android::build::GetBuildNumber().c_str());
-                fprintf(stdout, "Installed as %s\n", android::base::GetExecutablePath().c_str());
-                return 0;
-            } else {
-                die("unknown option %s", longopts[longindex].name);
-            }
-        } else {
-            switch (c) {
-                case 'a':
-                    fp->wants_set_active = true;
-                    if (optarg) next_active = optarg;
-                    break;
-                case 'h':
-                    return show_help();
-                case 'l':
-                    g_long_listing = true;
-                    break;
-                case 's':
-                    serial = optarg;
-                    break;
-                case 'S':
-                    if (!android::base::ParseByteCount(optarg, &sparse_limit)) {
-                        die("invalid sparse limit %s", optarg);
-                    }
-                    break;
-                case 'v':
-                    set_verbose();
-                    break;
-                case 'w':
-                    fp->wants_wipe = true;
-                    break;
-                case '?':
-                    return 1;
-                default:
-                    abort();
-            }
-        }
-    }
-
-    argc -= optind;
-    argv += optind;
-
-    if (argc == 0 && !fp->wants_wipe && !fp->wants_set_active) syntax_error("no command");
-
-    if (argc > 0 && !strcmp(*argv, "devices")) {
-        list_devices();
-        return 0;
-    }
-
-    if (argc > 0 && !strcmp(*argv, "connect")) {
-        argc -= optind;
-        argv += optind;
-        return Connect(argc, argv);
-    }
-
-    if (argc > 0 && !strcmp(*argv, "disconnect")) {
-        argc -= optind;
-        argv += optind;
-        return Disconnect(argc, argv);
-    }
-
-    if (argc > 0 && !strcmp(*argv, "help")) {
-        return show_help();
-    }
-
-    Transport* transport = open_device();
-    if (transport == nullptr) {
-        return 1;
-    }
-    fastboot::DriverCallbacks driver_callbacks = {
-            .prolog = Status,
-            .epilog = Epilog,
-            .info = InfoMessage,
-            .text = TextMessage,
-    };
-
-    fastboot::FastBootDriver fastboot_driver(transport, driver_callbacks, false);
-    fb = &fastboot_driver;
-    fp->fb = &fastboot_driver;
+static const fastboot::DriverCallbacks kDriverCallbacks = {
+        .prolog = Status,
+        .epilog = Epilog,
+        .info = InfoMessage,
+        .text = TextMessage,
+};
 
+// Runs the commands in |args| on the device behind |fb|, then closes its
+// transport.
+static int RunCommands(FlashingPlan* fp, std::vector<std::string> args, std::string next_active) {
     const double start = now();
 
     if (fp->slot_override != "") fp->slot_override = verify_slot(fp->slot_override);
@@ -2398,7 +2564,6 @@ int FastBootTool::Main(int argc, char* argv[]) {
         }
     }
     std::vector<std::unique_ptr<Task>> tasks;
-    std::vector<std::string> args(argv, argv + argc);
     while (!args.empty()) {
         std::string command = next_arg(&args);
 
@@ -2451,17 +2616,17 @@ int FastBootTool::Main(int argc, char* argv[]) {
         } else if (command == FB_CMD_REBOOT) {
             if (args.size() == 1) {
                 std::string reboot_target = next_arg(&args);
-                tasks.emplace_back(std::make_unique<RebootTask>(fp.get(), reboot_target));
+                tasks.emplace_back(std::make_unique<RebootTask>(fp, reboot_target));
             } else if (!fp->skip_reboot) {
-                tasks.emplace_back(std::make_unique<RebootTask>(fp.get()));
+                tasks.emplace_back(std::make_unique<RebootTask>(fp));
             }
             if (!args.empty()) syntax_error("junk after reboot command");
         } else if (command == FB_CMD_REBOOT_BOOTLOADER) {
-            tasks.emplace_back(std::make_unique<RebootTask>(fp.get(), "bootloader"));
+            tasks.emplace_back(std::make_unique<RebootTask>(fp, "bootloader"));
         } else if (command == FB_CMD_REBOOT_RECOVERY) {
-            tasks.emplace_back(std::make_unique<RebootTask>(fp.get(), "recovery"));
+            tasks.emplace_back(std::make_unique<RebootTask>(fp, "recovery"));
         } else if (command == FB_CMD_REBOOT_FASTBOOT) {
-            tasks.emplace_back(std::make_unique<RebootTask>(fp.get(), "fastboot"));
+            tasks.emplace_back(std::make_unique<RebootTask>(fp, "fastboot"));
         } else if (command == FB_CMD_CONTINUE) {
             fb->Continue();
         } else if (command == FB_CMD_BOOT) {
@@ -2504,10 +2669,10 @@ int FastBootTool::Main(int argc, char* argv[]) {
                         "Warning: slot set to 'all'. Secondary slots will not be flashed.\n");
                 fp->skip_secondary = true;
             }
-            do_flashall(fp.get());
+            do_flashall(fp);
 
             if (!fp->skip_reboot) {
-                tasks.emplace_back(std::make_unique<RebootTask>(fp.get()));
+                tasks.emplace_back(std::make_unique<RebootTask>(fp));
             }
         } else if (command == "update") {
             bool slot_all = (fp->slot_override == "all");
@@ -2519,9 +2684,9 @@ int FastBootTool::Main(int argc, char* argv[]) {
             if (!args.empty()) {
                 filename = next_arg(&args);
             }
-            do_update(filename.c_str(), fp.get());
+            do_update(filename.c_str(), fp);
             if (!fp->skip_reboot) {
-                tasks.emplace_back(std::make_unique<RebootTask>(fp.get()));
+                tasks.emplace_back(std::make_unique<RebootTask>(fp));
             }
         } else if (command == FB_CMD_SET_ACTIVE) {
             std::string slot = verify_slot(next_arg(&args), false);
@@ -2555,12 +2720,12 @@ int FastBootTool::Main(int argc, char* argv[]) {
             fb->CreatePartition(partition, size);
         } else if (command == FB_CMD_DELETE_PARTITION) {
             std::string partition = next_arg(&args);
-            tasks.emplace_back(std::make_unique<DeleteTask>(fp.get(), partition));
+            tasks.emplace_back(std::make_unique<DeleteTask>(fp, partition));
         } else if (command == FB_CMD_RESIZE_PARTITION) {
             std::string partition = next_arg(&args);
             std::string size = next_arg(&args);
             std::unique_ptr<ResizeTask> resize_task =
-                    std::make_unique<ResizeTask>(fp.get(), partition, size, fp->slot_override);
+                    std::make_unique<ResizeTask>(fp, partition, size, fp->slot_override);
             resize_task->Run();
         } else if (command == "gsi") {
             if (args.empty()) syntax_error("invalid gsi command");
@@ -2602,7 +2767,7 @@ int FastBootTool::Main(int argc, char* argv[]) {
         std::vector<std::unique_ptr<Task>> wipe_tasks;
         std::vector<std::string> partitions = {"userdata", "cache", "metadata"};
         for (const auto& partition : partitions) {
-            wipe_tasks.emplace_back(std::make_unique<WipeTask>(fp.get(), partition));
+            wipe_tasks.emplace_back(std::make_unique<WipeTask>(fp, partition));
         }
         tasks.insert(tasks.begin(), std::make_move_iterator(wipe_tasks.begin()),
                      std::make_move_iterator(wipe_tasks.end()));
@@ -2613,7 +2778,10 @@ int FastBootTool::Main(int argc, char* argv[]) {
     for (auto& task : tasks) {
         task->Run();
     }
-    fprintf(stderr, "Finished. Total time: %.3fs\n", (now() - start));
+    // In multi-device mode, FlashDevices() reports the time for each device.
+    if (g_device_tag.empty()) {
+        fprintf(stderr, "Finished. Total time: %.3fs\n", (now() - start));
+    }
 
     auto* old_transport = fb->set_transport(nullptr);
     delete old_transport;
@@ -2621,6 +2789,317 @@ int FastBootTool::Main(int argc, char* argv[]) {
     return 0;
 }
 
+#ifndef _WIN32
+// Where a device's process sends the message die() was called with.
+static int g_device_error_fd = -1;
+
+static void DeviceRunDied(const std::string& message) {
+    android::base::WriteStringToFd(message, g_device_error_fd);
+    fflush(nullptr);
+    _exit(EXIT_FAILURE);
+}
+
+std::vector<DeviceRunResult> RunOnDevices(const std::vector<std::string>& serials,
+                                          const std::function<void(const std::string&)>& fn) {
+    struct DeviceRun {
+        pid_t pid = -1;
+        unique_fd error_fd;
+        double start = 0;
+    };
+    std::vector<DeviceRunResult> results(serials.size());
+    std::vector<DeviceRun> runs(serials.size());
+
+    // Otherwise each child would print whatever is still buffered again.
+    fflush(nullptr);
+    for (size_t i = 0; i < serials.size(); i++) {
+        results[i].serial = serials[i];
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            die("could not create pipe: %s", strerror(errno));
+        }
+        runs[i].start = now();
+        pid_t pid = fork();
+        if (pid == -1) {
+            die("could not fork: %s", strerror(errno));
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            g_device_error_fd = fds[1];
+            g_device_tag = serials[i];
+            serial = serials[i].c_str();
+            set_die_handler(DeviceRunDied);
+            fn(serials[i]);
+            fflush(nullptr);
+            _exit(EXIT_SUCCESS);
+        }
+        close(fds[1]);
+        runs[i].pid = pid;
+        runs[i].error_fd.reset(fds[0]);
+    }
+
+    size_t done = 0, failed = 0;
+    while (done < runs.size()) {
+        int status;
+        pid_t pid = TEMP_FAILURE_RETRY(waitpid(-1, &status, 0));
+        if (pid == -1) {
+            die("waitpid failed: %s", strerror(errno));
+        }
+        auto it = std::find_if(runs.begin(), runs.end(),
+                               [pid](const DeviceRun& run) { return run.pid == pid; });
+        if (it == runs.end()) {
+            continue;
+        }
+        DeviceRunResult* result = &results[it - runs.begin()];
+        android::base::ReadFdToString(it->error_fd, &result->error);
+        result->ok = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+        if (!result->ok && result->error.empty()) {
+            // Not a die(): a crash, or an abort from LOG(FATAL).
+            result->error = WIFSIGNALED(status)
+                                    ? android::base::StringPrintf("killed by signal %d",
+                                                                  WTERMSIG(status))
+                                    : android::base::StringPrintf("exited with status %d",
+                                                                  WEXITSTATUS(status));
+        }
+
+        done++;
+        if (!result->ok) {
+            failed++;
+            fprintf(stderr, "%s: fastboot: error: %s\n", result->serial.c_str(),
+                    result->error.c_str());
+        }
+        fprintf(stderr, "%s: %s [%7.3fs] (%zu of %zu devices done, %zu failed)\n",
+                result->serial.c_str(), result->ok ? "Finished" : "FAILED", now() - it->start,
+                done, serials.size(), failed);
+    }
+    return results;
+}
+
+// Runs the commands in |args| on each device in |serials| at once, with one
+// process, transport and FastBootDriver per device.
+static int FlashDevices(const std::vector<std::string>& serials, const FlashingPlan& plan,
+                        const std::vector<std::string>& args, const std::string& next_active) {
+    const double start = now();
+
+    auto results = RunOnDevices(serials, [&](const std::string& device) {
+        Transport* transport = open_device(device.c_str());
+        if (transport == nullptr) {
+            die("could not open device");
+        }
+        fastboot::FastBootDriver fastboot_driver(transport, kDriverCallbacks, false);
+        fastboot_driver.set_stream_flash(g_stream_flash);
+        fastboot_driver.set_compress_download(g_compress_download);
+        fb = &fastboot_driver;
+
+        FlashingPlan fp = plan;
+        fp.fb = &fastboot_driver;
+        RunCommands(&fp, args, next_active);
+        fb = nullptr;
+    });
+
+    size_t failed = 0;
+    for (const auto& result : results) {
+        if (!result.ok) {
+            fprintf(stderr, "Failed: %s: %s\n", result.serial.c_str(), result.error.c_str());
+            failed++;
+        }
+    }
+    fprintf(stderr, "Finished %zu devices, %zu failed. Total time: %.3fs\n", results.size(),
+            failed, now() - start);
+    return failed ? 1 : 0;
+}
+#endif
+
+int FastBootTool::Main(int argc, char* argv[]) {
+    android::base::InitLogging(argv, FastbootLogger, FastbootAborter);
+    std::unique_ptr<FlashingPlan> fp = std::make_unique<FlashingPlan>();
+
+    int longindex;
+    std::string next_active;
+
+    g_boot_img_hdr.kernel_addr = 0x00008000;
+    g_boot_img_hdr.ramdisk_addr = 0x01000000;
+    g_boot_img_hdr.second_addr = 0x00f00000;
+    g_boot_img_hdr.tags_addr = 0x00000100;
+    g_boot_img_hdr.page_size = 2048;
+    g_boot_img_hdr.dtb_addr = 0x01100000;
+
+    const struct option longopts[] = {{"all", no_argument, 0, 0},
+                                      {"base", required_argument, 0, 0},
+                                      {"cmdline", required_argument, 0, 0},
+                                      {"compress", no_argument, 0, 0},
+                                      {"disable-verification", no_argument, 0, 0},
+                                      {"disable-verity", no_argument, 0, 0},
+                                      {"force", no_argument, 0, 0},
+                                      {"fs-options", required_argument, 0, 0},
+                                      {"header-version", required_argument, 0, 0},
+                                      {"help", no_argument, 0, 'h'},
+                                      {"kernel-offset", required_argument, 0, 0},
+                                      {"os-patch-level", required_argument, 0, 0},
+                                      {"os-version", required_argument, 0, 0},
+                                      {"page-size", required_argument, 0, 0},
+                                      {"ramdisk-offset", required_argument, 0, 0},
+                                      {"set-active", optional_argument, 0, 'a'},
+                                      {"skip-reboot", no_argument, 0, 0},
+                                      {"skip-secondary", no_argument, 0, 0},
+                                      {"slot", required_argument, 0, 0},
+                                      {"stream-flash", no_argument, 0, 0},
+                                      {"tags-offset", required_argument, 0, 0},
+                                      {"dtb", required_argument, 0, 0},
+                                      {"dtb-offset", required_argument, 0, 0},
+                                      {"unbuffered", no_argument, 0, 0},
+                                      {"verbose", no_argument, 0, 'v'},
+                                      {"version", no_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    serial = getenv("ANDROID_SERIAL");
+
+    int c;
+    while ((c = getopt_long(argc, argv, "a::hls:S:vw", longopts, &longindex)) != -1) {
+        if (c == 0) {
+            std::string name{longopts[longindex].name};
+            if (name == "all") {
+                g_all_devices = true;
+            } else if (name == "base") {
+                g_base_addr = strtoul(optarg, 0, 16);
+            } else if (name == "cmdline") {
+                g_cmdline = optarg;
+            } else if (name == "compress") {
+                g_compress_download = true;
+            } else if (name == "disable-verification") {
+                g_disable_verification = true;
+            } else if (name == "disable-verity") {
+                g_disable_verity = true;
+            } else if (name == "force") {
+                fp->force_flash = true;
+            } else if (name == "fs-options") {
+                fp->fs_options = ParseFsOption(optarg);
+            } else if (name == "header-version") {
+                g_boot_img_hdr.header_version = strtoul(optarg, nullptr, 0);
+            } else if (name == "dtb") {
+                g_dtb_path = optarg;
+            } else if (name == "kernel-offset") {
+                g_boot_img_hdr.kernel_addr = strtoul(optarg, 0, 16);
+            } else if (name == "os-patch-level") {
+                ParseOsPatchLevel(&g_boot_img_hdr, optarg);
+            } else if (name == "os-version") {
+                ParseOsVersion(&g_boot_img_hdr, optarg);
+            } else if (name == "page-size") {
+                g_boot_img_hdr.page_size = strtoul(optarg, nullptr, 0);
+                if (g_boot_img_hdr.page_size == 0) die("invalid page size");
+            } else if (name == "ramdisk-offset") {
+                g_boot_img_hdr.ramdisk_addr = strtoul(optarg, 0, 16);
+            } else if (name == "skip-reboot") {
+                fp->skip_reboot = true;
+            } else if (name == "skip-secondary") {
+                fp->skip_secondary = true;
+            } else if (name == "slot") {
+                fp->slot_override = optarg;
+            } else if (name == "stream-flash") {
+                g_stream_flash = true;
+            } else if (name == "dtb-offset") {
+                g_boot_img_hdr.dtb_addr = strtoul(optarg, 0, 16);
+            } else if (name == "tags-offset") {
+                g_boot_img_hdr.tags_addr = strtoul(optarg, 0, 16);
+            } else if (name == "unbuffered") {
+                setvbuf(stdout, nullptr, _IONBF, 0);
+                setvbuf(stderr, nullptr, _IONBF, 0);
+            } else if (name == "version") {
+                fprintf(stdout, "fastboot version %s-%s\n", PLATFORM_TOOLS_VERSION,
+                        android::build::GetBuildNumber().c_str());
+                fprintf(stdout, "Installed as %s\n", android::base::GetExecutablePath().c_str());
+                return 0;
+            } else {
+                die("unknown option %s", longopts[longindex].name);
+            }
+        } else {
+            switch (c) {
+                case 'a':
+                    fp->wants_set_active = true;
+                    if (optarg) next_active = optarg;
+                    break;
+                case 'h':
+                    return show_help();
+                case 'l':
+                    g_long_listing = true;
+                    break;
+                case 's':
+                    serial = optarg;
+                    break;
+                case 'S':
+                    if (!android::base::ParseByteCount(optarg, &sparse_limit)) {
+                        die("invalid sparse limit %s", optarg);
+                    }
+                    break;
+                case 'v':
+                    set_verbose();
+                    break;
+                case 'w':
+                    fp->wants_wipe = true;
+                    break;
+                case '?':
+                    return 1;
+                default:
+                    abort();
+            }
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc == 0 && !fp->wants_wipe && !fp->wants_set_active) syntax_error("no command");
+
+    if (argc > 0 && !strcmp(*argv, "devices")) {
+        list_devices();
+        return 0;
+    }
+
+    if (argc > 0 && !strcmp(*argv, "connect")) {
+        argc -= optind;
+        argv += optind;
+        return Connect(argc, argv);
+    }
+
+    if (argc > 0 && !strcmp(*argv, "disconnect")) {
+        argc -= optind;
+        argv += optind;
+        return Disconnect(argc, argv);
+    }
+
+    if (argc > 0 && !strcmp(*argv, "help")) {
+        return show_help();
+    }
+
+    std::vector<std::string> args(argv, argv + argc);
+    std::vector<std::string> serials;
+    if (g_all_devices) {
+        serials = list_usb_serials();
+        if (serials.empty()) die("no devices found");
+    } else if (serial != nullptr && strchr(serial, ',') != nullptr) {
+        serials = Split(serial, ",");
+    }
+    if (!serials.empty()) {
+#ifdef _WIN32
+        die("flashing several devices at once is not supported on Windows");
+#else
+        return FlashDevices(serials, *fp, args, next_active);
+#endif
+    }
+
+    Transport* transport = open_device();
+    if (transport == nullptr) {
+        return 1;
+    }
+
+    fastboot::FastBootDriver fastboot_driver(transport, kDriverCallbacks, false);
+    fastboot_driver.set_stream_flash(g_stream_flash);
+    fastboot_driver.set_compress_download(g_compress_download);
+    fb = &fastboot_driver;
+    fp->fb = &fastboot_driver;
+
+    return RunCommands(fp.get(), std::move(args), next_active);
+}
+
 void FastBootTool::ParseOsPatchLevel(boot_img_hdr_v1* hdr, const char* arg) {
     unsigned year, month, day;
     if (sscanf(arg, "%u-%u-%u", &year, &month, &day) != 3) {
@@ -27,7 +27,9 @@
  */
 #pragma once
 
+#include <functional>
 #include <string>
+#include <vector>
 #include "fastboot_driver.h"
 #include "fastboot_driver_interface.h"
 #include "filesystem.h"
@@ -114,14 +116,34 @@ class FlashAllTool {
     void DetermineSlot();
     void CollectImages();
     void FlashImages(const std::vector<std::pair<const Image*, std::string>>& images);
-    void FlashImage(const Image& image, const std::string& slot, fastboot_buffer* buf);
+    void FlashImage(const Image& image, const std::string& slot,
+                    const std::vector<char>& signature_data, fastboot_buffer* buf);
     void HardcodedFlash();
 
+    // Workers preparing images ahead of FlashImages(), and the bytes of
+    // prepared images they may keep waiting to be flashed.
+    static constexpr size_t kPrepareThreads = 2;
+    static constexpr uint64_t kPrepareBudget = 2ULL * 1024 * 1024 * 1024;
+
     std::vector<ImageEntry> boot_images_;
     std::vector<ImageEntry> os_images_;
     FlashingPlan* fp_;
 };
 
+struct DeviceRunResult {
+    std::string serial;
+    bool ok = false;
+    // What die() was called with, if the run failed.
+    std::string error;
+};
+
+// Calls |fn| with each device in |serials| at once, in a child process per
+// device, with that device selected as the serial to use. A die() in one of
+// these processes ends only that device's run, and its message is returned
+// with the results. Not available on Windows.
+std::vector<DeviceRunResult> RunOnDevices(const std::vector<std::string>& serials,
+                                          const std::function<void(const std::string&)>& fn);
+
 bool should_flash_in_userspace(const std::string& partition_name);
 bool is_userspace_fastboot();
 void do_flash(const char* pname, const char* fname, const bool apply_vbmeta);
@@ -35,10 +35,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <memory>
 #include <regex>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -47,6 +49,7 @@
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
+#include <lz4frame.h>
 #include <storage_literals/storage_literals.h>
 
 #include "constants.h"
@@ -57,6 +60,65 @@ using namespace android::storage_literals;
 
 namespace fastboot {
 
+// Compressed downloads are made of one LZ4 frame per this much input, so that
+// the frames can be compressed in parallel. Concatenated frames decode as a
+// single stream.
+static constexpr size_t kLz4FrameSize = 4_MiB;
+
+// Compresses |size| bytes at |data| into |out|. Fails if that saves less than
+// an eighth of the size, which is not worth decompressing on the device.
+static bool CompressLz4(const char* data, size_t size, std::vector<char>* out) {
+    LZ4F_preferences_t prefs = {};
+    prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+    prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+    const size_t frame_count = (size + kLz4FrameSize - 1) / kLz4FrameSize;
+    std::vector<std::vector<char>> frames(frame_count);
+    std::atomic<size_t> next_frame = 0;
+    std::atomic<bool> failed = false;
+    auto compress = [&] {
+        for (size_t i; (i = next_frame++) < frame_count;) {
+            size_t offset = i * kLz4FrameSize;
+            size_t len = std::min(kLz4FrameSize, size - offset);
+            auto& frame = frames[i];
+            frame.resize(LZ4F_compressFrameBound(len, &prefs));
+            size_t ret = LZ4F_compressFrame(frame.data(), frame.size(), data + offset, len, &prefs);
+            if (LZ4F_isError(ret)) {
+                failed = true;
+                return;
+            }
+            frame.resize(ret);
+        }
+    };
+    size_t thread_count =
+            std::min<size_t>(frame_count, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < thread_count; i++) {
+        threads.emplace_back(compress);
+    }
+    compress();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (failed) {
+        return false;
+    }
+
+    size_t total = 0;
+    for (const auto& frame : frames) {
+        total += frame.size();
+    }
+    if (total > size - size / 8) {
+        return false;
+    }
+    out->clear();
+    out->reserve(total);
+    for (const auto& frame : frames) {
+        out->insert(out->end(), frame.begin(), frame.end());
+    }
+    return true;
+}
+
 /*************************** PUBLIC *******************************/
 FastBootDriver::FastBootDriver(Transport* transport, DriverCallbacks driver_callbacks,
                                bool no_checks)
@@ -99,6 +161,17 @@ RetCode FastBootDriver::Flash(const std::string& partition, std::string* respons
 
 RetCode FastBootDriver::GetVar(const std::string& key, std::string* val,
                                std::vector<std::string>* info) {
+    if (cache_vars_ && key != "all") {
+        if (!var_cache_) {
+            FillVarCache();
+        }
+        auto iter = var_cache_->find(key);
+        if (iter != var_cache_->end()) {
+            *val = iter->second;
+            return SUCCESS;
+        }
+    }
+    // Variables missing from "getvar all" are still asked for one by one.
     return RawCommand(FB_CMD_GETVAR ":" + key, val, info);
 }
 
@@ -138,6 +211,9 @@ RetCode FastBootDriver::SnapshotUpdateCommand(const std::string& command, std::s
 
 RetCode FastBootDriver::FlashPartition(const std::string& partition,
                                        const std::vector<char>& data) {
+    if (UseStreamFlash()) {
+        return StreamFlash(partition, data.size(), [&] { return SendBuffer(data); });
+    }
     RetCode ret;
     if ((ret = Download(partition, data))) {
         return ret;
@@ -147,6 +223,9 @@ RetCode FastBootDriver::FlashPartition(const std::string& partition,
 
 RetCode FastBootDriver::FlashPartition(const std::string& partition, android::base::borrowed_fd fd,
                                        uint32_t size) {
+    if (UseStreamFlash()) {
+        return StreamFlash(partition, size, [&] { return SendBuffer(fd, size); });
+    }
     RetCode ret;
     if ((ret = Download(partition, fd, size))) {
         return ret;
@@ -156,6 +235,14 @@ RetCode FastBootDriver::FlashPartition(const std::string& partition, android::ba
 
 RetCode FastBootDriver::FlashPartition(const std::string& partition, sparse_file* s, uint32_t size,
                                        size_t current, size_t total) {
+    if (UseStreamFlash()) {
+        int64_t len = sparse_file_len(s, true, false);
+        if (len <= 0 || len > MAX_DOWNLOAD_SIZE) {
+            error_ = "Sparse file is too large or invalid";
+            return BAD_ARG;
+        }
+        return StreamFlash(partition, len, [&] { return SendSparseFile(s, false); });
+    }
     RetCode ret;
     if ((ret = Download(partition, s, size, current, total, false))) {
         return ret;
@@ -163,6 +250,79 @@ RetCode FastBootDriver::FlashPartition(const std::string& partition, sparse_file
     return Flash(partition);
 }
 
+bool FastBootDriver::UseStreamFlash() {
+    if (!stream_flash_) {
+        return false;
+    }
+    if (!stream_flash_supported_) {
+        std::string value;
+        stream_flash_supported_ = GetVar(FB_VAR_STREAM_FLASH, &value) == SUCCESS && value == "yes";
+    }
+    return *stream_flash_supported_;
+}
+
+RetCode FastBootDriver::StreamFlash(const std::string& partition, size_t size,
+                                    const std::function<RetCode()>& send) {
+    prolog_(StringPrintf("Streaming '%s' (%zu KB)", partition.c_str(), size / 1024));
+    auto result = [&]() -> RetCode {
+        if ((size == 0 || size > MAX_DOWNLOAD_SIZE) && !disable_checks_) {
+            error_ = "File is too large to download";
+            return BAD_ARG;
+        }
+
+        RetCode ret;
+        std::string cmd(StringPrintf("%s:%s:%08" PRIx32, FB_CMD_STREAM_FLASH, partition.c_str(),
+                                     static_cast<uint32_t>(size)));
+        if ((ret = RawCommand(cmd))) {
+            return ret;
+        }
+        if ((ret = send())) {
+            return ret;
+        }
+        // The device only answers once the image is on the partition.
+        return HandleResponse();
+    }();
+    epilog_(result);
+    return result;
+}
+
+bool FastBootDriver::UseCompressedDownload() {
+    if (!compress_download_) {
+        return false;
+    }
+    if (!compressed_download_supported_) {
+        std::string value;
+        bool ok = GetVar(FB_VAR_DOWNLOAD_COMPRESSION, &value) == SUCCESS;
+        // A comma-separated list, leaving room for other formats.
+        auto formats = android::base::Split(value, ",");
+        compressed_download_supported_ =
+                ok && std::find(formats.begin(), formats.end(), "lz4") != formats.end();
+    }
+    return *compressed_download_supported_;
+}
+
+std::optional<RetCode> FastBootDriver::CompressedDownload(const void* data, size_t size,
+                                                          std::string* response,
+                                                          std::vector<std::string>* info) {
+    std::vector<char> compressed;
+    if (!UseCompressedDownload() ||
+        !CompressLz4(static_cast<const char*>(data), size, &compressed)) {
+        return {};
+    }
+
+    RetCode ret;
+    std::string cmd(StringPrintf("%s:%08" PRIx32 ":%08" PRIx32, FB_CMD_DOWNLOAD_LZ4,
+                                 static_cast<uint32_t>(compressed.size()),
+                                 static_cast<uint32_t>(size)));
+    if ((ret = RawCommand(cmd, response, info))) {
+        return ret;
+    }
+    if ((ret = SendBuffer(compressed))) {
+        return ret;
+    }
+    return HandleResponse(response, info);
+}
+
 RetCode FastBootDriver::Partitions(std::vector<std::tuple<std::string, uint64_t>>* partitions) {
     std::vector<std::string> all;
     RetCode ret;
@@ -202,6 +362,17 @@ RetCode FastBootDriver::Download(android::base::borrowed_fd fd, size_t size, std
         return BAD_ARG;
     }
 
+    if (UseCompressedDownload()) {
+        auto mapping = android::base::MappedFile::FromFd(fd, 0, size, PROT_READ);
+        if (!mapping) {
+            error_ = "Creating filemap failed";
+            return IO_ERROR;
+        }
+        if (auto result = CompressedDownload(mapping->data(), size, response, info)) {
+            return *result;
+        }
+    }
+
     uint32_t u32size = static_cast<uint32_t>(size);
     if ((ret = DownloadCommand(u32size, response, info))) {
         return ret;
@@ -233,6 +404,10 @@ RetCode FastBootDriver::Download(const std::vector<char>& buf, std::string* resp
         return BAD_ARG;
     }
 
+    if (auto result = CompressedDownload(buf.data(), buf.size(), response, info)) {
+        return *result;
+    }
+
     if ((ret = DownloadCommand(buf.size(), response, info))) {
         return ret;
     }
@@ -265,12 +440,45 @@ RetCode FastBootDriver::Download(sparse_file* s, bool use_crc, std::string* resp
         return BAD_ARG;
     }
 
+    if (UseCompressedDownload()) {
+        // The whole image has to be in memory to be compressed.
+        std::vector<char> buf;
+        buf.reserve(size);
+        auto append = [](void* priv, const void* data, size_t len) -> int {
+            auto out = static_cast<std::vector<char>*>(priv);
+            const char* cdata = static_cast<const char*>(data);
+            out->insert(out->end(), cdata, cdata + len);
+            return 0;
+        };
+        if (sparse_file_callback(s, true, use_crc, append, &buf) < 0) {
+            error_ = "Error reading sparse file";
+            return IO_ERROR;
+        }
+        if (auto result = CompressedDownload(buf.data(), buf.size(), response, info)) {
+            return *result;
+        }
+        RetCode ret;
+        if ((ret = DownloadCommand(buf.size(), response, info)) || (ret = SendBuffer(buf))) {
+            return ret;
+        }
+        return HandleResponse(response, info);
+    }
+
     RetCode ret;
     uint32_t u32size = static_cast<uint32_t>(size);
     if ((ret = DownloadCommand(u32size, response, info))) {
         return ret;
     }
 
+    if ((ret = SendSparseFile(s, use_crc))) {
+        return ret;
+    }
+
+    return HandleResponse(response, info);
+}
+
+RetCode FastBootDriver::SendSparseFile(sparse_file* s, bool use_crc) {
+    RetCode ret;
     struct SparseCBPrivate {
         FastBootDriver* self;
         std::vector<char> tpbuf;
@@ -293,7 +501,7 @@ RetCode FastBootDriver::Download(sparse_file* s, bool use_crc, std::string* resp
         return ret;
     }
 
-    return HandleResponse(response, info);
+    return SUCCESS;
 }
 
 RetCode FastBootDriver::Upload(const std::string& outfile, std::string* response,
@@ -440,6 +648,9 @@ RetCode FastBootDriver::RawCommand(const std::string& cmd, std::string* response
         error_ = "Command length to RawCommand() is too long";
         return BAD_ARG;
     }
+    if (var_cache_) {
+        InvalidateVarCache(cmd);
+    }
 
     if (transport_->Write(cmd.c_str(), cmd.size()) != static_cast<int>(cmd.size())) {
         error_ = ErrnoStr("Write to device failed");
@@ -450,6 +661,80 @@ RetCode FastBootDriver::RawCommand(const std::string& cmd, std::string* response
     return HandleResponse(response, info, dsize);
 }
 
+void FastBootDriver::FillVarCache() {
+    var_cache_.emplace();
+
+    std::string response;
+    std::vector<std::string> info;
+    // Don't print the whole variable list.
+    auto info_cb = std::move(info_);
+    info_ = [](const std::string&) {};
+    RetCode ret = RawCommand(FB_CMD_GETVAR ":all", &response, &info);
+    info_ = std::move(info_cb);
+    if (ret != SUCCESS) {
+        // Leave the cache empty; every lookup then goes to the device.
+        return;
+    }
+    // Lines are "<name>[:<arg>]: <value>". A value containing ':' gives a key
+    // that is never asked for, so such a variable is fetched on its own.
+    for (const auto& line : info) {
+        size_t pos = line.rfind(':');
+        if (pos == std::string::npos) {
+            continue;
+        }
+        (*var_cache_)[line.substr(0, pos)] = android::base::Trim(line.substr(pos + 1));
+    }
+}
+
+void FastBootDriver::InvalidateVarCache(const std::string& cmd) {
+    using android::base::EndsWith;
+    using android::base::StartsWith;
+
+    // Data transfers, queries, and writes to ordinary partitions leave the
+    // variables alone.
+    for (const char* prefix : {FB_CMD_GETVAR ":", FB_CMD_DOWNLOAD ":", FB_CMD_DOWNLOAD_LZ4 ":",
+                               FB_CMD_UPLOAD, FB_CMD_FETCH ":", FB_CMD_ERASE ":"}) {
+        if (StartsWith(cmd, prefix)) {
+            return;
+        }
+    }
+    for (const char* prefix : {FB_CMD_FLASH ":", FB_CMD_STREAM_FLASH ":"}) {
+        if (StartsWith(cmd, prefix)) {
+            std::string partition = cmd.substr(strlen(prefix));
+            partition = partition.substr(0, partition.find(':'));
+            auto super = var_cache_->find("super-partition-name");
+            std::string super_name = super != var_cache_->end() ? super->second : "super";
+            if (!StartsWith(partition, super_name)) {
+                return;
+            }
+        }
+    }
+
+    // Changing a logical partition only affects the variables about it.
+    for (const char* prefix : {FB_CMD_CREATE_PARTITION ":", FB_CMD_DELETE_PARTITION ":",
+                               FB_CMD_RESIZE_PARTITION ":"}) {
+        if (StartsWith(cmd, prefix)) {
+            std::string partition = cmd.substr(strlen(prefix));
+            std::string suffix = ":" + partition.substr(0, partition.find(':'));
+            for (auto iter = var_cache_->begin(); iter != var_cache_->end();) {
+                iter = EndsWith(iter->first, suffix) ? var_cache_->erase(iter) : std::next(iter);
+            }
+            return;
+        }
+    }
+    if (StartsWith(cmd, FB_CMD_SET_ACTIVE ":")) {
+        for (auto iter = var_cache_->begin(); iter != var_cache_->end();) {
+            bool slot_var = iter->first == "current-slot" || StartsWith(iter->first, "slot-");
+            iter = slot_var ? var_cache_->erase(iter) : std::next(iter);
+        }
+        return;
+    }
+
+    // Anything else (reboots, super updates, oem commands, ...) may change
+    // any variable; refetch them all on the next lookup.
+    var_cache_.reset();
+}
+
 RetCode FastBootDriver::DownloadCommand(uint32_t size, std::string* response,
                                         std::vector<std::string>* info) {
     std::string cmd(android::base::StringPrintf("%s:%08" PRIx32, FB_CMD_DOWNLOAD, size));
@@ -629,6 +914,9 @@ int FastBootDriver::SparseWriteCallback(std::vector<char>& tpbuf, const char* da
 
 Transport* FastBootDriver::set_transport(Transport* transport) {
     std::swap(transport_, transport);
+    stream_flash_supported_.reset();
+    compressed_download_supported_.reset();
+    var_cache_.reset();
     return transport;
 }
 
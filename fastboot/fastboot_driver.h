@@ -29,6 +29,8 @@
 #include <cstdlib>
 #include <deque>
 #include <limits>
+#include <map>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -60,7 +62,9 @@ class FastBootDriver : public IFastBootDriver {
   public:
     static constexpr int RESP_TIMEOUT = 30;  // 30 seconds
     static constexpr uint32_t MAX_DOWNLOAD_SIZE = std::numeric_limits<uint32_t>::max();
-    static constexpr size_t TRANSPORT_CHUNK_SIZE = 1024;
+    // Sparse images are sent in multiples of this, so that small chunks are
+    // batched into writes large enough for the transport to pipeline.
+    static constexpr size_t TRANSPORT_CHUNK_SIZE = 256 * 1024;
 
     FastBootDriver(Transport* transport, DriverCallbacks driver_callbacks = {},
                    bool no_checks = false);
@@ -119,6 +123,18 @@ class FastBootDriver : public IFastBootDriver {
 
     /* HELPERS */
     void SetInfoCallback(std::function<void(const std::string&)> info);
+    // When enabled, FlashPartition() uses "stream-flash" on devices that
+    // support it, so the device writes the image while it is being sent.
+    void set_stream_flash(bool enable) { stream_flash_ = enable; }
+    // When enabled, Download() compresses data with lz4 on devices that
+    // advertise "download-compression", if that makes it noticeably smaller.
+    void set_compress_download(bool enable) { compress_download_ = enable; }
+    // When enabled, GetVar() answers from the output of a single "getvar all",
+    // refetched after commands that may change the device's variables.
+    void set_cache_vars(bool enable) {
+        cache_vars_ = enable;
+        var_cache_.reset();
+    }
     static const std::string RCString(RetCode rc);
     std::string Error();
     RetCode WaitForDisconnect() override;
@@ -149,14 +165,29 @@ class FastBootDriver : public IFastBootDriver {
     RetCode SendBuffer(const std::vector<char>& buf);
     RetCode SendBuffer(const void* buf, size_t size);
 
+    RetCode SendSparseFile(sparse_file* s, bool use_crc);
+
     RetCode ReadBuffer(void* buf, size_t size);
 
+    bool UseStreamFlash();
+    RetCode StreamFlash(const std::string& partition, size_t size,
+                        const std::function<RetCode()>& send);
+
+    bool UseCompressedDownload();
+    // Returns nothing if the data should be sent uncompressed instead.
+    std::optional<RetCode> CompressedDownload(const void* data, size_t size,
+                                              std::string* response,
+                                              std::vector<std::string>* info);
+
     RetCode UploadInner(const std::string& outfile, std::string* response = nullptr,
                         std::vector<std::string>* info = nullptr);
     RetCode RunAndReadBuffer(const std::string& cmd, std::string* response,
                              std::vector<std::string>* info,
                              const std::function<RetCode(const char*, uint64_t)>& write_fn);
 
+    void FillVarCache();
+    void InvalidateVarCache(const std::string& cmd);
+
     int SparseWriteCallback(std::vector<char>& tpbuf, const char* data, size_t len);
 
     std::string error_;
@@ -165,6 +196,12 @@ class FastBootDriver : public IFastBootDriver {
     std::function<void(const std::string&)> info_;
     std::function<void(const std::string&)> text_;
     bool disable_checks_;
+    bool stream_flash_ = false;
+    std::optional<bool> stream_flash_supported_;
+    bool compress_download_ = false;
+    std::optional<bool> compressed_download_supported_;
+    bool cache_vars_ = false;
+    std::optional<std::map<std::string, std::string>> var_cache_;
 };
 
 }  // namespace fastboot
@@ -18,6 +18,8 @@
 
 #include <optional>
 
+#include <android-base/stringprintf.h>
+
 #include <gtest/gtest.h>
 #include "mock_transport.h"
 
@@ -43,6 +45,48 @@ TEST_F(DriverTest, GetVar) {
     ASSERT_EQ(output, "0.4");
 }
 
+TEST_F(DriverTest, CachedGetVar) {
+    MockTransport transport;
+    FastBootDriver driver(&transport);
+    driver.set_cache_vars(true);
+
+    EXPECT_CALL(transport, Write(_, _))
+            .With(AllArgs(RawData("getvar:all")))
+            .WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("INFOslot-count:2")));
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("INFOis-logical:system_a:yes")));
+    EXPECT_CALL(transport, Read(_, _))
+            .WillOnce(Invoke(CopyData("INFOpartition-size:system_a: 0x1000")));
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAY")));
+    // Not part of "getvar all", so it is asked for.
+    EXPECT_CALL(transport, Write(_, _))
+            .With(AllArgs(RawData("getvar:is-userspace")))
+            .WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAYyes")));
+    EXPECT_CALL(transport, Write(_, _))
+            .With(AllArgs(RawData("resize-logical-partition:system_a:8192")))
+            .WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAY")));
+    EXPECT_CALL(transport, Write(_, _))
+            .With(AllArgs(RawData("getvar:partition-size:system_a")))
+            .WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAY0x2000")));
+
+    std::string output;
+    ASSERT_EQ(driver.GetVar("partition-size:system_a", &output), SUCCESS) << driver.Error();
+    ASSERT_EQ(output, "0x1000");
+    ASSERT_EQ(driver.GetVar("slot-count", &output), SUCCESS) << driver.Error();
+    ASSERT_EQ(output, "2");
+    ASSERT_EQ(driver.GetVar("is-userspace", &output), SUCCESS) << driver.Error();
+    ASSERT_EQ(output, "yes");
+
+    ASSERT_EQ(driver.ResizePartition("system_a", "8192"), SUCCESS) << driver.Error();
+    ASSERT_EQ(driver.GetVar("partition-size:system_a", &output), SUCCESS) << driver.Error();
+    ASSERT_EQ(output, "0x2000");
+    ASSERT_EQ(driver.GetVar("slot-count", &output), SUCCESS) << driver.Error();
+    ASSERT_EQ(output, "2");
+}
+
 TEST_F(DriverTest, InfoMessage) {
     MockTransport transport;
     FastBootDriver driver(&transport);
@@ -93,3 +137,82 @@ TEST_F(DriverTest, TextMessage) {
               " Indeed we can do that now with a TEXT message whenever we feel like it."
               " Isn't that truly super cool?");
 }
+
+TEST_F(DriverTest, StreamFlash) {
+    MockTransport transport;
+    FastBootDriver driver(&transport);
+    driver.set_stream_flash(true);
+
+    EXPECT_CALL(transport, Write(_, _))
+            .With(AllArgs(RawData("getvar:stream-flash")))
+            .WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAYyes")));
+    EXPECT_CALL(transport, Write(_, _))
+            .With(AllArgs(RawData("stream-flash:system:00000004")))
+            .WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("DATA00000004")));
+    EXPECT_CALL(transport, Write(_, _)).With(AllArgs(RawData("abcd"))).WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAY")));
+
+    std::vector<char> data = {'a', 'b', 'c', 'd'};
+    ASSERT_EQ(driver.FlashPartition("system", data), SUCCESS) << driver.Error();
+}
+
+TEST_F(DriverTest, CompressedDownload) {
+    MockTransport transport;
+    FastBootDriver driver(&transport);
+    driver.set_compress_download(true);
+
+    std::vector<char> data(1024 * 1024, 'a');
+    std::string compressed;
+
+    EXPECT_CALL(transport, Write(_, _))
+            .With(AllArgs(RawData("getvar:download-compression")))
+            .WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAYlz4")));
+    std::string command;
+    EXPECT_CALL(transport, Write(_, _)).WillOnce([&](const void* buf, size_t len) {
+        command.assign(static_cast<const char*>(buf), len);
+        return len;
+    });
+    EXPECT_CALL(transport, Read(_, _)).WillOnce([&](void* buf, size_t size) {
+        // Accept whatever compressed size the driver asked for.
+        std::string response = "DATA" + command.substr(command.find(':') + 1, 8);
+        size_t len = std::min(size, response.size());
+        memcpy(buf, response.data(), len);
+        return static_cast<ssize_t>(len);
+    });
+    EXPECT_CALL(transport, Write(_, _)).WillOnce([&](const void* buf, size_t len) {
+        compressed.assign(static_cast<const char*>(buf), len);
+        return len;
+    });
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAY")));
+
+    ASSERT_EQ(driver.Download(data), SUCCESS) << driver.Error();
+    ASSERT_EQ(command.substr(0, strlen("download-lz4:")), "download-lz4:");
+    EXPECT_EQ(command.substr(command.size() - 9), ":00100000");
+    EXPECT_EQ(command.substr(strlen("download-lz4:"), 8),
+              android::base::StringPrintf("%08zx", compressed.size()));
+    EXPECT_LT(compressed.size(), data.size() / 8);
+}
+
+TEST_F(DriverTest, CompressedDownloadFallback) {
+    MockTransport transport;
+    FastBootDriver driver(&transport);
+    driver.set_compress_download(true);
+
+    // Too short to get any smaller, so it is sent as is.
+    EXPECT_CALL(transport, Write(_, _))
+            .With(AllArgs(RawData("getvar:download-compression")))
+            .WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAYlz4")));
+    EXPECT_CALL(transport, Write(_, _))
+            .With(AllArgs(RawData("download:00000004")))
+            .WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("DATA00000004")));
+    EXPECT_CALL(transport, Write(_, _)).With(AllArgs(RawData("abcd"))).WillOnce(ReturnArg<1>());
+    EXPECT_CALL(transport, Read(_, _)).WillOnce(Invoke(CopyData("OKAY")));
+
+    std::vector<char> data = {'a', 'b', 'c', 'd'};
+    ASSERT_EQ(driver.Download(data), SUCCESS) << driver.Error();
+}
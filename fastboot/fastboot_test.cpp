@@ -251,6 +251,25 @@ TEST(FastBoot, ParseNetworkSerial) {
                                    FastbootError::Type::NETWORK_SERIAL_WRONG_ADDRESS);
 }
 
+#ifndef _WIN32
+TEST(RunOnDevicesTest, DieEndsOnlyThatDevice) {
+    auto results = RunOnDevices({"good", "bad", "good2"}, [](const std::string& serial) {
+        if (serial == "bad") {
+            die("could not flash %s", serial.c_str());
+        }
+    });
+
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_EQ(results[0].serial, "good");
+    EXPECT_TRUE(results[0].ok);
+    EXPECT_EQ(results[1].serial, "bad");
+    EXPECT_FALSE(results[1].ok);
+    EXPECT_EQ(results[1].error, "could not flash bad");
+    EXPECT_EQ(results[2].serial, "good2");
+    EXPECT_TRUE(results[2].ok);
+}
+#endif
+
 int main(int argc, char* argv[]) {
     ::testing::InitGoogleTest(&argc, argv);
     android::base::InitLogging(argv);
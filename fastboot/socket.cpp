@@ -31,6 +31,11 @@
 #ifndef _WIN32
 #include <sys/select.h>
 #endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include <errno.h>
 
 #include <android-base/errors.h>
 #include <android-base/stringprintf.h>
@@ -72,6 +77,11 @@ ssize_t Socket::ReceiveAll(void* data, size_t length, int timeout_ms) {
     return total;
 }
 
+bool Socket::SendFile(int /* fd */, int64_t /* offset */, size_t /* length */) {
+    errno = EOPNOTSUPP;
+    return false;
+}
+
 int Socket::GetLocalPort() {
     return socket_get_local_port(sock_);
 }
@@ -177,6 +187,9 @@ class TcpSocket : public Socket {
 
     bool Send(const void* data, size_t length) override;
     bool Send(std::vector<cutils_socket_buffer_t> buffers) override;
+#if defined(__linux__)
+    bool SendFile(int fd, int64_t offset, size_t length) override;
+#endif
     ssize_t Receive(void* data, size_t length, int timeout_ms) override;
 
     std::unique_ptr<Socket> Accept() override;
@@ -233,6 +246,27 @@ bool TcpSocket::Send(std::vector<cutils_socket_buffer_t> buffers) {
     return true;
 }
 
+#if defined(__linux__)
+bool TcpSocket::SendFile(int fd, int64_t offset, size_t length) {
+    off64_t pos = offset;
+    while (length > 0) {
+        ssize_t sent = TEMP_FAILURE_RETRY(sendfile64(sock_, fd, &pos, length));
+
+        if (sent == -1) {
+            return false;
+        }
+        if (sent == 0) {
+            // The file is shorter than expected.
+            errno = EIO;
+            return false;
+        }
+        length -= sent;
+    }
+
+    return true;
+}
+#endif
+
 ssize_t TcpSocket::Receive(void* data, size_t length, int timeout_ms) {
     if (!WaitForRecv(timeout_ms)) {
         return -1;
@@ -32,6 +32,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include <functional>
 #include <memory>
 #include <string>
@@ -79,6 +81,11 @@ class Socket {
     // would require an additional sendto() variation of multi-buffer write.
     virtual bool Send(std::vector<cutils_socket_buffer_t> buffers) = 0;
 
+    // Sends |length| bytes of file |fd| starting at |offset| without copying them through user
+    // space. Only TCP sockets on Linux support this; others return false with errno set to
+    // EOPNOTSUPP. Returns true on success.
+    virtual bool SendFile(int fd, int64_t offset, size_t length);
+
     // Waits up to |timeout_ms| to receive up to |length| bytes of data. |timout_ms| of 0 will
     // block forever. Returns the number of bytes received or -1 on error/timeout; see
     // ReceiveTimedOut() to distinguish between the two.
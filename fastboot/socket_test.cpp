@@ -170,6 +170,26 @@ TEST(SocketTest, TestUdpReceiveOverflow) {
     }
 }
 
+#if defined(__linux__)
+// Tests sending part of a file over TCP; UDP doesn't support it.
+TEST(SocketTest, TestSendFile) {
+    std::unique_ptr<FILE, decltype(&fclose)> file(tmpfile(), fclose);
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(10u, fwrite("0123456789", 1, 10, file.get()));
+    ASSERT_EQ(0, fflush(file.get()));
+
+    std::unique_ptr<Socket> server, client;
+    ASSERT_TRUE(MakeConnectedSockets(Socket::Protocol::kTcp, &server, &client));
+    EXPECT_TRUE(client->SendFile(fileno(file.get()), 3, 5));
+    EXPECT_TRUE(ReceiveString(server.get(), "34567"));
+    // Past the end of the file.
+    EXPECT_FALSE(client->SendFile(fileno(file.get()), 8, 5));
+
+    ASSERT_TRUE(MakeConnectedSockets(Socket::Protocol::kUdp, &server, &client));
+    EXPECT_FALSE(client->SendFile(fileno(file.get()), 0, 10));
+}
+#endif
+
 // Tests UDP multi-buffer send.
 TEST(SocketTest, TestUdpSendBuffers) {
     std::unique_ptr<Socket> sock = Socket::NewServer(Socket::Protocol::kUdp, 0);
@@ -47,22 +47,28 @@ bool SuperFlashHelper::AddPartition(const std::string& partition, const std::str
     }
     auto iter = image_fds_.find(image_name);
     if (iter == image_fds_.end()) {
-        unique_fd fd = source_.OpenFile(image_name);
-        if (fd < 0) {
-            if (!optional) {
-                LOG(VERBOSE) << "could not find partition image: " << image_name;
-                return false;
+        ImageRegion region;
+        region.fd = source_.OpenFileRegion(image_name, &region.offset, &region.size);
+        if (region.fd < 0) {
+            region.fd = source_.OpenFile(image_name);
+            if (region.fd < 0) {
+                if (!optional) {
+                    LOG(VERBOSE) << "could not find partition image: " << image_name;
+                    return false;
+                }
+                return true;
             }
-            return true;
+            region.offset = 0;
+            region.size = get_file_size(region.fd);
         }
-        if (is_sparse_file(fd)) {
+        if (is_sparse_file(region.fd, region.offset)) {
             LOG(VERBOSE) << "cannot optimize dynamic partitions with sparse images";
             return false;
         }
-        iter = image_fds_.emplace(image_name, std::move(fd)).first;
+        iter = image_fds_.emplace(image_name, std::move(region)).first;
     }
 
-    if (!builder_.AddPartition(partition, image_name, get_file_size(iter->second))) {
+    if (!builder_.AddPartition(partition, image_name, iter->second.size)) {
         return false;
     }
 
@@ -108,8 +114,9 @@ SparsePtr SuperFlashHelper::GetSparseLayout() {
                     LOG(FATAL) << "image added but not found: " << extent.image_name;
                     return {nullptr, nullptr};
                 }
-                rv = sparse_file_add_fd(s.get(), iter->second.get(), extent.image_offset,
-                                        extent.size, block);
+                const ImageRegion& region = iter->second;
+                rv = sparse_file_add_fd(s.get(), region.fd.get(),
+                                        region.offset + extent.image_offset, extent.size, block);
                 break;
             }
             default:
@@ -49,8 +49,16 @@ class SuperFlashHelper final {
     std::unique_ptr<android::fs_mgr::LpMetadata> base_metadata_;
     std::vector<android::fs_mgr::SuperImageExtent> extents_;
 
+    // An image is |size| bytes at |offset| in |fd|; the offset is non-zero
+    // when the image is read in place from an archive.
+    struct ImageRegion {
+        android::base::unique_fd fd;
+        int64_t offset = 0;
+        int64_t size = 0;
+    };
+
     // Cache open image fds. This keeps them alive while we flash the sparse
     // file.
-    std::unordered_map<std::string, android::base::unique_fd> image_fds_;
+    std::unordered_map<std::string, ImageRegion> image_fds_;
     std::unordered_set<std::string> will_flash_;
 };
@@ -16,6 +16,10 @@
 
 #pragma once
 
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 #include <android-base/macros.h>
 
 // General interface to allow the fastboot protocol to be used over different
@@ -33,6 +37,15 @@ class Transport {
     // written or -1 on error.
     virtual ssize_t Write(const void* data, size_t len) = 0;
 
+    // Writes |len| bytes of file |fd| starting at |offset|, as one Write()
+    // would, but without copying them through user space. Returns the number
+    // of bytes actually written or -1 on error; errno is EOPNOTSUPP if the
+    // transport can't do this, and the caller should Write() the data instead.
+    virtual ssize_t WriteFromFd(int /* fd */, int64_t /* offset */, size_t /* len */) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
     // Closes the underlying transport. Returns 0 on success.
     virtual int Close() = 0;
 
@@ -32,12 +32,16 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include <algorithm>
 #include <list>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <android-base/macros.h>
+#include <android-base/parseint.h>
 #include <android-base/stringprintf.h>
 
 #include "socket.h"
@@ -103,7 +107,7 @@ class UdpTransport : public Transport {
   public:
     // Factory function so we can return nullptr if initialization fails.
     static std::unique_ptr<UdpTransport> NewTransport(std::unique_ptr<Socket> socket,
-                                                      std::string* error);
+                                                      uint16_t window_size, std::string* error);
     ~UdpTransport() override = default;
 
     ssize_t Read(void* data, size_t length) override;
@@ -112,7 +116,8 @@ class UdpTransport : public Transport {
     int Reset() override;
 
   private:
-    explicit UdpTransport(std::unique_ptr<Socket> socket) : socket_(std::move(socket)) {}
+    UdpTransport(std::unique_ptr<Socket> socket, uint16_t window_size)
+        : socket_(std::move(socket)), host_window_size_(window_size) {}
 
     // Performs the UDP initialization procedure. Returns true on success.
     bool InitializeProtocol(std::string* error);
@@ -131,17 +136,26 @@ class UdpTransport : public Transport {
                                    uint8_t* rx_data, size_t rx_length, int attempts,
                                    std::string* error);
 
+    // Helper for SendData(); sends |tx_length| bytes, a multiple of |max_data_length_|, as
+    // continuation packets with up to |window_size_| of them unacknowledged at a time. Only
+    // packets that time out are sent again. Returns false and fills |error| on failure.
+    bool SendWindowedHelper(Id id, const uint8_t* tx_data, size_t tx_length, int attempts,
+                            std::string* error);
+
     std::unique_ptr<Socket> socket_;
     int sequence_ = -1;
     size_t max_data_length_ = kMinPacketSize - kHeaderSize;
+    uint16_t host_window_size_;
+    size_t window_size_ = 1;
     std::vector<uint8_t> rx_packet_;
 
     DISALLOW_COPY_AND_ASSIGN(UdpTransport);
 };
 
 std::unique_ptr<UdpTransport> UdpTransport::NewTransport(std::unique_ptr<Socket> socket,
+                                                         uint16_t window_size,
                                                          std::string* error) {
-    std::unique_ptr<UdpTransport> transport(new UdpTransport(std::move(socket)));
+    std::unique_ptr<UdpTransport> transport(new UdpTransport(std::move(socket), window_size));
 
     if (!transport->InitializeProtocol(error)) {
         return nullptr;
@@ -151,7 +165,7 @@ std::unique_ptr<UdpTransport> UdpTransport::NewTransport(std::unique_ptr<Socket>
 }
 
 bool UdpTransport::InitializeProtocol(std::string* error) {
-    uint8_t rx_data[4];
+    uint8_t rx_data[6];
 
     sequence_ = 0;
     rx_packet_.resize(kMinPacketSize);
@@ -169,9 +183,11 @@ bool UdpTransport::InitializeProtocol(std::string* error) {
     // The first two bytes contain the next expected sequence number.
     sequence_ = ExtractUint16(rx_data);
 
-    // Now send the initialization packet with our version and maximum packet size.
-    uint8_t init_data[] = {kProtocolVersion >> 8, kProtocolVersion & 0xFF,
-                           kHostMaxPacketSize >> 8, kHostMaxPacketSize & 0xFF};
+    // Now send the initialization packet with our version, maximum packet size and, for version 2,
+    // write window size. Version 1 devices ignore the window size.
+    uint8_t init_data[] = {kHostProtocolVersion >> 8,   kHostProtocolVersion & 0xFF,
+                           kHostMaxPacketSize >> 8,     kHostMaxPacketSize & 0xFF,
+                           uint8_t(host_window_size_ >> 8), uint8_t(host_window_size_ & 0xFF)};
     rx_bytes = SendData(kIdInitialization, init_data, sizeof(init_data), rx_data, sizeof(rx_data),
                         kMaxTransmissionAttempts, error);
     if (rx_bytes == -1) {
@@ -199,6 +215,15 @@ bool UdpTransport::InitializeProtocol(std::string* error) {
     max_data_length_ = packet_size - kHeaderSize;
     rx_packet_.resize(packet_size);
 
+    // Version 2 devices append their own write window size; anything else gets one packet at a
+    // time.
+    window_size_ = 1;
+    if (version >= 2 && rx_bytes >= 6) {
+        uint16_t window_size = ExtractUint16(rx_data + 4);
+        window_size_ = std::max<size_t>(1, std::min({host_window_size_, window_size,
+                                                     kHostMaxWindowSize}));
+    }
+
     return true;
 }
 
@@ -211,6 +236,17 @@ ssize_t UdpTransport::SendData(Id id, const uint8_t* tx_data, size_t tx_length,
         return -1;
     }
 
+    // Large writes are pipelined when the device supports it. The last packet always goes
+    // through SendSinglePacketHelper() since its response is the one that matters.
+    if (window_size_ > 1 && id == kIdFastboot && tx_length > max_data_length_) {
+        size_t windowed_length = (tx_length - 1) / max_data_length_ * max_data_length_;
+        if (!SendWindowedHelper(id, tx_data, windowed_length, attempts, error)) {
+            return -1;
+        }
+        tx_data += windowed_length;
+        tx_length -= windowed_length;
+    }
+
     Header header;
     size_t packet_data_length;
     ssize_t ret = 0;
@@ -325,6 +361,83 @@ ssize_t UdpTransport::SendSinglePacketHelper(
     return total_data_bytes;
 }
 
+bool UdpTransport::SendWindowedHelper(Id id, const uint8_t* tx_data, size_t tx_length,
+                                      int attempts, std::string* error) {
+    error->clear();
+
+    const size_t count = tx_length / max_data_length_;
+    const uint16_t first_sequence = sequence_;
+    std::vector<bool> acked(count, false);
+
+    auto send_packet = [&](size_t index) {
+        Header header;
+        header.Set(id, first_sequence + index, kFlagContinuation);
+        return socket_->Send({{header.bytes(), kHeaderSize},
+                              {tx_data + index * max_data_length_, max_data_length_}});
+    };
+
+    // Packets [base, next) have been sent; those before |base| are all acknowledged.
+    size_t base = 0;
+    size_t next = 0;
+    int attempts_left = attempts;
+    while (base < count) {
+        for (; next < count && next < base + window_size_; ++next) {
+            if (!send_packet(next)) {
+                *error = Socket::GetErrorMessage();
+                return false;
+            }
+        }
+
+        ssize_t bytes = socket_->Receive(rx_packet_.data(), rx_packet_.size(), kResponseTimeoutMs);
+        if (bytes == -1) {
+            if (!socket_->ReceiveTimedOut()) {
+                *error = Socket::GetErrorMessage();
+                return false;
+            }
+            if (--attempts_left <= 0) {
+                *error = "no response from target";
+                return false;
+            }
+            for (size_t i = base; i < next; ++i) {
+                if (!acked[i] && !send_packet(i)) {
+                    *error = Socket::GetErrorMessage();
+                    return false;
+                }
+            }
+            continue;
+        } else if (bytes < static_cast<ssize_t>(kHeaderSize)) {
+            *error = "protocol error: incomplete header";
+            return false;
+        }
+
+        // Ignore anything outside the window, e.g. duplicate ACKs of old packets.
+        uint16_t offset = ExtractUint16(rx_packet_.data() + kIndexSeqH) -
+                          static_cast<uint16_t>(first_sequence + base);
+        if (offset >= next - base) {
+            continue;
+        }
+        if (rx_packet_[kIndexId] == kIdError) {
+            *error = "target reported error: " +
+                     std::string(rx_packet_.data() + kHeaderSize, rx_packet_.data() + bytes);
+            return false;
+        } else if (rx_packet_[kIndexId] != id) {
+            continue;
+        } else if (bytes > static_cast<ssize_t>(kHeaderSize)) {
+            *error = "target sent fastboot data out-of-turn";
+            return false;
+        }
+
+        acked[base + offset] = true;
+        attempts_left = attempts;
+        while (base < count && acked[base]) {
+            ++base;
+        }
+    }
+
+    sequence_ += count;
+    return true;
+}
+
 ssize_t UdpTransport::Read(void* data, size_t length) {
     // Read from the target by sending an empty packet.
     std::string error;
@@ -376,19 +489,29 @@ int UdpTransport::Reset() {
 }
 
 std::unique_ptr<Transport> Connect(const std::string& hostname, int port, std::string* error) {
+    uint16_t window_size = kHostDefaultWindowSize;
+    if (const char* value = getenv("FASTBOOT_UDP_WINDOW")) {
+        if (!android::base::ParseUint(value, &window_size, kHostMaxWindowSize) ||
+            window_size == 0) {
+            *error = android::base::StringPrintf("invalid FASTBOOT_UDP_WINDOW '%s' (1-%d)", value,
+                                                 kHostMaxWindowSize);
+            return nullptr;
+        }
+    }
     return internal::Connect(Socket::NewClient(Socket::Protocol::kUdp, hostname, port, error),
-                             error);
+                             error, window_size);
 }
 
 namespace internal {
 
-std::unique_ptr<Transport> Connect(std::unique_ptr<Socket> sock, std::string* error) {
+std::unique_ptr<Transport> Connect(std::unique_ptr<Socket> sock, std::string* error,
+                                   uint16_t window_size) {
     if (sock == nullptr) {
         // If Socket creation failed |error| is already set.
         return nullptr;
     }
 
-    return UdpTransport::NewTransport(std::move(sock), error);
+    return UdpTransport::NewTransport(std::move(sock), window_size, error);
 }
 
 }  // namespace internal
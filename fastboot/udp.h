@@ -39,16 +39,22 @@ namespace udp {
 constexpr int kDefaultPort = 5554;
 
 // Returns a newly allocated Transport object connected to |hostname|:|port|. On failure, |error| is
-// filled and nullptr is returned.
+// filled and nullptr is returned. The write window can be set with the FASTBOOT_UDP_WINDOW
+// environment variable; 1 disables windowing.
 std::unique_ptr<Transport> Connect(const std::string& hostname, int port, std::string* error);
 
 // Internal namespace for test use only.
 namespace internal {
 
+// Oldest protocol version we can talk to.
 constexpr uint16_t kProtocolVersion = 1;
+// Version sent by the host; version 2 adds windowed writes.
+constexpr uint16_t kHostProtocolVersion = 2;
 
-// This will be negotiated with the device so may end up being smaller.
+// These will be negotiated with the device so may end up being smaller.
 constexpr uint16_t kHostMaxPacketSize = 8192;
+constexpr uint16_t kHostMaxWindowSize = 256;
+constexpr uint16_t kHostDefaultWindowSize = 32;
 
 // Retransmission constants. Retransmission timeout must be at least 500ms, and the host must
 // attempt to send packets for at least 1 minute once the device has connected. See
@@ -70,8 +76,10 @@ enum Flag : uint8_t {
 };
 
 // Creates a UDP Transport object using a given Socket. Used for unit tests to create a Transport
-// object that uses a SocketMock.
-std::unique_ptr<Transport> Connect(std::unique_ptr<Socket> sock, std::string* error);
+// object that uses a SocketMock. |window_size| is the number of write packets the host may have
+// in flight, before negotiation with the device.
+std::unique_ptr<Transport> Connect(std::unique_ptr<Socket> sock, std::string* error,
+                                   uint16_t window_size = kHostDefaultWindowSize);
 
 }  // namespace internal
 
@@ -56,6 +56,18 @@ static std::string InitPacket(uint16_t sequence, uint16_t version, uint16_t max_
            PacketValue(version) + PacketValue(max_packet_size);
 }
 
+// Returns an Init packet with a 2-byte |version|, |max_packet_size| and |window_size|.
+static std::string InitPacket(uint16_t sequence, uint16_t version, uint16_t max_packet_size,
+                              uint16_t window_size) {
+    return InitPacket(sequence, version, max_packet_size) + PacketValue(window_size);
+}
+
+// Returns the Init packet sent by the host.
+static std::string HostInitPacket(uint16_t sequence,
+                                  uint16_t window_size = kHostDefaultWindowSize) {
+    return InitPacket(sequence, kHostProtocolVersion, kHostMaxPacketSize, window_size);
+}
+
 // Returns a Fastboot packet with |data|.
 static std::string FastbootPacket(uint16_t sequence, const std::string& data = "",
                                   char flags = kFlagNone) {
@@ -89,7 +101,7 @@ TEST_F(UdpConnectTest, InitializationSuccess) {
     for (uint16_t seq : kTestSequenceNumbers) {
         mock_socket_->ExpectSend(QueryPacket(0));
         mock_socket_->AddReceive(QueryPacket(0, seq));
-        mock_socket_->ExpectSend(InitPacket(seq, kProtocolVersion, kHostMaxPacketSize));
+        mock_socket_->ExpectSend(HostInitPacket(seq));
         mock_socket_->AddReceive(InitPacket(seq, kProtocolVersion, 1024));
 
         EXPECT_TRUE(UdpConnect());
@@ -103,7 +115,7 @@ TEST_F(UdpConnectTest, InitializationContinuationSuccess) {
     mock_socket_->ExpectSend(std::string{kIdDeviceQuery, kFlagNone, 0, 1});
     mock_socket_->AddReceive(std::string{kIdDeviceQuery, kFlagNone, 0, 1, 0x55});
 
-    mock_socket_->ExpectSend(InitPacket(0x4455, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0x4455));
     mock_socket_->AddReceive(std::string{kIdInitialization, kFlagContinuation, 0x44, 0x55, 0});
     mock_socket_->ExpectSend(std::string{kIdInitialization, kFlagNone, 0x44, 0x56});
     mock_socket_->AddReceive(std::string{kIdInitialization, kFlagContinuation, 0x44, 0x56, 1});
@@ -121,14 +133,14 @@ TEST_F(UdpConnectTest, InitializationContinuationSuccess) {
 TEST_F(UdpConnectTest, InitializationVersionMismatch) {
     mock_socket_->ExpectSend(QueryPacket(0));
     mock_socket_->AddReceive(QueryPacket(0, 0));
-    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0));
     mock_socket_->AddReceive(InitPacket(0, 2, 1024));
 
     EXPECT_TRUE(UdpConnect());
 
     mock_socket_->ExpectSend(QueryPacket(0));
     mock_socket_->AddReceive(QueryPacket(0, 0));
-    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0));
     mock_socket_->AddReceive(InitPacket(0, 0, 1024));
 
     EXPECT_FALSE(UdpConnect());
@@ -154,7 +166,7 @@ TEST_F(UdpConnectTest, InitResponseTimeoutFailure) {
     mock_socket_->ExpectSend(QueryPacket(0));
     mock_socket_->AddReceive(QueryPacket(0, 0));
     for (int i = 0; i < kMaxTransmissionAttempts; ++i) {
-        mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+        mock_socket_->ExpectSend(HostInitPacket(0));
         mock_socket_->AddReceiveTimeout();
     }
 
@@ -164,7 +176,7 @@ TEST_F(UdpConnectTest, InitResponseTimeoutFailure) {
 TEST_F(UdpConnectTest, InitResponseReceiveFailure) {
     mock_socket_->ExpectSend(QueryPacket(0));
     mock_socket_->AddReceive(QueryPacket(0, 0));
-    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0));
     mock_socket_->AddReceiveFailure();
 
     EXPECT_FALSE(UdpConnect());
@@ -182,10 +194,10 @@ TEST_F(UdpConnectTest, ResponseRecovery) {
 
     // Subsequent packets try up to (kMaxTransmissionAttempts - 1) times.
     for (int i = 0; i < kMaxTransmissionAttempts - 1; ++i) {
-        mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+        mock_socket_->ExpectSend(HostInitPacket(0));
         mock_socket_->AddReceiveTimeout();
     }
-    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0));
     mock_socket_->AddReceive(InitPacket(0, kProtocolVersion, 1024));
 
     EXPECT_TRUE(UdpConnect());
@@ -195,7 +207,7 @@ TEST_F(UdpConnectTest, ResponseRecovery) {
 TEST_F(UdpConnectTest, ExtraResponseDataSuccess) {
     mock_socket_->ExpectSend(QueryPacket(0));
     mock_socket_->AddReceive(QueryPacket(0, 0) + "foo");
-    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0));
     mock_socket_->AddReceive(InitPacket(0, kProtocolVersion, 1024) + "bar");
 
     EXPECT_TRUE(UdpConnect());
@@ -208,7 +220,7 @@ TEST_F(UdpConnectTest, WrongSequenceRecovery) {
     mock_socket_->AddReceive(QueryPacket(1, 0));
     mock_socket_->AddReceive(QueryPacket(0, 0));
 
-    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0));
     mock_socket_->AddReceive(InitPacket(1, kProtocolVersion, 1024));
     mock_socket_->AddReceive(InitPacket(0, kProtocolVersion, 1024));
 
@@ -221,7 +233,7 @@ TEST_F(UdpConnectTest, WrongIdRecovery) {
     mock_socket_->AddReceive(FastbootPacket(0));
     mock_socket_->AddReceive(QueryPacket(0, 0));
 
-    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0));
     mock_socket_->AddReceive(FastbootPacket(0));
     mock_socket_->AddReceive(InitPacket(0, kProtocolVersion, 1024));
 
@@ -251,7 +263,7 @@ TEST_F(UdpConnectTest, InvalidInitResponseFailure) {
 
     mock_socket_->ExpectSend(QueryPacket(0));
     mock_socket_->AddReceive(QueryPacket(0, 0));
-    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0));
     mock_socket_->AddReceive(InitPacket(0, kProtocolVersion, 511));
 
     EXPECT_FALSE(UdpConnect(&error));
@@ -259,7 +271,7 @@ TEST_F(UdpConnectTest, InvalidInitResponseFailure) {
 
     mock_socket_->ExpectSend(QueryPacket(0));
     mock_socket_->AddReceive(QueryPacket(0, 0));
-    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0));
     mock_socket_->AddReceive(InitPacket(0, 0, 1024));
 
     EXPECT_FALSE(UdpConnect(&error));
@@ -277,7 +289,7 @@ TEST_F(UdpConnectTest, ErrorResponseFailure) {
 
     mock_socket_->ExpectSend(QueryPacket(0));
     mock_socket_->AddReceive(QueryPacket(0, 0));
-    mock_socket_->ExpectSend(InitPacket(0, kProtocolVersion, kHostMaxPacketSize));
+    mock_socket_->ExpectSend(HostInitPacket(0));
     mock_socket_->AddReceive(ErrorPacket(0, "error2"));
 
     EXPECT_FALSE(UdpConnect(&error));
@@ -310,14 +322,20 @@ class UdpTest : public ::testing::Test {
 
     // Sets up |mock_socket_| to correctly initialize the protocol and creates |transport_|. This
     // can be called multiple times in a test if needed.
-    bool InitializeTransport(uint16_t starting_sequence, int device_max_packet_size = 512) {
+    // A non-zero |device_window_size| makes the device reply as a version 2 device.
+    bool InitializeTransport(uint16_t starting_sequence, int device_max_packet_size = 512,
+                             uint16_t device_window_size = 0) {
         mock_socket_ = new SocketMock;
         mock_socket_->ExpectSend(QueryPacket(0));
         mock_socket_->AddReceive(QueryPacket(0, starting_sequence));
-        mock_socket_->ExpectSend(
-                InitPacket(starting_sequence, kProtocolVersion, kHostMaxPacketSize));
-        mock_socket_->AddReceive(
-                InitPacket(starting_sequence, kProtocolVersion, device_max_packet_size));
+        mock_socket_->ExpectSend(HostInitPacket(starting_sequence));
+        if (device_window_size) {
+            mock_socket_->AddReceive(InitPacket(starting_sequence, 2, device_max_packet_size,
+                                                device_window_size));
+        } else {
+            mock_socket_->AddReceive(
+                    InitPacket(starting_sequence, kProtocolVersion, device_max_packet_size));
+        }
 
         std::string error;
         transport_ = Connect(std::unique_ptr<Socket>(mock_socket_), &error);
@@ -522,6 +540,92 @@ TEST_F(UdpTest, ErrorResponse) {
     EXPECT_FALSE(Write("foo"));
 }
 
+// Builds |count| packets worth of data for a 512-byte packet size.
+static std::vector<std::string> MakeChunks(size_t count) {
+    std::vector<std::string> chunks;
+    for (size_t i = 0; i < count; ++i) {
+        chunks.emplace_back(508, static_cast<char>(i));
+    }
+    return chunks;
+}
+
+// Tests that a version 2 device gets several write packets in flight.
+TEST_F(UdpTest, WindowedWrite) {
+    ASSERT_TRUE(InitializeTransport(0, 512, 2));
+    auto chunks = MakeChunks(4);
+
+    // Two packets go out before any ACK; the last one waits for the rest.
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1], kFlagContinuation));
+    mock_socket_->AddReceive(FastbootPacket(1));
+    mock_socket_->ExpectSend(FastbootPacket(3, chunks[2], kFlagContinuation));
+    mock_socket_->AddReceive(FastbootPacket(2));
+    mock_socket_->AddReceive(FastbootPacket(3));
+    mock_socket_->ExpectSend(FastbootPacket(4, chunks[3]));
+    mock_socket_->AddReceive(FastbootPacket(4));
+
+    EXPECT_TRUE(Write(chunks[0] + chunks[1] + chunks[2] + chunks[3]));
+}
+
+// Tests that the window is the smaller of the host and device windows.
+TEST_F(UdpTest, WindowNegotiation) {
+    ASSERT_TRUE(InitializeTransport(0, 512, kHostDefaultWindowSize + 10));
+    auto chunks = MakeChunks(kHostDefaultWindowSize + 2);
+
+    std::string data;
+    for (size_t i = 0; i < chunks.size() - 1; ++i) {
+        if (i < kHostDefaultWindowSize) {
+            mock_socket_->ExpectSend(FastbootPacket(i + 1, chunks[i], kFlagContinuation));
+        }
+        data += chunks[i];
+    }
+    data += chunks.back();
+    mock_socket_->AddReceive(FastbootPacket(1));
+    mock_socket_->ExpectSend(FastbootPacket(kHostDefaultWindowSize + 1,
+                                            chunks[kHostDefaultWindowSize], kFlagContinuation));
+    for (size_t i = 2; i <= kHostDefaultWindowSize + 1; ++i) {
+        mock_socket_->AddReceive(FastbootPacket(i));
+    }
+    mock_socket_->ExpectSend(FastbootPacket(kHostDefaultWindowSize + 2, chunks.back()));
+    mock_socket_->AddReceive(FastbootPacket(kHostDefaultWindowSize + 2));
+
+    EXPECT_TRUE(Write(data));
+}
+
+// Tests that only unacknowledged packets are sent again after a timeout.
+TEST_F(UdpTest, WindowedSelectiveRetransmit) {
+    ASSERT_TRUE(InitializeTransport(0xFFFE, 512, 3));
+    auto chunks = MakeChunks(4);
+
+    mock_socket_->ExpectSend(FastbootPacket(0xFFFF, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(0x0000, chunks[1], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(0x0001, chunks[2], kFlagContinuation));
+    // The second packet is lost.
+    mock_socket_->AddReceive(FastbootPacket(0xFFFF));
+    mock_socket_->AddReceive(FastbootPacket(0x0001));
+    mock_socket_->AddReceiveTimeout();
+    mock_socket_->ExpectSend(FastbootPacket(0x0000, chunks[1], kFlagContinuation));
+    // A duplicate ACK is ignored.
+    mock_socket_->AddReceive(FastbootPacket(0xFFFF));
+    mock_socket_->AddReceive(FastbootPacket(0x0000));
+    mock_socket_->ExpectSend(FastbootPacket(0x0002, chunks[3]));
+    mock_socket_->AddReceive(FastbootPacket(0x0002));
+
+    EXPECT_TRUE(Write(chunks[0] + chunks[1] + chunks[2] + chunks[3]));
+}
+
+// Tests that an error response in the window aborts the write.
+TEST_F(UdpTest, WindowedWriteError) {
+    ASSERT_TRUE(InitializeTransport(0, 512, 2));
+    auto chunks = MakeChunks(3);
+
+    mock_socket_->ExpectSend(FastbootPacket(1, chunks[0], kFlagContinuation));
+    mock_socket_->ExpectSend(FastbootPacket(2, chunks[1], kFlagContinuation));
+    mock_socket_->AddReceive(ErrorPacket(2, "test error"));
+
+    EXPECT_FALSE(Write(chunks[0] + chunks[1] + chunks[2]));
+}
+
 // Tests that attempting to use a closed transport returns -1 without making any socket calls.
 TEST_F(UdpTest, CloseTransport) {
     char buffer[32];
@@ -30,6 +30,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,6 +46,7 @@
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
+#include <algorithm>
 #include <chrono>
 #include <memory>
 #include <thread>
@@ -85,6 +87,10 @@ using namespace std::chrono_literals;
 // kernel.
 #define MAX_USBFS_BULK_SIZE (16 * 1024)
 
+// Write() keeps up to this many bulk URBs queued, so the device is never left
+// idle while the host reaps one transfer and submits the next.
+static constexpr size_t kMaxUrbsInFlight = 32;
+
 struct usb_handle
 {
     char fname[64];
@@ -106,6 +112,8 @@ class LinuxUsbTransport : public UsbTransport {
     int WaitForDisconnect() override;
 
   private:
+    usbdevfs_urb* ReapUrb();
+
     std::unique_ptr<usb_handle> handle_;
     const uint32_t ms_timeout_;
 
@@ -400,37 +408,108 @@ LinuxUsbTransport::~LinuxUsbTransport() {
     Close();
 }
 
+// Waits for a submitted URB to complete, for at most ms_timeout_ if set.
+// Returns nullptr with errno set on timeout or error.
+usbdevfs_urb* LinuxUsbTransport::ReapUrb() {
+    while (true) {
+        usbdevfs_urb* urb = nullptr;
+        if (ioctl(handle_->desc, USBDEVFS_REAPURBNDELAY, &urb) == 0) {
+            return urb;
+        }
+        if (errno != EAGAIN) {
+            return nullptr;
+        }
+        // usbfs reports completed URBs as POLLOUT.
+        struct pollfd pfd = {.fd = handle_->desc, .events = POLLOUT, .revents = 0};
+        int n = TEMP_FAILURE_RETRY(poll(&pfd, 1, ms_timeout_ ? ms_timeout_ : -1));
+        if (n == 0) {
+            errno = ETIMEDOUT;
+        }
+        if (n <= 0) {
+            return nullptr;
+        }
+    }
+}
+
 ssize_t LinuxUsbTransport::Write(const void* _data, size_t len)
 {
     unsigned char *data = (unsigned char*) _data;
-    unsigned count = 0;
-    struct usbdevfs_bulktransfer bulk;
-    int n;
+    size_t count = 0;
+    size_t submitted = 0;
+    struct usbdevfs_urb urbs[kMaxUrbsInFlight];
+    bool busy[kMaxUrbsInFlight] = {};
+    size_t in_flight = 0;
+    bool failed = false;
 
     if (handle_->ep_out == 0 || handle_->desc == -1) {
         return -1;
     }
 
-    do {
-        int xfer;
-        xfer = (len > MAX_USBFS_BULK_SIZE) ? MAX_USBFS_BULK_SIZE : len;
-
-        bulk.ep = handle_->ep_out;
-        bulk.len = xfer;
-        bulk.data = data;
-        bulk.timeout = ms_timeout_;
+    // Submit at least one URB, so that a zero length write still sends a
+    // zero length packet.
+    bool first = true;
+    while (!failed && (submitted < len || first || in_flight > 0)) {
+        for (size_t i = 0; i < kMaxUrbsInFlight && (submitted < len || first); i++) {
+            if (busy[i]) continue;
+            size_t xfer = std::min<size_t>(len - submitted, MAX_USBFS_BULK_SIZE);
+
+            struct usbdevfs_urb* urb = &urbs[i];
+            memset(urb, 0, sizeof(*urb));
+            urb->type = USBDEVFS_URB_TYPE_BULK;
+            urb->endpoint = handle_->ep_out;
+            urb->buffer = data + submitted;
+            urb->buffer_length = xfer;
+            if (ioctl(handle_->desc, USBDEVFS_SUBMITURB, urb) < 0) {
+                DBG("ERROR: submit urb, errno = %d (%s)\n", errno, strerror(errno));
+                failed = true;
+                break;
+            }
+            busy[i] = true;
+            in_flight++;
+            submitted += xfer;
+            first = false;
+        }
+        if (in_flight == 0) {
+            break;
+        }
 
-        n = ioctl(handle_->desc, USBDEVFS_BULK, &bulk);
-        if(n != xfer) {
-            DBG("ERROR: n = %d, errno = %d (%s)\n",
-                n, errno, strerror(errno));
-            return -1;
+        struct usbdevfs_urb* urb = ReapUrb();
+        if (urb == nullptr) {
+            DBG("ERROR: reap urb, errno = %d (%s)\n", errno, strerror(errno));
+            failed = true;
+            break;
+        }
+        busy[urb - urbs] = false;
+        in_flight--;
+        if (urb->status != 0 || urb->actual_length != urb->buffer_length) {
+            DBG("ERROR: urb status = %d, %d of %d bytes\n", urb->status, urb->actual_length,
+                urb->buffer_length);
+            failed = true;
+            break;
         }
+        count += urb->actual_length;
+    }
 
-        count += xfer;
-        len -= xfer;
-        data += xfer;
-    } while(len > 0);
+    if (failed) {
+        // Cancel what is still queued. The data was copied when each URB was
+        // submitted, so nothing refers to |data| once Write() returns, even
+        // if a URB cannot be reaped because the device is gone.
+        for (size_t i = 0; i < kMaxUrbsInFlight; i++) {
+            if (busy[i]) ioctl(handle_->desc, USBDEVFS_DISCARDURB, &urbs[i]);
+        }
+        // Every URB must be reaped here, or a later Write() would reap it
+        // and the kernel would write its status to |urbs| after they are
+        // gone. Only a device that went away drops them all.
+        while (in_flight > 0) {
+            struct usbdevfs_urb* urb = nullptr;
+            if (TEMP_FAILURE_RETRY(ioctl(handle_->desc, USBDEVFS_REAPURB, &urb)) == 0) {
+                in_flight--;
+            } else if (errno == ENODEV) {
+                break;
+            }
+        }
+        return -1;
+    }
 
     return count;
 }
@@ -33,7 +33,9 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 
+#include <android-base/file.h>
 #include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 
 #include "util.h"
@@ -41,6 +43,7 @@
 using android::base::borrowed_fd;
 
 static bool g_verbose = false;
+static void (*g_die_handler)(const std::string& message) = nullptr;
 
 double now() {
     struct timeval tv;
@@ -51,10 +54,13 @@ double now() {
 void die(const char* fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    fprintf(stderr, "fastboot: error: ");
-    vfprintf(stderr, fmt, ap);
-    fprintf(stderr, "\n");
+    std::string message;
+    android::base::StringAppendV(&message, fmt, ap);
     va_end(ap);
+    if (g_die_handler) {
+        g_die_handler(message);
+    }
+    fprintf(stderr, "fastboot: error: %s\n", message.c_str());
     exit(EXIT_FAILURE);
 }
 
@@ -62,6 +68,10 @@ void die(const std::string& str) {
     die("%s", str.c_str());
 }
 
+void set_die_handler(void (*handler)(const std::string& message)) {
+    g_die_handler = handler;
+}
+
 void set_verbose() {
     g_verbose = true;
 }
@@ -102,6 +112,14 @@ bool is_sparse_file(borrowed_fd fd) {
     return !!s;
 }
 
+bool is_sparse_file(borrowed_fd fd, int64_t offset) {
+    // Only the magic is checked; the header is validated on import.
+    static constexpr uint32_t kSparseHeaderMagic = 0xed26ff3a;
+    uint32_t magic;
+    return android::base::ReadFullyAtOffset(fd, &magic, sizeof(magic), offset) &&
+           magic == kSparseHeaderMagic;
+}
+
 int64_t get_file_size(borrowed_fd fd) {
     struct stat sb;
     if (fstat(fd.get(), &sb) == -1) {
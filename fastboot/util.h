@@ -26,9 +26,15 @@ void verbose(const char* fmt, ...) __attribute__((__format__(__printf__, 1, 2)))
 
 void die(const std::string& str) __attribute__((__noreturn__));
 
+// die() normally prints the message and exits. A process can install a handler
+// that is given the message instead; the handler must not return. Pass nullptr
+// to remove it.
+void set_die_handler(void (*handler)(const std::string& message));
+
 bool should_flash_in_userspace(const android::fs_mgr::LpMetadata& metadata,
                                const std::string& partition_name);
 bool is_sparse_file(android::base::borrowed_fd fd);
+bool is_sparse_file(android::base::borrowed_fd fd, int64_t offset);
 int64_t get_file_size(android::base::borrowed_fd fd);
 std::string fb_fix_numeric_var(std::string var);
 
@@ -37,4 +43,14 @@ class ImageSource {
     virtual ~ImageSource(){};
     virtual bool ReadFile(const std::string& name, std::vector<char>* out) const = 0;
     virtual android::base::unique_fd OpenFile(const std::string& name) const = 0;
+
+    // Sources holding |name| uncompressed inside a larger file can return that
+    // file, with the offset and size of the image in it, so the image is read
+    // in place instead of being copied out by OpenFile(). The returned fd has
+    // its own file offset. Returns an invalid fd if this is not possible.
+    virtual android::base::unique_fd OpenFileRegion(const std::string& /* name */,
+                                                    int64_t* /* offset */,
+                                                    int64_t* /* size */) const {
+        return {};
+    }
 };
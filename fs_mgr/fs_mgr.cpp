@@ -38,9 +38,13 @@
 
 #include <array>
 #include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <thread>
@@ -915,9 +919,12 @@ static bool fs_match(const std::string& in1, const std::string& in2) {
 // end_idx: On return, will be the last entry that was looked at.
 // attempted_idx: On return, will indicate which fstab entry
 //     succeeded. In case of failure, it will be the start_idx.
+// prepared_fs_stat: If set, fstab[start_idx] was already prepared for mount
+//     (see prepare_fs_for_mount) and this is the resulting fs_stat.
 // Sets errno to match the 1st mount failure on failure.
 static bool mount_with_alternatives(Fstab& fstab, int start_idx, int* end_idx,
-                                    int* attempted_idx) {
+                                    int* attempted_idx,
+                                    std::optional<int> prepared_fs_stat = {}) {
     unsigned long i;
     int mount_errno = 0;
     bool mounted = false;
@@ -944,7 +951,9 @@ static bool mount_with_alternatives(Fstab& fstab, int start_idx, int* end_idx,
             fstab[i].blk_device = fstab[start_idx].blk_device;
         }
 
-        int fs_stat = prepare_fs_for_mount(fstab[i].blk_device, fstab[i]);
+        int fs_stat = (i == start_idx && prepared_fs_stat)
+                              ? *prepared_fs_stat
+                              : prepare_fs_for_mount(fstab[i].blk_device, fstab[i]);
         if (fs_stat & FS_STAT_INVALID_MAGIC) {
             LERROR << __FUNCTION__
                    << "(): skipping mount due to invalid magic, mountpoint=" << fstab[i].mount_point
@@ -1386,6 +1395,174 @@ static bool IsMountPointMounted(const std::string& mount_point) {
     return GetEntryForMountPoint(&fstab, mount_point) != nullptr;
 }
 
+// Runs the device wait and prepare_fs_for_mount() (fsck, tune2fs) of independent
+// fstab entries on a bounded pool of threads, ahead of fs_mgr_mount_all() which
+// still mounts everything in fstab order. An entry is only prepared once its
+// closest parent mount point in the fstab has been handled, since preparing
+// creates the mount point directory and may temporarily mount over it.
+//
+// Only plain entries are eligible: anything involving shared state (AVB,
+// logical partitions, checkpointing, alternatives, /data and encryption) is
+// left to the sequential path.
+class ParallelMountPreparer {
+  public:
+    struct Result {
+        bool device_ready = false;
+        int fs_stat = 0;
+    };
+
+    ParallelMountPreparer(Fstab* fstab, int mount_mode, unsigned int threads);
+    ~ParallelMountPreparer();
+
+    // Tell the preparer that fs_mgr_mount_all() has dealt with every entry
+    // before |index|.
+    void Advance(int index);
+
+    // If fstab[index] is prepared in parallel, wait for and return the result.
+    std::optional<Result> Take(int index);
+
+  private:
+    struct Task {
+        int index;
+        int parent;
+        std::optional<Result> result;
+    };
+
+    bool IsEligible(int index, int mount_mode) const;
+    int FindParent(int index) const;
+    void Run();
+
+    const Fstab& fstab_;
+    std::map<int, Task> tasks_;
+    std::map<int, Task>::iterator next_task_;
+    std::vector<std::thread> threads_;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    int progress_ = 0;
+    bool stopped_ = false;
+};
+
+ParallelMountPreparer::ParallelMountPreparer(Fstab* fstab, int mount_mode, unsigned int threads)
+    : fstab_(*fstab) {
+    for (int i = 0; i < static_cast<int>(fstab_.size()); i++) {
+        if (IsEligible(i, mount_mode)) {
+            tasks_.emplace(i, Task{.index = i, .parent = FindParent(i)});
+        }
+    }
+    next_task_ = tasks_.begin();
+    threads = std::min(threads, static_cast<unsigned int>(tasks_.size()));
+    for (unsigned int i = 0; i < threads; i++) {
+        threads_.emplace_back([this]() -> void { Run(); });
+    }
+}
+
+ParallelMountPreparer::~ParallelMountPreparer() {
+    {
+        // Don't start on entries fs_mgr_mount_all() will never get to.
+        std::lock_guard<std::mutex> lock(lock_);
+        stopped_ = true;
+    }
+    Advance(std::numeric_limits<int>::max());
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+// This must agree with the checks in fs_mgr_mount_all(): nothing that would be
+// skipped there may be touched here.
+bool ParallelMountPreparer::IsEligible(int index, int mount_mode) const {
+    const auto& entry = fstab_[index];
+    if (entry.fs_mgr_flags.first_stage_mount || entry.fs_mgr_flags.vold_managed ||
+        entry.fs_mgr_flags.recovery_only) {
+        return false;
+    }
+    if (mount_mode == MOUNT_MODE_ONLY_USERDATA ||
+        (mount_mode == MOUNT_MODE_LATE && !entry.fs_mgr_flags.late_mount) ||
+        (mount_mode == MOUNT_MODE_EARLY && entry.fs_mgr_flags.late_mount)) {
+        return false;
+    }
+    if (!is_extfs(entry.fs_type) && !is_f2fs(entry.fs_type)) {
+        return false;
+    }
+    if (entry.mount_point == "/" || entry.mount_point == "/system" ||
+        entry.mount_point == "/data") {
+        return false;
+    }
+    if (entry.fs_mgr_flags.logical || entry.fs_mgr_flags.avb || !entry.avb_keys.empty() ||
+        entry.fs_mgr_flags.checkpoint_blk || entry.fs_mgr_flags.checkpoint_fs) {
+        return false;
+    }
+    if (StartsWith(entry.blk_device, "LABEL=")) {
+        return false;
+    }
+    // Alternatives for the same mount point are consecutive.
+    if ((index > 0 && fstab_[index - 1].mount_point == entry.mount_point) ||
+        (index + 1 < static_cast<int>(fstab_.size()) &&
+         fstab_[index + 1].mount_point == entry.mount_point)) {
+        return false;
+    }
+    return true;
+}
+
+// Returns the index of the closest earlier entry whose mount point contains
+// this one, or -1.
+int ParallelMountPreparer::FindParent(int index) const {
+    const auto& mount_point = fstab_[index].mount_point;
+    for (int i = index - 1; i >= 0; i--) {
+        const auto& other = fstab_[i].mount_point;
+        if (other != "/" && StartsWith(mount_point, other + "/")) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void ParallelMountPreparer::Advance(int index) {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (index > progress_) {
+        progress_ = index;
+        cv_.notify_all();
+    }
+}
+
+void ParallelMountPreparer::Run() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!stopped_ && next_task_ != tasks_.end()) {
+        // Tasks are taken in fstab order, and only ever wait on earlier
+        // entries, so the pool cannot deadlock.
+        Task& task = (next_task_++)->second;
+        cv_.wait(lock, [&]() -> bool { return progress_ > task.parent; });
+        if (stopped_) break;
+        lock.unlock();
+
+        const auto& entry = fstab_[task.index];
+        Result result;
+        if (!entry.fs_mgr_flags.wait || WaitForFile(entry.blk_device, 20s)) {
+            result.device_ready = true;
+            result.fs_stat = prepare_fs_for_mount(entry.blk_device, entry);
+        }
+
+        lock.lock();
+        task.result = result;
+        cv_.notify_all();
+    }
+}
+
+std::optional<ParallelMountPreparer::Result> ParallelMountPreparer::Take(int index) {
+    auto iter = tasks_.find(index);
+    if (iter == tasks_.end()) {
+        return {};
+    }
+    Task& task = iter->second;
+
+    std::unique_lock<std::mutex> lock(lock_);
+    cv_.wait(lock, [&]() -> bool { return task.result.has_value(); });
+    auto result = task.result;
+    // A format will replay the entry; it must then be prepared again.
+    tasks_.erase(iter);
+    return result;
+}
+
 // When multiple fstab records share the same mount_point, it will try to mount each
 // one in turn, and ignore any duplicates after a first successful mount.
 // Returns -1 on error, and  FS_MGR_MNTALL_* otherwise.
@@ -1401,10 +1578,19 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
         return {FS_MGR_MNTALL_FAIL, userdata_mounted};
     }
 
+    std::optional<ParallelMountPreparer> preparer;
+    if (auto threads = GetUintProperty<unsigned int>("ro.fs_mgr.mount_all.threads", 0);
+        threads > 1) {
+        preparer.emplace(fstab, mount_mode, threads);
+    }
+
     // Keep i int to prevent unsigned integer overflow from (i = top_idx - 1),
     // where top_idx is 0. It will give SIGABRT
     for (int i = 0; i < static_cast<int>(fstab->size()); i++) {
         auto& current_entry = (*fstab)[i];
+        if (preparer) {
+            preparer->Advance(i);
+        }
 
         // If a filesystem should have been mounted in the first stage, we
         // ignore it here. With one exception, if the filesystem is
@@ -1464,7 +1650,15 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
             continue;
         }
 
-        if (current_entry.fs_mgr_flags.wait && !WaitForFile(current_entry.blk_device, 20s)) {
+        std::optional<int> prepared_fs_stat;
+        if (auto prepared = preparer ? preparer->Take(i) : std::nullopt; prepared) {
+            if (!prepared->device_ready) {
+                LERROR << "Skipping '" << current_entry.blk_device << "' during mount_all";
+                continue;
+            }
+            prepared_fs_stat = prepared->fs_stat;
+        } else if (current_entry.fs_mgr_flags.wait &&
+                   !WaitForFile(current_entry.blk_device, 20s)) {
             LERROR << "Skipping '" << current_entry.blk_device << "' during mount_all";
             continue;
         }
@@ -1498,7 +1692,8 @@ MountAllResult fs_mgr_mount_all(Fstab* fstab, int mount_mode) {
         int top_idx = i;
         int attempted_idx = -1;
 
-        bool mret = mount_with_alternatives(*fstab, i, &last_idx_inspected, &attempted_idx);
+        bool mret = mount_with_alternatives(*fstab, i, &last_idx_inspected, &attempted_idx,
+                                            prepared_fs_stat);
         auto& attempted_entry = (*fstab)[attempted_idx];
         i = last_idx_inspected;
         int mount_errno = errno;
@@ -2066,10 +2261,10 @@ static bool PrepareZramBackingDevice(off64_t size) {
         return false;
     }
 
-    // Allocate loop device and attach it to file_path.
+    // Allocate loop device and attach it to file_path, with block size and direct IO set.
     LoopControl loop_control;
     std::string loop_device;
-    if (!loop_control.Attach(target_fd.get(), 5s, &loop_device)) {
+    if (!loop_control.Attach(target_fd.get(), 5s, &loop_device, true /* direct_io */)) {
         return false;
     }
 
@@ -2079,7 +2274,6 @@ static bool PrepareZramBackingDevice(off64_t size) {
         LOG(DEBUG) << "Failed to config queue depth: " << ret.error().message();
     }
 
-    // set block size & direct IO
     unique_fd loop_fd(TEMP_FAILURE_RETRY(open(loop_device.c_str(), O_RDWR | O_CLOEXEC)));
     if (loop_fd.get() == -1) {
         PERROR << "Cannot open " << loop_device;
@@ -2088,9 +2282,6 @@ static bool PrepareZramBackingDevice(off64_t size) {
     if (!LoopControl::SetAutoClearStatus(loop_fd.get())) {
         PERROR << "Failed set LO_FLAGS_AUTOCLEAR for " << loop_device;
     }
-    if (!LoopControl::EnableDirectIo(loop_fd.get())) {
-        return false;
-    }
 
     return InstallZramDevice(loop_device);
 }
@@ -31,6 +31,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <optional>
 #include <sstream>
 
 #include <android-base/file.h>
@@ -92,34 +93,89 @@ static bool GetPhysicalPartitionDevicePath(const CreateLogicalPartitionParams& p
 bool CreateDmTableInternal(const CreateLogicalPartitionParams& params, DmTable* table) {
     const auto& super_device = params.block_device;
 
+    // Resolving a device path involves a realpath() of its symlink, so do it
+    // once per block device rather than once per extent.
+    std::vector<std::optional<std::string>> device_paths(params.metadata->block_devices.size());
+
+    // Adjacent extents that continue each other are emitted as a single
+    // target. liblp merges these as they are added, but metadata written by
+    // older tools (or by other writers) may still contain them, and every
+    // target costs kernel memory, table load time, and a lookup per bio.
+    struct PendingExtent {
+        uint32_t target_type;
+        uint32_t target_source;
+        uint64_t target_data;
+        uint64_t num_sectors;
+    };
+    std::optional<PendingExtent> pending;
     uint64_t sector = 0;
+    auto flush = [&]() -> bool {
+        if (!pending) return true;
+
+        std::unique_ptr<DmTarget> target;
+        if (pending->target_type == LP_TARGET_TYPE_ZERO) {
+            target = std::make_unique<DmTargetZero>(sector, pending->num_sectors);
+        } else {
+            auto& dev_string = device_paths[pending->target_source];
+            if (!dev_string) {
+                const auto& block_device = params.metadata->block_devices[pending->target_source];
+                std::string path;
+                if (!GetPhysicalPartitionDevicePath(params, block_device, super_device, &path)) {
+                    LOG(ERROR) << "Unable to complete device-mapper table, unknown block device";
+                    return false;
+                }
+                dev_string = std::move(path);
+            }
+            target = std::make_unique<DmTargetLinear>(sector, pending->num_sectors, *dev_string,
+                                                      pending->target_data);
+        }
+        if (!table->AddTarget(std::move(target))) {
+            return false;
+        }
+        sector += pending->num_sectors;
+        pending.reset();
+        return true;
+    };
+
     for (size_t i = 0; i < params.partition->num_extents; i++) {
         const auto& extent = params.metadata->extents[params.partition->first_extent_index + i];
-        std::unique_ptr<DmTarget> target;
         switch (extent.target_type) {
             case LP_TARGET_TYPE_ZERO:
-                target = std::make_unique<DmTargetZero>(sector, extent.num_sectors);
                 break;
-            case LP_TARGET_TYPE_LINEAR: {
-                const auto& block_device = params.metadata->block_devices[extent.target_source];
-                std::string dev_string;
-                if (!GetPhysicalPartitionDevicePath(params, block_device, super_device,
-                                                    &dev_string)) {
+            case LP_TARGET_TYPE_LINEAR:
+                if (extent.target_source >= device_paths.size()) {
                     LOG(ERROR) << "Unable to complete device-mapper table, unknown block device";
                     return false;
                 }
-                target = std::make_unique<DmTargetLinear>(sector, extent.num_sectors, dev_string,
-                                                          extent.target_data);
                 break;
-            }
             default:
                 LOG(ERROR) << "Unknown target type in metadata: " << extent.target_type;
                 return false;
         }
-        if (!table->AddTarget(std::move(target))) {
+
+        if (pending && pending->target_type == extent.target_type) {
+            if (extent.target_type == LP_TARGET_TYPE_ZERO) {
+                pending->num_sectors += extent.num_sectors;
+                continue;
+            }
+            if (pending->target_source == extent.target_source &&
+                pending->target_data + pending->num_sectors == extent.target_data) {
+                pending->num_sectors += extent.num_sectors;
+                continue;
+            }
+        }
+        if (!flush()) {
             return false;
         }
-        sector += extent.num_sectors;
+        pending = PendingExtent{
+                .target_type = extent.target_type,
+                .target_source = extent.target_source,
+                .target_data = extent.target_data,
+                .num_sectors = extent.num_sectors,
+        };
+    }
+    if (!flush()) {
+        return false;
     }
     if (params.partition->attributes & LP_PARTITION_ATTR_READONLY) {
         table->set_readonly(true);
@@ -152,10 +208,10 @@ std::unique_ptr<LpMetadata> ReadCurrentMetadata(const std::string& block_device)
 }
 
 bool CreateLogicalPartitions(const LpMetadata& metadata, const std::string& super_device) {
-    CreateLogicalPartitionParams params = {
-            .block_device = super_device,
-            .metadata = &metadata,
-    };
+    // Build every table up front so that all devices can be created and
+    // waited for as a single batch.
+    std::vector<std::string> names;
+    std::vector<DmTable> tables;
     for (const auto& partition : metadata.partitions) {
         if (!partition.num_extents) {
             LINFO << "Skipping zero-length logical partition: " << GetPartitionName(partition);
@@ -166,13 +222,34 @@ bool CreateLogicalPartitions(const LpMetadata& metadata, const std::string& supe
             continue;
         }
 
-        params.partition = &partition;
-
-        std::string ignore_path;
-        if (!CreateLogicalPartition(params, &ignore_path)) {
+        CreateLogicalPartitionParams params = {
+                .block_device = super_device,
+                .metadata = &metadata,
+                .partition = &partition,
+        };
+        CreateLogicalPartitionParams::OwnedData owned_data;
+        DmTable table;
+        if (!params.InitDefaults(&owned_data) || !CreateDmTableInternal(params, &table)) {
             LERROR << "Could not create logical partition: " << GetPartitionName(partition);
             return false;
         }
+        names.emplace_back(params.device_name);
+        tables.emplace_back(std::move(table));
+    }
+
+    std::vector<DeviceMapper::CreateDeviceRequest> requests;
+    for (size_t i = 0; i < names.size(); i++) {
+        requests.push_back({.name = names[i], .table = &tables[i]});
+    }
+
+    std::vector<std::string> paths;
+    DeviceMapper& dm = DeviceMapper::Instance();
+    if (!dm.CreateDevices(requests, &paths, {})) {
+        LERROR << "Could not create logical partitions on " << super_device;
+        return false;
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+        LINFO << "Created logical partition " << names[i] << " on device " << paths[i];
     }
     return true;
 }
@@ -24,6 +24,7 @@
 #include <cutils/partition_utils.h>
 #include <sys/mount.h>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/properties.h>
 #include <android-base/unique_fd.h>
 #include <ext4_utils/ext4.h>
@@ -35,6 +36,7 @@
 
 #include "fs_mgr_priv.h"
 
+using android::base::Timer;
 using android::base::unique_fd;
 
 // Realistically, this file should be part of the android::fs_mgr namespace;
@@ -56,8 +58,55 @@ static int get_dev_sz(const std::string& fs_blkdev, uint64_t* dev_sz) {
     return 0;
 }
 
+// How the device was prepared before the mkfs tools run.
+struct FormatPolicy {
+    // The tools must not discard the device themselves.
+    bool no_discard = false;
+    // The device reads back as zeroes, so the tools don't need to zero anything.
+    bool zeroed = false;
+};
+
+// Discards the first |dev_sz| bytes of the device in a single request, rather
+// than leaving it to the mkfs tools, which issue it in smaller pieces.
+static FormatPolicy prepare_device(const std::string& fs_blkdev, uint64_t dev_sz, bool no_trim) {
+    FormatPolicy policy;
+    if (no_trim) {
+        // The device asked not to be discarded at all.
+        policy.no_discard = true;
+        return policy;
+    }
+
+    unique_fd fd(TEMP_FAILURE_RETRY(open(fs_blkdev.c_str(), O_RDWR | O_CLOEXEC)));
+    if (fd < 0) {
+        PWARNING << "Cannot open " << fs_blkdev << " for discard";
+        return policy;
+    }
+
+    unsigned int discard_zeroes = 0;
+    if (ioctl(fd, BLKDISCARDZEROES, &discard_zeroes) == -1) {
+        discard_zeroes = 0;
+    }
+
+    Timer t;
+    uint64_t range[2] = {0, dev_sz};
+    if (ioctl(fd, BLKDISCARD, &range) == -1) {
+        if (errno == EOPNOTSUPP) {
+            // The tools would fail the same way.
+            policy.no_discard = true;
+        } else {
+            PWARNING << "BLKDISCARD failed on " << fs_blkdev;
+        }
+        return policy;
+    }
+    LINFO << "Discarded " << fs_blkdev << " in " << t.duration().count() << "ms";
+
+    policy.no_discard = true;
+    policy.zeroed = discard_zeroes != 0;
+    return policy;
+}
+
 static int format_ext4(const std::string& fs_blkdev, const std::string& fs_mnt_point,
-                       bool needs_projid, bool needs_metadata_csum) {
+                       bool needs_projid, bool needs_metadata_csum, bool no_trim) {
     uint64_t dev_sz;
     int rc = 0;
 
@@ -66,6 +115,8 @@ static int format_ext4(const std::string& fs_blkdev, const std::string& fs_mnt_p
         return rc;
     }
 
+    FormatPolicy policy = prepare_device(fs_blkdev, dev_sz, no_trim);
+
     /* Format the partition using the calculated length */
 
     std::string size_str = std::to_string(dev_sz / 4096);
@@ -94,6 +145,18 @@ static int format_ext4(const std::string& fs_blkdev, const std::string& fs_mnt_p
         mke2fs_args.push_back("extent");
     }
 
+    // Inode tables are zeroed by the kernel in the background after the first mount; the
+    // journal only needs zeroing if the device doesn't read back as zeroes already.
+    std::string extended_opts = "lazy_itable_init=1";
+    if (policy.zeroed) {
+        extended_opts += ",lazy_journal_init=1";
+    }
+    if (policy.no_discard) {
+        extended_opts += ",nodiscard";
+    }
+    mke2fs_args.push_back("-E");
+    mke2fs_args.push_back(extended_opts.c_str());
+
     mke2fs_args.push_back(fs_blkdev.c_str());
     mke2fs_args.push_back(size_str.c_str());
 
@@ -117,7 +180,8 @@ static int format_ext4(const std::string& fs_blkdev, const std::string& fs_mnt_p
 }
 
 static int format_f2fs(const std::string& fs_blkdev, uint64_t dev_sz, bool needs_projid,
-                       bool needs_casefold, bool fs_compress, const std::string& zoned_device) {
+                       bool needs_casefold, bool fs_compress, const std::string& zoned_device,
+                       bool no_trim) {
     if (!dev_sz) {
         int rc = get_dev_sz(fs_blkdev, &dev_sz);
         if (rc) {
@@ -125,6 +189,12 @@ static int format_f2fs(const std::string& fs_blkdev, uint64_t dev_sz, bool needs
         }
     }
 
+    // Zoned devices are reset by make_f2fs itself.
+    FormatPolicy policy;
+    if (zoned_device.empty()) {
+        policy = prepare_device(fs_blkdev, dev_sz, no_trim);
+    }
+
     /* Format the partition using the calculated length */
 
     std::string size_str = std::to_string(dev_sz / 4096);
@@ -146,6 +216,10 @@ static int format_f2fs(const std::string& fs_blkdev, uint64_t dev_sz, bool needs
         args.push_back("-O");
         args.push_back("extra_attr");
     }
+    if (policy.no_discard) {
+        args.push_back("-t");
+        args.push_back("0");
+    }
     if (!zoned_device.empty()) {
         args.push_back("-c");
         args.push_back(zoned_device.c_str());
@@ -169,14 +243,20 @@ int fs_mgr_do_format(const FstabEntry& entry) {
         needs_casefold = android::base::GetBoolProperty("external_storage.casefold.enabled", false);
     }
 
+    Timer t;
+    int rc;
     if (entry.fs_type == "f2fs") {
-        return format_f2fs(entry.blk_device, entry.length, needs_projid, needs_casefold,
-                           entry.fs_mgr_flags.fs_compress, entry.zoned_device);
+        rc = format_f2fs(entry.blk_device, entry.length, needs_projid, needs_casefold,
+                         entry.fs_mgr_flags.fs_compress, entry.zoned_device,
+                         entry.fs_mgr_flags.no_trim);
     } else if (entry.fs_type == "ext4") {
-        return format_ext4(entry.blk_device, entry.mount_point, needs_projid,
-                           entry.fs_mgr_flags.ext_meta_csum);
+        rc = format_ext4(entry.blk_device, entry.mount_point, needs_projid,
+                         entry.fs_mgr_flags.ext_meta_csum, entry.fs_mgr_flags.no_trim);
     } else {
         LERROR << "File system type '" << entry.fs_type << "' is not supported";
         return -EINVAL;
     }
+    LINFO << __FUNCTION__ << ": Format of " << entry.blk_device << " took " << t.duration().count()
+          << "ms, rc=" << rc;
+    return rc;
 }
@@ -52,6 +52,11 @@ namespace {
 
 constexpr char kDefaultAndroidDtDir[] = "/proc/device-tree/firmware/android";
 
+// Parsed fstabs, see WriteFstabCache(). /dev is a tmpfs that first stage init
+// mounts and hands over to second stage init, so the cache lasts exactly one
+// boot.
+constexpr char kFstabCachePath[] = "/dev/fstab.cache";
+
 struct FlagList {
     const char *name;
     uint64_t flag;
@@ -508,6 +513,12 @@ std::vector<FstabPtrEntryType*> GetEntriesByPred(FstabPtr fstab, const Pred& pre
     return entries;
 }
 
+// Only init populates the fstab cache. It parses every fstab first, in both
+// stages, and everything else only reads what it left behind.
+bool ShouldWriteFstabCache() {
+    return getpid() == 1;
+}
+
 }  // namespace
 
 // Return the path to the fstab file.  There may be multiple fstab files; the
@@ -701,16 +712,24 @@ void EnableMandatoryFlags(Fstab* fstab) {
 bool ReadFstabFromFile(const std::string& path, Fstab* fstab_out) {
     const bool is_proc_mounts = (path == "/proc/mounts");
 
-    std::string fstab_str;
-    if (!android::base::ReadFileToString(path, &fstab_str, /* follow_symlinks = */ true)) {
-        PERROR << __FUNCTION__ << "(): failed to read file: '" << path << "'";
-        return false;
-    }
+    // /proc/mounts changes all the time, so it is never cached.
+    std::string cache_key = is_proc_mounts ? "" : GetFstabCacheKey(path);
 
     Fstab fstab;
-    if (!ParseFstabFromString(fstab_str, is_proc_mounts, &fstab)) {
-        LERROR << __FUNCTION__ << "(): failed to load fstab from : '" << path << "'";
-        return false;
+    if (!ReadFstabCache(kFstabCachePath, cache_key, &fstab)) {
+        std::string fstab_str;
+        if (!android::base::ReadFileToString(path, &fstab_str, /* follow_symlinks = */ true)) {
+            PERROR << __FUNCTION__ << "(): failed to read file: '" << path << "'";
+            return false;
+        }
+
+        if (!ParseFstabFromString(fstab_str, is_proc_mounts, &fstab)) {
+            LERROR << __FUNCTION__ << "(): failed to load fstab from : '" << path << "'";
+            return false;
+        }
+        if (ShouldWriteFstabCache()) {
+            WriteFstabCache(kFstabCachePath, cache_key, fstab);
+        }
     }
     if (!is_proc_mounts) {
         if (!access(android::gsi::kGsiBootedIndicatorFile, F_OK)) {
@@ -740,18 +759,25 @@ bool ReadFstabFromFile(const std::string& path, Fstab* fstab_out) {
 
 // Returns fstab entries parsed from the device tree if they exist
 bool ReadFstabFromDt(Fstab* fstab, bool verbose) {
-    std::string fstab_buf = ReadFstabFromDt();
-    if (fstab_buf.empty()) {
-        if (verbose) LINFO << __FUNCTION__ << "(): failed to read fstab from dt";
-        return false;
-    }
+    // The device tree cannot change during a boot, and the cache does not outlive one.
+    std::string cache_key = "dt:" + get_android_dt_dir();
+    if (!ReadFstabCache(kFstabCachePath, cache_key, fstab)) {
+        std::string fstab_buf = ReadFstabFromDt();
+        if (fstab_buf.empty()) {
+            if (verbose) LINFO << __FUNCTION__ << "(): failed to read fstab from dt";
+            return false;
+        }
 
-    if (!ParseFstabFromString(fstab_buf, /* proc_mounts = */ false, fstab)) {
-        if (verbose) {
-            LERROR << __FUNCTION__ << "(): failed to load fstab from kernel:" << std::endl
-                   << fstab_buf;
+        if (!ParseFstabFromString(fstab_buf, /* proc_mounts = */ false, fstab)) {
+            if (verbose) {
+                LERROR << __FUNCTION__ << "(): failed to load fstab from kernel:" << std::endl
+                       << fstab_buf;
+            }
+            return false;
+        }
+        if (ShouldWriteFstabCache()) {
+            WriteFstabCache(kFstabCachePath, cache_key, *fstab);
         }
-        return false;
     }
 
     SkipMountingPartitions(fstab, verbose);
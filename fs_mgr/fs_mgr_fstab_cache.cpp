@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+
+#include "fs_mgr_priv.h"
+
+using android::base::StringPrintf;
+using android::base::unique_fd;
+
+namespace android {
+namespace fs_mgr {
+namespace {
+
+// The cache is a header followed by one section per cached source:
+//
+//   u32 magic, u32 version, u32 sizeof(FstabEntry), u32 number of sections,
+//   u64 size of the whole cache
+//   section: string key, u64 payload size, payload
+//   payload: u32 number of entries, entries
+//
+// Strings are a u32 length followed by the bytes. The cache can be written by
+// one build of libfstab (first stage init) and read by another (vold), so
+// kFstabCacheVersion must be bumped whenever FstabEntry or the encoding below
+// changes. The size of FstabEntry is only a safety net for a forgotten bump.
+constexpr uint32_t kFstabCacheMagic = 0x46535443;  // "FSTC"
+constexpr uint32_t kFstabCacheVersion = 1;
+constexpr size_t kFstabCacheHeaderSize = 4 * sizeof(uint32_t) + sizeof(uint64_t);
+
+class CacheWriter {
+  public:
+    void PutU32(uint32_t value) { Put(&value, sizeof(value)); }
+    void PutU64(uint64_t value) { Put(&value, sizeof(value)); }
+    void PutString(const std::string& value) {
+        PutU32(static_cast<uint32_t>(value.size()));
+        Put(value.data(), value.size());
+    }
+    void Put(const void* data, size_t size) {
+        buffer_.append(reinterpret_cast<const char*>(data), size);
+    }
+    std::string& buffer() { return buffer_; }
+
+  private:
+    std::string buffer_;
+};
+
+// Reads from a mapped cache. Every read is bounds checked, and a failed read
+// leaves the reader failed, so callers only need to check ok() at the end.
+class CacheReader {
+  public:
+    CacheReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+    uint32_t GetU32() {
+        uint32_t value = 0;
+        Get(&value, sizeof(value));
+        return value;
+    }
+    uint64_t GetU64() {
+        uint64_t value = 0;
+        Get(&value, sizeof(value));
+        return value;
+    }
+    std::string_view GetBytes(uint64_t size) {
+        if (!ok_ || size > size_ - pos_) {
+            ok_ = false;
+            return {};
+        }
+        std::string_view bytes(data_ + pos_, size);
+        pos_ += size;
+        return bytes;
+    }
+    std::string GetString() { return std::string(GetBytes(GetU32())); }
+    void Get(void* out, size_t size) {
+        auto bytes = GetBytes(size);
+        if (ok_) memcpy(out, bytes.data(), size);
+    }
+    bool ok() const { return ok_; }
+    bool done() const { return pos_ == size_; }
+
+  private:
+    const char* data_;
+    size_t size_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+void PutEntry(CacheWriter* writer, const FstabEntry& entry) {
+    for (const auto* str :
+         {&entry.blk_device, &entry.zoned_device, &entry.logical_partition_name,
+          &entry.mount_point, &entry.fs_type, &entry.fs_options, &entry.fs_checkpoint_opts,
+          &entry.metadata_key_dir, &entry.metadata_encryption_options, &entry.label,
+          &entry.encryption_options, &entry.sysfs_path, &entry.vbmeta_partition, &entry.avb_keys,
+          &entry.lowerdir}) {
+        writer->PutString(*str);
+    }
+    writer->PutU64(entry.flags);
+    writer->PutU64(static_cast<uint64_t>(entry.length));
+    writer->PutU32(static_cast<uint32_t>(entry.partnum));
+    writer->PutU32(static_cast<uint32_t>(entry.swap_prio));
+    writer->PutU32(static_cast<uint32_t>(entry.max_comp_streams));
+    writer->PutU64(static_cast<uint64_t>(entry.zram_size));
+    writer->PutU64(static_cast<uint64_t>(entry.reserved_size));
+    writer->PutU64(static_cast<uint64_t>(entry.readahead_size_kb));
+    writer->PutU64(static_cast<uint64_t>(entry.erase_blk_size));
+    writer->PutU64(static_cast<uint64_t>(entry.logical_blk_size));
+    writer->PutU64(entry.zram_backingdev_size);
+    writer->Put(&entry.fs_mgr_flags, sizeof(entry.fs_mgr_flags));
+}
+
+FstabEntry GetEntry(CacheReader* reader) {
+    FstabEntry entry;
+    for (auto* str :
+         {&entry.blk_device, &entry.zoned_device, &entry.logical_partition_name,
+          &entry.mount_point, &entry.fs_type, &entry.fs_options, &entry.fs_checkpoint_opts,
+          &entry.metadata_key_dir, &entry.metadata_encryption_options, &entry.label,
+          &entry.encryption_options, &entry.sysfs_path, &entry.vbmeta_partition, &entry.avb_keys,
+          &entry.lowerdir}) {
+        *str = reader->GetString();
+    }
+    entry.flags = reader->GetU64();
+    entry.length = static_cast<off64_t>(reader->GetU64());
+    entry.partnum = static_cast<int>(reader->GetU32());
+    entry.swap_prio = static_cast<int>(reader->GetU32());
+    entry.max_comp_streams = static_cast<int>(reader->GetU32());
+    entry.zram_size = static_cast<off64_t>(reader->GetU64());
+    entry.reserved_size = static_cast<off64_t>(reader->GetU64());
+    entry.readahead_size_kb = static_cast<off64_t>(reader->GetU64());
+    entry.erase_blk_size = static_cast<off64_t>(reader->GetU64());
+    entry.logical_blk_size = static_cast<off64_t>(reader->GetU64());
+    entry.zram_backingdev_size = reader->GetU64();
+    reader->Get(&entry.fs_mgr_flags, sizeof(entry.fs_mgr_flags));
+    return entry;
+}
+
+class MappedCache {
+  public:
+    ~MappedCache() {
+        if (data_ != MAP_FAILED) munmap(data_, size_);
+    }
+
+    // Returns false if the cache is missing or was written by an incompatible
+    // libfstab. Neither is an error, so nothing is logged.
+    bool Map(const std::string& path) {
+        unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd.get(), &st) || st.st_size < static_cast<off_t>(kFstabCacheHeaderSize)) {
+            return false;
+        }
+        size_ = st.st_size;
+        data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+        if (data_ == MAP_FAILED) return false;
+
+        CacheReader header(static_cast<const char*>(data_), kFstabCacheHeaderSize);
+        if (header.GetU32() != kFstabCacheMagic || header.GetU32() != kFstabCacheVersion ||
+            header.GetU32() != sizeof(FstabEntry)) {
+            return false;
+        }
+        num_sections_ = header.GetU32();
+        return true;
+    }
+
+    // Calls |fn| with the key and payload of each section, until it returns
+    // false. Returns false if the cache is corrupt.
+    template <typename Fn>
+    bool ForEachSection(Fn&& fn) const {
+        CacheReader reader(static_cast<const char*>(data_), size_);
+        reader.GetBytes(kFstabCacheHeaderSize - sizeof(uint64_t));
+        // Catch truncation up front, since |fn| usually stops early.
+        if (reader.GetU64() != size_) {
+            return false;
+        }
+        for (uint32_t i = 0; i < num_sections_ && reader.ok(); i++) {
+            std::string key = reader.GetString();
+            std::string_view payload = reader.GetBytes(reader.GetU64());
+            if (reader.ok() && !fn(std::move(key), payload)) return true;
+        }
+        return reader.ok() && reader.done();
+    }
+
+  private:
+    void* data_ = MAP_FAILED;
+    size_t size_ = 0;
+    uint32_t num_sections_ = 0;
+};
+
+}  // namespace
+
+// The key changes whenever the file is replaced or rewritten. Files are only
+// cached by init, and the fstab files it reads live on read-only partitions or
+// the ramdisk, so coarse timestamps are not a concern in practice.
+std::string GetFstabCacheKey(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st)) {
+        return {};
+    }
+    return StringPrintf("%s:%llu:%llu:%lld:%lld.%09ld:%lld.%09ld", path.c_str(),
+                        static_cast<unsigned long long>(st.st_dev),
+                        static_cast<unsigned long long>(st.st_ino),
+                        static_cast<long long>(st.st_size),
+                        static_cast<long long>(st.st_mtim.tv_sec), st.st_mtim.tv_nsec,
+                        static_cast<long long>(st.st_ctim.tv_sec), st.st_ctim.tv_nsec);
+}
+
+bool ReadFstabCache(const std::string& cache_path, const std::string& key, Fstab* fstab) {
+    MappedCache cache;
+    if (key.empty() || !cache.Map(cache_path)) {
+        return false;
+    }
+
+    bool found = false;
+    bool corrupt = false;
+    bool ok = cache.ForEachSection([&](std::string section_key, std::string_view payload) -> bool {
+        if (section_key != key) return true;
+
+        CacheReader reader(payload.data(), payload.size());
+        uint32_t num_entries = reader.GetU32();
+        Fstab entries;
+        for (uint32_t i = 0; i < num_entries && reader.ok(); i++) {
+            entries.emplace_back(GetEntry(&reader));
+        }
+        if (reader.ok() && reader.done()) {
+            *fstab = std::move(entries);
+            found = true;
+        } else {
+            corrupt = true;
+        }
+        return false;
+    });
+    if (!ok || corrupt) {
+        LWARNING << "Ignoring corrupt fstab cache: " << cache_path;
+        return false;
+    }
+    return found;
+}
+
+bool WriteFstabCache(const std::string& cache_path, const std::string& key, const Fstab& fstab) {
+    if (key.empty()) {
+        return false;
+    }
+
+    // Keep every other section, so that each source read by init ends up in
+    // the cache, then replace the file atomically so readers never observe a
+    // partial write.
+    std::vector<std::pair<std::string, std::string>> sections;
+    MappedCache old_cache;
+    if (old_cache.Map(cache_path)) {
+        old_cache.ForEachSection([&](std::string section_key, std::string_view payload) -> bool {
+            if (section_key != key) sections.emplace_back(std::move(section_key), payload);
+            return true;
+        });
+    }
+
+    CacheWriter payload;
+    payload.PutU32(static_cast<uint32_t>(fstab.size()));
+    for (const auto& entry : fstab) {
+        PutEntry(&payload, entry);
+    }
+    sections.emplace_back(key, std::move(payload.buffer()));
+
+    CacheWriter writer;
+    writer.PutU32(kFstabCacheMagic);
+    writer.PutU32(kFstabCacheVersion);
+    writer.PutU32(sizeof(FstabEntry));
+    writer.PutU32(static_cast<uint32_t>(sections.size()));
+    writer.PutU64(0);
+    for (const auto& [section_key, section_payload] : sections) {
+        writer.PutString(section_key);
+        writer.PutU64(section_payload.size());
+        writer.Put(section_payload.data(), section_payload.size());
+    }
+    uint64_t size = writer.buffer().size();
+    writer.buffer().replace(kFstabCacheHeaderSize - sizeof(size), sizeof(size),
+                            reinterpret_cast<const char*>(&size), sizeof(size));
+
+    std::string temp_path = StringPrintf("%s.%d.tmp", cache_path.c_str(), getpid());
+    if (!android::base::WriteStringToFile(writer.buffer(), temp_path, 0644, getuid(), getgid())) {
+        PWARNING << "Could not write fstab cache: " << temp_path;
+        unlink(temp_path.c_str());
+        return false;
+    }
+    if (rename(temp_path.c_str(), cache_path.c_str())) {
+        PWARNING << "Could not rename " << temp_path << " to " << cache_path;
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+}  // namespace fs_mgr
+}  // namespace android
@@ -35,6 +35,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -78,6 +79,25 @@ bool fs_mgr_access(const std::string& path) {
 const auto kLowerdirOption = "lowerdir="s;
 const auto kUpperdirOption = "upperdir="s;
 
+// Same as fs_mgr_overlayfs_already_mounted(), for callers that check a number
+// of mount points against one read of /proc/mounts.
+bool fs_mgr_overlayfs_mounted_in(const Fstab& mounts, const std::string& mount_point,
+                                 bool overlay_only = true) {
+    const auto lowerdir = kLowerdirOption + mount_point;
+    for (const auto& entry : mounts) {
+        if (overlay_only && "overlay" != entry.fs_type && "overlayfs" != entry.fs_type) continue;
+        if (mount_point != entry.mount_point) continue;
+        if (!overlay_only) return true;
+        const auto options = android::base::Split(entry.fs_options, ",");
+        for (const auto& opt : options) {
+            if (opt == lowerdir) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 bool fs_mgr_in_recovery() {
     // Check the existence of recovery binary instead of using the compile time
     // __ANDROID_RECOVERY__ macro.
@@ -408,11 +428,9 @@ std::string fs_mgr_overlayfs_setup_dir(const std::string& dir) {
     return top;
 }
 
+// The fscreate context is per thread, so overlays can be set up concurrently.
 bool fs_mgr_overlayfs_setup_one(const std::string& overlay, const std::string& mount_point,
                                 bool* want_reboot) {
-    if (fs_mgr_overlayfs_already_mounted(mount_point)) {
-        return true;
-    }
     auto fsrec_mount_point = overlay + "/" + android::base::Basename(mount_point) + "/";
 
     AutoSetFsCreateCon createcon(kOverlayfsFileContext);
@@ -1289,7 +1307,7 @@ Fstab fs_mgr_overlayfs_candidate_list(const Fstab& fstab) {
         }
 
         FstabEntry new_entry = entry;
-        if (!fs_mgr_overlayfs_already_mounted(entry.mount_point) &&
+        if (!fs_mgr_overlayfs_mounted_in(mounts, entry.mount_point) &&
             !fs_mgr_wants_overlayfs(&new_entry)) {
             continue;
         }
@@ -1340,12 +1358,17 @@ bool fs_mgr_overlayfs_mount_all(Fstab* fstab) {
     if (!OverlayfsSetupAllowed()) {
         return false;
     }
+    Fstab mounts;
+    if (!ReadFstabFromFile("/proc/mounts", &mounts)) {
+        PLOG(ERROR) << "Failed to read /proc/mounts";
+        return false;
+    }
     auto ret = true;
     auto scratch_can_be_mounted = true;
     for (const auto& entry : fs_mgr_overlayfs_candidate_list(*fstab)) {
         if (fs_mgr_is_verity_enabled(entry)) continue;
         auto mount_point = fs_mgr_mount_point(entry.mount_point);
-        if (fs_mgr_overlayfs_already_mounted(mount_point)) {
+        if (fs_mgr_overlayfs_mounted_in(mounts, mount_point)) {
             continue;
         }
         if (scratch_can_be_mounted) {
@@ -1416,10 +1439,40 @@ bool fs_mgr_overlayfs_setup(const Fstab& fstab, const char* mount_point, bool* w
         return false;
     }
 
-    bool ok = true;
+    Fstab mounts;
+    if (!ReadFstabFromFile("/proc/mounts", &mounts)) {
+        PLOG(ERROR) << "Failed to read /proc/mounts";
+        return false;
+    }
+    std::vector<std::string> mount_points;
     for (const auto& entry : candidates) {
         auto fstab_mount_point = fs_mgr_mount_point(entry.mount_point);
-        ok &= fs_mgr_overlayfs_setup_one(overlay, fstab_mount_point, want_reboot);
+        if (!fs_mgr_overlayfs_mounted_in(mounts, fstab_mount_point)) {
+            mount_points.emplace_back(std::move(fstab_mount_point));
+        }
+    }
+
+    // Each overlay's directories are created and labelled on their own
+    // thread; on devices with many partitions, doing them one at a time
+    // dominates the time taken by "adb remount".
+    std::vector<char> results(mount_points.size());
+    std::vector<char> reboots(mount_points.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < mount_points.size(); i++) {
+        threads.emplace_back([&, i]() -> void {
+            bool reboot = false;
+            results[i] = fs_mgr_overlayfs_setup_one(overlay, mount_points[i], &reboot);
+            reboots[i] = reboot;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < mount_points.size(); i++) {
+        ok &= results[i];
+        if (want_reboot && reboots[i]) *want_reboot = true;
     }
     return ok;
 }
@@ -1718,17 +1771,5 @@ bool fs_mgr_overlayfs_already_mounted(const std::string& mount_point, bool overl
     if (!ReadFstabFromFile("/proc/mounts", &fstab)) {
         return false;
     }
-    const auto lowerdir = kLowerdirOption + mount_point;
-    for (const auto& entry : fstab) {
-        if (overlay_only && "overlay" != entry.fs_type && "overlayfs" != entry.fs_type) continue;
-        if (mount_point != entry.mount_point) continue;
-        if (!overlay_only) return true;
-        const auto options = android::base::Split(entry.fs_options, ",");
-        for (const auto& opt : options) {
-            if (opt == lowerdir) {
-                return true;
-            }
-        }
-    }
-    return false;
+    return fs_mgr_overlayfs_mounted_in(fstab, mount_point, overlay_only);
 }
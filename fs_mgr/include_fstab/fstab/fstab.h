@@ -29,6 +29,7 @@ std::string fs_mgr_get_other_slot_suffix();
 namespace android {
 namespace fs_mgr {
 
+// Bump kFstabCacheVersion in fs_mgr_fstab_cache.cpp when changing this struct.
 struct FstabEntry {
     std::string blk_device;
     std::string zoned_device;
@@ -101,6 +102,13 @@ std::string GetFstabPath();
 // Exported for testability.
 bool SkipMountWithConfig(const std::string& skip_config, Fstab* fstab, bool verbose);
 
+// Exported for testability. Regular users get the cache through ReadFstabFromFile() and
+// ReadFstabFromDt(). The key of a file is empty if it cannot be stat'ed, and an empty key is
+// never cached.
+std::string GetFstabCacheKey(const std::string& path);
+bool ReadFstabCache(const std::string& cache_path, const std::string& key, Fstab* fstab);
+bool WriteFstabCache(const std::string& cache_path, const std::string& key, const Fstab& fstab);
+
 bool ReadFstabFromFile(const std::string& path, Fstab* fstab);
 bool ReadFstabFromDt(Fstab* fstab, bool verbose = true);
 bool ReadDefaultFstab(Fstab* fstab);
@@ -58,7 +58,7 @@ DeviceMapper& DeviceMapper::Instance() {
 }
 
 // Creates a new device mapper device
-bool DeviceMapper::CreateDevice(const std::string& name, const std::string& uuid) {
+bool DeviceMapper::CreateDevice(const std::string& name, const std::string& uuid, dev_t* dev) {
     if (name.empty()) {
         LOG(ERROR) << "Unnamed device mapper device creation is not supported";
         return false;
@@ -84,6 +84,10 @@ bool DeviceMapper::CreateDevice(const std::string& name, const std::string& uuid
     CHECK(io.target_count == 0) << "Unexpected targets for newly created [" << name << "] device";
     CHECK(io.open_count == 0) << "Unexpected opens for newly created [" << name << "] device";
 
+    if (dev) {
+        *dev = io.dev;
+    }
+
     // Creates a new device mapper device with the name passed in
     return true;
 }
@@ -171,6 +175,21 @@ static bool IsRecovery() {
     return access("/system/bin/recovery", F_OK) == 0;
 }
 
+// Old non-A/B recovery images ship a ueventd that does not create the
+// by-uuid links, so the dm-N node is the only thing we can wait on.
+static bool UseLegacyDevicePaths() {
+    if (!IsRecovery()) {
+        return false;
+    }
+    bool non_ab_device = android::base::GetProperty("ro.build.ab_update", "").empty();
+    int sdk = android::base::GetIntProperty("ro.build.version.sdk", 0);
+    if (non_ab_device && sdk && sdk <= 29) {
+        LOG(INFO) << "Detected ueventd incompatibility, reverting to legacy libdm behavior.";
+        return true;
+    }
+    return false;
+}
+
 bool DeviceMapper::CreateEmptyDevice(const std::string& name) {
     std::string uuid = GenerateUuid();
     return CreateDevice(name, uuid);
@@ -191,13 +210,8 @@ bool DeviceMapper::WaitForDevice(const std::string& name,
         return true;
     }
 
-    if (IsRecovery()) {
-        bool non_ab_device = android::base::GetProperty("ro.build.ab_update", "").empty();
-        int sdk = android::base::GetIntProperty("ro.build.version.sdk", 0);
-        if (non_ab_device && sdk && sdk <= 29) {
-            LOG(INFO) << "Detected ueventd incompatibility, reverting to legacy libdm behavior.";
-            unique_path = *path;
-        }
+    if (UseLegacyDevicePaths()) {
+        unique_path = *path;
     }
 
     if (!WaitForFile(unique_path, timeout_ms)) {
@@ -227,6 +241,50 @@ bool DeviceMapper::CreateDevice(const std::string& name, const DmTable& table, s
     return true;
 }
 
+bool DeviceMapper::CreateDevices(const std::vector<CreateDeviceRequest>& devices,
+                                 std::vector<std::string>* paths,
+                                 const std::chrono::milliseconds& timeout_ms) {
+    std::vector<std::string> created;
+    auto cleanup = [&]() -> bool {
+        for (const auto& name : created) {
+            DeleteDevice(name);
+        }
+        return false;
+    };
+
+    // The device number is returned by DM_DEV_CREATE and the uuid is ours,
+    // so neither path needs a DM_DEV_STATUS round trip.
+    std::vector<std::string> dm_paths;
+    std::vector<std::string> wait_paths;
+    for (const auto& request : devices) {
+        std::string uuid = GenerateUuid();
+        dev_t dev;
+        if (!CreateDevice(request.name, uuid, &dev)) {
+            return cleanup();
+        }
+        created.emplace_back(request.name);
+
+        if (!LoadTableAndActivate(request.name, *request.table)) {
+            return cleanup();
+        }
+        dm_paths.emplace_back("/dev/block/dm-" + std::to_string(minor(dev)));
+        wait_paths.emplace_back("/dev/block/mapper/by-uuid/" + uuid);
+    }
+
+    if (timeout_ms > std::chrono::milliseconds::zero()) {
+        if (UseLegacyDevicePaths()) {
+            wait_paths = dm_paths;
+        }
+        if (!WaitForFiles(wait_paths, timeout_ms)) {
+            LOG(ERROR) << "Failed waiting for " << devices.size() << " device paths";
+            return cleanup();
+        }
+    }
+
+    *paths = std::move(dm_paths);
+    return true;
+}
+
 bool DeviceMapper::GetDeviceUniquePath(const std::string& name, std::string* path) {
     struct dm_ioctl io;
     InitIo(&io, name);
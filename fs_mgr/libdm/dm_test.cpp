@@ -18,11 +18,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <chrono>
 #include <ctime>
 #include <iostream>
@@ -586,6 +588,75 @@ TEST_F(DmTest, DeleteDeviceWithTimeout) {
     ASSERT_EQ(ENOENT, errno);
 }
 
+TEST_F(DmTest, CreateDevices) {
+    unique_fd tmp(CreateTempFile("file_1", 4096));
+    ASSERT_GE(tmp, 0);
+    LoopDevice loop(tmp, 10s);
+    ASSERT_TRUE(loop.valid());
+
+    DmTable table_a;
+    ASSERT_TRUE(table_a.Emplace<DmTargetLinear>(0, 1, loop.device(), 0));
+    DmTable table_b;
+    ASSERT_TRUE(table_b.Emplace<DmTargetLinear>(0, 1, loop.device(), 1));
+
+    DeviceMapper& dm = DeviceMapper::Instance();
+    std::vector<DeviceMapper::CreateDeviceRequest> requests = {
+            {.name = "libdm-test-dm-batch-a", .table = &table_a},
+            {.name = "libdm-test-dm-batch-b", .table = &table_b},
+    };
+    std::vector<std::string> paths;
+    ASSERT_TRUE(dm.CreateDevices(requests, &paths, 5s));
+    auto cleanup = make_scope_guard([&]() {
+        dm.DeleteDeviceIfExists("libdm-test-dm-batch-a", 5s);
+        dm.DeleteDeviceIfExists("libdm-test-dm-batch-b", 5s);
+    });
+
+    ASSERT_EQ(paths.size(), 2);
+    for (size_t i = 0; i < requests.size(); i++) {
+        std::string path;
+        ASSERT_TRUE(dm.GetDmDevicePathByName(requests[i].name, &path));
+        EXPECT_EQ(paths[i], path);
+        EXPECT_EQ(0, access(path.c_str(), F_OK));
+        EXPECT_EQ(DmDeviceState::ACTIVE, dm.GetState(requests[i].name));
+    }
+}
+
+TEST(FileNotifierTest, ConcurrentWaiters) {
+    TemporaryDir dir;
+    std::string subdir = dir.path + "/sub"s;
+
+    // Half of the paths are in a directory that does not exist yet, to cover
+    // the polling fallback.
+    std::vector<std::string> paths;
+    for (int i = 0; i < 8; i++) {
+        paths.emplace_back((i % 2 ? subdir : std::string(dir.path)) + "/node" + std::to_string(i));
+    }
+
+    std::vector<std::thread> waiters;
+    std::atomic<int> found = 0;
+    for (const auto& path : paths) {
+        waiters.emplace_back([&, path]() {
+            if (WaitForFile(path, 10s)) found++;
+        });
+    }
+    waiters.emplace_back([&]() {
+        if (WaitForFiles(paths, 10s)) found++;
+    });
+
+    std::this_thread::sleep_for(50ms);
+    ASSERT_EQ(mkdir(subdir.c_str(), 0755), 0);
+    for (const auto& path : paths) {
+        unique_fd fd(open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644));
+        ASSERT_GE(fd, 0);
+    }
+    for (auto& thread : waiters) {
+        thread.join();
+    }
+    EXPECT_EQ(found, paths.size() + 1);
+
+    EXPECT_FALSE(WaitForFile(dir.path + "/missing"s, 100ms));
+}
+
 TEST_F(DmTest, IsDmBlockDevice) {
     unique_fd tmp(CreateTempFile("file_1", 4096));
     ASSERT_GE(tmp, 0);
@@ -0,0 +1,192 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "file_notifier.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <set>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/macros.h>
+
+#include "utility.h"
+
+namespace android {
+namespace dm {
+
+using namespace std::literals;
+
+// Upper bound on a single sleep, so that a missed event (for example, a link
+// created in a directory nobody is watching) cannot stall a waiter for the
+// whole timeout.
+static constexpr auto kMaxWaitSlice = 100ms;
+
+FileNotifier& FileNotifier::Instance() {
+    static FileNotifier instance;
+    return instance;
+}
+
+// Removes paths from |pending| as they appear. Returns Done once none are
+// left.
+static WaitResult CheckFilesExist(std::vector<std::string>* pending) {
+    for (auto iter = pending->begin(); iter != pending->end();) {
+        if (access(iter->c_str(), F_OK) == 0) {
+            iter = pending->erase(iter);
+            continue;
+        }
+        if (errno != ENOENT) {
+            PLOG(ERROR) << "access failed: " << *iter;
+            return WaitResult::Fail;
+        }
+        iter++;
+    }
+    return pending->empty() ? WaitResult::Done : WaitResult::Wait;
+}
+
+bool FileNotifier::AddWatch(const std::string& dir) {
+    if (auto iter = watches_.find(dir); iter != watches_.end()) {
+        iter->second.refs++;
+        return true;
+    }
+    int wd = inotify_add_watch(inotify_fd_.get(), dir.c_str(), IN_CREATE | IN_MOVED_TO);
+    if (wd < 0) {
+        // ENOENT is expected for directories ueventd creates lazily, such as
+        // /dev/block/mapper/by-uuid.
+        if (errno != ENOENT) {
+            PLOG(ERROR) << "inotify_add_watch failed: " << dir;
+        }
+        return false;
+    }
+    watches_.emplace(dir, Watch{wd, 1});
+    return true;
+}
+
+void FileNotifier::RemoveWatch(const std::string& dir) {
+    auto iter = watches_.find(dir);
+    if (iter == watches_.end() || --iter->second.refs > 0) {
+        return;
+    }
+    // This fails harmlessly if the directory was deleted and the kernel
+    // already dropped the watch.
+    inotify_rm_watch(inotify_fd_.get(), iter->second.wd);
+    watches_.erase(iter);
+}
+
+// Called without |lock_| held, by the single waiter that set |reading_|.
+void FileNotifier::ReadEvents(const std::chrono::milliseconds& timeout_ms) {
+    struct pollfd event = {
+            .fd = inotify_fd_.get(),
+            .events = POLLIN,
+            .revents = 0,
+    };
+    int rv = TEMP_FAILURE_RETRY(poll(&event, 1, static_cast<int>(timeout_ms.count())));
+    if (rv < 0) {
+        PLOG(ERROR) << "poll for inotify failed";
+        return;
+    }
+    if (rv == 0) {
+        return;
+    }
+
+    // The events themselves are not interesting; waiters simply re-check
+    // their paths.
+    static constexpr size_t kBufferSize = sizeof(struct inotify_event) + NAME_MAX + 1;
+    char buffer[kBufferSize];
+    while (TEMP_FAILURE_RETRY(read(inotify_fd_.get(), buffer, sizeof(buffer))) > 0) {
+    }
+}
+
+bool FileNotifier::WaitForFiles(const std::vector<std::string>& paths,
+                                const std::chrono::milliseconds& timeout_ms) {
+    std::vector<std::string> pending = paths;
+    if (auto result = CheckFilesExist(&pending); result != WaitResult::Wait) {
+        return result == WaitResult::Done;
+    }
+
+    std::set<std::string> dirs;
+    for (const auto& path : pending) {
+        dirs.emplace(android::base::Dirname(path));
+    }
+
+    std::unique_lock lock(lock_);
+    if (inotify_fd_ < 0) {
+        inotify_fd_.reset(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+        if (inotify_fd_ < 0) {
+            PLOG(ERROR) << "inotify_init1 failed";
+        }
+    }
+
+    std::vector<std::string> watched;
+    bool watching = inotify_fd_ >= 0;
+    for (auto iter = dirs.begin(); watching && iter != dirs.end(); iter++) {
+        if (AddWatch(*iter)) {
+            watched.emplace_back(*iter);
+        } else {
+            watching = false;
+        }
+    }
+    if (!watching) {
+        for (const auto& dir : watched) {
+            RemoveWatch(dir);
+        }
+        lock.unlock();
+        auto condition = [&]() -> WaitResult { return CheckFilesExist(&pending); };
+        return WaitForCondition(condition, timeout_ms);
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    WaitResult result;
+    while (true) {
+        // Sample the generation before checking, so that a change which
+        // races with the check is not slept through.
+        uint64_t seen = generation_;
+        lock.unlock();
+        result = CheckFilesExist(&pending);
+        lock.lock();
+        if (result != WaitResult::Wait) break;
+
+        auto now = std::chrono::steady_clock::now();
+        auto time_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
+        if (time_elapsed > timeout_ms) break;
+        if (generation_ != seen) continue;
+
+        auto slice = std::min<std::chrono::milliseconds>(timeout_ms - time_elapsed, kMaxWaitSlice);
+        if (!reading_) {
+            reading_ = true;
+            lock.unlock();
+            ReadEvents(slice + 1ms);
+            lock.lock();
+            reading_ = false;
+            generation_++;
+            cv_.notify_all();
+        } else {
+            cv_.wait_for(lock, slice, [&]() -> bool { return generation_ != seen; });
+        }
+    }
+
+    for (const auto& dir : watched) {
+        RemoveWatch(dir);
+    }
+    return result == WaitResult::Done;
+}
+
+}  // namespace dm
+}  // namespace android
@@ -0,0 +1,72 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+
+namespace android {
+namespace dm {
+
+// Process-wide waiter for device nodes to appear. There is a single inotify
+// instance, with one watch per directory shared by every pending waiter, so
+// any number of threads can wait on any number of paths. Whichever waiter
+// finds the inotify idle reads it on behalf of the others and wakes them when
+// something changes; there is no background thread.
+class FileNotifier final {
+  public:
+    static FileNotifier& Instance();
+
+    // Wait until every path in |paths| exists. Returns false on timeout, or
+    // if accessing a path fails with anything other than ENOENT. The parent
+    // directories do not need to exist yet; if they cannot be watched, this
+    // falls back to polling.
+    bool WaitForFiles(const std::vector<std::string>& paths,
+                      const std::chrono::milliseconds& timeout_ms);
+
+  private:
+    struct Watch {
+        int wd;
+        int refs;
+    };
+
+    FileNotifier() = default;
+    FileNotifier(const FileNotifier&) = delete;
+    FileNotifier& operator=(const FileNotifier&) = delete;
+
+    bool AddWatch(const std::string& dir);
+    void RemoveWatch(const std::string& dir);
+    void ReadEvents(const std::chrono::milliseconds& timeout_ms);
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    android::base::unique_fd inotify_fd_;
+    std::map<std::string, Watch> watches_;
+    // True while some waiter is blocked reading |inotify_fd_|.
+    bool reading_ = false;
+    // Bumped every time the reader wakes up, so other waiters re-check.
+    uint64_t generation_ = 0;
+};
+
+}  // namespace dm
+}  // namespace android
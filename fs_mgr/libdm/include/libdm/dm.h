@@ -188,6 +188,21 @@ class DeviceMapper final : public IDeviceMapper {
     bool CreateDevice(const std::string& name, const DmTable& table, std::string* path,
                       const std::chrono::milliseconds& timeout_ms) override;
 
+    struct CreateDeviceRequest {
+        std::string name;
+        const DmTable* table;
+    };
+
+    // Same as the timeout variant of CreateDevice above, but for several
+    // devices at once. All devices are created and activated before waiting,
+    // and the wait covers every device path together, so ueventd can work
+    // through the whole batch while we block. On success, |paths| holds the
+    // dm-N path of each device in request order. On failure, every device
+    // created by this call is deleted.
+    bool CreateDevices(const std::vector<CreateDeviceRequest>& devices,
+                       std::vector<std::string>* paths,
+                       const std::chrono::milliseconds& timeout_ms);
+
     // Create a device and activate the given table, without waiting to acquire
     // a valid path. If the caller will use GetDmDevicePathByName(), it should
     // use the timeout variant above.
@@ -312,7 +327,8 @@ class DeviceMapper final : public IDeviceMapper {
     // limit we are imposing here of 256.
     static constexpr uint32_t kMaxPossibleDmDevices = 256;
 
-    bool CreateDevice(const std::string& name, const std::string& uuid = {});
+    bool CreateDevice(const std::string& name, const std::string& uuid = {},
+                      dev_t* dev = nullptr);
     bool GetTable(const std::string& name, uint32_t flags, std::vector<TargetInfo>* table);
     void InitIo(struct dm_ioctl* io, const std::string& name = std::string()) const;
 
@@ -40,12 +40,22 @@ class LoopControl final {
     bool Attach(int file_fd, const std::chrono::milliseconds& timeout_ms,
                 std::string* loopdev) const;
 
+    // Same as above, but if |direct_io| is true the loop device is also set
+    // up as EnableDirectIo() would. On kernels with LOOP_CONFIGURE (5.8+)
+    // this is done in the same ioctl that attaches the file. If direct I/O
+    // can't be enabled, the loop device is detached again.
+    bool Attach(int file_fd, const std::chrono::milliseconds& timeout_ms, std::string* loopdev,
+                bool direct_io) const;
+
     // Detach the loop device given by 'loopdev' from the attached backing file.
     bool Detach(const std::string& loopdev) const;
 
     // Enable Direct I/O on a loop device. This requires kernel 4.9+.
     static bool EnableDirectIo(int fd);
 
+    // Returns whether Direct I/O is enabled on a loop device.
+    static bool HasDirectIo(int fd);
+
     // Set LO_FLAGS_AUTOCLEAR on a loop device.
     static bool SetAutoClearStatus(int fd);
 
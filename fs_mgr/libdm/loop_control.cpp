@@ -39,8 +39,41 @@ LoopControl::LoopControl() : control_fd_(-1) {
     }
 }
 
+// Note: the block size has to be >= the logical block size of the underlying
+// block device, *not* the filesystem block size.
+static constexpr uint32_t kDirectIoBlockSize = 4096;
+
+// Binds file_fd to the loop device, with direct I/O if requested. Sets
+// *configured if that was done in the same ioctl. Returns false with errno set
+// on failure.
+static bool BindLoopDevice(int loop_fd, int file_fd, bool direct_io, bool* configured) {
+    *configured = false;
+#if defined(LOOP_CONFIGURE)
+    struct loop_config config = {};
+    config.fd = file_fd;
+    if (direct_io) {
+        config.block_size = kDirectIoBlockSize;
+        config.info.lo_flags = LO_FLAGS_DIRECT_IO;
+    }
+    if (ioctl(loop_fd, LOOP_CONFIGURE, &config) == 0) {
+        *configured = true;
+        return true;
+    }
+    // Kernels before 5.8 don't know LOOP_CONFIGURE.
+    if (errno != EINVAL && errno != ENOTTY) {
+        return false;
+    }
+#endif
+    return ioctl(loop_fd, LOOP_SET_FD, file_fd) == 0;
+}
+
 bool LoopControl::Attach(int file_fd, const std::chrono::milliseconds& timeout_ms,
                          std::string* loopdev) const {
+    return Attach(file_fd, timeout_ms, loopdev, false);
+}
+
+bool LoopControl::Attach(int file_fd, const std::chrono::milliseconds& timeout_ms,
+                         std::string* loopdev, bool direct_io) const {
     auto start_time = std::chrono::steady_clock::now();
     auto condition = [&]() -> WaitResult {
         if (!FindFreeLoopDevice(loopdev)) {
@@ -62,14 +95,23 @@ bool LoopControl::Attach(int file_fd, const std::chrono::milliseconds& timeout_m
             return WaitResult::Fail;
         }
 
-        if (int rc = ioctl(loop_fd, LOOP_SET_FD, file_fd); rc == 0) {
-            return WaitResult::Done;
+        bool configured;
+        if (!BindLoopDevice(loop_fd, file_fd, direct_io, &configured)) {
+            if (errno != EBUSY) {
+                PLOG(ERROR) << "Failed to bind " << *loopdev;
+                return WaitResult::Fail;
+            }
+            return WaitResult::Wait;
         }
-        if (errno != EBUSY) {
-            PLOG(ERROR) << "Failed LOOP_SET_FD";
+
+        // LOOP_CONFIGURE quietly falls back to buffered I/O when the backing
+        // file can't do direct I/O, where LOOP_SET_DIRECT_IO fails.
+        if (direct_io && !(configured ? HasDirectIo(loop_fd) : EnableDirectIo(loop_fd))) {
+            LOG(ERROR) << "Could not enable direct IO on " << *loopdev;
+            ioctl(loop_fd, LOOP_CLR_FD, 0);
             return WaitResult::Fail;
         }
-        return WaitResult::Wait;
+        return WaitResult::Done;
     };
     if (!WaitForCondition(condition, timeout_ms)) {
         LOG(ERROR) << "Timed out trying to acquire a loop device";
@@ -120,9 +162,7 @@ bool LoopControl::EnableDirectIo(int fd) {
     static constexpr int LOOP_SET_DIRECT_IO = 0x4C08;
 #endif
 
-    // Note: the block size has to be >= the logical block size of the underlying
-    // block device, *not* the filesystem block size.
-    if (ioctl(fd, LOOP_SET_BLOCK_SIZE, 4096)) {
+    if (ioctl(fd, LOOP_SET_BLOCK_SIZE, kDirectIoBlockSize)) {
         PLOG(ERROR) << "Could not set loop device block size";
         return false;
     }
@@ -133,6 +173,15 @@ bool LoopControl::EnableDirectIo(int fd) {
     return true;
 }
 
+bool LoopControl::HasDirectIo(int fd) {
+    struct loop_info64 info = {};
+    if (ioctl(fd, LOOP_GET_STATUS64, &info)) {
+        PLOG(ERROR) << "Could not get loop device status";
+        return false;
+    }
+    return (info.lo_flags & LO_FLAGS_DIRECT_IO) != 0;
+}
+
 bool LoopControl::SetAutoClearStatus(int fd) {
     struct loop_info64 info = {};
 
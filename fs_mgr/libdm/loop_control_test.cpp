@@ -62,3 +62,19 @@ TEST(libdm, LoopControl) {
     ASSERT_TRUE(android::base::ReadFully(loop_fd, buffer, sizeof(buffer)));
     ASSERT_EQ(memcmp(buffer, "Hello", 6), 0);
 }
+
+TEST(libdm, LoopControlDirectIo) {
+    unique_fd fd = TempFile();
+    ASSERT_GE(fd, 0);
+
+    LoopControl control;
+    std::string device;
+    ASSERT_TRUE(control.Attach(fd, 10s, &device, true /* direct_io */));
+
+    unique_fd loop_fd(open(device.c_str(), O_RDWR | O_CLOEXEC));
+    ASSERT_GE(loop_fd, 0);
+    EXPECT_TRUE(LoopControl::HasDirectIo(loop_fd));
+    loop_fd.reset();
+
+    ASSERT_TRUE(control.Detach(device));
+}
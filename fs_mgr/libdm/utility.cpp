@@ -21,6 +21,8 @@
 
 #include <android-base/logging.h>
 
+#include "file_notifier.h"
+
 using namespace std::literals;
 
 namespace android {
@@ -43,19 +45,12 @@ bool WaitForCondition(const std::function<WaitResult()>& condition,
 }
 
 bool WaitForFile(const std::string& path, const std::chrono::milliseconds& timeout_ms) {
-    auto condition = [&]() -> WaitResult {
-        // If the file exists but returns EPERM or something, we consider the
-        // condition met.
-        if (access(path.c_str(), F_OK) != 0) {
-            if (errno == ENOENT) {
-                return WaitResult::Wait;
-            }
-            PLOG(ERROR) << "access failed: " << path;
-            return WaitResult::Fail;
-        }
-        return WaitResult::Done;
-    };
-    return WaitForCondition(condition, timeout_ms);
+    return WaitForFiles({path}, timeout_ms);
+}
+
+bool WaitForFiles(const std::vector<std::string>& paths,
+                  const std::chrono::milliseconds& timeout_ms) {
+    return FileNotifier::Instance().WaitForFiles(paths, timeout_ms);
 }
 
 bool WaitForFileDeleted(const std::string& path, const std::chrono::milliseconds& timeout_ms) {
@@ -27,6 +27,7 @@
 #include <sys/vfs.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <limits>
 #include <string>
 #include <utility>
@@ -54,6 +55,9 @@ static constexpr const uint32_t kUnsupportedExtentFlags =
         FIEMAP_EXTENT_NOT_ALIGNED | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL |
         FIEMAP_EXTENT_UNWRITTEN | FIEMAP_EXTENT_SHARED;
 
+// Size of each write when converting fallocated extents into written ones.
+static constexpr uint64_t kZeroWriteSize = 1024 * 1024;
+
 // Large file support must be enabled.
 static_assert(sizeof(off_t) == sizeof(uint64_t));
 
@@ -379,13 +383,16 @@ static bool PinFile(int file_fd, const std::string& file_path, uint32_t fs_type)
     return true;
 }
 
-// write zeroes in 'blocksz' byte increments until we reach file_size to make sure the data
-// blocks are actually written to by the file system and thus getting rid of the holes in the
-// file.
+// write zeroes until we reach file_size to make sure the data blocks are actually written to by
+// the file system and thus getting rid of the holes in the file. FALLOC_FL_ZERO_RANGE and
+// BLKZEROOUT are no substitute here: both leave the extents unwritten as far as the file system
+// is concerned, which FIEMAP reports and we reject. Writes are issued in chunks of up to
+// kZeroWriteSize (a multiple of 'blocksz'), since per-block syscalls dominate otherwise.
 static FiemapStatus WriteZeroes(int file_fd, const std::string& file_path, size_t blocksz,
                                 uint64_t file_size,
                                 const std::function<bool(uint64_t, uint64_t)>& on_progress) {
-    auto buffer = std::unique_ptr<void, decltype(&free)>(calloc(1, blocksz), free);
+    size_t chunk_size = std::max(static_cast<size_t>(kZeroWriteSize / blocksz), size_t(1)) * blocksz;
+    auto buffer = std::unique_ptr<void, decltype(&free)>(calloc(1, chunk_size), free);
     if (buffer == nullptr) {
         LOG(ERROR) << "failed to allocate memory for writing file";
         return FiemapStatus::Error();
@@ -399,13 +406,14 @@ static FiemapStatus WriteZeroes(int file_fd, const std::string& file_path, size_
 
     int permille = -1;
     while (offset < file_size) {
-        if (!::android::base::WriteFully(file_fd, buffer.get(), blocksz)) {
-            PLOG(ERROR) << "Failed to write" << blocksz << " bytes at offset" << offset
+        size_t to_write = std::min(static_cast<uint64_t>(chunk_size), file_size - offset);
+        if (!::android::base::WriteFully(file_fd, buffer.get(), to_write)) {
+            PLOG(ERROR) << "Failed to write" << to_write << " bytes at offset" << offset
                         << " in file " << file_path;
             return FiemapStatus::FromErrno(errno);
         }
 
-        offset += blocksz;
+        offset += to_write;
 
         // Don't invoke the callback every iteration - wait until a significant
         // chunk (here, 1/1000th) of the data has been processed.
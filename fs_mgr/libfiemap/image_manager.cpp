@@ -16,6 +16,11 @@
 
 #include <libfiemap/image_manager.h>
 
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <future>
 #include <optional>
 
 #include <android-base/file.h>
@@ -204,6 +209,9 @@ FiemapStatus ImageManager::CreateBackingImage(
     if (!UpdateMetadata(metadata_dir_, name, fw.get(), size, readonly)) {
         return FiemapStatus::Error();
     }
+    if (!SaveExtentCache(metadata_dir_, name, data_path)) {
+        LOG(WARNING) << "Could not save extent cache for " << name;
+    }
 
     if (flags & CREATE_IMAGE_ZERO_FILL) {
         auto res = ZeroFillNewImage(name, 0);
@@ -240,9 +248,6 @@ FiemapStatus ImageManager::ZeroFillNewImage(const std::string& name, uint64_t by
         return FiemapStatus::Error();
     }
 
-    static constexpr size_t kChunkSize = 4096;
-    std::string zeroes(kChunkSize, '\0');
-
     uint64_t remaining;
     if (bytes) {
         remaining = bytes;
@@ -253,6 +258,40 @@ FiemapStatus ImageManager::ZeroFillNewImage(const std::string& name, uint64_t by
             return FiemapStatus::FromErrno(errno);
         }
     }
+
+    // Let the kernel zero the range. The device is dm-linear on the raw
+    // partition underneath the encryption layer, so this either becomes a
+    // REQ_OP_WRITE_ZEROES on the storage device or, if it has none, large
+    // in-kernel writes of the zero page. Ranges are bounded so that a single
+    // ioctl stays short. BLKDISCARD is not used since it does not guarantee
+    // zeroes on read.
+    static constexpr uint64_t kZeroOutChunkSize = 256 * 1024 * 1024;
+    uint64_t offset = 0;
+    while (remaining >= LP_SECTOR_SIZE) {
+        uint64_t size = std::min(kZeroOutChunkSize, remaining) & ~uint64_t(LP_SECTOR_SIZE - 1);
+        uint64_t range[2] = {offset, size};
+        if (ioctl(device->fd(), BLKZEROOUT, &range)) {
+            if (errno != ENOTTY && errno != EOPNOTSUPP && errno != EINVAL) {
+                PLOG(ERROR) << "BLKZEROOUT failed: " << device->path();
+                return FiemapStatus::FromErrno(errno);
+            }
+            PLOG(INFO) << "BLKZEROOUT not supported, writing zeroes: " << device->path();
+            break;
+        }
+        offset += size;
+        remaining -= size;
+    }
+    if (!remaining) {
+        return FiemapStatus::Ok();
+    }
+
+    if (lseek64(device->fd(), offset, SEEK_SET) < 0) {
+        PLOG(ERROR) << "lseek failed: " << device->path();
+        return FiemapStatus::FromErrno(errno);
+    }
+
+    static constexpr size_t kChunkSize = 1024 * 1024;
+    std::string zeroes(kChunkSize, '\0');
     while (remaining) {
         uint64_t to_write = std::min(static_cast<uint64_t>(zeroes.size()), remaining);
         if (!android::base::WriteFully(device->fd(), zeroes.data(),
@@ -338,11 +377,16 @@ static bool CreateLoopDevice(LoopControl& control, const std::string& file,
         PLOG(ERROR) << "Could not open file: " << file;
         return false;
     }
-    if (!control.Attach(file_fd, timeout_ms, path)) {
+    // Without direct IO, pages would be cached for both the loop device and
+    // the file, using double the memory. The device is only handed out once
+    // attached, so that nothing else gets detached on failure.
+    std::string loop_device;
+    if (!control.Attach(file_fd, timeout_ms, &loop_device, true /* direct_io */)) {
         LOG(ERROR) << "Could not create loop device for: " << file;
         return false;
     }
-    LOG(INFO) << "Created loop device " << *path << " for file " << file;
+    LOG(INFO) << "Created loop device " << loop_device << " for file " << file;
+    *path = std::move(loop_device);
     return true;
 }
 
@@ -440,20 +484,6 @@ bool ImageManager::MapWithLoopDeviceList(const std::vector<std::string>& device_
     return true;
 }
 
-static bool OptimizeLoopDevices(const std::vector<std::string>& device_list) {
-    for (const auto& device : device_list) {
-        unique_fd fd(open(device.c_str(), O_RDWR | O_CLOEXEC | O_NOFOLLOW));
-        if (fd < 0) {
-            PLOG(ERROR) << "Open failed: " << device;
-            return false;
-        }
-        if (!LoopControl::EnableDirectIo(fd)) {
-            return false;
-        }
-    }
-    return true;
-}
-
 // Helper to use one or more loop devices around image files.
 bool ImageManager::MapWithLoopDevice(const std::string& name,
                                      const std::chrono::milliseconds& timeout_ms,
@@ -466,29 +496,26 @@ bool ImageManager::MapWithLoopDevice(const std::string& name,
         return false;
     }
 
-    // Map each image file as a loopback device.
+    // Map each image file as a loopback device. Most of the time goes to
+    // waiting for ueventd to create each device node, so they are all created
+    // at once and the timeout applies to each of them.
     LoopControl control;
-    std::vector<std::string> loop_devices;
-    AutoDetachLoopDevices auto_detach(control, loop_devices);
-
-    auto start_time = std::chrono::steady_clock::now();
-    for (const auto& file : file_list) {
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time);
-
-        std::string loop_device;
-        if (!CreateLoopDevice(control, file, timeout_ms - elapsed, &loop_device)) {
-            break;
-        }
-        loop_devices.emplace_back(loop_device);
+    std::vector<std::string> loop_devices(file_list.size());
+    std::vector<std::future<bool>> results;
+    for (size_t i = 0; i < file_list.size(); i++) {
+        results.emplace_back(std::async(std::launch::async, [&, i]() -> bool {
+            return CreateLoopDevice(control, file_list[i], timeout_ms, &loop_devices[i]);
+        }));
     }
-    if (loop_devices.size() != file_list.size()) {
-        // The number of devices will mismatch if CreateLoopDevice() failed.
-        return false;
+    bool ok = true;
+    for (auto& result : results) {
+        ok &= result.get();
     }
-
-    // If OptimizeLoopDevices fails, we'd use double the memory.
-    if (!OptimizeLoopDevices(loop_devices)) {
+    // Devices that failed are left empty and have nothing to detach.
+    loop_devices.erase(std::remove(loop_devices.begin(), loop_devices.end(), std::string()),
+                       loop_devices.end());
+    AutoDetachLoopDevices auto_detach(control, loop_devices);
+    if (!ok) {
         return false;
     }
 
@@ -665,6 +692,9 @@ bool ImageManager::Validate() {
     for (const auto& partition : metadata->partitions) {
         auto name = GetPartitionName(partition);
         auto image_path = GetImageHeaderPath(name);
+        if (ExtentCacheMatches(*metadata.get(), metadata_dir_, name, image_path)) {
+            continue;
+        }
         auto fiemap = SplitFiemap::Open(image_path);
         if (fiemap == nullptr) {
             LOG(ERROR) << "SplitFiemap::Open(\"" << image_path << "\") failed";
@@ -810,6 +840,13 @@ bool ImageManager::ValidateImageMaps() {
     for (const auto& partition : metadata->partitions) {
         auto name = GetPartitionName(partition);
         auto image_path = GetImageHeaderPath(name);
+
+        // Skip FIEMAP entirely if the files are unchanged since their extents
+        // were last validated.
+        if (ExtentCacheMatches(*metadata.get(), metadata_dir_, name, image_path)) {
+            continue;
+        }
+
         auto fiemap = SplitFiemap::Open(image_path);
         if (fiemap == nullptr) {
             LOG(ERROR) << "SplitFiemap::Open(\"" << image_path << "\") failed";
@@ -849,8 +886,56 @@ bool ImageManager::ValidateImageMaps() {
             LOG(ERROR) << "Metadata for " << image_path << " does not match fiemap";
             return false;
         }
+
+        if (!SaveExtentCache(metadata_dir_, name, image_path)) {
+            LOG(WARNING) << "Could not save extent cache for " << name;
+        }
+    }
+
+    return true;
+}
+
+bool ImageManager::GetFragmentationStats(const std::string& name, FragmentationStats* stats) {
+    if (!MetadataExists(metadata_dir_)) {
+        return false;
+    }
+    auto metadata = OpenMetadata(metadata_dir_);
+    if (!metadata) {
+        return false;
+    }
+    auto partition = FindPartition(*metadata.get(), name);
+    if (!partition) {
+        LOG(ERROR) << "Could not find image " << name;
+        return false;
     }
 
+    *stats = {};
+    const LpMetadataExtent* prev = nullptr;
+    uint64_t run = 0;
+    auto end_run = [&]() -> void {
+        if (!run) return;
+        stats->extents++;
+        stats->largest_extent = std::max(stats->largest_extent, run);
+        if (!stats->smallest_extent || run < stats->smallest_extent) {
+            stats->smallest_extent = run;
+        }
+        run = 0;
+    };
+    for (uint32_t i = 0; i < partition->num_extents; i++) {
+        const auto& extent = metadata->extents[partition->first_extent_index + i];
+        uint64_t bytes = extent.num_sectors * LP_SECTOR_SIZE;
+        bool adjacent = prev && prev->target_type == LP_TARGET_TYPE_LINEAR &&
+                        extent.target_type == LP_TARGET_TYPE_LINEAR &&
+                        prev->target_source == extent.target_source &&
+                        prev->target_data + prev->num_sectors == extent.target_data;
+        if (!adjacent) {
+            end_run();
+        }
+        run += bytes;
+        stats->size += bytes;
+        prev = &extent;
+    }
+    end_run();
     return true;
 }
 
@@ -139,6 +139,57 @@ TEST_F(NativeTest, GetMappedImageDevice) {
     ASSERT_TRUE(manager_->UnmapImageDevice(base_name_));
 }
 
+TEST_F(NativeTest, ZeroFill) {
+    ASSERT_TRUE(manager_->CreateBackingImage(base_name_, kTestImageSize,
+                                             ImageManager::CREATE_IMAGE_ZERO_FILL, nullptr));
+
+    std::string path;
+    ASSERT_TRUE(manager_->MapImageDevice(base_name_, 5s, &path));
+    {
+        unique_fd fd(open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+        ASSERT_GE(fd, 0);
+
+        std::string buffer(kTestImageSize, '\1');
+        ASSERT_TRUE(android::base::ReadFully(fd, buffer.data(), buffer.size()));
+        ASSERT_EQ(buffer, std::string(kTestImageSize, '\0'));
+    }
+    ASSERT_TRUE(manager_->UnmapImageDevice(base_name_));
+}
+
+TEST_F(NativeTest, ValidateWithExtentCache) {
+    ASSERT_TRUE(manager_->CreateBackingImage(base_name_, kTestImageSize, false, nullptr));
+
+    auto cache_file = kMetadataPath + "/"s + base_name_ + ".extents";
+    std::string cache;
+    ASSERT_TRUE(android::base::ReadFileToString(cache_file, &cache));
+    ASSERT_FALSE(cache.empty());
+    ASSERT_TRUE(manager_->ValidateImageMaps());
+
+    // A stale cache must fall back to FIEMAP, and be rewritten.
+    ASSERT_TRUE(android::base::WriteStringToFile("stale", cache_file));
+    ASSERT_TRUE(manager_->ValidateImageMaps());
+    std::string rewritten;
+    ASSERT_TRUE(android::base::ReadFileToString(cache_file, &rewritten));
+    EXPECT_EQ(cache, rewritten);
+
+    ASSERT_TRUE(manager_->DeleteBackingImage(base_name_));
+    EXPECT_NE(access(cache_file.c_str(), F_OK), 0);
+}
+
+TEST_F(NativeTest, FragmentationStats) {
+    ASSERT_TRUE(manager_->CreateBackingImage(base_name_, kTestImageSize, false, nullptr));
+
+    ImageManager::FragmentationStats stats;
+    ASSERT_TRUE(manager_->GetFragmentationStats(base_name_, &stats));
+    EXPECT_EQ(stats.size, kTestImageSize);
+    EXPECT_GE(stats.extents, 1);
+    EXPECT_GT(stats.smallest_extent, 0);
+    EXPECT_LE(stats.smallest_extent, stats.largest_extent);
+    EXPECT_LE(stats.largest_extent, kTestImageSize);
+
+    EXPECT_FALSE(manager_->GetFragmentationStats("does_not_exist", &stats));
+}
+
 namespace {
 
 struct IsSubdirTestParam {
@@ -178,6 +178,18 @@ class ImageManager final : public IImageManager {
     // Validate that all images still have the same block map.
     bool ValidateImageMaps();
 
+    struct FragmentationStats {
+        // Number of extents, after merging physically adjacent ones. This is
+        // the number of dm-linear targets the image maps to.
+        uint32_t extents = 0;
+        uint64_t size = 0;
+        uint64_t smallest_extent = 0;
+        uint64_t largest_extent = 0;
+    };
+
+    // Report how fragmented an image's backing storage is, from its metadata.
+    bool GetFragmentationStats(const std::string& name, FragmentationStats* stats);
+
   private:
     ImageManager(const std::string& metadata_dir, const std::string& data_dir,
                  const DeviceInfo& device_info);
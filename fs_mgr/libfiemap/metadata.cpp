@@ -16,12 +16,16 @@
 
 #include "metadata.h"
 
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <libfiemap/fiemap_writer.h>
 #include <liblp/builder.h>
 
 #include "utility.h"
@@ -125,6 +129,116 @@ bool SaveMetadata(MetadataBuilder* builder, const std::string& metadata_dir) {
     return true;
 }
 
+static std::string GetExtentCacheFile(const std::string& metadata_dir,
+                                      const std::string& partition_name) {
+    return JoinPaths(metadata_dir, partition_name) + ".extents";
+}
+
+static bool GetFileIdentity(const std::string& file, std::string* out) {
+    unique_fd fd(open(file.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+    if (fd < 0) {
+        PLOG(ERROR) << "open failed: " << file;
+        return false;
+    }
+    struct stat s;
+    if (fstat(fd, &s)) {
+        PLOG(ERROR) << "fstat failed: " << file;
+        return false;
+    }
+    // The generation tells apart a new file that reuses the inode number.
+    // Not every file system has one, in which case the timestamps must do.
+    int generation = 0;
+    if (ioctl(fd, FS_IOC_GETVERSION, &generation)) {
+        generation = 0;
+    }
+    *out += android::base::StringPrintf(
+            "file %s %llu %llu %d %lld %lld.%09ld %lld.%09ld\n", file.c_str(),
+            static_cast<unsigned long long>(s.st_dev), static_cast<unsigned long long>(s.st_ino),
+            generation, static_cast<long long>(s.st_size), static_cast<long long>(s.st_mtim.tv_sec),
+            s.st_mtim.tv_nsec, static_cast<long long>(s.st_ctim.tv_sec), s.st_ctim.tv_nsec);
+    return true;
+}
+
+// Serialize the identity of every split file of |image_path|, followed by the
+// lp_metadata extents of |partition_name|.
+static bool BuildExtentCache(const LpMetadata& metadata, const std::string& partition_name,
+                             const std::string& image_path, std::string* out) {
+    const LpMetadataPartition* partition = nullptr;
+    for (const auto& p : metadata.partitions) {
+        if (GetPartitionName(p) == partition_name) {
+            partition = &p;
+            break;
+        }
+    }
+    if (!partition) {
+        return false;
+    }
+
+    std::vector<std::string> files;
+    if (!SplitFiemap::GetSplitFileList(image_path, &files)) {
+        return false;
+    }
+    for (const auto& file : files) {
+        if (!GetFileIdentity(file, out)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < partition->num_extents; i++) {
+        const auto& extent = metadata.extents[partition->first_extent_index + i];
+        *out += android::base::StringPrintf(
+                "extent %llu %u %llu %u\n", static_cast<unsigned long long>(extent.num_sectors),
+                extent.target_type, static_cast<unsigned long long>(extent.target_data),
+                extent.target_source);
+    }
+    return true;
+}
+
+bool SaveExtentCache(const std::string& metadata_dir, const std::string& partition_name,
+                     const std::string& image_path) {
+    auto metadata = OpenMetadata(metadata_dir);
+    if (!metadata) {
+        return false;
+    }
+    std::string contents;
+    if (!BuildExtentCache(*metadata.get(), partition_name, image_path, &contents)) {
+        return false;
+    }
+    // A torn write only means the cache will not match, and the next check
+    // falls back to FIEMAP.
+    auto cache_file = GetExtentCacheFile(metadata_dir, partition_name);
+    if (!android::base::WriteStringToFile(contents, cache_file)) {
+        PLOG(ERROR) << "write failed: " << cache_file;
+        return false;
+    }
+    return true;
+}
+
+bool ExtentCacheMatches(const LpMetadata& metadata, const std::string& metadata_dir,
+                        const std::string& partition_name, const std::string& image_path) {
+    std::string cached;
+    auto cache_file = GetExtentCacheFile(metadata_dir, partition_name);
+    if (!android::base::ReadFileToString(cache_file, &cached)) {
+        return false;
+    }
+    std::string current;
+    if (!BuildExtentCache(metadata, partition_name, image_path, &current) || current != cached) {
+        return false;
+    }
+
+    // An f2fs file that lost its pin may have been moved by GC without any
+    // of the above changing, so this must still be checked.
+    std::vector<std::string> files;
+    if (!SplitFiemap::GetSplitFileList(image_path, &files)) {
+        return false;
+    }
+    for (const auto& file : files) {
+        if (!FiemapWriter::HasPinnedExtents(file)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool RemoveAllMetadata(const std::string& dir) {
     auto metadata_file = GetMetadataFile(dir);
     std::string err;
@@ -185,7 +299,16 @@ bool RemoveImageMetadata(const std::string& metadata_dir, const std::string& par
         return false;
     }
     builder->RemovePartition(partition_name);
-    return SaveMetadata(builder.get(), metadata_dir);
+    if (!SaveMetadata(builder.get(), metadata_dir)) {
+        return false;
+    }
+
+    std::string err;
+    if (!android::base::RemoveFileIfExists(GetExtentCacheFile(metadata_dir, partition_name),
+                                           &err)) {
+        LOG(WARNING) << "Could not remove extent cache: " << err;
+    }
+    return true;
 }
 
 bool UpdateMetadata(const std::string& metadata_dir, const std::string& partition_name,
@@ -35,6 +35,16 @@ bool AddAttributes(const std::string& metadata_dir, const std::string& partition
 bool RemoveImageMetadata(const std::string& metadata_dir, const std::string& partition_name);
 bool RemoveAllMetadata(const std::string& dir);
 
+// The extent cache records, for one image, the identity of each of its split
+// files (inode, generation, size, mtime, ctime) alongside the extents in
+// lp_metadata that were last validated against FIEMAP. If nothing has changed
+// since, the extents can be trusted without issuing FIEMAP again.
+bool SaveExtentCache(const std::string& metadata_dir, const std::string& partition_name,
+                     const std::string& image_path);
+bool ExtentCacheMatches(const android::fs_mgr::LpMetadata& metadata,
+                        const std::string& metadata_dir, const std::string& partition_name,
+                        const std::string& image_path);
+
 bool FillPartitionExtents(android::fs_mgr::MetadataBuilder* builder,
                           android::fs_mgr::Partition* partition, android::fiemap::SplitFiemap* file,
                           uint64_t partition_size);
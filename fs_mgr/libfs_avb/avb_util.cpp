@@ -19,12 +19,15 @@
 #include <unistd.h>
 
 #include <array>
+#include <map>
+#include <mutex>
 #include <sstream>
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 
+#include "sha.h"
 #include "util.h"
 
 using android::base::Basename;
@@ -326,6 +329,55 @@ bool ValidatePublicKeyBlob(const std::string& key_blob_to_validate,
     return false;
 }
 
+// The same vbmeta images are verified more than once during a boot, e.g. by
+// each mount pass and by the chained partitions' lookups. The result of
+// avb_vbmeta_image_verify() only depends on the image content, so it is kept
+// per process, keyed by the digest of the image. Nothing is persisted: a
+// record stored on disk could be forged by whoever can write the partitions.
+struct VBMetaVerifyCacheEntry {
+    ::AvbVBMetaVerifyResult result;
+    // Offset of the public key within the image; only valid if pk_len > 0.
+    size_t pk_offset;
+    size_t pk_len;
+};
+
+static ::AvbVBMetaVerifyResult CachedVBMetaImageVerify(const VBMetaData& vbmeta,
+                                                       const uint8_t** out_pk_data,
+                                                       size_t* out_pk_len) {
+    static std::mutex cache_lock;
+    static std::map<std::string, VBMetaVerifyCacheEntry> cache;
+
+    SHA256Hasher hasher;
+    hasher.update(vbmeta.data(), vbmeta.size());
+    std::string key(reinterpret_cast<const char*>(hasher.finalize()), SHA256Hasher::DIGEST_SIZE);
+
+    {
+        std::lock_guard<std::mutex> lock(cache_lock);
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            *out_pk_data = it->second.pk_len > 0 ? vbmeta.data() + it->second.pk_offset : nullptr;
+            *out_pk_len = it->second.pk_len;
+            return it->second.result;
+        }
+    }
+
+    const uint8_t* pk_data = nullptr;
+    size_t pk_len = 0;
+    auto result = avb_vbmeta_image_verify(vbmeta.data(), vbmeta.size(), &pk_data, &pk_len);
+    if (pk_data == nullptr) {
+        pk_len = 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(cache_lock);
+        cache[key] = {result, pk_len > 0 ? static_cast<size_t>(pk_data - vbmeta.data()) : 0,
+                      pk_len};
+    }
+    *out_pk_data = pk_data;
+    *out_pk_len = pk_len;
+    return result;
+}
+
 VBMetaVerifyResult VerifyVBMetaSignature(const VBMetaData& vbmeta,
                                          const std::string& expected_public_key_blob,
                                          std::string* out_public_key_data) {
@@ -333,7 +385,7 @@ VBMetaVerifyResult VerifyVBMetaSignature(const VBMetaData& vbmeta,
     size_t pk_len;
     ::AvbVBMetaVerifyResult vbmeta_ret;
 
-    vbmeta_ret = avb_vbmeta_image_verify(vbmeta.data(), vbmeta.size(), &pk_data, &pk_len);
+    vbmeta_ret = CachedVBMetaImageVerify(vbmeta, &pk_data, &pk_len);
 
     if (out_public_key_data != nullptr) {
         out_public_key_data->clear();
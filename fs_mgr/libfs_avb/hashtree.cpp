@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+
+#include "fs_avb/fs_avb_util.h"
+#include "sha.h"
+#include "util.h"
+
+namespace android {
+namespace fs_mgr {
+
+// Data blocks are read this many at a time by each thread.
+static constexpr uint64_t kReadBlocks = 256;
+
+// Builds the tree the way avbtool does: every block of a level, zero padded
+// to the block size, is hashed with the salt prepended. Each digest is padded
+// to a power of two, and each level to a multiple of the hash block size. The
+// levels are stored top down, and the root digest is the salted hash of the
+// single block at the top.
+template <typename Hasher>
+class HashtreeBuilder {
+  public:
+    HashtreeBuilder(int fd, const FsAvbHashtreeDescriptor& desc, const std::string& salt,
+                    unsigned int num_threads)
+        : fd_(fd), desc_(desc), num_threads_(num_threads) {
+        salted_.update(reinterpret_cast<const uint8_t*>(salt.data()), salt.size());
+        digest_padded_size_ = 1;
+        while (digest_padded_size_ < Hasher::DIGEST_SIZE) {
+            digest_padded_size_ <<= 1;
+        }
+    }
+
+    bool Build(std::string* tree, std::string* root_digest);
+
+  private:
+    uint64_t LevelSize(uint64_t src_size, uint64_t block_size) const;
+    bool HashBlocks(const uint8_t* src, uint64_t src_size, uint64_t block_size, uint8_t* dst);
+    bool HashRange(const uint8_t* src, uint64_t src_size, uint64_t block_size, uint64_t begin,
+                   uint64_t end, uint8_t* dst);
+    void HashBlock(const uint8_t* data, size_t size, size_t block_size, uint8_t* digest) const;
+
+    int fd_;
+    const FsAvbHashtreeDescriptor& desc_;
+    unsigned int num_threads_;
+    Hasher salted_;
+    size_t digest_padded_size_;
+};
+
+template <typename Hasher>
+uint64_t HashtreeBuilder<Hasher>::LevelSize(uint64_t src_size, uint64_t block_size) const {
+    uint64_t num_blocks = (src_size + block_size - 1) / block_size;
+    uint64_t size = num_blocks * digest_padded_size_;
+    return (size + desc_.hash_block_size - 1) / desc_.hash_block_size * desc_.hash_block_size;
+}
+
+template <typename Hasher>
+void HashtreeBuilder<Hasher>::HashBlock(const uint8_t* data, size_t size, size_t block_size,
+                                        uint8_t* digest) const {
+    static const std::vector<uint8_t> zeroes(65536);
+
+    Hasher hasher = salted_;
+    hasher.update(data, size);
+    for (size_t padding = block_size - size; padding;) {
+        size_t n = std::min(padding, zeroes.size());
+        hasher.update(zeroes.data(), n);
+        padding -= n;
+    }
+    memcpy(digest, hasher.finalize(), Hasher::DIGEST_SIZE);
+}
+
+// Hashes blocks [begin, end) of a level. If |src| is null, the level is the
+// image in |fd_|.
+template <typename Hasher>
+bool HashtreeBuilder<Hasher>::HashRange(const uint8_t* src, uint64_t src_size, uint64_t block_size,
+                                        uint64_t begin, uint64_t end, uint8_t* dst) {
+    std::vector<uint8_t> buffer;
+    if (!src) {
+        buffer.resize(kReadBlocks * block_size);
+    }
+
+    for (uint64_t block = begin; block < end;) {
+        uint64_t count = std::min(end - block, src ? end - block : kReadBlocks);
+        uint64_t offset = block * block_size;
+        uint64_t size = std::min(count * block_size, src_size - offset);
+
+        const uint8_t* data = src ? src + offset : buffer.data();
+        if (!src && !android::base::ReadFullyAtOffset(fd_, buffer.data(), size, offset)) {
+            PERROR << "Failed to read image at offset " << offset;
+            return false;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            size_t len = std::min<uint64_t>(block_size, size - i * block_size);
+            HashBlock(data + i * block_size, len, block_size,
+                      dst + (block + i) * digest_padded_size_);
+        }
+        block += count;
+    }
+    return true;
+}
+
+template <typename Hasher>
+bool HashtreeBuilder<Hasher>::HashBlocks(const uint8_t* src, uint64_t src_size,
+                                         uint64_t block_size, uint8_t* dst) {
+    uint64_t num_blocks = (src_size + block_size - 1) / block_size;
+    unsigned int num_threads = std::max<uint64_t>(1, std::min<uint64_t>(num_threads_, num_blocks));
+    if (num_threads == 1) {
+        return HashRange(src, src_size, block_size, 0, num_blocks, dst);
+    }
+
+    // Each thread hashes a contiguous run of blocks, so that reads from the
+    // image stay sequential within a thread.
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> threads;
+    uint64_t per_thread = (num_blocks + num_threads - 1) / num_threads;
+    for (unsigned int i = 0; i < num_threads; i++) {
+        uint64_t begin = std::min(num_blocks, i * per_thread);
+        uint64_t end = std::min(num_blocks, begin + per_thread);
+        threads.emplace_back([&, begin, end]() -> void {
+            if (!HashRange(src, src_size, block_size, begin, end, dst)) ok = false;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return ok;
+}
+
+template <typename Hasher>
+bool HashtreeBuilder<Hasher>::Build(std::string* tree, std::string* root_digest) {
+    // Level 0 hashes the data; each following level hashes the one below it,
+    // until a level fits in a single hash block.
+    std::vector<uint64_t> level_sizes;
+    uint64_t size = LevelSize(desc_.image_size, desc_.data_block_size);
+    if (desc_.image_size > desc_.data_block_size) {
+        level_sizes.emplace_back(size);
+        while (size > desc_.hash_block_size) {
+            size = LevelSize(size, desc_.hash_block_size);
+            level_sizes.emplace_back(size);
+        }
+    }
+
+    uint64_t tree_size = 0;
+    for (auto level_size : level_sizes) {
+        tree_size += level_size;
+    }
+    if (tree_size != desc_.tree_size) {
+        LERROR << "Computed hash tree size " << tree_size << " does not match descriptor size "
+               << desc_.tree_size;
+        return false;
+    }
+    tree->assign(tree_size, '\0');
+
+    // The top level is stored first.
+    uint8_t* level = reinterpret_cast<uint8_t*>(tree->data()) + tree_size;
+    const uint8_t* src = nullptr;
+    uint64_t src_size = desc_.image_size;
+    uint64_t block_size = desc_.data_block_size;
+    for (auto level_size : level_sizes) {
+        level -= level_size;
+        if (!HashBlocks(src, src_size, block_size, level)) {
+            return false;
+        }
+        src = level;
+        src_size = level_size;
+        block_size = desc_.hash_block_size;
+    }
+
+    uint8_t digest[Hasher::DIGEST_SIZE];
+    if (src) {
+        HashBlock(src, src_size, src_size, digest);
+    } else {
+        // The image fits in one block and has no tree.
+        std::vector<uint8_t> data(src_size);
+        if (!android::base::ReadFullyAtOffset(fd_, data.data(), data.size(), 0)) {
+            PERROR << "Failed to read image";
+            return false;
+        }
+        HashBlock(data.data(), data.size(), block_size, digest);
+    }
+    *root_digest = BytesToHex(digest, sizeof(digest));
+    return true;
+}
+
+bool BuildHashtree(int fd, const FsAvbHashtreeDescriptor& hashtree_desc, unsigned int num_threads,
+                   std::string* out_tree, std::string* out_root_digest) {
+    if (!hashtree_desc.data_block_size || !hashtree_desc.hash_block_size) {
+        LERROR << "Invalid hash tree block size";
+        return false;
+    }
+
+    std::string salt(hashtree_desc.salt.size() / 2, '\0');
+    if (!HexToBytes(reinterpret_cast<uint8_t*>(salt.data()), salt.size(), hashtree_desc.salt)) {
+        LERROR << "Invalid hash tree salt: " << hashtree_desc.salt;
+        return false;
+    }
+    if (!num_threads) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // libcrypto picks the SHA-2 instructions of the CPU when it has them, so
+    // the per-block hashing is already accelerated; threads spread it over
+    // the cores.
+    std::string algorithm(reinterpret_cast<const char*>(hashtree_desc.hash_algorithm),
+                          strnlen(reinterpret_cast<const char*>(hashtree_desc.hash_algorithm),
+                                  sizeof(hashtree_desc.hash_algorithm)));
+    if (algorithm == "sha1") {
+        return HashtreeBuilder<SHA1Hasher>(fd, hashtree_desc, salt, num_threads)
+                .Build(out_tree, out_root_digest);
+    } else if (algorithm == "sha256") {
+        return HashtreeBuilder<SHA256Hasher>(fd, hashtree_desc, salt, num_threads)
+                .Build(out_tree, out_root_digest);
+    } else if (algorithm == "sha512") {
+        return HashtreeBuilder<SHA512Hasher>(fd, hashtree_desc, salt, num_threads)
+                .Build(out_tree, out_root_digest);
+    }
+    LERROR << "Unsupported hash tree algorithm: " << algorithm;
+    return false;
+}
+
+bool RegenerateHashtree(int fd, const FsAvbHashtreeDescriptor& hashtree_desc,
+                        unsigned int num_threads) {
+    std::string tree, root_digest;
+    if (!BuildHashtree(fd, hashtree_desc, num_threads, &tree, &root_digest)) {
+        return false;
+    }
+    if (root_digest != hashtree_desc.root_digest) {
+        LERROR << "Root digest " << root_digest << " does not match descriptor "
+               << hashtree_desc.root_digest;
+        return false;
+    }
+    if (!android::base::WriteFullyAtOffset(fd, tree.data(), tree.size(),
+                                           hashtree_desc.tree_offset)) {
+        PERROR << "Failed to write hash tree at offset " << hashtree_desc.tree_offset;
+        return false;
+    }
+    if (fsync(fd) < 0) {
+        PERROR << "Failed to sync hash tree";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace fs_mgr
+}  // namespace android
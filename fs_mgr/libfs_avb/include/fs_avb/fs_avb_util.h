@@ -53,5 +53,18 @@ std::unique_ptr<FsAvbHashDescriptor> GetHashDescriptor(const std::string& avb_pa
 std::string GetAvbPropertyDescriptor(const std::string& key,
                                      const std::vector<VBMetaData>& vbmeta_images);
 
+// Computes the dm-verity hash tree of the image in |fd| as described by
+// |hashtree_desc|, using up to |num_threads| threads (0 for one per CPU). On
+// success, |out_tree| holds the tree as laid out on disk and |out_root_digest|
+// the hex encoded root digest, as in FsAvbHashtreeDescriptor::root_digest.
+bool BuildHashtree(int fd, const FsAvbHashtreeDescriptor& hashtree_desc, unsigned int num_threads,
+                   std::string* out_tree, std::string* out_root_digest);
+
+// Rebuilds the hash tree of the image in |fd| and writes it at the tree offset,
+// e.g. after the data was rewritten by a snapshot merge. Nothing is written
+// if the root digest does not match |hashtree_desc|.
+bool RegenerateHashtree(int fd, const FsAvbHashtreeDescriptor& hashtree_desc,
+                        unsigned int num_threads);
+
 }  // namespace fs_mgr
 }  // namespace android
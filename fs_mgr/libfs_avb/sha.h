@@ -21,6 +21,24 @@
 namespace android {
 namespace fs_mgr {
 
+class SHA1Hasher {
+  private:
+    SHA_CTX sha1_ctx;
+    uint8_t hash[SHA_DIGEST_LENGTH];
+
+  public:
+    enum { DIGEST_SIZE = SHA_DIGEST_LENGTH };
+
+    SHA1Hasher() { SHA1_Init(&sha1_ctx); }
+
+    void update(const uint8_t* data, size_t data_size) { SHA1_Update(&sha1_ctx, data, data_size); }
+
+    const uint8_t* finalize() {
+        SHA1_Final(hash, &sha1_ctx);
+        return hash;
+    }
+};
+
 class SHA256Hasher {
   private:
     SHA256_CTX sha256_ctx;
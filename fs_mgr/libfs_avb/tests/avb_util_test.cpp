@@ -520,6 +520,52 @@ TEST_F(AvbUtilTest, VerifyVBMetaSignatureOutputPublicKeyData) {
     EXPECT_NE(out_public_key_data, expected_public_key_blob);
 }
 
+TEST_F(AvbUtilTest, VerifyVBMetaSignatureRepeated) {
+    const size_t image_size = 10 * 1024 * 1024;
+    const size_t partition_size = 15 * 1024 * 1024;
+    auto signing_key = data_dir_.Append("testkey_rsa4096.pem");
+    auto vbmeta = GenerateImageAndExtractVBMetaData("system", image_size, partition_size,
+                                                    "hashtree", signing_key, "SHA256_RSA4096",
+                                                    10 /* rollback_index */);
+    auto expected_public_key_blob = ExtractPublicKeyAvbBlob(signing_key);
+
+    // A repeated verification of the same image gives the same result and key.
+    for (int i = 0; i < 2; i++) {
+        std::string out_public_key_data;
+        EXPECT_EQ(VBMetaVerifyResult::kSuccess,
+                  VerifyVBMetaSignature(vbmeta, expected_public_key_blob, &out_public_key_data));
+        EXPECT_EQ(out_public_key_data, expected_public_key_blob);
+    }
+
+    // The public key is still checked against the expected one.
+    auto unexpected_public_key_blob = expected_public_key_blob;
+    unexpected_public_key_blob[10] ^= 0x80;
+    EXPECT_EQ(VBMetaVerifyResult::kErrorVerification,
+              VerifyVBMetaSignature(vbmeta, unexpected_public_key_blob,
+                                    nullptr /* out_public_key_data */));
+
+    // A copy of the image with the same content is verified the same way,
+    // with the public key pointing into the copy.
+    VBMetaData vbmeta_copy(vbmeta.data(), vbmeta.size(), "system_copy");
+    std::string out_public_key_data;
+    EXPECT_EQ(VBMetaVerifyResult::kSuccess,
+              VerifyVBMetaSignature(vbmeta_copy, expected_public_key_blob, &out_public_key_data));
+    EXPECT_EQ(out_public_key_data, expected_public_key_blob);
+
+    // Modifying an image after it has been verified is still detected.
+    auto header = vbmeta.GetVBMetaHeader(true /* update_vbmeta_size */);
+    size_t auxiliary_block_offset =
+            sizeof(AvbVBMetaImageHeader) + header->authentication_data_block_size;
+    vbmeta.data()[auxiliary_block_offset] ^= 0x80;
+    EXPECT_EQ(VBMetaVerifyResult::kErrorVerification,
+              VerifyVBMetaSignature(vbmeta, expected_public_key_blob,
+                                    nullptr /* out_public_key_data */));
+    vbmeta.data()[auxiliary_block_offset] ^= 0x80;
+    EXPECT_EQ(VBMetaVerifyResult::kSuccess,
+              VerifyVBMetaSignature(vbmeta, expected_public_key_blob,
+                                    nullptr /* out_public_key_data */));
+}
+
 bool AvbUtilTest::TestVBMetaModification(VBMetaVerifyResult expected_result,
                                          const VBMetaData& vbmeta, size_t offset, size_t length) {
     uint8_t* d = reinterpret_cast<uint8_t*>(vbmeta.data());
@@ -14,6 +14,10 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
 #include <fs_avb/fs_avb_util.h>
 
 #include "fs_avb_test_util.h"
@@ -119,4 +123,47 @@ TEST_F(PublicFsAvbUtilTest, GetHashtreeDescriptor_NotFound) {
     EXPECT_EQ(nullptr, hashtree_desc);
 }
 
+TEST_F(PublicFsAvbUtilTest, BuildHashtree) {
+    // A few blocks over 10MiB, so that the upper levels are partially filled.
+    const size_t system_image_size = 10 * 1024 * 1024 + 12 * 1024;
+    const size_t system_partition_size = 15 * 1024 * 1024;
+    base::FilePath system_path = GenerateImage("system.img", system_image_size);
+
+    AddAvbFooter(system_path, "hashtree", "system", system_partition_size, "SHA256_RSA4096", 10,
+                 data_dir_.Append("testkey_rsa4096.pem"), "d00df00d",
+                 "--hash_algorithm sha256 --internal_release_string \"unit test\"");
+    auto system_vbmeta = ExtractAndLoadVBMetaData(system_path, "system-vbmeta.img");
+    auto hashtree_desc =
+            GetHashtreeDescriptor("system" /* avb_partition_name */, std::move(system_vbmeta));
+    ASSERT_NE(nullptr, hashtree_desc);
+
+    android::base::unique_fd fd(open(system_path.value().c_str(), O_RDWR | O_CLOEXEC));
+    ASSERT_GE(fd, 0);
+    std::string expected_tree(hashtree_desc->tree_size, '\0');
+    ASSERT_TRUE(android::base::ReadFullyAtOffset(fd, expected_tree.data(), expected_tree.size(),
+                                                 hashtree_desc->tree_offset));
+
+    // The tree must not depend on how the blocks are split between threads.
+    for (unsigned int num_threads : {1, 3, 8}) {
+        std::string tree, root_digest;
+        ASSERT_TRUE(BuildHashtree(fd, *hashtree_desc, num_threads, &tree, &root_digest));
+        EXPECT_EQ(hashtree_desc->root_digest, root_digest);
+        EXPECT_TRUE(tree == expected_tree);
+    }
+
+    // Regenerating overwrites a damaged tree with the original.
+    std::string zeroes(hashtree_desc->tree_size, '\0');
+    ASSERT_TRUE(android::base::WriteFullyAtOffset(fd, zeroes.data(), zeroes.size(),
+                                                  hashtree_desc->tree_offset));
+    ASSERT_TRUE(RegenerateHashtree(fd, *hashtree_desc, 0));
+    std::string tree(hashtree_desc->tree_size, '\0');
+    ASSERT_TRUE(android::base::ReadFullyAtOffset(fd, tree.data(), tree.size(),
+                                                 hashtree_desc->tree_offset));
+    EXPECT_TRUE(tree == expected_tree);
+
+    // Nothing is written if the data no longer matches the root digest.
+    ASSERT_TRUE(android::base::WriteFullyAtOffset(fd, zeroes.data(), 4096, 0));
+    EXPECT_FALSE(RegenerateHashtree(fd, *hashtree_desc, 0));
+}
+
 }  // namespace fs_avb_host_test
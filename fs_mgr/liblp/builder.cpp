@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
 
 #include <android-base/unique_fd.h>
@@ -95,8 +96,18 @@ bool ZeroExtent::operator==(const android::fs_mgr::Extent& other) const {
     return other.GetExtentType() == ExtentType::kZero && num_sectors_ == other.num_sectors();
 }
 
+static std::atomic<uint64_t> next_partition_generation = 0;
+
 Partition::Partition(std::string_view name, std::string_view group_name, uint32_t attributes)
-    : name_(name), group_name_(group_name), attributes_(attributes), size_(0) {}
+    : name_(name),
+      group_name_(group_name),
+      attributes_(attributes),
+      size_(0),
+      generation_(++next_partition_generation) {}
+
+void Partition::ExtentsChanged() {
+    generation_ = ++next_partition_generation;
+}
 
 void Partition::AddExtent(std::unique_ptr<Extent>&& extent) {
     size_ += extent->num_sectors() * LP_SECTOR_SIZE;
@@ -116,11 +127,13 @@ void Partition::AddExtent(std::unique_ptr<Extent>&& extent) {
         }
     }
     extents_.push_back(std::move(extent));
+    ExtentsChanged();
 }
 
 void Partition::RemoveExtents() {
     size_ = 0;
     extents_.clear();
+    ExtentsChanged();
 }
 
 void Partition::ShrinkTo(uint64_t aligned_size) {
@@ -144,6 +157,7 @@ void Partition::ShrinkTo(uint64_t aligned_size) {
         extents_.pop_back();
     }
     DCHECK(size_ == aligned_size);
+    ExtentsChanged();
 }
 
 Partition Partition::GetBeginningExtents(uint64_t aligned_size) const {
@@ -582,65 +596,149 @@ void MetadataBuilder::RemovePartition(std::string_view name) {
     }
 }
 
-void MetadataBuilder::ExtentsToFreeList(const std::vector<Interval>& extents,
-                                        std::vector<Interval>* free_regions) const {
-    // Convert the extent list into a list of gaps between the extents; i.e.,
-    // the list of ranges that are free on the disk.
-    for (size_t i = 1; i < extents.size(); i++) {
-        const Interval& previous = extents[i - 1];
-        const Interval& current = extents[i];
-        DCHECK(previous.device_index == current.device_index);
+bool MetadataBuilder::GetFreeRegionBetween(const Interval& previous, const Interval& current,
+                                           Interval* region) const {
+    DCHECK(previous.device_index == current.device_index);
 
-        uint64_t aligned;
-        if (!AlignSector(block_devices_[current.device_index], previous.end, &aligned)) {
-            LERROR << "Sector " << previous.end << " caused integer overflow.";
-            continue;
+    uint64_t aligned;
+    if (!AlignSector(block_devices_[current.device_index], previous.end, &aligned)) {
+        LERROR << "Sector " << previous.end << " caused integer overflow.";
+        return false;
+    }
+    if (aligned >= current.start) {
+        // There is no gap between these two extents. Note that we check with
+        // >= instead of >, since alignment may bump the ending sector past
+        // the beginning of the next extent.
+        return false;
+    }
+
+    // The new interval represents the free space starting at the end of
+    // the previous interval, and ending at the start of the next interval.
+    *region = Interval(current.device_index, aligned, current.start);
+    return true;
+}
+
+void MetadataBuilder::IndexExtent(const Interval& extent) const {
+    auto& allocated = allocation_index_.allocated[extent.device_index];
+    auto& free = allocation_index_.free[extent.device_index];
+
+    // The free region between the neighbors of the new extent is replaced by
+    // the regions on either side of it.
+    auto iter = allocated.emplace(extent);
+    auto next = std::next(iter);
+    Interval region = extent;
+    if (iter != allocated.begin()) {
+        auto prev = std::prev(iter);
+        if (next != allocated.end() && GetFreeRegionBetween(*prev, *next, &region)) {
+            free.erase(free.find(region));
         }
-        if (aligned >= current.start) {
-            // There is no gap between these two extents, try the next one.
-            // Note that we check with >= instead of >, since alignment may
-            // bump the ending sector past the beginning of the next extent.
-            continue;
+        if (GetFreeRegionBetween(*prev, extent, &region)) {
+            free.emplace(region);
         }
+    }
+    if (next != allocated.end() && GetFreeRegionBetween(extent, *next, &region)) {
+        free.emplace(region);
+    }
+}
+
+void MetadataBuilder::UnindexExtent(const Interval& extent) const {
+    auto& allocated = allocation_index_.allocated[extent.device_index];
+    auto& free = allocation_index_.free[extent.device_index];
 
-        // The new interval represents the free space starting at the end of
-        // the previous interval, and ending at the start of the next interval.
-        free_regions->emplace_back(current.device_index, aligned, current.start);
+    auto iter = allocated.find(extent);
+    CHECK(iter != allocated.end());
+    auto next = std::next(iter);
+    Interval region = extent;
+    if (next != allocated.end() && GetFreeRegionBetween(extent, *next, &region)) {
+        free.erase(free.find(region));
+    }
+    if (iter != allocated.begin()) {
+        auto prev = std::prev(iter);
+        if (GetFreeRegionBetween(*prev, extent, &region)) {
+            free.erase(free.find(region));
+        }
+        if (next != allocated.end() && GetFreeRegionBetween(*prev, *next, &region)) {
+            free.emplace(region);
+        }
     }
+    allocated.erase(iter);
 }
 
-auto MetadataBuilder::GetFreeRegions() const -> std::vector<Interval> {
-    std::vector<Interval> free_regions;
+void MetadataBuilder::ResetAllocationIndex() const {
+    auto& index = allocation_index_;
+    index.block_devices = block_devices_;
+    index.allocated.assign(block_devices_.size(), {});
+    index.free.assign(block_devices_.size(), {});
+    index.partitions.clear();
+
+    // Add 0-length intervals for the first and last sectors. This will cause
+    // the space in between to be treated as available.
+    for (size_t i = 0; i < block_devices_.size(); i++) {
+        const auto& block_device = block_devices_[i];
+        uint64_t first_sector = block_device.first_logical_sector;
+        uint64_t last_sector = block_device.size / LP_SECTOR_SIZE;
+        IndexExtent(Interval(i, first_sector, first_sector));
+        IndexExtent(Interval(i, last_sector, last_sector));
+    }
+}
+
+void MetadataBuilder::SyncAllocationIndex() const {
+    auto& index = allocation_index_;
+
+    // Device indices and alignment rarely change, but when they do, every
+    // extent has to be looked at again.
+    if (index.block_devices.size() != block_devices_.size() ||
+        memcmp(index.block_devices.data(), block_devices_.data(),
+               block_devices_.size() * sizeof(LpMetadataBlockDevice))) {
+        ResetAllocationIndex();
+    }
 
-    // Collect all extents in the partition table, per-device, then sort them
-    // by starting sector.
-    std::vector<std::vector<Interval>> device_extents(block_devices_.size());
     for (const auto& partition : partitions_) {
+        auto& entry = index.partitions[partition.get()];
+        if (entry.generation == partition->generation_) {
+            continue;
+        }
+        for (const auto& extent : entry.extents) {
+            UnindexExtent(extent);
+        }
+        entry.extents.clear();
         for (const auto& extent : partition->extents()) {
             LinearExtent* linear = extent->AsLinearExtent();
             if (!linear) {
                 continue;
             }
-            CHECK(linear->device_index() < device_extents.size());
-            auto& extents = device_extents[linear->device_index()];
-            extents.emplace_back(linear->device_index(), linear->physical_sector(),
-                                 linear->physical_sector() + extent->num_sectors());
+            CHECK(linear->device_index() < block_devices_.size());
+            entry.extents.emplace_back(linear->AsInterval());
+            IndexExtent(entry.extents.back());
         }
+        entry.generation = partition->generation_;
     }
 
-    // Add 0-length intervals for the first and last sectors. This will cause
-    // ExtentToFreeList() to treat the space in between as available.
-    for (size_t i = 0; i < device_extents.size(); i++) {
-        auto& extents = device_extents[i];
-        const auto& block_device = block_devices_[i];
+    // Drop partitions that were removed.
+    if (index.partitions.size() != partitions_.size()) {
+        std::set<const Partition*> live;
+        for (const auto& partition : partitions_) {
+            live.emplace(partition.get());
+        }
+        for (auto iter = index.partitions.begin(); iter != index.partitions.end();) {
+            if (live.count(iter->first)) {
+                iter++;
+                continue;
+            }
+            for (const auto& extent : iter->second.extents) {
+                UnindexExtent(extent);
+            }
+            iter = index.partitions.erase(iter);
+        }
+    }
+}
 
-        uint64_t first_sector = block_device.first_logical_sector;
-        uint64_t last_sector = block_device.size / LP_SECTOR_SIZE;
-        extents.emplace_back(i, first_sector, first_sector);
-        extents.emplace_back(i, last_sector, last_sector);
+auto MetadataBuilder::GetFreeRegions() const -> std::vector<Interval> {
+    SyncAllocationIndex();
 
-        std::sort(extents.begin(), extents.end());
-        ExtentsToFreeList(extents, &free_regions);
+    std::vector<Interval> free_regions;
+    for (const auto& regions : allocation_index_.free) {
+        free_regions.insert(free_regions.end(), regions.begin(), regions.end());
     }
     return free_regions;
 }
@@ -854,15 +952,22 @@ bool MetadataBuilder::IsAnyRegionCovered(const std::vector<Interval>& regions,
 }
 
 bool MetadataBuilder::IsAnyRegionAllocated(const LinearExtent& candidate) const {
-    for (const auto& partition : partitions_) {
-        for (const auto& extent : partition->extents()) {
-            LinearExtent* linear = extent->AsLinearExtent();
-            if (!linear) {
-                continue;
-            }
-            if (linear->OverlapsWith(candidate)) {
-                return true;
-            }
+    SyncAllocationIndex();
+    if (candidate.device_index() >= allocation_index_.allocated.size()) {
+        return false;
+    }
+
+    // Extents do not overlap each other, so only the last one starting before
+    // the candidate, and those starting inside it, can overlap it.
+    const auto& allocated = allocation_index_.allocated[candidate.device_index()];
+    auto iter = allocated.lower_bound(
+            Interval(candidate.device_index(), candidate.physical_sector(), 0));
+    if (iter != allocated.begin()) {
+        iter--;
+    }
+    for (; iter != allocated.end() && iter->start < candidate.end_sector(); iter++) {
+        if (iter->length() && candidate.OverlapsWith(*iter)) {
+            return true;
         }
     }
     return false;
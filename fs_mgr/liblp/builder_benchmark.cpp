@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <liblp/builder.h>
+
+using namespace android::fs_mgr;
+
+static constexpr uint64_t kSuperSize = 64ULL * 1024 * 1024 * 1024;
+static constexpr uint64_t kGrowSize = 1024 * 1024;
+static constexpr int kRounds = 8;
+
+static std::unique_ptr<MetadataBuilder> NewBuilder(int num_partitions,
+                                                   std::vector<Partition*>* partitions) {
+    BlockDeviceInfo super("super", kSuperSize, kDefaultPartitionAlignment, 0, kDefaultBlockSize);
+    auto builder = MetadataBuilder::New({super}, "super", 256 * 1024, 2);
+    for (int i = 0; i < num_partitions; i++) {
+        partitions->emplace_back(builder->AddPartition("p" + std::to_string(i), 0));
+    }
+    return builder;
+}
+
+// Grow every partition round-robin, so that each step adds an extent, like
+// COW partitions being carved out of a fragmented super.
+static void BM_GrowFragmented(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<Partition*> partitions;
+        auto builder = NewBuilder(state.range(0), &partitions);
+        state.ResumeTiming();
+
+        for (int round = 0; round < kRounds; round++) {
+            for (auto partition : partitions) {
+                builder->ResizePartition(partition, partition->size() + kGrowSize);
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * kRounds);
+}
+BENCHMARK(BM_GrowFragmented)->Arg(100)->Arg(500)->Arg(1000);
+
+// Free every other extent and allocate into the holes.
+static void BM_RefillHoles(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<Partition*> partitions;
+        auto builder = NewBuilder(state.range(0), &partitions);
+        for (int round = 0; round < kRounds; round++) {
+            for (auto partition : partitions) {
+                builder->ResizePartition(partition, partition->size() + kGrowSize);
+            }
+        }
+        for (size_t i = 0; i < partitions.size(); i += 2) {
+            builder->ResizePartition(partitions[i], 0);
+        }
+        state.ResumeTiming();
+
+        for (size_t i = 0; i < partitions.size(); i += 2) {
+            builder->ResizePartition(partitions[i], kGrowSize * kRounds);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) / 2);
+}
+BENCHMARK(BM_RefillHoles)->Arg(100)->Arg(500)->Arg(1000);
+
+BENCHMARK_MAIN();
@@ -1051,6 +1051,43 @@ TEST_F(BuilderTest, AlignFreeRegion) {
     EXPECT_EQ(e2->end_sector(), 4197368);
 }
 
+TEST_F(BuilderTest, FreeRegionsTrackExtentChanges) {
+    BlockDeviceInfo super("super", 1_GiB, 4096, 0, 4096);
+    unique_ptr<MetadataBuilder> builder = MetadataBuilder::New({super}, "super", 65536, 2);
+    ASSERT_NE(builder, nullptr);
+
+    auto regions = builder->GetFreeRegions();
+    ASSERT_EQ(regions.size(), 1);
+    const uint64_t first = regions[0].start;
+    const uint64_t last = regions[0].end;
+    auto expect_regions = [&](std::vector<std::pair<uint64_t, uint64_t>> expected) {
+        std::vector<std::pair<uint64_t, uint64_t>> actual;
+        for (const auto& region : builder->GetFreeRegions()) {
+            actual.emplace_back(region.start, region.end);
+        }
+        EXPECT_EQ(actual, expected);
+    };
+
+    Partition* a = builder->AddPartition("a", 0);
+    Partition* b = builder->AddPartition("b", 0);
+    Partition* c = builder->AddPartition("c", 0);
+    ASSERT_TRUE(builder->ResizePartition(a, 1_MiB));
+    ASSERT_TRUE(builder->ResizePartition(b, 1_MiB));
+    ASSERT_TRUE(builder->ResizePartition(c, 1_MiB));
+    expect_regions({{first + 6144, last}});
+
+    builder->RemovePartition("b");
+    expect_regions({{first + 2048, first + 4096}, {first + 6144, last}});
+
+    // Extents changed through the partition are picked up too.
+    a->RemoveExtents();
+    expect_regions({{first, first + 4096}, {first + 6144, last}});
+
+    ASSERT_TRUE(builder->ResizePartition(c, 2_MiB));
+    ASSERT_EQ(c->extents().size(), 2);
+    expect_regions({{first + 2048, first + 4096}, {first + 6144, last}});
+}
+
 TEST_F(BuilderTest, ResizeOverflow) {
     BlockDeviceInfo super("super", 8_GiB, 786432, 229376, 4096);
     std::vector<BlockDeviceInfo> block_devices = {super};
@@ -19,6 +19,9 @@
 #include <limits.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <future>
+
 #include <android-base/file.h>
 
 #include "reader.h"
@@ -238,7 +241,7 @@ bool ImageBuilder::AddData(sparse_file* file, const std::string& blob, uint64_t
     return true;
 }
 
-bool ImageBuilder::SectorToBlock(uint64_t sector, uint32_t* block) {
+bool ImageBuilder::SectorToBlock(uint64_t sector, uint32_t* block) const {
     // The caller must ensure that the metadata has an alignment that is a
     // multiple of the block size. liblp will take care of the rest, ensuring
     // that all partitions are on an aligned boundary. Therefore all writes
@@ -282,14 +285,13 @@ bool ImageBuilder::Build() {
         return false;
     }
 
+    std::vector<PartitionImage> images;
     for (const auto& partition : metadata_.partitions) {
         auto iter = images_.find(GetPartitionName(partition));
         if (iter == images_.end()) {
             continue;
         }
-        if (!AddPartitionImage(partition, iter->second)) {
-            return false;
-        }
+        images.emplace_back(PartitionImage{.partition = &partition, .file = iter->second});
         images_.erase(iter);
     }
 
@@ -297,10 +299,34 @@ bool ImageBuilder::Build() {
         LERROR << "Partition image was specified but no partition was found.";
         return false;
     }
+
+    // Reading every block of the images is most of the work, and the images
+    // don't depend on each other, so they are read at the same time. The
+    // sparse files are then filled in one image after another.
+    std::vector<std::future<bool>> results;
+    for (auto& image : images) {
+        results.emplace_back(
+                std::async(std::launch::async, &ImageBuilder::ReadPartitionImage, this, &image));
+    }
+    bool ok = true;
+    for (auto& result : results) {
+        ok &= result.get();
+    }
+    if (!ok) {
+        return false;
+    }
+
+    for (auto& image : images) {
+        if (!AddPartitionImage(image)) {
+            return false;
+        }
+        // The sparse files refer to the image, so keep it open.
+        temp_fds_.emplace_back(std::move(image.fd));
+    }
     return true;
 }
 
-static inline bool HasFillValue(uint32_t* buffer, size_t count) {
+static inline bool HasFillValue(const uint32_t* buffer, size_t count) {
     uint32_t fill_value = buffer[0];
     for (size_t i = 1; i < count; i++) {
         if (fill_value != buffer[i]) {
@@ -310,104 +336,133 @@ static inline bool HasFillValue(uint32_t* buffer, size_t count) {
     return true;
 }
 
-bool ImageBuilder::AddPartitionImage(const LpMetadataPartition& partition,
-                                     const std::string& file) {
+// Appends a run of bytes to the chunk list, merging it into the last chunk
+// if both are data, or both are filled with the same value.
+void ImageBuilder::AppendChunk(std::vector<Chunk>* chunks, const Chunk& chunk) {
+    if (!chunks->empty()) {
+        auto& last = chunks->back();
+        if (last.offset + last.length == chunk.offset && last.is_fill == chunk.is_fill &&
+            (!chunk.is_fill || last.fill_value == chunk.fill_value)) {
+            last.length += chunk.length;
+            return;
+        }
+    }
+    chunks->emplace_back(chunk);
+}
+
+bool ImageBuilder::ReadPartitionImage(PartitionImage* image) const {
+    const LpMetadataPartition& partition = *image->partition;
     if (partition.num_extents == 0) {
         LERROR << "Partition size is zero: " << GetPartitionName(partition);
         return false;
     }
 
-    // Track which extent we're processing.
-    uint32_t extent_index = partition.first_extent_index;
-
-    const LpMetadataExtent& extent = metadata_.extents[extent_index];
+    const LpMetadataExtent& extent = metadata_.extents[partition.first_extent_index];
     if (extent.target_type != LP_TARGET_TYPE_LINEAR) {
         LERROR << "Partition should only have linear extents: " << GetPartitionName(partition);
         return false;
     }
 
-    int fd = OpenImageFile(file);
-    if (fd < 0) {
+    image->fd = OpenImageFile(image->file);
+    if (image->fd < 0) {
         LERROR << "Could not open image for partition: " << GetPartitionName(partition);
         return false;
     }
 
     // Make sure the image does not exceed the partition size.
-    uint64_t file_length;
-    if (!GetDescriptorSize(fd, &file_length)) {
+    if (!GetDescriptorSize(image->fd, &image->length)) {
         LERROR << "Could not compute image size";
         return false;
     }
     uint64_t partition_size = ComputePartitionSize(partition);
-    if (file_length > partition_size) {
+    if (image->length > partition_size) {
         LERROR << "Image for partition '" << GetPartitionName(partition)
-               << "' is greater than its size (" << file_length << ", expected " << partition_size
-               << ")";
-        return false;
-    }
-    if (SeekFile64(fd, 0, SEEK_SET)) {
-        PERROR << "lseek failed";
+               << "' is greater than its size (" << image->length << ", expected "
+               << partition_size << ")";
         return false;
     }
 
-    // We track the current logical sector and the position the current extent
-    // ends at.
-    uint64_t output_sector = 0;
-    uint64_t extent_last_sector = extent.num_sectors;
+    // Read many blocks at a time, and look at each block to see whether it
+    // can be stored as a fill. A trailing partial block is always data.
+    static constexpr size_t kReadSize = 1024 * 1024;
+    size_t words_per_block = block_size_ / sizeof(uint32_t);
+    size_t blocks_per_read = std::max<size_t>(1, kReadSize / block_size_);
+    auto buffer = std::make_unique<uint32_t[]>(blocks_per_read * words_per_block);
 
-    // We also track the output device and the current output block within that
-    // device.
-    uint32_t output_block;
-    if (!SectorToBlock(extent.target_data, &output_block)) {
-        return false;
+    uint64_t pos = 0;
+    while (pos < image->length) {
+        size_t read_size = std::min<uint64_t>(blocks_per_read * block_size_, image->length - pos);
+        if (!android::base::ReadFullyAtOffset(image->fd, buffer.get(), read_size, pos)) {
+            PERROR << "read failed";
+            return false;
+        }
+        for (size_t offset = 0; offset < read_size; offset += block_size_) {
+            size_t size = std::min<size_t>(block_size_, read_size - offset);
+            const uint32_t* block = buffer.get() + offset / sizeof(uint32_t);
+            bool is_fill = size == block_size_ && HasFillValue(block, words_per_block);
+            AppendChunk(&image->chunks, {.offset = pos + offset,
+                                         .length = size,
+                                         .is_fill = is_fill,
+                                         .fill_value = is_fill ? block[0] : 0});
+        }
+        pos += read_size;
     }
-    sparse_file* output_device = device_images_[extent.target_source].get();
+    return true;
+}
 
-    // Proceed to read the file and build sparse images.
-    uint64_t pos = 0;
-    uint64_t remaining = file_length;
-    while (remaining) {
-        // Check if we need to advance to the next extent.
-        if (output_sector == extent_last_sector) {
-            extent_index++;
-            if (extent_index >= partition.first_extent_index + partition.num_extents) {
-                LERROR << "image is larger than extent table";
-                return false;
-            }
+bool ImageBuilder::AddPartitionImage(const PartitionImage& image) {
+    const LpMetadataPartition& partition = *image.partition;
 
-            const LpMetadataExtent& extent = metadata_.extents[extent_index];
-            extent_last_sector += extent.num_sectors;
-            output_device = device_images_[extent.target_source].get();
-            if (!SectorToBlock(extent.target_data, &output_block)) {
-                return false;
+    // Track which extent we're processing, and the range of the image that
+    // it covers.
+    uint32_t extent_index = partition.first_extent_index;
+    const LpMetadataExtent* extent = &metadata_.extents[extent_index];
+    uint64_t extent_begin = 0;
+    uint64_t extent_end = extent->num_sectors * LP_SECTOR_SIZE;
+
+    for (const auto& chunk : image.chunks) {
+        uint64_t pos = chunk.offset;
+        uint64_t remaining = chunk.length;
+        while (remaining) {
+            // Check if we need to advance to the next extent. Extents are
+            // block aligned, so this only ever splits a chunk between blocks.
+            if (pos == extent_end) {
+                extent_index++;
+                if (extent_index >= partition.first_extent_index + partition.num_extents) {
+                    LERROR << "image is larger than extent table";
+                    return false;
+                }
+                extent = &metadata_.extents[extent_index];
+                extent_begin = extent_end;
+                extent_end += extent->num_sectors * LP_SECTOR_SIZE;
             }
-        }
 
-        uint32_t buffer[block_size_ / sizeof(uint32_t)];
-        size_t read_size = remaining >= sizeof(buffer) ? sizeof(buffer) : size_t(remaining);
-        if (!android::base::ReadFully(fd, buffer, sizeof(buffer))) {
-            PERROR << "read failed";
-            return false;
-        }
-        if (read_size != sizeof(buffer) || !HasFillValue(buffer, read_size / sizeof(uint32_t))) {
-            int rv = sparse_file_add_fd(output_device, fd, pos, read_size, output_block);
-            if (rv) {
-                LERROR << "sparse_file_add_fd failed with code: " << rv;
+            uint32_t output_block;
+            if (!SectorToBlock(extent->target_data + (pos - extent_begin) / LP_SECTOR_SIZE,
+                               &output_block)) {
                 return false;
             }
-        } else {
-            int rv = sparse_file_add_fill(output_device, buffer[0], read_size, output_block);
-            if (rv) {
-                LERROR << "sparse_file_add_fill failed with code: " << rv;
-                return false;
+            sparse_file* output_device = device_images_[extent->target_source].get();
+
+            uint64_t size = std::min(remaining, extent_end - pos);
+            if (chunk.is_fill) {
+                int rv = sparse_file_add_fill(output_device, chunk.fill_value, size, output_block);
+                if (rv) {
+                    LERROR << "sparse_file_add_fill failed with code: " << rv;
+                    return false;
+                }
+            } else {
+                int rv = sparse_file_add_fd(output_device, image.fd.get(), pos, size,
+                                            output_block);
+                if (rv) {
+                    LERROR << "sparse_file_add_fd failed with code: " << rv;
+                    return false;
+                }
             }
+            pos += size;
+            remaining -= size;
         }
-        pos += read_size;
-        remaining -= read_size;
-        output_sector += block_size_ / LP_SECTOR_SIZE;
-        output_block++;
     }
-
     return true;
 }
 
@@ -447,34 +502,31 @@ bool ImageBuilder::CheckExtentOrdering() {
     return true;
 }
 
-int ImageBuilder::OpenImageFile(const std::string& file) {
+unique_fd ImageBuilder::OpenImageFile(const std::string& file) const {
     unique_fd source_fd = GetControlFileOrOpen(file.c_str(), O_RDONLY | O_CLOEXEC | O_BINARY);
     if (source_fd < 0) {
         PERROR << "open image file failed: " << file;
-        return -1;
+        return {};
     }
 
     SparsePtr source(sparse_file_import(source_fd, true, true), sparse_file_destroy);
     if (!source) {
-        int fd = source_fd.get();
-        temp_fds_.push_back(std::move(source_fd));
-        return fd;
+        return source_fd;
     }
 
     TemporaryFile tf;
     if (tf.fd < 0) {
         PERROR << "make temporary file failed";
-        return -1;
+        return {};
     }
 
     // We temporarily unsparse the file, rather than try to merge its chunks.
     int rv = sparse_file_write(source.get(), tf.fd, false, false, false);
     if (rv) {
         LERROR << "sparse_file_write failed with code: " << rv;
-        return -1;
+        return {};
     }
-    temp_fds_.push_back(android::base::unique_fd(tf.release()));
-    return temp_fds_.back().get();
+    return unique_fd(tf.release());
 }
 
 bool WriteToImageFile(const std::string& file, const LpMetadata& metadata, uint32_t block_size,
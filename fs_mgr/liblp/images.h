@@ -18,6 +18,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 #include <liblp/liblp.h>
@@ -47,10 +48,32 @@ class ImageBuilder {
     const std::vector<SparsePtr>& device_images() const { return device_images_; }
 
   private:
+    // A run of bytes in a partition image that is either data, or whole
+    // blocks all filled with the same 32-bit value.
+    struct Chunk {
+        uint64_t offset;
+        uint64_t length;
+        bool is_fill;
+        uint32_t fill_value;
+    };
+
+    // A partition image, read and split into chunks ahead of being added to
+    // the sparse files.
+    struct PartitionImage {
+        const LpMetadataPartition* partition;
+        std::string file;
+        android::base::unique_fd fd;
+        uint64_t length = 0;
+        std::vector<Chunk> chunks;
+    };
+
+    static void AppendChunk(std::vector<Chunk>* chunks, const Chunk& chunk);
+
     bool AddData(sparse_file* file, const std::string& blob, uint64_t sector);
-    bool AddPartitionImage(const LpMetadataPartition& partition, const std::string& file);
-    int OpenImageFile(const std::string& file);
-    bool SectorToBlock(uint64_t sector, uint32_t* block);
+    bool ReadPartitionImage(PartitionImage* image) const;
+    bool AddPartitionImage(const PartitionImage& image);
+    android::base::unique_fd OpenImageFile(const std::string& file) const;
+    bool SectorToBlock(uint64_t sector, uint32_t* block) const;
     uint64_t BlockToSector(uint64_t block) const;
     bool CheckExtentOrdering();
     uint64_t ComputePartitionSize(const LpMetadataPartition& partition) const;
@@ -25,6 +25,7 @@
 #include <optional>
 #include <set>
 #include <string_view>
+#include <unordered_map>
 
 #include "liblp.h"
 #include "partition_opener.h"
@@ -155,12 +156,15 @@ class Partition final {
   private:
     void ShrinkTo(uint64_t aligned_size);
     void set_group_name(std::string_view group_name) { group_name_ = group_name; }
+    void ExtentsChanged();
 
     std::string name_;
     std::string group_name_;
     std::vector<std::unique_ptr<Extent>> extents_;
     uint32_t attributes_;
     uint64_t size_;
+    // Unique across all partitions, and changed whenever extents_ is.
+    uint64_t generation_;
 };
 
 // An interval in the metadata. This is similar to a LinearExtent with one difference.
@@ -406,13 +410,34 @@ class MetadataBuilder {
     bool IsAnyRegionCovered(const std::vector<Interval>& regions,
                             const LinearExtent& candidate) const;
     bool IsAnyRegionAllocated(const LinearExtent& candidate) const;
-    void ExtentsToFreeList(const std::vector<Interval>& extents,
-                           std::vector<Interval>* free_regions) const;
     std::vector<Interval> PrioritizeSecondHalfOfSuper(const std::vector<Interval>& free_list);
     std::unique_ptr<LinearExtent> ExtendFinalExtent(Partition* partition,
                                                     const std::vector<Interval>& free_list,
                                                     uint64_t sectors_needed) const;
 
+    // Linear extents, and the free regions between them, of every block
+    // device. Partitions whose extents changed since the last call to
+    // SyncAllocationIndex() are re-indexed, so that allocating does not need
+    // to collect and sort every extent in the table again.
+    struct AllocationIndex {
+        struct Entry {
+            uint64_t generation;
+            std::vector<Interval> extents;
+        };
+        std::vector<LpMetadataBlockDevice> block_devices;
+        // Per device, including 0-length intervals at the first and last
+        // usable sectors, as in GetFreeRegions().
+        std::vector<std::multiset<Interval>> allocated;
+        std::vector<std::multiset<Interval>> free;
+        std::unordered_map<const Partition*, Entry> partitions;
+    };
+    void SyncAllocationIndex() const;
+    void ResetAllocationIndex() const;
+    void IndexExtent(const Interval& extent) const;
+    void UnindexExtent(const Interval& extent) const;
+    bool GetFreeRegionBetween(const Interval& previous, const Interval& current,
+                              Interval* region) const;
+
     static bool UpdateMetadataForOtherSuper(LpMetadata* metadata, uint32_t source_slot_number,
                                             uint32_t target_slot_number);
 
@@ -422,6 +447,7 @@ class MetadataBuilder {
     std::vector<std::unique_ptr<PartitionGroup>> groups_;
     std::vector<LpMetadataBlockDevice> block_devices_;
     bool auto_slot_suffixing_;
+    mutable AllocationIndex allocation_index_;
 };
 
 // Read BlockDeviceInfo for a given block device. This always returns false
@@ -64,6 +64,13 @@ bool UpdatePartitionTable(const IPartitionOpener& opener, const std::string& sup
 std::unique_ptr<LpMetadata> ReadMetadata(const IPartitionOpener& opener,
                                          const std::string& super_partition, uint32_t slot_number);
 
+// ReadMetadata() keeps the last metadata it read from each block device and
+// slot. Later reads of that slot still read the geometry and the metadata
+// header, which carries the checksum of the tables, and only reuse the cached
+// tables if both are unchanged. Writes by other processes are therefore seen
+// as usual. The cache is enabled by default.
+void SetMetadataCacheEnabled(bool enabled);
+
 // Helper functions that use the default PartitionOpener.
 bool FlashPartitionTable(const std::string& super_partition, const LpMetadata& metadata);
 bool UpdatePartitionTable(const std::string& super_partition, const LpMetadata& metadata,
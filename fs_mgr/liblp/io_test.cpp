@@ -367,6 +367,46 @@ TEST_F(LiblpTest, ReadBackupMetadata) {
     EXPECT_EQ(ReadMetadata(opener, "super", 0), nullptr);
 }
 
+// Test that a cached copy is used only while the on-disk header is unchanged.
+TEST_F(LiblpTest, ReadCachedMetadata) {
+    unique_fd fd = CreateFlashedDisk();
+    ASSERT_GE(fd, 0);
+
+    DefaultPartitionOpener opener(fd);
+
+    unique_ptr<LpMetadata> metadata = ReadMetadata(opener, "super", 0);
+    ASSERT_NE(metadata, nullptr);
+
+    // Updates are seen.
+    ASSERT_EQ(metadata->partitions.size(), 1);
+    strncpy(metadata->partitions[0].name, "vendor", sizeof(metadata->partitions[0].name));
+    ASSERT_TRUE(UpdatePartitionTable(opener, "super", *metadata.get(), 0));
+    metadata = ReadMetadata(opener, "super", 0);
+    ASSERT_NE(metadata, nullptr);
+    ASSERT_EQ(metadata->partitions.size(), 1);
+    EXPECT_EQ(GetPartitionName(metadata->partitions[0]), "vendor");
+
+    // Damage both copies of the tables, but not the headers. Only the cached
+    // tables can pass the checksum now.
+    const auto& header = metadata->header;
+    ssize_t damage = header.header_size + header.tables_size - sizeof(LpMetadataHeader);
+    ASSERT_GT(damage, 0);
+    std::vector<char> corruption(damage, 0xff);
+    for (off_t offset : {GetPrimaryMetadataOffset(metadata->geometry, 0),
+                         GetBackupMetadataOffset(metadata->geometry, 0)}) {
+        ASSERT_GE(lseek(fd, offset + sizeof(LpMetadataHeader), SEEK_SET), 0);
+        ASSERT_TRUE(android::base::WriteFully(fd, corruption.data(), corruption.size()));
+    }
+    metadata = ReadMetadata(opener, "super", 0);
+    ASSERT_NE(metadata, nullptr);
+    ASSERT_EQ(metadata->partitions.size(), 1);
+    EXPECT_EQ(GetPartitionName(metadata->partitions[0]), "vendor");
+
+    SetMetadataCacheEnabled(false);
+    EXPECT_EQ(ReadMetadata(opener, "super", 0), nullptr);
+    SetMetadataCacheEnabled(true);
+}
+
 // Test that we don't attempt to write metadata if it would overflow its
 // reserved space.
 TEST_F(LiblpTest, TooManyPartitions) {
@@ -507,10 +547,12 @@ TEST_F(LiblpTest, UpdatePrimaryMetadataFailure) {
 
     BadWriter writer;
 
-    // Read and write it back.
+    // Read, change, and write it back. Identical tables are not rewritten.
     writer.FailOnWrite(1);
     unique_ptr<LpMetadata> imported = ReadMetadata(opener, "super", 0);
     ASSERT_NE(imported, nullptr);
+    ASSERT_GE(imported->partitions.size(), 1);
+    imported->partitions[0].name[0]++;
     ASSERT_FALSE(UpdatePartitionTable(opener, "super", *imported.get(), 0, writer));
 
     // We should still be able to read the backup copy.
@@ -520,6 +562,7 @@ TEST_F(LiblpTest, UpdatePrimaryMetadataFailure) {
     // Flash again, this time fail the backup copy. We should still be able
     // to read the primary.
     writer.FailOnWrite(3);
+    imported->partitions[0].name[0]++;
     ASSERT_FALSE(UpdatePartitionTable(opener, "super", *imported.get(), 0, writer));
     imported = ReadMetadata(opener, "super", 0);
     ASSERT_NE(imported, nullptr);
@@ -535,10 +578,12 @@ TEST_F(LiblpTest, UpdateBackupMetadataFailure) {
 
     BadWriter writer;
 
-    // Read and write it back.
+    // Read, change, and write it back. Identical tables are not rewritten.
     writer.FailOnWrite(2);
     unique_ptr<LpMetadata> imported = ReadMetadata(opener, "super", 0);
     ASSERT_NE(imported, nullptr);
+    ASSERT_GE(imported->partitions.size(), 1);
+    imported->partitions[0].name[0]++;
     ASSERT_FALSE(UpdatePartitionTable(opener, "super", *imported.get(), 0, writer));
 
     // We should still be able to read the primary copy.
@@ -548,6 +593,7 @@ TEST_F(LiblpTest, UpdateBackupMetadataFailure) {
     // Flash again, this time fail the primary copy. We should still be able
     // to read the primary.
     writer.FailOnWrite(2);
+    imported->partitions[0].name[0]++;
     ASSERT_FALSE(UpdatePartitionTable(opener, "super", *imported.get(), 0, writer));
     imported = ReadMetadata(opener, "super", 0);
     ASSERT_NE(imported, nullptr);
@@ -592,6 +638,27 @@ TEST_F(LiblpTest, UpdateMetadataCleanFailure) {
     ASSERT_EQ(GetPartitionName(new_table->partitions[0]), GetPartitionName(imported->partitions[0]));
 }
 
+// Test that committing an unchanged table does not write to the device.
+TEST_F(LiblpTest, UpdateUnchangedMetadata) {
+    unique_fd fd = CreateFlashedDisk();
+    ASSERT_GE(fd, 0);
+
+    DefaultPartitionOpener opener(fd);
+
+    BadWriter writer;
+
+    unique_ptr<LpMetadata> imported = ReadMetadata(opener, "super", 0);
+    ASSERT_NE(imported, nullptr);
+    writer.FailOnWrite(1);
+    ASSERT_TRUE(UpdatePartitionTable(opener, "super", *imported.get(), 0, writer));
+
+    // A change to the table is still written.
+    ASSERT_GE(imported->partitions.size(), 1);
+    imported->partitions[0].name[0]++;
+    writer.FailOnWrite(1);
+    ASSERT_FALSE(UpdatePartitionTable(opener, "super", *imported.get(), 0, writer));
+}
+
 // Test that writing a sparse image can be read back.
 TEST_F(LiblpTest, FlashSparseImage) {
     unique_fd fd = CreateFakeDisk();
@@ -627,6 +694,64 @@ TEST_F(LiblpTest, FlashSparseImage) {
     ASSERT_NE(ReadBackupMetadata(fd.get(), geometry, 0), nullptr);
 }
 
+// Test that partition images come out at their extents, for both data and
+// fill blocks.
+TEST_F(LiblpTest, FlashSparseImageWithPartitions) {
+    unique_fd fd = CreateFakeDisk();
+    ASSERT_GE(fd, 0);
+
+    BlockDeviceInfo device_info("super", kDiskSize, 0, 0, 512);
+    unique_ptr<MetadataBuilder> builder =
+            MetadataBuilder::New(device_info, kMetadataSize, kMetadataSlots);
+    ASSERT_NE(builder, nullptr);
+    ASSERT_TRUE(AddDefaultPartitions(builder.get()));
+    Partition* vendor = builder->AddPartition("vendor", LP_PARTITION_ATTR_NONE);
+    ASSERT_NE(vendor, nullptr);
+    ASSERT_TRUE(builder->ResizePartition(vendor, 8 * 1024));
+
+    unique_ptr<LpMetadata> exported = builder->Export();
+    ASSERT_NE(exported, nullptr);
+
+    // Data blocks between runs of zero and non-zero fill blocks.
+    std::string system_data(24 * 1024, '\0');
+    std::fill(system_data.begin() + 4096, system_data.begin() + 6144, 'x');
+    for (size_t i = 10000; i < 12000; i++) {
+        system_data[i] = static_cast<char>(i);
+    }
+    std::string vendor_data(6 * 1024, 'v');
+    vendor_data.back() = 'e';
+
+    TemporaryFile system_image, vendor_image;
+    ASSERT_TRUE(android::base::WriteStringToFd(system_data, system_image.fd));
+    ASSERT_TRUE(android::base::WriteStringToFd(vendor_data, vendor_image.fd));
+
+    ImageBuilder sparse(*exported.get(), 512,
+                        {{"system", system_image.path}, {"vendor", vendor_image.path}},
+                        true /* sparsify */);
+    ASSERT_TRUE(sparse.IsValid());
+    ASSERT_TRUE(sparse.Build());
+
+    const auto& images = sparse.device_images();
+    ASSERT_EQ(images.size(), static_cast<size_t>(1));
+    ASSERT_NE(lseek(fd.get(), 0, SEEK_SET), -1);
+    ASSERT_EQ(sparse_file_write(images[0].get(), fd.get(), false, false, false), 0);
+
+    for (const auto& [name, data] : {std::pair{"system", &system_data}, {"vendor", &vendor_data}}) {
+        const LpMetadataPartition* partition = nullptr;
+        for (const auto& p : exported->partitions) {
+            if (GetPartitionName(p) == name) partition = &p;
+        }
+        ASSERT_NE(partition, nullptr);
+        ASSERT_EQ(partition->num_extents, 1);
+        const auto& extent = exported->extents[partition->first_extent_index];
+
+        std::string contents(data->size(), '\0');
+        ASSERT_TRUE(android::base::ReadFullyAtOffset(fd, contents.data(), contents.size(),
+                                                     extent.target_data * LP_SECTOR_SIZE));
+        EXPECT_EQ(contents, *data) << name;
+    }
+}
+
 TEST_F(LiblpTest, AutoSlotSuffixing) {
     unique_ptr<MetadataBuilder> builder = CreateDefaultBuilder();
     ASSERT_NE(builder, nullptr);
@@ -19,9 +19,13 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <functional>
+#include <map>
+#include <mutex>
+#include <tuple>
 
 #include <android-base/file.h>
 #include <android-base/unique_fd.h>
@@ -434,8 +438,80 @@ bool AdjustMetadataForSlot(LpMetadata* metadata, uint32_t slot_number) {
     return true;
 }
 
+// Metadata last read from a given super device and slot, along with the
+// on-disk bytes it was validated against.
+using MetadataCacheKey = std::tuple<dev_t, ino_t, uint32_t>;
+struct MetadataCacheEntry {
+    LpMetadataGeometry geometry;
+    uint8_t header[sizeof(LpMetadataHeader)];
+    LpMetadata metadata;
+};
+
+std::mutex metadata_cache_lock;
+bool metadata_cache_enabled = true;
+std::map<MetadataCacheKey, MetadataCacheEntry> metadata_cache;
+
+bool GetMetadataCacheKey(int fd, uint32_t slot_number, MetadataCacheKey* key) {
+    struct stat s;
+    if (fstat(fd, &s) < 0) {
+        return false;
+    }
+    // Different nodes of the same block device share the cache.
+    if (S_ISBLK(s.st_mode)) {
+        *key = {s.st_rdev, 0, slot_number};
+    } else {
+        *key = {s.st_dev, s.st_ino, slot_number};
+    }
+    return true;
+}
+
+// Read the raw bytes of the primary metadata header. For older, shorter headers
+// this includes the start of the tables, which is harmless.
+bool ReadRawPrimaryHeader(int fd, const LpMetadataGeometry& geometry, uint32_t slot_number,
+                          uint8_t* header) {
+    int64_t offset = GetPrimaryMetadataOffset(geometry, slot_number);
+    if (SeekFile64(fd, offset, SEEK_SET) < 0) {
+        return false;
+    }
+    return android::base::ReadFully(fd, header, sizeof(LpMetadataHeader));
+}
+
+std::unique_ptr<LpMetadata> FindCachedMetadata(const MetadataCacheKey& key,
+                                               const LpMetadataGeometry& geometry,
+                                               const uint8_t* header) {
+    std::lock_guard<std::mutex> guard(metadata_cache_lock);
+    auto iter = metadata_cache.find(key);
+    if (iter == metadata_cache.end()) {
+        return nullptr;
+    }
+    const auto& entry = iter->second;
+    if (memcmp(&entry.geometry, &geometry, sizeof(geometry)) != 0 ||
+        memcmp(entry.header, header, sizeof(entry.header)) != 0) {
+        metadata_cache.erase(iter);
+        return nullptr;
+    }
+    return std::make_unique<LpMetadata>(entry.metadata);
+}
+
+void AddCachedMetadata(const MetadataCacheKey& key, const LpMetadataGeometry& geometry,
+                       const uint8_t* header, const LpMetadata& metadata) {
+    std::lock_guard<std::mutex> guard(metadata_cache_lock);
+    auto& entry = metadata_cache[key];
+    entry.geometry = geometry;
+    memcpy(entry.header, header, sizeof(entry.header));
+    entry.metadata = metadata;
+}
+
 }  // namespace
 
+void SetMetadataCacheEnabled(bool enabled) {
+    std::lock_guard<std::mutex> guard(metadata_cache_lock);
+    metadata_cache_enabled = enabled;
+    if (!enabled) {
+        metadata_cache.clear();
+    }
+}
+
 std::unique_ptr<LpMetadata> ReadMetadata(const IPartitionOpener& opener,
                                          const std::string& super_partition, uint32_t slot_number) {
     android::base::unique_fd fd = opener.Open(super_partition, O_RDONLY);
@@ -453,6 +529,21 @@ std::unique_ptr<LpMetadata> ReadMetadata(const IPartitionOpener& opener,
         return nullptr;
     }
 
+    MetadataCacheKey cache_key;
+    uint8_t header[sizeof(LpMetadataHeader)];
+    bool cacheable;
+    {
+        std::lock_guard<std::mutex> guard(metadata_cache_lock);
+        cacheable = metadata_cache_enabled;
+    }
+    cacheable = cacheable && GetMetadataCacheKey(fd, slot_number, &cache_key) &&
+                ReadRawPrimaryHeader(fd, geometry, slot_number, header);
+    if (cacheable) {
+        if (auto metadata = FindCachedMetadata(cache_key, geometry, header)) {
+            return metadata;
+        }
+    }
+
     std::vector<int64_t> offsets = {
             GetPrimaryMetadataOffset(geometry, slot_number),
             GetBackupMetadataOffset(geometry, slot_number),
@@ -462,15 +553,19 @@ std::unique_ptr<LpMetadata> ReadMetadata(const IPartitionOpener& opener,
     for (const auto& offset : offsets) {
         if (SeekFile64(fd, offset, SEEK_SET) < 0) {
             PERROR << __PRETTY_FUNCTION__ << " lseek failed, offset " << offset;
-            continue;
-        }
-        if ((metadata = ParseMetadata(geometry, fd)) != nullptr) {
+        } else if ((metadata = ParseMetadata(geometry, fd)) != nullptr) {
             break;
         }
+        // Only a copy read from the primary location can be checked against
+        // the primary header later.
+        cacheable = false;
     }
     if (!metadata || !AdjustMetadataForSlot(metadata.get(), slot_number)) {
         return nullptr;
     }
+    if (cacheable) {
+        AddCachedMetadata(cache_key, geometry, header, *metadata.get());
+    }
     return metadata;
 }
 
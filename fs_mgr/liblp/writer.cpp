@@ -241,13 +241,27 @@ static bool DefaultWriter(int fd, const std::string& blob) {
     return android::base::WriteFully(fd, blob.data(), blob.size());
 }
 
+static bool FlushMetadata(int fd) {
+#if !defined(_WIN32)
+    if (fsync(fd) < 0) {
+        PERROR << __PRETTY_FUNCTION__ << " fsync failed";
+        return false;
+    }
+#else
+    (void)fd;
+#endif
+    return true;
+}
+
 #if defined(_WIN32)
 static const int O_SYNC = 0;
 #endif
 
 bool FlashPartitionTable(const IPartitionOpener& opener, const std::string& super_partition,
                          const LpMetadata& metadata) {
-    android::base::unique_fd fd = opener.Open(super_partition, O_RDWR | O_SYNC);
+    // Nothing on the device is valid until every copy has been written, so
+    // write them all and sync once at the end, rather than opening O_SYNC.
+    android::base::unique_fd fd = opener.Open(super_partition, O_RDWR);
     if (fd < 0) {
         PERROR << __PRETTY_FUNCTION__ << " open failed: " << super_partition;
         return false;
@@ -308,7 +322,7 @@ bool FlashPartitionTable(const IPartitionOpener& opener, const std::string& supe
     for (size_t i = 0; i < metadata.geometry.metadata_slot_count; i++) {
         ok &= WriteMetadata(fd, metadata, i, metadata_blob, DefaultWriter);
     }
-    return ok;
+    return FlushMetadata(fd) && ok;
 }
 
 bool FlashPartitionTable(const std::string& super_partition, const LpMetadata& metadata) {
@@ -320,6 +334,11 @@ static bool CompareMetadata(const LpMetadata& a, const LpMetadata& b) {
                    sizeof(a.header.header_checksum));
 }
 
+// True if |metadata|, as read from the device, serializes to exactly |blob|.
+static bool MetadataMatchesBlob(const LpMetadata* metadata, const std::string& blob) {
+    return metadata && SerializeMetadata(*metadata) == blob;
+}
+
 bool UpdatePartitionTable(const IPartitionOpener& opener, const std::string& super_partition,
                           const LpMetadata& metadata, uint32_t slot_number,
                           const std::function<bool(int, const std::string&)>& writer) {
@@ -362,6 +381,14 @@ bool UpdatePartitionTable(const IPartitionOpener& opener, const std::string& sup
     std::unique_ptr<LpMetadata> primary = ReadPrimaryMetadata(fd, geometry, slot_number);
     std::unique_ptr<LpMetadata> backup = ReadBackupMetadata(fd, geometry, slot_number);
 
+    // Callers often commit the same table more than once. If both copies
+    // already hold it, there is nothing to write or sync.
+    if (MetadataMatchesBlob(primary.get(), blob) && MetadataMatchesBlob(backup.get(), blob)) {
+        LINFO << "Logical partition table at slot " << slot_number << " on device "
+              << super_partition << " is unchanged";
+        return true;
+    }
+
     if (primary && (!backup || !CompareMetadata(*primary.get(), *backup.get()))) {
         // If the backup copy does not match the primary copy, we first
         // synchronize the backup copy. This guarantees that a partial write
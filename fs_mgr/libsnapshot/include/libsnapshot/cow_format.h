@@ -15,7 +15,10 @@
 #pragma once
 
 #include <stdint.h>
+
+#include <optional>
 #include <string>
+#include <string_view>
 
 namespace android {
 namespace snapshot {
@@ -24,6 +27,11 @@ static constexpr uint64_t kCowMagicNumber = 0x436f77634f572121ULL;
 static constexpr uint32_t kCowVersionMajor = 2;
 static constexpr uint32_t kCowVersionMinor = 0;
 
+// COWs containing ops unknown to v2 readers (multi-block compression units,
+// the op index) or a dictionary region are written with this major version,
+// so that older readers reject the file. Readers accept any major version up to this one.
+static constexpr uint32_t kCowVersionMajorMax = 3;
+
 static constexpr uint32_t kCowVersionManifest = 2;
 
 static constexpr size_t BLOCK_SZ = 4096;
@@ -35,6 +43,8 @@ static constexpr size_t BLOCK_SHIFT = (__builtin_ffs(BLOCK_SZ) - 1);
 //      +-----------------------+
 //      |     Header (fixed)    |
 //      +-----------------------+
+//      |  Dictionary (optional)|
+//      +-----------------------+
 //      |     Scratch space     |
 //      +-----------------------+
 //      | Operation  (variable) |
@@ -52,13 +62,17 @@ static constexpr size_t BLOCK_SHIFT = (__builtin_ffs(BLOCK_SZ) - 1);
 // A missing or corrupt footer likely indicates that writing was cut off
 // between writing the last operation/data pair, or the footer itself. In this
 // case, the safest way to proceed is to assume the last operation is faulty.
+//
+// The dictionary region is only present when |header_size| is larger than
+// sizeof(CowHeader), which requires |major_version| kCowVersionMajorMax. It starts with a CowDictionaryHeader and is accounted for
+// in |header_size|, so the scratch space always begins at |header_size|.
 
 struct CowHeader {
     uint64_t magic;
     uint16_t major_version;
     uint16_t minor_version;
 
-    // Size of this struct.
+    // Size of this struct, plus the optional dictionary region.
     uint16_t header_size;
 
     // Size of footer struct
@@ -80,6 +94,21 @@ struct CowHeader {
     uint32_t buffer_size;
 } __attribute__((packed));
 
+// Immediately follows CowHeader if the COW has a dictionary region. The region
+// is reserved when the COW is created, and filled in once the writer has
+// trained a dictionary on the first blocks it was given.
+struct CowDictionaryHeader {
+    // Compression algorithm the dictionary was trained for.
+    uint8_t compression;
+
+    // Number of valid dictionary bytes following this struct. 0 if no
+    // dictionary has been trained (yet).
+    uint32_t dictionary_size;
+
+    // Number of bytes reserved for the dictionary after this struct.
+    uint32_t dictionary_capacity;
+} __attribute__((packed));
+
 // This structure is the same size of a normal Operation, but is repurposed for the footer.
 struct CowFooterOperation {
     // The operation code (always kCowFooterOp).
@@ -130,7 +159,12 @@ struct CowOperation {
     //
     // For replace operations, this is a byte offset within the COW's data
     // sections (eg, not landing within the header or metadata). It is an
-    // absolute position within the image.
+    // absolute position within the image. If |compression| has
+    // kCowCompressionUnitFlag set, this is instead the offset of the data of
+    // the compression unit the block belongs to, and |data_length| is zero.
+    // If |compression| has kCowDedupFlag set, this is the offset of data
+    // written for an earlier op with identical contents, and no data follows
+    // this op.
     //
     // For zero operations (replace with all zeroes), this is unused and must
     // be zero.
@@ -140,6 +174,13 @@ struct CowOperation {
     // For Cluster operations, this is the length of the following data region
     //
     // For Xor operations, this is the byte location in the source image.
+    //
+    // For Compression Unit operations, this is the length of the compressed
+    // data, which may exceed what |data_length| can hold. |data_length| is the
+    // number of consecutive blocks, starting at |new_block|, in the unit.
+    //
+    // For Op Index operations, this is the offset of the CowOpIndexHeader, or
+    // 0 if the index is missing or stale. If present, this is the first op.
     uint64_t source;
 } __attribute__((packed));
 
@@ -152,13 +193,33 @@ static constexpr uint8_t kCowLabelOp = 4;
 static constexpr uint8_t kCowClusterOp = 5;
 static constexpr uint8_t kCowXorOp = 6;
 static constexpr uint8_t kCowSequenceOp = 7;
+static constexpr uint8_t kCowCompressionUnitOp = 8;
+static constexpr uint8_t kCowOpIndexOp = 9;
 static constexpr uint8_t kCowFooterOp = -1;
 
+// Set in CowOperation::compression for replace ops whose data is a block
+// within a multi-block compression unit.
+static constexpr uint8_t kCowCompressionUnitFlag = 0x80;
+
+// Set in CowOperation::compression for replace ops that share the data of an
+// earlier replace op. |source| and |data_length| describe that data.
+static constexpr uint8_t kCowDedupFlag = 0x40;
+
+// Largest amount of data covered by a single compression unit.
+static constexpr uint32_t kCowMaxCompressionUnitSize = 256 * 1024;
+
 enum CowCompressionAlgorithm : uint8_t {
     kCowCompressNone = 0,
     kCowCompressGz = 1,
     kCowCompressBrotli = 2,
-    kCowCompressLz4 = 3
+    kCowCompressLz4 = 3,
+    kCowCompressZstd = 4,
+};
+
+struct CowCompression {
+    CowCompressionAlgorithm algorithm = kCowCompressNone;
+    // Algorithm specific compression level. 0 selects the default level.
+    int32_t compression_level = 0;
 };
 
 static constexpr uint8_t kCowReadAheadNotStarted = 0;
@@ -170,6 +231,50 @@ struct CowFooter {
     CowFooterData data;
 } __attribute__((packed));
 
+static constexpr uint64_t kCowOpIndexMagic = 0x786564496f43ULL;  // "CoIdex"
+
+// Written after the footer by Finalize(), at a page aligned offset so that it
+// can be mapped directly. It is followed by these arrays, each starting at an
+// 8-byte aligned offset relative to the header:
+//
+//      CowOperation       ops[num_ops]              - the op stream, without the footer
+//      uint32_t           merge_sequence[num_merge_ops]  - indices into ops, merge order
+//      CowOpIndexXorEntry xor_entries[num_xor_ops]  - sorted by new_block
+//      CowOpIndexUnitEntry unit_entries[num_units]  - sorted by data_offset
+//
+// The merge sequence is in user-space merge order: ordered ops first, then
+// the remaining ops sorted by block.
+struct CowOpIndexHeader {
+    uint64_t magic;
+
+    // Offset of the footer this index was built against.
+    uint64_t footer_offset;
+
+    uint64_t num_ops;
+    uint64_t num_merge_ops;
+
+    // Number of leading entries in the merge sequence that are ordered ops.
+    uint64_t num_ordered_ops;
+
+    uint64_t num_xor_ops;
+    uint64_t num_units;
+
+    // Value of the last label op, if |has_label| is set.
+    uint32_t has_label;
+    uint32_t reserved;
+    uint64_t last_label;
+} __attribute__((packed));
+
+struct CowOpIndexXorEntry {
+    uint64_t new_block;
+    uint64_t data_offset;
+} __attribute__((packed));
+
+struct CowOpIndexUnitEntry {
+    uint64_t data_offset;
+    CowOperation op;
+} __attribute__((packed));
+
 struct ScratchMetadata {
     // Block of data in the image that operation modifies
     // and read-ahead thread stores the modified data
@@ -188,6 +293,9 @@ static constexpr uint64_t BUFFER_REGION_DEFAULT_SIZE = (1ULL << 21);
 
 std::ostream& operator<<(std::ostream& os, CowOperation const& arg);
 
+// Number of bytes the op occupies in the data section.
+uint64_t GetOpDataLength(const CowOperation& op);
+
 int64_t GetNextOpOffset(const CowOperation& op, uint32_t cluster_size);
 int64_t GetNextDataOffset(const CowOperation& op, uint32_t cluster_size);
 
@@ -196,5 +304,8 @@ bool IsMetadataOp(const CowOperation& op);
 // Ops that have dependencies on old blocks, and must take care in their merge order
 bool IsOrderedOp(const CowOperation& op);
 
+// Parse a compression algorithm name, as accepted in CowOptions::compression.
+std::optional<CowCompressionAlgorithm> CompressionAlgorithmFromString(std::string_view name);
+
 }  // namespace snapshot
 }  // namespace android
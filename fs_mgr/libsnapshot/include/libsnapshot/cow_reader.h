@@ -19,14 +19,18 @@
 #include <functional>
 #include <memory>
 #include <optional>
+#include <string>
 #include <unordered_map>
 
 #include <android-base/unique_fd.h>
 #include <libsnapshot/cow_format.h>
 
+struct ZSTD_DDict_s;
+
 namespace android {
 namespace snapshot {
 
+class CowOpIndex;
 class ICowOpIter;
 
 // A ByteSink object handles requests for a buffer of a specific size. It
@@ -123,6 +127,11 @@ class CowReader final : public ICowReader {
     bool Parse(android::base::unique_fd&& fd, std::optional<uint64_t> label = {});
     bool Parse(android::base::borrowed_fd fd, std::optional<uint64_t> label = {});
 
+    // Parse a complete COW for user-space merge, taking the ops from an op
+    // index written by ExportOpIndex() at the start of |op_index_fd|. If the
+    // index does not describe this COW, the COW is parsed as usual.
+    bool ParseWithOpIndex(android::base::borrowed_fd fd, android::base::borrowed_fd op_index_fd);
+
     bool InitForMerge(android::base::unique_fd&& fd);
     bool VerifyMergeOps() override;
 
@@ -158,7 +167,25 @@ class CowReader final : public ICowReader {
 
     void UpdateMergeOpsCompleted(int num_merge_ops) { header_.num_merge_ops += num_merge_ops; }
 
+    // Serialize the parsed ops as an op index (see CowOpIndexHeader) at
+    // |offset| in |fd|, and return its size. The COW must have been parsed
+    // for user-space merge, without a label and without InitForMerge().
+    bool WriteOpIndex(android::base::borrowed_fd fd, uint64_t offset, uint64_t footer_offset,
+                      uint64_t* size);
+
+    // Serialize the parsed ops as an op index at the start of |fd|, for use
+    // with ParseWithOpIndex(). Same requirements as WriteOpIndex().
+    bool ExportOpIndex(android::base::borrowed_fd fd, uint64_t* size);
+
+    // True if ops are being served from a mapped op index.
+    bool HasOpIndex() const { return op_index_ != nullptr; }
+
   private:
+    bool ReadDictionary();
+    bool LoadOpIndex();
+    bool ReadUnitData(const CowOperation& op, IByteSink* sink);
+    bool GetXorDataOffset(const CowOperation& op, uint64_t* offset);
+    bool GetCompressionUnit(uint64_t offset, CowOperation* unit);
     bool ParseOps(std::optional<uint64_t> label);
     bool PrepMergeOps();
     uint64_t FindNumCopyops();
@@ -167,15 +194,27 @@ class CowReader final : public ICowReader {
     android::base::borrowed_fd fd_;
     CowHeader header_;
     std::optional<CowFooter> footer_;
+    uint64_t footer_offset_{};
     uint64_t fd_size_;
     std::optional<uint64_t> last_label_;
     std::shared_ptr<std::vector<CowOperation>> ops_;
     uint64_t merge_op_start_{};
-    std::shared_ptr<std::vector<int>> block_pos_index_;
+    std::shared_ptr<std::vector<uint32_t>> block_pos_index_;
     uint64_t num_total_data_ops_{};
+    uint64_t num_ordered_ops_{};
     uint64_t num_ordered_ops_to_merge_{};
     bool has_seq_ops_{};
     std::shared_ptr<std::unordered_map<uint64_t, uint64_t>> data_loc_;
+    std::shared_ptr<ZSTD_DDict_s> dictionary_;
+    // Compression unit ops, keyed by the offset of their data.
+    std::shared_ptr<std::unordered_map<uint64_t, CowOperation>> units_;
+    // If set, replaces ops_, block_pos_index_, data_loc_ and units_.
+    std::shared_ptr<const CowOpIndex> op_index_;
+    // Where LoadOpIndex() looks for the index, if not in the COW itself.
+    android::base::borrowed_fd op_index_fd_{-1};
+    // Most recently decompressed unit. Not shared between clones.
+    uint64_t cached_unit_offset_{};
+    std::string cached_unit_;
     ReaderFlags reader_flag_;
     bool is_merge_{};
 };
@@ -25,6 +25,7 @@
 #include <queue>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -32,13 +33,32 @@
 #include <libsnapshot/cow_format.h>
 #include <libsnapshot/cow_reader.h>
 
+struct ZSTD_CDict_s;
+
 namespace android {
 namespace snapshot {
 
 struct CowOptions {
     uint32_t block_size = 4096;
+
+    // Compression algorithm, optionally followed by a level, for example
+    // "lz4" or "zstd,6".
     std::string compression;
 
+    // If non-zero and compression is zstd, train a dictionary on up to this
+    // many blocks sampled from the first batch written, and store it in the
+    // COW header. If training fails, the COW is written without one.
+    uint32_t compression_dictionary_blocks = 0;
+
+    // Maximum size of the trained dictionary, in bytes.
+    uint32_t compression_dictionary_size = 16 * 1024;
+
+    // If non-zero, compress consecutive replace blocks together in units of
+    // up to this many bytes instead of one block at a time. Must be a multiple
+    // of the block size, and at most kCowMaxCompressionUnitSize. Requires a
+    // reader that understands kCowVersionMajorMax.
+    uint32_t compression_unit_size = 0;
+
     // Maximum number of blocks that can be written.
     std::optional<uint64_t> max_blocks;
 
@@ -50,11 +70,24 @@ struct CowOptions {
     // Preset the number of merged ops. Only useful for testing.
     uint64_t num_merge_ops = 0;
 
-    // Number of threads for compression
+    // Number of threads for compression. When more than one, blocks are
+    // compressed in parallel while earlier blocks are written out in order.
+    // 0 picks a default from ro.virtual_ab.compression.threads.
     int num_compress_threads = 0;
 
     // Batch write cluster ops
     bool batch_write = false;
+
+    // Write an op index (see CowOpIndexHeader) in Finalize(), so that readers
+    // can map the ops instead of parsing them. Requires a reader that
+    // understands kCowVersionMajorMax.
+    bool op_index = false;
+
+    // Hash each replace block, and write blocks repeating the contents of an
+    // earlier block as ops sharing that block's data (see kCowDedupFlag).
+    // Not applied to blocks in compression units. Requires a reader that
+    // understands kCowVersionMajorMax.
+    bool dedup_blocks = false;
 };
 
 // Interface for writing to a snapuserd COW. All operations are ordered; merges
@@ -115,17 +148,24 @@ class ICowWriter {
 
 class CompressWorker {
   public:
-    CompressWorker(CowCompressionAlgorithm compression, uint32_t block_size);
+    CompressWorker(const CowCompression& compression, uint32_t block_size);
     bool RunThread();
     void EnqueueCompressBlocks(const void* buffer, size_t num_blocks);
     bool GetCompressedBuffers(std::vector<std::basic_string<uint8_t>>* compressed_buf);
     void Finalize();
-    static std::basic_string<uint8_t> Compress(CowCompressionAlgorithm compression,
-                                               const void* data, size_t length);
 
-    static bool CompressBlocks(CowCompressionAlgorithm compression, size_t block_size,
+    // Set the digested zstd dictionary used for all subsequent work.
+    void SetDictionary(std::shared_ptr<ZSTD_CDict_s> dictionary);
+
+    // |dictionary| is only used for zstd, and may be null.
+    static std::basic_string<uint8_t> Compress(const CowCompression& compression,
+                                               const void* data, size_t length,
+                                               const ZSTD_CDict_s* dictionary = nullptr);
+
+    static bool CompressBlocks(const CowCompression& compression, size_t block_size,
                                const void* buffer, size_t num_blocks,
-                               std::vector<std::basic_string<uint8_t>>* compressed_data);
+                               std::vector<std::basic_string<uint8_t>>* compressed_data,
+                               const ZSTD_CDict_s* dictionary = nullptr);
 
   private:
     struct CompressWork {
@@ -135,8 +175,9 @@ class CompressWorker {
         std::vector<std::basic_string<uint8_t>> compressed_data;
     };
 
-    CowCompressionAlgorithm compression_;
+    CowCompression compression_;
     uint32_t block_size_;
+    std::shared_ptr<ZSTD_CDict_s> dictionary_;
 
     std::queue<CompressWork> work_queue_;
     std::queue<CompressWork> compressed_queue_;
@@ -187,11 +228,19 @@ class CowWriter : public ICowWriter {
     bool EmitClusterIfNeeded();
     bool EmitBlocks(uint64_t new_block_start, const void* data, size_t size, uint64_t old_block,
                     uint16_t offset, uint8_t type);
+    bool EmitCompressedBlocks(uint64_t new_block_start, const uint8_t* data, size_t num_blocks,
+                              uint64_t old_block, uint16_t offset, uint8_t type);
+    bool EmitCompressionUnits(uint64_t new_block_start, const void* data, size_t num_blocks);
     void SetupHeaders();
     void SetupWriteOptions();
     bool ParseOptions();
     bool OpenForWrite();
     bool OpenForAppend(uint64_t label);
+    bool ReadDictionary();
+    bool TrainDictionary(const void* data, size_t num_blocks);
+    bool SetDictionary(const void* data, size_t size);
+    bool WriteOpIndex(uint64_t footer_offset);
+    bool InvalidateOpIndex();
     bool GetDataPos(uint64_t* pos);
     bool WriteRawData(const void* data, size_t size);
     bool WriteOperation(const CowOperation& op, const void* data = nullptr, size_t size = 0);
@@ -201,18 +250,54 @@ class CowWriter : public ICowWriter {
     void InitWorkers();
     bool FlushCluster();
 
-    bool CompressBlocks(size_t num_blocks, const void* data);
     bool SetFd(android::base::borrowed_fd fd);
     bool Sync();
     bool Truncate(off_t length);
     bool EnsureSpaceAvailable(const uint64_t bytes_needed) const;
 
+    struct BlockHash {
+        uint64_t low;
+        uint64_t high;
+        bool operator==(const BlockHash& other) const {
+            return low == other.low && high == other.high;
+        }
+    };
+    struct BlockHashHasher {
+        size_t operator()(const BlockHash& hash) const { return hash.low; }
+    };
+    static BlockHash HashBlock(const uint8_t* data, size_t size);
+    const CowOperation* FindDuplicateBlock(const BlockHash& hash, const uint8_t* data) const;
+    void AddDedupBlock(const BlockHash& hash, const uint8_t* data, const CowOperation& op);
+    bool EmitDuplicateBlock(uint64_t new_block, const CowOperation& original);
+
   private:
+    // Blocks per unit of work handed to a compression thread.
+    static constexpr size_t kCompressChunkBlocks = 64;
+    // Chunks queued per compression thread ahead of the writer.
+    static constexpr size_t kCompressChunksPerThread = 4;
+
     android::base::unique_fd owned_fd_;
     android::base::borrowed_fd fd_;
     CowHeader header_{};
     CowFooter footer_{};
-    CowCompressionAlgorithm compression_ = kCowCompressNone;
+    CowCompression compression_;
+    uint32_t compression_unit_blocks_ = 0;
+    uint32_t dictionary_capacity_ = 0;
+    bool dictionary_trained_ = false;
+    bool dedup_blocks_ = false;
+    // Replace ops that wrote data, by the hash of their uncompressed block. The
+    // block is kept so that a hash match can be confirmed byte for byte.
+    struct DedupEntry {
+        CowOperation op;
+        std::basic_string<uint8_t> data;
+    };
+    // Bounds the memory held by dedup_table_; later blocks are not deduplicated.
+    static constexpr size_t kMaxDedupBytes = 16 * 1024 * 1024;
+    std::unordered_map<BlockHash, DedupEntry, BlockHashHasher> dedup_table_;
+    std::shared_ptr<ZSTD_CDict_s> dictionary_;
+    // Position of the kCowOpIndexOp, or 0 if there is none.
+    uint64_t op_index_pos_ = 0;
+    bool op_index_valid_ = false;
     uint64_t current_op_pos_ = 0;
     uint64_t next_op_pos_ = 0;
     uint64_t next_data_pos_ = 0;
@@ -230,7 +315,6 @@ class CowWriter : public ICowWriter {
     std::vector<std::unique_ptr<CompressWorker>> compress_threads_;
     std::vector<std::future<bool>> threads_;
     std::vector<std::basic_string<uint8_t>> compressed_buf_;
-    std::vector<std::basic_string<uint8_t>>::iterator buf_iter_;
 
     std::vector<std::unique_ptr<CowOperation>> opbuffer_vec_;
     std::vector<std::unique_ptr<uint8_t[]>> databuffer_vec_;
@@ -16,6 +16,7 @@
 
 #include <cstdio>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <string_view>
 
@@ -376,6 +377,53 @@ TEST_P(CompressionRWTest, ThreadedBatchWrites) {
     ASSERT_EQ(total_blocks, expected_blocks);
 }
 
+TEST_P(CompressionRWTest, ThreadedWritesInOrder) {
+    CowOptions options;
+    options.compression = GetParam();
+    options.num_compress_threads = 4;
+
+    CowWriter writer(options);
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+
+    // Enough blocks to keep every worker's queue full, with a partial last
+    // chunk, and distinct contents per block so that reordering is caught.
+    const size_t num_blocks = 1500;
+    std::string data(options.block_size * num_blocks, '\0');
+    for (size_t i = 0; i < num_blocks; i++) {
+        std::string tag = "block " + std::to_string(i);
+        data.replace(i * options.block_size, tag.size(), tag);
+    }
+    ASSERT_TRUE(writer.AddRawBlocks(10, data.data(), data.size()));
+    ASSERT_TRUE(writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    auto iter = reader.GetOpIter();
+    ASSERT_NE(iter, nullptr);
+
+    size_t expected_block = 0;
+    uint64_t last_source = 0;
+    while (!iter->Done()) {
+        auto op = &iter->Get();
+        if (op->type == kCowReplaceOp) {
+            ASSERT_EQ(op->new_block, 10 + expected_block);
+            ASSERT_GT(op->source, last_source);
+            last_source = op->source;
+
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            ASSERT_EQ(sink.stream(), data.substr(expected_block * options.block_size,
+                                                 options.block_size));
+            expected_block++;
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(expected_block, num_blocks);
+}
+
 TEST_P(CompressionRWTest, NoBatchWrites) {
     CowOptions options;
     options.compression = GetParam();
@@ -440,7 +488,320 @@ TEST_P(CompressionRWTest, NoBatchWrites) {
     ASSERT_EQ(total_blocks, expected_blocks);
 }
 
-INSTANTIATE_TEST_SUITE_P(CowApi, CompressionRWTest, testing::Values("none", "gz", "brotli", "lz4"));
+TEST_P(CompressionRWTest, DedupBlocks) {
+    CowOptions options;
+    options.compression = GetParam();
+    options.num_compress_threads = 2;
+    options.batch_write = true;
+    options.dedup_blocks = true;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+    ASSERT_EQ(writer.GetCowVersion(), kCowVersionMajorMax);
+
+    // Four distinct blocks, each repeated three times.
+    std::string data;
+    for (size_t i = 0; i < 12; i++) {
+        std::string block = "Dedup block " + std::to_string(i % 4);
+        block.resize(options.block_size, static_cast<char>(i % 4));
+        data += block;
+    }
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    std::map<uint64_t, uint64_t> sources;
+    size_t num_dedup = 0, num_replace = 0;
+    auto iter = reader.GetOpIter();
+    ASSERT_NE(iter, nullptr);
+    while (!iter->Done()) {
+        auto op = &iter->Get();
+        if (op->type == kCowReplaceOp) {
+            size_t index = op->new_block - 50;
+            if (index < 4) {
+                ASSERT_FALSE(op->compression & kCowDedupFlag);
+                sources[index] = op->source;
+            } else {
+                ASSERT_TRUE(op->compression & kCowDedupFlag);
+                ASSERT_EQ(op->source, sources[index % 4]);
+                num_dedup++;
+            }
+
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            ASSERT_EQ(sink.stream(), data.substr(index * options.block_size, options.block_size));
+            num_replace++;
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(num_replace, 12);
+    ASSERT_EQ(num_dedup, 8);
+}
+
+INSTANTIATE_TEST_SUITE_P(CowApi, CompressionRWTest,
+                         testing::Values("none", "gz", "brotli", "lz4", "zstd", "zstd,9"));
+
+class CompressionUnitTest : public CowTest, public testing::WithParamInterface<const char*> {};
+
+TEST_P(CompressionUnitTest, ReadWrite) {
+    CowOptions options;
+    options.compression = GetParam();
+    options.compression_unit_size = 64 * 1024;
+    options.batch_write = true;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+    ASSERT_EQ(writer.GetCowVersion(), kCowVersionMajorMax);
+
+    std::string data;
+    for (size_t i = 0; i < 37; i++) {
+        std::string block = "Compression unit block " + std::to_string(i);
+        block.resize(options.block_size, static_cast<char>(i));
+        data += block;
+    }
+    ASSERT_TRUE(writer.AddCopy(5, 10));
+    ASSERT_TRUE(writer.AddRawBlocks(100, data.data(), data.size()));
+    ASSERT_TRUE(writer.AddZeroBlocks(200, 2));
+    ASSERT_TRUE(writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    size_t num_units = 0, num_replace = 0;
+    auto iter = reader.GetOpIter();
+    ASSERT_NE(iter, nullptr);
+    while (!iter->Done()) {
+        auto op = &iter->Get();
+        if (op->type == kCowCompressionUnitOp) {
+            num_units++;
+        } else if (op->type == kCowReplaceOp) {
+            ASSERT_TRUE(op->compression & kCowCompressionUnitFlag);
+
+            size_t index = op->new_block - 100;
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            ASSERT_EQ(sink.stream(), data.substr(index * options.block_size, options.block_size));
+            num_replace++;
+        }
+        iter->Next();
+    }
+    // 37 blocks in 16-block units.
+    ASSERT_EQ(num_units, 3);
+    ASSERT_EQ(num_replace, 37);
+
+    // Merge order must not include the unit ops, and must still decode.
+    auto merge_iter = reader.GetMergeOpIter();
+    size_t num_merge_ops = 0;
+    while (!merge_iter->Done()) {
+        auto op = &merge_iter->Get();
+        ASSERT_NE(op->type, kCowCompressionUnitOp);
+        if (op->type == kCowReplaceOp) {
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+        }
+        num_merge_ops++;
+        merge_iter->Next();
+    }
+    ASSERT_EQ(num_merge_ops, 1 + 37 + 2);
+}
+
+INSTANTIATE_TEST_SUITE_P(CowApi, CompressionUnitTest, testing::Values("gz", "lz4", "zstd"));
+
+static void WriteOpIndexTestCow(const CowOptions& options, int fd, std::string* data) {
+    CowWriter writer(options);
+    ASSERT_TRUE(writer.Initialize(fd));
+
+    data->clear();
+    for (size_t i = 0; i < 20; i++) {
+        std::string block = "Op index block " + std::to_string(i);
+        block.resize(options.block_size, static_cast<char>(i));
+        *data += block;
+    }
+    ASSERT_TRUE(writer.AddCopy(30, 2, 3));
+    ASSERT_TRUE(writer.AddRawBlocks(60, data->data(), data->size()));
+    ASSERT_TRUE(writer.AddXorBlocks(10, data->data(), options.block_size * 2, 70, 24));
+    ASSERT_TRUE(writer.AddZeroBlocks(5, 2));
+    ASSERT_TRUE(writer.AddLabel(7));
+    ASSERT_TRUE(writer.Finalize());
+}
+
+TEST_F(CowTest, OpIndex) {
+    CowOptions options;
+    options.compression = "lz4";
+    options.compression_unit_size = 32 * 1024;
+    std::string data;
+
+    TemporaryFile plain_cow;
+    ASSERT_NO_FATAL_FAILURE(WriteOpIndexTestCow(options, plain_cow.fd, &data));
+    options.op_index = true;
+    ASSERT_NO_FATAL_FAILURE(WriteOpIndexTestCow(options, cow_->fd, &data));
+
+    CowReader plain(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_TRUE(plain.Parse(plain_cow.fd));
+    ASSERT_FALSE(plain.HasOpIndex());
+
+    CowReader reader(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+    ASSERT_TRUE(reader.HasOpIndex());
+
+    uint64_t label;
+    ASSERT_TRUE(reader.GetLastLabel(&label));
+    ASSERT_EQ(label, 7);
+    ASSERT_EQ(reader.get_num_total_data_ops(), plain.get_num_total_data_ops());
+    ASSERT_EQ(reader.get_num_ordered_ops_to_merge(), plain.get_num_ordered_ops_to_merge());
+
+    // The mapped index must present the same merge sequence, with the same
+    // data, in a clone as well.
+    auto clone = reader.CloneCowReader();
+    ASSERT_TRUE(clone->InitForMerge(android::base::unique_fd(dup(cow_->fd))));
+    for (auto* indexed : {&reader, clone.get()}) {
+        auto expected = plain.GetMergeOpIter();
+        auto iter = indexed->GetMergeOpIter();
+        while (!expected->Done()) {
+            ASSERT_FALSE(iter->Done());
+            const auto& op = iter->Get();
+            ASSERT_EQ(op.type, expected->Get().type);
+            ASSERT_EQ(op.new_block, expected->Get().new_block);
+            if (op.type == kCowReplaceOp || op.type == kCowXorOp) {
+                StringSink sink, expected_sink;
+                ASSERT_TRUE(indexed->ReadData(op, &sink));
+                ASSERT_TRUE(plain.ReadData(expected->Get(), &expected_sink));
+                ASSERT_EQ(sink.stream(), expected_sink.stream());
+            }
+            expected->Next();
+            iter->Next();
+        }
+        ASSERT_TRUE(iter->Done());
+
+        size_t num_ops = 0;
+        for (auto rev_iter = indexed->GetRevMergeOpIter(); !rev_iter->Done(); rev_iter->Next()) {
+            num_ops++;
+        }
+        ASSERT_EQ(num_ops, plain.get_num_total_data_ops());
+    }
+
+    // Appending must invalidate the index until the next Finalize().
+    options.op_index = false;
+    CowWriter writer(options);
+    ASSERT_TRUE(writer.InitializeAppend(cow_->fd, 7));
+    std::string appended_data = "appended";
+    appended_data.resize(options.block_size, '\0');
+    ASSERT_TRUE(writer.AddRawBlocks(90, appended_data.data(), appended_data.size()));
+
+    CowReader stale(CowReader::ReaderFlags::USERSPACE_MERGE);
+    stale.Parse(cow_->fd);
+    ASSERT_FALSE(stale.HasOpIndex());
+
+    ASSERT_TRUE(writer.Finalize());
+    CowReader appended(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_TRUE(appended.Parse(cow_->fd));
+    ASSERT_TRUE(appended.HasOpIndex());
+    ASSERT_EQ(appended.get_num_total_data_ops(), plain.get_num_total_data_ops() + 1);
+}
+
+TEST_F(CowTest, ExportedOpIndex) {
+    CowOptions options;
+    options.compression = "lz4";
+    std::string data;
+    ASSERT_NO_FATAL_FAILURE(WriteOpIndexTestCow(options, cow_->fd, &data));
+
+    CowReader plain(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_TRUE(plain.Parse(cow_->fd));
+    ASSERT_FALSE(plain.HasOpIndex());
+
+    TemporaryFile index;
+    uint64_t index_size;
+    ASSERT_TRUE(plain.ExportOpIndex(index.fd, &index_size));
+    ASSERT_GT(index_size, 0);
+
+    CowReader reader(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_TRUE(reader.ParseWithOpIndex(cow_->fd, index.fd));
+    ASSERT_TRUE(reader.HasOpIndex());
+    ASSERT_EQ(reader.get_num_total_data_ops(), plain.get_num_total_data_ops());
+
+    auto expected = plain.GetMergeOpIter();
+    auto iter = reader.GetMergeOpIter();
+    while (!expected->Done()) {
+        ASSERT_FALSE(iter->Done());
+        ASSERT_EQ(iter->Get().type, expected->Get().type);
+        ASSERT_EQ(iter->Get().new_block, expected->Get().new_block);
+        expected->Next();
+        iter->Next();
+    }
+    ASSERT_TRUE(iter->Done());
+
+    // An index for another COW is ignored.
+    TemporaryFile other_cow;
+    CowWriter writer(options);
+    ASSERT_TRUE(writer.Initialize(other_cow.fd));
+    ASSERT_TRUE(writer.AddZeroBlocks(5, 2));
+    ASSERT_TRUE(writer.Finalize());
+
+    CowReader other(CowReader::ReaderFlags::USERSPACE_MERGE);
+    ASSERT_TRUE(other.ParseWithOpIndex(other_cow.fd, index.fd));
+    ASSERT_FALSE(other.HasOpIndex());
+    ASSERT_EQ(other.get_num_total_data_ops(), 2);
+}
+
+TEST_F(CowTest, CompressZstdDictionary) {
+    CowOptions options;
+    options.compression = "zstd,3";
+    options.compression_dictionary_blocks = 128;
+    CowWriter writer(options);
+
+    ASSERT_TRUE(writer.Initialize(cow_->fd));
+    // v2 readers don't know about the dictionary region.
+    ASSERT_EQ(writer.GetCowVersion(), kCowVersionMajorMax);
+
+    std::string data;
+    for (size_t i = 0; i < 256; i++) {
+        std::string block = "Block " + std::to_string(i) + " of some highly redundant data";
+        block.resize(options.block_size, static_cast<char>(i % 7));
+        data += block;
+    }
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.AddLabel(1));
+
+    // Appending must pick up the dictionary trained above.
+    CowWriter append_writer(options);
+    ASSERT_TRUE(append_writer.InitializeAppend(cow_->fd, 1));
+    ASSERT_TRUE(append_writer.AddRawBlocks(500, data.data(), options.block_size));
+    ASSERT_TRUE(append_writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    CowHeader header;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+    ASSERT_TRUE(reader.GetHeader(&header));
+    ASSERT_EQ(header.header_size, sizeof(CowHeader) + sizeof(CowDictionaryHeader) +
+                                          options.compression_dictionary_size);
+
+    auto iter = reader.GetOpIter();
+    ASSERT_NE(iter, nullptr);
+
+    size_t num_blocks = 0;
+    while (!iter->Done()) {
+        auto op = &iter->Get();
+        if (op->type == kCowReplaceOp) {
+            ASSERT_EQ(op->compression, kCowCompressZstd);
+
+            size_t index = op->new_block == 500 ? 0 : op->new_block - 50;
+            StringSink sink;
+            ASSERT_TRUE(reader.ReadData(*op, &sink));
+            ASSERT_EQ(sink.stream(), data.substr(index * options.block_size, options.block_size));
+            num_blocks++;
+        }
+        iter->Next();
+    }
+    ASSERT_EQ(num_blocks, 257);
+}
 
 TEST_F(CowTest, ClusterCompressGz) {
     CowOptions options;
@@ -0,0 +1,191 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <libsnapshot/cow_reader.h>
+#include <libsnapshot/cow_writer.h>
+
+using android::base::borrowed_fd;
+
+namespace android {
+namespace snapshot {
+
+// Indexed by the first benchmark argument.
+static const char* const kAlgorithms[] = {"none", "gz", "brotli", "lz4", "zstd"};
+
+static constexpr size_t kDataBlocks = 1024;
+static constexpr uint64_t kParseOps = 1024 * 1024;
+
+class NullSink : public IByteSink {
+  public:
+    void* GetBuffer(size_t requested, size_t* actual) override {
+        if (buffer_.size() < requested) {
+            buffer_.resize(requested);
+        }
+        *actual = requested;
+        return buffer_.data();
+    }
+    bool ReturnData(void*, size_t) override { return true; }
+
+  private:
+    std::string buffer_;
+};
+
+// Blocks that are half random and half zero, so that every algorithm has
+// something to do and something to gain.
+static const std::string& BlockData() {
+    static std::string data = [] {
+        std::string data(kDataBlocks * BLOCK_SZ, '\0');
+        srand(0);
+        for (size_t i = 0; i < data.size(); i += BLOCK_SZ) {
+            for (size_t j = 0; j < BLOCK_SZ / 2; j++) {
+                data[i + j] = rand();
+            }
+        }
+        return data;
+    }();
+    return data;
+}
+
+static bool WriteReplaceCow(const char* algorithm, int num_threads, borrowed_fd fd) {
+    CowOptions options;
+    options.compression = algorithm;
+    options.num_compress_threads = num_threads;
+    CowWriter writer(options);
+    const auto& data = BlockData();
+    return writer.Initialize(fd) && writer.AddRawBlocks(0, data.data(), data.size()) &&
+           writer.Finalize();
+}
+
+// A COW with kParseOps ops: copies and zeroes, with a label every 64 ops,
+// like a large delta OTA. It is built once and shared by the parse and
+// iteration benchmarks.
+static const TemporaryFile& ParseCow(bool op_index) {
+    static std::unique_ptr<TemporaryFile> cows[2];
+    auto& cow = cows[op_index];
+    if (cow) {
+        return *cow;
+    }
+
+    cow = std::make_unique<TemporaryFile>();
+    CowOptions options;
+    options.op_index = op_index;
+    CowWriter writer(options);
+    CHECK(writer.Initialize(cow->fd));
+    for (uint64_t i = 0; i < kParseOps; i += 64) {
+        CHECK(writer.AddCopy(i, kParseOps + i, 32));
+        CHECK(writer.AddZeroBlocks(i + 32, 31));
+        CHECK(writer.AddLabel(i));
+    }
+    CHECK(writer.Finalize());
+    return *cow;
+}
+
+// Arguments: algorithm, compression threads.
+static void BM_AddRawBlocks(benchmark::State& state) {
+    const char* algorithm = kAlgorithms[state.range(0)];
+    for (auto _ : state) {
+        state.PauseTiming();
+        TemporaryFile cow;
+        state.ResumeTiming();
+
+        if (!WriteReplaceCow(algorithm, state.range(1), cow.fd)) {
+            state.SkipWithError("failed to write COW");
+            return;
+        }
+    }
+    state.SetLabel(algorithm);
+    state.SetBytesProcessed(state.iterations() * kDataBlocks * BLOCK_SZ);
+}
+BENCHMARK(BM_AddRawBlocks)
+        ->ArgsProduct({{0, 1, 2, 3, 4}, {1, 2, 4}})
+        ->UseRealTime()
+        ->Unit(benchmark::kMillisecond);
+
+// Argument: whether the COW has an op index.
+static void BM_Parse(benchmark::State& state) {
+    const auto& cow = ParseCow(state.range(0));
+    for (auto _ : state) {
+        CowReader reader;
+        if (!reader.Parse(cow.fd)) {
+            state.SkipWithError("failed to parse COW");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kParseOps);
+}
+BENCHMARK(BM_Parse)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+static void BM_OpIter(benchmark::State& state) {
+    const auto& cow = ParseCow(false);
+    CowReader reader;
+    if (!reader.Parse(cow.fd)) {
+        state.SkipWithError("failed to parse COW");
+        return;
+    }
+    for (auto _ : state) {
+        uint64_t blocks = 0;
+        for (auto iter = reader.GetOpIter(); !iter->Done(); iter->Next()) {
+            blocks += iter->Get().new_block;
+        }
+        benchmark::DoNotOptimize(blocks);
+    }
+    state.SetItemsProcessed(state.iterations() * kParseOps);
+}
+BENCHMARK(BM_OpIter)->Unit(benchmark::kMillisecond);
+
+// Argument: algorithm.
+static void BM_ReadData(benchmark::State& state) {
+    const char* algorithm = kAlgorithms[state.range(0)];
+    TemporaryFile cow;
+    CowReader reader;
+    if (!WriteReplaceCow(algorithm, 1, cow.fd) || !reader.Parse(cow.fd)) {
+        state.SkipWithError("failed to create COW");
+        return;
+    }
+
+    std::vector<CowOperation> ops;
+    for (auto iter = reader.GetOpIter(); !iter->Done(); iter->Next()) {
+        if (iter->Get().type == kCowReplaceOp) {
+            ops.emplace_back(iter->Get());
+        }
+    }
+
+    NullSink sink;
+    for (auto _ : state) {
+        for (const auto& op : ops) {
+            if (!reader.ReadData(op, &sink)) {
+                state.SkipWithError("failed to read data");
+                return;
+            }
+        }
+    }
+    state.SetLabel(algorithm);
+    state.SetItemsProcessed(state.iterations() * ops.size());
+    state.SetBytesProcessed(state.iterations() * ops.size() * BLOCK_SZ);
+}
+BENCHMARK(BM_ReadData)->DenseRange(0, 4);
+
+}  // namespace snapshot
+}  // namespace android
+
+BENCHMARK_MAIN();
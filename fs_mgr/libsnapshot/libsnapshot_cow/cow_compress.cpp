@@ -29,23 +29,26 @@
 #include <libsnapshot/cow_writer.h>
 #include <lz4.h>
 #include <zlib.h>
+#include <zstd.h>
 
 namespace android {
 namespace snapshot {
 std::basic_string<uint8_t> CompressWorker::Compress(const void* data, size_t length) {
-    return Compress(compression_, data, length);
+    return Compress(compression_, data, length, dictionary_.get());
 }
 
-std::basic_string<uint8_t> CompressWorker::Compress(CowCompressionAlgorithm compression,
-                                                    const void* data, size_t length) {
-    switch (compression) {
+std::basic_string<uint8_t> CompressWorker::Compress(const CowCompression& compression,
+                                                    const void* data, size_t length,
+                                                    const ZSTD_CDict* dictionary) {
+    switch (compression.algorithm) {
         case kCowCompressGz: {
             const auto bound = compressBound(length);
             std::basic_string<uint8_t> buffer(bound, '\0');
 
+            const int level = compression.compression_level ?: Z_BEST_COMPRESSION;
             uLongf dest_len = bound;
             auto rv = compress2(buffer.data(), &dest_len, reinterpret_cast<const Bytef*>(data),
-                                length, Z_BEST_COMPRESSION);
+                                length, level);
             if (rv != Z_OK) {
                 LOG(ERROR) << "compress2 returned: " << rv;
                 return {};
@@ -61,10 +64,11 @@ std::basic_string<uint8_t> CompressWorker::Compress(CowCompressionAlgorithm comp
             }
             std::basic_string<uint8_t> buffer(bound, '\0');
 
+            const int quality = compression.compression_level ?: BROTLI_DEFAULT_QUALITY;
             size_t encoded_size = bound;
-            auto rv = BrotliEncoderCompress(
-                    BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE, length,
-                    reinterpret_cast<const uint8_t*>(data), &encoded_size, buffer.data());
+            auto rv = BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE,
+                                            length, reinterpret_cast<const uint8_t*>(data),
+                                            &encoded_size, buffer.data());
             if (!rv) {
                 LOG(ERROR) << "BrotliEncoderCompress failed";
                 return {};
@@ -97,23 +101,59 @@ std::basic_string<uint8_t> CompressWorker::Compress(CowCompressionAlgorithm comp
             }
             return buffer;
         }
+        case kCowCompressZstd: {
+            // Contexts are expensive to set up, so keep one per thread.
+            static thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(
+                    ZSTD_createCCtx(), ZSTD_freeCCtx);
+            if (!cctx) {
+                LOG(ERROR) << "ZSTD_createCCtx failed";
+                return {};
+            }
+
+            const auto bound = ZSTD_compressBound(length);
+            std::basic_string<uint8_t> buffer(bound, '\0');
+
+            size_t compressed_size;
+            if (dictionary) {
+                compressed_size = ZSTD_compress_usingCDict(cctx.get(), buffer.data(), buffer.size(),
+                                                           data, length, dictionary);
+            } else {
+                compressed_size = ZSTD_compressCCtx(cctx.get(), buffer.data(), buffer.size(), data,
+                                                    length, compression.compression_level);
+            }
+            if (ZSTD_isError(compressed_size)) {
+                LOG(ERROR) << "ZSTD compression failed, input size: " << length
+                           << ", error: " << ZSTD_getErrorName(compressed_size);
+                return {};
+            }
+            // Same as lz4: store the block as-is if compression did not help.
+            if (compressed_size >= length) {
+                buffer.resize(length);
+                memcpy(buffer.data(), data, length);
+            } else {
+                buffer.resize(compressed_size);
+            }
+            return buffer;
+        }
         default:
-            LOG(ERROR) << "unhandled compression type: " << compression;
+            LOG(ERROR) << "unhandled compression type: " << compression.algorithm;
             break;
     }
     return {};
 }
 bool CompressWorker::CompressBlocks(const void* buffer, size_t num_blocks,
                                     std::vector<std::basic_string<uint8_t>>* compressed_data) {
-    return CompressBlocks(compression_, block_size_, buffer, num_blocks, compressed_data);
+    return CompressBlocks(compression_, block_size_, buffer, num_blocks, compressed_data,
+                          dictionary_.get());
 }
 
-bool CompressWorker::CompressBlocks(CowCompressionAlgorithm compression, size_t block_size,
+bool CompressWorker::CompressBlocks(const CowCompression& compression, size_t block_size,
                                     const void* buffer, size_t num_blocks,
-                                    std::vector<std::basic_string<uint8_t>>* compressed_data) {
+                                    std::vector<std::basic_string<uint8_t>>* compressed_data,
+                                    const ZSTD_CDict* dictionary) {
     const uint8_t* iter = reinterpret_cast<const uint8_t*>(buffer);
     while (num_blocks) {
-        auto data = Compress(compression, iter, block_size);
+        auto data = Compress(compression, iter, block_size, dictionary);
         if (data.empty()) {
             PLOG(ERROR) << "CompressBlocks: Compression failed";
             return false;
@@ -159,9 +199,10 @@ bool CompressWorker::RunThread() {
         // Notify completion
         cv_.notify_all();
 
+        // Keep going: the writer still has to collect the work queued behind
+        // this one, and fails when it retrieves this result.
         if (!ret) {
             LOG(ERROR) << "CompressBlocks failed";
-            return false;
         }
     }
 
@@ -192,26 +233,30 @@ bool CompressWorker::GetCompressedBuffers(std::vector<std::basic_string<uint8_t>
         }
     }
 
+    // Work is completed in the order it was queued; return the oldest item
+    // only, so that the caller can interleave writes with later items.
+    CompressWork blocks;
     {
         std::lock_guard<std::mutex> lock(lock_);
-        while (compressed_queue_.size() > 0) {
-            CompressWork blocks = std::move(compressed_queue_.front());
-            compressed_queue_.pop();
-
-            if (blocks.compression_status) {
-                compressed_buf->insert(compressed_buf->end(),
-                                       std::make_move_iterator(blocks.compressed_data.begin()),
-                                       std::make_move_iterator(blocks.compressed_data.end()));
-            } else {
-                LOG(ERROR) << "Block compression failed";
-                return false;
-            }
-        }
+        blocks = std::move(compressed_queue_.front());
+        compressed_queue_.pop();
     }
 
+    if (!blocks.compression_status) {
+        LOG(ERROR) << "Block compression failed";
+        return false;
+    }
+    compressed_buf->insert(compressed_buf->end(),
+                           std::make_move_iterator(blocks.compressed_data.begin()),
+                           std::make_move_iterator(blocks.compressed_data.end()));
     return true;
 }
 
+void CompressWorker::SetDictionary(std::shared_ptr<ZSTD_CDict> dictionary) {
+    std::lock_guard<std::mutex> lock(lock_);
+    dictionary_ = std::move(dictionary);
+}
+
 void CompressWorker::Finalize() {
     {
         std::unique_lock<std::mutex> lock(lock_);
@@ -220,7 +265,7 @@ void CompressWorker::Finalize() {
     cv_.notify_all();
 }
 
-CompressWorker::CompressWorker(CowCompressionAlgorithm compression, uint32_t block_size)
+CompressWorker::CompressWorker(const CowCompression& compression, uint32_t block_size)
     : compression_(compression), block_size_(block_size) {}
 
 }  // namespace snapshot
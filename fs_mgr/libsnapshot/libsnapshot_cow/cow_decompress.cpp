@@ -22,6 +22,7 @@
 #include <brotli/decode.h>
 #include <lz4.h>
 #include <zlib.h>
+#include <zstd.h>
 
 namespace android {
 namespace snapshot {
@@ -311,5 +312,78 @@ std::unique_ptr<IDecompressor> IDecompressor::Lz4() {
     return std::make_unique<Lz4Decompressor>();
 }
 
+class ZstdDecompressor final : public IDecompressor {
+  public:
+    explicit ZstdDecompressor(const ZSTD_DDict* dictionary) : dictionary_(dictionary) {}
+
+    bool Decompress(const size_t output_size) override {
+        size_t actual_buffer_size = 0;
+        auto&& output_buffer = sink_->GetBuffer(output_size, &actual_buffer_size);
+        if (actual_buffer_size != output_size) {
+            LOG(ERROR) << "Failed to allocate buffer of size " << output_size << " only got "
+                       << actual_buffer_size << " bytes";
+            return false;
+        }
+        // If input size is same as output size, then input is uncompressed.
+        if (stream_->Size() == output_size) {
+            size_t bytes_read = 0;
+            stream_->Read(output_buffer, output_size, &bytes_read);
+            if (bytes_read != output_size) {
+                LOG(ERROR) << "Failed to read all input at once. Expected: " << output_size
+                           << " actual: " << bytes_read;
+                return false;
+            }
+            sink_->ReturnData(output_buffer, output_size);
+            return true;
+        }
+        std::string input_buffer;
+        input_buffer.resize(stream_->Size());
+        size_t bytes_read = 0;
+        stream_->Read(input_buffer.data(), input_buffer.size(), &bytes_read);
+        if (bytes_read != input_buffer.size()) {
+            LOG(ERROR) << "Failed to read all input at once. Expected: " << input_buffer.size()
+                       << " actual: " << bytes_read;
+            return false;
+        }
+
+        // Contexts are expensive to set up, so keep one per thread.
+        static thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(
+                ZSTD_createDCtx(), ZSTD_freeDCtx);
+        if (!dctx) {
+            LOG(ERROR) << "ZSTD_createDCtx failed";
+            return false;
+        }
+
+        size_t bytes_decompressed;
+        if (dictionary_) {
+            bytes_decompressed =
+                    ZSTD_decompress_usingDDict(dctx.get(), output_buffer, output_size,
+                                               input_buffer.data(), input_buffer.size(), dictionary_);
+        } else {
+            bytes_decompressed = ZSTD_decompressDCtx(dctx.get(), output_buffer, output_size,
+                                                     input_buffer.data(), input_buffer.size());
+        }
+        if (ZSTD_isError(bytes_decompressed)) {
+            LOG(ERROR) << "Failed to decompress ZSTD block: "
+                       << ZSTD_getErrorName(bytes_decompressed);
+            return false;
+        }
+        if (bytes_decompressed != output_size) {
+            LOG(ERROR) << "Failed to decompress ZSTD block, expected output size: " << output_size
+                       << ", actual: " << bytes_decompressed;
+            return false;
+        }
+        sink_->ReturnData(output_buffer, output_size);
+        return true;
+    }
+
+  private:
+    const ZSTD_DDict* dictionary_;
+};
+
+std::unique_ptr<IDecompressor> IDecompressor::Zstd(const ZSTD_DDict* dictionary) {
+    return std::make_unique<ZstdDecompressor>(dictionary);
+}
+
 }  // namespace snapshot
 }  // namespace android
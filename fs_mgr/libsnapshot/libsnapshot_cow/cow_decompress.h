@@ -42,6 +42,8 @@ class IDecompressor {
     static std::unique_ptr<IDecompressor> Gz();
     static std::unique_ptr<IDecompressor> Brotli();
     static std::unique_ptr<IDecompressor> Lz4();
+    // |dictionary| must outlive the decompressor, and may be null.
+    static std::unique_ptr<IDecompressor> Zstd(const ZSTD_DDict_s* dictionary);
 
     // |output_bytes| is the expected total number of bytes to sink.
     virtual bool Decompress(size_t output_bytes) = 0;
@@ -41,19 +41,30 @@ std::ostream& operator<<(std::ostream& os, CowOperation const& op) {
         os << "kCowXorOp      ";
     else if (op.type == kCowSequenceOp)
         os << "kCowSequenceOp ";
+    else if (op.type == kCowCompressionUnitOp)
+        os << "kCowCompressionUnitOp ";
+    else if (op.type == kCowOpIndexOp)
+        os << "kCowOpIndexOp  ";
     else if (op.type == kCowFooterOp)
         os << "kCowFooterOp  ";
     else
         os << (int)op.type << "?,";
     os << "compression:";
-    if (op.compression == kCowCompressNone)
+    if (op.compression & kCowCompressionUnitFlag) os << "unit|";
+    if (op.compression & kCowDedupFlag) os << "dedup|";
+    const uint8_t compression = op.compression & ~(kCowCompressionUnitFlag | kCowDedupFlag);
+    if (compression == kCowCompressNone)
         os << "kCowCompressNone,   ";
-    else if (op.compression == kCowCompressGz)
+    else if (compression == kCowCompressGz)
         os << "kCowCompressGz,     ";
-    else if (op.compression == kCowCompressBrotli)
+    else if (compression == kCowCompressBrotli)
         os << "kCowCompressBrotli, ";
+    else if (compression == kCowCompressLz4)
+        os << "kCowCompressLz4,    ";
+    else if (compression == kCowCompressZstd)
+        os << "kCowCompressZstd,   ";
     else
-        os << (int)op.compression << "?, ";
+        os << (int)compression << "?, ";
     os << "data_length:" << op.data_length << ",\t";
     os << "new_block:" << op.new_block << ",\t";
     os << "source:" << op.source;
@@ -63,11 +74,24 @@ std::ostream& operator<<(std::ostream& os, CowOperation const& op) {
     return os;
 }
 
+uint64_t GetOpDataLength(const CowOperation& op) {
+    if (op.type == kCowCompressionUnitOp) {
+        return op.source;
+    }
+    if (op.type == kCowReplaceOp && (op.compression & kCowDedupFlag)) {
+        // The data belongs to an earlier op.
+        return 0;
+    }
+    return op.data_length;
+}
+
 int64_t GetNextOpOffset(const CowOperation& op, uint32_t cluster_ops) {
     if (op.type == kCowClusterOp) {
         return op.source;
-    } else if ((op.type == kCowReplaceOp || op.type == kCowXorOp) && cluster_ops == 0) {
-        return op.data_length;
+    } else if ((op.type == kCowReplaceOp || op.type == kCowXorOp ||
+                op.type == kCowCompressionUnitOp) &&
+               cluster_ops == 0) {
+        return GetOpDataLength(op);
     } else {
         return 0;
     }
@@ -89,6 +113,8 @@ bool IsMetadataOp(const CowOperation& op) {
         case kCowClusterOp:
         case kCowFooterOp:
         case kCowSequenceOp:
+        case kCowCompressionUnitOp:
+        case kCowOpIndexOp:
             return true;
         default:
             return false;
@@ -105,5 +131,20 @@ bool IsOrderedOp(const CowOperation& op) {
     }
 }
 
+std::optional<CowCompressionAlgorithm> CompressionAlgorithmFromString(std::string_view name) {
+    if (name == "gz") {
+        return {kCowCompressGz};
+    } else if (name == "brotli") {
+        return {kCowCompressBrotli};
+    } else if (name == "lz4") {
+        return {kCowCompressLz4};
+    } else if (name == "zstd") {
+        return {kCowCompressZstd};
+    } else if (name == "none" || name.empty()) {
+        return {kCowCompressNone};
+    }
+    return {};
+}
+
 }  // namespace snapshot
 }  // namespace android
@@ -14,9 +14,11 @@
 // limitations under the License.
 //
 
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <limits>
 #include <optional>
 #include <set>
@@ -28,6 +30,7 @@
 #include <android-base/logging.h>
 #include <libsnapshot/cow_reader.h>
 #include <zlib.h>
+#include <zstd.h>
 
 #include "cow_decompress.h"
 
@@ -38,10 +41,107 @@ CowReader::CowReader(ReaderFlags reader_flag, bool is_merge)
     : fd_(-1),
       header_(),
       fd_size_(0),
-      block_pos_index_(std::make_shared<std::vector<int>>()),
+      block_pos_index_(std::make_shared<std::vector<uint32_t>>()),
       reader_flag_(reader_flag),
       is_merge_(is_merge) {}
 
+// Offsets of each section of an op index, relative to its header.
+struct CowOpIndexLayout {
+    uint64_t ops;
+    uint64_t merge_sequence;
+    uint64_t xor_entries;
+    uint64_t unit_entries;
+    uint64_t size;
+};
+
+static uint64_t AlignOpIndexSection(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+static CowOpIndexLayout GetOpIndexLayout(const CowOpIndexHeader& header) {
+    CowOpIndexLayout layout;
+    layout.ops = AlignOpIndexSection(sizeof(CowOpIndexHeader));
+    layout.merge_sequence = AlignOpIndexSection(layout.ops + header.num_ops * sizeof(CowOperation));
+    layout.xor_entries =
+            AlignOpIndexSection(layout.merge_sequence + header.num_merge_ops * sizeof(uint32_t));
+    layout.unit_entries = AlignOpIndexSection(layout.xor_entries +
+                                              header.num_xor_ops * sizeof(CowOpIndexXorEntry));
+    layout.size = layout.unit_entries + header.num_units * sizeof(CowOpIndexUnitEntry);
+    return layout;
+}
+
+// Read-only mapping of an op index. It is shared by a reader and all of its
+// clones, so the ops live in the page cache rather than in each process' heap.
+class CowOpIndex final {
+  public:
+    static std::shared_ptr<const CowOpIndex> Map(android::base::borrowed_fd fd, uint64_t offset,
+                                                 uint64_t fd_size);
+    ~CowOpIndex();
+
+    const CowOpIndexHeader& header() const { return header_; }
+    const CowOperation* ops() const { return Section<CowOperation>(layout_.ops); }
+    const uint32_t* merge_sequence() const { return Section<uint32_t>(layout_.merge_sequence); }
+    const CowOpIndexXorEntry* xor_entries() const {
+        return Section<CowOpIndexXorEntry>(layout_.xor_entries);
+    }
+    const CowOpIndexUnitEntry* unit_entries() const {
+        return Section<CowOpIndexUnitEntry>(layout_.unit_entries);
+    }
+
+  private:
+    CowOpIndex(void* addr, size_t length, const CowOpIndexHeader& header)
+        : addr_(addr), length_(length), header_(header), layout_(GetOpIndexLayout(header)) {}
+
+    template <typename T>
+    const T* Section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(addr_) + offset);
+    }
+
+    void* addr_;
+    size_t length_;
+    CowOpIndexHeader header_;
+    CowOpIndexLayout layout_;
+};
+
+std::shared_ptr<const CowOpIndex> CowOpIndex::Map(android::base::borrowed_fd fd, uint64_t offset,
+                                                  uint64_t fd_size) {
+    CowOpIndexHeader header;
+    if (offset % getpagesize() != 0 || offset > fd_size ||
+        fd_size - offset < sizeof(CowOpIndexHeader)) {
+        LOG(ERROR) << "Invalid op index offset: " << offset;
+        return nullptr;
+    }
+    if (!android::base::ReadFullyAtOffset(fd, &header, sizeof(header), offset)) {
+        PLOG(ERROR) << "read op index header failed";
+        return nullptr;
+    }
+    // Bound each count by the file size before computing the layout, so that
+    // the offsets can't overflow.
+    uint64_t available = fd_size - offset;
+    if (header.magic != kCowOpIndexMagic || header.num_ops > available / sizeof(CowOperation) ||
+        header.num_merge_ops > header.num_ops || header.num_ordered_ops > header.num_merge_ops ||
+        header.num_xor_ops > header.num_ops || header.num_units > header.num_ops) {
+        LOG(ERROR) << "Invalid op index header";
+        return nullptr;
+    }
+    auto layout = GetOpIndexLayout(header);
+    if (layout.size > available) {
+        LOG(ERROR) << "Op index of size " << layout.size << " exceeds the COW";
+        return nullptr;
+    }
+
+    void* addr = mmap(nullptr, layout.size, PROT_READ, MAP_SHARED, fd.get(), offset);
+    if (addr == MAP_FAILED) {
+        PLOG(ERROR) << "mmap op index failed";
+        return nullptr;
+    }
+    return std::shared_ptr<const CowOpIndex>(new CowOpIndex(addr, layout.size, header));
+}
+
+CowOpIndex::~CowOpIndex() {
+    munmap(addr_, length_);
+}
+
 static void SHA256(const void*, size_t, uint8_t[]) {
 #if 0
     SHA256_CTX c;
@@ -56,6 +156,7 @@ std::unique_ptr<CowReader> CowReader::CloneCowReader() {
     cow->owned_fd_.reset();
     cow->header_ = header_;
     cow->footer_ = footer_;
+    cow->footer_offset_ = footer_offset_;
     cow->fd_size_ = fd_size_;
     cow->last_label_ = last_label_;
     cow->ops_ = ops_;
@@ -64,7 +165,11 @@ std::unique_ptr<CowReader> CowReader::CloneCowReader() {
     cow->num_ordered_ops_to_merge_ = num_ordered_ops_to_merge_;
     cow->has_seq_ops_ = has_seq_ops_;
     cow->data_loc_ = data_loc_;
+    cow->dictionary_ = dictionary_;
+    cow->units_ = units_;
     cow->block_pos_index_ = block_pos_index_;
+    cow->num_ordered_ops_ = num_ordered_ops_;
+    cow->op_index_ = op_index_;
     cow->is_merge_ = is_merge_;
     return cow;
 }
@@ -97,6 +202,14 @@ bool CowReader::Parse(android::base::unique_fd&& fd, std::optional<uint64_t> lab
     return Parse(android::base::borrowed_fd{owned_fd_}, label);
 }
 
+bool CowReader::ParseWithOpIndex(android::base::borrowed_fd fd,
+                                 android::base::borrowed_fd op_index_fd) {
+    op_index_fd_ = op_index_fd;
+    bool ok = Parse(fd);
+    op_index_fd_ = -1;
+    return ok;
+}
+
 bool CowReader::Parse(android::base::borrowed_fd fd, std::optional<uint64_t> label) {
     fd_ = fd;
 
@@ -145,15 +258,26 @@ bool CowReader::Parse(android::base::borrowed_fd fd, std::optional<uint64_t> lab
         return false;
     }
 
-    if ((header_.major_version > kCowVersionMajor) || (header_.minor_version != kCowVersionMinor)) {
+    if ((header_.major_version > kCowVersionMajorMax) ||
+        (header_.minor_version != kCowVersionMinor)) {
         LOG(ERROR) << "Header version mismatch";
         LOG(ERROR) << "Major version: " << header_.major_version
-                   << "Expected: " << kCowVersionMajor;
+                   << "Expected: " << kCowVersionMajorMax;
         LOG(ERROR) << "Minor version: " << header_.minor_version
                    << "Expected: " << kCowVersionMinor;
         return false;
     }
 
+    if (!ReadDictionary()) {
+        return false;
+    }
+
+    // A complete COW may carry an index of its ops, which makes parsing
+    // unnecessary. Any problem with it just means falling back to parsing.
+    if (!label && reader_flag_ == ReaderFlags::USERSPACE_MERGE && LoadOpIndex()) {
+        return true;
+    }
+
     if (!ParseOps(label)) {
         return false;
     }
@@ -162,9 +286,187 @@ bool CowReader::Parse(android::base::borrowed_fd fd, std::optional<uint64_t> lab
     return PrepMergeOps();
 }
 
+bool CowReader::ReadDictionary() {
+    if (header_.header_size <= sizeof(CowHeader)) {
+        return true;
+    }
+    if (header_.major_version < kCowVersionMajorMax) {
+        LOG(ERROR) << "COW version " << header_.major_version
+                   << " has an unexpected header size: " << header_.header_size;
+        return false;
+    }
+
+    CowDictionaryHeader dict_header;
+    if (!android::base::ReadFullyAtOffset(fd_, &dict_header, sizeof(dict_header),
+                                          sizeof(CowHeader))) {
+        PLOG(ERROR) << "read dictionary header failed";
+        return false;
+    }
+    if (sizeof(CowHeader) + sizeof(dict_header) + dict_header.dictionary_capacity >
+                header_.header_size ||
+        dict_header.dictionary_size > dict_header.dictionary_capacity) {
+        LOG(ERROR) << "Invalid dictionary region, size: " << dict_header.dictionary_size
+                   << ", capacity: " << dict_header.dictionary_capacity
+                   << ", header size: " << header_.header_size;
+        return false;
+    }
+    if (!dict_header.dictionary_size) {
+        return true;
+    }
+    if (dict_header.compression != kCowCompressZstd) {
+        LOG(ERROR) << "Unknown dictionary compression type: "
+                   << static_cast<int>(dict_header.compression);
+        return false;
+    }
+
+    std::string dict(dict_header.dictionary_size, '\0');
+    if (!android::base::ReadFullyAtOffset(fd_, dict.data(), dict.size(),
+                                          sizeof(CowHeader) + sizeof(dict_header))) {
+        PLOG(ERROR) << "read dictionary failed";
+        return false;
+    }
+    dictionary_.reset(ZSTD_createDDict(dict.data(), dict.size()), ZSTD_freeDDict);
+    if (!dictionary_) {
+        LOG(ERROR) << "ZSTD_createDDict failed";
+        return false;
+    }
+    return true;
+}
+
+bool CowReader::LoadOpIndex() {
+    // v1 COWs have no scratch space field, which ParseOps() fixes up.
+    if (header_.major_version < 2) {
+        return false;
+    }
+
+    std::shared_ptr<const CowOpIndex> op_index;
+    if (op_index_fd_.get() >= 0) {
+        off_t index_size = lseek(op_index_fd_.get(), 0, SEEK_END);
+        if (index_size < 0) {
+            PLOG(ERROR) << "lseek op index failed";
+            return false;
+        }
+        op_index = CowOpIndex::Map(op_index_fd_, 0, index_size);
+    } else {
+        if (header_.major_version < kCowVersionMajorMax) {
+            return false;
+        }
+        CowOperation first_op;
+        if (!android::base::ReadFullyAtOffset(fd_, &first_op, sizeof(first_op),
+                                              header_.header_size + header_.buffer_size)) {
+            return false;
+        }
+        if (first_op.type != kCowOpIndexOp || !first_op.source) {
+            return false;
+        }
+        op_index = CowOpIndex::Map(fd_, first_op.source, fd_size_);
+    }
+    if (!op_index) {
+        LOG(WARNING) << "Ignoring unusable op index";
+        return false;
+    }
+
+    // The index must describe the footer that is actually in the file.
+    const auto& index_header = op_index->header();
+    CowFooter footer;
+    if (index_header.footer_offset > fd_size_ ||
+        fd_size_ - index_header.footer_offset < sizeof(footer) ||
+        !android::base::ReadFullyAtOffset(fd_, &footer, sizeof(footer),
+                                          index_header.footer_offset) ||
+        footer.op.type != kCowFooterOp || footer.op.num_ops != index_header.num_ops) {
+        LOG(WARNING) << "Op index does not match the COW footer, ignoring it";
+        return false;
+    }
+
+    footer_ = footer;
+    footer_offset_ = index_header.footer_offset;
+    if (index_header.has_label) {
+        last_label_ = {index_header.last_label};
+    }
+    num_total_data_ops_ = index_header.num_merge_ops;
+    num_ordered_ops_ = index_header.num_ordered_ops;
+    if (num_ordered_ops_ > header_.num_merge_ops) {
+        num_ordered_ops_to_merge_ = num_ordered_ops_ - header_.num_merge_ops;
+    } else {
+        num_ordered_ops_to_merge_ = 0;
+    }
+    if (header_.num_merge_ops > 0) {
+        merge_op_start_ = header_.num_merge_ops;
+    }
+    op_index_ = std::move(op_index);
+    LOG(DEBUG) << "COW op index loaded. Total ops: " << index_header.num_ops;
+    return true;
+}
+
+bool CowReader::WriteOpIndex(android::base::borrowed_fd fd, uint64_t offset,
+                             uint64_t footer_offset, uint64_t* size) {
+    if (op_index_ || is_merge_ || reader_flag_ != ReaderFlags::USERSPACE_MERGE || !ops_) {
+        LOG(ERROR) << "Cannot write an op index from this reader";
+        return false;
+    }
+
+    CowOpIndexHeader header = {};
+    header.magic = kCowOpIndexMagic;
+    header.footer_offset = footer_offset;
+    header.num_ops = ops_->size();
+    header.num_merge_ops = block_pos_index_->size();
+    header.num_ordered_ops = num_ordered_ops_;
+    header.num_xor_ops = data_loc_->size();
+    header.num_units = units_->size();
+    if (last_label_) {
+        header.has_label = 1;
+        header.last_label = last_label_.value();
+    }
+
+    std::vector<CowOpIndexXorEntry> xor_entries;
+    xor_entries.reserve(data_loc_->size());
+    for (const auto& [new_block, data_offset] : *data_loc_) {
+        xor_entries.push_back({new_block, data_offset});
+    }
+    std::sort(xor_entries.begin(), xor_entries.end(),
+              [](const auto& a, const auto& b) { return a.new_block < b.new_block; });
+
+    std::vector<CowOpIndexUnitEntry> unit_entries;
+    unit_entries.reserve(units_->size());
+    for (const auto& [data_offset, op] : *units_) {
+        unit_entries.push_back({data_offset, op});
+    }
+    std::sort(unit_entries.begin(), unit_entries.end(),
+              [](const auto& a, const auto& b) { return a.data_offset < b.data_offset; });
+
+    auto layout = GetOpIndexLayout(header);
+    if (!android::base::WriteFullyAtOffset(fd, &header, sizeof(header), offset) ||
+        !android::base::WriteFullyAtOffset(fd, ops_->data(),
+                                           ops_->size() * sizeof(CowOperation),
+                                           offset + layout.ops) ||
+        !android::base::WriteFullyAtOffset(fd, block_pos_index_->data(),
+                                           block_pos_index_->size() * sizeof(uint32_t),
+                                           offset + layout.merge_sequence) ||
+        !android::base::WriteFullyAtOffset(fd, xor_entries.data(),
+                                           xor_entries.size() * sizeof(CowOpIndexXorEntry),
+                                           offset + layout.xor_entries) ||
+        !android::base::WriteFullyAtOffset(fd, unit_entries.data(),
+                                           unit_entries.size() * sizeof(CowOpIndexUnitEntry),
+                                           offset + layout.unit_entries)) {
+        PLOG(ERROR) << "write op index failed";
+        return false;
+    }
+    *size = layout.size;
+    return true;
+}
+
+bool CowReader::ExportOpIndex(android::base::borrowed_fd fd, uint64_t* size) {
+    if (!footer_) {
+        LOG(ERROR) << "Cannot export an op index without a COW footer";
+        return false;
+    }
+    return WriteOpIndex(fd, 0, footer_offset_, size);
+}
+
 bool CowReader::ParseOps(std::optional<uint64_t> label) {
     uint64_t pos;
     auto data_loc = std::make_shared<std::unordered_map<uint64_t, uint64_t>>();
+    auto units = std::make_shared<std::unordered_map<uint64_t, CowOperation>>();
 
     // Skip the scratch space
     if (header_.major_version >= 2 && (header_.buffer_size > 0)) {
@@ -210,12 +512,16 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
         // Parse current cluster to find start of next cluster
         while (current_op_num < ops_buffer->size()) {
             auto& current_op = ops_buffer->data()[current_op_num];
+            uint64_t op_pos = pos;
             current_op_num++;
             if (current_op.type == kCowXorOp) {
                 data_loc->insert({current_op.new_block, data_pos});
+            } else if (current_op.type == kCowCompressionUnitOp) {
+                units->insert({data_pos, current_op});
             }
             pos += sizeof(CowOperation) + GetNextOpOffset(current_op, header_.cluster_ops);
-            data_pos += current_op.data_length + GetNextDataOffset(current_op, header_.cluster_ops);
+            data_pos += GetOpDataLength(current_op) +
+                        GetNextDataOffset(current_op, header_.cluster_ops);
 
             if (current_op.type == kCowClusterOp) {
                 break;
@@ -229,6 +535,7 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
                 }
             } else if (current_op.type == kCowFooterOp) {
                 footer_.emplace();
+                footer_offset_ = op_pos;
                 CowFooter* footer = &footer_.value();
                 memcpy(&footer_->op, &current_op, sizeof(footer->op));
                 off_t offs = lseek(fd_.get(), pos, SEEK_SET);
@@ -307,6 +614,7 @@ bool CowReader::ParseOps(std::optional<uint64_t> label) {
     ops_ = ops_buffer;
     ops_->shrink_to_fit();
     data_loc_ = data_loc;
+    units_ = units;
 
     return true;
 }
@@ -419,7 +727,7 @@ bool CowReader::PrepMergeOps() {
     auto merge_op_blocks = std::make_unique<std::vector<uint32_t>>();
     std::vector<int> other_ops;
     auto seq_ops_set = std::unordered_set<uint32_t>();
-    auto block_map = std::make_unique<std::unordered_map<uint32_t, int>>();
+    auto block_map = std::make_unique<std::unordered_map<uint32_t, uint32_t>>();
     size_t num_seqs = 0;
     size_t read;
 
@@ -459,6 +767,7 @@ bool CowReader::PrepMergeOps() {
         }
     }
 
+    num_ordered_ops_ = merge_op_blocks->size();
     if (merge_op_blocks->size() > header_.num_merge_ops) {
         num_ordered_ops_to_merge_ = merge_op_blocks->size() - header_.num_merge_ops;
     } else {
@@ -561,9 +870,12 @@ bool CowReader::GetLastLabel(uint64_t* label) {
     return true;
 }
 
+// Iterates over |size| ops, either in place or, if |index| is set, in the
+// order given by |index|. |owner| keeps the underlying storage alive.
 class CowOpIter final : public ICowOpIter {
   public:
-    CowOpIter(std::shared_ptr<std::vector<CowOperation>>& ops, uint64_t start);
+    CowOpIter(std::shared_ptr<const void> owner, const CowOperation* ops, const uint32_t* index,
+              uint64_t size, uint64_t start);
 
     bool Done() override;
     const CowOperation& Get() override;
@@ -573,61 +885,44 @@ class CowOpIter final : public ICowOpIter {
     bool RDone() override;
 
   private:
-    std::shared_ptr<std::vector<CowOperation>> ops_;
-    std::vector<CowOperation>::iterator op_iter_;
+    std::shared_ptr<const void> owner_;
+    const CowOperation* ops_;
+    const uint32_t* index_;
+    uint64_t size_;
+    uint64_t pos_;
 };
 
-CowOpIter::CowOpIter(std::shared_ptr<std::vector<CowOperation>>& ops, uint64_t start) {
-    ops_ = ops;
-    op_iter_ = ops_->begin() + start;
-}
+CowOpIter::CowOpIter(std::shared_ptr<const void> owner, const CowOperation* ops,
+                     const uint32_t* index, uint64_t size, uint64_t start)
+    : owner_(std::move(owner)), ops_(ops), index_(index), size_(size), pos_(start) {}
 
 bool CowOpIter::RDone() {
-    return op_iter_ == ops_->begin();
+    return pos_ == 0;
 }
 
 void CowOpIter::Prev() {
     CHECK(!RDone());
-    op_iter_--;
+    pos_--;
 }
 
 bool CowOpIter::Done() {
-    return op_iter_ == ops_->end();
+    return pos_ == size_;
 }
 
 void CowOpIter::Next() {
     CHECK(!Done());
-    op_iter_++;
+    pos_++;
 }
 
 const CowOperation& CowOpIter::Get() {
     CHECK(!Done());
-    return (*op_iter_);
+    return index_ ? ops_[index_[pos_]] : ops_[pos_];
 }
 
 class CowRevMergeOpIter final : public ICowOpIter {
   public:
-    explicit CowRevMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
-                               std::shared_ptr<std::vector<int>> block_pos_index, uint64_t start);
-
-    bool Done() override;
-    const CowOperation& Get() override;
-    void Next() override;
-
-    void Prev() override;
-    bool RDone() override;
-
-  private:
-    std::shared_ptr<std::vector<CowOperation>> ops_;
-    std::vector<int>::reverse_iterator block_riter_;
-    std::shared_ptr<std::vector<int>> cow_op_index_vec_;
-    uint64_t start_;
-};
-
-class CowMergeOpIter final : public ICowOpIter {
-  public:
-    explicit CowMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
-                            std::shared_ptr<std::vector<int>> block_pos_index, uint64_t start);
+    CowRevMergeOpIter(std::shared_ptr<const void> owner, const CowOperation* ops,
+                      const uint32_t* index, uint64_t size, uint64_t start);
 
     bool Done() override;
     const CowOperation& Get() override;
@@ -637,87 +932,85 @@ class CowMergeOpIter final : public ICowOpIter {
     bool RDone() override;
 
   private:
-    std::shared_ptr<std::vector<CowOperation>> ops_;
-    std::vector<int>::iterator block_iter_;
-    std::shared_ptr<std::vector<int>> cow_op_index_vec_;
+    std::shared_ptr<const void> owner_;
+    const CowOperation* ops_;
+    const uint32_t* index_;
+    uint64_t size_;
     uint64_t start_;
+    // One past the current entry of |index_|.
+    uint64_t pos_;
 };
 
-CowMergeOpIter::CowMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
-                               std::shared_ptr<std::vector<int>> block_pos_index, uint64_t start) {
-    ops_ = ops;
-    start_ = start;
-    cow_op_index_vec_ = block_pos_index;
-    block_iter_ = cow_op_index_vec_->begin() + start;
-}
-
-bool CowMergeOpIter::RDone() {
-    return block_iter_ == cow_op_index_vec_->begin();
-}
-
-void CowMergeOpIter::Prev() {
-    CHECK(!RDone());
-    block_iter_--;
-}
-
-bool CowMergeOpIter::Done() {
-    return block_iter_ == cow_op_index_vec_->end();
-}
-
-void CowMergeOpIter::Next() {
-    CHECK(!Done());
-    block_iter_++;
-}
-
-const CowOperation& CowMergeOpIter::Get() {
-    CHECK(!Done());
-    return ops_->data()[*block_iter_];
-}
-
-CowRevMergeOpIter::CowRevMergeOpIter(std::shared_ptr<std::vector<CowOperation>> ops,
-                                     std::shared_ptr<std::vector<int>> block_pos_index,
-                                     uint64_t start) {
-    ops_ = ops;
-    start_ = start;
-    cow_op_index_vec_ = block_pos_index;
-    block_riter_ = cow_op_index_vec_->rbegin();
-}
+CowRevMergeOpIter::CowRevMergeOpIter(std::shared_ptr<const void> owner, const CowOperation* ops,
+                                     const uint32_t* index, uint64_t size, uint64_t start)
+    : owner_(std::move(owner)),
+      ops_(ops),
+      index_(index),
+      size_(size),
+      start_(std::min(start, size)),
+      pos_(size) {}
 
 bool CowRevMergeOpIter::RDone() {
-    return block_riter_ == cow_op_index_vec_->rbegin();
+    return pos_ == size_;
 }
 
 void CowRevMergeOpIter::Prev() {
     CHECK(!RDone());
-    block_riter_--;
+    pos_++;
 }
 
 bool CowRevMergeOpIter::Done() {
-    return block_riter_ == cow_op_index_vec_->rend() - start_;
+    return pos_ == start_;
 }
 
 void CowRevMergeOpIter::Next() {
     CHECK(!Done());
-    block_riter_++;
+    pos_--;
 }
 
 const CowOperation& CowRevMergeOpIter::Get() {
     CHECK(!Done());
-    return ops_->data()[*block_riter_];
+    return ops_[index_[pos_ - 1]];
 }
 
 std::unique_ptr<ICowOpIter> CowReader::GetOpIter(bool merge_progress) {
-    return std::make_unique<CowOpIter>(ops_, merge_progress ? merge_op_start_ : 0);
+    uint64_t start = merge_progress ? merge_op_start_ : 0;
+    if (op_index_) {
+        // The merge reader only sees data ops, in merge order.
+        if (is_merge_) {
+            const auto& header = op_index_->header();
+            return std::make_unique<CowOpIter>(op_index_, op_index_->ops(),
+                                               op_index_->merge_sequence(), header.num_merge_ops,
+                                               std::min(start, header.num_merge_ops));
+        }
+        return std::make_unique<CowOpIter>(op_index_, op_index_->ops(), nullptr,
+                                           op_index_->header().num_ops, start);
+    }
+    return std::make_unique<CowOpIter>(ops_, ops_->data(), nullptr, ops_->size(), start);
 }
 
 std::unique_ptr<ICowOpIter> CowReader::GetRevMergeOpIter(bool ignore_progress) {
-    return std::make_unique<CowRevMergeOpIter>(ops_, block_pos_index_,
-                                               ignore_progress ? 0 : merge_op_start_);
+    uint64_t start = ignore_progress ? 0 : merge_op_start_;
+    if (op_index_) {
+        return std::make_unique<CowRevMergeOpIter>(op_index_, op_index_->ops(),
+                                                   op_index_->merge_sequence(),
+                                                   op_index_->header().num_merge_ops, start);
+    }
+    return std::make_unique<CowRevMergeOpIter>(ops_, ops_->data(), block_pos_index_->data(),
+                                               block_pos_index_->size(), start);
 }
 
 std::unique_ptr<ICowOpIter> CowReader::GetMergeOpIter(bool ignore_progress) {
-    return std::make_unique<CowMergeOpIter>(ops_, block_pos_index_,
-                                            ignore_progress ? 0 : merge_op_start_);
+    uint64_t start = ignore_progress ? 0 : merge_op_start_;
+    if (op_index_) {
+        const auto& header = op_index_->header();
+        return std::make_unique<CowOpIter>(op_index_, op_index_->ops(),
+                                           op_index_->merge_sequence(), header.num_merge_ops,
+                                           std::min(start, header.num_merge_ops));
+    }
+    return std::make_unique<CowOpIter>(ops_, ops_->data(), block_pos_index_->data(),
+                                       block_pos_index_->size(),
+                                       std::min<uint64_t>(start, block_pos_index_->size()));
 }
 
 bool CowReader::GetRawBytes(uint64_t offset, void* buffer, size_t len, size_t* read) {
@@ -727,11 +1020,7 @@ bool CowReader::GetRawBytes(uint64_t offset, void* buffer, size_t len, size_t* r
         LOG(ERROR) << "invalid data offset: " << offset << ", " << len << " bytes";
         return false;
     }
-    if (lseek(fd_.get(), offset, SEEK_SET) < 0) {
-        PLOG(ERROR) << "lseek to read raw bytes failed";
-        return false;
-    }
-    ssize_t rv = TEMP_FAILURE_RETRY(::read(fd_.get(), buffer, len));
+    ssize_t rv = TEMP_FAILURE_RETRY(::pread64(fd_.get(), buffer, len, offset));
     if (rv < 0) {
         PLOG(ERROR) << "read failed";
         return false;
@@ -770,31 +1059,148 @@ class CowDataStream final : public IByteStream {
     size_t remaining_;
 };
 
-bool CowReader::ReadData(const CowOperation& op, IByteSink* sink) {
-    std::unique_ptr<IDecompressor> decompressor;
-    switch (op.compression) {
+static std::unique_ptr<IDecompressor> CreateDecompressor(uint8_t compression,
+                                                         const ZSTD_DDict* dictionary) {
+    switch (compression) {
         case kCowCompressNone:
-            decompressor = IDecompressor::Uncompressed();
-            break;
+            return IDecompressor::Uncompressed();
         case kCowCompressGz:
-            decompressor = IDecompressor::Gz();
-            break;
+            return IDecompressor::Gz();
         case kCowCompressBrotli:
-            decompressor = IDecompressor::Brotli();
-            break;
+            return IDecompressor::Brotli();
         case kCowCompressLz4:
-            decompressor = IDecompressor::Lz4();
-            break;
+            return IDecompressor::Lz4();
+        case kCowCompressZstd:
+            return IDecompressor::Zstd(dictionary);
         default:
-            LOG(ERROR) << "Unknown compression type: " << op.compression;
+            LOG(ERROR) << "Unknown compression type: " << static_cast<int>(compression);
+            return nullptr;
+    }
+}
+
+// Sink which decompresses into a preallocated string.
+class FixedStringSink final : public IByteSink {
+  public:
+    explicit FixedStringSink(std::string* buffer) : buffer_(buffer) {}
+
+    void* GetBuffer(size_t requested, size_t* actual) override {
+        *actual = std::min(requested, buffer_->size() - offset_);
+        return buffer_->data() + offset_;
+    }
+    bool ReturnData(void*, size_t length) override {
+        offset_ += length;
+        return true;
+    }
+    size_t offset() const { return offset_; }
+
+  private:
+    std::string* buffer_;
+    size_t offset_ = 0;
+};
+
+bool CowReader::GetXorDataOffset(const CowOperation& op, uint64_t* offset) {
+    if (op_index_) {
+        const auto* begin = op_index_->xor_entries();
+        const auto* end = begin + op_index_->header().num_xor_ops;
+        auto iter = std::lower_bound(begin, end, op.new_block, [](const auto& entry, uint64_t b) {
+            return entry.new_block < b;
+        });
+        if (iter != end && iter->new_block == op.new_block) {
+            *offset = iter->data_offset;
+            return true;
+        }
+    } else if (auto iter = data_loc_->find(op.new_block); iter != data_loc_->end()) {
+        *offset = iter->second;
+        return true;
+    }
+    LOG(ERROR) << "No data found for xor op: " << op;
+    return false;
+}
+
+bool CowReader::GetCompressionUnit(uint64_t offset, CowOperation* unit) {
+    if (op_index_) {
+        const auto* begin = op_index_->unit_entries();
+        const auto* end = begin + op_index_->header().num_units;
+        auto iter = std::lower_bound(begin, end, offset, [](const auto& entry, uint64_t o) {
+            return entry.data_offset < o;
+        });
+        if (iter != end && iter->data_offset == offset) {
+            *unit = iter->op;
+            return true;
+        }
+    } else if (auto iter = units_->find(offset); iter != units_->end()) {
+        *unit = iter->second;
+        return true;
+    }
+    return false;
+}
+
+bool CowReader::ReadUnitData(const CowOperation& op, IByteSink* sink) {
+    CowOperation unit;
+    if (!GetCompressionUnit(op.source, &unit)) {
+        LOG(ERROR) << "No compression unit at offset " << op.source << " for op: " << op;
+        return false;
+    }
+    if (op.new_block < unit.new_block || op.new_block >= unit.new_block + unit.data_length) {
+        LOG(ERROR) << "Op: " << op << " is not covered by its compression unit: " << unit;
+        return false;
+    }
+
+    // Consecutive blocks are usually read together, so decompress each unit
+    // once and serve the following blocks from the cache.
+    if (cached_unit_.empty() || cached_unit_offset_ != op.source) {
+        auto decompressor = CreateDecompressor(unit.compression, dictionary_.get());
+        if (!decompressor) {
+            return false;
+        }
+
+        const size_t unit_size = unit.data_length * header_.block_size;
+        cached_unit_.resize(unit_size);
+        FixedStringSink unit_sink(&cached_unit_);
+        CowDataStream stream(this, op.source, unit.source);
+        decompressor->set_stream(&stream);
+        decompressor->set_sink(&unit_sink);
+        if (!decompressor->Decompress(unit_size) || unit_sink.offset() != unit_size) {
+            LOG(ERROR) << "Failed to decompress compression unit: " << unit;
+            cached_unit_.clear();
             return false;
+        }
+        cached_unit_offset_ = op.source;
     }
 
-    uint64_t offset;
-    if (op.type == kCowXorOp) {
-        offset = data_loc_->at(op.new_block);
-    } else {
-        offset = op.source;
+    const char* data = cached_unit_.data() + (op.new_block - unit.new_block) * header_.block_size;
+    size_t remaining = header_.block_size;
+    while (remaining) {
+        size_t actual = 0;
+        void* buffer = sink->GetBuffer(remaining, &actual);
+        if (!buffer || !actual) {
+            LOG(ERROR) << "Could not acquire buffer from sink";
+            return false;
+        }
+        actual = std::min(actual, remaining);
+        memcpy(buffer, data, actual);
+        if (!sink->ReturnData(buffer, actual)) {
+            LOG(ERROR) << "Could not return buffer to sink";
+            return false;
+        }
+        data += actual;
+        remaining -= actual;
+    }
+    return true;
+}
+
+bool CowReader::ReadData(const CowOperation& op, IByteSink* sink) {
+    if (op.compression & kCowCompressionUnitFlag) {
+        return ReadUnitData(op, sink);
+    }
+
+    auto decompressor = CreateDecompressor(op.compression & ~kCowDedupFlag, dictionary_.get());
+    if (!decompressor) {
+        return false;
+    }
+    uint64_t offset = op.source;
+    if (op.type == kCowXorOp && !GetXorDataOffset(op, &offset)) {
+        return false;
     }
     CowDataStream stream(this, offset, op.data_length);
     decompressor->set_stream(&stream);
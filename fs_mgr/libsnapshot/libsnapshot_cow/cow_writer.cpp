@@ -23,14 +23,19 @@
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
+#include <android-base/scopeguard.h>
+#include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <brotli/encode.h>
 #include <libsnapshot/cow_format.h>
 #include <libsnapshot/cow_reader.h>
 #include <libsnapshot/cow_writer.h>
 #include <lz4.h>
+#include <zdict.h>
 #include <zlib.h>
+#include <zstd.h>
 
 #include <fcntl.h>
 #include <linux/fs.h>
@@ -194,18 +199,51 @@ void CowWriter::SetupHeaders() {
 }
 
 bool CowWriter::ParseOptions() {
-    if (options_.compression == "gz") {
-        compression_ = kCowCompressGz;
-    } else if (options_.compression == "brotli") {
-        compression_ = kCowCompressBrotli;
-    } else if (options_.compression == "lz4") {
-        compression_ = kCowCompressLz4;
-    } else if (options_.compression == "none") {
-        compression_ = kCowCompressNone;
-    } else if (!options_.compression.empty()) {
+    auto parts = android::base::Split(options_.compression, ",");
+    if (parts.size() > 2) {
+        LOG(ERROR) << "failed to parse compression parameters: " << options_.compression;
+        return false;
+    }
+    auto algorithm = CompressionAlgorithmFromString(parts[0]);
+    if (!algorithm) {
         LOG(ERROR) << "unrecognized compression: " << options_.compression;
         return false;
     }
+    compression_.algorithm = *algorithm;
+    compression_.compression_level = 0;
+    if (parts.size() == 2 &&
+        !android::base::ParseInt(parts[1], &compression_.compression_level)) {
+        LOG(ERROR) << "failed to parse compression level: " << parts[1];
+        return false;
+    }
+
+    dictionary_capacity_ = 0;
+    if (compression_.algorithm == kCowCompressZstd && options_.compression_dictionary_blocks) {
+        dictionary_capacity_ = options_.compression_dictionary_size;
+        // The dictionary region is accounted for in the 16-bit header_size.
+        const size_t max_capacity = std::numeric_limits<uint16_t>::max() - sizeof(CowHeader) -
+                                    sizeof(CowDictionaryHeader);
+        if (!dictionary_capacity_ || dictionary_capacity_ > max_capacity) {
+            LOG(ERROR) << "invalid compression dictionary size: " << dictionary_capacity_;
+            return false;
+        }
+    }
+
+    compression_unit_blocks_ = 0;
+    if (options_.compression_unit_size) {
+        if (options_.compression_unit_size % options_.block_size != 0 ||
+            options_.compression_unit_size > kCowMaxCompressionUnitSize) {
+            LOG(ERROR) << "invalid compression unit size: " << options_.compression_unit_size;
+            return false;
+        }
+        // Units only pay off when the data is compressed.
+        if (compression_.algorithm != kCowCompressNone) {
+            compression_unit_blocks_ = options_.compression_unit_size / options_.block_size;
+        }
+    }
+
+    dedup_blocks_ = options_.dedup_blocks;
+
     if (options_.cluster_ops == 1) {
         LOG(ERROR) << "Clusters must contain at least two operations to function.";
         return false;
@@ -281,6 +319,7 @@ void CowWriter::InitWorkers() {
     }
     for (int i = 0; i < num_compress_threads_; i++) {
         auto wt = std::make_unique<CompressWorker>(compression_, header_.block_size);
+        wt->SetDictionary(dictionary_);
         threads_.emplace_back(std::async(std::launch::async, &CompressWorker::RunThread, wt.get()));
         compress_threads_.push_back(std::move(wt));
     }
@@ -326,7 +365,7 @@ bool CowWriter::InitializeAppend(android::base::borrowed_fd fd, uint64_t label)
 }
 
 void CowWriter::InitPos() {
-    next_op_pos_ = sizeof(header_) + header_.buffer_size;
+    next_op_pos_ = header_.header_size + header_.buffer_size;
     cluster_size_ = header_.cluster_ops * sizeof(CowOperation);
     if (header_.cluster_ops) {
         next_data_pos_ = next_op_pos_ + cluster_size_;
@@ -335,6 +374,7 @@ void CowWriter::InitPos() {
     }
     current_cluster_size_ = 0;
     current_data_size_ = 0;
+    dedup_table_.clear();
 }
 
 bool CowWriter::OpenForWrite() {
@@ -352,6 +392,13 @@ bool CowWriter::OpenForWrite() {
     if (options_.scratch_space) {
         header_.buffer_size = BUFFER_REGION_DEFAULT_SIZE;
     }
+    if (dictionary_capacity_) {
+        header_.header_size = sizeof(CowHeader) + sizeof(CowDictionaryHeader) + dictionary_capacity_;
+    }
+    if (compression_unit_blocks_ > 1 || options_.op_index || dedup_blocks_ ||
+        dictionary_capacity_) {
+        header_.major_version = kCowVersionMajorMax;
+    }
 
     // Headers are not complete, but this ensures the file is at the right
     // position.
@@ -360,6 +407,18 @@ bool CowWriter::OpenForWrite() {
         return false;
     }
 
+    if (dictionary_capacity_) {
+        // Reserve the dictionary region. It is filled in by TrainDictionary().
+        std::string data(sizeof(CowDictionaryHeader) + dictionary_capacity_, 0);
+        auto dict_header = reinterpret_cast<CowDictionaryHeader*>(data.data());
+        dict_header->compression = compression_.algorithm;
+        dict_header->dictionary_capacity = dictionary_capacity_;
+        if (!android::base::WriteFully(fd_, data.data(), data.size())) {
+            PLOG(ERROR) << "writing dictionary region failed";
+            return false;
+        }
+    }
+
     if (options_.scratch_space) {
         // Initialize the scratch space
         std::string data(header_.buffer_size, 0);
@@ -374,7 +433,7 @@ bool CowWriter::OpenForWrite() {
         return false;
     }
 
-    if (lseek(fd_.get(), sizeof(header_) + header_.buffer_size, SEEK_SET) < 0) {
+    if (lseek(fd_.get(), header_.header_size + header_.buffer_size, SEEK_SET) < 0) {
         PLOG(ERROR) << "lseek failed";
         return false;
     }
@@ -382,6 +441,17 @@ bool CowWriter::OpenForWrite() {
     InitPos();
     InitBatchWrites();
 
+    if (options_.op_index) {
+        // Reserve the first op; Finalize() points it at the index.
+        CowOperation op = {};
+        op.type = kCowOpIndexOp;
+        op_index_pos_ = next_op_pos_;
+        if (!WriteOperation(op)) {
+            LOG(ERROR) << "Failed to write op index placeholder";
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -396,12 +466,37 @@ bool CowWriter::OpenForAppend(uint64_t label) {
     options_.block_size = header_.block_size;
     options_.cluster_ops = header_.cluster_ops;
 
+    if (!ReadDictionary()) {
+        return false;
+    }
+
+    // The header is not rewritten, so older COWs can't pick up units.
+    if (compression_unit_blocks_ > 1 && header_.major_version < kCowVersionMajorMax) {
+        LOG(INFO) << "COW version " << header_.major_version
+                  << " does not support compression units, appending without them";
+        compression_unit_blocks_ = 0;
+    }
+    if (dedup_blocks_ && header_.major_version < kCowVersionMajorMax) {
+        LOG(INFO) << "COW version " << header_.major_version
+                  << " does not support dedup, appending without it";
+        dedup_blocks_ = false;
+    }
+
     // Reset this, since we're going to reimport all operations.
     footer_.op.num_ops = 0;
     InitPos();
 
     auto iter = reader->GetOpIter();
 
+    // An index written by a previous Finalize() no longer matches once ops
+    // are appended, so it will be rebuilt.
+    if (!iter->Done() && iter->Get().type == kCowOpIndexOp) {
+        op_index_pos_ = next_op_pos_;
+        op_index_valid_ = true;
+    } else if (options_.op_index) {
+        LOG(INFO) << "COW has no op index placeholder, appending without an index";
+    }
+
     while (!iter->Done()) {
         AddOperation(iter->Get());
         iter->Next();
@@ -410,6 +505,10 @@ bool CowWriter::OpenForAppend(uint64_t label) {
     // Free reader so we own the descriptor position again.
     reader = nullptr;
 
+    if (!InvalidateOpIndex()) {
+        return false;
+    }
+
     if (lseek(fd_.get(), next_op_pos_, SEEK_SET) < 0) {
         PLOG(ERROR) << "lseek failed";
         return false;
@@ -420,6 +519,126 @@ bool CowWriter::OpenForAppend(uint64_t label) {
     return EmitClusterIfNeeded();
 }
 
+bool CowWriter::ReadDictionary() {
+    dictionary_capacity_ = 0;
+    dictionary_trained_ = false;
+    dictionary_ = nullptr;
+    if (header_.header_size <= sizeof(CowHeader)) {
+        return true;
+    }
+    if (header_.major_version < kCowVersionMajorMax) {
+        LOG(ERROR) << "COW version " << header_.major_version
+                   << " has an unexpected header size: " << header_.header_size;
+        return false;
+    }
+
+    CowDictionaryHeader dict_header;
+    if (!android::base::ReadFullyAtOffset(fd_, &dict_header, sizeof(dict_header),
+                                          sizeof(CowHeader))) {
+        PLOG(ERROR) << "read dictionary header failed";
+        return false;
+    }
+    if (sizeof(CowHeader) + sizeof(dict_header) + dict_header.dictionary_capacity >
+                header_.header_size ||
+        dict_header.dictionary_size > dict_header.dictionary_capacity) {
+        LOG(ERROR) << "Invalid dictionary region, size: " << dict_header.dictionary_size
+                   << ", capacity: " << dict_header.dictionary_capacity;
+        return false;
+    }
+    if (dict_header.compression != compression_.algorithm) {
+        LOG(ERROR) << "COW dictionary was trained for compression "
+                   << static_cast<int>(dict_header.compression) << ", but appending with "
+                   << options_.compression;
+        return false;
+    }
+    if (!dict_header.dictionary_size) {
+        // The ops already written were compressed without a dictionary, and
+        // would not decode with one trained now.
+        return true;
+    }
+    dictionary_capacity_ = dict_header.dictionary_capacity;
+
+    std::string dict(dict_header.dictionary_size, '\0');
+    if (!android::base::ReadFullyAtOffset(fd_, dict.data(), dict.size(),
+                                          sizeof(CowHeader) + sizeof(dict_header))) {
+        PLOG(ERROR) << "read dictionary failed";
+        return false;
+    }
+    dictionary_trained_ = true;
+    return SetDictionary(dict.data(), dict.size());
+}
+
+// Train the dictionary on the first blocks we are given, before any of them
+// is compressed. The reader decompresses every op with the dictionary once
+// there is one, and frames compressed without it do not decode the same way,
+// so this is the only chance: if training fails, the COW has no dictionary.
+bool CowWriter::TrainDictionary(const void* data, size_t num_blocks) {
+    if (!dictionary_capacity_ || dictionary_trained_) {
+        return true;
+    }
+
+    // Spread the samples over the whole batch, rather than the blocks at its
+    // start, which tend to be a single file's.
+    size_t num_samples = std::min<size_t>(num_blocks, options_.compression_dictionary_blocks);
+    const uint8_t* blocks = reinterpret_cast<const uint8_t*>(data);
+    std::string samples;
+    samples.reserve(num_samples * header_.block_size);
+    for (size_t i = 0; i < num_samples; i++) {
+        size_t block = i * num_blocks / num_samples;
+        samples.append(reinterpret_cast<const char*>(blocks + block * header_.block_size),
+                       header_.block_size);
+    }
+    std::vector<size_t> sample_sizes(num_samples, header_.block_size);
+
+    std::string dict(dictionary_capacity_, '\0');
+    size_t dict_size = ZDICT_trainFromBuffer(dict.data(), dict.size(), samples.data(),
+                                             sample_sizes.data(), sample_sizes.size());
+    if (ZDICT_isError(dict_size)) {
+        LOG(WARNING) << "Could not train compression dictionary on " << num_samples
+                     << " blocks: " << ZDICT_getErrorName(dict_size);
+        dictionary_capacity_ = 0;
+        return true;
+    }
+    dict.resize(dict_size);
+
+    CowDictionaryHeader dict_header = {};
+    dict_header.compression = compression_.algorithm;
+    dict_header.dictionary_size = dict_size;
+    dict_header.dictionary_capacity = dictionary_capacity_;
+    if (!android::base::WriteFullyAtOffset(fd_, dict.data(), dict.size(),
+                                           sizeof(CowHeader) + sizeof(dict_header)) ||
+        !android::base::WriteFullyAtOffset(fd_, &dict_header, sizeof(dict_header),
+                                           sizeof(CowHeader))) {
+        PLOG(ERROR) << "write dictionary failed";
+        return false;
+    }
+    if (!Sync()) {
+        return false;
+    }
+
+    LOG(INFO) << "Trained " << dict_size << " byte compression dictionary on " << num_samples
+              << " blocks";
+    if (!SetDictionary(dict.data(), dict.size())) {
+        return false;
+    }
+    dictionary_trained_ = true;
+    return true;
+}
+
+bool CowWriter::SetDictionary(const void* data, size_t size) {
+    std::shared_ptr<ZSTD_CDict> dictionary(
+            ZSTD_createCDict(data, size, compression_.compression_level), ZSTD_freeCDict);
+    if (!dictionary) {
+        LOG(ERROR) << "ZSTD_createCDict failed";
+        return false;
+    }
+    dictionary_ = dictionary;
+    for (const auto& worker : compress_threads_) {
+        worker->SetDictionary(dictionary_);
+    }
+    return true;
+}
+
 bool CowWriter::EmitCopy(uint64_t new_block, uint64_t old_block, uint64_t num_blocks) {
     CHECK(!merge_in_progress_);
 
@@ -436,6 +655,71 @@ bool CowWriter::EmitCopy(uint64_t new_block, uint64_t old_block, uint64_t num_bl
     return true;
 }
 
+// A fast non-cryptographic 128-bit hash, as two 64-bit multiply-rotate lanes
+// over 16-byte stripes. It only picks candidates for deduplication; matches are
+// confirmed against the block contents.
+CowWriter::BlockHash CowWriter::HashBlock(const uint8_t* data, size_t size) {
+    static constexpr uint64_t kPrime1 = 0x9e3779b185ebca87ULL;
+    static constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4fULL;
+    static constexpr uint64_t kPrime3 = 0x165667b19e3779f9ULL;
+
+    auto rotl = [](uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); };
+    auto mix = [](uint64_t value) {
+        value ^= value >> 33;
+        value *= kPrime2;
+        value ^= value >> 29;
+        value *= kPrime3;
+        value ^= value >> 32;
+        return value;
+    };
+
+    uint64_t low = kPrime1 ^ size;
+    uint64_t high = kPrime2 + size;
+    size_t pos = 0;
+    for (; pos + 16 <= size; pos += 16) {
+        uint64_t word0, word1;
+        memcpy(&word0, data + pos, sizeof(word0));
+        memcpy(&word1, data + pos + 8, sizeof(word1));
+        low = rotl(low + word0 * kPrime2, 31) * kPrime1;
+        high = rotl(high + word1 * kPrime1, 27) * kPrime2;
+    }
+    for (; pos < size; pos++) {
+        low = rotl(low ^ (data[pos] * kPrime3), 11) * kPrime1;
+    }
+
+    low += high;
+    high += low;
+    return {mix(low), mix(high)};
+}
+
+// Returns the replace op that wrote the same contents as |data|, if any.
+const CowOperation* CowWriter::FindDuplicateBlock(const BlockHash& hash,
+                                                  const uint8_t* data) const {
+    auto dup = dedup_table_.find(hash);
+    if (dup == dedup_table_.end() ||
+        memcmp(dup->second.data.data(), data, header_.block_size) != 0) {
+        return nullptr;
+    }
+    return &dup->second.op;
+}
+
+void CowWriter::AddDedupBlock(const BlockHash& hash, const uint8_t* data,
+                              const CowOperation& op) {
+    if (dedup_table_.size() >= kMaxDedupBytes / header_.block_size) {
+        return;
+    }
+    dedup_table_.emplace(hash,
+                         DedupEntry{op, std::basic_string<uint8_t>(data, header_.block_size)});
+}
+
+// Write a replace op for |new_block| that shares the data of |original|.
+bool CowWriter::EmitDuplicateBlock(uint64_t new_block, const CowOperation& original) {
+    CowOperation op = original;
+    op.new_block = new_block;
+    op.compression |= kCowDedupFlag;
+    return WriteOperation(op);
+}
+
 bool CowWriter::EmitRawBlocks(uint64_t new_block_start, const void* data, size_t size) {
     return EmitBlocks(new_block_start, data, size, 0, 0, kCowReplaceOp);
 }
@@ -445,111 +729,210 @@ bool CowWriter::EmitXorBlocks(uint32_t new_block_start, const void* data, size_t
     return EmitBlocks(new_block_start, data, size, old_block, offset, kCowXorOp);
 }
 
-bool CowWriter::CompressBlocks(size_t num_blocks, const void* data) {
-    size_t num_threads = (num_blocks == 1) ? 1 : num_compress_threads_;
-    size_t num_blocks_per_thread = num_blocks / num_threads;
+bool CowWriter::EmitBlocks(uint64_t new_block_start, const void* data, size_t size,
+                           uint64_t old_block, uint16_t offset, uint8_t type) {
+    CHECK(!merge_in_progress_);
     const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
-    compressed_buf_.clear();
-    if (num_threads <= 1) {
-        return CompressWorker::CompressBlocks(compression_, options_.block_size, data, num_blocks,
-                                              &compressed_buf_);
-    }
+    size_t num_blocks = (size / header_.block_size);
 
-    // Submit the blocks per thread. The retrieval of
-    // compressed buffers has to be done in the same order.
-    // We should not poll for completed buffers in a different order as the
-    // buffers are tightly coupled with block ordering.
-    for (size_t i = 0; i < num_threads; i++) {
-        CompressWorker* worker = compress_threads_[i].get();
-        if (i == num_threads - 1) {
-            num_blocks_per_thread = num_blocks;
-        }
-        worker->EnqueueCompressBlocks(iter, num_blocks_per_thread);
-        iter += (num_blocks_per_thread * header_.block_size);
-        num_blocks -= num_blocks_per_thread;
+    if (!TrainDictionary(data, num_blocks)) {
+        return false;
     }
 
-    for (size_t i = 0; i < num_threads; i++) {
-        CompressWorker* worker = compress_threads_[i].get();
-        if (!worker->GetCompressedBuffers(&compressed_buf_)) {
-            return false;
-        }
+    if (type == kCowReplaceOp && compression_unit_blocks_ > 1) {
+        return EmitCompressionUnits(new_block_start, data, num_blocks);
     }
 
-    return true;
-}
+    if (compression_.algorithm && num_compress_threads_ > 1) {
+        return EmitCompressedBlocks(new_block_start, iter, num_blocks, old_block, offset, type);
+    }
 
-bool CowWriter::EmitBlocks(uint64_t new_block_start, const void* data, size_t size,
-                           uint64_t old_block, uint16_t offset, uint8_t type) {
-    CHECK(!merge_in_progress_);
-    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
+    const bool dedup = dedup_blocks_ && type == kCowReplaceOp;
+    for (size_t i = 0; i < num_blocks; i++) {
+        CowOperation op = {};
+        op.new_block = new_block_start + i;
+        op.type = type;
+        if (type == kCowXorOp) {
+            op.source = (old_block + i) * header_.block_size + offset;
+        } else {
+            op.source = next_data_pos_;
+        }
 
-    // Update engine can potentially send 100MB of blocks at a time. We
-    // don't want to process all those blocks in one shot as it can
-    // stress the memory. Hence, process the blocks in chunks.
-    //
-    // 1024 blocks is reasonable given we will end up using max
-    // memory of ~4MB.
-    const size_t kProcessingBlocks = 1024;
-    size_t num_blocks = (size / header_.block_size);
-    size_t i = 0;
+        BlockHash hash = {};
+        if (dedup) {
+            hash = HashBlock(iter, header_.block_size);
+            if (auto dup = FindDuplicateBlock(hash, iter)) {
+                if (!EmitDuplicateBlock(op.new_block, *dup)) {
+                    PLOG(ERROR) << "AddRawBlocks: write failed";
+                    return false;
+                }
+                iter += header_.block_size;
+                continue;
+            }
+        }
 
-    while (num_blocks) {
-        size_t pending_blocks = (std::min(kProcessingBlocks, num_blocks));
+        if (compression_.algorithm) {
+            auto data =
+                    CompressWorker::Compress(compression_, iter, header_.block_size, dictionary_.get());
+            op.compression = compression_.algorithm;
+            op.data_length = static_cast<uint16_t>(data.size());
 
-        if (compression_ && num_compress_threads_ > 1) {
-            if (!CompressBlocks(pending_blocks, iter)) {
+            if (!WriteOperation(op, data.data(), data.size())) {
+                PLOG(ERROR) << "AddRawBlocks: write failed";
+                return false;
+            }
+        } else {
+            op.data_length = static_cast<uint16_t>(header_.block_size);
+            if (!WriteOperation(op, iter, header_.block_size)) {
+                PLOG(ERROR) << "AddRawBlocks: write failed";
                 return false;
             }
-            buf_iter_ = compressed_buf_.begin();
-            CHECK(pending_blocks == compressed_buf_.size());
         }
+        if (dedup) {
+            AddDedupBlock(hash, iter, op);
+        }
+        iter += header_.block_size;
+    }
+    return true;
+}
 
-        num_blocks -= pending_blocks;
+// Compress on the worker threads while writing out in order. The blocks are
+// split into chunks of kCompressChunkBlocks that are handed to the workers
+// round robin, so each worker returns its chunks in submission order. At most
+// kCompressChunksPerThread chunks per worker are in flight, which bounds the
+// memory held by compressed data that has not been written yet.
+bool CowWriter::EmitCompressedBlocks(uint64_t new_block_start, const uint8_t* data,
+                                     size_t num_blocks, uint64_t old_block, uint16_t offset,
+                                     uint8_t type) {
+    const size_t num_chunks = (num_blocks + kCompressChunkBlocks - 1) / kCompressChunkBlocks;
+    const size_t max_in_flight = compress_threads_.size() * kCompressChunksPerThread;
+    size_t submitted = 0;
+    size_t retrieved = 0;
+    const bool dedup = dedup_blocks_ && type == kCowReplaceOp;
+
+    auto submit = [&, this]() {
+        size_t first_block = submitted * kCompressChunkBlocks;
+        size_t chunk_blocks = std::min(kCompressChunkBlocks, num_blocks - first_block);
+        CompressWorker* worker = compress_threads_[submitted % compress_threads_.size()].get();
+        worker->EnqueueCompressBlocks(data + first_block * header_.block_size, chunk_blocks);
+        submitted++;
+    };
+
+    // The workers hold pointers into |data|, so every chunk handed out must be
+    // collected before returning, including on failure.
+    auto drain = android::base::make_scope_guard([&, this]() {
+        std::vector<std::basic_string<uint8_t>> discard;
+        for (; retrieved < submitted; retrieved++) {
+            compress_threads_[retrieved % compress_threads_.size()]->GetCompressedBuffers(&discard);
+            discard.clear();
+        }
+    });
+
+    while (submitted < num_chunks && submitted < max_in_flight) {
+        submit();
+    }
 
-        while (i < size / header_.block_size && pending_blocks) {
+    size_t block = 0;
+    while (retrieved < num_chunks) {
+        compressed_buf_.clear();
+        CompressWorker* worker = compress_threads_[retrieved % compress_threads_.size()].get();
+        bool ok = worker->GetCompressedBuffers(&compressed_buf_);
+        retrieved++;
+        if (!ok) {
+            return false;
+        }
+
+        // Keep the workers busy while this chunk is written.
+        if (submitted < num_chunks) {
+            submit();
+        }
+
+        for (auto& compressed : compressed_buf_) {
             CowOperation op = {};
-            op.new_block = new_block_start + i;
+            op.new_block = new_block_start + block;
             op.type = type;
             if (type == kCowXorOp) {
-                op.source = (old_block + i) * header_.block_size + offset;
+                op.source = (old_block + block) * header_.block_size + offset;
             } else {
                 op.source = next_data_pos_;
             }
-
-            if (compression_) {
-                auto data = [&, this]() {
-                    if (num_compress_threads_ > 1) {
-                        auto data = std::move(*buf_iter_);
-                        buf_iter_++;
-                        return data;
-                    } else {
-                        auto data =
-                                CompressWorker::Compress(compression_, iter, header_.block_size);
-                        return data;
+            op.compression = compression_.algorithm;
+            op.data_length = static_cast<uint16_t>(compressed.size());
+
+            // Duplicates were compressed anyway, but their data is dropped.
+            BlockHash hash = {};
+            if (dedup) {
+                hash = HashBlock(data + block * header_.block_size, header_.block_size);
+                if (auto dup = FindDuplicateBlock(hash, data + block * header_.block_size)) {
+                    if (!EmitDuplicateBlock(op.new_block, *dup)) {
+                        PLOG(ERROR) << "AddRawBlocks: write failed";
+                        return false;
                     }
-                }();
-                op.compression = compression_;
-                op.data_length = static_cast<uint16_t>(data.size());
-
-                if (!WriteOperation(op, data.data(), data.size())) {
-                    PLOG(ERROR) << "AddRawBlocks: write failed";
-                    return false;
-                }
-            } else {
-                op.data_length = static_cast<uint16_t>(header_.block_size);
-                if (!WriteOperation(op, iter, header_.block_size)) {
-                    PLOG(ERROR) << "AddRawBlocks: write failed";
-                    return false;
+                    block++;
+                    continue;
                 }
             }
-            iter += header_.block_size;
 
-            i += 1;
-            pending_blocks -= 1;
+            if (!WriteOperation(op, compressed.data(), compressed.size())) {
+                PLOG(ERROR) << "AddRawBlocks: write failed";
+                return false;
+            }
+            if (dedup) {
+                AddDedupBlock(hash, data + block * header_.block_size, op);
+            }
+            block++;
+        }
+    }
+
+    CHECK(block == num_blocks);
+    return true;
+}
+
+// Each unit is written as a kCowCompressionUnitOp carrying the compressed data,
+// followed by one data-less replace op per block pointing back at that data.
+bool CowWriter::EmitCompressionUnits(uint64_t new_block_start, const void* data,
+                                     size_t num_blocks) {
+    const uint8_t* iter = reinterpret_cast<const uint8_t*>(data);
+
+    while (num_blocks) {
+        size_t unit_blocks = std::min<size_t>(num_blocks, compression_unit_blocks_);
+        size_t unit_size = unit_blocks * header_.block_size;
+
+        auto payload = CompressWorker::Compress(compression_, iter, unit_size, dictionary_.get());
+        if (payload.empty()) {
+            LOG(ERROR) << "EmitCompressionUnits: Compression failed";
+            return false;
+        }
+
+        CowOperation unit_op = {};
+        unit_op.type = kCowCompressionUnitOp;
+        unit_op.compression = compression_.algorithm;
+        unit_op.data_length = static_cast<uint16_t>(unit_blocks);
+        unit_op.new_block = new_block_start;
+        unit_op.source = payload.size();
+
+        // The unit's data lands at the current data position.
+        const uint64_t unit_data_pos = next_data_pos_;
+        if (!WriteOperation(unit_op, payload.data(), payload.size())) {
+            PLOG(ERROR) << "EmitCompressionUnits: write failed";
+            return false;
+        }
+
+        for (size_t i = 0; i < unit_blocks; i++) {
+            CowOperation op = {};
+            op.type = kCowReplaceOp;
+            op.compression = compression_.algorithm | kCowCompressionUnitFlag;
+            op.new_block = new_block_start + i;
+            op.source = unit_data_pos;
+            if (!WriteOperation(op)) {
+                PLOG(ERROR) << "EmitCompressionUnits: write failed";
+                return false;
+            }
         }
 
-        CHECK(pending_blocks == 0);
+        iter += unit_size;
+        new_block_start += unit_blocks;
+        num_blocks -= unit_blocks;
     }
     return true;
 }
@@ -683,6 +1066,10 @@ bool CowWriter::Finalize() {
         return false;
     }
 
+    if (op_index_pos_ && !WriteOpIndex(offs - sizeof(footer_))) {
+        return false;
+    }
+
     // Reposition for additional Writing
     if (extra_cluster) {
         current_cluster_size_ = continue_cluster_size;
@@ -697,12 +1084,87 @@ bool CowWriter::Finalize() {
     return Sync();
 }
 
+// Xor and unit entries are mutually exclusive, so this bounds the size of
+// the index for |num_ops| ops, plus alignment of each section.
+static uint64_t GetOpIndexSizeEstimate(uint64_t num_ops) {
+    return getpagesize() + sizeof(CowOpIndexHeader) + 4 * 8 +
+           num_ops * (sizeof(CowOperation) + sizeof(uint32_t) + sizeof(CowOpIndexUnitEntry));
+}
+
 uint64_t CowWriter::GetCowSize() {
+    uint64_t size;
     if (current_data_size_ > 0) {
-        return next_data_pos_ + sizeof(footer_);
+        size = next_data_pos_ + sizeof(footer_);
     } else {
-        return next_op_pos_ + sizeof(footer_);
+        size = next_op_pos_ + sizeof(footer_);
+    }
+    if (op_index_pos_) {
+        size += GetOpIndexSizeEstimate(footer_.op.num_ops);
+    }
+    return size;
+}
+
+bool CowWriter::WriteOpIndex(uint64_t footer_offset) {
+    if (is_dev_null_) {
+        return true;
+    }
+    if (!InvalidateOpIndex()) {
+        return false;
+    }
+
+    // The index is an optimization for readers. If it can't be written, the
+    // COW is still complete without it.
+    CowReader reader(CowReader::ReaderFlags::USERSPACE_MERGE);
+    if (!reader.Parse(fd_)) {
+        LOG(WARNING) << "Could not parse COW, not writing an op index";
+        return true;
+    }
+
+    uint64_t page_size = getpagesize();
+    uint64_t index_offset = (footer_offset + sizeof(footer_) + page_size - 1) / page_size * page_size;
+    if (index_offset + GetOpIndexSizeEstimate(footer_.op.num_ops) > cow_image_size_) {
+        LOG(WARNING) << "No space on COW device for an op index";
+        return true;
+    }
+
+    uint64_t index_size;
+    if (!reader.WriteOpIndex(fd_, index_offset, footer_offset, &index_size)) {
+        LOG(WARNING) << "Failed to write op index";
+        return true;
+    }
+    if (!Truncate(index_offset + index_size)) {
+        return false;
+    }
+    // The index must be durable before the placeholder refers to it.
+    if (!Sync()) {
+        return false;
+    }
+
+    CowOperation op = {};
+    op.type = kCowOpIndexOp;
+    op.source = index_offset;
+    if (!android::base::WriteFullyAtOffset(fd_, &op, sizeof(op), op_index_pos_)) {
+        PLOG(ERROR) << "Failed to update op index placeholder";
+        return false;
     }
+    op_index_valid_ = true;
+    return true;
+}
+
+bool CowWriter::InvalidateOpIndex() {
+    if (!op_index_valid_) {
+        return true;
+    }
+
+    CowOperation op = {};
+    op.type = kCowOpIndexOp;
+    if (!android::base::WriteFullyAtOffset(fd_, &op, sizeof(op), op_index_pos_)) {
+        PLOG(ERROR) << "Failed to invalidate op index";
+        return false;
+    }
+    op_index_valid_ = false;
+    // Make sure no reader can pair the index with ops written after it.
+    return Sync();
 }
 
 bool CowWriter::GetDataPos(uint64_t* pos) {
@@ -755,6 +1217,9 @@ bool CowWriter::FlushCluster() {
 }
 
 bool CowWriter::WriteOperation(const CowOperation& op, const void* data, size_t size) {
+    if (!InvalidateOpIndex()) {
+        return false;
+    }
     if (!EnsureSpaceAvailable(next_op_pos_ + sizeof(op))) {
         return false;
     }
@@ -762,7 +1227,15 @@ bool CowWriter::WriteOperation(const CowOperation& op, const void* data, size_t
         return false;
     }
 
-    if (batch_write_) {
+    // Compression units can exceed the batch data buffers. Flush what has
+    // been queued so far, and write those directly.
+    const bool write_direct = !batch_write_ || size > header_.block_size * 2;
+    if (batch_write_ && write_direct && !FlushCluster()) {
+        LOG(ERROR) << "Failed to flush cluster data";
+        return false;
+    }
+
+    if (!write_direct) {
         CowOperation* cow_op = reinterpret_cast<CowOperation*>(cowop_vec_[op_vec_index_].iov_base);
         std::memcpy(cow_op, &op, sizeof(CowOperation));
         op_vec_index_ += 1;
@@ -789,7 +1262,10 @@ bool CowWriter::WriteOperation(const CowOperation& op, const void* data, size_t
 
     AddOperation(op);
 
-    if (batch_write_) {
+    if (batch_write_ && write_direct) {
+        current_op_pos_ = next_op_pos_;
+        current_data_pos_ = next_data_pos_;
+    } else if (batch_write_) {
         if (op_vec_index_ == header_.cluster_ops || data_vec_index_ == header_.cluster_ops ||
             op.type == kCowLabelOp || op.type == kCowClusterOp) {
             if (!FlushCluster()) {
@@ -810,10 +1286,10 @@ void CowWriter::AddOperation(const CowOperation& op) {
         current_data_size_ = 0;
     } else if (header_.cluster_ops) {
         current_cluster_size_ += sizeof(op);
-        current_data_size_ += op.data_length;
+        current_data_size_ += GetOpDataLength(op);
     }
 
-    next_data_pos_ += op.data_length + GetNextDataOffset(op, header_.cluster_ops);
+    next_data_pos_ += GetOpDataLength(op) + GetNextDataOffset(op, header_.cluster_ops);
     next_op_pos_ += sizeof(CowOperation) + GetNextOpOffset(op, header_.cluster_ops);
 }
 
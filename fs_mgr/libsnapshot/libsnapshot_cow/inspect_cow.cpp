@@ -13,15 +13,21 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 //
+#include <getopt.h>
 #include <stdio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/unique_fd.h>
 #include <libsnapshot/cow_reader.h>
 
@@ -47,7 +53,9 @@ static void usage(void) {
     LOG(ERROR) << "\t -n Show ops in merge order";
     LOG(ERROR) << "\t -a Include merged ops in any merge order listing";
     LOG(ERROR) << "\t -o Shows sequence op block order";
-    LOG(ERROR) << "\t -v Verifies merge order has no conflicts\n";
+    LOG(ERROR) << "\t -v Verifies merge order has no conflicts";
+    LOG(ERROR) << "\t --benchmark[=N] Decompress all data ops with N threads and report throughput";
+    LOG(ERROR) << "\t --layout Report how sequential the ops are\n";
 }
 
 enum OpIter { Normal, RevMerge, Merge };
@@ -61,6 +69,9 @@ struct Options {
     bool verify_sequence;
     OpIter iter_type;
     bool include_merged;
+    // Number of threads for --benchmark, 0 if not benchmarking.
+    unsigned int benchmark_threads;
+    bool layout;
 };
 
 // Sink that always appends to the end of a string.
@@ -99,6 +110,220 @@ static void ShowBad(CowReader& reader, const struct CowOperation& op) {
     }
 }
 
+static const char* CompressionName(uint8_t compression) {
+    switch (compression & ~(kCowCompressionUnitFlag | kCowDedupFlag)) {
+        case kCowCompressNone:
+            return "none";
+        case kCowCompressGz:
+            return "gz";
+        case kCowCompressBrotli:
+            return "brotli";
+        case kCowCompressLz4:
+            return "lz4";
+        case kCowCompressZstd:
+            return "zstd";
+        default:
+            return "unknown";
+    }
+}
+
+struct BenchmarkStats {
+    uint64_t ops = 0;
+    uint64_t bytes = 0;
+    uint64_t failures = 0;
+    std::chrono::nanoseconds time{};
+    // Compressed size as a fraction of the block size, in tenths. Ops in a
+    // multi-block compression unit have no size of their own and are not
+    // counted.
+    uint64_t ratio_histogram[10] = {};
+};
+
+using BenchmarkResult = std::map<uint8_t, BenchmarkStats>;
+
+static void BenchmarkWorker(const std::string& path, CowReader* parsed,
+                            const std::vector<CowOperation>& ops, size_t begin, size_t end,
+                            uint32_t block_size, BenchmarkResult* result) {
+    // CowReader is not thread safe, so each worker reads through its own
+    // clone and file descriptor.
+    auto reader = parsed->CloneCowReader();
+    android::base::unique_fd fd(open(path.c_str(), O_RDONLY));
+    if (fd < 0 || !reader->InitForMerge(std::move(fd))) {
+        PLOG(ERROR) << "could not open " << path;
+        (*result)[kCowCompressNone].failures += end - begin;
+        return;
+    }
+
+    StringSink sink;
+    for (size_t i = begin; i < end; i++) {
+        const CowOperation& op = ops[i];
+        auto& stats = (*result)[op.compression & ~(kCowCompressionUnitFlag | kCowDedupFlag)];
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = reader->ReadData(op, &sink);
+        stats.time += std::chrono::steady_clock::now() - start;
+
+        if (!ok) {
+            stats.failures++;
+        } else {
+            stats.ops++;
+            stats.bytes += sink.stream().size();
+        }
+        if (!(op.compression & (kCowCompressionUnitFlag | kCowDedupFlag))) {
+            size_t bucket = (uint64_t(op.data_length) * 10) / block_size;
+            stats.ratio_histogram[std::min<size_t>(bucket, 9)]++;
+        }
+        sink.Reset();
+    }
+}
+
+static bool Benchmark(const std::string& path, CowReader& reader, uint32_t block_size,
+                      unsigned int num_threads) {
+    std::vector<CowOperation> ops;
+    auto iter = reader.GetOpIter();
+    for (; !iter->Done(); iter->Next()) {
+        const CowOperation& op = iter->Get();
+        if (op.type == kCowReplaceOp || op.type == kCowXorOp) {
+            ops.emplace_back(op);
+        }
+    }
+
+    // Give each thread a contiguous range of ops, so that blocks of the same
+    // compression unit are decompressed by the same reader.
+    std::vector<BenchmarkResult> results(num_threads);
+    std::vector<std::thread> threads;
+    size_t per_thread = (ops.size() + num_threads - 1) / num_threads;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < num_threads; i++) {
+        size_t begin = std::min(ops.size(), i * per_thread);
+        size_t end = std::min(ops.size(), begin + per_thread);
+        threads.emplace_back(BenchmarkWorker, path, &reader, std::cref(ops), begin, end, block_size,
+                             &results[i]);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    BenchmarkResult total;
+    for (const auto& result : results) {
+        for (const auto& [compression, stats] : result) {
+            auto& sum = total[compression];
+            sum.ops += stats.ops;
+            sum.bytes += stats.bytes;
+            sum.failures += stats.failures;
+            sum.time += stats.time;
+            for (size_t i = 0; i < 10; i++) {
+                sum.ratio_histogram[i] += stats.ratio_histogram[i];
+            }
+        }
+    }
+
+    bool success = true;
+    uint64_t total_bytes = 0;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto& [compression, stats] : total) {
+        // Per-thread time spent in this algorithm, so rates are per thread.
+        double seconds = std::chrono::duration<double>(stats.time).count();
+        std::cout << CompressionName(compression) << ": " << stats.ops << " ops, "
+                  << stats.failures << " failures, " << stats.bytes << " bytes";
+        if (seconds > 0) {
+            std::cout << ", " << stats.bytes / seconds / 1e6 << " MB/s, " << stats.ops / seconds
+                      << " ops/s per thread";
+        }
+        std::cout << "\n";
+        if (std::any_of(std::begin(stats.ratio_histogram), std::end(stats.ratio_histogram),
+                        [](uint64_t count) { return count != 0; })) {
+            std::cout << "  Compressed size (% of block):";
+            for (size_t i = 0; i < 10; i++) {
+                std::cout << " " << i * 10 << "-" << (i + 1) * 10
+                          << "%: " << stats.ratio_histogram[i];
+            }
+            std::cout << "\n";
+        }
+        total_bytes += stats.bytes;
+        if (stats.failures) success = false;
+    }
+    std::cout << "Decompressed " << ops.size() << " ops, " << total_bytes << " bytes with "
+              << num_threads << " threads in " << std::setprecision(3) << elapsed.count() << "s"
+              << std::setprecision(1);
+    if (elapsed.count() > 0) {
+        std::cout << ", " << total_bytes / elapsed.count() / 1e6 << " MB/s";
+    }
+    std::cout << std::defaultfloat << "\n";
+    return success;
+}
+
+// Sequential run lengths of new blocks, as given by the op order, and of
+// source blocks for copy ops.
+struct RunStats {
+    uint64_t ops = 0;
+    uint64_t runs = 0;
+    uint64_t longest = 0;
+    // Runs of length 1, 2-7, 8-31, 32-255 and 256+.
+    uint64_t histogram[5] = {};
+
+    uint64_t current = 0;
+    uint64_t last_block = 0;
+
+    void Add(uint64_t block) {
+        ops++;
+        if (current && block == last_block + 1) {
+            current++;
+        } else {
+            End();
+            current = 1;
+        }
+        last_block = block;
+    }
+    void End() {
+        if (!current) return;
+        runs++;
+        longest = std::max(longest, current);
+        if (current == 1) {
+            histogram[0]++;
+        } else if (current < 8) {
+            histogram[1]++;
+        } else if (current < 32) {
+            histogram[2]++;
+        } else if (current < 256) {
+            histogram[3]++;
+        } else {
+            histogram[4]++;
+        }
+        current = 0;
+    }
+    void Print(const char* name) {
+        End();
+        std::cout << name << ": " << ops << " ops in " << runs << " runs";
+        if (runs) {
+            std::cout << ", average " << std::fixed << std::setprecision(1)
+                      << static_cast<double>(ops) / runs << std::defaultfloat << ", longest "
+                      << longest << ", scattered (run of 1) " << histogram[0] << ", 2-7 "
+                      << histogram[1] << ", 8-31 " << histogram[2] << ", 32-255 " << histogram[3]
+                      << ", 256+ " << histogram[4];
+        }
+        std::cout << "\n";
+    }
+};
+
+static void ShowLayout(ICowOpIter* iter) {
+    RunStats all, replace, copy_source;
+    for (; !iter->Done(); iter->Next()) {
+        const CowOperation& op = iter->Get();
+        if (IsMetadataOp(op)) continue;
+
+        all.Add(op.new_block);
+        if (op.type == kCowReplaceOp) {
+            replace.Add(op.new_block);
+        } else if (op.type == kCowCopyOp) {
+            copy_source.Add(op.source);
+        }
+    }
+    all.Print("All data ops");
+    replace.Print("Replace ops");
+    copy_source.Print("Copy op sources");
+}
+
 static bool Inspect(const std::string& path, Options opt) {
     android::base::unique_fd fd(open(path.c_str(), O_RDONLY));
     if (fd < 0) {
@@ -145,6 +370,10 @@ static bool Inspect(const std::string& path, Options opt) {
         }
     }
 
+    if (opt.benchmark_threads) {
+        return Benchmark(path, reader, header.block_size, opt.benchmark_threads);
+    }
+
     std::unique_ptr<ICowOpIter> iter;
     if (opt.iter_type == Normal) {
         iter = reader.GetOpIter();
@@ -153,9 +382,14 @@ static bool Inspect(const std::string& path, Options opt) {
     } else if (opt.iter_type == Merge) {
         iter = reader.GetMergeOpIter(opt.include_merged);
     }
+    if (opt.layout) {
+        ShowLayout(iter.get());
+        return true;
+    }
+
     StringSink sink;
     bool success = true;
-    uint64_t xor_ops = 0, copy_ops = 0, replace_ops = 0, zero_ops = 0;
+    uint64_t xor_ops = 0, copy_ops = 0, replace_ops = 0, zero_ops = 0, dedup_ops = 0;
     while (!iter->Done()) {
         const CowOperation& op = iter->Get();
 
@@ -192,6 +426,7 @@ static bool Inspect(const std::string& path, Options opt) {
             copy_ops++;
         } else if (op.type == kCowReplaceOp) {
             replace_ops++;
+            if (op.compression & kCowDedupFlag) dedup_ops++;
         } else if (op.type == kCowZeroOp) {
             zero_ops++;
         } else if (op.type == kCowXorOp) {
@@ -205,7 +440,7 @@ static bool Inspect(const std::string& path, Options opt) {
         auto total_ops = replace_ops + zero_ops + copy_ops + xor_ops;
         std::cout << "Total-data-ops: " << total_ops << "Replace-ops: " << replace_ops
                   << " Zero-ops: " << zero_ops << " Copy-ops: " << copy_ops
-                  << " Xor_ops: " << xor_ops << std::endl;
+                  << " Xor_ops: " << xor_ops << " Dedup-ops: " << dedup_ops << std::endl;
     }
 
     return success;
@@ -223,8 +458,30 @@ int main(int argc, char** argv) {
     opt.iter_type = android::snapshot::Normal;
     opt.verify_sequence = false;
     opt.include_merged = false;
-    while ((ch = getopt(argc, argv, "sdbmnolva")) != -1) {
+    opt.benchmark_threads = 0;
+    opt.layout = false;
+
+    enum { kBenchmarkOption = 256, kLayoutOption };
+    static const struct option long_options[] = {
+            {"benchmark", optional_argument, nullptr, kBenchmarkOption},
+            {"layout", no_argument, nullptr, kLayoutOption},
+            {nullptr, 0, nullptr, 0},
+    };
+    while ((ch = getopt_long(argc, argv, "sdbmnolva", long_options, nullptr)) != -1) {
         switch (ch) {
+            case kBenchmarkOption:
+                if (!optarg) {
+                    opt.benchmark_threads = std::max(std::thread::hardware_concurrency(), 1u);
+                } else if (!android::base::ParseUint(optarg, &opt.benchmark_threads) ||
+                           opt.benchmark_threads == 0) {
+                    LOG(ERROR) << "Invalid thread count for --benchmark: " << optarg;
+                    android::snapshot::usage();
+                    return 1;
+                }
+                break;
+            case kLayoutOption:
+                opt.layout = true;
+                break;
             case 's':
                 opt.silent = true;
                 break;
@@ -18,6 +18,7 @@
 
 #include <android-base/logging.h>
 #include <android/snapshot/snapshot.pb.h>
+#include <libsnapshot/cow_writer.h>
 #include <storage_literals/storage_literals.h>
 
 #include "dm_snapshot_internals.h"
@@ -37,6 +38,11 @@ namespace snapshot {
 
 static constexpr uint64_t kBlockSize = 4096;
 
+// The payload's replace data is mostly xz or bzip2, which compress better than
+// the algorithms used for COWs. Scale the sampled ratio by this much so that
+// the estimate stays an over-estimate.
+static constexpr double kCompressionRatioMargin = 1.5;
+
 using namespace android::storage_literals;
 
 // Intersect two linear extents. If no intersection, return an extent with length 0.
@@ -155,16 +161,135 @@ bool WriteExtent(DmSnapCowSizeCalculator* sc, const chromeos_update_engine::Exte
     return true;
 }
 
+// Ratio of compressed to uncompressed size of the partition's new data, sampled
+// from the payload's replace operations. These carry the new blocks as the
+// payload generator compressed them, or raw if they did not compress. Returns
+// 1.0 if there is nothing to sample.
+double PartitionCowCreator::SampleCompressionRatio() {
+    uint64_t data_bytes = 0;
+    uint64_t block_bytes = 0;
+    for (const auto& iop : update->operations()) {
+        if (iop.type() != InstallOperation::REPLACE && iop.type() != InstallOperation::REPLACE_BZ &&
+            iop.type() != InstallOperation::REPLACE_XZ) {
+            continue;
+        }
+        for (const auto& de : iop.dst_extents()) {
+            block_bytes += de.num_blocks() * kBlockSize;
+        }
+        data_bytes += iop.data_length();
+    }
+    if (block_bytes == 0 || data_bytes >= block_bytes) {
+        return 1.0;
+    }
+    return static_cast<double>(data_bytes) / block_bytes;
+}
+
+// Estimate the size of a v2 COW written for |update|: the exact header, op and
+// footer costs of the format, plus replace data scaled by the sampled
+// compression ratio. Returns nullopt if the manifest has no operations to
+// estimate from.
+std::optional<uint64_t> PartitionCowCreator::EstimateCowSize() {
+    if (update == nullptr || update->operations().empty()) {
+        return std::nullopt;
+    }
+
+    double ratio = 1.0;
+    if (!compression_algorithm.empty() && compression_algorithm != "none") {
+        ratio = std::min(1.0, SampleCompressionRatio() * kCompressionRatioMargin);
+    }
+    // Blocks that do not compress are stored raw, so a block never costs more
+    // than kBlockSize.
+    const uint64_t replace_block_size =
+            std::min<uint64_t>(kBlockSize, static_cast<uint64_t>(ceil(kBlockSize * ratio)));
+
+    uint64_t num_ops = 0;
+    uint64_t data_size = 0;
+    uint64_t num_ordered_blocks = 0;
+    auto add_blocks = [&](const RepeatedPtrField<ChromeOSExtent>& extents,
+                          uint64_t block_data_size) -> void {
+        for (const auto& de : extents) {
+            num_ops += de.num_blocks();
+            data_size += de.num_blocks() * block_data_size;
+        }
+    };
+
+    for (const auto& iop : update->operations()) {
+        // update_engine labels the COW after each operation.
+        num_ops++;
+
+        switch (iop.type()) {
+            case InstallOperation::SOURCE_COPY: {
+                const InstallOperation* written_op = &iop;
+                InstallOperation buf;
+                if (OptimizeSourceCopyOperation(iop, &buf)) {
+                    written_op = &buf;
+                }
+                add_blocks(written_op->dst_extents(), 0);
+                for (const auto& de : written_op->dst_extents()) {
+                    num_ordered_blocks += de.num_blocks();
+                }
+                break;
+            }
+            case InstallOperation::ZERO:
+            case InstallOperation::DISCARD:
+                add_blocks(iop.dst_extents(), 0);
+                break;
+            case InstallOperation::REPLACE:
+            case InstallOperation::REPLACE_BZ:
+            case InstallOperation::REPLACE_XZ:
+                add_blocks(iop.dst_extents(), replace_block_size);
+                break;
+            default:
+                // Diff operations become replace or xor ops; the latter also
+                // take part in the merge sequence.
+                add_blocks(iop.dst_extents(), replace_block_size);
+                for (const auto& de : iop.dst_extents()) {
+                    num_ordered_blocks += de.num_blocks();
+                }
+                break;
+        }
+    }
+
+    // Hash trees and FEC are written as raw replace blocks.
+    for (const auto& de : extra_extents) {
+        num_ops += de.num_blocks();
+        data_size += de.num_blocks() * kBlockSize;
+    }
+
+    // See CowWriter::EmitSequenceData.
+    const uint64_t sequence_entries_per_op = (kBlockSize * 2) / sizeof(uint32_t);
+    num_ops += (num_ordered_blocks + sequence_entries_per_op - 1) / sequence_entries_per_op;
+    data_size += num_ordered_blocks * sizeof(uint32_t);
+
+    // CowWriter ends a cluster every cluster_ops - 1 ops with a cluster op.
+    const uint64_t cluster_ops = CowOptions{}.cluster_ops;
+    if (cluster_ops) {
+        num_ops += (num_ops + cluster_ops - 2) / (cluster_ops - 1);
+    }
+
+    return sizeof(CowHeader) + BUFFER_REGION_DEFAULT_SIZE + num_ops * sizeof(CowOperation) +
+           data_size + sizeof(CowFooter);
+}
+
 std::optional<uint64_t> PartitionCowCreator::GetCowSize() {
     if (using_snapuserd) {
-        if (update == nullptr || !update->has_estimate_cow_size()) {
+        // The manifest's estimate comes from running the payload generator's
+        // writer, so it is exact; the estimate from the operations is only a
+        // sample and can fall short. Use it only when the manifest has none.
+        std::optional<uint64_t> estimate;
+        if (update != nullptr && update->has_estimate_cow_size()) {
+            estimate = update->estimate_cow_size();
+        } else {
+            estimate = EstimateCowSize();
+        }
+        if (!estimate) {
             LOG(ERROR) << "Update manifest does not include a COW size";
             return std::nullopt;
         }
 
         // Add an extra 2MB of wiggle room for any minor differences in labels/metadata
         // that might come up.
-        auto size = update->estimate_cow_size() + 2_MiB;
+        auto size = *estimate + 2_MiB;
 
         // Align to nearest block.
         size += kBlockSize - 1;
@@ -76,6 +76,8 @@ struct PartitionCowCreator {
   private:
     bool HasExtent(Partition* p, Extent* e);
     std::optional<uint64_t> GetCowSize();
+    std::optional<uint64_t> EstimateCowSize();
+    double SampleCompressionRatio();
 };
 
 }  // namespace snapshot
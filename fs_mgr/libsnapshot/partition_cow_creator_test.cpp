@@ -257,6 +257,61 @@ TEST_F(PartitionCowCreatorTest, CompressionEnabled) {
     ASSERT_EQ(ret->snapshot_status.cow_file_size(), 1458176);
 }
 
+TEST_F(PartitionCowCreatorTest, CompressionEstimateWithoutManifestSize) {
+    constexpr uint64_t super_size = 1_MiB;
+    auto builder_a = MetadataBuilder::New(super_size, 1_KiB, 2);
+    ASSERT_NE(builder_a, nullptr);
+
+    auto builder_b = MetadataBuilder::New(super_size, 1_KiB, 2);
+    ASSERT_NE(builder_b, nullptr);
+    auto system_b = builder_b->AddPartition("system_b", LP_PARTITION_ATTR_READONLY);
+    ASSERT_NE(system_b, nullptr);
+    ASSERT_TRUE(builder_b->ResizePartition(system_b, 128_KiB));
+
+    PartitionUpdate update;
+    update.set_estimate_cow_size(64_MiB);
+
+    // 16 new blocks compressed to a quarter of their size, and 10 moved blocks.
+    auto* replace = update.add_operations();
+    replace->set_type(InstallOperation::REPLACE_XZ);
+    replace->set_data_length(16_KiB);
+    auto* e = replace->add_dst_extents();
+    e->set_start_block(0);
+    e->set_num_blocks(16);
+
+    auto* copy = update.add_operations();
+    copy->set_type(InstallOperation::SOURCE_COPY);
+    e = copy->add_src_extents();
+    e->set_start_block(100);
+    e->set_num_blocks(10);
+    e = copy->add_dst_extents();
+    e->set_start_block(16);
+    e->set_num_blocks(10);
+
+    PartitionCowCreator creator{.target_metadata = builder_b.get(),
+                                .target_suffix = "_b",
+                                .target_partition = system_b,
+                                .current_metadata = builder_a.get(),
+                                .current_suffix = "_a",
+                                .update = &update,
+                                .using_snapuserd = true,
+                                .compression_algorithm = "lz4"};
+
+    // The manifest's estimate always wins.
+    auto ret = creator.Run();
+    ASSERT_TRUE(ret.has_value());
+    ASSERT_EQ(ret->snapshot_status.cow_partition_size() + ret->snapshot_status.cow_file_size(),
+              64_MiB + 2_MiB);
+
+    // Without one: header and scratch space, 30 ops, 16 replace blocks at 1536
+    // bytes, the copy sequence and the footer, plus 2MiB, rounded up to a block.
+    update.clear_estimate_cow_size();
+    ret = creator.Run();
+    ASSERT_TRUE(ret.has_value());
+    ASSERT_EQ(ret->snapshot_status.cow_partition_size() + ret->snapshot_status.cow_file_size(),
+              4222976);
+}
+
 TEST_F(PartitionCowCreatorTest, CompressionWithNoManifest) {
     constexpr uint64_t super_size = 1_MiB;
     auto builder_a = MetadataBuilder::New(super_size, 1_KiB, 2);
@@ -2271,6 +2271,7 @@ bool SnapshotManager::MapAllPartitions(LockedFile* lock, const std::string& supe
         return false;
     }
 
+    auto begin = std::chrono::steady_clock::now();
     for (const auto& partition : metadata->partitions) {
         if (GetPartitionGroupName(metadata->groups[partition.group_index]) == kCowGroupName) {
             LOG(INFO) << "Skip mapping partition " << GetPartitionName(partition) << " in group "
@@ -2285,12 +2286,19 @@ bool SnapshotManager::MapAllPartitions(LockedFile* lock, const std::string& supe
                 .timeout_ms = timeout_ms,
                 .partition_opener = &opener,
         };
+        auto partition_begin = std::chrono::steady_clock::now();
         if (!MapPartitionWithSnapshot(lock, std::move(params), SnapshotContext::Mount, nullptr)) {
             return false;
         }
+        auto partition_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - partition_begin);
+        LOG(INFO) << "Mapping " << GetPartitionName(partition) << " took "
+                  << partition_time.count() << "ms";
     }
 
-    LOG(INFO) << "Created logical partitions with snapshot.";
+    auto total_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - begin);
+    LOG(INFO) << "Created logical partitions with snapshot in " << total_time.count() << "ms.";
     return true;
 }
 
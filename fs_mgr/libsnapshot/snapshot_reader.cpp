@@ -25,6 +25,13 @@ namespace snapshot {
 
 using android::base::borrowed_fd;
 
+// Number of decompressed blocks kept for repeated reads.
+static constexpr size_t kBlockCacheSize = 64;
+
+// Largest source device read, in blocks. Sequential reads always read this
+// far ahead.
+static constexpr uint64_t kReadaheadBlocks = 32;
+
 // Not supported.
 bool ReadOnlyFileDescriptor::Open(const char*, int, mode_t) {
     errno = EINVAL;
@@ -79,6 +86,7 @@ bool ReadFdFileDescriptor::Flush() {
 
 bool CompressedSnapshotReader::SetCow(std::unique_ptr<CowReader>&& cow) {
     cow_ = std::move(cow);
+    ResetCaches();
 
     CowHeader header;
     if (!cow_->GetHeader(&header)) {
@@ -167,6 +175,13 @@ ssize_t CompressedSnapshotReader::Read(void* buf, size_t count) {
     // Chop off the first N bytes if the position is not block-aligned.
     size_t start_offset = offset_ % block_size_;
 
+    // Source device reads cover the rest of the request, and go further
+    // ahead if this read continues the previous one.
+    read_end_chunk_ = end_chunk;
+    if (offset_ == last_read_end_) {
+        read_end_chunk_ = std::max(end_chunk, start_chunk + kReadaheadBlocks - 1);
+    }
+
     MemoryByteSink sink(buf, count);
 
     size_t initial_bytes = std::min(block_size_ - start_offset, sink.remaining());
@@ -193,11 +208,27 @@ ssize_t CompressedSnapshotReader::Read(void* buf, size_t count) {
     }
 
     errno = 0;
+    last_read_end_ = offset_;
 
     DCHECK(sink.pos() - sink.buf() == count);
     return count;
 }
 
+ssize_t CompressedSnapshotReader::ReadV(const struct iovec* iov, int iovcnt) {
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (!iov[i].iov_len) {
+            continue;
+        }
+        ssize_t rv = Read(iov[i].iov_base, iov[i].iov_len);
+        if (rv < 0) {
+            return -1;
+        }
+        total += rv;
+    }
+    return total;
+}
+
 // Discard the first N bytes of a sink request, or any excess bytes.
 class PartialSink : public MemoryByteSink {
   public:
@@ -252,62 +283,123 @@ ssize_t CompressedSnapshotReader::ReadBlock(uint64_t chunk, IByteSink* sink, siz
     }
 
     if (!op || op->type == kCowCopyOp) {
+        uint64_t source_block = op ? op->source : chunk;
+        if (!ReadSourceBlock(chunk, source_block, buffer, start_offset, bytes_to_read)) {
+            return -1;
+        }
+    } else if (op->type == kCowZeroOp) {
+        memset(buffer, 0, bytes_to_read);
+    } else if (op->type == kCowReplaceOp || op->type == kCowXorOp) {
+        const std::string* block = ReadCowBlock(chunk, op);
+        if (!block) {
+            return -1;
+        }
+        memcpy(buffer, block->data() + start_offset, bytes_to_read);
+    } else {
+        LOG(ERROR) << "CompressedSnapshotReader unknown op type: " << uint32_t(op->type);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // MemoryByteSink doesn't do anything in ReturnBuffer, so don't bother calling it.
+    return bytes_to_read;
+}
+
+bool CompressedSnapshotReader::ReadSourceBlock(uint64_t chunk, uint64_t source_block,
+                                               void* buffer, size_t start_offset,
+                                               size_t bytes_to_read) {
+    if (source_block < window_start_ || source_block >= window_start_ + window_blocks_) {
         borrowed_fd fd = GetSourceFd();
         if (fd < 0) {
             // GetSourceFd sets errno.
-            return -1;
+            return false;
         }
 
-        if (op) {
-            chunk = op->source;
+        // Read the run of following chunks that map to consecutive source
+        // blocks along with this one.
+        uint64_t num_blocks = 1;
+        uint64_t max_blocks = std::min(kReadaheadBlocks, read_end_chunk_ - chunk + 1);
+        while (num_blocks < max_blocks) {
+            uint64_t next = chunk + num_blocks;
+            const CowOperation* op = next < ops_.size() ? ops_[next] : nullptr;
+            uint64_t next_source = op ? op->source : next;
+            if ((op && op->type != kCowCopyOp) || next_source != source_block + num_blocks) {
+                break;
+            }
+            num_blocks++;
         }
 
-        off64_t offset = (chunk * block_size_) + start_offset;
-        if (!android::base::ReadFullyAtOffset(fd, buffer, bytes_to_read, offset)) {
-            PLOG(ERROR) << "read " << *source_device_;
-            // ReadFullyAtOffset sets errno.
-            return -1;
-        }
-    } else if (op->type == kCowZeroOp) {
-        memset(buffer, 0, bytes_to_read);
-    } else if (op->type == kCowReplaceOp) {
-        PartialSink partial_sink(buffer, bytes_to_read, start_offset);
-        if (!cow_->ReadData(*op, &partial_sink)) {
-            LOG(ERROR) << "CompressedSnapshotReader failed to read replace op";
-            errno = EIO;
-            return -1;
+        window_blocks_ = 0;
+        window_.resize(num_blocks * block_size_);
+        while (!android::base::ReadFullyAtOffset(fd, window_.data(), num_blocks * block_size_,
+                                                 source_block * block_size_)) {
+            if (num_blocks == 1) {
+                PLOG(ERROR) << "read " << *source_device_;
+                // ReadFullyAtOffset sets errno.
+                return false;
+            }
+            // Reading ahead may have gone past the end of the source device.
+            num_blocks = 1;
         }
-    } else if (op->type == kCowXorOp) {
+        window_start_ = source_block;
+        window_blocks_ = num_blocks;
+    }
+
+    const char* data = window_.data() + (source_block - window_start_) * block_size_;
+    memcpy(buffer, data + start_offset, bytes_to_read);
+    return true;
+}
+
+const std::string* CompressedSnapshotReader::ReadCowBlock(uint64_t chunk,
+                                                          const CowOperation* op) {
+    auto iter = block_cache_map_.find(chunk);
+    if (iter != block_cache_map_.end()) {
+        block_cache_.splice(block_cache_.begin(), block_cache_, iter->second);
+        return &iter->second->second;
+    }
+
+    std::string block(block_size_, '\0');
+    PartialSink sink(block.data(), block.size(), 0);
+    if (!cow_->ReadData(*op, &sink)) {
+        LOG(ERROR) << "CompressedSnapshotReader failed to read "
+                   << (op->type == kCowXorOp ? "xor" : "replace") << " op";
+        errno = EIO;
+        return nullptr;
+    }
+    if (op->type == kCowXorOp) {
         borrowed_fd fd = GetSourceFd();
         if (fd < 0) {
             // GetSourceFd sets errno.
-            return -1;
+            return nullptr;
         }
 
-        off64_t offset = op->source + start_offset;
-        char data[BLOCK_SZ];
-        if (!android::base::ReadFullyAtOffset(fd, &data, bytes_to_read, offset)) {
+        std::string data(block_size_, '\0');
+        if (!android::base::ReadFullyAtOffset(fd, data.data(), data.size(), op->source)) {
             PLOG(ERROR) << "read " << *source_device_;
             // ReadFullyAtOffset sets errno.
-            return -1;
-        }
-        PartialSink partial_sink(buffer, bytes_to_read, start_offset);
-        if (!cow_->ReadData(*op, &partial_sink)) {
-            LOG(ERROR) << "CompressedSnapshotReader failed to read xor op";
-            errno = EIO;
-            return -1;
+            return nullptr;
         }
-        for (size_t i = 0; i < bytes_to_read; i++) {
-            ((char*)buffer)[i] ^= data[i];
+        for (size_t i = 0; i < block.size(); i++) {
+            block[i] ^= data[i];
         }
-    } else {
-        LOG(ERROR) << "CompressedSnapshotReader unknown op type: " << uint32_t(op->type);
-        errno = EINVAL;
-        return -1;
     }
 
-    // MemoryByteSink doesn't do anything in ReturnBuffer, so don't bother calling it.
-    return bytes_to_read;
+    if (block_cache_.size() >= kBlockCacheSize) {
+        block_cache_map_.erase(block_cache_.back().first);
+        block_cache_.pop_back();
+    }
+    block_cache_.emplace_front(chunk, std::move(block));
+    block_cache_map_[chunk] = block_cache_.begin();
+    return &block_cache_.front().second;
+}
+
+void CompressedSnapshotReader::ResetCaches() {
+    block_cache_.clear();
+    block_cache_map_.clear();
+    window_.clear();
+    window_start_ = 0;
+    window_blocks_ = 0;
+    last_read_end_ = -1;
 }
 
 off64_t CompressedSnapshotReader::Seek(off64_t offset, int whence) {
@@ -336,6 +428,7 @@ uint64_t CompressedSnapshotReader::BlockDevSize() {
 bool CompressedSnapshotReader::Close() {
     cow_ = nullptr;
     source_fd_ = {};
+    ResetCaches();
     return true;
 }
 
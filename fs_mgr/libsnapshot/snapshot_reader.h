@@ -16,7 +16,12 @@
 
 #pragma once
 
+#include <sys/uio.h>
+
+#include <list>
 #include <optional>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/file.h>
@@ -64,10 +69,17 @@ class CompressedSnapshotReader : public ReadOnlyFileDescriptor {
     bool IsOpen() override;
     bool Flush() override;
 
+    // Like readv(): fill each buffer in turn, starting at the current offset.
+    ssize_t ReadV(const struct iovec* iov, int iovcnt);
+
   private:
     ssize_t ReadBlock(uint64_t chunk, IByteSink* sink, size_t start_offset,
                       const std::optional<uint64_t>& max_bytes = {});
+    bool ReadSourceBlock(uint64_t chunk, uint64_t source_block, void* buffer, size_t start_offset,
+                         size_t bytes_to_read);
+    const std::string* ReadCowBlock(uint64_t chunk, const CowOperation* op);
     android::base::borrowed_fd GetSourceFd();
+    void ResetCaches();
 
     std::unique_ptr<CowReader> cow_;
     std::unique_ptr<ICowOpIter> op_iter_;
@@ -79,6 +91,21 @@ class CompressedSnapshotReader : public ReadOnlyFileDescriptor {
     off64_t offset_ = 0;
 
     std::vector<const CowOperation*> ops_;
+
+    // Decompressed replace and xor blocks, most recently used first.
+    using BlockCacheList = std::list<std::pair<uint64_t, std::string>>;
+    BlockCacheList block_cache_;
+    std::unordered_map<uint64_t, BlockCacheList::iterator> block_cache_map_;
+
+    // Source device blocks [window_start_, window_start_ + window_blocks_).
+    std::string window_;
+    uint64_t window_start_ = 0;
+    uint64_t window_blocks_ = 0;
+
+    // Offset at which the last Read() ended, and the last chunk of the
+    // current one, used to size source device reads.
+    off64_t last_read_end_ = -1;
+    uint64_t read_end_chunk_ = 0;
 };
 
 }  // namespace snapshot
@@ -21,6 +21,8 @@
 #include <libsnapshot/cow_writer.h>
 #include <payload_consumer/file_descriptor.h>
 
+#include "snapshot_reader.h"
+
 namespace android {
 namespace snapshot {
 
@@ -142,9 +144,49 @@ class OfflineSnapshotTest : public ::testing::Test {
         ASSERT_EQ(value, MakeNewBlockString()[1000]);
     }
 
+    // Small sequential reads and vectored reads, served from the caches or
+    // not, must see the whole snapshot as written.
+    void TestSequentialReads(ISnapshotWriter* writer) {
+        auto reader = writer->OpenReader();
+        ASSERT_NE(reader, nullptr);
+
+        std::string xor_block = base_blocks_[0].substr(kBlockSize / 2, kBlockSize / 2) +
+                                base_blocks_[1].substr(0, kBlockSize / 2);
+        for (int i = 0; i < 100; i++) {
+            xor_block[i] = (char)~(xor_block[i]);
+        }
+        std::string expected = base_blocks_[0] + xor_block + base_blocks_[2] + base_blocks_[0] +
+                               base_blocks_[4] + MakeNewBlockString() + base_blocks_[6] +
+                               std::string(kBlockSize * 2, 0) + base_blocks_[9];
+
+        for (int pass = 0; pass < 2; pass++) {
+            std::string image(expected.size(), 0);
+            ASSERT_EQ(reader->Seek(0, SEEK_SET), 0);
+            for (size_t pos = 0; pos < image.size(); pos += 1000) {
+                size_t len = std::min<size_t>(1000, image.size() - pos);
+                ASSERT_EQ(reader->Read(image.data() + pos, len), len);
+            }
+            ASSERT_EQ(image, expected);
+        }
+
+        auto* compressed = static_cast<CompressedSnapshotReader*>(reader.get());
+        std::string a(kBlockSize / 2, 0), b(kBlockSize * 3, 0), c(kBlockSize * 5 + 7, 0);
+        struct iovec iov[] = {
+                {a.data(), a.size()},
+                {nullptr, 0},
+                {b.data(), b.size()},
+                {c.data(), c.size()},
+        };
+        off64_t offset = kBlockSize / 2;
+        ASSERT_EQ(reader->Seek(offset, SEEK_SET), offset);
+        ASSERT_EQ(compressed->ReadV(iov, 4), a.size() + b.size() + c.size());
+        ASSERT_EQ(a + b + c, expected.substr(offset, a.size() + b.size() + c.size()));
+    }
+
     void TestReads(ISnapshotWriter* writer) {
         ASSERT_NO_FATAL_FAILURE(TestBlockReads(writer));
         ASSERT_NO_FATAL_FAILURE(TestByteReads(writer));
+        ASSERT_NO_FATAL_FAILURE(TestSequentialReads(writer));
     }
 
     std::string MakeNewBlockString() {
@@ -31,6 +31,7 @@
 #include <liblp/builder.h>
 #include <libsnapshot/cow_format.h>
 #include <libsnapshot/snapshot.h>
+#include <snapuserd/snapuserd_client.h>
 #include <storage_literals/storage_literals.h>
 
 #ifdef SNAPSHOTCTL_USERDEBUG_OR_ENG
@@ -56,7 +57,9 @@ int Usage() {
                  "  merge\n"
                  "    Deprecated.\n"
                  "  map\n"
-                 "    Map all partitions at /dev/block/mapper\n";
+                 "    Map all partitions at /dev/block/mapper\n"
+                 "  stats\n"
+                 "    Print snapuserd latency histograms.\n";
     return EX_USAGE;
 }
 
@@ -79,6 +82,17 @@ bool UnmapCmdHandler(int, char** argv) {
     return SnapshotManager::New()->UnmapAllSnapshots();
 }
 
+bool StatsCmdHandler(int /*argc*/, char** argv) {
+    android::base::InitLogging(argv, &android::base::StderrLogger);
+    auto client = SnapuserdClient::Connect(kSnapuserdSocket, 5s);
+    if (!client) {
+        std::cerr << "Could not connect to snapuserd.\n";
+        return false;
+    }
+    std::cout << client->GetStats();
+    return true;
+}
+
 bool MergeCmdHandler(int /*argc*/, char** argv) {
     android::base::InitLogging(argv, &android::base::StderrLogger);
     LOG(WARNING) << "Deprecated. Call update_engine_client --merge instead.";
@@ -215,6 +229,7 @@ static std::map<std::string, std::function<bool(int, char**)>> kCmdMap = {
 #ifdef SNAPSHOTCTL_USERDEBUG_OR_ENG
         {"test-blank-ota", TestOtaHandler},
 #endif
+        {"stats", StatsCmdHandler},
         {"unmap", UnmapCmdHandler},
         // clang-format on
 };
@@ -25,10 +25,15 @@
 namespace android {
 namespace snapshot {
 
+// XOR |len| bytes of |src| into |dst|, using vector instructions where the
+// CPU has them.
+void XorBuffers(uint8_t* dst, const uint8_t* src, size_t len);
+
 class BufferSink : public IByteSink {
   public:
     void Initialize(size_t size);
     void* GetBufPtr() { return buffer_.get(); }
+    size_t GetBufferSize() const { return buffer_size_; }
     void Clear() { memset(GetBufPtr(), 0, buffer_size_); }
     void* GetPayloadBuffer(size_t size);
     void* GetBuffer(size_t requested, size_t* actual) override;
@@ -47,7 +52,9 @@ class BufferSink : public IByteSink {
 class XorSink : public IByteSink {
   public:
     void Initialize(BufferSink* sink, size_t size);
-    void Reset();
+    // Start a new block. The data is XOR'ed into the payload of the sink,
+    // |offset| bytes past its current offset.
+    void Reset(size_t offset = 0);
     void* GetBuffer(size_t requested, size_t* actual) override;
     bool ReturnData(void* buffer, size_t len) override;
 
@@ -55,6 +62,7 @@ class XorSink : public IByteSink {
     BufferSink* bufsink_;
     std::unique_ptr<uint8_t[]> buffer_;
     size_t buffer_size_;
+    size_t offset_;
     size_t returned_;
 };
 
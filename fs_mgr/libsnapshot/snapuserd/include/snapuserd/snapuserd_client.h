@@ -19,6 +19,7 @@
 #include <chrono>
 #include <cstring>
 #include <iostream>
+#include <map>
 #include <string>
 #include <thread>
 #include <vector>
@@ -30,6 +31,9 @@ namespace snapshot {
 
 static constexpr uint32_t PACKET_SIZE = 512;
 
+// Replies that carry statistics for every handler can exceed PACKET_SIZE.
+static constexpr uint32_t kMaxStatsSize = 64 * 1024;
+
 static constexpr char kSnapuserdSocket[] = "snapuserd";
 static constexpr char kSnapuserdSocketProxy[] = "snapuserd_proxy";
 static constexpr char kDaemonAliveIndicator[] = "daemon-alive-indicator";
@@ -42,7 +46,7 @@ class SnapuserdClient {
     android::base::unique_fd sockfd_;
 
     bool Sendmsg(const std::string& msg);
-    std::string Receivemsg();
+    std::string Receivemsg(size_t max_size = PACKET_SIZE);
 
     bool ValidateConnection();
     std::string GetDaemonAliveIndicatorPath();
@@ -72,6 +76,13 @@ class SnapuserdClient {
                            const std::string& base_path_merge = "");
     bool AttachDmUser(const std::string& misc_name);
 
+    // Tune io_uring for the merge and read-ahead threads of a handler. Must be
+    // called between InitDmUserCow and AttachDmUser. Only supported by the
+    // user-space merge daemon. |merge_io_blocks| caps the blocks merged with
+    // one write; 0 keeps the daemon's default.
+    bool SetIoUringOptions(const std::string& misc_name, int queue_depth, int merge_batch_blocks,
+                           bool register_buffers, int merge_io_blocks = 0);
+
     // Wait for snapuserd to disassociate with a dm-user control device. This
     // must ONLY be called if the control device has already been deleted.
     bool WaitForDeviceDelete(const std::string& control_device);
@@ -84,6 +95,12 @@ class SnapuserdClient {
     // Returns true if the snapuserd instance supports bridging a socket to second-stage init.
     bool SupportsSecondStageSocketHandoff();
 
+    // Return a memfd holding the op index of each handler, keyed by misc name,
+    // so that the daemon relaunched for the selinux transition does not need
+    // to parse the COWs again. Handlers whose COW carries its own op index
+    // are omitted. Only supported by the user-space merge daemon.
+    bool ExportOpIndexes(std::map<std::string, android::base::unique_fd>* op_indexes);
+
     // Returns true if the merge is started(or resumed from crash).
     bool InitiateMerge(const std::string& misc_name);
 
@@ -93,10 +110,28 @@ class SnapuserdClient {
     // Return the status of the snapshot
     std::string QuerySnapshotStatus(const std::string& misc_name);
 
+    // Return the status of the snapshot, followed by the current merge rate
+    // and read-ahead window:
+    // "<status>,<blocks_per_commit>,<sleep_ms>,<io_pressure>,<ra_window_blocks>".
+    std::string QueryMergeRate(const std::string& misc_name);
+
     // Check the update verification status - invoked by update_verifier during
     // boot
     bool QueryUpdateVerification();
 
+    // Return "<partition>,<bytes_read>,<duration_ms>,<MiB/s>" for each verified
+    // partition, separated by ';'.
+    std::string QueryVerificationStats();
+
+    // Return the latency histograms of every handler, one per line:
+    // "<misc_name> <histogram> count=<n> avg_us=<n> p50_us=<n> ...".
+    std::string GetStats();
+
+    // Return "<state>,rss_kb=<n>,budget_kb=<n>,reserved_kb=<n>": the resident
+    // memory of the daemon, its memory budget, and the part of the budget
+    // held by handlers. Empty on failure.
+    std::string GetMemoryStatus();
+
     // Check if Snapuser daemon is ready post selinux transition after OTA boot
     // This is invoked only by init as there is no sockets setup yet during
     // selinux transition
@@ -17,9 +17,69 @@
 #include <snapuserd/snapuserd_buffer.h>
 #include <snapuserd/snapuserd_kernel.h>
 
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 namespace android {
 namespace snapshot {
 
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) static size_t XorBuffersAvx2(uint8_t* dst, const uint8_t* src,
+                                                              size_t len) {
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m256i d0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i d1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i + 32));
+        __m256i s0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i s1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(d0, s0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 32), _mm256_xor_si256(d1, s1));
+    }
+    return i;
+}
+
+static bool HasAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+void XorBuffers(uint8_t* dst, const uint8_t* src, size_t len) {
+    size_t i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 64 <= len; i += 64) {
+        uint8x16_t d0 = vld1q_u8(dst + i);
+        uint8x16_t d1 = vld1q_u8(dst + i + 16);
+        uint8x16_t d2 = vld1q_u8(dst + i + 32);
+        uint8x16_t d3 = vld1q_u8(dst + i + 48);
+        vst1q_u8(dst + i, veorq_u8(d0, vld1q_u8(src + i)));
+        vst1q_u8(dst + i + 16, veorq_u8(d1, vld1q_u8(src + i + 16)));
+        vst1q_u8(dst + i + 32, veorq_u8(d2, vld1q_u8(src + i + 32)));
+        vst1q_u8(dst + i + 48, veorq_u8(d3, vld1q_u8(src + i + 48)));
+    }
+#elif defined(__x86_64__)
+    static const bool has_avx2 = HasAvx2();
+    if (has_avx2) {
+        i = XorBuffersAvx2(dst, src, len);
+    }
+#endif
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t d, s;
+        memcpy(&d, dst + i, sizeof(d));
+        memcpy(&s, src + i, sizeof(s));
+        d ^= s;
+        memcpy(dst + i, &d, sizeof(d));
+    }
+    for (; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
 void BufferSink::Initialize(size_t size) {
     buffer_size_ = size;
     buffer_offset_ = 0;
@@ -62,11 +122,13 @@ void* BufferSink::GetPayloadBufPtr() {
 void XorSink::Initialize(BufferSink* sink, size_t size) {
     bufsink_ = sink;
     buffer_size_ = size;
+    offset_ = 0;
     returned_ = 0;
     buffer_ = std::make_unique<uint8_t[]>(size);
 }
 
-void XorSink::Reset() {
+void XorSink::Reset(size_t offset) {
+    offset_ = offset;
     returned_ = 0;
 }
 
@@ -81,13 +143,12 @@ void* XorSink::GetBuffer(size_t requested, size_t* actual) {
 
 bool XorSink::ReturnData(void* buffer, size_t len) {
     uint8_t* xor_data = reinterpret_cast<uint8_t*>(buffer);
-    uint8_t* buff = reinterpret_cast<uint8_t*>(bufsink_->GetPayloadBuffer(len + returned_));
+    uint8_t* buff =
+            reinterpret_cast<uint8_t*>(bufsink_->GetPayloadBuffer(offset_ + returned_ + len));
     if (buff == nullptr) {
         return false;
     }
-    for (size_t i = 0; i < len; i++) {
-        buff[returned_ + i] ^= xor_data[i];
-    }
+    XorBuffers(buff + offset_ + returned_, xor_data, len);
     returned_ += len;
     return true;
 }
@@ -29,6 +29,7 @@
 #include <chrono>
 #include <sstream>
 
+#include <android-base/cmsg.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
@@ -170,9 +171,38 @@ bool SnapuserdClient::SupportsSecondStageSocketHandoff() {
     return response == "success";
 }
 
-std::string SnapuserdClient::Receivemsg() {
-    char msg[PACKET_SIZE];
-    ssize_t ret = TEMP_FAILURE_RETRY(recv(sockfd_, msg, sizeof(msg), 0));
+bool SnapuserdClient::ExportOpIndexes(std::map<std::string, unique_fd>* op_indexes) {
+    std::string msg = "export_op_index";
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return false;
+    }
+
+    static constexpr size_t kMaxOpIndexes = 64;
+    std::string response(PACKET_SIZE * 8, '\0');
+    std::vector<unique_fd> fds;
+    ssize_t rv = android::base::ReceiveFileDescriptorVector(sockfd_, response.data(),
+                                                            response.size(), kMaxOpIndexes, &fds);
+    if (rv <= 0) {
+        PLOG(ERROR) << "Failed to receive op indexes from snapuserd";
+        return false;
+    }
+    response.resize(rv);
+
+    auto parts = android::base::Split(response, ",");
+    if (parts[0] != "success" || parts.size() != fds.size() + 1) {
+        LOG(ERROR) << "Unexpected op index reply from snapuserd: " << response;
+        return false;
+    }
+    for (size_t i = 0; i < fds.size(); i++) {
+        (*op_indexes)[parts[i + 1]] = std::move(fds[i]);
+    }
+    return true;
+}
+
+std::string SnapuserdClient::Receivemsg(size_t max_size) {
+    std::string msg(max_size, '\0');
+    ssize_t ret = TEMP_FAILURE_RETRY(recv(sockfd_, msg.data(), msg.size(), 0));
     if (ret < 0) {
         PLOG(ERROR) << "Snapuserd:client: recv failed";
         return {};
@@ -181,7 +211,8 @@ std::string SnapuserdClient::Receivemsg() {
         LOG(DEBUG) << "Snapuserd:client disconnected";
         return {};
     }
-    return std::string(msg, ret);
+    msg.resize(ret);
+    return msg;
 }
 
 bool SnapuserdClient::StopSnapuserd() {
@@ -211,6 +242,29 @@ bool SnapuserdClient::AttachDmUser(const std::string& misc_name) {
     return true;
 }
 
+bool SnapuserdClient::SetIoUringOptions(const std::string& misc_name, int queue_depth,
+                                        int merge_batch_blocks, bool register_buffers,
+                                        int merge_io_blocks) {
+    std::vector<std::string> parts = {"io_uring_options",
+                                      misc_name,
+                                      std::to_string(queue_depth),
+                                      std::to_string(merge_batch_blocks),
+                                      register_buffers ? "1" : "0",
+                                      std::to_string(merge_io_blocks)};
+    std::string msg = android::base::Join(parts, ",");
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd daemon";
+        return false;
+    }
+
+    std::string str = Receivemsg();
+    if (str != "success") {
+        LOG(ERROR) << "Failed to receive ack for " << msg << " from snapuserd daemon";
+        return false;
+    }
+    return true;
+}
+
 uint64_t SnapuserdClient::InitDmUserCow(const std::string& misc_name, const std::string& cow_device,
                                         const std::string& backing_device,
                                         const std::string& base_path_merge) {
@@ -288,6 +342,74 @@ std::string SnapuserdClient::QuerySnapshotStatus(const std::string& misc_name) {
     return Receivemsg();
 }
 
+std::string SnapuserdClient::QueryMergeRate(const std::string& misc_name) {
+    std::string msg = "getmergerate," + misc_name;
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return "fail";
+    }
+    return Receivemsg();
+}
+
+std::string SnapuserdClient::QueryVerificationStats() {
+    std::string msg = "verify-stats";
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return "";
+    }
+    std::string response = Receivemsg();
+    return response == "none" ? "" : response;
+}
+
+std::string SnapuserdClient::GetStats() {
+    std::string msg = "getstats";
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return "";
+    }
+    // The reply is "<length>,<histograms>", and a long one takes several
+    // recv() calls.
+    std::string response;
+    size_t comma;
+    while ((comma = response.find(',')) == std::string::npos) {
+        std::string more = Receivemsg();
+        if (more.empty() || response.size() + more.size() > PACKET_SIZE) {
+            LOG(ERROR) << "Invalid stats reply from snapuserd";
+            return "";
+        }
+        response += more;
+    }
+    size_t length;
+    if (!android::base::ParseUint(response.substr(0, comma), &length, size_t{kMaxStatsSize})) {
+        LOG(ERROR) << "Invalid stats length from snapuserd: " << response.substr(0, comma);
+        return "";
+    }
+    response.erase(0, comma + 1);
+    while (response.size() < length) {
+        std::string more = Receivemsg(length - response.size());
+        if (more.empty()) {
+            LOG(ERROR) << "Stats reply from snapuserd truncated at " << response.size() << " of "
+                       << length << " bytes";
+            return "";
+        }
+        response += more;
+    }
+    if (response.size() != length) {
+        LOG(ERROR) << "Stats reply from snapuserd is longer than its length: " << length;
+        return "";
+    }
+    return response;
+}
+
+std::string SnapuserdClient::GetMemoryStatus() {
+    std::string msg = "query,memory";
+    if (!Sendmsg(msg)) {
+        LOG(ERROR) << "Failed to send message " << msg << " to snapuserd";
+        return "";
+    }
+    return Receivemsg();
+}
+
 bool SnapuserdClient::QueryUpdateVerification() {
     std::string msg = "update-verify";
     if (!Sendmsg(msg)) {
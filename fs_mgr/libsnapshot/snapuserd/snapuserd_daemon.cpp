@@ -15,6 +15,7 @@
  */
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/strings.h>
 #include <gflags/gflags.h>
@@ -29,6 +30,9 @@ DEFINE_bool(socket_handoff, false,
             "If true, perform a socket hand-off with an existing snapuserd instance, then exit.");
 DEFINE_bool(user_snapshot, false, "If true, user-space snapshots are used");
 DEFINE_bool(io_uring, false, "If true, io_uring feature is enabled");
+DEFINE_uint32(memory_budget_mb, 0,
+              "If non-zero, worker counts and read-ahead windows are scaled down so that the "
+              "buffers of all partitions fit in this many MiB.");
 
 namespace android {
 namespace snapshot {
@@ -96,6 +100,7 @@ bool Daemon::StartServerForUserspaceSnapshots(int arg_start, int argc, char** ar
     if (FLAGS_io_uring) {
         user_server_.SetIouringEnabled();
     }
+    user_server_.SetMemoryBudget(static_cast<uint64_t>(FLAGS_memory_budget_mb) << 20);
 
     if (FLAGS_socket_handoff) {
         return user_server_.RunForSocketHandoff();
@@ -109,11 +114,23 @@ bool Daemon::StartServerForUserspaceSnapshots(int arg_start, int argc, char** ar
 
     for (int i = arg_start; i < argc; i++) {
         auto parts = android::base::Split(argv[i], ",");
-        if (parts.size() != 4) {
-            LOG(ERROR) << "Malformed message, expected four sub-arguments.";
+        if (parts.size() != 4 && parts.size() != 5) {
+            LOG(ERROR) << "Malformed message, expected four or five sub-arguments.";
             return false;
         }
-        auto handler = user_server_.AddHandler(parts[0], parts[1], parts[2], parts[3]);
+        // The optional fifth sub-argument is an inherited op index memfd,
+        // exported by the first-stage daemon.
+        android::base::unique_fd op_index_fd;
+        if (parts.size() == 5) {
+            int fd;
+            if (!android::base::ParseInt(parts[4], &fd, 0)) {
+                LOG(ERROR) << "Malformed op index fd: " << parts[4];
+                return false;
+            }
+            op_index_fd.reset(fd);
+        }
+        auto handler = user_server_.AddHandler(parts[0], parts[1], parts[2], parts[3],
+                                               std::move(op_index_fd));
         if (!handler || !user_server_.StartHandler(handler)) {
             return false;
         }
@@ -0,0 +1,242 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <memory>
+#include <random>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+#include <fs_mgr/file_wait.h>
+#include <libdm/dm.h>
+#include <libdm/loop_control.h>
+#include <libsnapshot/cow_writer.h>
+#include <snapuserd/snapuserd_client.h>
+#include <storage_literals/storage_literals.h>
+
+namespace android {
+namespace snapshot {
+
+using namespace android::storage_literals;
+using namespace std::chrono_literals;
+using android::base::unique_fd;
+using android::dm::DeviceMapper;
+using android::dm::DmTable;
+using android::dm::DmTargetUser;
+using android::dm::LoopDevice;
+
+static constexpr char kSnapuserdSocketBenchmark[] = "snapuserdBenchmark";
+static constexpr char kDeviceName[] = "snapuserd_benchmark";
+static constexpr char kControlName[] = "snapuserd_benchmark-ctrl";
+static constexpr uint64_t kDeviceSize = 256_MiB;
+
+// A snapshot device served by a snapuserd started for the benchmark, over a
+// loop device. A quarter of the blocks are copies, a quarter are lz4 replace
+// ops and the rest are unmodified, interleaved the way a delta OTA would
+// leave them.
+class SnapuserdDevice {
+  public:
+    ~SnapuserdDevice();
+
+    bool Setup();
+    const std::string& path() const { return path_; }
+
+  private:
+    bool CreateBaseDevice();
+    bool CreateCow();
+    bool StartDaemon();
+
+    unique_fd base_fd_;
+    std::unique_ptr<LoopDevice> base_loop_;
+    std::unique_ptr<TemporaryFile> cow_;
+    std::unique_ptr<SnapuserdClient> client_;
+    pid_t daemon_pid_ = -1;
+    bool dm_user_created_ = false;
+    std::string path_;
+};
+
+static std::unique_ptr<SnapuserdDevice> sDevice;
+
+SnapuserdDevice::~SnapuserdDevice() {
+    if (dm_user_created_) {
+        DeviceMapper::Instance().DeleteDevice(kDeviceName);
+        if (client_) {
+            client_->WaitForDeviceDelete(kControlName);
+        }
+    }
+    if (client_) {
+        client_->DetachSnapuserd();
+    }
+    if (daemon_pid_ > 0) {
+        waitpid(daemon_pid_, nullptr, 0);
+    }
+}
+
+bool SnapuserdDevice::CreateBaseDevice() {
+    base_fd_.reset(syscall(__NR_memfd_create, "base_device", MFD_ALLOW_SEALING));
+    if (base_fd_ < 0) {
+        PLOG(ERROR) << "memfd_create failed";
+        return false;
+    }
+
+    std::mt19937_64 rng(0);
+    std::string buffer(1_MiB, '\0');
+    for (uint64_t offset = 0; offset < kDeviceSize; offset += buffer.size()) {
+        for (size_t i = 0; i < buffer.size(); i += sizeof(uint64_t)) {
+            uint64_t value = rng();
+            memcpy(&buffer[i], &value, sizeof(value));
+        }
+        if (!android::base::WriteFully(base_fd_, buffer.data(), buffer.size())) {
+            PLOG(ERROR) << "write base device failed";
+            return false;
+        }
+    }
+
+    base_loop_ = std::make_unique<LoopDevice>(base_fd_, 10s);
+    return base_loop_->valid();
+}
+
+bool SnapuserdDevice::CreateCow() {
+    cow_ = std::make_unique<TemporaryFile>(android::base::GetExecutableDirectory());
+
+    CowOptions options;
+    options.compression = "lz4";
+    CowWriter writer(options);
+    if (!writer.Initialize(cow_->fd)) {
+        return false;
+    }
+
+    // Half zero blocks, so that lz4 has something to compress.
+    std::string block(options.block_size, '\0');
+    std::mt19937_64 rng(1);
+    const uint64_t num_blocks = kDeviceSize / options.block_size;
+    for (uint64_t b = 0; b < num_blocks; b += 4) {
+        if (!writer.AddCopy(b, num_blocks - 1 - b)) {
+            return false;
+        }
+        for (size_t i = 0; i < block.size() / 2; i += sizeof(uint64_t)) {
+            uint64_t value = rng();
+            memcpy(&block[i], &value, sizeof(value));
+        }
+        if (!writer.AddRawBlocks(b + 1, block.data(), block.size())) {
+            return false;
+        }
+    }
+    return writer.Finalize();
+}
+
+bool SnapuserdDevice::StartDaemon() {
+    daemon_pid_ = fork();
+    if (daemon_pid_ < 0) {
+        PLOG(ERROR) << "fork failed";
+        return false;
+    }
+    if (daemon_pid_ == 0) {
+        std::string arg0 = "/system/bin/snapuserd";
+        std::string arg1 = std::string("-socket=") + kSnapuserdSocketBenchmark;
+        char* const argv[] = {arg0.data(), arg1.data(), nullptr};
+        execv(arg0.c_str(), argv);
+        _exit(127);
+    }
+
+    client_ = SnapuserdClient::Connect(kSnapuserdSocketBenchmark, 10s);
+    return client_ != nullptr;
+}
+
+bool SnapuserdDevice::Setup() {
+    if (!CreateBaseDevice() || !CreateCow() || !StartDaemon()) {
+        return false;
+    }
+
+    uint64_t num_sectors = client_->InitDmUserCow(kControlName, cow_->path, base_loop_->device(),
+                                                  base_loop_->device());
+    if (!num_sectors) {
+        LOG(ERROR) << "InitDmUserCow failed";
+        return false;
+    }
+
+    DmTable table;
+    if (!table.AddTarget(std::make_unique<DmTargetUser>(0, num_sectors, kControlName))) {
+        return false;
+    }
+    if (!DeviceMapper::Instance().CreateDevice(kDeviceName, table, &path_, 10s)) {
+        LOG(ERROR) << "could not create dm-user device";
+        return false;
+    }
+    dm_user_created_ = true;
+
+    if (!android::fs_mgr::WaitForFile(std::string("/dev/dm-user/") + kControlName, 10s)) {
+        return false;
+    }
+    return client_->AttachDmUser(kControlName);
+}
+
+// Argument: read size.
+static void BM_RandomRead(benchmark::State& state) {
+    if (!sDevice) {
+        sDevice = std::make_unique<SnapuserdDevice>();
+        if (!sDevice->Setup()) {
+            state.SkipWithError("could not set up snapuserd (needs root and dm-user)");
+            return;
+        }
+    }
+
+    // O_DIRECT so that every read goes to snapuserd rather than the page
+    // cache.
+    unique_fd fd(open(sDevice->path().c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC));
+    if (fd < 0) {
+        state.SkipWithError("could not open snapshot device");
+        return;
+    }
+
+    const size_t read_size = state.range(0);
+    void* buffer;
+    if (posix_memalign(&buffer, 4096, read_size)) {
+        state.SkipWithError("could not allocate buffer");
+        return;
+    }
+    std::unique_ptr<void, decltype(&free)> buffer_guard(buffer, &free);
+
+    std::mt19937_64 rng(2);
+    std::uniform_int_distribution<uint64_t> dist(0, kDeviceSize / read_size - 1);
+    for (auto _ : state) {
+        if (pread64(fd, buffer, read_size, dist(rng) * read_size) != (ssize_t)read_size) {
+            state.SkipWithError("read failed");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * read_size);
+}
+BENCHMARK(BM_RandomRead)->Arg(4_KiB)->Arg(16_KiB)->Arg(64_KiB)->UseRealTime();
+
+}  // namespace snapshot
+}  // namespace android
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    // Tear down the device and daemon before the loop device goes away.
+    android::snapshot::sDevice = nullptr;
+    return 0;
+}
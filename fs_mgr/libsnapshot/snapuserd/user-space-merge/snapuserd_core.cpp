@@ -16,6 +16,7 @@
 
 #include "snapuserd_core.h"
 
+#include <inttypes.h>
 #include <sys/utsname.h>
 
 #include <android-base/chrono_utils.h>
@@ -45,6 +46,7 @@ SnapshotHandler::SnapshotHandler(std::string misc_name, std::string cow_device,
 }
 
 bool SnapshotHandler::InitializeWorkers() {
+    std::lock_guard<std::mutex> lock(stats_lock_);
     for (int i = 0; i < num_worker_threads_; i++) {
         std::unique_ptr<Worker> wt =
                 std::make_unique<Worker>(cow_device_, backing_store_device_, control_device_,
@@ -54,20 +56,107 @@ bool SnapshotHandler::InitializeWorkers() {
             return false;
         }
 
+        worker_stats_.push_back(wt->GetStats());
         worker_threads_.push_back(std::move(wt));
     }
 
     merge_thread_ = std::make_unique<Worker>(cow_device_, backing_store_device_, control_device_,
                                              misc_name_, base_path_merge_, GetSharedPtr());
+    worker_stats_.push_back(merge_thread_->GetStats());
 
     read_ahead_thread_ = std::make_unique<ReadAhead>(cow_device_, backing_store_device_, misc_name_,
                                                      GetSharedPtr());
 
-    update_verify_ = std::make_unique<UpdateVerify>(misc_name_);
+    update_verify_ = std::make_unique<UpdateVerify>(misc_name_, IsIouringSupported());
 
     return true;
 }
 
+void LatencyHistogram::Record(std::chrono::nanoseconds duration) {
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    size_t bucket = 0;
+    while (bucket < kNumBuckets - 1 && us >= (1ULL << bucket)) {
+        bucket++;
+    }
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_us_.fetch_add(us, std::memory_order_relaxed);
+
+    uint64_t max = max_us_.load(std::memory_order_relaxed);
+    while (us > max && !max_us_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::Add(const LatencyHistogram& other) {
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        buckets_[i].fetch_add(other.buckets_[i].load(std::memory_order_relaxed),
+                              std::memory_order_relaxed);
+    }
+    count_.fetch_add(other.GetCount(), std::memory_order_relaxed);
+    sum_us_.fetch_add(other.sum_us_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    max_us_.store(std::max(max_us_.load(std::memory_order_relaxed),
+                           other.max_us_.load(std::memory_order_relaxed)),
+                  std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetPercentile(double percentile) const {
+    uint64_t target = static_cast<uint64_t>(GetCount() * percentile);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets - 1; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen > target) {
+            return std::min(uint64_t{1} << i, max_us_.load(std::memory_order_relaxed));
+        }
+    }
+    return max_us_.load(std::memory_order_relaxed);
+}
+
+std::string LatencyHistogram::ToString() const {
+    uint64_t count = GetCount();
+    uint64_t avg = count ? sum_us_.load(std::memory_order_relaxed) / count : 0;
+    return android::base::StringPrintf(
+            "count=%" PRIu64 " avg_us=%" PRIu64 " p50_us=%" PRIu64 " p90_us=%" PRIu64
+            " p99_us=%" PRIu64 " max_us=%" PRIu64,
+            count, avg, GetPercentile(0.5), GetPercentile(0.9), GetPercentile(0.99),
+            max_us_.load(std::memory_order_relaxed));
+}
+
+std::string SnapshotHandler::GetStats() {
+    static constexpr const char* kCompressionNames[] = {"none", "gz", "brotli", "lz4", "zstd"};
+    static_assert(std::size(kCompressionNames) == kCowCompressZstd + 1);
+
+    WorkerStats total;
+    {
+        std::lock_guard<std::mutex> lock(stats_lock_);
+        for (const auto& stats : worker_stats_) {
+            total.dm_user_request.Add(stats->dm_user_request);
+            for (size_t i = 0; i < total.decompress.size(); i++) {
+                total.decompress[i].Add(stats->decompress[i]);
+            }
+            total.base_read.Add(stats->base_read);
+            total.merge_batch.Add(stats->merge_batch);
+        }
+    }
+
+    std::vector<std::pair<std::string, const LatencyHistogram*>> histograms = {
+            {"dm-user-request", &total.dm_user_request},
+            {"base-read", &total.base_read},
+            {"merge-batch", &total.merge_batch},
+    };
+    for (size_t i = 0; i < total.decompress.size(); i++) {
+        histograms.emplace_back(std::string("decompress-") + kCompressionNames[i], &total.decompress[i]);
+    }
+
+    std::string stats;
+    for (const auto& [name, histogram] : histograms) {
+        if (histogram->GetCount() == 0) {
+            continue;
+        }
+        stats += misc_name_ + " " + name + " " + histogram->ToString() + "\n";
+    }
+    return stats;
+}
+
 std::unique_ptr<CowReader> SnapshotHandler::CloneReaderForWorker() {
     return reader_->CloneCowReader();
 }
@@ -152,6 +241,40 @@ bool SnapshotHandler::CheckMergeCompletionStatus() {
     return true;
 }
 
+bool SnapshotHandler::ParseCow() {
+    if (op_index_fd_ >= 0) {
+        if (!reader_->ParseWithOpIndex(cow_fd_, op_index_fd_)) {
+            return false;
+        }
+        if (!reader_->HasOpIndex()) {
+            SNAP_LOG(WARNING) << "Handed over op index was not usable, parsed the COW instead";
+            op_index_fd_ = {};
+        }
+        return true;
+    }
+
+    // Parse the COW once and keep the result as an op index in a memfd, so
+    // that the daemon launched after the selinux transition can map it
+    // instead of parsing the COW again. Not needed if the COW has an index.
+    CowReader parser(CowReader::ReaderFlags::USERSPACE_MERGE);
+    if (!parser.Parse(cow_fd_)) {
+        return false;
+    }
+    if (!parser.HasOpIndex()) {
+        unique_fd fd(memfd_create("snapuserd_op_index", MFD_CLOEXEC));
+        uint64_t size;
+        if (fd < 0) {
+            SNAP_PLOG(ERROR) << "memfd_create failed";
+        } else if (!parser.ExportOpIndex(fd, &size)) {
+            SNAP_LOG(ERROR) << "Failed to export op index";
+        } else {
+            SNAP_LOG(DEBUG) << "Exported op index of size: " << size;
+            op_index_fd_ = std::move(fd);
+        }
+    }
+    return reader_->ParseWithOpIndex(cow_fd_, op_index_fd_);
+}
+
 bool SnapshotHandler::ReadMetadata() {
     reader_ = std::make_unique<CowReader>(CowReader::ReaderFlags::USERSPACE_MERGE, true);
     CowHeader header;
@@ -159,7 +282,7 @@ bool SnapshotHandler::ReadMetadata() {
 
     SNAP_LOG(DEBUG) << "ReadMetadata: Parsing cow file";
 
-    if (!reader_->Parse(cow_fd_)) {
+    if (!ParseCow()) {
         SNAP_LOG(ERROR) << "Failed to parse";
         return false;
     }
@@ -183,10 +306,30 @@ bool SnapshotHandler::ReadMetadata() {
 
     UpdateMergeCompletionPercentage();
 
+    ra_data_size_ = GetBufferDataSize();
+    if (ra_window_limit_ && ra_window_limit_ < ra_data_size_) {
+        if (GetBufferState()->read_ahead_state == kCowReadAheadDone) {
+            SNAP_LOG(INFO) << "Read-ahead data to recover, not limiting read-ahead window";
+        } else {
+            ra_data_size_ = std::max(ra_window_limit_ & ~(BLOCK_SZ - 1), BLOCK_SZ);
+            SNAP_LOG(INFO) << "Read-ahead window limited to: " << ra_data_size_;
+        }
+    }
+
     // Initialize the iterator for reading metadata
     std::unique_ptr<ICowOpIter> cowop_iter = reader_->GetOpIter(true);
 
-    int num_ra_ops_per_iter = ((GetBufferDataSize()) / BLOCK_SZ);
+    // Ordered ops are split into merge groups. If read-ahead data has to be
+    // recovered, the recovered window is the first group, so that it is
+    // merged as a whole as before the crash.
+    int window_blocks = GetReadAheadDataSize() / BLOCK_SZ;
+    ra_group_blocks_ = std::min(kMergeGroupBlocks, window_blocks);
+    ra_window_.Initialize(ra_group_blocks_, window_blocks / ra_group_blocks_);
+
+    int num_ra_ops_per_iter = GetRecoveredReadAheadBlocks();
+    if (num_ra_ops_per_iter == 0) {
+        num_ra_ops_per_iter = ra_group_blocks_;
+    }
     int ra_index = 0;
 
     size_t copy_ops = 0, replace_ops = 0, zero_ops = 0, xor_ops = 0;
@@ -220,7 +363,7 @@ bool SnapshotHandler::ReadMetadata() {
 
             // Move to next RA block
             if (num_ra_ops_per_iter == 0) {
-                num_ra_ops_per_iter = ((GetBufferDataSize()) / BLOCK_SZ);
+                num_ra_ops_per_iter = ra_group_blocks_;
                 ra_index += 1;
             }
         }
@@ -231,6 +374,7 @@ bool SnapshotHandler::ReadMetadata() {
 
     // Sort the vector based on sectors as we need this during un-aligned access
     std::sort(chunk_vec_.begin(), chunk_vec_.end(), compare);
+    block_op_map_.Build(chunk_vec_);
 
     PrepareReadAhead();
 
@@ -420,6 +564,30 @@ size_t SnapshotHandler::GetBufferDataSize() {
     return (buffer_size - GetBufferMetadataSize());
 }
 
+// Number of blocks in the scratch space that ReadAhead::ReconstructDataFromCow()
+// will recover, or 0 if there is nothing to recover.
+int SnapshotHandler::GetRecoveredReadAheadBlocks() {
+    if (GetBufferState()->read_ahead_state != kCowReadAheadDone) {
+        return 0;
+    }
+
+    size_t metadata_size = GetBufferMetadataSize();
+    // The metadata may not be aligned; see ReconstructDataFromCow().
+    auto metadata = std::make_unique<uint8_t[]>(metadata_size);
+    memcpy(metadata.get(), (char*)mapped_addr_ + GetBufferMetadataOffset(), metadata_size);
+
+    int num_blocks = 0;
+    for (size_t offset = 0; offset + sizeof(ScratchMetadata) <= metadata_size;
+         offset += sizeof(ScratchMetadata)) {
+        auto bm = reinterpret_cast<struct ScratchMetadata*>(metadata.get() + offset);
+        if (bm->new_block == 0 && bm->file_offset == 0) {
+            break;
+        }
+        num_blocks += 1;
+    }
+    return num_blocks;
+}
+
 struct BufferState* SnapshotHandler::GetBufferState() {
     CowHeader header;
     reader_->GetHeader(&header);
@@ -22,6 +22,9 @@
 #include <sys/time.h>
 #include <unistd.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstring>
 #include <future>
@@ -59,6 +62,10 @@ static_assert(PAYLOAD_BUFFER_SZ >= BLOCK_SZ);
 
 static constexpr int kNumWorkerThreads = 4;
 
+// Ordered ops are tracked for merge in groups of this many blocks. Each
+// read-ahead window covers a whole number of groups.
+static constexpr int kMergeGroupBlocks = 32;
+
 static constexpr int kNiceValueForMergeThreads = -5;
 
 #define SNAP_LOG(level) LOG(level) << misc_name_ << ": "
@@ -75,6 +82,164 @@ enum class MERGE_IO_TRANSITION {
 
 class SnapshotHandler;
 
+// Per-handler io_uring tuning for the merge and read-ahead threads. Set by
+// the client through UserSnapshotServer before the handler is started.
+struct IoUringOptions {
+    // Queue depth of 8 seems optimal by default. We don't want
+    // to have a huge depth as it may put more memory pressure
+    // on the kernel worker threads given that we use
+    // IOSQE_ASYNC flag - ASYNC flags can potentially
+    // result in EINTR; Since we don't restart
+    // syscalls and fallback to synchronous I/O, we
+    // don't want huge queue depth
+    int queue_depth = 8;
+
+    // Number of replace/zero blocks merged between commits. Flush after
+    // merging 2MB by default; larger batches can be problematic on low
+    // memory devices with multiple merge threads in parallel.
+    int merge_batch_blocks = (PAYLOAD_BUFFER_SZ / BLOCK_SZ) * 2;
+
+    // Largest number of consecutive blocks merged with a single write, or
+    // zeroed with a single BLKZEROOUT. At most one payload buffer.
+    int merge_io_blocks = PAYLOAD_BUFFER_SZ / BLOCK_SZ;
+
+    // Register the I/O buffers and target fds with each ring
+    // (IORING_REGISTER_BUFFERS / IORING_REGISTER_FILES).
+    bool register_buffers = false;
+};
+
+// Paces MergeReplaceZeroOps according to system I/O pressure, so that the
+// merge runs flat out on an idle device and backs off while foreground I/O
+// is stalling. Pressure is "some avg10" from /proc/pressure/io; without PSI
+// the merge is not throttled.
+class MergeRateController {
+  public:
+    // At most |max_batch_blocks| blocks are merged per commit.
+    void Initialize(int max_batch_blocks);
+
+    // Number of blocks to merge before the next commit.
+    int GetBatchBlocks();
+
+    // Called after each commit. Sleeps as long as the current rate requires.
+    void Throttle();
+
+    // "<batch_blocks>,<sleep_ms>,<io_pressure>" for the merge rate query.
+    std::string GetStatus();
+
+  private:
+    static constexpr double kLowPressure = 5.0;
+    static constexpr double kHighPressure = 40.0;
+    static constexpr int kMaxSleepMs = 200;
+    static constexpr int kMinBatchDivisor = 16;
+    static constexpr std::chrono::milliseconds kSampleInterval = 200ms;
+
+    void Update();
+    static bool ReadIoPressure(double* avg10);
+
+    std::mutex lock_;
+    int max_batch_blocks_ = 0;
+    int batch_blocks_ = 0;
+    int sleep_ms_ = 0;
+    double io_pressure_ = 0;
+    bool psi_available_ = true;
+    std::chrono::steady_clock::time_point last_sample_;
+};
+
+// Read "some avg10" from a PSI file such as /proc/pressure/io.
+bool ReadPressureAvg10(const char* path, double* avg10);
+
+// Sizes the read-ahead window in whole merge groups. The window grows while
+// source reads are sequential and the merge thread keeps up with read-ahead,
+// and shrinks under memory or I/O pressure. Without PSI, only the first two
+// apply.
+class ReadAheadWindow {
+  public:
+    // The window holds at most |max_groups| groups of |group_blocks| blocks.
+    void Initialize(int group_blocks, int max_groups);
+
+    // Number of merge groups to read ahead in the next cycle.
+    int GetGroups();
+
+    // Called after each cycle with the number of blocks read, the number of
+    // reads they took, and how long the read-ahead thread then waited for the
+    // merge of the previous window.
+    void Update(int blocks, int reads, std::chrono::nanoseconds merge_wait);
+
+    // As above, with "some avg10" of I/O and memory PSI already sampled.
+    void Update(int blocks, int reads, std::chrono::nanoseconds merge_wait, double io_pressure,
+                double memory_pressure);
+
+    // Current window size in blocks, for the merge rate query.
+    int GetBlocks();
+
+  private:
+    static constexpr int kSequentialBlocksPerRead = 8;
+    static constexpr double kHighPressure = 20.0;
+    static constexpr std::chrono::milliseconds kMergeKeepsPace = 5ms;
+
+    std::mutex lock_;
+    int group_blocks_ = 0;
+    int max_groups_ = 1;
+    int groups_ = 1;
+    bool psi_available_ = true;
+};
+
+// Latencies in power-of-two microsecond buckets. Recording is lock-free so
+// that the I/O path can record every request; readers see a consistent
+// enough view for percentiles without stopping the writers.
+class LatencyHistogram {
+  public:
+    // Bucket i holds samples below 2^i microseconds; the last bucket holds
+    // everything else (~8s and above).
+    static constexpr size_t kNumBuckets = 24;
+
+    void Record(std::chrono::nanoseconds duration);
+
+    // Add the samples of |other| to this histogram.
+    void Add(const LatencyHistogram& other);
+
+    uint64_t GetCount() const { return count_.load(std::memory_order_relaxed); }
+
+    // "count=<n> avg_us=<n> p50_us=<n> p90_us=<n> p99_us=<n> max_us=<n>".
+    // Percentiles are bucket upper bounds, at most the maximum.
+    std::string ToString() const;
+
+  private:
+    uint64_t GetPercentile(double percentile) const;
+
+    std::array<std::atomic<uint64_t>, kNumBuckets> buckets_{};
+    std::atomic<uint64_t> count_ = 0;
+    std::atomic<uint64_t> sum_us_ = 0;
+    std::atomic<uint64_t> max_us_ = 0;
+};
+
+// Performance counters kept by each Worker. They are shared with the
+// SnapshotHandler so that they can be read after the worker has exited.
+struct WorkerStats {
+    // Time to serve a dm-user request, from the header being read to the
+    // last payload being written.
+    LatencyHistogram dm_user_request;
+    // Time to read and decode the data of a replace or xor op, indexed by
+    // CowCompressionAlgorithm.
+    std::array<LatencyHistogram, kCowCompressZstd + 1> decompress;
+    // Reads of the base or source device on behalf of dm-user.
+    LatencyHistogram base_read;
+    // Time to merge and commit one batch of ops.
+    LatencyHistogram merge_batch;
+};
+
+// Records the lifetime of a scope into a LatencyHistogram.
+class ScopedLatency {
+  public:
+    explicit ScopedLatency(LatencyHistogram* histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedLatency() { histogram_->Record(std::chrono::steady_clock::now() - start_); }
+
+  private:
+    LatencyHistogram* histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
 enum class MERGE_GROUP_STATE {
     GROUP_MERGE_PENDING,
     GROUP_MERGE_RA_READY,
@@ -96,6 +261,62 @@ struct MergeGroupState {
         : merge_state_(state), num_ios_in_progress(n_ios) {}
 };
 
+// Maps a block of the snapshot device to the index of its entry in the
+// sorted chunk vector, so that the I/O path doesn't have to search for every
+// block. It is a two-level table: leaves covering kBlocksPerLeaf blocks are
+// allocated only for ranges that have COW ops. Built once before the worker
+// threads start, then only read.
+class BlockOpMap {
+  public:
+    static constexpr size_t kNotFound = std::numeric_limits<size_t>::max();
+
+    // |chunk_vec| must be sorted by sector. If a block appears more than once,
+    // the first entry wins, matching std::lower_bound.
+    void Build(const std::vector<std::pair<sector_t, const CowOperation*>>& chunk_vec) {
+        leaves_.clear();
+        if (chunk_vec.empty()) {
+            return;
+        }
+        leaves_.resize((SectorToBlock(chunk_vec.back().first) >> kLeafShift) + 1);
+        for (size_t i = 0; i < chunk_vec.size(); i++) {
+            chunk_t block = SectorToBlock(chunk_vec[i].first);
+            auto& leaf = leaves_[block >> kLeafShift];
+            if (!leaf) {
+                leaf = std::make_unique<uint32_t[]>(kBlocksPerLeaf);
+            }
+            uint32_t& entry = leaf[block & (kBlocksPerLeaf - 1)];
+            if (!entry) {
+                entry = static_cast<uint32_t>(i + 1);
+            }
+        }
+    }
+
+    // Return the chunk vector index of the op for the block starting at
+    // |sector|, or kNotFound.
+    size_t Find(sector_t sector) const {
+        if (sector & ((1 << CHUNK_SHIFT) - 1)) {
+            return kNotFound;
+        }
+        chunk_t block = SectorToBlock(sector);
+        size_t leaf_index = block >> kLeafShift;
+        if (leaf_index >= leaves_.size() || !leaves_[leaf_index]) {
+            return kNotFound;
+        }
+        uint32_t entry = leaves_[leaf_index][block & (kBlocksPerLeaf - 1)];
+        return entry ? entry - 1 : kNotFound;
+    }
+
+  private:
+    // 1024 blocks (4MiB of the device) per 4KiB leaf.
+    static constexpr int kLeafShift = 10;
+    static constexpr size_t kBlocksPerLeaf = 1 << kLeafShift;
+
+    static chunk_t SectorToBlock(sector_t sector) { return sector >> CHUNK_SHIFT; }
+
+    // Entries are chunk vector indices plus one; zero means no op.
+    std::vector<std::unique_ptr<uint32_t[]>> leaves_;
+};
+
 class ReadAhead {
   public:
     ReadAhead(const std::string& cow_device, const std::string& backing_device,
@@ -122,6 +343,10 @@ class ReadAhead {
     bool ReconstructDataFromCow();
     void CheckOverlap(const CowOperation* cow_op);
 
+    // Blocks to read ahead in the current cycle, and reads issued for them.
+    int ra_window_blocks_ = 0;
+    int num_reads_ = 0;
+
     bool ReadAheadAsyncIO();
     bool ReapIoCompletions(int pending_ios_to_complete);
     bool ReadXorData(size_t block_index, size_t xor_op_index,
@@ -161,23 +386,22 @@ class ReadAhead {
 
     uint64_t total_ra_blocks_completed_ = 0;
     bool read_ahead_async_ = false;
-    // Queue depth of 8 seems optimal. We don't want
-    // to have a huge depth as it may put more memory pressure
-    // on the kernel worker threads given that we use
-    // IOSQE_ASYNC flag - ASYNC flags can potentially
-    // result in EINTR; Since we don't restart
-    // syscalls and fallback to synchronous I/O, we
-    // don't want huge queue depth
     int queue_depth_ = 8;
+    // ra_temp_buffer_ and backing_store_fd_ are registered with ring_.
+    bool registered_io_ = false;
     std::unique_ptr<struct io_uring> ring_;
 };
 
 class UpdateVerify {
   public:
-    UpdateVerify(const std::string& misc_name);
+    UpdateVerify(const std::string& misc_name, bool use_iouring);
     void VerifyUpdatePartition();
     bool CheckPartitionVerification();
 
+    // "<partition>,<bytes_read>,<duration_ms>,<MiB/s>" once verification has
+    // finished, else empty.
+    std::string GetVerificationStats();
+
   private:
     enum class UpdateVerifyState {
         VERIFY_UNKNOWN,
@@ -186,20 +410,26 @@ class UpdateVerify {
     };
 
     std::string misc_name_;
+    bool use_iouring_;
     UpdateVerifyState state_;
     std::mutex m_lock_;
     std::condition_variable m_cv_;
+    std::string stats_;
 
     int kMinThreadsToVerify = 1;
-    int kMaxThreadsToVerify = 4;
+    int kMaxThreadsToVerify = 8;
     uint64_t kThresholdSize = 512_MiB;
     uint64_t kBlockSizeVerify = 1_MiB;
+    int kMinQueueDepth = 4;
+    int kMaxQueueDepth = 32;
 
     bool IsBlockAligned(uint64_t read_size) { return ((read_size & (BLOCK_SZ - 1)) == 0); }
     void UpdatePartitionVerificationState(UpdateVerifyState state);
     bool VerifyPartition(const std::string& partition_name, const std::string& dm_block_device);
     bool VerifyBlocks(const std::string& partition_name, const std::string& dm_block_device,
                       off_t offset, int skip_blocks, uint64_t dev_sz);
+    bool VerifyBlocksAsync(const std::string& partition_name, const std::string& dm_block_device,
+                           off_t offset, int skip_blocks, uint64_t dev_sz, int queue_depth);
 };
 
 class Worker {
@@ -210,6 +440,7 @@ class Worker {
     bool RunThread();
     bool RunMergeThread();
     bool Init();
+    std::shared_ptr<WorkerStats> GetStats() { return stats_; }
 
   private:
     // Initialization
@@ -245,11 +476,27 @@ class Worker {
     bool ProcessReplaceOp(const CowOperation* cow_op);
     bool ProcessZeroOp();
 
+    // Uncompressed replace ops whose data is laid out back to back in the COW
+    // are read with a single pread straight into the payload buffer.
+    bool IsRawReplaceOp(const CowOperation* cow_op) {
+        return cow_op->type == kCowReplaceOp &&
+               (cow_op->compression & ~kCowDedupFlag) == kCowCompressNone &&
+               cow_op->data_length == BLOCK_SZ;
+    }
+    size_t GetRawReplaceRun(sector_t sector, size_t read_size, const CowOperation* cow_op);
+    LatencyHistogram* GetDecompressHistogram(const CowOperation* cow_op);
+    bool ProcessRawReplaceOps(const CowOperation* cow_op, size_t size);
+
     // Handles Copy and Xor
     bool ProcessCopyOp(const CowOperation* cow_op);
     bool ProcessXorOp(const CowOperation* cow_op);
     bool ProcessOrderedOp(const CowOperation* cow_op);
 
+    // Xor ops whose source data is contiguous on the source device are read
+    // with a single pread, and then XOR'ed block by block.
+    size_t GetXorRun(sector_t sector, size_t read_size, const CowOperation* cow_op);
+    bool ProcessXorOps(size_t size);
+
     // Merge related ops
     bool Merge();
     bool AsyncMerge();
@@ -257,6 +504,14 @@ class Worker {
     bool MergeOrderedOps();
     bool MergeOrderedOpsAsync();
     bool MergeReplaceZeroOps();
+    // Transition the merge groups of the current read-ahead window.
+    void SetWindowMergeInProgress();
+    void SetWindowMergeCompleted();
+    void SetWindowMergeFailed();
+    bool WriteMergeData(size_t size, uint64_t offset);
+    bool ZeroMergeData(size_t size, uint64_t offset);
+    bool MergeReplaceZeroRun(const std::vector<const CowOperation*>& ops, size_t begin,
+                             size_t end, uint64_t offset);
     int PrepareMerge(uint64_t* source_offset, int* pending_ops,
                      std::vector<const CowOperation*>* replace_zero_vec = nullptr);
 
@@ -269,6 +524,8 @@ class Worker {
     std::unique_ptr<CowReader> reader_;
     BufferSink bufsink_;
     XorSink xorsink_;
+    std::vector<const CowOperation*> xor_run_;
+    std::vector<MERGE_GROUP_STATE> xor_run_states_;
 
     std::string cow_device_;
     std::string backing_store_device_;
@@ -285,19 +542,44 @@ class Worker {
     size_t ra_block_index_ = 0;
     uint64_t blocks_merged_in_group_ = 0;
     bool merge_async_ = false;
-    // Queue depth of 8 seems optimal. We don't want
-    // to have a huge depth as it may put more memory pressure
-    // on the kernel worker threads given that we use
-    // IOSQE_ASYNC flag - ASYNC flags can potentially
-    // result in EINTR; Since we don't restart
-    // syscalls and fallback to synchronous I/O, we
-    // don't want huge queue depth
+    // Cleared once the base device rejects BLKZEROOUT.
+    bool zeroout_supported_ = true;
     int queue_depth_ = 8;
+    // bufsink_ and base_path_merge_fd_ are registered with ring_.
+    bool registered_io_ = false;
     std::unique_ptr<struct io_uring> ring_;
 
+    std::shared_ptr<WorkerStats> stats_ = std::make_shared<WorkerStats>();
     std::shared_ptr<SnapshotHandler> snapuserd_;
 };
 
+// The daemon's cap on the buffer memory of all handlers. Each new handler
+// reserves its share up front, scaled down to fit what is left, and releases
+// it when it goes away.
+class MemoryBudget {
+  public:
+    // Cap of |bytes|, 0 for no cap.
+    void SetLimit(uint64_t bytes);
+    uint64_t GetLimit();
+    uint64_t GetReserved();
+
+    // Scale |num_workers| and the read-ahead window down until the handler's
+    // buffers fit what is left of the budget, and reserve them. |ra_window|
+    // is set to the window limit, or 0 for the default window. Returns the
+    // bytes reserved, to be passed to Release(); 0 if there is no cap.
+    uint64_t Reserve(int* num_workers, size_t* ra_window);
+    void Release(uint64_t bytes);
+
+    // Buffer memory of a handler with |num_workers| workers and a read-ahead
+    // window of |ra_window| bytes.
+    static uint64_t GetHandlerMemory(int num_workers, size_t ra_window);
+
+  private:
+    std::mutex lock_;
+    uint64_t limit_ = 0;
+    uint64_t reserved_ = 0;
+};
+
 class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
   public:
     SnapshotHandler(std::string misc_name, std::string cow_device, std::string backing_device,
@@ -306,6 +588,14 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     bool InitCowDevice();
     bool Start();
 
+    // Load the ops from an op index handed over by a previous instance of the
+    // daemon, rather than parsing the COW. Must be called before
+    // InitCowDevice().
+    void SetOpIndexFd(unique_fd&& fd) { op_index_fd_ = std::move(fd); }
+    // The memfd holding the op index the ops were loaded from, or -1 if the
+    // COW carries its own index.
+    int GetOpIndexFd() const { return op_index_fd_.get(); }
+
     const std::string& GetControlDevicePath() { return control_device_; }
     const std::string& GetMiscName() { return misc_name_; }
     const uint64_t& GetNumSectors() { return num_sectors_; }
@@ -327,6 +617,7 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     std::shared_ptr<SnapshotHandler> GetSharedPtr() { return shared_from_this(); }
 
     std::vector<std::pair<sector_t, const CowOperation*>>& GetChunkVec() { return chunk_vec_; }
+    const BlockOpMap& GetBlockOpMap() const { return block_op_map_; }
 
     static bool compare(std::pair<sector_t, const CowOperation*> p1,
                         std::pair<sector_t, const CowOperation*> p2) {
@@ -366,10 +657,23 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     size_t GetBufferMetadataSize();
     size_t GetBufferDataOffset();
     size_t GetBufferDataSize();
+    // Bytes of the scratch data region filled per read-ahead cycle. Equal to
+    // GetBufferDataSize() unless limited by SetReadAheadWindowLimit().
+    size_t GetReadAheadDataSize() { return ra_data_size_; }
+    // Limit the read-ahead window to |bytes|, 0 for no limit. Must be called
+    // before InitCowDevice(). Ignored if read-ahead data from a previous boot
+    // has to be recovered, as that was laid out with the full window.
+    void SetReadAheadWindowLimit(size_t bytes) { ra_window_limit_ = bytes; }
 
     // Total number of blocks to be merged in a given read-ahead buffer region
     void SetMergedBlockCountForNextCommit(int x) { total_ra_blocks_merged_ = x; }
     int GetTotalBlocksToMerge() { return total_ra_blocks_merged_; }
+    // Number of merge groups covered by the blocks above.
+    void SetMergeGroupCountForNextCommit(int x) { total_ra_groups_merged_ = x; }
+    int GetTotalGroupsToMerge() { return total_ra_groups_merged_; }
+    int GetMergeGroupBlocks() { return ra_group_blocks_; }
+    size_t GetNumMergeGroups() { return merge_blk_state_.size(); }
+    ReadAheadWindow& GetReadAheadWindow() { return ra_window_; }
     bool MergeInitiated() { return merge_initiated_; }
     bool MergeMonitored() { return merge_monitored_; }
     double GetMergePercentage() { return merge_completion_percentage_; }
@@ -383,14 +687,23 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     MERGE_GROUP_STATE ProcessMergingBlock(uint64_t new_block, void* buffer);
 
     bool IsIouringSupported();
+    void SetIoUringOptions(const IoUringOptions& options) { io_uring_options_ = options; }
+    const IoUringOptions& GetIoUringOptions() const { return io_uring_options_; }
+    MergeRateController& GetMergeRateController() { return merge_rate_; }
     bool CheckPartitionVerification() { return update_verify_->CheckPartitionVerification(); }
+    std::string GetVerificationStats() { return update_verify_->GetVerificationStats(); }
+
+    // Latency histograms of all the workers of this handler, one per line.
+    std::string GetStats();
 
   private:
+    bool ParseCow();
     bool ReadMetadata();
     sector_t ChunkToSector(chunk_t chunk) { return chunk << CHUNK_SHIFT; }
     chunk_t SectorToChunk(sector_t sector) { return sector >> CHUNK_SHIFT; }
     bool IsBlockAligned(uint64_t read_size) { return ((read_size & (BLOCK_SZ - 1)) == 0); }
     struct BufferState* GetBufferState();
+    int GetRecoveredReadAheadBlocks();
     void UpdateMergeCompletionPercentage();
 
     // COW device
@@ -404,6 +717,7 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     std::string base_path_merge_;
 
     unique_fd cow_fd_;
+    unique_fd op_index_fd_;
 
     uint64_t num_sectors_;
 
@@ -412,6 +726,8 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     // chunk_vec stores the pseudo mapping of sector
     // to COW operations.
     std::vector<std::pair<sector_t, const CowOperation*>> chunk_vec_;
+    // Index over chunk_vec_ for the aligned read path.
+    BlockOpMap block_op_map_;
 
     std::mutex lock_;
     std::condition_variable cv;
@@ -424,6 +740,11 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     bool populate_data_from_cow_ = false;
     bool ra_thread_ = false;
     int total_ra_blocks_merged_ = 0;
+    int total_ra_groups_merged_ = 0;
+    int ra_group_blocks_ = 0;
+    ReadAheadWindow ra_window_;
+    size_t ra_window_limit_ = 0;
+    size_t ra_data_size_ = 0;
     MERGE_IO_TRANSITION io_state_;
     std::unique_ptr<ReadAhead> read_ahead_thread_;
     std::unordered_map<uint64_t, void*> read_ahead_buffer_map_;
@@ -444,6 +765,11 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     bool scratch_space_ = false;
     int num_worker_threads_ = kNumWorkerThreads;
     bool perform_verification_ = true;
+    IoUringOptions io_uring_options_;
+    MergeRateController merge_rate_;
+
+    std::mutex stats_lock_;
+    std::vector<std::shared_ptr<WorkerStats>> worker_stats_;
 
     std::unique_ptr<struct io_uring> ring_;
     std::unique_ptr<UpdateVerify> update_verify_;
@@ -76,6 +76,7 @@ bool Worker::InitReader() {
 // internal COW format and if the block is compressed,
 // it will be de-compressed.
 bool Worker::ProcessReplaceOp(const CowOperation* cow_op) {
+    ScopedLatency latency(GetDecompressHistogram(cow_op));
     if (!reader_->ReadData(*cow_op, &bufsink_)) {
         SNAP_LOG(ERROR) << "ProcessReplaceOp failed for block " << cow_op->new_block;
         return false;
@@ -84,6 +85,62 @@ bool Worker::ProcessReplaceOp(const CowOperation* cow_op) {
     return true;
 }
 
+// Return the number of bytes, starting at |sector|, that are served by
+// uncompressed replace ops stored contiguously in the COW after |cow_op|.
+size_t Worker::GetRawReplaceRun(sector_t sector, size_t read_size, const CowOperation* cow_op) {
+    std::vector<std::pair<sector_t, const CowOperation*>>& chunk_vec = snapuserd_->GetChunkVec();
+    const BlockOpMap& block_op_map = snapuserd_->GetBlockOpMap();
+
+    size_t run_size = BLOCK_SZ;
+    while (run_size + BLOCK_SZ <= read_size) {
+        size_t index = block_op_map.Find(sector + (run_size >> SECTOR_SHIFT));
+        if (index == BlockOpMap::kNotFound) {
+            break;
+        }
+        const CowOperation* next_op = chunk_vec[index].second;
+        if (!IsRawReplaceOp(next_op) || next_op->source != cow_op->source + run_size) {
+            break;
+        }
+        run_size += BLOCK_SZ;
+    }
+    return run_size;
+}
+
+// Read |size| bytes of uncompressed replace data, starting at the data of
+// |cow_op|, directly into the payload buffer. This bypasses the decompressor
+// and the sink, and replaces one read per block with a single read.
+bool Worker::ProcessRawReplaceOps(const CowOperation* cow_op, size_t size) {
+    ScopedLatency latency(&stats_->decompress[kCowCompressNone]);
+    uint8_t* buffer = reinterpret_cast<uint8_t*>(bufsink_.GetPayloadBuffer(size));
+    if (buffer == nullptr) {
+        SNAP_LOG(ERROR) << "ProcessRawReplaceOps: Failed to get payload buffer";
+        return false;
+    }
+
+    size_t offset = 0;
+    while (offset < size) {
+        size_t bytes_read = 0;
+        if (!reader_->GetRawBytes(cow_op->source + offset, buffer + offset, size - offset,
+                                  &bytes_read)) {
+            SNAP_LOG(ERROR) << "ProcessRawReplaceOps failed for block " << cow_op->new_block
+                            << " size: " << size;
+            return false;
+        }
+        if (bytes_read == 0) {
+            SNAP_LOG(ERROR) << "ProcessRawReplaceOps: unexpected end of COW at block "
+                            << cow_op->new_block;
+            return false;
+        }
+        offset += bytes_read;
+    }
+    return true;
+}
+
+LatencyHistogram* Worker::GetDecompressHistogram(const CowOperation* cow_op) {
+    size_t algorithm = cow_op->compression & ~(kCowCompressionUnitFlag | kCowDedupFlag);
+    return &stats_->decompress[std::min(algorithm, stats_->decompress.size() - 1)];
+}
+
 bool Worker::ReadFromSourceDevice(const CowOperation* cow_op) {
     void* buffer = bufsink_.GetPayloadBuffer(BLOCK_SZ);
     if (buffer == nullptr) {
@@ -92,6 +149,7 @@ bool Worker::ReadFromSourceDevice(const CowOperation* cow_op) {
     }
     SNAP_LOG(DEBUG) << " ReadFromBaseDevice...: new-block: " << cow_op->new_block
                     << " Source: " << cow_op->source;
+    ScopedLatency latency(&stats_->base_read);
     uint64_t offset = cow_op->source;
     if (cow_op->type == kCowCopyOp) {
         offset *= BLOCK_SZ;
@@ -126,6 +184,7 @@ bool Worker::ProcessXorOp(const CowOperation* cow_op) {
         return false;
     }
     xorsink_.Reset();
+    ScopedLatency latency(GetDecompressHistogram(cow_op));
     if (!reader_->ReadData(*cow_op, &xorsink_)) {
         SNAP_LOG(ERROR) << "ProcessXorOp failed for block " << cow_op->new_block;
         return false;
@@ -134,6 +193,117 @@ bool Worker::ProcessXorOp(const CowOperation* cow_op) {
     return true;
 }
 
+// Collect the xor ops, starting at |sector|, whose source data follows that
+// of |cow_op| on the source device. Returns the number of bytes they serve.
+size_t Worker::GetXorRun(sector_t sector, size_t read_size, const CowOperation* cow_op) {
+    std::vector<std::pair<sector_t, const CowOperation*>>& chunk_vec = snapuserd_->GetChunkVec();
+    const BlockOpMap& block_op_map = snapuserd_->GetBlockOpMap();
+
+    xor_run_.clear();
+    xor_run_.emplace_back(cow_op);
+    size_t run_size = BLOCK_SZ;
+    while (run_size + BLOCK_SZ <= read_size) {
+        size_t index = block_op_map.Find(sector + (run_size >> SECTOR_SHIFT));
+        if (index == BlockOpMap::kNotFound) {
+            break;
+        }
+        const CowOperation* next_op = chunk_vec[index].second;
+        if (next_op->type != kCowXorOp || next_op->source != cow_op->source + run_size) {
+            break;
+        }
+        xor_run_.emplace_back(next_op);
+        run_size += BLOCK_SZ;
+    }
+    return run_size;
+}
+
+// Process the ops collected by GetXorRun(). Blocks of groups that are still
+// pending merge get their source data in one read per contiguous stretch;
+// the others are served as ProcessOrderedOp() would.
+bool Worker::ProcessXorOps(size_t size) {
+    uint8_t* buffer = reinterpret_cast<uint8_t*>(bufsink_.GetPayloadBuffer(size));
+    if (buffer == nullptr) {
+        SNAP_LOG(ERROR) << "ProcessXorOps: Failed to get payload buffer";
+        return false;
+    }
+
+    const size_t num_ops = xor_run_.size();
+    xor_run_states_.resize(num_ops);
+    for (size_t i = 0; i < num_ops; i++) {
+        xor_run_states_[i] =
+                snapuserd_->ProcessMergingBlock(xor_run_[i]->new_block, buffer + i * BLOCK_SZ);
+    }
+
+    bool ok = true;
+    size_t i = 0;
+    while (ok && i < num_ops) {
+        const CowOperation* cow_op = xor_run_[i];
+        switch (xor_run_states_[i]) {
+            case MERGE_GROUP_STATE::GROUP_MERGE_PENDING: {
+                size_t end = i + 1;
+                while (end < num_ops &&
+                       xor_run_states_[end] == MERGE_GROUP_STATE::GROUP_MERGE_PENDING) {
+                    end++;
+                }
+                {
+                    ScopedLatency latency(&stats_->base_read);
+                    if (!android::base::ReadFullyAtOffset(backing_store_fd_, buffer + i * BLOCK_SZ,
+                                                          (end - i) * BLOCK_SZ, cow_op->source)) {
+                        SNAP_PLOG(ERROR) << "Xor-op failed. Read from backing store: "
+                                         << backing_store_device_ << " at offset "
+                                         << cow_op->source << " size: " << (end - i) * BLOCK_SZ;
+                        ok = false;
+                        break;
+                    }
+                }
+                for (; ok && i < end; i++) {
+                    xorsink_.Reset(i * BLOCK_SZ);
+                    ScopedLatency latency(GetDecompressHistogram(xor_run_[i]));
+                    if (!reader_->ReadData(*xor_run_[i], &xorsink_)) {
+                        SNAP_LOG(ERROR) << "ProcessXorOps failed for block "
+                                        << xor_run_[i]->new_block;
+                        ok = false;
+                    }
+                }
+                continue;
+            }
+            case MERGE_GROUP_STATE::GROUP_MERGE_COMPLETED: {
+                // Merge is completed for this COW op; just read directly from
+                // the base device
+                ScopedLatency latency(&stats_->base_read);
+                loff_t offset = ChunkToSector(cow_op->new_block) << SECTOR_SHIFT;
+                if (!android::base::ReadFullyAtOffset(base_path_merge_fd_, buffer + i * BLOCK_SZ,
+                                                      BLOCK_SZ, offset)) {
+                    SNAP_PLOG(ERROR) << "ReadDataFromBaseDevice failed. fd: "
+                                     << base_path_merge_fd_ << " at block: " << cow_op->new_block
+                                     << " after merge-complete.";
+                    ok = false;
+                }
+                break;
+            }
+            // The data was copied from the RA buffer.
+            case MERGE_GROUP_STATE::GROUP_MERGE_RA_READY:
+                [[fallthrough]];
+            case MERGE_GROUP_STATE::GROUP_MERGE_IN_PROGRESS:
+                break;
+            default:
+                // All other states, fail the I/O viz (GROUP_MERGE_FAILED and GROUP_INVALID)
+                ok = false;
+                break;
+        }
+        i++;
+    }
+
+    // I/O is complete - decrement the refcounts irrespective of the return
+    // status
+    for (size_t j = 0; j < num_ops; j++) {
+        if (xor_run_states_[j] == MERGE_GROUP_STATE::GROUP_MERGE_PENDING) {
+            snapuserd_->NotifyIOCompletion(xor_run_[j]->new_block);
+        }
+    }
+    return ok;
+}
+
 bool Worker::ProcessZeroOp() {
     // Zero out the entire block
     void* buffer = bufsink_.GetPayloadBuffer(BLOCK_SZ);
@@ -312,6 +482,7 @@ bool Worker::ReadDataFromBaseDevice(sector_t sector, size_t read_size) {
         return false;
     }
 
+    ScopedLatency latency(&stats_->base_read);
     loff_t offset = sector << SECTOR_SHIFT;
     if (!android::base::ReadFullyAtOffset(base_path_merge_fd_, buffer, read_size, offset)) {
         SNAP_PLOG(ERROR) << "ReadDataFromBaseDevice failed. fd: " << base_path_merge_fd_
@@ -326,6 +497,7 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
     struct dm_user_header* header = bufsink_.GetHeaderPtr();
     size_t remaining_size = sz;
     std::vector<std::pair<sector_t, const CowOperation*>>& chunk_vec = snapuserd_->GetChunkVec();
+    const BlockOpMap& block_op_map = snapuserd_->GetBlockOpMap();
     bool io_error = false;
     int ret = 0;
 
@@ -343,11 +515,9 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
             // present in the mapping.
             size_t size = std::min(BLOCK_SZ, read_size);
 
-            auto it = std::lower_bound(chunk_vec.begin(), chunk_vec.end(),
-                                       std::make_pair(sector, nullptr), SnapshotHandler::compare);
-            bool not_found = (it == chunk_vec.end() || it->first != sector);
+            size_t index = block_op_map.Find(sector);
 
-            if (not_found) {
+            if (index == BlockOpMap::kNotFound) {
                 // Block not found in map - which means this block was not
                 // changed as per the OTA. Just route the I/O to the base
                 // device.
@@ -360,12 +530,25 @@ bool Worker::ReadAlignedSector(sector_t sector, size_t sz, bool header_response)
             } else {
                 // We found the sector in mapping. Check the type of COW OP and
                 // process it.
-                if (!ProcessCowOp(it->second)) {
-                    SNAP_LOG(ERROR) << "ProcessCowOp failed";
-                    header->type = DM_USER_RESP_ERROR;
+                const CowOperation* cow_op = chunk_vec[index].second;
+                if (IsRawReplaceOp(cow_op)) {
+                    ret = GetRawReplaceRun(sector, read_size, cow_op);
+                    if (!ProcessRawReplaceOps(cow_op, ret)) {
+                        header->type = DM_USER_RESP_ERROR;
+                    }
+                } else if (cow_op->type == kCowXorOp) {
+                    ret = GetXorRun(sector, read_size, cow_op);
+                    if (!ProcessXorOps(ret)) {
+                        header->type = DM_USER_RESP_ERROR;
+                    }
+                } else {
+                    if (!ProcessCowOp(cow_op)) {
+                        SNAP_LOG(ERROR) << "ProcessCowOp failed";
+                        header->type = DM_USER_RESP_ERROR;
+                    }
+
+                    ret = BLOCK_SZ;
                 }
-
-                ret = BLOCK_SZ;
             }
 
             // Just return the header if it is an error
@@ -628,6 +811,7 @@ bool Worker::ProcessIORequest() {
 
     switch (header->type) {
         case DM_USER_REQ_MAP_READ: {
+            ScopedLatency latency(&stats_->dm_user_request);
             if (!DmuserReadRequest()) {
                 return false;
             }
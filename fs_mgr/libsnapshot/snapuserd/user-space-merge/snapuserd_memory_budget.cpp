@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "snapuserd_core.h"
+
+#include <algorithm>
+
+namespace android {
+namespace snapshot {
+
+void MemoryBudget::SetLimit(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(lock_);
+    limit_ = bytes;
+}
+
+uint64_t MemoryBudget::GetLimit() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return limit_;
+}
+
+uint64_t MemoryBudget::GetReserved() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return reserved_;
+}
+
+// One payload buffer for each worker and for the merge thread, plus the
+// read-ahead window in both the scratch mapping and the read-ahead thread's
+// own buffer.
+uint64_t MemoryBudget::GetHandlerMemory(int num_workers, size_t ra_window) {
+    return (num_workers + 1) * (sizeof(struct dm_user_header) + PAYLOAD_BUFFER_SZ) +
+           2 * ra_window;
+}
+
+uint64_t MemoryBudget::Reserve(int* num_workers, size_t* ra_window) {
+    static constexpr size_t kMinReadAheadWindow = 64_KiB;
+
+    *ra_window = 0;
+
+    // The budget is checked and reserved in one go, so that handlers added
+    // concurrently cannot both count the same memory as available.
+    std::lock_guard<std::mutex> lock(lock_);
+    if (!limit_) {
+        return 0;
+    }
+    uint64_t available = limit_ > reserved_ ? limit_ - reserved_ : 0;
+
+    // Give up worker threads first, as they only add parallelism, then
+    // shrink the read-ahead window, which slows down the merge.
+    size_t window = BUFFER_REGION_DEFAULT_SIZE;
+    while (*num_workers > 1 && GetHandlerMemory(*num_workers, window) > available) {
+        *num_workers -= 1;
+    }
+    while (window > kMinReadAheadWindow && GetHandlerMemory(*num_workers, window) > available) {
+        window /= 2;
+    }
+
+    uint64_t cost = GetHandlerMemory(*num_workers, window);
+    if (cost > available) {
+        LOG(WARNING) << "Memory budget exceeded: " << cost << " bytes needed, " << available
+                     << " available";
+    }
+    reserved_ += cost;
+    *ra_window = window < BUFFER_REGION_DEFAULT_SIZE ? window : 0;
+    LOG(INFO) << "Memory budget: " << *num_workers << " workers, read-ahead window " << window
+              << " bytes";
+    return cost;
+}
+
+void MemoryBudget::Release(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(lock_);
+    reserved_ -= std::min(reserved_, bytes);
+}
+
+}  // namespace snapshot
+}  // namespace android
@@ -16,6 +16,14 @@
 
 #include "snapuserd_core.h"
 
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+
+#include <android-base/parsedouble.h>
+#include <android-base/strings.h>
+
 namespace android {
 namespace snapshot {
 
@@ -23,6 +31,88 @@ using namespace android;
 using namespace android::dm;
 using android::base::unique_fd;
 
+void MergeRateController::Initialize(int max_batch_blocks) {
+    std::lock_guard<std::mutex> lock(lock_);
+    max_batch_blocks_ = max_batch_blocks;
+    batch_blocks_ = max_batch_blocks;
+    sleep_ms_ = 0;
+    last_sample_ = {};
+}
+
+bool ReadPressureAvg10(const char* path, double* avg10) {
+    std::string content;
+    if (!android::base::ReadFileToString(path, &content)) {
+        return false;
+    }
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    for (const auto& line : android::base::Split(content, "\n")) {
+        if (!android::base::StartsWith(line, "some ")) {
+            continue;
+        }
+        for (const auto& field : android::base::Split(line, " ")) {
+            if (android::base::StartsWith(field, "avg10=")) {
+                return android::base::ParseDouble(field.substr(6), avg10);
+            }
+        }
+    }
+    return false;
+}
+
+bool MergeRateController::ReadIoPressure(double* avg10) {
+    return ReadPressureAvg10("/proc/pressure/io", avg10);
+}
+
+void MergeRateController::Update() {
+    auto now = std::chrono::steady_clock::now();
+    if (!psi_available_ || now - last_sample_ < kSampleInterval) {
+        return;
+    }
+    last_sample_ = now;
+
+    double pressure;
+    if (!ReadIoPressure(&pressure)) {
+        LOG(INFO) << "I/O pressure not available, merge will not be throttled";
+        psi_available_ = false;
+        batch_blocks_ = max_batch_blocks_;
+        sleep_ms_ = 0;
+        return;
+    }
+    io_pressure_ = pressure;
+
+    // Scale linearly from full speed at kLowPressure down to the smallest
+    // batches and longest sleeps at kHighPressure.
+    double scale = (pressure - kLowPressure) / (kHighPressure - kLowPressure);
+    scale = std::clamp(scale, 0.0, 1.0);
+    int min_batch_blocks = std::max(1, max_batch_blocks_ / kMinBatchDivisor);
+    batch_blocks_ =
+            max_batch_blocks_ - static_cast<int>(scale * (max_batch_blocks_ - min_batch_blocks));
+    sleep_ms_ = static_cast<int>(scale * kMaxSleepMs);
+}
+
+int MergeRateController::GetBatchBlocks() {
+    std::lock_guard<std::mutex> lock(lock_);
+    Update();
+    return batch_blocks_;
+}
+
+void MergeRateController::Throttle() {
+    int sleep_ms;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        Update();
+        sleep_ms = sleep_ms_;
+    }
+    if (sleep_ms) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
+    }
+}
+
+std::string MergeRateController::GetStatus() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return std::to_string(batch_blocks_) + "," + std::to_string(sleep_ms_) + "," +
+           android::base::StringPrintf("%.2f", io_pressure_);
+}
+
 int Worker::PrepareMerge(uint64_t* source_offset, int* pending_ops,
                          std::vector<const CowOperation*>* replace_zero_vec) {
     int num_ops = *pending_ops;
@@ -70,26 +160,122 @@ int Worker::PrepareMerge(uint64_t* source_offset, int* pending_ops,
     return nr_consecutive;
 }
 
+// Write |size| bytes of the payload buffer to the base device at |offset|.
+bool Worker::WriteMergeData(size_t size, uint64_t offset) {
+    void* buffer = bufsink_.GetPayloadBufPtr();
+    if (!merge_async_) {
+        ssize_t ret = TEMP_FAILURE_RETRY(pwrite(base_path_merge_fd_.get(), buffer, size, offset));
+        return ret == static_cast<ssize_t>(size);
+    }
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+    if (!sqe) {
+        SNAP_LOG(ERROR) << "io_uring_get_sqe failed during merge";
+        return false;
+    }
+    if (registered_io_) {
+        // Index 0 of both the registered files and buffers.
+        io_uring_prep_write_fixed(sqe, 0, buffer, size, offset, 0);
+        sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+        io_uring_prep_write(sqe, base_path_merge_fd_.get(), buffer, size, offset);
+    }
+
+    int ret = io_uring_submit(ring_.get());
+    if (ret != 1) {
+        SNAP_LOG(ERROR) << "Merge: io_uring_submit failed: " << ret;
+        return false;
+    }
+    struct io_uring_cqe* cqe;
+    ret = io_uring_wait_cqe(ring_.get(), &cqe);
+    if (ret) {
+        SNAP_LOG(ERROR) << "Merge: io_uring_wait_cqe failed: " << ret;
+        return false;
+    }
+    int res = cqe->res;
+    io_uring_cqe_seen(ring_.get(), cqe);
+    return res == static_cast<int>(size);
+}
+
+// Zero |size| bytes of the base device at |offset| without transferring any
+// data. Returns false if the device can't, and the zeroes must be written.
+bool Worker::ZeroMergeData(size_t size, uint64_t offset) {
+    if (!zeroout_supported_) {
+        return false;
+    }
+    uint64_t range[2] = {offset, size};
+    if (ioctl(base_path_merge_fd_.get(), BLKZEROOUT, &range) < 0) {
+        // Anything else is retried as a write, which reports real I/O errors.
+        if (errno == ENOTTY || errno == EOPNOTSUPP || errno == EINVAL) {
+            SNAP_LOG(INFO) << "BLKZEROOUT not supported by " << base_path_merge_
+                           << ", writing zero blocks";
+            zeroout_supported_ = false;
+        } else {
+            SNAP_PLOG(ERROR) << "BLKZEROOUT failed at offset: " << offset << " size: " << size;
+        }
+        return false;
+    }
+    return true;
+}
+
+// Merge ops [begin, end) of |ops|, which target consecutive blocks starting
+// at |offset| and are either all replace or all zero ops, with one I/O.
+bool Worker::MergeReplaceZeroRun(const std::vector<const CowOperation*>& ops, size_t begin,
+                                 size_t end, uint64_t offset) {
+    const size_t io_size = (end - begin) * BLOCK_SZ;
+    if (ops[begin]->type == kCowZeroOp && ZeroMergeData(io_size, offset)) {
+        return true;
+    }
+
+    bufsink_.ResetBufferOffset();
+    for (size_t i = begin; i < end; i++) {
+        const CowOperation* cow_op = ops[i];
+        if (cow_op->type == kCowReplaceOp) {
+            if (!ProcessReplaceOp(cow_op)) {
+                SNAP_LOG(ERROR) << "Merge - ReplaceOp failed for block: " << cow_op->new_block;
+                return false;
+            }
+        } else {
+            CHECK(cow_op->type == kCowZeroOp);
+            if (!ProcessZeroOp()) {
+                SNAP_LOG(ERROR) << "Merge ZeroOp failed.";
+                return false;
+            }
+        }
+
+        bufsink_.UpdateBufferOffset(BLOCK_SZ);
+    }
+
+    // Merge - Write the contents back to base device
+    if (!WriteMergeData(io_size, offset)) {
+        SNAP_LOG(ERROR) << "Merge: ReplaceZeroOps: Failed to write to backing device while merging "
+                        << " at offset: " << offset << " io_size: " << io_size;
+        return false;
+    }
+    return true;
+}
+
 bool Worker::MergeReplaceZeroOps() {
-    // Flush after merging 2MB. Since all ops are independent and there is no
-    // dependency between COW ops, we will flush the data and the number
-    // of ops merged in COW block device. If there is a crash, we will
-    // end up replaying some of the COW ops which were already merged. That is
-    // ok.
-    //
-    // Although increasing this greater than 2MB may help in improving merge
-    // times; however, on devices with low memory, this can be problematic
-    // when there are multiple merge threads in parallel.
-    int total_ops_merged_per_commit = (PAYLOAD_BUFFER_SZ / BLOCK_SZ) * 2;
+    // Since all ops are independent and there is no dependency between COW
+    // ops, we will flush the data and the number of ops merged in COW block
+    // device after every batch. If there is a crash, we will end up
+    // replaying some of the COW ops which were already merged. That is ok.
+    auto& merge_rate = snapuserd_->GetMergeRateController();
+    merge_rate.Initialize(snapuserd_->GetIoUringOptions().merge_batch_blocks);
+    int total_ops_merged_per_commit = merge_rate.GetBatchBlocks();
     int num_ops_merged = 0;
+    auto batch_start = std::chrono::steady_clock::now();
 
     SNAP_LOG(INFO) << "MergeReplaceZeroOps started....";
 
+    const int merge_io_blocks = snapuserd_->GetIoUringOptions().merge_io_blocks;
+    std::vector<const CowOperation*> replace_zero_vec;
+
     while (!cowop_iter_->Done()) {
-        int num_ops = PAYLOAD_BUFFER_SZ / BLOCK_SZ;
-        std::vector<const CowOperation*> replace_zero_vec;
+        int num_ops = merge_io_blocks;
         uint64_t source_offset;
 
+        replace_zero_vec.clear();
         int linear_blocks = PrepareMerge(&source_offset, &num_ops, &replace_zero_vec);
         if (linear_blocks == 0) {
             // Merge complete
@@ -97,34 +283,21 @@ bool Worker::MergeReplaceZeroOps() {
             break;
         }
 
-        for (size_t i = 0; i < replace_zero_vec.size(); i++) {
-            const CowOperation* cow_op = replace_zero_vec[i];
-            if (cow_op->type == kCowReplaceOp) {
-                if (!ProcessReplaceOp(cow_op)) {
-                    SNAP_LOG(ERROR) << "Merge - ReplaceOp failed for block: " << cow_op->new_block;
-                    return false;
-                }
-            } else {
-                CHECK(cow_op->type == kCowZeroOp);
-                if (!ProcessZeroOp()) {
-                    SNAP_LOG(ERROR) << "Merge ZeroOp failed.";
-                    return false;
-                }
+        // Split the consecutive blocks into stretches of replace and of zero
+        // ops. Zero stretches are discarded on the device instead of written.
+        size_t begin = 0;
+        while (begin < replace_zero_vec.size()) {
+            const bool zero = replace_zero_vec[begin]->type == kCowZeroOp;
+            size_t end = begin + 1;
+            while (end < replace_zero_vec.size() &&
+                   (replace_zero_vec[end]->type == kCowZeroOp) == zero) {
+                end++;
             }
-
-            bufsink_.UpdateBufferOffset(BLOCK_SZ);
-        }
-
-        size_t io_size = linear_blocks * BLOCK_SZ;
-
-        // Merge - Write the contents back to base device
-        int ret = TEMP_FAILURE_RETRY(pwrite(base_path_merge_fd_.get(), bufsink_.GetPayloadBufPtr(),
-                                            io_size, source_offset));
-        if (ret < 0 || ret != io_size) {
-            SNAP_LOG(ERROR)
-                    << "Merge: ReplaceZeroOps: Failed to write to backing device while merging "
-                    << " at offset: " << source_offset << " io_size: " << io_size;
-            return false;
+            if (!MergeReplaceZeroRun(replace_zero_vec, begin, end,
+                                     source_offset + begin * BLOCK_SZ)) {
+                return false;
+            }
+            begin = end;
         }
 
         num_ops_merged += linear_blocks;
@@ -143,6 +316,12 @@ bool Worker::MergeReplaceZeroOps() {
             }
 
             num_ops_merged = 0;
+            stats_->merge_batch.Record(std::chrono::steady_clock::now() - batch_start);
+
+            // Back off while foreground I/O is under pressure.
+            merge_rate.Throttle();
+            total_ops_merged_per_commit = merge_rate.GetBatchBlocks();
+            batch_start = std::chrono::steady_clock::now();
         }
 
         bufsink_.ResetBufferOffset();
@@ -168,11 +347,36 @@ bool Worker::MergeReplaceZeroOps() {
         }
 
         num_ops_merged = 0;
+        stats_->merge_batch.Record(std::chrono::steady_clock::now() - batch_start);
     }
 
     return true;
 }
 
+void Worker::SetWindowMergeInProgress() {
+    size_t end = std::min(ra_block_index_ + snapuserd_->GetTotalGroupsToMerge(),
+                          snapuserd_->GetNumMergeGroups());
+    for (size_t i = ra_block_index_; i < end; i++) {
+        snapuserd_->SetMergeInProgress(i);
+    }
+}
+
+void Worker::SetWindowMergeCompleted() {
+    size_t end = std::min(ra_block_index_ + snapuserd_->GetTotalGroupsToMerge(),
+                          snapuserd_->GetNumMergeGroups());
+    for (size_t i = ra_block_index_; i < end; i++) {
+        snapuserd_->SetMergeCompleted(i);
+    }
+}
+
+void Worker::SetWindowMergeFailed() {
+    size_t end = std::min(ra_block_index_ + snapuserd_->GetTotalGroupsToMerge(),
+                          snapuserd_->GetNumMergeGroups());
+    for (size_t i = ra_block_index_; i < end; i++) {
+        snapuserd_->SetMergeFailed(i);
+    }
+}
+
 bool Worker::MergeOrderedOpsAsync() {
     void* mapped_addr = snapuserd_->GetMappedAddr();
     void* read_ahead_buffer =
@@ -193,7 +397,8 @@ bool Worker::MergeOrderedOpsAsync() {
             return false;
         }
 
-        snapuserd_->SetMergeInProgress(ra_block_index_);
+        SetWindowMergeInProgress();
+        auto batch_start = std::chrono::steady_clock::now();
 
         loff_t offset = 0;
         int num_ops = snapuserd_->GetTotalBlocksToMerge();
@@ -207,7 +412,8 @@ bool Worker::MergeOrderedOpsAsync() {
         while (num_ops) {
             uint64_t source_offset;
 
-            int linear_blocks = PrepareMerge(&source_offset, &num_ops);
+            int max_blocks = std::min(num_ops, snapuserd_->GetIoUringOptions().merge_io_blocks);
+            int linear_blocks = PrepareMerge(&source_offset, &max_blocks);
 
             if (linear_blocks != 0) {
                 size_t io_size = (linear_blocks * BLOCK_SZ);
@@ -341,14 +547,19 @@ bool Worker::MergeOrderedOpsAsync() {
         SNAP_LOG(DEBUG) << "Block commit of size: " << snapuserd_->GetTotalBlocksToMerge();
 
         // Mark the block as merge complete
-        snapuserd_->SetMergeCompleted(ra_block_index_);
+        SetWindowMergeCompleted();
+        stats_->merge_batch.Record(std::chrono::steady_clock::now() - batch_start);
+
+        // The RA thread sets the size of the next window once notified, so
+        // read the size of this one first.
+        int window_groups = snapuserd_->GetTotalGroupsToMerge();
 
         // Notify RA thread that the merge thread is ready to merge the next
         // window
         snapuserd_->NotifyRAForMergeReady();
 
-        // Get the next block
-        ra_block_index_ += 1;
+        // Get the next window
+        ra_block_index_ += window_groups;
     }
 
     return true;
@@ -371,11 +582,12 @@ bool Worker::MergeOrderedOps() {
         // Wait for RA thread to notify that the merge window
         // is ready for merging.
         if (!snapuserd_->WaitForMergeBegin()) {
-            snapuserd_->SetMergeFailed(ra_block_index_);
+            SetWindowMergeFailed();
             return false;
         }
 
-        snapuserd_->SetMergeInProgress(ra_block_index_);
+        SetWindowMergeInProgress();
+        auto batch_start = std::chrono::steady_clock::now();
 
         loff_t offset = 0;
         int num_ops = snapuserd_->GetTotalBlocksToMerge();
@@ -383,7 +595,8 @@ bool Worker::MergeOrderedOps() {
         while (num_ops) {
             uint64_t source_offset;
 
-            int linear_blocks = PrepareMerge(&source_offset, &num_ops);
+            int max_blocks = std::min(num_ops, snapuserd_->GetIoUringOptions().merge_io_blocks);
+            int linear_blocks = PrepareMerge(&source_offset, &max_blocks);
             if (linear_blocks == 0) {
                 break;
             }
@@ -398,7 +611,7 @@ bool Worker::MergeOrderedOps() {
             if (ret < 0 || ret != io_size) {
                 SNAP_LOG(ERROR) << "Failed to write to backing device while merging "
                                 << " at offset: " << source_offset << " io_size: " << io_size;
-                snapuserd_->SetMergeFailed(ra_block_index_);
+                SetWindowMergeFailed();
                 return false;
             }
 
@@ -412,7 +625,7 @@ bool Worker::MergeOrderedOps() {
         // Flush the data
         if (fsync(base_path_merge_fd_.get()) < 0) {
             SNAP_LOG(ERROR) << " Failed to fsync merged data";
-            snapuserd_->SetMergeFailed(ra_block_index_);
+            SetWindowMergeFailed();
             return false;
         }
 
@@ -420,20 +633,25 @@ bool Worker::MergeOrderedOps() {
         // the merge completion
         if (!snapuserd_->CommitMerge(snapuserd_->GetTotalBlocksToMerge())) {
             SNAP_LOG(ERROR) << " Failed to commit the merged block in the header";
-            snapuserd_->SetMergeFailed(ra_block_index_);
+            SetWindowMergeFailed();
             return false;
         }
 
         SNAP_LOG(DEBUG) << "Block commit of size: " << snapuserd_->GetTotalBlocksToMerge();
         // Mark the block as merge complete
-        snapuserd_->SetMergeCompleted(ra_block_index_);
+        SetWindowMergeCompleted();
+        stats_->merge_batch.Record(std::chrono::steady_clock::now() - batch_start);
+
+        // The RA thread sets the size of the next window once notified, so
+        // read the size of this one first.
+        int window_groups = snapuserd_->GetTotalGroupsToMerge();
 
         // Notify RA thread that the merge thread is ready to merge the next
         // window
         snapuserd_->NotifyRAForMergeReady();
 
-        // Get the next block
-        ra_block_index_ += 1;
+        // Get the next window
+        ra_block_index_ += window_groups;
     }
 
     return true;
@@ -516,6 +734,8 @@ bool Worker::InitializeIouring() {
         return false;
     }
 
+    const auto& options = snapuserd_->GetIoUringOptions();
+    queue_depth_ = options.queue_depth;
     ring_ = std::make_unique<struct io_uring>();
 
     int ret = io_uring_queue_init(queue_depth_, ring_.get(), 0);
@@ -526,13 +746,34 @@ bool Worker::InitializeIouring() {
 
     merge_async_ = true;
 
-    LOG(INFO) << "Merge: io_uring initialized with queue depth: " << queue_depth_;
+    // Pin the replace/zero op payload buffer and the base device, so the
+    // kernel doesn't map them for every write. This is best effort.
+    if (options.register_buffers) {
+        struct iovec iov = {bufsink_.GetBufPtr(), bufsink_.GetBufferSize()};
+        int fd = base_path_merge_fd_.get();
+        ret = io_uring_register_buffers(ring_.get(), &iov, 1);
+        if (!ret) {
+            ret = io_uring_register_files(ring_.get(), &fd, 1);
+            if (ret) {
+                io_uring_unregister_buffers(ring_.get());
+            }
+        }
+        if (ret) {
+            SNAP_LOG(ERROR) << "Merge: io_uring registration failed with ret: " << ret;
+        } else {
+            registered_io_ = true;
+        }
+    }
+
+    LOG(INFO) << "Merge: io_uring initialized with queue depth: " << queue_depth_
+              << " registered: " << registered_io_;
     return true;
 }
 
 void Worker::FinalizeIouring() {
     if (merge_async_) {
         io_uring_queue_exit(ring_.get());
+        registered_io_ = false;
     }
 }
 
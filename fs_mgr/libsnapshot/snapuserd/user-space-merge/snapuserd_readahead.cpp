@@ -23,6 +23,50 @@ using namespace android;
 using namespace android::dm;
 using android::base::unique_fd;
 
+void ReadAheadWindow::Initialize(int group_blocks, int max_groups) {
+    std::lock_guard<std::mutex> lock(lock_);
+    group_blocks_ = group_blocks;
+    max_groups_ = std::max(max_groups, 1);
+    // Start small; sequential sources quickly grow the window.
+    groups_ = std::max(max_groups_ / 4, 1);
+}
+
+int ReadAheadWindow::GetGroups() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return groups_;
+}
+
+int ReadAheadWindow::GetBlocks() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return groups_ * group_blocks_;
+}
+
+void ReadAheadWindow::Update(int blocks, int reads, std::chrono::nanoseconds merge_wait) {
+    double io_pressure = 0, memory_pressure = 0;
+    if (psi_available_ && (!ReadPressureAvg10("/proc/pressure/io", &io_pressure) ||
+                           !ReadPressureAvg10("/proc/pressure/memory", &memory_pressure))) {
+        psi_available_ = false;
+        io_pressure = memory_pressure = 0;
+    }
+    Update(blocks, reads, merge_wait, io_pressure, memory_pressure);
+}
+
+void ReadAheadWindow::Update(int blocks, int reads, std::chrono::nanoseconds merge_wait,
+                             double io_pressure, double memory_pressure) {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (io_pressure >= kHighPressure || memory_pressure >= kHighPressure) {
+        groups_ = std::max(groups_ / 2, 1);
+        return;
+    }
+
+    // A short wait means the merge had already finished the previous window,
+    // so read-ahead is what holds the merge back.
+    bool sequential = reads > 0 && blocks / reads >= kSequentialBlocksPerRead;
+    if (sequential && merge_wait < kMergeKeepsPace) {
+        groups_ = std::min(groups_ * 2, max_groups_);
+    }
+}
+
 ReadAhead::ReadAhead(const std::string& cow_device, const std::string& backing_device,
                      const std::string& misc_name, std::shared_ptr<SnapshotHandler> snapuserd) {
     cow_device_ = cow_device;
@@ -75,6 +119,7 @@ int ReadAhead::PrepareNextReadAhead(uint64_t* source_offset, int* pending_ops,
     RAIterNext();
     num_ops -= 1;
     nr_consecutive = 1;
+    num_reads_ += 1;
     blocks.push_back(cow_op->new_block);
 
     if (!overlap_) {
@@ -170,6 +215,9 @@ bool ReadAhead::ReconstructDataFromCow() {
     }
 
     snapuserd_->SetMergedBlockCountForNextCommit(total_blocks_merged);
+    // The recovered window is a single merge group; see
+    // SnapshotHandler::ReadMetadata().
+    snapuserd_->SetMergeGroupCountForNextCommit(1);
 
     snapuserd_->FinishReconstructDataFromCow();
 
@@ -244,9 +292,10 @@ bool ReadAhead::ReconstructDataFromCow() {
  */
 
 bool ReadAhead::ReadAheadAsyncIO() {
-    int num_ops = (snapuserd_->GetBufferDataSize()) / BLOCK_SZ;
+    int num_ops = ra_window_blocks_;
     loff_t buffer_offset = 0;
     total_blocks_merged_ = 0;
+    num_reads_ = 0;
     overlap_ = false;
     dest_blocks_.clear();
     source_blocks_.clear();
@@ -263,9 +312,8 @@ bool ReadAhead::ReadAheadAsyncIO() {
 
     bufsink_.ResetBufferOffset();
 
-    // Number of ops to be merged in this window. This is a fixed size
-    // except for the last window wherein the number of ops can be less
-    // than the size of the RA window.
+    // Number of ops to be merged in this window, as sized by
+    // ReadAheadWindow. The last window can have fewer ops.
     while (num_ops) {
         uint64_t source_offset;
         struct io_uring_sqe* sqe;
@@ -282,9 +330,14 @@ bool ReadAhead::ReadAheadAsyncIO() {
                 return false;
             }
 
-            io_uring_prep_read(sqe, backing_store_fd_.get(),
-                               (char*)ra_temp_buffer_.get() + buffer_offset, io_size,
-                               source_offset);
+            char* buffer = (char*)ra_temp_buffer_.get() + buffer_offset;
+            if (registered_io_) {
+                // Index 0 of both the registered files and buffers.
+                io_uring_prep_read_fixed(sqe, 0, buffer, io_size, source_offset, 0);
+                sqe->flags |= IOSQE_FIXED_FILE;
+            } else {
+                io_uring_prep_read(sqe, backing_store_fd_.get(), buffer, io_size, source_offset);
+            }
 
             buffer_offset += io_size;
             num_ops -= linear_blocks;
@@ -440,9 +493,7 @@ void ReadAhead::ProcessXorData(size_t& block_xor_index, size_t& xor_index,
                 uint8_t* xor_data = reinterpret_cast<uint8_t*>((char*)bufsink_.GetPayloadBufPtr() +
                                                                xor_buf_offset);
 
-                for (size_t byte_offset = 0; byte_offset < BLOCK_SZ; byte_offset++) {
-                    buffer[byte_offset] ^= xor_data[byte_offset];
-                }
+                XorBuffers(buffer, xor_data, BLOCK_SZ);
 
                 // Move to next XOR op
                 xor_index += 1;
@@ -483,9 +534,10 @@ bool ReadAhead::ReadXorData(size_t block_index, size_t xor_op_index,
 }
 
 bool ReadAhead::ReadAheadSyncIO() {
-    int num_ops = (snapuserd_->GetBufferDataSize()) / BLOCK_SZ;
+    int num_ops = ra_window_blocks_;
     loff_t buffer_offset = 0;
     total_blocks_merged_ = 0;
+    num_reads_ = 0;
     overlap_ = false;
     dest_blocks_.clear();
     source_blocks_.clear();
@@ -494,9 +546,8 @@ bool ReadAhead::ReadAheadSyncIO() {
 
     bufsink_.ResetBufferOffset();
 
-    // Number of ops to be merged in this window. This is a fixed size
-    // except for the last window wherein the number of ops can be less
-    // than the size of the RA window.
+    // Number of ops to be merged in this window, as sized by
+    // ReadAheadWindow. The last window can have fewer ops.
     while (num_ops) {
         uint64_t source_offset;
 
@@ -572,9 +623,7 @@ bool ReadAhead::ReadAheadSyncIO() {
                 uint8_t* xor_data = reinterpret_cast<uint8_t*>(bufsink.GetPayloadBufPtr());
 
                 // Retrieve the original data
-                for (size_t byte_offset = 0; byte_offset < BLOCK_SZ; byte_offset++) {
-                    buffer[byte_offset] ^= xor_data[byte_offset];
-                }
+                XorBuffers(buffer, xor_data, BLOCK_SZ);
 
                 // Move to next XOR op
                 xor_index += 1;
@@ -615,6 +664,9 @@ bool ReadAhead::ReadAheadIOStart() {
         return ReconstructDataFromCow();
     }
 
+    auto& window = snapuserd_->GetReadAheadWindow();
+    ra_window_blocks_ = window.GetGroups() * snapuserd_->GetMergeGroupBlocks();
+
     bool retry = false;
     bool ra_status;
 
@@ -651,9 +703,11 @@ bool ReadAhead::ReadAheadIOStart() {
     // be touching the scratch space until merge is complete of previous RA
     // window. If there is a crash during this time frame, merge should resume
     // based on the contents of the scratch space.
+    auto wait_start = std::chrono::steady_clock::now();
     if (!snapuserd_->WaitForMergeReady()) {
         return false;
     }
+    auto merge_wait = std::chrono::steady_clock::now() - wait_start;
 
     // Copy the data to scratch space
     memcpy(metadata_buffer_, ra_temp_meta_buffer_.get(), snapuserd_->GetBufferMetadataSize());
@@ -673,6 +727,9 @@ bool ReadAhead::ReadAheadIOStart() {
 
     total_ra_blocks_completed_ += total_blocks_merged_;
     snapuserd_->SetMergedBlockCountForNextCommit(total_blocks_merged_);
+    int group_blocks = snapuserd_->GetMergeGroupBlocks();
+    snapuserd_->SetMergeGroupCountForNextCommit((total_blocks_merged_ + group_blocks - 1) /
+                                                group_blocks);
 
     // Flush the data only if we have a overlapping blocks in the region
     // Notify the Merge thread to resume merging this window
@@ -682,6 +739,7 @@ bool ReadAhead::ReadAheadIOStart() {
         return false;
     }
 
+    window.Update(total_blocks_merged_, num_reads_, merge_wait);
     return true;
 }
 
@@ -690,6 +748,8 @@ bool ReadAhead::InitializeIouring() {
         return false;
     }
 
+    const auto& options = snapuserd_->GetIoUringOptions();
+    queue_depth_ = options.queue_depth;
     ring_ = std::make_unique<struct io_uring>();
 
     int ret = io_uring_queue_init(queue_depth_, ring_.get(), 0);
@@ -702,13 +762,33 @@ bool ReadAhead::InitializeIouring() {
     bufsink_.Initialize(PAYLOAD_BUFFER_SZ * 2);
     read_ahead_async_ = true;
 
-    SNAP_LOG(INFO) << "Read-ahead: io_uring initialized with queue depth: " << queue_depth_;
+    // Pin the read-ahead buffer and the source device. This is best effort.
+    if (options.register_buffers) {
+        struct iovec iov = {ra_temp_buffer_.get(), snapuserd_->GetReadAheadDataSize()};
+        int fd = backing_store_fd_.get();
+        ret = io_uring_register_buffers(ring_.get(), &iov, 1);
+        if (!ret) {
+            ret = io_uring_register_files(ring_.get(), &fd, 1);
+            if (ret) {
+                io_uring_unregister_buffers(ring_.get());
+            }
+        }
+        if (ret) {
+            SNAP_LOG(ERROR) << "Read-ahead: io_uring registration failed with ret: " << ret;
+        } else {
+            registered_io_ = true;
+        }
+    }
+
+    SNAP_LOG(INFO) << "Read-ahead: io_uring initialized with queue depth: " << queue_depth_
+                   << " registered: " << registered_io_;
     return true;
 }
 
 void ReadAhead::FinalizeIouring() {
     if (read_ahead_async_) {
         io_uring_queue_exit(ring_.get());
+        registered_io_ = false;
     }
 }
 
@@ -812,7 +892,7 @@ void ReadAhead::InitializeBuffer() {
             static_cast<void*>((char*)mapped_addr + snapuserd_->GetBufferMetadataOffset());
     read_ahead_buffer_ = static_cast<void*>((char*)mapped_addr + snapuserd_->GetBufferDataOffset());
 
-    ra_temp_buffer_ = std::make_unique<uint8_t[]>(snapuserd_->GetBufferDataSize());
+    ra_temp_buffer_ = std::make_unique<uint8_t[]>(snapuserd_->GetReadAheadDataSize());
     ra_temp_meta_buffer_ = std::make_unique<uint8_t[]>(snapuserd_->GetBufferMetadataSize());
 }
 
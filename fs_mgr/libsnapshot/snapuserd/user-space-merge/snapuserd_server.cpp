@@ -17,6 +17,7 @@
 #include <arpa/inet.h>
 #include <cutils/sockets.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <netinet/in.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -27,6 +28,7 @@
 
 #include <android-base/cmsg.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/scopeguard.h>
 #include <android-base/strings.h>
@@ -57,6 +59,11 @@ DaemonOps UserSnapshotServer::Resolveop(std::string& input) {
     if (input == "merge_percent") return DaemonOps::PERCENTAGE;
     if (input == "getstatus") return DaemonOps::GETSTATUS;
     if (input == "update-verify") return DaemonOps::UPDATE_VERIFY;
+    if (input == "io_uring_options") return DaemonOps::IO_URING_OPTIONS;
+    if (input == "getmergerate") return DaemonOps::GET_MERGE_RATE;
+    if (input == "verify-stats") return DaemonOps::VERIFY_STATS;
+    if (input == "getstats") return DaemonOps::GET_STATS;
+    if (input == "export_op_index") return DaemonOps::EXPORT_OP_INDEX;
 
     return DaemonOps::INVALID;
 }
@@ -76,7 +83,7 @@ UserSnapshotServer::~UserSnapshotServer() {
     }
 }
 
-std::string UserSnapshotServer::GetDaemonStatus() {
+std::string UserSnapshotServer::GetDaemonStatus(bool with_memory) {
     std::string msg = "";
 
     if (IsTerminating())
@@ -84,6 +91,23 @@ std::string UserSnapshotServer::GetDaemonStatus() {
     else
         msg = "active";
 
+    if (with_memory) {
+        uint64_t rss_kb = 0;
+        std::string status;
+        if (android::base::ReadFileToString("/proc/self/status", &status)) {
+            for (const auto& line : android::base::Split(status, "\n")) {
+                if (android::base::StartsWith(line, "VmRSS:")) {
+                    sscanf(line.c_str(), "VmRSS: %" SCNu64, &rss_kb);
+                    break;
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(lock_);
+        msg += ",rss_kb=" + std::to_string(rss_kb) +
+               ",budget_kb=" + std::to_string(memory_budget_.GetLimit() / 1024) +
+               ",reserved_kb=" + std::to_string(memory_budget_.GetReserved() / 1024);
+    }
+
     return msg;
 }
 
@@ -181,6 +205,53 @@ bool UserSnapshotServer::Receivemsg(android::base::borrowed_fd fd, const std::st
             }
             return Sendmsg(fd, "success");
         }
+        case DaemonOps::IO_URING_OPTIONS: {
+            // Message format:
+            // io_uring_options,<misc_name>,<queue_depth>,<merge_batch_blocks>,<register_buffers>
+            //                 [,<merge_io_blocks>]
+            //
+            // Tune io_uring for the merge and read-ahead threads. Must be
+            // sent between init and start. A merge_io_blocks of 0 keeps the
+            // default.
+            if (out.size() != 5 && out.size() != 6) {
+                LOG(ERROR) << "Malformed io_uring_options message, " << out.size() << " parts";
+                return Sendmsg(fd, "fail");
+            }
+
+            IoUringOptions options;
+            int register_buffers;
+            if (!android::base::ParseInt(out[2], &options.queue_depth, 1, 4096) ||
+                !android::base::ParseInt(out[3], &options.merge_batch_blocks, 1) ||
+                !android::base::ParseInt(out[4], &register_buffers, 0, 1)) {
+                LOG(ERROR) << "Invalid io_uring options: " << str;
+                return Sendmsg(fd, "fail");
+            }
+            options.register_buffers = register_buffers;
+            if (out.size() == 6) {
+                int merge_io_blocks;
+                if (!android::base::ParseInt(out[5], &merge_io_blocks, 0,
+                                             static_cast<int>(PAYLOAD_BUFFER_SZ / BLOCK_SZ))) {
+                    LOG(ERROR) << "Invalid io_uring options: " << str;
+                    return Sendmsg(fd, "fail");
+                }
+                if (merge_io_blocks) {
+                    options.merge_io_blocks = merge_io_blocks;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(lock_);
+            auto iter = FindHandler(&lock, out[1]);
+            if (iter == dm_users_.end()) {
+                LOG(ERROR) << "Could not find handler: " << out[1];
+                return Sendmsg(fd, "fail");
+            }
+            if (!(*iter)->snapuserd() || (*iter)->snapuserd()->IsAttached()) {
+                LOG(ERROR) << "io_uring options must be set before start: " << out[1];
+                return Sendmsg(fd, "fail");
+            }
+            (*iter)->snapuserd()->SetIoUringOptions(options);
+            return Sendmsg(fd, "success");
+        }
         case DaemonOps::STOP: {
             // Message format: stop
             //
@@ -191,7 +262,10 @@ bool UserSnapshotServer::Receivemsg(android::base::borrowed_fd fd, const std::st
             return true;
         }
         case DaemonOps::QUERY: {
-            // Message format: query
+            // Message format: query[,memory]
+            //
+            // With "memory", the reply is followed by
+            // ",rss_kb=<n>,budget_kb=<n>,reserved_kb=<n>".
             //
             // As part of transition, Second stage daemon will be
             // created before terminating the first stage daemon. Hence,
@@ -200,7 +274,7 @@ bool UserSnapshotServer::Receivemsg(android::base::borrowed_fd fd, const std::st
             //
             // Second stage daemon is marked as active and hence will
             // be ready to receive control message.
-            return Sendmsg(fd, GetDaemonStatus());
+            return Sendmsg(fd, GetDaemonStatus(out.size() == 2 && out[1] == "memory"));
         }
         case DaemonOps::DELETE: {
             // Message format:
@@ -292,6 +366,29 @@ bool UserSnapshotServer::Receivemsg(android::base::borrowed_fd fd, const std::st
                 return Sendmsg(fd, merge_status);
             }
         }
+        case DaemonOps::GET_MERGE_RATE: {
+            // Message format:
+            // getmergerate,<misc_name>
+            //
+            // Reply: "<status>,<batch_blocks>,<sleep_ms>,<io_pressure>,<ra_window_blocks>",
+            // where
+            // status is the same as for getstatus. It is kept separate
+            // from getstatus, whose replies are compared as whole strings.
+            if (out.size() != 2) {
+                LOG(ERROR) << "Malformed getmergerate message, " << out.size() << " parts";
+                return Sendmsg(fd, "fail");
+            }
+            std::lock_guard<std::mutex> lock(lock_);
+            auto iter = FindHandler(&lock, out[1]);
+            if (iter == dm_users_.end() || !(*iter)->snapuserd()) {
+                LOG(ERROR) << "Could not find handler: " << out[1];
+                return Sendmsg(fd, "fail");
+            }
+            auto& snapuserd = (*iter)->snapuserd();
+            return Sendmsg(fd, snapuserd->GetMergeStatus() + "," +
+                                       snapuserd->GetMergeRateController().GetStatus() + "," +
+                                       std::to_string(snapuserd->GetReadAheadWindow().GetBlocks()));
+        }
         case DaemonOps::UPDATE_VERIFY: {
             std::lock_guard<std::mutex> lock(lock_);
             if (!UpdateVerification(&lock)) {
@@ -300,6 +397,69 @@ bool UserSnapshotServer::Receivemsg(android::base::borrowed_fd fd, const std::st
 
             return Sendmsg(fd, "success");
         }
+        case DaemonOps::VERIFY_STATS: {
+            // Message format: verify-stats
+            //
+            // Reply: "<partition>,<bytes_read>,<duration_ms>,<MiB/s>" for each
+            // partition that has finished verification, separated by ';', or
+            // "none".
+            std::lock_guard<std::mutex> lock(lock_);
+            std::vector<std::string> stats;
+            for (const auto& handler : dm_users_) {
+                if (!handler->snapuserd()) {
+                    continue;
+                }
+                auto partition_stats = handler->snapuserd()->GetVerificationStats();
+                if (!partition_stats.empty()) {
+                    stats.emplace_back(std::move(partition_stats));
+                }
+            }
+            // An empty reply would leave the client waiting in recv().
+            return Sendmsg(fd, stats.empty() ? "none" : android::base::Join(stats, ";"));
+        }
+        case DaemonOps::GET_STATS: {
+            // Message format: getstats
+            //
+            // Reply: "<length>,<histograms>", with the latency histograms
+            // of every handler, one per line. The length keeps the reply from
+            // being empty, and lets the client read it in several parts.
+            std::lock_guard<std::mutex> lock(lock_);
+            std::string stats;
+            for (const auto& handler : dm_users_) {
+                if (handler->snapuserd()) {
+                    stats += handler->snapuserd()->GetStats();
+                }
+            }
+            if (stats.size() > kMaxStatsSize) {
+                LOG(WARNING) << "Truncating " << stats.size() << " bytes of stats";
+                stats.resize(stats.rfind('\n', kMaxStatsSize - 1) + 1);
+            }
+            return Sendmsg(fd, std::to_string(stats.size()) + "," + stats);
+        }
+        case DaemonOps::EXPORT_OP_INDEX: {
+            // Message format: export_op_index
+            //
+            // Reply: "success,<misc_name>,<misc_name>..." with the op index
+            // memfd of each of those handlers attached, in the same order.
+            // Handlers whose COW carries its own op index are skipped.
+            std::lock_guard<std::mutex> lock(lock_);
+            std::string reply = "success";
+            std::vector<int> fds;
+            for (const auto& handler : dm_users_) {
+                if (handler->snapuserd() && handler->snapuserd()->GetOpIndexFd() >= 0) {
+                    reply += "," + handler->misc_name();
+                    fds.emplace_back(handler->snapuserd()->GetOpIndexFd());
+                }
+            }
+            if (fds.empty()) {
+                return Sendmsg(fd, reply);
+            }
+            if (android::base::SendFileDescriptorVector(fd, reply.data(), reply.size(), fds) < 0) {
+                PLOG(ERROR) << "Failed to send op indexes";
+                return false;
+            }
+            return true;
+        }
         default: {
             LOG(ERROR) << "Received unknown message type from client";
             Sendmsg(fd, "fail");
@@ -354,6 +514,7 @@ void UserSnapshotServer::RunThread(std::shared_ptr<HandlerThread> handler) {
         // WaitForDelete() is called, the handler is either in the list, or
         // it's not and its resources are guaranteed to be freed.
         handler->FreeResources();
+        ReleaseMemory(&lock, handler);
         dm_users_.erase(iter);
     }
 }
@@ -487,7 +648,8 @@ void UserSnapshotServer::Interrupt() {
 std::shared_ptr<HandlerThread> UserSnapshotServer::AddHandler(const std::string& misc_name,
                                                               const std::string& cow_device_path,
                                                               const std::string& backing_device,
-                                                              const std::string& base_path_merge) {
+                                                              const std::string& base_path_merge,
+                                                              unique_fd op_index_fd) {
     // We will need multiple worker threads only during
     // device boot after OTA. For all other purposes,
     // one thread is sufficient. We don't want to consume
@@ -501,6 +663,9 @@ std::shared_ptr<HandlerThread> UserSnapshotServer::AddHandler(const std::string&
         num_worker_threads = 1;
     }
 
+    size_t ra_window = 0;
+    uint64_t memory_cost = memory_budget_.Reserve(&num_worker_threads, &ra_window);
+
     bool perform_verification = true;
     if (android::base::EndsWith(misc_name, "-init") || is_socket_present_) {
         perform_verification = false;
@@ -509,13 +674,17 @@ std::shared_ptr<HandlerThread> UserSnapshotServer::AddHandler(const std::string&
     auto snapuserd = std::make_shared<SnapshotHandler>(misc_name, cow_device_path, backing_device,
                                                        base_path_merge, num_worker_threads,
                                                        io_uring_enabled_, perform_verification);
+    snapuserd->SetOpIndexFd(std::move(op_index_fd));
+    snapuserd->SetReadAheadWindowLimit(ra_window);
     if (!snapuserd->InitCowDevice()) {
         LOG(ERROR) << "Failed to initialize Snapuserd";
+        memory_budget_.Release(memory_cost);
         return nullptr;
     }
 
     if (!snapuserd->InitializeWorkers()) {
         LOG(ERROR) << "Failed to initialize workers";
+        memory_budget_.Release(memory_cost);
         return nullptr;
     }
 
@@ -524,13 +693,22 @@ std::shared_ptr<HandlerThread> UserSnapshotServer::AddHandler(const std::string&
         std::lock_guard<std::mutex> lock(lock_);
         if (FindHandler(&lock, misc_name) != dm_users_.end()) {
             LOG(ERROR) << "Handler already exists: " << misc_name;
+            memory_budget_.Release(memory_cost);
             return nullptr;
         }
+        handler->set_memory_reserved(memory_cost);
         dm_users_.push_back(handler);
     }
     return handler;
 }
 
+void UserSnapshotServer::ReleaseMemory(std::lock_guard<std::mutex>* proof_of_lock,
+                                       const std::shared_ptr<HandlerThread>& handler) {
+    CHECK(proof_of_lock);
+    memory_budget_.Release(handler->memory_reserved());
+    handler->set_memory_reserved(0);
+}
+
 bool UserSnapshotServer::StartHandler(const std::shared_ptr<HandlerThread>& handler) {
     if (handler->snapuserd()->IsAttached()) {
         LOG(ERROR) << "Handler already attached";
@@ -631,6 +809,7 @@ bool UserSnapshotServer::RemoveAndJoinHandler(const std::string& misc_name) {
             return true;
         }
         handler = std::move(*iter);
+        ReleaseMemory(&lock, handler);
         dm_users_.erase(iter);
     }
 
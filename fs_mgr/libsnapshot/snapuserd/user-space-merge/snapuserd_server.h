@@ -51,6 +51,11 @@ enum class DaemonOps {
     PERCENTAGE,
     GETSTATUS,
     UPDATE_VERIFY,
+    IO_URING_OPTIONS,
+    GET_MERGE_RATE,
+    VERIFY_STATS,
+    GET_STATS,
+    EXPORT_OP_INDEX,
     INVALID,
 };
 
@@ -71,6 +76,9 @@ class HandlerThread {
     std::thread& thread() { return thread_; }
 
     const std::string& misc_name() const { return misc_name_; }
+    // Share of the daemon memory budget held by this handler.
+    uint64_t memory_reserved() const { return memory_reserved_; }
+    void set_memory_reserved(uint64_t bytes) { memory_reserved_ = bytes; }
     bool ThreadTerminated() { return thread_terminated_; }
     void SetThreadTerminated() { thread_terminated_ = true; }
 
@@ -78,6 +86,7 @@ class HandlerThread {
     std::thread thread_;
     std::shared_ptr<SnapshotHandler> snapuserd_;
     std::string misc_name_;
+    uint64_t memory_reserved_ = 0;
     bool thread_terminated_ = false;
 };
 
@@ -93,6 +102,8 @@ class UserSnapshotServer {
     bool stop_monitor_merge_thread_ = false;
     bool is_server_running_ = false;
     bool io_uring_enabled_ = false;
+    // Memory budget for the buffers of all handlers.
+    MemoryBudget memory_budget_;
     std::optional<bool> is_merge_monitor_started_;
 
     android::base::unique_fd monitor_merge_event_fd_;
@@ -113,7 +124,7 @@ class UserSnapshotServer {
     void ShutdownThreads();
     bool RemoveAndJoinHandler(const std::string& control_device);
     DaemonOps Resolveop(std::string& input);
-    std::string GetDaemonStatus();
+    std::string GetDaemonStatus(bool with_memory = false);
     void Parsemsg(std::string const& msg, const char delim, std::vector<std::string>& out);
 
     bool IsTerminating() { return terminating_; }
@@ -130,6 +141,8 @@ class UserSnapshotServer {
 
     double GetMergePercentage(std::lock_guard<std::mutex>* proof_of_lock);
     void TerminateMergeThreads(std::lock_guard<std::mutex>* proof_of_lock);
+    void ReleaseMemory(std::lock_guard<std::mutex>* proof_of_lock,
+                       const std::shared_ptr<HandlerThread>& handler);
 
     bool UpdateVerification(std::lock_guard<std::mutex>* proof_of_lock);
 
@@ -146,7 +159,8 @@ class UserSnapshotServer {
     std::shared_ptr<HandlerThread> AddHandler(const std::string& misc_name,
                                               const std::string& cow_device_path,
                                               const std::string& backing_device,
-                                              const std::string& base_path_merge);
+                                              const std::string& base_path_merge,
+                                              android::base::unique_fd op_index_fd = {});
     bool StartHandler(const std::shared_ptr<HandlerThread>& handler);
     bool StartMerge(std::lock_guard<std::mutex>* proof_of_lock,
                     const std::shared_ptr<HandlerThread>& handler);
@@ -159,6 +173,9 @@ class UserSnapshotServer {
     bool IsServerRunning() { return is_server_running_; }
     void SetIouringEnabled() { io_uring_enabled_ = true; }
     bool IsIouringEnabled() { return io_uring_enabled_; }
+    // Cap the buffer memory of all handlers. Worker counts and read-ahead
+    // windows of new handlers are scaled down to fit. 0 for no cap.
+    void SetMemoryBudget(uint64_t bytes) { memory_budget_.SetLimit(bytes); }
 };
 
 }  // namespace snapshot
@@ -109,6 +109,7 @@ class SnapuserdTest : public ::testing::Test {
     bool Merge();
     void ValidateMerge();
     void ReadSnapshotDeviceAndValidate();
+    void ReadXorRunsAndValidate();
     void Shutdown();
     void MergeInterrupt();
     void MergeInterruptFixed(int duration);
@@ -296,6 +297,31 @@ void SnapuserdTest::ReadSnapshotDeviceAndValidate() {
     ASSERT_EQ(memcmp(snapuserd_buffer.get(), (char*)orig_buffer_.get() + (size_ * 4), size_), 0);
 }
 
+// Read parts of the XOR region with O_DIRECT, so that each read reaches the
+// daemon as a multi-block request and the XOR ops in it are served as one
+// run. The ranges start in the REPLACE region before it, in the middle of
+// it, and end at the end of the device.
+void SnapuserdTest::ReadXorRunsAndValidate() {
+    unique_fd fd(open(dmuser_dev_->path().c_str(), O_RDONLY | O_DIRECT));
+    ASSERT_GE(fd, 0);
+
+    void* buffer;
+    ASSERT_EQ(posix_memalign(&buffer, BLOCK_SZ, 64 * BLOCK_SZ), 0);
+    std::unique_ptr<void, decltype(&free)> buffer_guard(buffer, free);
+
+    loff_t xor_start = size_ * 4;
+    const std::pair<loff_t, size_t> ranges[] = {
+            {xor_start - 3 * BLOCK_SZ, 11 * BLOCK_SZ},
+            {xor_start + 5 * BLOCK_SZ, 33 * BLOCK_SZ},
+            {xor_start + size_ - 64 * BLOCK_SZ, 64 * BLOCK_SZ},
+    };
+    for (const auto& [offset, size] : ranges) {
+        ASSERT_EQ(ReadFullyAtOffset(fd, buffer, size, offset), true) << "offset: " << offset;
+        ASSERT_EQ(memcmp(buffer, (char*)orig_buffer_.get() + offset, size), 0)
+                << "offset: " << offset << " size: " << size;
+    }
+}
+
 void SnapuserdTest::CreateCowDeviceWithCopyOverlap_2() {
     std::string path = android::base::GetExecutableDirectory();
     cow_system_ = std::make_unique<TemporaryFile>(path);
@@ -774,6 +800,20 @@ TEST_F(SnapuserdTest, Snapshot_IO_TEST) {
     Shutdown();
 }
 
+TEST_F(SnapuserdTest, Snapshot_XOR_Run_IO_TEST) {
+    ASSERT_TRUE(SetupDefault());
+    // Every block of a run is still pending merge
+    ReadXorRunsAndValidate();
+    // Runs mix blocks of merged and pending groups
+    StartMerge();
+    std::async(std::launch::async, &SnapuserdTest::ReadXorRunsAndValidate, this);
+    CheckMergeCompletion();
+    ValidateMerge();
+    // Every block of a run is read from the base device
+    ReadXorRunsAndValidate();
+    Shutdown();
+}
+
 TEST_F(SnapuserdTest, Snapshot_MERGE_IO_TEST) {
     ASSERT_TRUE(SetupDefault());
     // Issue I/O before merge begins
@@ -851,6 +891,195 @@ TEST_F(SnapuserdTest, Snapshot_Merge_Crash_Random_Inverted) {
     Shutdown();
 }
 
+TEST(BlockOpMapTest, Lookup) {
+    CowOperation ops[4] = {};
+    std::vector<std::pair<sector_t, const CowOperation*>> chunk_vec = {
+            {0, &ops[0]},
+            {5 << CHUNK_SHIFT, &ops[1]},
+            {5 << CHUNK_SHIFT, &ops[2]},
+            {5000 << CHUNK_SHIFT, &ops[3]},
+    };
+
+    BlockOpMap map;
+    ASSERT_EQ(map.Find(0), BlockOpMap::kNotFound);
+    map.Build(chunk_vec);
+
+    ASSERT_EQ(map.Find(0), 0);
+    // Duplicates resolve to the first entry, as with std::lower_bound.
+    ASSERT_EQ(map.Find(5 << CHUNK_SHIFT), 1);
+    ASSERT_EQ(map.Find(5000 << CHUNK_SHIFT), 3);
+    // Unaligned sectors, unmapped blocks, and blocks past the end.
+    ASSERT_EQ(map.Find((5 << CHUNK_SHIFT) + 1), BlockOpMap::kNotFound);
+    ASSERT_EQ(map.Find(6 << CHUNK_SHIFT), BlockOpMap::kNotFound);
+    ASSERT_EQ(map.Find(3000 << CHUNK_SHIFT), BlockOpMap::kNotFound);
+    ASSERT_EQ(map.Find(9000000ULL << CHUNK_SHIFT), BlockOpMap::kNotFound);
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+    LatencyHistogram histogram;
+    ASSERT_EQ(histogram.ToString(), "count=0 avg_us=0 p50_us=0 p90_us=0 p99_us=0 max_us=0");
+
+    for (int i = 0; i < 90; i++) {
+        histogram.Record(std::chrono::microseconds(100));
+    }
+    for (int i = 0; i < 10; i++) {
+        histogram.Record(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(histogram.GetCount(), 100);
+    ASSERT_EQ(histogram.ToString(),
+              "count=100 avg_us=1090 p50_us=128 p90_us=10000 p99_us=10000 max_us=10000");
+
+    LatencyHistogram total;
+    total.Add(histogram);
+    total.Record(std::chrono::seconds(60));
+    ASSERT_EQ(total.GetCount(), 101);
+    ASSERT_EQ(total.ToString(),
+              "count=101 avg_us=595138 p50_us=128 p90_us=16384 p99_us=16384 max_us=60000000");
+}
+
+TEST(MemoryBudgetTest, Unlimited) {
+    MemoryBudget budget;
+    int num_workers = 4;
+    size_t ra_window = 123;
+    ASSERT_EQ(budget.Reserve(&num_workers, &ra_window), 0);
+    ASSERT_EQ(num_workers, 4);
+    ASSERT_EQ(ra_window, 0);
+    ASSERT_EQ(budget.GetReserved(), 0);
+}
+
+TEST(MemoryBudgetTest, ScalesDownAndReleases) {
+    uint64_t full = MemoryBudget::GetHandlerMemory(4, BUFFER_REGION_DEFAULT_SIZE);
+    MemoryBudget budget;
+    budget.SetLimit(full + MemoryBudget::GetHandlerMemory(2, BUFFER_REGION_DEFAULT_SIZE));
+
+    int num_workers = 4;
+    size_t ra_window;
+    uint64_t first = budget.Reserve(&num_workers, &ra_window);
+    ASSERT_EQ(first, full);
+    ASSERT_EQ(num_workers, 4);
+    ASSERT_EQ(ra_window, 0);
+
+    // Workers are given up before the read-ahead window.
+    num_workers = 4;
+    uint64_t second = budget.Reserve(&num_workers, &ra_window);
+    ASSERT_EQ(num_workers, 2);
+    ASSERT_EQ(ra_window, 0);
+    ASSERT_EQ(budget.GetReserved(), first + second);
+
+    // Nothing left: one worker and the smallest window, over budget.
+    num_workers = 4;
+    uint64_t third = budget.Reserve(&num_workers, &ra_window);
+    ASSERT_EQ(num_workers, 1);
+    ASSERT_EQ(ra_window, 64_KiB);
+    ASSERT_EQ(third, MemoryBudget::GetHandlerMemory(1, 64_KiB));
+
+    budget.Release(third);
+    budget.Release(second);
+    ASSERT_EQ(budget.GetReserved(), first);
+    num_workers = 4;
+    ASSERT_EQ(budget.Reserve(&num_workers, &ra_window), second);
+    ASSERT_EQ(num_workers, 2);
+}
+
+TEST(MemoryBudgetTest, ConcurrentReservationsFit) {
+    // Room for exactly four single-worker handlers with the default window.
+    uint64_t handler = MemoryBudget::GetHandlerMemory(1, BUFFER_REGION_DEFAULT_SIZE);
+    MemoryBudget budget;
+    budget.SetLimit(4 * handler);
+
+    std::vector<std::future<uint64_t>> reservations;
+    for (int i = 0; i < 8; i++) {
+        reservations.emplace_back(std::async(std::launch::async, [&budget]() {
+            int num_workers = 1;
+            size_t ra_window;
+            return budget.Reserve(&num_workers, &ra_window);
+        }));
+    }
+    int full_size = 0;
+    uint64_t total = 0;
+    for (auto& reservation : reservations) {
+        uint64_t cost = reservation.get();
+        full_size += cost == handler;
+        total += cost;
+    }
+    ASSERT_EQ(full_size, 4);
+    ASSERT_EQ(budget.GetReserved(), total);
+}
+
+TEST(ReadAheadWindowTest, GrowsWhileSequentialAndMergeKeepsPace) {
+    ReadAheadWindow window;
+    window.Initialize(32, 16);
+    ASSERT_EQ(window.GetGroups(), 4);
+    ASSERT_EQ(window.GetBlocks(), 128);
+
+    // Random source reads, or a merge that holds read-ahead back, keep the
+    // window as it is.
+    window.Update(128, 128, 1ms, 0, 0);
+    ASSERT_EQ(window.GetGroups(), 4);
+    window.Update(128, 0, 1ms, 0, 0);
+    ASSERT_EQ(window.GetGroups(), 4);
+    window.Update(128, 1, 100ms, 0, 0);
+    ASSERT_EQ(window.GetGroups(), 4);
+
+    window.Update(128, 16, 1ms, 0, 0);
+    ASSERT_EQ(window.GetGroups(), 8);
+    window.Update(256, 1, 1ms, 0, 0);
+    ASSERT_EQ(window.GetGroups(), 16);
+    window.Update(512, 1, 1ms, 0, 0);
+    ASSERT_EQ(window.GetGroups(), 16);
+    ASSERT_EQ(window.GetBlocks(), 512);
+}
+
+TEST(ReadAheadWindowTest, ShrinksUnderPressure) {
+    ReadAheadWindow window;
+    window.Initialize(32, 16);
+
+    // Pressure wins over sequential reads.
+    window.Update(128, 1, 1ms, 20.0, 0);
+    ASSERT_EQ(window.GetGroups(), 2);
+    window.Update(64, 1, 1ms, 0, 35.5);
+    ASSERT_EQ(window.GetGroups(), 1);
+    window.Update(32, 1, 1ms, 90.0, 90.0);
+    ASSERT_EQ(window.GetGroups(), 1);
+
+    window.Update(32, 1, 1ms, 19.9, 19.9);
+    ASSERT_EQ(window.GetGroups(), 2);
+}
+
+TEST(ReadAheadWindowTest, SmallScratchSpace) {
+    ReadAheadWindow window;
+    window.Initialize(32, 0);
+    ASSERT_EQ(window.GetGroups(), 1);
+    window.Update(32, 1, 1ms, 0, 0);
+    ASSERT_EQ(window.GetGroups(), 1);
+
+    window.Initialize(32, 3);
+    ASSERT_EQ(window.GetGroups(), 1);
+    window.Update(32, 1, 1ms, 0, 0);
+    ASSERT_EQ(window.GetGroups(), 2);
+    window.Update(64, 1, 1ms, 0, 0);
+    ASSERT_EQ(window.GetGroups(), 3);
+}
+
+TEST(XorBuffersTest, MatchesBytewise) {
+    // Cover the vector loops, the word loop, and the byte tail, at unaligned
+    // addresses.
+    for (size_t len : {0, 1, 7, 8, 63, 64, 100, 4096, 4099}) {
+        std::vector<uint8_t> src(len + 1), dst(len + 1);
+        for (size_t i = 0; i <= len; i++) {
+            src[i] = static_cast<uint8_t>(i * 7 + 3);
+            dst[i] = static_cast<uint8_t>(i * 13 + 1);
+        }
+        std::vector<uint8_t> expected = dst;
+        for (size_t i = 0; i < len; i++) {
+            expected[i + 1] ^= src[i + 1];
+        }
+
+        XorBuffers(dst.data() + 1, src.data() + 1, len);
+        ASSERT_EQ(dst, expected) << "len: " << len;
+    }
+}
+
 }  // namespace snapshot
 }  // namespace android
 
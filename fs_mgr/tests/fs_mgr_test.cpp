@@ -1218,3 +1218,57 @@ vendor /vendor      ext4    ro  wait,logical,first_stage_mount
     EXPECT_EQ("erofs", entry->fs_type);
     entry++;
 }
+
+TEST(fs_mgr, FstabCache) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    std::string fstab_contents = R"fs(
+system /system      ext4    ro  wait,logical,first_stage_mount,slotselect,avb=vbmeta_system
+/dev/block/by-name/userdata /data f2fs noatime,nosuid,nodev latemount,wait,check,quota,reservedsize=128M,fileencryption=aes-256-xts:aes-256-cts,keydirectory=/metadata/vold/metadata_encryption
+/dev/block/zram0 none swap defaults zramsize=1073741824,max_comp_streams=8
+)fs";
+    ASSERT_TRUE(android::base::WriteStringToFile(fstab_contents, tf.path));
+
+    Fstab fstab;
+    ASSERT_TRUE(ReadFstabFromFile(tf.path, &fstab));
+    ASSERT_EQ(3U, fstab.size());
+
+    TemporaryDir td;
+    std::string cache_path = std::string(td.path) + "/fstab.cache";
+    std::string key = GetFstabCacheKey(tf.path);
+    ASSERT_FALSE(key.empty());
+
+    Fstab cached;
+    EXPECT_FALSE(ReadFstabCache(cache_path, key, &cached));
+    ASSERT_TRUE(WriteFstabCache(cache_path, key, fstab));
+    ASSERT_TRUE(WriteFstabCache(cache_path, "other", {}));
+    ASSERT_TRUE(ReadFstabCache(cache_path, key, &cached));
+    ASSERT_EQ(fstab.size(), cached.size());
+    for (size_t i = 0; i < fstab.size(); i++) {
+        EXPECT_EQ(fstab[i].blk_device, cached[i].blk_device);
+        EXPECT_EQ(fstab[i].logical_partition_name, cached[i].logical_partition_name);
+        EXPECT_EQ(fstab[i].mount_point, cached[i].mount_point);
+        EXPECT_EQ(fstab[i].fs_type, cached[i].fs_type);
+        EXPECT_EQ(fstab[i].flags, cached[i].flags);
+        EXPECT_EQ(fstab[i].fs_options, cached[i].fs_options);
+        EXPECT_EQ(fstab[i].metadata_key_dir, cached[i].metadata_key_dir);
+        EXPECT_EQ(fstab[i].encryption_options, cached[i].encryption_options);
+        EXPECT_EQ(fstab[i].vbmeta_partition, cached[i].vbmeta_partition);
+        EXPECT_EQ(fstab[i].reserved_size, cached[i].reserved_size);
+        EXPECT_EQ(fstab[i].zram_size, cached[i].zram_size);
+        EXPECT_EQ(fstab[i].max_comp_streams, cached[i].max_comp_streams);
+        EXPECT_EQ(fstab[i].readahead_size_kb, cached[i].readahead_size_kb);
+        EXPECT_TRUE(CompareFlags(fstab[i].fs_mgr_flags, cached[i].fs_mgr_flags));
+    }
+
+    // Rewriting the fstab changes its key, so the stale copy is not used.
+    ASSERT_TRUE(android::base::WriteStringToFile(fstab_contents + "\n", tf.path));
+    EXPECT_NE(key, GetFstabCacheKey(tf.path));
+    EXPECT_FALSE(ReadFstabCache(cache_path, GetFstabCacheKey(tf.path), &cached));
+
+    // A truncated cache is ignored.
+    std::string cache;
+    ASSERT_TRUE(android::base::ReadFileToString(cache_path, &cache));
+    ASSERT_TRUE(android::base::WriteStringToFile(cache.substr(0, cache.size() - 1), cache_path));
+    EXPECT_FALSE(ReadFstabCache(cache_path, key, &cached));
+}
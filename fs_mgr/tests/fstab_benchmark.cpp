@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <fstab/fstab.h>
+
+using namespace android::fs_mgr;
+
+// Roughly the fstab of a current device, repeated to get a measurable amount of work.
+static constexpr char kFstabLines[] = R"fs(
+system /system erofs ro wait,slotselect,avb=vbmeta_system,logical,first_stage_mount,avb_keys=/avb/q-gsi.avbpubkey:/avb/r-gsi.avbpubkey:/avb/s-gsi.avbpubkey
+system /system ext4 ro,barrier=1 wait,slotselect,avb=vbmeta_system,logical,first_stage_mount,avb_keys=/avb/q-gsi.avbpubkey:/avb/r-gsi.avbpubkey:/avb/s-gsi.avbpubkey
+system_ext /system_ext erofs ro wait,slotselect,avb=vbmeta_system,logical,first_stage_mount
+product /product erofs ro wait,slotselect,avb=vbmeta_system,logical,first_stage_mount
+vendor /vendor erofs ro wait,slotselect,avb=vbmeta_vendor,logical,first_stage_mount
+vendor_dlkm /vendor_dlkm erofs ro wait,slotselect,avb=vbmeta,logical,first_stage_mount
+/dev/block/by-name/metadata /metadata ext4 noatime,nosuid,nodev,sync wait,check,formattable,first_stage_mount
+/dev/block/by-name/userdata /data f2fs noatime,nosuid,nodev,inlinecrypt latemount,wait,check,quota,formattable,reservedsize=128M,checkpoint=fs,fileencryption=aes-256-xts:aes-256-cts:inlinecrypt_optimized,keydirectory=/metadata/vold/metadata_encryption
+/dev/block/by-name/misc /misc emmc defaults defaults
+/dev/block/zram0 none swap defaults zramsize=50%,max_comp_streams=8
+)fs";
+
+static std::string MakeFstab(int repeat) {
+    std::string fstab;
+    for (int i = 0; i < repeat; i++) fstab += kFstabLines;
+    return fstab;
+}
+
+static void BM_ParseFstab(benchmark::State& state) {
+    TemporaryFile tf;
+    CHECK(android::base::WriteStringToFile(MakeFstab(state.range(0)), tf.path));
+
+    for (auto _ : state) {
+        std::string fstab_str;
+        Fstab fstab;
+        CHECK(android::base::ReadFileToString(tf.path, &fstab_str));
+        CHECK(ParseFstabFromString(fstab_str, false, &fstab));
+    }
+}
+BENCHMARK(BM_ParseFstab)->Arg(1)->Arg(10);
+
+static void BM_ReadFstabCache(benchmark::State& state) {
+    TemporaryFile tf;
+    CHECK(android::base::WriteStringToFile(MakeFstab(state.range(0)), tf.path));
+    Fstab parsed;
+    CHECK(ParseFstabFromString(MakeFstab(state.range(0)), false, &parsed));
+
+    TemporaryDir td;
+    std::string cache_path = std::string(td.path) + "/fstab.cache";
+    CHECK(WriteFstabCache(cache_path, GetFstabCacheKey(tf.path), parsed));
+
+    for (auto _ : state) {
+        Fstab fstab;
+        CHECK(ReadFstabCache(cache_path, GetFstabCacheKey(tf.path), &fstab));
+    }
+    unlink(cache_path.c_str());
+}
+BENCHMARK(BM_ReadFstabCache)->Arg(1)->Arg(10);
+
+BENCHMARK_MAIN();
@@ -18,15 +18,22 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <linux/dm-ioctl.h>
+#include <linux/fs.h>
+#include <liburing.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
+#include <android-base/scopeguard.h>
 #include <android-base/unique_fd.h>
 #include <libdm/dm.h>
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <functional>
 #include <iomanip>
@@ -34,8 +41,10 @@
 #include <iostream>
 #include <map>
 #include <optional>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace std::literals::string_literals;
@@ -58,6 +67,9 @@ static int Usage(void) {
     std::cerr << "  resume <dm-name>" << std::endl;
     std::cerr << "  suspend <dm-name>" << std::endl;
     std::cerr << "  table <dm-name>" << std::endl;
+    std::cerr << "  bench <dm-name> [seq | rand] [-b block_size] [-q queue_depth] [-t seconds]"
+              << std::endl;
+    std::cerr << "  watch <dm-name> [-i interval_ms] [-c count]" << std::endl;
     std::cerr << "  help" << std::endl;
     std::cerr << std::endl;
     std::cerr << "-f file reads command and all parameters from named file" << std::endl;
@@ -543,6 +555,300 @@ static int SuspendCmdHandler(int argc, char** argv) {
     return 0;
 }
 
+struct BenchOptions {
+    bool sequential = false;
+    uint32_t block_size = 4096;
+    uint32_t queue_depth = 32;
+    uint32_t seconds = 10;
+};
+
+static bool ParseBenchOptions(int argc, char** argv, BenchOptions* options) {
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "seq") {
+            options->sequential = true;
+        } else if (arg == "rand") {
+            options->sequential = false;
+        } else if (arg == "-b" && i + 1 < argc) {
+            if (!android::base::ParseUint(argv[++i], &options->block_size) ||
+                options->block_size == 0 || options->block_size % 512 != 0) {
+                std::cerr << "Block size must be a multiple of 512, got: " << argv[i]
+                          << std::endl;
+                return false;
+            }
+        } else if (arg == "-q" && i + 1 < argc) {
+            if (!android::base::ParseUint(argv[++i], &options->queue_depth, 4096u) ||
+                options->queue_depth == 0) {
+                std::cerr << "Queue depth must be between 1 and 4096, got: " << argv[i]
+                          << std::endl;
+                return false;
+            }
+        } else if (arg == "-t" && i + 1 < argc) {
+            if (!android::base::ParseUint(argv[++i], &options->seconds) || options->seconds == 0) {
+                std::cerr << "Expected a non-zero number of seconds, got: " << argv[i]
+                          << std::endl;
+                return false;
+            }
+        } else {
+            std::cerr << "Unrecognized option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static int BenchCmdHandler(int argc, char** argv) {
+    if (argc < 1) {
+        std::cerr << "Usage: dmctl bench <dm-name> [seq | rand] [-b block_size] [-q queue_depth]"
+                  << " [-t seconds]" << std::endl;
+        return -EINVAL;
+    }
+    BenchOptions options;
+    if (!ParseBenchOptions(argc - 1, argv + 1, &options)) {
+        return -EINVAL;
+    }
+
+    DeviceMapper& dm = DeviceMapper::Instance();
+    std::string path;
+    if (!dm.GetDmDevicePathByName(argv[0], &path)) {
+        std::cerr << "Could not query path of device \"" << argv[0] << "\"." << std::endl;
+        return -EINVAL;
+    }
+    // O_DIRECT so that the page cache doesn't hide the cost of the target.
+    android::base::unique_fd fd(open(path.c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC));
+    if (fd < 0) {
+        int err = errno;
+        std::cerr << "Could not open " << path << ": " << strerror(err) << std::endl;
+        return -err;
+    }
+    uint64_t dev_size;
+    if (ioctl(fd, BLKGETSIZE64, &dev_size) < 0) {
+        int err = errno;
+        std::cerr << "Could not get size of " << path << ": " << strerror(err) << std::endl;
+        return -err;
+    }
+    uint64_t num_blocks = dev_size / options.block_size;
+    if (num_blocks == 0) {
+        std::cerr << "Device is smaller than one block" << std::endl;
+        return -EINVAL;
+    }
+
+    void* addr;
+    if (posix_memalign(&addr, getpagesize(), size_t(options.block_size) * options.queue_depth)) {
+        std::cerr << "Could not allocate read buffers" << std::endl;
+        return -ENOMEM;
+    }
+    std::unique_ptr<void, decltype(&::free)> buffer(addr, ::free);
+
+    struct io_uring ring;
+    if (int ret = io_uring_queue_init(options.queue_depth, &ring, 0); ret < 0) {
+        std::cerr << "io_uring_queue_init failed: " << strerror(-ret) << std::endl;
+        return ret;
+    }
+    auto ring_guard = android::base::make_scope_guard([&ring]() { io_uring_queue_exit(&ring); });
+
+    using Clock = std::chrono::steady_clock;
+    std::mt19937_64 random(Clock::now().time_since_epoch().count());
+    std::vector<Clock::time_point> issued(options.queue_depth);
+    std::vector<uint64_t> latencies_us;
+    uint64_t next_block = 0;
+    uint32_t in_flight = 0;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::seconds(options.seconds);
+
+    auto queue_read = [&](uint32_t slot) -> bool {
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        if (!sqe) {
+            std::cerr << "io_uring_get_sqe failed" << std::endl;
+            return false;
+        }
+        uint64_t block = options.sequential ? next_block++ % num_blocks : random() % num_blocks;
+        char* slot_buffer = static_cast<char*>(buffer.get()) + size_t(slot) * options.block_size;
+        io_uring_prep_read(sqe, fd.get(), slot_buffer, options.block_size,
+                           block * options.block_size);
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<uintptr_t>(slot)));
+        issued[slot] = Clock::now();
+        in_flight++;
+        return true;
+    };
+
+    // Every error return first reaps the reads still in flight. Tearing down
+    // the ring does not wait for them, so they could otherwise still write
+    // into the buffer once it is freed. If they cannot be reaped, the buffer
+    // is leaked instead.
+    auto drain = [&]() {
+        while (in_flight) {
+            int ret = io_uring_submit_and_wait(&ring, 1);
+            if (ret == -EINTR || ret == -EAGAIN || ret == -EBUSY) {
+                continue;
+            }
+            if (ret < 0) {
+                std::cerr << "Could not reap reads in flight: " << strerror(-ret) << std::endl;
+                (void)buffer.release();
+                return;
+            }
+            struct io_uring_cqe* cqe;
+            while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+                io_uring_cqe_seen(&ring, cqe);
+                in_flight--;
+            }
+        }
+    };
+
+    for (uint32_t slot = 0; slot < options.queue_depth; slot++) {
+        if (!queue_read(slot)) {
+            drain();
+            return -EIO;
+        }
+    }
+
+    bool ok = true;
+    while (in_flight) {
+        if (int ret = io_uring_submit_and_wait(&ring, 1); ret < 0) {
+            std::cerr << "io_uring_submit_and_wait failed: " << strerror(-ret) << std::endl;
+            drain();
+            return ret;
+        }
+        auto now = Clock::now();
+        struct io_uring_cqe* cqe;
+        while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+            auto slot = static_cast<uint32_t>(
+                    reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+            int res = cqe->res;
+            io_uring_cqe_seen(&ring, cqe);
+            in_flight--;
+
+            if (res != static_cast<int>(options.block_size)) {
+                std::cerr << "Read failed: " << (res < 0 ? strerror(-res) : "short read")
+                          << std::endl;
+                ok = false;
+                continue;
+            }
+            latencies_us.emplace_back(
+                    std::chrono::duration_cast<std::chrono::microseconds>(now - issued[slot])
+                            .count());
+            if (ok && now < deadline && !queue_read(slot)) {
+                ok = false;
+            }
+        }
+    }
+    if (!ok) {
+        return -EIO;
+    }
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    std::sort(latencies_us.begin(), latencies_us.end());
+    auto percentile = [&](double p) -> uint64_t {
+        if (latencies_us.empty()) return 0;
+        return latencies_us[std::min(latencies_us.size() - 1, size_t(latencies_us.size() * p))];
+    };
+    uint64_t total_us = 0;
+    for (auto latency : latencies_us) {
+        total_us += latency;
+    }
+
+    constexpr int spacing = 14;
+    std::cout << std::left << std::setw(spacing) << "device"
+              << ": " << argv[0] << " (" << path << ")" << std::endl;
+    std::cout << std::left << std::setw(spacing) << "pattern"
+              << ": " << (options.sequential ? "sequential" : "random") << ", "
+              << options.block_size << " bytes, queue depth " << options.queue_depth
+              << std::endl;
+    std::cout << std::left << std::setw(spacing) << "reads"
+              << ": " << latencies_us.size() << " in " << std::fixed << std::setprecision(2)
+              << elapsed << "s" << std::endl;
+    std::cout << std::left << std::setw(spacing) << "iops"
+              << ": " << std::setprecision(0) << latencies_us.size() / elapsed << std::endl;
+    std::cout << std::left << std::setw(spacing) << "throughput"
+              << ": " << std::setprecision(2)
+              << latencies_us.size() * options.block_size / elapsed / (1024 * 1024) << " MiB/s"
+              << std::endl;
+    std::cout << std::left << std::setw(spacing) << "latency (us)"
+              << ": avg " << (latencies_us.empty() ? 0 : total_us / latencies_us.size())
+              << ", p50 " << percentile(0.5) << ", p99 " << percentile(0.99) << ", max "
+              << (latencies_us.empty() ? 0 : latencies_us.back()) << std::endl;
+    return 0;
+}
+
+static int WatchCmdHandler(int argc, char** argv) {
+    uint32_t interval_ms = 1000;
+    uint32_t count = 0;
+    if (argc < 1) {
+        std::cerr << "Usage: dmctl watch <dm-name> [-i interval_ms] [-c count]" << std::endl;
+        return -EINVAL;
+    }
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-i" && i + 1 < argc) {
+            if (!android::base::ParseUint(argv[++i], &interval_ms) || interval_ms == 0) {
+                std::cerr << "Expected a non-zero interval, got: " << argv[i] << std::endl;
+                return -EINVAL;
+            }
+        } else if (arg == "-c" && i + 1 < argc) {
+            if (!android::base::ParseUint(argv[++i], &count)) {
+                std::cerr << "Expected a sample count, got: " << argv[i] << std::endl;
+                return -EINVAL;
+            }
+        } else {
+            std::cerr << "Unrecognized option: " << arg << std::endl;
+            return -EINVAL;
+        }
+    }
+
+    // Merge progress is measured against the allocation seen in the first
+    // sample of each target.
+    DeviceMapper& dm = DeviceMapper::Instance();
+    std::vector<uint64_t> sectors_initial;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t sample = 0; count == 0 || sample < count; sample++) {
+        if (sample) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+        }
+
+        std::vector<DeviceMapper::TargetInfo> table;
+        if (!dm.GetTableStatus(argv[0], &table)) {
+            std::cerr << "Could not query table status of device \"" << argv[0] << "\"."
+                      << std::endl;
+            return -EINVAL;
+        }
+        sectors_initial.resize(table.size());
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+        for (size_t i = 0; i < table.size(); i++) {
+            const auto& target = table[i];
+            std::string type = DeviceMapper::GetTargetType(target.spec);
+            std::cout << std::fixed << std::setprecision(3) << elapsed.count() / 1000.0 << "s "
+                      << target.spec.sector_start << "-"
+                      << (target.spec.sector_start + target.spec.length) << ": " << type;
+
+            DmTargetSnapshot::Status status;
+            if ((type == "snapshot" || type == "snapshot-merge") &&
+                DmTargetSnapshot::ParseStatusText(target.data, &status)) {
+                if (!status.error.empty()) {
+                    std::cout << ", " << status.error << std::endl;
+                    continue;
+                }
+                if (!sectors_initial[i]) {
+                    sectors_initial[i] = status.sectors_allocated;
+                }
+                std::cout << ", allocated " << status.sectors_allocated << "/"
+                          << status.total_sectors << " sectors, metadata "
+                          << status.metadata_sectors;
+                if (type == "snapshot-merge") {
+                    std::cout << ", merged " << std::setprecision(1)
+                              << DmTargetSnapshot::MergePercent(status, sectors_initial[i])
+                              << "%";
+                }
+            } else if (!target.data.empty()) {
+                std::cout << ", " << target.data;
+            }
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
+
 static std::map<std::string, std::function<int(int, char**)>> cmdmap = {
         // clang-format off
         {"create", DmCreateCmdHandler},
@@ -557,6 +863,8 @@ static std::map<std::string, std::function<int(int, char**)>> cmdmap = {
         {"status", StatusCmdHandler},
         {"resume", ResumeCmdHandler},
         {"suspend", SuspendCmdHandler},
+        {"bench", BenchCmdHandler},
+        {"watch", WatchCmdHandler},
         // clang-format on
 };
 
@@ -28,13 +28,18 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <string>
+#include <unordered_map>
 
 #include <aidl/android/hardware/health/HealthInfo.h>
 #include <android-base/file.h>
 #include <android-base/parseint.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <android/hardware/health/2.1/types.h>
 #include <android/hardware/health/translate-ndk.h>
 #include <batteryservice/BatteryService.h>
@@ -285,11 +290,56 @@ BatteryChargingState getBatteryChargingState(const char* chargingState) {
     return *ret;
 }
 
+// updateValues() reads a dozen or more sysfs attributes every time it runs.
+// Rather than opening and closing each of them on every update, keep them open
+// and re-read them with pread() at offset 0, which makes sysfs regenerate the
+// value. An fd that fails (e.g. ENODEV after the power supply went away) is
+// dropped and the attribute reopened once.
+class SysfsAttributeCache {
+  public:
+    bool read(const std::string& path, std::string* buf);
+
+  private:
+    bool readLocked(const std::string& path, std::string* buf);
+
+    std::mutex mLock;
+    std::unordered_map<std::string, android::base::unique_fd> mFds;
+};
+
+bool SysfsAttributeCache::read(const std::string& path, std::string* buf) {
+    if (path.empty()) return false;
+
+    std::lock_guard<std::mutex> lock(mLock);
+    if (readLocked(path, buf)) return true;
+    if (mFds.erase(path) == 0) return false;
+    return readLocked(path, buf);
+}
+
+bool SysfsAttributeCache::readLocked(const std::string& path, std::string* buf) {
+    auto it = mFds.find(path);
+    if (it == mFds.end()) {
+        android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+        if (fd == -1) return false;
+        it = mFds.emplace(path, std::move(fd)).first;
+    }
+
+    // sysfs attributes are at most a page long.
+    char data[4096];
+    ssize_t n = TEMP_FAILURE_RETRY(pread(it->second.get(), data, sizeof(data), 0));
+    if (n < 0) return false;
+    buf->assign(data, n);
+    return true;
+}
+
+static SysfsAttributeCache gSysfsAttributes;
+
+// Returns -1 if path can't be read, else the length of its trimmed contents.
 static int readFromFile(const String8& path, std::string* buf) {
     buf->clear();
-    if (android::base::ReadFileToString(path.c_str(), buf)) {
-        *buf = android::base::Trim(*buf);
+    if (!gSysfsAttributes.read(path.c_str(), buf)) {
+        return -1;
     }
+    *buf = android::base::Trim(*buf);
     return buf->length();
 }
 
@@ -352,6 +402,20 @@ static int getIntField(const String8& path) {
     return value;
 }
 
+// Like getIntField(), but returns default_value if path can't be read at all.
+static int getIntField(const String8& path, int default_value) {
+    std::string buf;
+    int value = 0;
+
+    int len = readFromFile(path, &buf);
+    if (len < 0)
+        return default_value;
+    if (len > 0)
+        android::base::ParseInt(buf, &value);
+
+    return value;
+}
+
 static bool isScopedPowerSupply(const char* name) {
     constexpr char kScopeDevice[] = "Device";
 
@@ -445,13 +509,16 @@ void BatteryMonitor::updateValues(void) {
 
     double MaxPower = 0;
 
-    // Rescan for the available charger types
+    // Rescan for the available charger types. readdir() of the class directory
+    // is cheap; the attributes of an entry are only probed the first time it
+    // shows up, and forgotten once it disappears.
     std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(POWER_SUPPLY_SYSFS_PATH), closedir);
     if (dir == NULL) {
         KLOG_ERROR(LOG_TAG, "Could not open %s\n", POWER_SUPPLY_SYSFS_PATH);
     } else {
         struct dirent* entry;
         String8 path;
+        std::map<std::string, PowerSupplyAttributes> supplies;
 
         mChargerNames.clear();
 
@@ -461,6 +528,19 @@ void BatteryMonitor::updateValues(void) {
             if (!strcmp(name, ".") || !strcmp(name, ".."))
                 continue;
 
+            PowerSupplyAttributes attrs;
+            if (auto it = mPowerSupplies.find(name); it != mPowerSupplies.end()) {
+                attrs = it->second;
+            } else {
+                path.clear();
+                path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH, name);
+                attrs.hasOnline = access(path.string(), R_OK) == 0;
+                path.clear();
+                path.appendFormat("%s/%s/is_dock", POWER_SUPPLY_SYSFS_PATH, name);
+                attrs.hasIsDock = access(path.string(), R_OK) == 0;
+            }
+            supplies.emplace(name, attrs);
+
             // Look for "type" file in each subdirectory
             path.clear();
             path.appendFormat("%s/%s/type", POWER_SUPPLY_SYSFS_PATH, name);
@@ -469,9 +549,7 @@ void BatteryMonitor::updateValues(void) {
             case ANDROID_POWER_SUPPLY_TYPE_USB:
             case ANDROID_POWER_SUPPLY_TYPE_WIRELESS:
             case ANDROID_POWER_SUPPLY_TYPE_DOCK:
-                path.clear();
-                path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH, name);
-                if (access(path.string(), R_OK) == 0)
+                if (attrs.hasOnline)
                     mChargerNames.add(String8(name));
                 break;
             default:
@@ -479,16 +557,11 @@ void BatteryMonitor::updateValues(void) {
             }
 
             // Look for "is_dock" file
-            path.clear();
-            path.appendFormat("%s/%s/is_dock", POWER_SUPPLY_SYSFS_PATH, name);
-            if (access(path.string(), R_OK) == 0) {
-                path.clear();
-                path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH, name);
-                if (access(path.string(), R_OK) == 0)
-                    mChargerNames.add(String8(name));
-
-            }
+            if (attrs.hasIsDock && attrs.hasOnline)
+                mChargerNames.add(String8(name));
         }
+
+        mPowerSupplies = std::move(supplies);
     }
 
     for (size_t i = 0; i < mChargerNames.size(); i++) {
@@ -513,22 +586,18 @@ void BatteryMonitor::updateValues(void) {
                 mHealthInfo->chargerDockOnline = true;
                 break;
             default:
-                path.clear();
-                path.appendFormat("%s/%s/is_dock", POWER_SUPPLY_SYSFS_PATH,
-                                  mChargerNames[i].string());
-                if (access(path.string(), R_OK) == 0)
+                if (auto it = mPowerSupplies.find(mChargerNames[i].string());
+                    it != mPowerSupplies.end() && it->second.hasIsDock)
                     mHealthInfo->chargerDockOnline = true;
                 else
                     KLOG_WARNING(LOG_TAG, "%s: Unknown power supply type\n",
                                  mChargerNames[i].string());
             }
 
-            int ChargingCurrent =
-                  (access(SYSFS_BATTERY_CURRENT, R_OK) == 0) ? abs(getIntField(String8(SYSFS_BATTERY_CURRENT))) : 0;
+            int ChargingCurrent = abs(getIntField(String8(SYSFS_BATTERY_CURRENT), 0));
 
             int ChargingVoltage =
-                  (access(SYSFS_BATTERY_VOLTAGE, R_OK) == 0) ? getIntField(String8(SYSFS_BATTERY_VOLTAGE)) :
-                   DEFAULT_VBUS_VOLTAGE;
+                  getIntField(String8(SYSFS_BATTERY_VOLTAGE), DEFAULT_VBUS_VOLTAGE);
 
             double power = ((double)ChargingCurrent / MILLION) *
                            ((double)ChargingVoltage / MILLION);
@@ -585,6 +654,41 @@ void BatteryMonitor::logValues(const HealthInfo_2_1& health_info,
     doLogValues(aidl_health_info, healthd_config);
 }
 
+static bool isSignificantChange(const HealthInfo& from, const HealthInfo& to) {
+    // A tenth of a degree is noise; a whole degree is worth reporting.
+    constexpr int kTemperatureDeltaTenthsCelsius = 10;
+
+    return from.chargerAcOnline != to.chargerAcOnline ||
+           from.chargerUsbOnline != to.chargerUsbOnline ||
+           from.chargerWirelessOnline != to.chargerWirelessOnline ||
+           from.chargerDockOnline != to.chargerDockOnline ||
+           from.batteryPresent != to.batteryPresent ||
+           from.batteryStatus != to.batteryStatus ||
+           from.batteryHealth != to.batteryHealth ||
+           from.batteryLevel != to.batteryLevel ||
+           from.batteryCapacityLevel != to.batteryCapacityLevel ||
+           from.chargingState != to.chargingState ||
+           from.chargingPolicy != to.chargingPolicy ||
+           abs(from.batteryTemperatureTenthsCelsius - to.batteryTemperatureTenthsCelsius) >=
+                   kTemperatureDeltaTenthsCelsius;
+}
+
+bool BatteryMonitor::isHealthInfoChanged() {
+    auto now = android::base::boot_clock::now();
+    int interval = mHealthdConfig ? mHealthdConfig->health_info_min_update_interval : 0;
+
+    if (interval > 0 && mReportedHealthInfo &&
+        now - mReportedTime < std::chrono::seconds(interval) &&
+        !isSignificantChange(*mReportedHealthInfo, *mHealthInfo)) {
+        return false;
+    }
+
+    if (!mReportedHealthInfo) mReportedHealthInfo = std::make_unique<HealthInfo>();
+    *mReportedHealthInfo = *mHealthInfo;
+    mReportedTime = now;
+    return true;
+}
+
 void BatteryMonitor::logValues(void) {
     doLogValues(*mHealthInfo, *mHealthdConfig);
 }
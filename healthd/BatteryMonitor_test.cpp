@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <healthd/BatteryMonitor.h>
+#include <healthd/healthd.h>
+
+using android::BatteryMonitor;
+using android::String8;
+using android::base::WriteStringToFile;
+using namespace std::chrono_literals;
+
+// Points the battery attributes BatteryMonitor reports at files in a temporary
+// directory, and keeps it from picking up the power supplies of the device.
+class BatteryMonitorTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        std::unique_ptr<DIR, decltype(&closedir)> dir(opendir("/sys/class/power_supply"),
+                                                      closedir);
+        dirent* entry;
+        while (dir && (entry = readdir(dir.get()))) {
+            config_.ignorePowerSupplyNames.emplace_back(String8(entry->d_name));
+        }
+
+        config_.batteryStatusPath = Attribute("status", "Charging");
+        config_.batteryHealthPath = Attribute("health", "Good");
+        config_.batteryPresentPath = Attribute("present", "1");
+        config_.batteryCapacityPath = Attribute("capacity", "50");
+        config_.batteryVoltagePath = Attribute("voltage_now", "4000000");
+        config_.batteryTemperaturePath = Attribute("temp", "250");
+        config_.batteryCurrentNowPath = Attribute("current_now", "-500000");
+    }
+
+    String8 Attribute(const std::string& name, const std::string& value) {
+        std::string path = std::string(dir_.path) + "/" + name;
+        EXPECT_TRUE(WriteStringToFile(value, path));
+        return String8(path.c_str());
+    }
+
+    bool Update() {
+        monitor_.updateValues();
+        return monitor_.isHealthInfoChanged();
+    }
+
+    TemporaryDir dir_;
+    healthd_config config_ = {};
+    BatteryMonitor monitor_;
+};
+
+TEST_F(BatteryMonitorTest, EveryUpdateWithoutInterval) {
+    monitor_.init(&config_);
+
+    EXPECT_TRUE(Update());
+    EXPECT_TRUE(Update());
+    Attribute("voltage_now", "4001000");
+    EXPECT_TRUE(Update());
+}
+
+TEST_F(BatteryMonitorTest, CoalescesReadingsThatDrift) {
+    config_.health_info_min_update_interval = 3600;
+    monitor_.init(&config_);
+
+    // The first update is always delivered.
+    EXPECT_TRUE(Update());
+    EXPECT_FALSE(Update());
+    Attribute("voltage_now", "4001000");
+    Attribute("current_now", "-400000");
+    EXPECT_FALSE(Update());
+    Attribute("temp", "259");
+    EXPECT_FALSE(Update());
+    // A degree away from what was delivered last.
+    Attribute("temp", "260");
+    EXPECT_TRUE(Update());
+}
+
+TEST_F(BatteryMonitorTest, SignificantChangesAreDeliveredAtOnce) {
+    config_.health_info_min_update_interval = 3600;
+    monitor_.init(&config_);
+    EXPECT_TRUE(Update());
+
+    Attribute("capacity", "51");
+    EXPECT_TRUE(Update());
+    EXPECT_FALSE(Update());
+    Attribute("status", "Discharging");
+    EXPECT_TRUE(Update());
+    Attribute("health", "Overheat");
+    EXPECT_TRUE(Update());
+    Attribute("present", "0");
+    EXPECT_TRUE(Update());
+}
+
+TEST_F(BatteryMonitorTest, DeliversAfterInterval) {
+    config_.health_info_min_update_interval = 1;
+    monitor_.init(&config_);
+    EXPECT_TRUE(Update());
+
+    Attribute("voltage_now", "4001000");
+    EXPECT_FALSE(Update());
+    std::this_thread::sleep_for(1100ms);
+    EXPECT_TRUE(Update());
+}
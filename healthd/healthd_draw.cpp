@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <android-base/stringprintf.h>
 #include <batteryservice/BatteryService.h>
 #include <cutils/klog.h>
@@ -83,7 +85,7 @@ HealthdDraw::~HealthdDraw() {}
 
 void HealthdDraw::redraw_screen(const animation* batt_anim, GRSurface* surf_unknown) {
     if (!graphics_available) return;
-    clear_screen();
+    clear_dirty();
 
     /* try to display *something* */
     if (batt_anim->cur_status == BATTERY_STATUS_UNKNOWN || batt_anim->cur_level < 0 ||
@@ -92,11 +94,48 @@ void HealthdDraw::redraw_screen(const animation* batt_anim, GRSurface* surf_unkn
     else
         draw_battery(batt_anim);
     gr_flip();
+
+    dirty_history_.emplace_front(std::move(dirty_));
+    dirty_.clear();
+    if (dirty_history_.size() > kMaxBuffers) dirty_history_.pop_back();
+}
+
+void HealthdDraw::clear_dirty() {
+    // Everything outside the areas drawn in the last few frames is still
+    // black in every buffer, so only those need clearing. This saves filling
+    // the whole screen for each animation step.
+    if (full_clear_frames_ > 0) {
+        full_clear_frames_--;
+        clear_screen();
+        return;
+    }
+
+    std::vector<Rect> cleared;
+    gr_color(0, 0, 0, 255);
+    for (const auto& frame : dirty_history_) {
+        for (const Rect& r : frame) {
+            if (std::find(cleared.begin(), cleared.end(), r) != cleared.end()) continue;
+            gr_fill(r.x1, r.y1, r.x2, r.y2);
+            cleared.push_back(r);
+        }
+    }
+}
+
+void HealthdDraw::mark_dirty(int x, int y, int w, int h) {
+    Rect r = {
+            .x1 = std::max(x, 0),
+            .y1 = std::max(y, 0),
+            .x2 = std::min(x + w, gr_fb_width()),
+            .y2 = std::min(y + h, gr_fb_height()),
+    };
+    if (r.x1 < r.x2 && r.y1 < r.y2) dirty_.push_back(r);
 }
 
 void HealthdDraw::blank_screen(bool blank, int drm) {
     if (!graphics_available) return;
     gr_fb_blank(blank, drm);
+    full_clear_frames_ = kMaxBuffers;
+    dirty_history_.clear();
 }
 
 // support screen rotation for foldable phone
@@ -106,6 +145,8 @@ void HealthdDraw::rotate_screen(int drm) {
         gr_rotate(GRRotation::RIGHT /* landscape mode */);
     else
         gr_rotate(GRRotation::NONE /* Portrait mode */);
+    full_clear_frames_ = kMaxBuffers;
+    dirty_history_.clear();
 }
 
 // detect dual display
@@ -129,10 +170,12 @@ int HealthdDraw::draw_surface_centered(GRSurface* surface) {
 
     LOGV("drawing surface %dx%d+%d+%d\n", w, h, x, y);
     gr_blit(surface, 0, 0, w, h, x, y);
+    mark_dirty(x, y, w, h);
     if (kSplitScreen) {
         x += screen_width_ - 2 * kSplitOffset;
         LOGV("drawing surface %dx%d+%d+%d\n", w, h, x, y);
         gr_blit(surface, 0, 0, w, h, x, y);
+        mark_dirty(x, y, w, h);
     }
 
     return y + h;
@@ -145,7 +188,11 @@ int HealthdDraw::draw_text(const GRFont* font, int x, int y, const char* str) {
     if (x < 0) x = (screen_width_ - str_len_px) / 2;
     if (y < 0) y = (screen_height_ - char_height_) / 2;
     gr_text(font, x + kSplitOffset, y, str, false /* bold */);
-    if (kSplitScreen) gr_text(font, x - kSplitOffset + screen_width_, y, str, false /* bold */);
+    mark_dirty(x + kSplitOffset, y, str_len_px, font->char_height);
+    if (kSplitScreen) {
+        gr_text(font, x - kSplitOffset + screen_width_, y, str, false /* bold */);
+        mark_dirty(x - kSplitOffset + screen_width_, y, str_len_px, font->char_height);
+    }
 
     return y + char_height_;
 }
@@ -20,6 +20,9 @@
 #include <linux/input.h>
 #include <minui/minui.h>
 
+#include <deque>
+#include <vector>
+
 #include "animation.h"
 
 using namespace android;
@@ -65,6 +68,11 @@ class HealthdDraw {
   // Draws charger->surf_unknown or basic text.
   virtual void draw_unknown(GRSurface* surf_unknown);
 
+  // Records that the frame being drawn covers the given area, so that the
+  // next frames only clear what was actually drawn instead of the whole
+  // screen.
+  void mark_dirty(int x, int y, int w, int h);
+
   // Pixel sizes of characters for default font.
   int char_width_;
   int char_height_;
@@ -87,6 +95,28 @@ class HealthdDraw {
  private:
   // Configures font using given animation.
   HealthdDraw(animation* anim);
+
+  // Clears what the previous frames drew into the buffer about to be drawn.
+  void clear_dirty();
+
+  struct Rect {
+    int x1, y1, x2, y2;
+    bool operator==(const Rect& o) const {
+      return x1 == o.x1 && y1 == o.y1 && x2 == o.x2 && y2 == o.y2;
+    }
+  };
+
+  // Upper bound on the number of buffers minui flips between. The buffer
+  // drawn next holds the frame from that many flips ago at most.
+  static constexpr int kMaxBuffers = 3;
+
+  // Frames left to clear entirely, since the buffers' contents are unknown
+  // e.g. before the first frame and after blanking or rotating.
+  int full_clear_frames_ = kMaxBuffers;
+  // Areas drawn in the frame being composed.
+  std::vector<Rect> dirty_;
+  // Areas drawn in the last kMaxBuffers frames, most recent first.
+  std::deque<std::vector<Rect>> dirty_history_;
 };
 
 #endif  // HEALTHD_DRAW_H
@@ -612,6 +612,13 @@ void Charger::OnHeartbeat() {
 }
 
 void Charger::OnHealthInfoChanged(const ChargerHealthInfo& health_info) {
+    // Updates that only differ in fields the charger doesn't look at are
+    // frequent; nothing below needs redoing for them.
+    if (have_battery_state_ && health_info.battery_level == health_info_.battery_level &&
+        health_info.battery_status == health_info_.battery_status) {
+        return;
+    }
+
     if (!have_battery_state_) {
         have_battery_state_ = true;
         next_screen_transition_ = curr_time_ms() - 1;
@@ -17,8 +17,11 @@
 #ifndef HEALTHD_BATTERYMONITOR_H
 #define HEALTHD_BATTERYMONITOR_H
 
+#include <map>
 #include <memory>
+#include <string>
 
+#include <android-base/chrono_utils.h>
 #include <batteryservice/BatteryService.h>
 #include <utils/String8.h>
 #include <utils/Vector.h>
@@ -79,6 +82,14 @@ class BatteryMonitor {
     const aidl::android::hardware::health::HealthInfo& getHealthInfo() const;
 
     void updateValues(void);
+    // Returns true if the values read by the last updateValues() should be
+    // delivered to clients: a field they act on (charger state, battery
+    // presence, status, health or level, charging state or policy, or the
+    // temperature by a degree or more) changed since the last time this
+    // returned true, or health_info_min_update_interval has passed since then.
+    // Readings that drift on every update, like current and voltage, are
+    // thereby coalesced instead of waking up every client each time.
+    bool isHealthInfoChanged();
     void logValues(void);
     bool isChargerOnline();
 
@@ -90,13 +101,24 @@ class BatteryMonitor {
                           const struct healthd_config& healthd_config);
 
   private:
+    // Which optional attributes a power_supply entry has; these don't change
+    // for as long as the entry exists, so they're only probed once.
+    struct PowerSupplyAttributes {
+        bool hasOnline;
+        bool hasIsDock;
+    };
+
     struct healthd_config *mHealthdConfig;
     Vector<String8> mChargerNames;
+    std::map<std::string, PowerSupplyAttributes> mPowerSupplies;
     bool mBatteryDevicePresent;
     int mBatteryFixedCapacity;
     int mBatteryFixedTemperature;
     int mBatteryHealthStatus;
     std::unique_ptr<aidl::android::hardware::health::HealthInfo> mHealthInfo;
+    // Last health info isHealthInfoChanged() returned true for, and when.
+    std::unique_ptr<aidl::android::hardware::health::HealthInfo> mReportedHealthInfo;
+    android::base::boot_clock::time_point mReportedTime;
 };
 
 }; // namespace android
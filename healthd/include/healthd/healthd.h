@@ -83,6 +83,10 @@ struct healthd_config {
     int boot_min_cap;
     bool (*screen_on)(android::BatteryProperties *props);
     std::vector<android::String8> ignorePowerSupplyNames;
+    // Minimum number of seconds between health info updates delivered to
+    // clients when nothing significant changed; see
+    // BatteryMonitor::isHealthInfoChanged(). 0 delivers every update.
+    int health_info_min_update_interval;
 };
 
 enum EventWakeup {
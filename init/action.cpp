@@ -21,6 +21,7 @@
 #include <android-base/properties.h>
 #include <android-base/strings.h>
 
+#include "action_profiler.h"
 #include "util.h"
 
 using android::base::Join;
@@ -150,6 +151,40 @@ void Action::ExecuteOneCommand(std::size_t command) const {
     ExecuteCommand(cmd);
 }
 
+std::size_t Action::ExecuteCommands(std::size_t command) const {
+    if (!subcontext_ || !commands_[command].execute_in_subcontext()) {
+        ExecuteOneCommand(command);
+        return 1;
+    }
+
+    // As in ExecuteOneCommand(), copy the commands in case they change commands_.
+    auto batch = std::vector<Command>();
+    auto batch_args = std::vector<std::vector<std::string>>();
+    for (auto i = command; i < commands_.size() && commands_[i].execute_in_subcontext(); ++i) {
+        batch.emplace_back(commands_[i]);
+        batch_args.emplace_back(commands_[i].args());
+    }
+
+    int64_t start_ns = IsProfiling() ? ProfileNow() : 0;
+    auto results = subcontext_->ExecuteBatch(batch_args);
+    if (IsProfiling()) {
+        RecordProfileSpan(ProfileKind::kSubcontextBatch,
+                          "subcontext batch of " + std::to_string(results.size()),
+                          filename_ + ":" + std::to_string(batch[0].line()), start_ns, ProfileNow());
+        // The subcontext only reports how long each command took, so lay them
+        // out back to back from the start of the round trip.
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            int64_t end_ns = start_ns + std::chrono::nanoseconds(results[i].duration).count();
+            ProfileCommand(batch[i], ProfileKind::kSubcontext, start_ns, end_ns);
+            start_ns = end_ns;
+        }
+    }
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        LogCommandResult(batch[i], results[i].result, results[i].duration);
+    }
+    return results.size();
+}
+
 void Action::ExecuteAllCommands() const {
     for (const auto& c : commands_) {
         ExecuteCommand(c);
@@ -158,9 +193,24 @@ void Action::ExecuteAllCommands() const {
 
 void Action::ExecuteCommand(const Command& command) const {
     android::base::Timer t;
+    int64_t start_ns = IsProfiling() ? ProfileNow() : 0;
     auto result = command.InvokeFunc(subcontext_);
-    auto duration = t.duration();
+    if (IsProfiling()) {
+        bool in_subcontext = subcontext_ && command.execute_in_subcontext();
+        ProfileCommand(command, in_subcontext ? ProfileKind::kSubcontext : ProfileKind::kBuiltin,
+                       start_ns, ProfileNow());
+    }
+    LogCommandResult(command, result, t.duration());
+}
+
+void Action::ProfileCommand(const Command& command, ProfileKind kind, int64_t start_ns,
+                            int64_t end_ns) const {
+    RecordProfileSpan(kind, command.BuildCommandString(),
+                      filename_ + ":" + std::to_string(command.line()), start_ns, end_ns);
+}
 
+void Action::LogCommandResult(const Command& command, const Result<void>& result,
+                              std::chrono::milliseconds duration) const {
     // Any action longer than 50ms will be warned to user as slow operation
     if (!result.has_value() || duration > 50ms ||
         android::base::GetMinimumLogSeverity() <= android::base::DEBUG) {
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <map>
 #include <queue>
 #include <string>
@@ -24,6 +25,7 @@
 
 #include <android-base/strings.h>
 
+#include "action_profiler.h"
 #include "builtins.h"
 #include "keyword_map.h"
 #include "result.h"
@@ -45,6 +47,8 @@ class Command {
     Result<void> CheckCommand() const;
 
     int line() const { return line_; }
+    bool execute_in_subcontext() const { return execute_in_subcontext_; }
+    const std::vector<std::string>& args() const { return args_; }
 
   private:
     BuiltinFunction func_;
@@ -67,6 +71,9 @@ class Action {
     void AddCommand(BuiltinFunction f, std::vector<std::string>&& args, int line);
     size_t NumCommands() const;
     void ExecuteOneCommand(std::size_t command) const;
+    // Executes |command|, and with it any following commands that can be sent to the subcontext
+    // in the same batch.  Returns the number of commands executed.
+    std::size_t ExecuteCommands(std::size_t command) const;
     void ExecuteAllCommands() const;
     bool CheckEvent(const EventTrigger& event_trigger) const;
     bool CheckEvent(const PropertyChange& property_change) const;
@@ -76,6 +83,10 @@ class Action {
     size_t CheckAllCommands() const;
 
     bool oneshot() const { return oneshot_; }
+    const std::string& event_trigger() const { return event_trigger_; }
+    const std::map<std::string, std::string>& property_triggers() const {
+        return property_triggers_;
+    }
     const std::string& filename() const { return filename_; }
     int line() const { return line_; }
     static void set_function_map(const BuiltinFunctionMap* function_map) {
@@ -85,6 +96,10 @@ class Action {
 
   private:
     void ExecuteCommand(const Command& command) const;
+    void LogCommandResult(const Command& command, const Result<void>& result,
+                          std::chrono::milliseconds duration) const;
+    void ProfileCommand(const Command& command, ProfileKind kind, int64_t start_ns,
+                        int64_t end_ns) const;
     bool CheckPropertyTriggers(const std::string& name = "",
                                const std::string& value = "") const;
 
@@ -37,9 +37,49 @@ ActionManager& ActionManager::GetInstance() {
 }
 
 void ActionManager::AddAction(std::unique_ptr<Action> action) {
+    IndexAction(action.get());
     actions_.emplace_back(std::move(action));
 }
 
+void ActionManager::IndexAction(const Action* action) {
+    if (!action->event_trigger().empty()) {
+        event_actions_[action->event_trigger()].emplace_back(action);
+        return;
+    }
+    if (action->property_triggers().empty()) {
+        num_untriggered_actions_++;
+        return;
+    }
+    for (const auto& [name, value] : action->property_triggers()) {
+        property_actions_[name].emplace_back(action);
+    }
+}
+
+void ActionManager::UnindexAction(const Action* action) {
+    if (!action->event_trigger().empty()) {
+        auto& actions = event_actions_[action->event_trigger()];
+        actions.erase(std::remove(actions.begin(), actions.end(), action), actions.end());
+        return;
+    }
+    if (action->property_triggers().empty()) {
+        num_untriggered_actions_--;
+        return;
+    }
+    for (const auto& [name, value] : action->property_triggers()) {
+        auto& actions = property_actions_[name];
+        actions.erase(std::remove(actions.begin(), actions.end(), action), actions.end());
+    }
+}
+
+void ActionManager::RebuildIndexes() {
+    event_actions_.clear();
+    property_actions_.clear();
+    num_untriggered_actions_ = 0;
+    for (const auto& action : actions_) {
+        IndexAction(action.get());
+    }
+}
+
 void ActionManager::QueueEventTrigger(const std::string& trigger) {
     auto lock = std::lock_guard{event_queue_lock_};
     event_queue_.emplace(trigger);
@@ -50,6 +90,13 @@ void ActionManager::QueuePropertyChange(const std::string& name, const std::stri
     event_queue_.emplace(std::make_pair(name, value));
 }
 
+void ActionManager::QueuePropertyChanges(const std::vector<PropertyChange>& changes) {
+    auto lock = std::lock_guard{event_queue_lock_};
+    for (const auto& change : changes) {
+        event_queue_.emplace(change);
+    }
+}
+
 void ActionManager::QueueAllPropertyActions() {
     QueuePropertyChange("", "");
 }
@@ -61,6 +108,7 @@ void ActionManager::QueueBuiltinAction(BuiltinFunction func, const std::string&
     action->AddCommand(std::move(func), {name}, 0);
 
     event_queue_.emplace(action.get());
+    IndexAction(action.get());
     actions_.emplace_back(std::move(action));
 }
 
@@ -69,10 +117,36 @@ void ActionManager::ExecuteOneCommand() {
         auto lock = std::lock_guard{event_queue_lock_};
         // Loop through the event queue until we have an action to execute
         while (current_executing_actions_.empty() && !event_queue_.empty()) {
-            for (const auto& action : actions_) {
+            const auto& next_event = event_queue_.front();
+            auto check_action = [&](const Action* action) {
                 if (std::visit([&action](const auto& event) { return action->CheckEvent(event); },
-                               event_queue_.front())) {
-                    current_executing_actions_.emplace(action.get());
+                               next_event)) {
+                    current_executing_actions_.emplace(action);
+                }
+            };
+
+            auto check_actions = [&](const auto& actions) {
+                for (const auto& action : actions) {
+                    check_action(action);
+                }
+            };
+
+            auto event_trigger = std::get_if<EventTrigger>(&next_event);
+            auto property_change = std::get_if<PropertyChange>(&next_event);
+            if (auto builtin_action = std::get_if<BuiltinAction>(&next_event)) {
+                current_executing_actions_.emplace(*builtin_action);
+            } else if (event_trigger) {
+                if (auto it = event_actions_.find(*event_trigger); it != event_actions_.end()) {
+                    check_actions(it->second);
+                }
+            } else if (!property_change->first.empty() && num_untriggered_actions_ == 0) {
+                if (auto it = property_actions_.find(property_change->first);
+                    it != property_actions_.end()) {
+                    check_actions(it->second);
+                }
+            } else {
+                for (const auto& action : actions_) {
+                    check_action(action.get());
                 }
             }
             event_queue_.pop();
@@ -89,18 +163,27 @@ void ActionManager::ExecuteOneCommand() {
         std::string trigger_name = action->BuildTriggersString();
         LOG(INFO) << "processing action (" << trigger_name << ") from (" << action->filename()
                   << ":" << action->line() << ")";
+        if (IsProfiling()) {
+            current_action_start_ns_ = ProfileNow();
+        }
     }
 
-    action->ExecuteOneCommand(current_command_);
+    current_command_ += action->ExecuteCommands(current_command_);
 
     // If this was the last command in the current action, then remove
     // the action from the executing list.
     // If this action was oneshot, then also remove it from actions_.
-    ++current_command_;
     if (current_command_ == action->NumCommands()) {
+        if (IsProfiling()) {
+            // This includes whatever init did between the commands.
+            RecordProfileSpan(ProfileKind::kAction, action->BuildTriggersString(),
+                              action->filename() + ":" + std::to_string(action->line()),
+                              current_action_start_ns_, ProfileNow());
+        }
         current_executing_actions_.pop();
         current_command_ = 0;
         if (action->oneshot()) {
+            UnindexAction(action);
             auto eraser = [&action](std::unique_ptr<Action>& a) { return a.get() == action; };
             actions_.erase(std::remove_if(actions_.begin(), actions_.end(), eraser),
                            actions_.end());
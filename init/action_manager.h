@@ -18,6 +18,7 @@
 
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/thread_annotations.h>
@@ -40,9 +41,11 @@ class ActionManager {
     template <class UnaryPredicate>
     void RemoveActionIf(UnaryPredicate predicate) {
         actions_.erase(std::remove_if(actions_.begin(), actions_.end(), predicate), actions_.end());
+        RebuildIndexes();
     }
     void QueueEventTrigger(const std::string& trigger);
     void QueuePropertyChange(const std::string& name, const std::string& value);
+    void QueuePropertyChanges(const std::vector<PropertyChange>& changes);
     void QueueAllPropertyActions();
     void QueueBuiltinAction(BuiltinFunction func, const std::string& name);
     void ExecuteOneCommand();
@@ -55,12 +58,27 @@ class ActionManager {
     ActionManager(ActionManager const&) = delete;
     void operator=(ActionManager const&) = delete;
 
+    void IndexAction(const Action* action);
+    void UnindexAction(const Action* action);
+    void RebuildIndexes();
+
     std::vector<std::unique_ptr<Action>> actions_;
+    // Actions with the given event trigger, in the same order as actions_, so that an event
+    // doesn't have to check every action.
+    std::unordered_map<std::string, std::vector<const Action*>> event_actions_;
+    // Actions that a change of the given property can trigger, in the same order as actions_,
+    // so that a property change doesn't have to check every action.
+    std::unordered_map<std::string, std::vector<const Action*>> property_actions_;
+    // Actions without any trigger match every property change. If there are any, property
+    // changes fall back to checking all of actions_.
+    size_t num_untriggered_actions_ = 0;
     std::queue<std::variant<EventTrigger, PropertyChange, BuiltinAction>> event_queue_
             GUARDED_BY(event_queue_lock_);
     mutable std::mutex event_queue_lock_;
     std::queue<const Action*> current_executing_actions_;
     std::size_t current_command_;
+    // When the first command of the front of current_executing_actions_ started, if profiling.
+    int64_t current_action_start_ns_ = 0;
 };
 
 }  // namespace init
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "action_manager.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace init {
+
+static const std::vector<std::string> kBootEvents = {
+        "early-init", "init", "late-init", "early-fs", "fs", "post-fs", "late-fs",
+        "post-fs-data", "zygote-start", "early-boot", "boot",
+};
+
+// Roughly the shape of a device's rc files: most actions are for the boot events, the rest for
+// property changes.
+static void AddActions(ActionManager* am) {
+    auto add_action = [am](const std::string& event,
+                           std::map<std::string, std::string> property_triggers) {
+        auto action = std::make_unique<Action>(false, nullptr, "/vendor/etc/init/bench.rc", 0,
+                                               event, property_triggers);
+        action->AddCommand([](const BuiltinArguments&) -> Result<void> { return {}; }, {"nop"}, 0);
+        am->AddAction(std::move(action));
+    };
+    for (int i = 0; i < 2000; i++) {
+        add_action(kBootEvents[i % kBootEvents.size()], {});
+    }
+    for (int i = 0; i < 200; i++) {
+        add_action(StringPrintf("vendor.trigger_%d", i), {});
+    }
+    for (int i = 0; i < 1000; i++) {
+        add_action("", {{StringPrintf("vendor.prop_%d", i), "1"}});
+    }
+}
+
+static void Drain(ActionManager* am) {
+    while (am->HasMoreCommands()) {
+        am->ExecuteOneCommand();
+    }
+}
+
+static void BM_EventTriggers(benchmark::State& state) {
+    ActionManager am;
+    AddActions(&am);
+    for (auto _ : state) {
+        for (int i = 0; i < 100; i++) {
+            am.QueueEventTrigger(StringPrintf("vendor.trigger_%d", i * 2));
+        }
+        Drain(&am);
+    }
+}
+BENCHMARK(BM_EventTriggers);
+
+static void BM_PropertyChanges(benchmark::State& state) {
+    ActionManager am;
+    AddActions(&am);
+    for (auto _ : state) {
+        for (int i = 0; i < 100; i++) {
+            am.QueuePropertyChange(StringPrintf("vendor.prop_%d", i * 10), "1");
+        }
+        Drain(&am);
+    }
+}
+BENCHMARK(BM_PropertyChanges);
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "action_profiler.h"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/chrono_utils.h>
+#include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+
+#include "util.h"
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace init {
+
+namespace {
+
+// Enough for the commands of a typical boot.
+constexpr size_t kDefaultCapacity = 16384;
+
+struct Span {
+    int64_t start_ns;
+    int64_t end_ns;
+    uint32_t name;
+    uint32_t location;
+    ProfileKind kind;
+};
+
+// Spans refer to their strings by index, since the same commands and actions
+// run over and over.
+struct Profile {
+    std::vector<Span> spans;
+    size_t next = 0;
+    uint64_t recorded = 0;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> string_ids;
+
+    uint32_t Intern(const std::string& str) {
+        auto [iter, inserted] = string_ids.emplace(str, strings.size());
+        if (inserted) {
+            strings.emplace_back(str);
+        }
+        return iter->second;
+    }
+};
+
+// Only used by init's main thread.
+std::unique_ptr<Profile> profile;
+
+const char* KindName(ProfileKind kind) {
+    switch (kind) {
+        case ProfileKind::kAction:
+            return "action";
+        case ProfileKind::kBuiltin:
+            return "builtin";
+        case ProfileKind::kSubcontext:
+            return "subcontext";
+        case ProfileKind::kSubcontextBatch:
+            return "subcontext_batch";
+    }
+    return "unknown";
+}
+
+std::string JsonEscape(const std::string& str) {
+    std::string escaped;
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c < 0x20) {
+            escaped += StringPrintf("\\u%04x", c);
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+}  // namespace
+
+void StartProfiling(size_t capacity) {
+    profile = std::make_unique<Profile>();
+    profile->spans.resize(capacity);
+}
+
+void StartProfilingIfRequested() {
+    if (android::base::GetBoolProperty("ro.boot.init_profile", false)) {
+        LOG(INFO) << "Profiling init actions and commands";
+        StartProfiling(kDefaultCapacity);
+    }
+}
+
+bool IsProfiling() {
+    return profile != nullptr && !profile->spans.empty();
+}
+
+int64_t ProfileNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   android::base::boot_clock::now().time_since_epoch())
+            .count();
+}
+
+void RecordProfileSpan(ProfileKind kind, const std::string& name, const std::string& location,
+                       int64_t start_ns, int64_t end_ns) {
+    if (!IsProfiling()) {
+        return;
+    }
+    profile->spans[profile->next] = {start_ns, end_ns, profile->Intern(name),
+                                     profile->Intern(location), kind};
+    profile->next = (profile->next + 1) % profile->spans.size();
+    profile->recorded++;
+}
+
+std::string FormatProfile() {
+    std::string trace = "{\"traceEvents\":[";
+    if (IsProfiling()) {
+        size_t count = std::min<uint64_t>(profile->recorded, profile->spans.size());
+        // Oldest first; once the ring has wrapped, that is the next slot to be overwritten.
+        size_t first = profile->recorded > profile->spans.size() ? profile->next : 0;
+        for (size_t i = 0; i < count; i++) {
+            const Span& span = profile->spans[(first + i) % profile->spans.size()];
+            trace += StringPrintf(
+                    "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":1,\"tid\":1,\"args\":{\"location\":\"%s\"}}",
+                    i ? "," : "", JsonEscape(profile->strings[span.name]).c_str(),
+                    KindName(span.kind), span.start_ns / 1000.0,
+                    (span.end_ns - span.start_ns) / 1000.0,
+                    JsonEscape(profile->strings[span.location]).c_str());
+        }
+    }
+    trace += "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return trace;
+}
+
+Result<void> DumpProfile(const std::string& path) {
+    if (!IsProfiling()) {
+        return Error() << "init profiling is not enabled; boot with androidboot.init_profile=1";
+    }
+    if (auto result = WriteFile(path, FormatProfile()); !result.ok()) {
+        return Error() << "Unable to write init profile to '" << path << "': " << result.error();
+    }
+    LOG(INFO) << "Wrote " << std::min<uint64_t>(profile->recorded, profile->spans.size())
+              << " init profile spans to " << path;
+    return {};
+}
+
+void DumpProfilerState() {
+    if (!IsProfiling()) {
+        return;
+    }
+    LOG(INFO) << "Init profile: " << profile->recorded << " spans recorded, "
+              << std::min<uint64_t>(profile->recorded, profile->spans.size()) << " kept, "
+              << profile->strings.size() << " distinct strings";
+}
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "result.h"
+
+namespace android {
+namespace init {
+
+// What a profiled span covers.
+enum class ProfileKind : uint8_t {
+    kAction,           // An action, from the start of its first command to the end of its last.
+    kBuiltin,          // A command run by init itself.
+    kSubcontext,       // A command run in a subcontext.
+    kSubcontextBatch,  // One round trip to a subcontext, running one or more commands.
+};
+
+// Starts keeping the most recent |capacity| spans, dropping any recorded so far.
+void StartProfiling(size_t capacity);
+// Starts profiling if androidboot.init_profile=1.
+void StartProfilingIfRequested();
+bool IsProfiling();
+
+// The clock spans are recorded with: CLOCK_BOOTTIME in ns, as used for ro.boottime.*.
+int64_t ProfileNow();
+
+void RecordProfileSpan(ProfileKind kind, const std::string& name, const std::string& location,
+                       int64_t start_ns, int64_t end_ns);
+
+// Returns the spans as a Chrome JSON trace, which Perfetto and chrome://tracing open directly.
+std::string FormatProfile();
+Result<void> DumpProfile(const std::string& path);
+void DumpProfilerState();
+
+}  // namespace init
+}  // namespace android
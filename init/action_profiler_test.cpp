@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "action_profiler.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+namespace init {
+
+TEST(action_profiler, KeepsMostRecentSpans) {
+    StartProfiling(2);
+    ASSERT_TRUE(IsProfiling());
+    RecordProfileSpan(ProfileKind::kAction, "first", "init.rc:1", 1000, 2000);
+    RecordProfileSpan(ProfileKind::kBuiltin, "second", "init.rc:2", 3000, 4500);
+    RecordProfileSpan(ProfileKind::kSubcontext, "third", "init.rc:3", 5000, 6000);
+
+    std::string trace = FormatProfile();
+    EXPECT_EQ(std::string::npos, trace.find("\"first\""));
+    auto second = trace.find(
+            "{\"name\":\"second\",\"cat\":\"builtin\",\"ph\":\"X\",\"ts\":3.000,\"dur\":1.500,"
+            "\"pid\":1,\"tid\":1,\"args\":{\"location\":\"init.rc:2\"}}");
+    auto third = trace.find("\"name\":\"third\",\"cat\":\"subcontext\"");
+    ASSERT_NE(std::string::npos, second);
+    ASSERT_NE(std::string::npos, third);
+    EXPECT_LT(second, third);
+}
+
+TEST(action_profiler, EscapesStrings) {
+    StartProfiling(1);
+    RecordProfileSpan(ProfileKind::kBuiltin, "write /x \"a\\b\"\n", "init.rc:1", 0, 0);
+    EXPECT_NE(std::string::npos, FormatProfile().find("\"write /x \\\"a\\\\b\\\"\\u000a\""));
+}
+
+TEST(action_profiler, Disabled) {
+    StartProfiling(0);
+    EXPECT_FALSE(IsProfiling());
+    RecordProfileSpan(ProfileKind::kBuiltin, "ignored", "init.rc:1", 0, 0);
+    EXPECT_EQ("{\"traceEvents\":[\n],\"displayTimeUnit\":\"ms\"}\n", FormatProfile());
+    EXPECT_FALSE(DumpProfile("/dev/null").ok());
+}
+
+}  // namespace init
+}  // namespace android
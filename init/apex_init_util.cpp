@@ -67,6 +67,9 @@ static Result<std::vector<std::string>> CollectApexConfigs(const std::string& ap
 static Result<void> ParseConfigs(const std::vector<std::string>& configs) {
     Parser parser =
             CreateApexConfigParser(ActionManager::GetInstance(), ServiceList::GetInstance());
+    // The files are read and tokenized in the background; the results are still merged into the
+    // action manager and service list in the order of |configs|.
+    parser.PrefetchConfigs(configs);
     std::vector<std::string> errors;
     for (const auto& c : configs) {
         auto result = parser.ParseConfigFile(c);
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <unistd.h>
+
 #include <chrono>
 #include <string_view>
 #include <vector>
@@ -29,11 +31,11 @@ namespace init {
 using android::base::Timer;
 using namespace std::chrono_literals;
 
-BlockDevInitializer::BlockDevInitializer() : uevent_listener_(16 * 1024 * 1024) {
-    auto boot_devices = android::fs_mgr::GetBootDevices();
+BlockDevInitializer::BlockDevInitializer()
+    : boot_devices_(android::fs_mgr::GetBootDevices()), uevent_listener_(16 * 1024 * 1024) {
     device_handler_ = std::make_unique<DeviceHandler>(
             std::vector<Permissions>{}, std::vector<SysfsPermissions>{}, std::vector<Subsystem>{},
-            std::move(boot_devices), false);
+            boot_devices_, false);
 }
 
 bool BlockDevInitializer::InitDeviceMapper() {
@@ -103,11 +105,32 @@ ListenerAction BlockDevInitializer::HandleUevent(const Uevent& uevent,
     return devices->empty() ? ListenerAction::kStop : ListenerAction::kContinue;
 }
 
+// Boot devices are named by their path under /sys/devices/platform, or under /sys/devices for
+// PCI devices.  Walking just their subtrees finds the partitions on them without regenerating the
+// uevents of every other device.
+ListenerAction BlockDevInitializer::RegenerateBootDeviceUevents(const ListenerCallback& callback) {
+    for (const auto& boot_device : boot_devices_) {
+        for (const auto& prefix : {"/sys/devices/platform/", "/sys/devices/"}) {
+            auto path = prefix + boot_device;
+            if (access(path.c_str(), F_OK) != 0) continue;
+            if (uevent_listener_.RegenerateUeventsForPath(path, callback) ==
+                ListenerAction::kStop) {
+                return ListenerAction::kStop;
+            }
+            break;
+        }
+    }
+    return ListenerAction::kContinue;
+}
+
 bool BlockDevInitializer::InitDevices(std::set<std::string> devices) {
     auto uevent_callback = [&, this](const Uevent& uevent) -> ListenerAction {
         return HandleUevent(uevent, &devices);
     };
-    uevent_listener_.RegenerateUevents(uevent_callback);
+    // Fall back to all of /sys/devices for partitions that are not on a boot device.
+    if (RegenerateBootDeviceUevents(uevent_callback) != ListenerAction::kStop) {
+        uevent_listener_.RegenerateUevents(uevent_callback);
+    }
 
     // UeventCallback() will remove found partitions from |devices|. So if it
     // isn't empty here, it means some partitions are not found.
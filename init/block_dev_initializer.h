@@ -37,7 +37,9 @@ class BlockDevInitializer final {
     ListenerAction HandleUevent(const Uevent& uevent, std::set<std::string>* devices);
 
     bool InitMiscDevice(const std::string& name);
+    ListenerAction RegenerateBootDeviceUevents(const ListenerCallback& callback);
 
+    std::set<std::string> boot_devices_;
     std::unique_ptr<DeviceHandler> device_handler_;
     UeventListener uevent_listener_;
 };
@@ -21,25 +21,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <string_view>
 #include <thread>
 
 #include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 
 using android::base::StringPrintf;
 using android::base::boot_clock;
+using android::base::unique_fd;
 using namespace std::chrono_literals;
 
 namespace android {
@@ -47,6 +55,15 @@ namespace init {
 
 static std::thread* g_bootcharting_thread;
 
+struct BootchartConfig {
+    bool binary = false;
+    std::chrono::milliseconds interval = 200ms;
+};
+
+static constexpr std::chrono::milliseconds kMinInterval = 10ms;
+static constexpr const char* kBinaryLogPath = "/data/bootchart/bootchart.bin";
+static constexpr size_t kBinaryLogCapacity = 32 * 1024 * 1024;
+
 static std::mutex g_bootcharting_finished_mutex;
 static std::condition_variable g_bootcharting_finished_cv;
 static bool g_bootcharting_finished;
@@ -137,7 +154,259 @@ static void log_processes(FILE* log) {
   fputc('\n', log);
 }
 
-static void bootchart_thread_main() {
+// Returns false once bootcharting has been stopped.
+static bool wait_for_next_sample(std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lock(g_bootcharting_finished_mutex);
+    g_bootcharting_finished_cv.wait_for(lock, interval);
+    return !g_bootcharting_finished;
+}
+
+static void record_text(std::chrono::milliseconds interval) {
+    // Don't leave a stale binary log around for grab-bootchart.sh to convert.
+    unlink(kBinaryLogPath);
+
+    auto stat_log = fopen_unique("/data/bootchart/proc_stat.log", "we");
+    if (!stat_log) return;
+    auto proc_log = fopen_unique("/data/bootchart/proc_ps.log", "we");
+    if (!proc_log) return;
+    auto disk_log = fopen_unique("/data/bootchart/proc_diskstats.log", "we");
+    if (!disk_log) return;
+
+    log_header();
+
+    while (wait_for_next_sample(interval)) {
+        log_file(&*stat_log, "/proc/stat");
+        log_file(&*disk_log, "/proc/diskstats");
+        log_processes(&*proc_log);
+    }
+}
+
+// The binary log starts with a BinaryLogHeader, followed by records each made of a RecordHeader
+// and |length| bytes of data. A kRecordSample record (whose data is the uptime in jiffies as a
+// uint64_t) starts each sample. /proc/stat, /proc/diskstats and /proc/<pid>/stat contents are
+// recorded only when they differ from the previous sample, and kRecordProcessExit marks a
+// process that has gone away. convert-bootchart.py turns this back into the text logs.
+enum RecordType : uint8_t {
+    kRecordSample = 1,
+    kRecordStat = 2,
+    kRecordDiskstats = 3,
+    kRecordProcess = 4,
+    kRecordProcessExit = 5,
+};
+
+struct BinaryLogHeader {
+    char magic[4];
+    uint32_t version;
+    // Bytes of complete samples following this header.
+    uint64_t size;
+};
+
+struct __attribute__((packed)) RecordHeader {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t pid;
+    uint32_t length;
+};
+
+static bool pread_file(int fd, std::string* content) {
+    content->clear();
+    char buf[4096];
+    for (off_t offset = 0;;) {
+        ssize_t n = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf), offset));
+        if (n == -1) return false;
+        if (n == 0) return true;
+        content->append(buf, n);
+        offset += n;
+    }
+}
+
+// Samples into a file mapped in memory, keeping the /proc files open between samples, so that
+// taking a sample costs a few preads and no open(), write() or allocations in the common case.
+class BinaryRecorder {
+  public:
+    ~BinaryRecorder();
+
+    bool Open(const char* filename, size_t capacity);
+    // Returns false once the log is full.
+    bool Sample();
+
+  private:
+    struct Process {
+        unique_fd stat_fd;
+        unique_fd cmdline_fd;
+        std::string stat;
+        bool seen = false;
+    };
+
+    bool OpenProcess(pid_t pid, Process* process);
+    bool Append(RecordType type, pid_t pid, std::string_view data);
+    bool AppendIfChanged(RecordType type, int fd, std::string* last);
+    bool SampleProcesses();
+
+    unique_fd fd_;
+    uint8_t* data_ = nullptr;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+
+    std::unique_ptr<DIR, int (*)(DIR*)> proc_dir_{nullptr, closedir};
+    unique_fd stat_fd_;
+    unique_fd diskstats_fd_;
+    std::string stat_;
+    std::string diskstats_;
+    std::string buffer_;
+    std::string cmdline_;
+    std::map<pid_t, Process> processes_;
+};
+
+BinaryRecorder::~BinaryRecorder() {
+    if (!data_) return;
+    munmap(data_, capacity_);
+    if (ftruncate(fd_.get(), sizeof(BinaryLogHeader) + size_) == -1) {
+        PLOG(ERROR) << "bootchart: failed to truncate " << kBinaryLogPath;
+    }
+}
+
+bool BinaryRecorder::Open(const char* filename, size_t capacity) {
+    fd_.reset(TEMP_FAILURE_RETRY(open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)));
+    if (fd_ == -1) {
+        PLOG(ERROR) << "bootchart: failed to open " << filename;
+        return false;
+    }
+    if (ftruncate(fd_.get(), capacity) == -1) {
+        PLOG(ERROR) << "bootchart: failed to size " << filename;
+        return false;
+    }
+    void* map = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_.get(), 0);
+    if (map == MAP_FAILED) {
+        PLOG(ERROR) << "bootchart: failed to map " << filename;
+        return false;
+    }
+    data_ = static_cast<uint8_t*>(map);
+    capacity_ = capacity;
+
+    auto header = reinterpret_cast<BinaryLogHeader*>(data_);
+    memcpy(header->magic, "BCHT", sizeof(header->magic));
+    header->version = 1;
+    header->size = 0;
+
+    proc_dir_.reset(opendir("/proc"));
+    stat_fd_.reset(TEMP_FAILURE_RETRY(open("/proc/stat", O_RDONLY | O_CLOEXEC)));
+    diskstats_fd_.reset(TEMP_FAILURE_RETRY(open("/proc/diskstats", O_RDONLY | O_CLOEXEC)));
+    if (!proc_dir_ || stat_fd_ == -1 || diskstats_fd_ == -1) {
+        PLOG(ERROR) << "bootchart: failed to open /proc";
+        return false;
+    }
+    return true;
+}
+
+bool BinaryRecorder::Append(RecordType type, pid_t pid, std::string_view data) {
+    RecordHeader record = {
+            .type = type,
+            .pid = static_cast<uint32_t>(pid),
+            .length = static_cast<uint32_t>(data.size()),
+    };
+    size_t offset = sizeof(BinaryLogHeader) + size_;
+    if (capacity_ - offset < sizeof(record) + data.size()) return false;
+    memcpy(data_ + offset, &record, sizeof(record));
+    memcpy(data_ + offset + sizeof(record), data.data(), data.size());
+    size_ += sizeof(record) + data.size();
+    return true;
+}
+
+bool BinaryRecorder::AppendIfChanged(RecordType type, int fd, std::string* last) {
+    if (!pread_file(fd, &buffer_) || buffer_ == *last) return true;
+    last->swap(buffer_);
+    return Append(type, 0, *last);
+}
+
+bool BinaryRecorder::OpenProcess(pid_t pid, Process* process) {
+    int proc_fd = dirfd(proc_dir_.get());
+    process->stat_fd.reset(
+            openat(proc_fd, StringPrintf("%d/stat", pid).c_str(), O_RDONLY | O_CLOEXEC));
+    process->cmdline_fd.reset(
+            openat(proc_fd, StringPrintf("%d/cmdline", pid).c_str(), O_RDONLY | O_CLOEXEC));
+    return process->stat_fd != -1;
+}
+
+bool BinaryRecorder::SampleProcesses() {
+    rewinddir(proc_dir_.get());
+    struct dirent* entry;
+    while ((entry = readdir(proc_dir_.get())) != nullptr) {
+        // Only match numeric values.
+        int pid = atoi(entry->d_name);
+        if (pid == 0) continue;
+
+        auto [it, inserted] = processes_.try_emplace(pid);
+        Process& process = it->second;
+        if (inserted && !OpenProcess(pid, &process)) continue;
+        if (!pread_file(process.stat_fd.get(), &buffer_)) {
+            // The process we had open exited, and its pid has been reused.
+            if (inserted || !OpenProcess(pid, &process)) continue;
+            if (!pread_file(process.stat_fd.get(), &buffer_)) continue;
+        }
+        process.seen = true;
+        if (buffer_ == process.stat) continue;
+        process.stat.swap(buffer_);
+
+        // As in log_processes(), substitute the truncated task name with the full one.
+        std::string_view stat = process.stat;
+        size_t open = stat.find('(');
+        size_t close = stat.find_last_of(')');
+        if (process.cmdline_fd != -1 && pread_file(process.cmdline_fd.get(), &cmdline_) &&
+            !cmdline_.empty() && open != std::string_view::npos && close != std::string_view::npos) {
+            cmdline_.resize(strlen(cmdline_.c_str()));  // So we stop at the first NUL.
+            buffer_.assign(stat.substr(0, open + 1));
+            buffer_.append(cmdline_);
+            buffer_.append(stat.substr(close));
+            stat = buffer_;
+        }
+        if (!Append(kRecordProcess, pid, stat)) return false;
+    }
+
+    for (auto it = processes_.begin(); it != processes_.end();) {
+        if (it->second.seen) {
+            it->second.seen = false;
+            ++it;
+            continue;
+        }
+        if (!it->second.stat.empty() && !Append(kRecordProcessExit, it->first, {})) return false;
+        it = processes_.erase(it);
+    }
+    return true;
+}
+
+bool BinaryRecorder::Sample() {
+    uint64_t uptime = get_uptime_jiffies();
+    bool ok = Append(kRecordSample, 0,
+                     std::string_view(reinterpret_cast<const char*>(&uptime), sizeof(uptime))) &&
+              AppendIfChanged(kRecordStat, stat_fd_.get(), &stat_) &&
+              AppendIfChanged(kRecordDiskstats, diskstats_fd_.get(), &diskstats_) &&
+              SampleProcesses();
+    auto header = reinterpret_cast<BinaryLogHeader*>(data_);
+    if (!ok) {
+        // Drop the partial sample.
+        size_ = header->size;
+        return false;
+    }
+    header->size = size_;
+    return true;
+}
+
+static void record_binary(std::chrono::milliseconds interval) {
+    BinaryRecorder recorder;
+    if (!recorder.Open(kBinaryLogPath, kBinaryLogCapacity)) return;
+
+    log_header();
+
+    while (wait_for_next_sample(interval)) {
+        if (!recorder.Sample()) {
+            LOG(WARNING) << "bootchart: " << kBinaryLogPath << " is full";
+            break;
+        }
+    }
+}
+
+static void bootchart_thread_main(BootchartConfig config) {
   LOG(INFO) << "Bootcharting started";
 
   // Unshare the mount namespace of this thread so that the init process itself can switch
@@ -154,40 +423,44 @@ static void bootchart_thread_main() {
       PLOG(ERROR) << "Cannot create mount namespace";
       return;
   }
-  // Open log files.
-  auto stat_log = fopen_unique("/data/bootchart/proc_stat.log", "we");
-  if (!stat_log) return;
-  auto proc_log = fopen_unique("/data/bootchart/proc_ps.log", "we");
-  if (!proc_log) return;
-  auto disk_log = fopen_unique("/data/bootchart/proc_diskstats.log", "we");
-  if (!disk_log) return;
-
-  log_header();
 
-  while (true) {
-    {
-      std::unique_lock<std::mutex> lock(g_bootcharting_finished_mutex);
-      g_bootcharting_finished_cv.wait_for(lock, 200ms);
-      if (g_bootcharting_finished) break;
-    }
-
-    log_file(&*stat_log, "/proc/stat");
-    log_file(&*disk_log, "/proc/diskstats");
-    log_processes(&*proc_log);
+  if (config.binary) {
+      record_binary(config.interval);
+  } else {
+      record_text(config.interval);
   }
 
   LOG(INFO) << "Bootcharting finished";
 }
 
+// /data/bootchart/enabled may contain "binary" to use the binary log, and a sampling interval in
+// milliseconds.
+static BootchartConfig parse_config(const std::string& content) {
+    BootchartConfig config;
+    for (const auto& word : android::base::Split(android::base::Trim(content), " \t\n")) {
+        unsigned int interval_ms;
+        if (word.empty()) {
+            continue;
+        } else if (word == "binary") {
+            config.binary = true;
+        } else if (android::base::ParseUint(word, &interval_ms)) {
+            config.interval = std::max(std::chrono::milliseconds(interval_ms), kMinInterval);
+        } else {
+            LOG(WARNING) << "bootchart: ignoring unknown option '" << word << "'";
+        }
+    }
+    return config;
+}
+
 static Result<void> do_bootchart_start() {
-    // We don't care about the content, but we do care that /data/bootchart/enabled actually exists.
+    // An empty /data/bootchart/enabled is fine, but it must exist.
     std::string start;
     if (!android::base::ReadFileToString("/data/bootchart/enabled", &start)) {
         LOG(VERBOSE) << "Not bootcharting";
         return {};
     }
 
-    g_bootcharting_thread = new std::thread(bootchart_thread_main);
+    g_bootcharting_thread = new std::thread(bootchart_thread_main, parse_config(start));
     return {};
 }
 
@@ -69,11 +69,13 @@
 #include <system/thread_defs.h>
 
 #include "action_manager.h"
+#include "action_profiler.h"
 #include "apex_init_util.h"
 #include "bootchart.h"
 #include "builtin_arguments.h"
 #include "fscrypt_init_extensions.h"
 #include "init.h"
+#include "lmkd_service.h"
 #include "mount_namespace.h"
 #include "parser.h"
 #include "property_service.h"
@@ -165,16 +167,23 @@ static Result<void> do_class_start(const BuiltinArguments& args) {
     // Do not start a class if it has a property persist.dont_start_class.CLASS set to 1.
     if (android::base::GetBoolProperty("persist.init.dont_start_class." + args[1], false))
         return {};
-    // Starting a class does not start services which are explicitly disabled.
-    // They must  be started individually.
+    auto services = std::vector<Service*>();
     for (const auto& service : ServiceList::GetInstance()) {
         if (service->classnames().count(args[1])) {
-            if (auto result = service->StartIfNotDisabled(); !result.ok()) {
-                LOG(ERROR) << "Could not start service '" << service->name()
-                           << "' as part of class '" << args[1] << "': " << result.error();
-            }
+            services.emplace_back(service.get());
+        }
+    }
+    Service::PrecomputeContexts(services);
+    // Starting a class does not start services which are explicitly disabled.
+    // They must  be started individually.
+    LmkdBeginBatch();
+    for (auto* service : services) {
+        if (auto result = service->StartIfNotDisabled(); !result.ok()) {
+            LOG(ERROR) << "Could not start service '" << service->name()
+                       << "' as part of class '" << args[1] << "': " << result.error();
         }
     }
+    LmkdEndBatch();
     return {};
 }
 
@@ -887,6 +896,10 @@ static Result<void> do_verity_update_state(const BuiltinArguments& args) {
     return {};
 }
 
+static Result<void> do_dump_init_profile(const BuiltinArguments& args) {
+    return DumpProfile(args[1]);
+}
+
 static Result<void> do_write(const BuiltinArguments& args) {
     if (auto result = WriteFile(args[1], args[2]); !result.ok()) {
         return ErrorIgnoreEnoent()
@@ -1098,6 +1111,11 @@ static Result<void> do_loglevel(const BuiltinArguments& args) {
     return {};
 }
 
+static Result<void> do_prefetch_persist_props(const BuiltinArguments& args) {
+    SendPrefetchPersistentPropertiesMessage();
+    return {};
+}
+
 static Result<void> do_load_persist_props(const BuiltinArguments& args) {
     SendLoadPersistentPropertiesMessage();
 
@@ -1352,6 +1370,7 @@ const BuiltinFunctionMap& GetBuiltinFunctionMap() {
         {"copy",                    {2,     2,    {true,   do_copy}}},
         {"copy_per_line",           {2,     2,    {true,   do_copy_per_line}}},
         {"domainname",              {1,     1,    {true,   do_domainname}}},
+        {"dump_init_profile",       {1,     1,    {false,  do_dump_init_profile}}},
         {"enable",                  {1,     1,    {false,  do_enable}}},
         {"exec",                    {1,     kMax, {false,  do_exec}}},
         {"exec_background",         {1,     kMax, {false,  do_exec_background}}},
@@ -1378,6 +1397,7 @@ const BuiltinFunctionMap& GetBuiltinFunctionMap() {
         {"mount_all",               {0,     kMax, {false,  do_mount_all}}},
         {"mount",                   {3,     kMax, {false,  do_mount}}},
         {"perform_apex_config",     {0,     0,    {false,  do_perform_apex_config}}},
+        {"prefetch_persist_props",  {0,     0,    {false,  do_prefetch_persist_props}}},
         {"umount",                  {1,     1,    {false,  do_umount}}},
         {"umount_all",              {0,     1,    {false,  do_umount_all}}},
         {"update_linker_config",    {0,     0,    {false,  do_update_linker_config}}},
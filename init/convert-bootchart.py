@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2026 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Convert a binary bootchart log into the text logs pybootchartgui reads.
+
+init writes /data/bootchart/bootchart.bin when /data/bootchart/enabled
+contains "binary". Each sample in it only has the /proc files that changed
+since the previous sample; this script fills in the rest and writes
+proc_stat.log, proc_diskstats.log and proc_ps.log in the same format as
+init's text mode.
+"""
+
+import os
+import struct
+import sys
+
+FILE_HEADER = struct.Struct('<4sIQ')
+RECORD_HEADER = struct.Struct('<B3xII')
+
+RECORD_SAMPLE = 1
+RECORD_STAT = 2
+RECORD_DISKSTATS = 3
+RECORD_PROCESS = 4
+RECORD_PROCESS_EXIT = 5
+
+
+def convert(binary_log, output_dir):
+    with open(binary_log, 'rb') as f:
+        data = f.read()
+    magic, version, size = FILE_HEADER.unpack_from(data)
+    if magic != b'BCHT' or version != 1:
+        sys.exit('%s is not a version 1 binary bootchart log' % binary_log)
+    end = FILE_HEADER.size + size
+
+    stat_log = open(os.path.join(output_dir, 'proc_stat.log'), 'w')
+    disk_log = open(os.path.join(output_dir, 'proc_diskstats.log'), 'w')
+    proc_log = open(os.path.join(output_dir, 'proc_ps.log'), 'w')
+
+    stat = ''
+    diskstats = ''
+    processes = {}
+    uptime = None
+
+    def write_sample():
+        stat_log.write('%d\n%s\n' % (uptime, stat))
+        disk_log.write('%d\n%s\n' % (uptime, diskstats))
+        proc_log.write('%d\n' % uptime)
+        for pid in sorted(processes):
+            proc_log.write(processes[pid])
+        proc_log.write('\n')
+
+    offset = FILE_HEADER.size
+    while offset < end:
+        record_type, pid, length = RECORD_HEADER.unpack_from(data, offset)
+        offset += RECORD_HEADER.size
+        payload = data[offset:offset + length]
+        offset += length
+
+        if record_type == RECORD_SAMPLE:
+            if uptime is not None:
+                write_sample()
+            uptime, = struct.unpack('<Q', payload)
+        elif record_type == RECORD_STAT:
+            stat = payload.decode('utf-8', 'replace')
+        elif record_type == RECORD_DISKSTATS:
+            diskstats = payload.decode('utf-8', 'replace')
+        elif record_type == RECORD_PROCESS:
+            processes[pid] = payload.decode('utf-8', 'replace')
+        elif record_type == RECORD_PROCESS_EXIT:
+            processes.pop(pid, None)
+        else:
+            sys.exit('Unknown record type %d at offset %d' % (record_type, offset))
+    if uptime is not None:
+        write_sample()
+
+    for log in (stat_log, disk_log, proc_log):
+        log.close()
+
+
+def main():
+    if len(sys.argv) != 3:
+        print('Usage: %s bootchart.bin output_dir' % sys.argv[0])
+        sys.exit(1)
+    convert(sys.argv[1], sys.argv[2])
+
+
+if __name__ == '__main__':
+    main()
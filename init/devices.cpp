@@ -170,6 +170,69 @@ bool SysfsPermissions::MatchWithSubsystem(const std::string& path,
     return Match(path);
 }
 
+static constexpr size_t kNoNode = 0;
+
+size_t PermissionsMatcher::FindChild(size_t node, char c) const {
+    for (const auto& [child_char, child] : nodes_[node].children) {
+        if (child_char == c) return child;
+    }
+    return kNoNode;
+}
+
+void PermissionsMatcher::Add(const Permissions& permissions, size_t index) {
+    const auto& name = permissions.name_;
+    if (!permissions.prefix_ && !permissions.wildcard_) {
+        exact_[name].emplace_back(index);
+        return;
+    }
+
+    // Any character up to the first one that fnmatch() treats specially must match literally.
+    size_t literal_length = name.size();
+    if (permissions.wildcard_) {
+        literal_length = std::min(name.find_first_of("*?[\\"), name.size());
+    }
+
+    // The root is node 0, and no other node points to it, so kNoNode can mean "no child".
+    size_t node = 0;
+    for (size_t i = 0; i < literal_length; i++) {
+        size_t child = FindChild(node, name[i]);
+        if (child == kNoNode) {
+            child = nodes_.size();
+            nodes_[node].children.emplace_back(name[i], child);
+            nodes_.emplace_back();
+        }
+        node = child;
+    }
+
+    if (permissions.prefix_) {
+        nodes_[node].prefixes.emplace_back(index);
+    } else {
+        nodes_[node].wildcards.push_back(
+                {index, name, permissions.no_fnm_pathname_ ? 0 : FNM_PATHNAME});
+    }
+}
+
+void PermissionsMatcher::Match(const std::string& path, std::vector<size_t>* matches) const {
+    if (auto it = exact_.find(path); it != exact_.end()) {
+        matches->insert(matches->end(), it->second.begin(), it->second.end());
+    }
+
+    size_t node = 0;
+    for (size_t pos = 0;; pos++) {
+        const auto& current = nodes_[node];
+        matches->insert(matches->end(), current.prefixes.begin(), current.prefixes.end());
+        for (const auto& wildcard : current.wildcards) {
+            if (fnmatch(wildcard.pattern.c_str(), path.c_str(), wildcard.flags) == 0) {
+                matches->emplace_back(wildcard.index);
+            }
+        }
+
+        if (pos == path.size()) break;
+        node = FindChild(node, path[pos]);
+        if (node == kNoNode) break;
+    }
+}
+
 void SysfsPermissions::SetPermissions(const std::string& path) const {
     std::string attribute_file = path + "/" + attribute_;
     LOG(VERBOSE) << "fixup " << attribute_file << " " << uid() << " " << gid() << " " << std::oct
@@ -254,7 +317,20 @@ void DeviceHandler::FixupSysPermissions(const std::string& upath,
     // contain, so we prepend it...
     std::string path = "/sys" + upath;
 
-    for (const auto& s : sysfs_permissions_) {
+    // MatchWithSubsystem() also tries the /sys/class and /sys/bus paths of the device, so collect
+    // the candidates for all three, then apply the entries that really match in their original
+    // order.
+    std::string path_basename = Basename(path);
+    std::vector<size_t> candidates;
+    sysfs_permissions_matcher_.Match(path, &candidates);
+    sysfs_permissions_matcher_.Match("/sys/class/" + subsystem + "/" + path_basename, &candidates);
+    sysfs_permissions_matcher_.Match("/sys/bus/" + subsystem + "/devices/" + path_basename,
+                                     &candidates);
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    for (size_t i : candidates) {
+        const auto& s = sysfs_permissions_[i];
         if (s.MatchWithSubsystem(path, subsystem)) s.SetPermissions(path);
     }
 
@@ -268,15 +344,17 @@ void DeviceHandler::FixupSysPermissions(const std::string& upath,
 
 std::tuple<mode_t, uid_t, gid_t> DeviceHandler::GetDevicePermissions(
     const std::string& path, const std::vector<std::string>& links) const {
-    // Search the perms list in reverse so that ueventd.$hardware can override ueventd.rc.
-    for (auto it = dev_permissions_.crbegin(); it != dev_permissions_.crend(); ++it) {
-        if (it->Match(path) || std::any_of(links.cbegin(), links.cend(),
-                                           [it](const auto& link) { return it->Match(link); })) {
-            return {it->perm(), it->uid(), it->gid()};
-        }
+    std::vector<size_t> matches;
+    dev_permissions_matcher_.Match(path, &matches);
+    for (const auto& link : links) {
+        dev_permissions_matcher_.Match(link, &matches);
     }
     /* Default if nothing found. */
-    return {0600, 0, 0};
+    if (matches.empty()) return {0600, 0, 0};
+
+    // The last match wins, so that ueventd.$hardware can override ueventd.rc.
+    const auto& permissions = dev_permissions_[*std::max_element(matches.begin(), matches.end())];
+    return {permissions.perm(), permissions.uid(), permissions.gid()};
 }
 
 void DeviceHandler::MakeDevice(const std::string& path, bool block, int major, int minor,
@@ -591,6 +669,8 @@ DeviceHandler::DeviceHandler(std::vector<Permissions> dev_permissions,
                              bool skip_restorecon)
     : dev_permissions_(std::move(dev_permissions)),
       sysfs_permissions_(std::move(sysfs_permissions)),
+      dev_permissions_matcher_(dev_permissions_),
+      sysfs_permissions_matcher_(sysfs_permissions_),
       subsystems_(std::move(subsystems)),
       boot_devices_(std::move(boot_devices)),
       skip_restorecon_(skip_restorecon),
@@ -23,6 +23,7 @@
 #include <algorithm>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/file.h>
@@ -37,6 +38,7 @@ namespace init {
 class Permissions {
   public:
     friend void TestPermissions(const Permissions& expected, const Permissions& test);
+    friend class PermissionsMatcher;
 
     Permissions(const std::string& name, mode_t perm, uid_t uid, gid_t gid, bool no_fnm_pathname);
 
@@ -74,6 +76,44 @@ class SysfsPermissions : public Permissions {
     const std::string attribute_;
 };
 
+// Finds the entries of a Permissions list that Match() a path, without trying each of them.
+// Exact names are looked up in a hash map.  Prefix names, and the literal part of wildcard names
+// before their first special character, are stored in a trie that the path is walked through, so
+// only wildcard names that share a literal prefix with the path are passed to fnmatch().
+class PermissionsMatcher {
+  public:
+    PermissionsMatcher() : nodes_(1) {}
+    template <typename T>
+    explicit PermissionsMatcher(const std::vector<T>& permissions) : PermissionsMatcher() {
+        for (size_t i = 0; i < permissions.size(); i++) {
+            Add(permissions[i], i);
+        }
+    }
+
+    // Appends the indices of all entries that match |path| to |matches|, in no particular order.
+    void Match(const std::string& path, std::vector<size_t>* matches) const;
+
+  private:
+    struct Wildcard {
+        size_t index;
+        std::string pattern;
+        int flags;
+    };
+    struct Node {
+        std::vector<std::pair<char, size_t>> children;
+        // Prefix entries whose name ends at this node.
+        std::vector<size_t> prefixes;
+        // Wildcard entries whose literal prefix ends at this node.
+        std::vector<Wildcard> wildcards;
+    };
+
+    void Add(const Permissions& permissions, size_t index);
+    size_t FindChild(size_t node, char c) const;
+
+    std::unordered_map<std::string, std::vector<size_t>> exact_;
+    std::vector<Node> nodes_;
+};
+
 class Subsystem {
   public:
     friend class SubsystemParser;
@@ -119,6 +159,7 @@ class DeviceHandler : public UeventHandler {
 
     void HandleUevent(const Uevent& uevent) override;
     void ColdbootDone() override;
+    std::string Name() const override { return "device"; }
 
     std::vector<std::string> GetBlockDeviceSymlinks(const Uevent& uevent) const;
 
@@ -141,6 +182,8 @@ class DeviceHandler : public UeventHandler {
 
     std::vector<Permissions> dev_permissions_;
     std::vector<SysfsPermissions> sysfs_permissions_;
+    PermissionsMatcher dev_permissions_matcher_;
+    PermissionsMatcher sysfs_permissions_matcher_;
     std::vector<Subsystem> subsystems_;
     std::set<std::string> boot_devices_;
     bool skip_restorecon_;
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "devices.h"
+
+#include <string>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace init {
+
+// Device nodes seen during a coldboot, in uevent order.
+static const std::vector<std::string> kUeventTrace = [] {
+    std::vector<std::string> trace = {"/dev/null", "/dev/zero", "/dev/full", "/dev/ptmx",
+                                      "/dev/tty", "/dev/random", "/dev/urandom", "/dev/kmsg",
+                                      "/dev/binder", "/dev/hwbinder", "/dev/vndbinder",
+                                      "/dev/dri/card0", "/dev/dri/renderD128", "/dev/uinput",
+                                      "/dev/rtc0", "/dev/tun", "/dev/kvm", "/dev/vhost-vsock"};
+    for (int i = 0; i < 64; i++) trace.emplace_back(StringPrintf("/dev/tty%d", i));
+    for (int i = 0; i < 16; i++) trace.emplace_back(StringPrintf("/dev/input/event%d", i));
+    for (int i = 0; i < 32; i++) trace.emplace_back(StringPrintf("/dev/snd/pcmC0D%dp", i));
+    for (int i = 0; i < 128; i++) trace.emplace_back(StringPrintf("/dev/block/sda%d", i));
+    for (int i = 0; i < 64; i++) trace.emplace_back(StringPrintf("/dev/block/dm-%d", i));
+    for (int i = 0; i < 32; i++) trace.emplace_back(StringPrintf("/dev/block/loop%d", i));
+    return trace;
+}();
+
+// ueventd.rc, followed by a vendor ueventd.rc with a few hundred more entries.
+static std::vector<Permissions> MakePermissions() {
+    std::vector<Permissions> permissions = {
+            {"/dev/null", 0666, 0, 0, false},      {"/dev/zero", 0666, 0, 0, false},
+            {"/dev/full", 0666, 0, 0, false},      {"/dev/ptmx", 0666, 0, 0, false},
+            {"/dev/tty", 0666, 0, 0, false},       {"/dev/random", 0666, 0, 0, false},
+            {"/dev/urandom", 0666, 0, 0, false},   {"/dev/ashmem*", 0666, 0, 0, false},
+            {"/dev/binder", 0666, 0, 0, false},    {"/dev/hwbinder", 0666, 0, 0, false},
+            {"/dev/vndbinder", 0666, 0, 0, false}, {"/dev/dri/*", 0666, 0, 1003, false},
+            {"/dev/uinput", 0660, 0, 0, false},    {"/dev/rtc0", 0640, 0, 0, false},
+            {"/dev/tty0", 0660, 0, 1000, false},   {"/dev/graphics/*", 0660, 0, 1003, false},
+            {"/dev/input/*", 0660, 0, 1004, false}, {"/dev/snd/*", 0660, 1000, 1005, false},
+            {"/dev/tun", 0660, 1000, 1016, false}, {"/dev/kvm", 0666, 0, 0, false},
+    };
+    for (int i = 0; i < 200; i++) {
+        permissions.emplace_back(StringPrintf("/dev/vendor_device%d", i), 0660, 1000, 1000,
+                                 false);
+    }
+    for (int i = 0; i < 50; i++) {
+        permissions.emplace_back(StringPrintf("/dev/vendor_class%d/*", i), 0660, 1000, 1000,
+                                 false);
+        permissions.emplace_back(StringPrintf("/dev/block/by-name/vendor%d_*", i), 0660, 1000,
+                                 1000, false);
+        permissions.emplace_back(StringPrintf("/dev/vendor%d/node*_ctl", i), 0660, 1000, 1000,
+                                 false);
+    }
+    return permissions;
+}
+
+static void BM_PermissionsLinear(benchmark::State& state) {
+    auto permissions = MakePermissions();
+    for (auto _ : state) {
+        for (const auto& path : kUeventTrace) {
+            for (auto it = permissions.crbegin(); it != permissions.crend(); ++it) {
+                if (it->Match(path)) {
+                    benchmark::DoNotOptimize(it->perm());
+                    break;
+                }
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kUeventTrace.size());
+}
+BENCHMARK(BM_PermissionsLinear);
+
+static void BM_PermissionsMatcher(benchmark::State& state) {
+    auto permissions = MakePermissions();
+    PermissionsMatcher matcher(permissions);
+    std::vector<size_t> matches;
+    for (auto _ : state) {
+        for (const auto& path : kUeventTrace) {
+            matches.clear();
+            matcher.Match(path, &matches);
+            if (!matches.empty()) {
+                benchmark::DoNotOptimize(
+                        permissions[*std::max_element(matches.begin(), matches.end())].perm());
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kUeventTrace.size());
+}
+BENCHMARK(BM_PermissionsMatcher);
+
+}  // namespace init
+}  // namespace android
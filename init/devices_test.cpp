@@ -328,5 +328,35 @@ TEST(device_handler, SysfsPermissionsMatchWithSubsystemBus) {
     EXPECT_EQ(1001U, permissions.gid());
 }
 
+TEST(device_handler, PermissionsMatcher) {
+    std::vector<Permissions> permissions = {
+            {"/dev/null", 0666, 0, 0, false},
+            {"/dev/dri/*", 0666, 0, 1000, false},
+            {"/dev/device*name", 0666, 0, 1000, false},
+            {"/dev/device*name*", 0666, 0, 1000, false},
+            {"/dev/device*name*", 0666, 0, 1000, true},
+            {"/dev/null", 0660, 0, 1000, false},
+            {"/dev/*", 0600, 0, 0, false},
+            {"/dev/tty[0-9]*", 0620, 0, 0, false},
+            {"*", 0600, 0, 0, false},
+    };
+    PermissionsMatcher matcher(permissions);
+
+    for (const auto& path :
+         {"/dev/null", "/dev/nul", "/dev/nullsuffix", "/dev/dri/card0", "/dev/dri/", "/dev/dr",
+          "/dev/devicename", "/dev/device123name", "/dev/device123name/something",
+          "/dev/device/1/2/3name/something", "/dev/deviceame", "/dev/tty1", "/dev/ttyS1", "",
+          "/sys/devices"}) {
+        std::vector<size_t> expected;
+        for (size_t i = 0; i < permissions.size(); i++) {
+            if (permissions[i].Match(path)) expected.emplace_back(i);
+        }
+        std::vector<size_t> matches;
+        matcher.Match(path, &matches);
+        std::sort(matches.begin(), matches.end());
+        EXPECT_EQ(expected, matches) << path;
+    }
+}
+
 }  // namespace init
 }  // namespace android
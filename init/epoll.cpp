@@ -40,7 +40,7 @@ Result<void> Epoll::Open() {
     return {};
 }
 
-Result<void> Epoll::RegisterHandler(int fd, Handler handler, uint32_t events) {
+Result<void> Epoll::RegisterHandler(int fd, Handler handler, uint32_t events, Priority priority) {
     if (!events) {
         return Error() << "Must specify events";
     }
@@ -49,6 +49,7 @@ Result<void> Epoll::RegisterHandler(int fd, Handler handler, uint32_t events) {
             fd, Info{
                         .events = events,
                         .handler = std::move(handler),
+                        .priority = priority,
                 });
     if (!inserted) {
         return Error() << "Cannot specify two epoll handlers for a given FD";
@@ -95,23 +96,25 @@ Result<int> Epoll::Wait(std::optional<std::chrono::milliseconds> timeout) {
     if (num_events > 0 && first_callback_) {
         first_callback_();
     }
-    for (int i = 0; i < num_events; ++i) {
-        const auto it = epoll_handlers_.find(ev[i].data.fd);
-        if (it == epoll_handlers_.end()) {
-            continue;
+    for (auto priority : {Priority::kHigh, Priority::kNormal}) {
+        for (int i = 0; i < num_events; ++i) {
+            const auto it = epoll_handlers_.find(ev[i].data.fd);
+            if (it == epoll_handlers_.end() || it->second.priority != priority) {
+                continue;
+            }
+            const Info& info = it->second;
+            if ((info.events & (EPOLLIN | EPOLLPRI)) == (EPOLLIN | EPOLLPRI) &&
+                (ev[i].events & EPOLLIN) != ev[i].events) {
+                // This handler wants to know about exception events, and just got one.
+                // Log something informational.
+                LOG(ERROR) << "Received unexpected epoll event set: " << ev[i].events;
+            }
+            info.handler();
+            for (auto fd : to_remove_) {
+                epoll_handlers_.erase(fd);
+            }
+            to_remove_.clear();
         }
-        const Info& info = it->second;
-        if ((info.events & (EPOLLIN | EPOLLPRI)) == (EPOLLIN | EPOLLPRI) &&
-            (ev[i].events & EPOLLIN) != ev[i].events) {
-            // This handler wants to know about exception events, and just got one.
-            // Log something informational.
-            LOG(ERROR) << "Received unexpected epoll event set: " << ev[i].events;
-        }
-        info.handler();
-        for (auto fd : to_remove_) {
-            epoll_handlers_.erase(fd);
-        }
-        to_remove_.clear();
     }
     return num_events;
 }
@@ -40,8 +40,16 @@ class Epoll {
 
     typedef std::function<void()> Handler;
 
+    // Within a single Wait(), handlers for ready FDs are called in priority order, and in the
+    // order the kernel reported them within a priority.
+    enum class Priority {
+        kHigh,
+        kNormal,
+    };
+
     Result<void> Open();
-    Result<void> RegisterHandler(int fd, Handler handler, uint32_t events = EPOLLIN);
+    Result<void> RegisterHandler(int fd, Handler handler, uint32_t events = EPOLLIN,
+                                 Priority priority = Priority::kNormal);
     Result<void> UnregisterHandler(int fd);
     void SetFirstCallback(std::function<void()> first_callback);
     Result<int> Wait(std::optional<std::chrono::milliseconds> timeout);
@@ -50,6 +58,7 @@ class Epoll {
     struct Info {
         Handler handler;
         uint32_t events;
+        Priority priority;
     };
 
     android::base::unique_fd epoll_fd_;
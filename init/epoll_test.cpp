@@ -18,7 +18,9 @@
 
 #include <sys/unistd.h>
 
+#include <string>
 #include <unordered_set>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -66,5 +68,29 @@ TEST(epoll, UnregisterHandler) {
     ASSERT_TRUE(handler_invoked);
 }
 
+TEST(epoll, Priority) {
+    Epoll epoll;
+    ASSERT_RESULT_OK(epoll.Open());
+
+    int normal_fds[2], high_fds[2];
+    ASSERT_EQ(pipe(normal_fds), 0);
+    ASSERT_EQ(pipe(high_fds), 0);
+
+    std::vector<std::string> order;
+    ASSERT_RESULT_OK(epoll.RegisterHandler(normal_fds[0], [&] { order.emplace_back("normal"); }));
+    ASSERT_RESULT_OK(epoll.RegisterHandler(
+            high_fds[0], [&] { order.emplace_back("high"); }, EPOLLIN, Epoll::Priority::kHigh));
+
+    // Make the normal priority FD ready first, so the kernel reports it first.
+    uint8_t byte = 0xee;
+    ASSERT_TRUE(android::base::WriteFully(normal_fds[1], &byte, sizeof(byte)));
+    ASSERT_TRUE(android::base::WriteFully(high_fds[1], &byte, sizeof(byte)));
+
+    auto epoll_result = epoll.Wait({});
+    ASSERT_RESULT_OK(epoll_result);
+    ASSERT_EQ(*epoll_result, 2);
+    EXPECT_EQ(order, (std::vector<std::string>{"high", "normal"}));
+}
+
 }  // namespace init
 }  // namespace android
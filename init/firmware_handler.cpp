@@ -67,14 +67,27 @@ static void LoadFirmware(const std::string& firmware, const std::string& root, i
     // Start transfer.
     WriteFully(loading_fd, "1", 1);
 
-    // Copy the firmware.
-    int rc = sendfile(data_fd, fw_fd, nullptr, fw_size);
-    if (rc == -1) {
-        PLOG(ERROR) << "firmware: sendfile failed { '" << root << "', '" << firmware << "' }";
+    // Copy the firmware. sendfile() may copy less than requested, so keep going until all of it
+    // is in, rather than committing a truncated image.
+    off_t offset = 0;
+    bool copied = true;
+    while (static_cast<size_t>(offset) < fw_size) {
+        ssize_t rc = TEMP_FAILURE_RETRY(sendfile(data_fd, fw_fd, &offset, fw_size - offset));
+        if (rc == -1) {
+            PLOG(ERROR) << "firmware: sendfile failed { '" << root << "', '" << firmware << "' }";
+            copied = false;
+            break;
+        }
+        if (rc == 0) {
+            LOG(ERROR) << "firmware: short read at " << offset << " of " << fw_size << " { '"
+                       << root << "', '" << firmware << "' }";
+            copied = false;
+            break;
+        }
     }
 
     // Tell the firmware whether to abort or commit.
-    const char* response = (rc != -1) ? "0" : "-1";
+    const char* response = copied ? "0" : "-1";
     WriteFully(loading_fd, response, strlen(response));
 }
 
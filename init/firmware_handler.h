@@ -49,6 +49,7 @@ class FirmwareHandler : public UeventHandler {
     virtual ~FirmwareHandler() = default;
 
     void HandleUevent(const Uevent& uevent) override;
+    std::string Name() const override { return "firmware"; }
 
   private:
     friend void FirmwareTestWithExternalHandler(const std::string& test_name,
@@ -425,6 +425,7 @@ int FirstStageMain(int argc, char** argv) {
     dup2(fd, STDOUT_FILENO);
     dup2(fd, STDERR_FILENO);
     close(fd);
+    KeepSnapuserdOpIndexesAcrossExec();
     execv(path, const_cast<char**>(args));
 
     // execv() only returns if an error happened, in which case we
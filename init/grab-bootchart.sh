@@ -16,6 +16,10 @@ FILES="header proc_stat.log proc_ps.log proc_diskstats.log"
 for f in $FILES; do
     adb "${@}" pull $LOGROOT/$f $TMPDIR/$f 2>&1 > /dev/null
 done
+# In binary mode, the text logs come from bootchart.bin instead.
+if adb "${@}" pull $LOGROOT/bootchart.bin $TMPDIR/bootchart.bin > /dev/null 2>&1; then
+    python3 $(dirname $0)/convert-bootchart.py $TMPDIR/bootchart.bin $TMPDIR
+fi
 (cd $TMPDIR && tar -czf $TARBALL $FILES)
 pybootchartgui ${TMPDIR}/${TARBALL}
 xdg-open ${TARBALL%.tgz}.png
@@ -67,6 +67,7 @@
 #include "action.h"
 #include "action_manager.h"
 #include "action_parser.h"
+#include "action_profiler.h"
 #include "apex_init_util.h"
 #include "epoll.h"
 #include "first_stage_init.h"
@@ -145,7 +146,9 @@ static void InstallInitNotifier(Epoll* epoll) {
         TEMP_FAILURE_RETRY(read(wake_main_thread_fd, &counter, sizeof(counter)));
     };
 
-    if (auto result = epoll->RegisterHandler(wake_main_thread_fd, clear_eventfd); !result.ok()) {
+    if (auto result = epoll->RegisterHandler(wake_main_thread_fd, clear_eventfd, EPOLLIN,
+                                             Epoll::Priority::kHigh);
+        !result.ok()) {
         LOG(FATAL) << result.error();
     }
 }
@@ -265,6 +268,7 @@ static class ShutdownState {
 void DumpState() {
     ServiceList::GetInstance().DumpState();
     ActionManager::GetInstance().DumpState();
+    DumpProfilerState();
 }
 
 Parser CreateParser(ActionManager& action_manager, ServiceList& service_list) {
@@ -339,6 +343,9 @@ static void LoadBootScripts(ActionManager& action_manager, ServiceList& service_
 
     std::string bootscript = GetProperty("ro.boot.init_rc", "");
     if (bootscript.empty()) {
+        parser.PrefetchConfigs({"/system/etc/init/hw/init.rc", "/system/etc/init",
+                                "/system_ext/etc/init", "/vendor/etc/init", "/odm/etc/init",
+                                "/product/etc/init"});
         parser.ParseConfig("/system/etc/init/hw/init.rc");
         if (!parser.ParseConfig("/system/etc/init")) {
             late_import_paths.emplace_back("/system/etc/init");
@@ -379,17 +386,36 @@ void PropertyChanged(const std::string& name, const std::string& value) {
     prop_waiter_state.CheckAndResetWait(name, value);
 }
 
+// Like PropertyChanged(), but queues the triggers for all of |changes| at once.
+void PropertiesChanged(const std::vector<std::pair<std::string, std::string>>& changes) {
+    for (const auto& [name, value] : changes) {
+        if (name == "sys.powerctl") {
+            trigger_shutdown(value);
+        }
+    }
+
+    if (property_triggers_enabled && !changes.empty()) {
+        ActionManager::GetInstance().QueuePropertyChanges(changes);
+        WakeMainInitThread();
+    }
+
+    for (const auto& [name, value] : changes) {
+        prop_waiter_state.CheckAndResetWait(name, value);
+    }
+}
+
 static std::optional<boot_clock::time_point> HandleProcessActions() {
-    std::optional<boot_clock::time_point> next_process_action_time;
-    for (const auto& s : ServiceList::GetInstance()) {
+    auto& service_list = ServiceList::GetInstance();
+    for (const auto& name : service_list.TakeDueProcessActions(boot_clock::now())) {
+        Service* s = service_list.FindService(name);
+        if (!s) continue;
+
         if ((s->flags() & SVC_RUNNING) && s->timeout_period()) {
             auto timeout_time = s->time_started() + *s->timeout_period();
             if (boot_clock::now() > timeout_time) {
                 s->Timeout();
             } else {
-                if (!next_process_action_time || timeout_time < *next_process_action_time) {
-                    next_process_action_time = timeout_time;
-                }
+                service_list.ScheduleProcessAction(*s, timeout_time);
             }
         }
 
@@ -401,12 +427,10 @@ static std::optional<boot_clock::time_point> HandleProcessActions() {
                 LOG(ERROR) << "Could not restart process '" << s->name() << "': " << result.error();
             }
         } else {
-            if (!next_process_action_time || restart_time < *next_process_action_time) {
-                next_process_action_time = restart_time;
-            }
+            service_list.ScheduleProcessAction(*s, restart_time);
         }
     }
-    return next_process_action_time;
+    return service_list.NextProcessActionTime();
 }
 
 static Result<void> DoControlStart(Service* service) {
@@ -646,6 +670,10 @@ static Result<void> SetupCgroupsAction(const BuiltinArguments&) {
     if (!CgroupSetup()) {
         return ErrnoError() << "Failed to setup cgroups";
     }
+    // Spare every other process the parsing of the task profiles JSON files.
+    if (!CompileTaskProfiles()) {
+        LOG(WARNING) << "Failed to compile task profiles";
+    }
 
     return {};
 }
@@ -714,23 +742,31 @@ static void HandleSigtermSignal(const signalfd_siginfo& siginfo) {
 }
 
 static void HandleSignalFd() {
-    signalfd_siginfo siginfo;
-    ssize_t bytes_read = TEMP_FAILURE_RETRY(read(signal_fd, &siginfo, sizeof(siginfo)));
-    if (bytes_read != sizeof(siginfo)) {
+    // Read all pending signals at once, so that SIGCHLD is handled with a single pass over the
+    // zombies however many signals woke us up.
+    signalfd_siginfo siginfos[8];
+    ssize_t bytes_read = TEMP_FAILURE_RETRY(read(signal_fd, siginfos, sizeof(siginfos)));
+    if (bytes_read <= 0 || bytes_read % sizeof(siginfos[0]) != 0) {
         PLOG(ERROR) << "Failed to read siginfo from signal_fd";
         return;
     }
 
-    switch (siginfo.ssi_signo) {
-        case SIGCHLD:
-            ReapAnyOutstandingChildren();
-            break;
-        case SIGTERM:
-            HandleSigtermSignal(siginfo);
-            break;
-        default:
-            LOG(ERROR) << "signal_fd: received unexpected signal " << siginfo.ssi_signo;
-            break;
+    bool reap = false;
+    for (size_t i = 0; i < bytes_read / sizeof(siginfos[0]); ++i) {
+        switch (siginfos[i].ssi_signo) {
+            case SIGCHLD:
+                reap = true;
+                break;
+            case SIGTERM:
+                HandleSigtermSignal(siginfos[i]);
+                break;
+            default:
+                LOG(ERROR) << "signal_fd: received unexpected signal " << siginfos[i].ssi_signo;
+                break;
+        }
+    }
+    if (reap) {
+        ReapAnyOutstandingChildren();
     }
 }
 
@@ -780,7 +816,9 @@ static void InstallSignalFdHandler(Epoll* epoll) {
     }
 
     constexpr int flags = EPOLLIN | EPOLLPRI;
-    if (auto result = epoll->RegisterHandler(signal_fd, HandleSignalFd, flags); !result.ok()) {
+    if (auto result =
+                epoll->RegisterHandler(signal_fd, HandleSignalFd, flags, Epoll::Priority::kHigh);
+        !result.ok()) {
         LOG(FATAL) << result.error();
     }
 }
@@ -875,6 +913,14 @@ void SendLoadPersistentPropertiesMessage() {
     }
 }
 
+void SendPrefetchPersistentPropertiesMessage() {
+    auto init_message = InitMessage{};
+    init_message.set_prefetch_persistent_properties(true);
+    if (auto result = SendMessage(property_fd, init_message); !result.ok()) {
+        LOG(ERROR) << "Failed to send prefetch persistent properties message: " << result.error();
+    }
+}
+
 static Result<void> ConnectEarlyStageSnapuserdAction(const BuiltinArguments& args) {
     auto pid = GetSnapuserdFirstStagePid();
     if (!pid) {
@@ -1028,6 +1074,7 @@ int SecondStageMain(int argc, char** argv) {
     }
 
     InitializeSubcontext();
+    StartProfilingIfRequested();
 
     ActionManager& am = ActionManager::GetInstance();
     ServiceList& sm = ServiceList::GetInstance();
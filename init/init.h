@@ -38,8 +38,10 @@ void DumpState();
 void ResetWaitForProp();
 
 void SendLoadPersistentPropertiesMessage();
+void SendPrefetchPersistentPropertiesMessage();
 
 void PropertyChanged(const std::string& name, const std::string& value);
+void PropertiesChanged(const std::vector<std::pair<std::string, std::string>>& changes);
 bool QueueControlMessage(const std::string& message, const std::string& name, pid_t pid, int fd);
 
 int SecondStageMain(int argc, char** argv);
@@ -176,6 +176,57 @@ execute_third
     EXPECT_EQ(3, num_executed);
 }
 
+TEST(init, PropertyTriggerOrder) {
+    std::string init_script =
+            R"init(
+on property:init.test.a=*
+execute_first
+
+on property:init.test.b=1
+execute_never
+
+on property:init.test.a=1
+execute_second
+
+on boot
+execute_never
+
+on property:init.test.a=2
+execute_never
+)init";
+
+    int num_executed = 0;
+    auto do_execute_first = [&num_executed](const BuiltinArguments&) {
+        EXPECT_EQ(0, num_executed++);
+        return Result<void>{};
+    };
+    auto do_execute_second = [&num_executed](const BuiltinArguments&) {
+        EXPECT_EQ(1, num_executed++);
+        return Result<void>{};
+    };
+    auto do_execute_never = [](const BuiltinArguments&) {
+        ADD_FAILURE();
+        return Result<void>{};
+    };
+
+    BuiltinFunctionMap test_function_map = {
+            {"execute_first", {0, 0, {false, do_execute_first}}},
+            {"execute_second", {0, 0, {false, do_execute_second}}},
+            {"execute_never", {0, 0, {false, do_execute_never}}},
+    };
+
+    ActionManagerCommand change_property = [](ActionManager& am) {
+        am.QueuePropertyChange("init.test.a", "1");
+        am.QueuePropertyChange("init.test.c", "1");
+    };
+    std::vector<ActionManagerCommand> commands{change_property};
+
+    ActionManager action_manager;
+    ServiceList service_list;
+    TestInitText(init_script, test_function_map, commands, &action_manager, &service_list);
+    EXPECT_EQ(2, num_executed);
+}
+
 TEST(init, OverrideService) {
     std::string init_script = R"init(
 service A something
@@ -523,6 +574,52 @@ TEST(init, EventTriggerOrderMultipleFiles) {
     EXPECT_EQ(6, num_executed);
 }
 
+TEST(init, EventTriggerOrderPrefetchedFiles) {
+    // Files are still parsed in the order that they're imported, whatever order they were
+    // prefetched in.
+    TemporaryFile first_import;
+    ASSERT_TRUE(first_import.fd != -1);
+    ASSERT_TRUE(android::base::WriteStringToFd("on boot\nexecute 2", first_import.fd));
+
+    TemporaryDir dir;
+    ASSERT_RESULT_OK(WriteFile(std::string(dir.path) + "/a.rc", "on boot\nexecute 3"));
+    ASSERT_RESULT_OK(WriteFile(std::string(dir.path) + "/b.rc", "on boot\n\n\nexecute 4"));
+
+    // clang-format off
+    std::string start_script = "import " + std::string(first_import.path) + "\n"
+                               "import " + std::string(dir.path) + "\n"
+                               "on boot\n"
+                               "execute 1";
+    // clang-format on
+    TemporaryFile start;
+    ASSERT_TRUE(android::base::WriteStringToFd(start_script, start.fd));
+
+    int num_executed = 0;
+    auto execute_command = [&num_executed](const BuiltinArguments& args) {
+        EXPECT_EQ(2U, args.size());
+        EXPECT_EQ(++num_executed, std::stoi(args[1]));
+        return Result<void>{};
+    };
+    BuiltinFunctionMap test_function_map = {
+            {"execute", {1, 1, {false, execute_command}}},
+    };
+    Action::set_function_map(&test_function_map);
+
+    ActionManager action_manager;
+    Parser parser;
+    parser.AddSectionParser("on", std::make_unique<ActionParser>(&action_manager, nullptr));
+    parser.AddSectionParser("import", std::make_unique<ImportParser>(&parser));
+    parser.PrefetchConfigs({dir.path, first_import.path, start.path});
+    ASSERT_TRUE(parser.ParseConfig(start.path));
+    EXPECT_EQ(0U, parser.parse_error_count());
+
+    action_manager.QueueEventTrigger("boot");
+    while (action_manager.HasMoreCommands()) {
+        action_manager.ExecuteOneCommand();
+    }
+    EXPECT_EQ(4, num_executed);
+}
+
 BuiltinFunctionMap GetTestFunctionMapForLazyLoad(int& num_executed, ActionManager& action_manager) {
     auto execute_command = [&num_executed](const BuiltinArguments& args) {
         EXPECT_EQ(2U, args.size());
@@ -16,8 +16,9 @@
 
 #pragma once
 
-#include <map>
+#include <limits>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "result.h"
@@ -57,7 +58,7 @@ class KeywordMap {
             return Errorf("Invalid keyword '{}'", keyword);
         }
 
-        auto result = result_it->second;
+        const auto& result = result_it->second;
 
         auto min_args = result.min_args;
         auto max_args = result.max_args;
@@ -80,7 +81,8 @@ class KeywordMap {
     }
 
   private:
-    std::map<std::string, MapValue> map_;
+    // Looked up once per line of every rc file; the order of the keywords does not matter.
+    std::unordered_map<std::string, MapValue> map_;
 };
 
 }  // namespace init
@@ -18,6 +18,9 @@
 
 #include <errno.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <android-base/logging.h>
 #include <liblmkd_utils.h>
 
@@ -34,31 +37,68 @@ enum LmkdRegistrationResult {
 
 static int lmkd_socket = -1;
 
-static LmkdRegistrationResult RegisterProcess(uid_t uid, pid_t pid, int oom_score_adjust) {
-    // connect to lmkd if not already connected
-    if (lmkd_socket < 0) {
-        lmkd_socket = lmkd_connect();
-        if (lmkd_socket < 0) {
-            return LMKD_CONN_FAILED;
-        }
-    }
+// registrations deferred between LmkdBeginBatch() and LmkdEndBatch()
+static bool batching = false;
+static std::vector<struct lmk_procprio> pending_procs;
 
-    // register service with lmkd
+static struct lmk_procprio MakeProcPrio(uid_t uid, pid_t pid, int oom_score_adjust) {
     struct lmk_procprio params;
     params.pid = pid;
     params.uid = uid;
     params.oomadj = oom_score_adjust;
     params.ptype = PROC_TYPE_SERVICE;
+    return params;
+}
+
+static bool ConnectLmkd() {
+    // connect to lmkd if not already connected
+    if (lmkd_socket < 0) {
+        lmkd_socket = lmkd_connect();
+    }
+    return lmkd_socket >= 0;
+}
+
+static void ResetConnection() {
+    close(lmkd_socket);
+    lmkd_socket = -1;
+}
+
+static LmkdRegistrationResult RegisterProcess(uid_t uid, pid_t pid, int oom_score_adjust) {
+    if (!ConnectLmkd()) {
+        return LMKD_CONN_FAILED;
+    }
+
+    // register service with lmkd
+    struct lmk_procprio params = MakeProcPrio(uid, pid, oom_score_adjust);
     if (lmkd_register_proc(lmkd_socket, &params) != 0) {
         // data transfer failed, reset the connection
-        close(lmkd_socket);
-        lmkd_socket = -1;
+        ResetConnection();
         return LMKD_REG_FAILED;
     }
 
     return LMKD_REG_SUCCESS;
 }
 
+// Registers |procs| using as few LMK_PROCS_PRIO packets as possible.
+static LmkdRegistrationResult RegisterProcesses(const std::vector<struct lmk_procprio>& procs) {
+    if (!ConnectLmkd()) {
+        return LMKD_CONN_FAILED;
+    }
+
+    for (size_t i = 0; i < procs.size(); i += PROCS_PRIO_MAX_RECORD_COUNT) {
+        size_t count = std::min(procs.size() - i, static_cast<size_t>(PROCS_PRIO_MAX_RECORD_COUNT));
+        struct lmk_procs_prio params;
+        std::copy(procs.begin() + i, procs.begin() + i + count, params.procs);
+        if (lmkd_register_procs(lmkd_socket, &params, count) != 0) {
+            // data transfer failed, reset the connection
+            ResetConnection();
+            return LMKD_REG_FAILED;
+        }
+    }
+
+    return LMKD_REG_SUCCESS;
+}
+
 static bool UnregisterProcess(pid_t pid) {
     if (lmkd_socket < 0) {
         // no connection or it was lost, no need to unregister
@@ -70,8 +110,7 @@ static bool UnregisterProcess(pid_t pid) {
     params.pid = pid;
     if (lmkd_unregister_proc(lmkd_socket, &params) != 0) {
         // data transfer failed, reset the connection
-        close(lmkd_socket);
-        lmkd_socket = -1;
+        ResetConnection();
         return false;
     }
 
@@ -79,6 +118,7 @@ static bool UnregisterProcess(pid_t pid) {
 }
 
 static void RegisterServices(pid_t exclude_pid) {
+    std::vector<struct lmk_procprio> procs;
     for (const auto& service : ServiceList::GetInstance()) {
         auto svc = service.get();
         if (svc->oom_score_adjust() != DEFAULT_OOM_SCORE_ADJUST) {
@@ -86,16 +126,21 @@ static void RegisterServices(pid_t exclude_pid) {
             if (svc->pid() == exclude_pid || svc->pid() == 0) {
                 continue;
             }
-            if (RegisterProcess(svc->uid(), svc->pid(), svc->oom_score_adjust()) !=
-                LMKD_REG_SUCCESS) {
-                // a failure here resets the connection, will retry during next registration
-                break;
-            }
+            procs.push_back(MakeProcPrio(svc->uid(), svc->pid(), svc->oom_score_adjust()));
         }
     }
+    if (!procs.empty()) {
+        // a failure here resets the connection, will retry during next registration
+        RegisterProcesses(procs);
+    }
 }
 
 void LmkdRegister(const std::string& name, uid_t uid, pid_t pid, int oom_score_adjust) {
+    if (batching) {
+        pending_procs.push_back(MakeProcPrio(uid, pid, oom_score_adjust));
+        return;
+    }
+
     bool new_connection = lmkd_socket == -1;
     LmkdRegistrationResult result;
 
@@ -121,7 +166,53 @@ void LmkdRegister(const std::string& name, uid_t uid, pid_t pid, int oom_score_a
     }
 }
 
+void LmkdBeginBatch() {
+    batching = true;
+}
+
+void LmkdEndBatch() {
+    batching = false;
+    if (pending_procs.empty()) {
+        return;
+    }
+
+    std::vector<struct lmk_procprio> procs;
+    procs.swap(pending_procs);
+
+    // A new connection gets every running service, which includes this batch.
+    if (lmkd_socket < 0) {
+        if (!ConnectLmkd()) {
+            PLOG(ERROR) << "lmkd connection failed when registering " << procs.size()
+                        << " processes";
+            return;
+        }
+        RegisterServices(0);
+        return;
+    }
+
+    LmkdRegistrationResult result = RegisterProcesses(procs);
+    if (result == LMKD_REG_FAILED) {
+        // retry one time if connection to lmkd was lost, replaying all services
+        if (ConnectLmkd()) {
+            RegisterServices(0);
+            return;
+        }
+        result = LMKD_CONN_FAILED;
+    }
+    if (result == LMKD_CONN_FAILED) {
+        PLOG(ERROR) << "lmkd connection failed when registering " << procs.size() << " processes";
+    }
+}
+
 void LmkdUnregister(const std::string& name, pid_t pid) {
+    auto it = std::find_if(pending_procs.begin(), pending_procs.end(),
+                           [pid](const auto& proc) { return proc.pid == pid; });
+    if (it != pending_procs.end()) {
+        // never reached lmkd
+        pending_procs.erase(it);
+        return;
+    }
+
     if (!UnregisterProcess(pid)) {
         PLOG(ERROR) << "lmkd failed to unregister " << name << " process";
     }
@@ -33,10 +33,17 @@ static const int DEFAULT_OOM_SCORE_ADJUST = MIN_OOM_SCORE_ADJUST;
 void LmkdRegister(const std::string& name, uid_t uid, pid_t pid, int oom_score_adjust);
 void LmkdUnregister(const std::string& name, pid_t pid);
 
+// Between these calls, LmkdRegister() only queues the process; LmkdEndBatch()
+// sends everything queued to lmkd in batched LMK_PROCS_PRIO packets.
+void LmkdBeginBatch();
+void LmkdEndBatch();
+
 #else  // defined(__ANDROID__)
 
 static inline void LmkdRegister(const std::string&, uid_t, pid_t, int) {}
 static inline void LmkdUnregister(const std::string&, pid_t) {}
+static inline void LmkdBeginBatch() {}
+static inline void LmkdEndBatch() {}
 
 #endif  // defined(__ANDROID__)
 
@@ -33,6 +33,7 @@ class ModaliasHandler : public UeventHandler {
     virtual ~ModaliasHandler() = default;
 
     void HandleUevent(const Uevent& uevent) override;
+    std::string Name() const override { return "modalias"; }
 
   private:
     Modprobe modprobe_;
@@ -18,6 +18,7 @@
 
 #include <dirent.h>
 
+#include <atomic>
 #include <map>
 
 #include <android-base/chrono_utils.h>
@@ -34,6 +35,12 @@ namespace init {
 
 Parser::Parser() {}
 
+Parser::~Parser() {
+    for (auto& thread : prefetch_threads_) {
+        thread.join();
+    }
+}
+
 void Parser::AddSectionParser(const std::string& name, std::unique_ptr<SectionParser> parser) {
     section_parsers_[name] = std::move(parser);
 }
@@ -42,7 +49,7 @@ void Parser::AddSingleLineParser(const std::string& prefix, LineCallback callbac
     line_callbacks_.emplace_back(prefix, std::move(callback));
 }
 
-void Parser::ParseData(const std::string& filename, std::string* data) {
+Parser::TokenizedConfig Parser::Tokenize(std::string* data) {
     data->push_back('\n');
     data->push_back('\0');
 
@@ -51,9 +58,33 @@ void Parser::ParseData(const std::string& filename, std::string* data) {
     state.ptr = data->data();
     state.nexttoken = 0;
 
+    TokenizedConfig config;
+    std::vector<std::string> args;
+    for (;;) {
+        switch (next_token(&state)) {
+            case T_EOF:
+                return config;
+            case T_NEWLINE:
+                state.line++;
+                if (!args.empty()) {
+                    config.emplace_back(TokenizedLine{state.line, std::move(args)});
+                    args.clear();
+                }
+                break;
+            case T_TEXT:
+                args.emplace_back(state.text);
+                break;
+        }
+    }
+}
+
+void Parser::ParseData(const std::string& filename, std::string* data) {
+    ParseTokens(filename, Tokenize(data));
+}
+
+void Parser::ParseTokens(const std::string& filename, TokenizedConfig&& config) {
     SectionParser* section_parser = nullptr;
     int section_start_line = -1;
-    std::vector<std::string> args;
 
     // If we encounter a bad section start, there is no valid parser object to parse the subsequent
     // sections, so we must suppress errors until the next valid section is found.
@@ -72,63 +103,86 @@ void Parser::ParseData(const std::string& filename, std::string* data) {
         section_start_line = -1;
     };
 
-    for (;;) {
-        switch (next_token(&state)) {
-            case T_EOF:
-                end_section();
+    for (auto& [line, args] : config) {
+        // If we have a line matching a prefix we recognize, call its callback and unset any
+        // current section parsers.  This is meant for /sys/ and /dev/ line entries for
+        // uevent.
+        auto line_callback = std::find_if(
+            line_callbacks_.begin(), line_callbacks_.end(),
+            [&args](const auto& c) { return android::base::StartsWith(args[0], c.first); });
+        if (line_callback != line_callbacks_.end()) {
+            end_section();
 
-                for (const auto& [section_name, section_parser] : section_parsers_) {
-                    section_parser->EndFile();
-                }
+            if (auto result = line_callback->second(std::move(args)); !result.ok()) {
+                parse_error_count_++;
+                LOG(ERROR) << filename << ": " << line << ": " << result.error();
+            }
+        } else if (auto it = section_parsers_.find(args[0]); it != section_parsers_.end()) {
+            end_section();
+            section_parser = it->second.get();
+            section_start_line = line;
+            if (auto result = section_parser->ParseSection(std::move(args), filename, line);
+                !result.ok()) {
+                parse_error_count_++;
+                LOG(ERROR) << filename << ": " << line << ": " << result.error();
+                section_parser = nullptr;
+                bad_section_found = true;
+            }
+        } else if (section_parser) {
+            if (auto result = section_parser->ParseLineSection(std::move(args), line);
+                !result.ok()) {
+                parse_error_count_++;
+                LOG(ERROR) << filename << ": " << line << ": " << result.error();
+            }
+        } else if (!bad_section_found) {
+            parse_error_count_++;
+            LOG(ERROR) << filename << ": " << line << ": Invalid section keyword found";
+        }
+    }
 
-                return;
-            case T_NEWLINE: {
-                state.line++;
-                if (args.empty()) break;
-                // If we have a line matching a prefix we recognize, call its callback and unset any
-                // current section parsers.  This is meant for /sys/ and /dev/ line entries for
-                // uevent.
-                auto line_callback = std::find_if(
-                    line_callbacks_.begin(), line_callbacks_.end(),
-                    [&args](const auto& c) { return android::base::StartsWith(args[0], c.first); });
-                if (line_callback != line_callbacks_.end()) {
-                    end_section();
-
-                    if (auto result = line_callback->second(std::move(args)); !result.ok()) {
-                        parse_error_count_++;
-                        LOG(ERROR) << filename << ": " << state.line << ": " << result.error();
-                    }
-                } else if (section_parsers_.count(args[0])) {
-                    end_section();
-                    section_parser = section_parsers_[args[0]].get();
-                    section_start_line = state.line;
-                    if (auto result =
-                                section_parser->ParseSection(std::move(args), filename, state.line);
-                        !result.ok()) {
-                        parse_error_count_++;
-                        LOG(ERROR) << filename << ": " << state.line << ": " << result.error();
-                        section_parser = nullptr;
-                        bad_section_found = true;
-                    }
-                } else if (section_parser) {
-                    if (auto result = section_parser->ParseLineSection(std::move(args), state.line);
-                        !result.ok()) {
-                        parse_error_count_++;
-                        LOG(ERROR) << filename << ": " << state.line << ": " << result.error();
-                    }
-                } else if (!bad_section_found) {
-                    parse_error_count_++;
-                    LOG(ERROR) << filename << ": " << state.line
-                               << ": Invalid section keyword found";
-                }
-                args.clear();
-                break;
+    end_section();
+
+    for (const auto& [section_name, section_parser] : section_parsers_) {
+        section_parser->EndFile();
+    }
+}
+
+void Parser::PrefetchConfigs(const std::vector<std::string>& paths) {
+    // Enough threads to keep a few reads in flight; the files are small.
+    static constexpr size_t kMaxPrefetchThreads = 4;
+
+    using Job = std::pair<std::string, std::promise<Result<TokenizedConfig>>>;
+    auto jobs = std::make_shared<std::vector<Job>>();
+    auto add_job = [this, &jobs](const std::string& file) {
+        if (prefetched_configs_.count(file)) return;
+        auto& job = jobs->emplace_back(file, std::promise<Result<TokenizedConfig>>());
+        prefetched_configs_.emplace(file, job.second.get_future());
+    };
+    for (const auto& path : paths) {
+        if (!is_dir(path.c_str())) {
+            add_job(path);
+        } else if (auto files = ListConfigDir(path)) {
+            for (const auto& file : *files) {
+                add_job(file);
             }
-            case T_TEXT:
-                args.emplace_back(state.text);
-                break;
         }
     }
+
+    auto next_job = std::make_shared<std::atomic<size_t>>(0);
+    auto num_threads = std::min(jobs->size(), kMaxPrefetchThreads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        prefetch_threads_.emplace_back([jobs, next_job] {
+            for (size_t i; (i = (*next_job)++) < jobs->size();) {
+                auto& [file, promise] = (*jobs)[i];
+                auto contents = ReadFile(file);
+                if (!contents.ok()) {
+                    promise.set_value(contents.error());
+                } else {
+                    promise.set_value(Tokenize(&*contents));
+                }
+            }
+        });
+    }
 }
 
 bool Parser::ParseConfigFileInsecure(const std::string& path, bool follow_symlinks = false) {
@@ -144,24 +198,29 @@ bool Parser::ParseConfigFileInsecure(const std::string& path, bool follow_symlin
 Result<void> Parser::ParseConfigFile(const std::string& path) {
     LOG(INFO) << "Parsing file " << path << "...";
     android::base::Timer t;
-    auto config_contents = ReadFile(path);
-    if (!config_contents.ok()) {
-        return Error() << "Unable to read config file '" << path
-                       << "': " << config_contents.error();
+    Result<TokenizedConfig> config;
+    if (auto it = prefetched_configs_.find(path); it != prefetched_configs_.end()) {
+        config = it->second.get();
+        prefetched_configs_.erase(it);
+    } else if (auto config_contents = ReadFile(path); config_contents.ok()) {
+        config = Tokenize(&config_contents.value());
+    } else {
+        config = config_contents.error();
+    }
+    if (!config.ok()) {
+        return Error() << "Unable to read config file '" << path << "': " << config.error();
     }
 
-    ParseData(path, &config_contents.value());
+    ParseTokens(path, std::move(*config));
 
     LOG(VERBOSE) << "(Parsing " << path << " took " << t << ".)";
     return {};
 }
 
-bool Parser::ParseConfigDir(const std::string& path) {
-    LOG(INFO) << "Parsing directory " << path << "...";
+std::optional<std::vector<std::string>> Parser::ListConfigDir(const std::string& path) {
     std::unique_ptr<DIR, decltype(&closedir)> config_dir(opendir(path.c_str()), closedir);
     if (!config_dir) {
-        PLOG(INFO) << "Could not import directory '" << path << "'";
-        return false;
+        return std::nullopt;
     }
     dirent* current_file;
     std::vector<std::string> files;
@@ -175,7 +234,17 @@ bool Parser::ParseConfigDir(const std::string& path) {
     }
     // Sort first so we load files in a consistent order (bug 31996208)
     std::sort(files.begin(), files.end());
-    for (const auto& file : files) {
+    return files;
+}
+
+bool Parser::ParseConfigDir(const std::string& path) {
+    LOG(INFO) << "Parsing directory " << path << "...";
+    auto files = ListConfigDir(path);
+    if (!files) {
+        PLOG(INFO) << "Could not import directory '" << path << "'";
+        return false;
+    }
+    for (const auto& file : *files) {
         if (auto result = ParseConfigFile(file); !result.ok()) {
             LOG(ERROR) << "could not import file '" << file << "': " << result.error();
         }
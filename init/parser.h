@@ -17,9 +17,12 @@
 #ifndef _INIT_PARSER_H_
 #define _INIT_PARSER_H_
 
+#include <future>
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "result.h"
@@ -70,6 +73,14 @@ class Parser {
     using LineCallback = std::function<Result<void>(std::vector<std::string>&&)>;
 
     Parser();
+    ~Parser();
+    Parser(Parser&&) = default;
+    Parser& operator=(Parser&&) = default;
+
+    // Starts reading and tokenizing the config files at |paths|, which may be directories as for
+    // ParseConfig(), on a few background threads.  A later ParseConfig() of one of those files
+    // then only needs to run the section parsers, which must still happen in order.
+    void PrefetchConfigs(const std::vector<std::string>& paths);
 
     bool ParseConfig(const std::string& path);
     Result<void> ParseConfigFile(const std::string& path);
@@ -82,12 +93,24 @@ class Parser {
     size_t parse_error_count() const { return parse_error_count_; }
 
   private:
+    struct TokenizedLine {
+        int line;
+        std::vector<std::string> args;
+    };
+    using TokenizedConfig = std::vector<TokenizedLine>;
+
+    static TokenizedConfig Tokenize(std::string* data);
+    static std::optional<std::vector<std::string>> ListConfigDir(const std::string& path);
     void ParseData(const std::string& filename, std::string* data);
+    void ParseTokens(const std::string& filename, TokenizedConfig&& config);
     bool ParseConfigDir(const std::string& path);
 
     std::map<std::string, std::unique_ptr<SectionParser>> section_parsers_;
     std::vector<std::pair<std::string, LineCallback>> line_callbacks_;
     size_t parse_error_count_ = 0;
+
+    std::map<std::string, std::future<Result<TokenizedConfig>>> prefetched_configs_;
+    std::vector<std::thread> prefetch_threads_;
 };
 
 }  // namespace init
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "parser.h"
+
+#include <unistd.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include "action_manager.h"
+#include "action_parser.h"
+#include "builtins.h"
+#include "service_list.h"
+#include "service_parser.h"
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace init {
+
+// The directories that LoadBootScripts() parses.
+static const std::vector<std::string> kBootScriptPaths = {
+        "/system/etc/init/hw/init.rc", "/system/etc/init", "/system_ext/etc/init",
+        "/vendor/etc/init",            "/odm/etc/init",    "/product/etc/init",
+};
+
+// Roughly the shape of a vendor's rc files: a few services with their options, and actions with a
+// handful of commands each.
+static std::string MakeScript(int index) {
+    std::string script;
+    for (int i = 0; i < 10; i++) {
+        script += StringPrintf("service vendor.service_%d_%d /vendor/bin/hw/service_%d --flag\n",
+                               index, i, i);
+        script += "    class hal\n";
+        script += "    user root\n";
+        script += "    group root system\n";
+        script += "    capabilities NET_ADMIN SYS_NICE\n";
+        script += "    task_profiles ProcessCapacityHigh MaxPerformance\n";
+        script += "    # services are disabled until their trigger\n";
+        script += "    disabled\n\n";
+    }
+    for (int i = 0; i < 20; i++) {
+        script += StringPrintf("on property:vendor.prop_%d_%d=1\n", index, i);
+        script += StringPrintf("    mkdir /data/vendor/dir_%d 0770 system system\n", i);
+        script += StringPrintf("    write /sys/devices/platform/dev_%d/enable \"1\"\n", i);
+        script += StringPrintf("    chown system system /sys/class/dev_%d/mode\n", i);
+        script += StringPrintf("    setprop vendor.ready_%d ${vendor.prop_%d_%d}\n", i, index, i);
+        script += StringPrintf("    start vendor.service_%d_%d\n\n", index, i % 10);
+    }
+    return script;
+}
+
+static void ParseScripts(const std::vector<std::string>& paths) {
+    ActionManager action_manager;
+    ServiceList service_list;
+    Parser parser;
+    parser.AddSectionParser("service",
+                            std::make_unique<ServiceParser>(&service_list, nullptr, std::nullopt));
+    parser.AddSectionParser("on", std::make_unique<ActionParser>(&action_manager, nullptr));
+    for (const auto& path : paths) {
+        parser.ParseConfig(path);
+    }
+    benchmark::DoNotOptimize(parser.parse_error_count());
+}
+
+static void BM_ParseScripts(benchmark::State& state) {
+    Action::set_function_map(&GetBuiltinFunctionMap());
+
+    TemporaryDir dir;
+    for (int i = 0; i < 50; i++) {
+        auto path = StringPrintf("%s/script_%02d.rc", dir.path, i);
+        if (!android::base::WriteStringToFile(MakeScript(i), path)) {
+            state.SkipWithError("could not write scripts");
+            return;
+        }
+    }
+    for (auto _ : state) {
+        ParseScripts({dir.path});
+    }
+}
+BENCHMARK(BM_ParseScripts)->Unit(benchmark::kMillisecond);
+
+// Parses the device's own boot scripts, when there are any.
+static void BM_ParseBootScripts(benchmark::State& state) {
+    if (access(kBootScriptPaths[0].c_str(), R_OK) != 0) {
+        state.SkipWithError("no boot scripts on this device");
+        return;
+    }
+    Action::set_function_map(&GetBuiltinFunctionMap());
+    for (auto _ : state) {
+        ParseScripts(kBootScriptPaths);
+    }
+}
+BENCHMARK(BM_ParseBootScripts)->Unit(benchmark::kMillisecond);
+
+}  // namespace init
+}  // namespace android
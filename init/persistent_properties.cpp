@@ -18,10 +18,12 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/system_properties.h>
 #include <sys/types.h>
 
+#include <future>
 #include <memory>
 
 #include <android-base/file.h>
@@ -46,6 +48,23 @@ namespace {
 
 constexpr const char kLegacyPersistentPropertyDir[] = "/data/property";
 
+// Updates are appended to a journal next to the property file, and folded into the property file
+// once the journal holds this many of them.
+constexpr size_t kMaxJournalEntries = 64;
+
+// The property file that the journal state below belongs to, and the number of entries in its
+// journal. Appending is only safe once the property file has been loaded or written by this
+// process, since the journal is replayed on top of it.
+std::string journal_property_filename;
+size_t journal_entries = 0;
+
+// Set by PrefetchPersistentProperties() and consumed by the next LoadPersistentPropertyFile().
+std::future<Result<PersistentProperties>> prefetched_properties;
+
+std::string JournalFilename() {
+    return persistent_property_filename + ".journal";
+}
+
 void AddPersistentProperty(const std::string& name, const std::string& value,
                            PersistentProperties* persistent_properties) {
     auto persistent_property_record = persistent_properties->add_properties();
@@ -53,6 +72,19 @@ void AddPersistentProperty(const std::string& name, const std::string& value,
     persistent_property_record->set_value(value);
 }
 
+void SetPersistentProperty(const std::string& name, const std::string& value,
+                           PersistentProperties* persistent_properties) {
+    auto it = std::find_if(persistent_properties->mutable_properties()->begin(),
+                           persistent_properties->mutable_properties()->end(),
+                           [&name](const auto& record) { return record.name() == name; });
+    if (it != persistent_properties->mutable_properties()->end()) {
+        it->set_name(name);
+        it->set_value(value);
+    } else {
+        AddPersistentProperty(name, value, persistent_properties);
+    }
+}
+
 Result<PersistentProperties> LoadLegacyPersistentProperties() {
     std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(kLegacyPersistentPropertyDir), closedir);
     if (!dir) {
@@ -169,18 +201,119 @@ Result<PersistentProperties> ParsePersistentPropertyFile(const std::string& file
     return persistent_properties;
 }
 
+// The journal is a sequence of entries, each a 32 bit length followed by a serialized
+// PersistentProperties holding the one property that was set. Entries are replayed in order on
+// top of the property file. An entry cut short by a crash is truncated away.
+Result<size_t> ReplayPersistentPropertyJournal(PersistentProperties* persistent_properties) {
+    const std::string journal_filename = JournalFilename();
+    unique_fd fd(TEMP_FAILURE_RETRY(
+            open(journal_filename.c_str(), O_RDWR | O_NOFOLLOW | O_CLOEXEC)));
+    if (fd == -1) {
+        if (errno == ENOENT) return 0;
+        return ErrnoError() << "Unable to open persistent property journal";
+    }
+    std::string journal;
+    if (!ReadFdToString(fd, &journal)) {
+        return ErrnoError() << "Unable to read persistent property journal";
+    }
+
+    size_t entries = 0;
+    size_t pos = 0;
+    while (pos < journal.size()) {
+        uint32_t length;
+        if (journal.size() - pos < sizeof(length)) break;
+        memcpy(&length, journal.data() + pos, sizeof(length));
+        if (journal.size() - pos - sizeof(length) < length) break;
+
+        PersistentProperties entry;
+        if (!entry.ParseFromArray(journal.data() + pos + sizeof(length), length) ||
+            entry.properties_size() != 1) {
+            break;
+        }
+        const auto& record = entry.properties(0);
+        if (!StartsWith(record.name(), "persist.")) {
+            return Error() << "Unable to load persistent property journal: property '"
+                           << record.name() << "' doesn't start with 'persist.'";
+        }
+        SetPersistentProperty(record.name(), record.value(), persistent_properties);
+        pos += sizeof(length) + length;
+        entries++;
+    }
+
+    if (pos != journal.size()) {
+        LOG(INFO) << "Discarding incomplete persistent property journal entry";
+        if (ftruncate(fd.get(), pos) == -1) {
+            return ErrnoError() << "Unable to truncate persistent property journal";
+        }
+    }
+    return entries;
+}
+
+Result<void> AppendPersistentPropertyJournal(const std::string& name, const std::string& value) {
+    PersistentProperties entry;
+    AddPersistentProperty(name, value, &entry);
+    std::string serialized_string;
+    if (!entry.SerializeToString(&serialized_string)) {
+        return Error() << "Unable to serialize property";
+    }
+    uint32_t length = serialized_string.size();
+    serialized_string.insert(0, reinterpret_cast<const char*>(&length), sizeof(length));
+
+    const std::string journal_filename = JournalFilename();
+    unique_fd fd(TEMP_FAILURE_RETRY(open(journal_filename.c_str(),
+                                         O_WRONLY | O_CREAT | O_APPEND | O_NOFOLLOW | O_CLOEXEC,
+                                         0600)));
+    if (fd == -1) {
+        return ErrnoError() << "Could not open persistent property journal";
+    }
+    if (!WriteStringToFd(serialized_string, fd)) {
+        return ErrnoError() << "Unable to write persistent property journal";
+    }
+    if (fsync(fd.get()) == -1) {
+        return ErrnoError() << "Unable to fsync persistent property journal";
+    }
+    return {};
+}
+
 }  // namespace
 
+void PrefetchPersistentProperties() {
+    if (prefetched_properties.valid()) return;
+    prefetched_properties = std::async(std::launch::async, []() -> Result<PersistentProperties> {
+        auto file_contents = ReadPersistentPropertyFile();
+        if (!file_contents.ok()) return file_contents.error();
+        return ParsePersistentPropertyFile(*file_contents);
+    });
+}
+
 Result<PersistentProperties> LoadPersistentPropertyFile() {
-    auto file_contents = ReadPersistentPropertyFile();
-    if (!file_contents.ok()) return file_contents.error();
+    journal_property_filename.clear();
 
-    auto persistent_properties = ParsePersistentPropertyFile(*file_contents);
+    Result<PersistentProperties> persistent_properties = Error() << "Not prefetched";
+    if (prefetched_properties.valid()) {
+        persistent_properties = prefetched_properties.get();
+    }
+    // A failed prefetch is read again here, so that errors are handled as they always have been.
     if (!persistent_properties.ok()) {
-        // If the file cannot be parsed in either format, then we don't have any recovery
-        // mechanisms, so we delete it to allow for future writes to take place successfully.
-        unlink(persistent_property_filename.c_str());
+        auto file_contents = ReadPersistentPropertyFile();
+        if (!file_contents.ok()) return file_contents.error();
+
+        persistent_properties = ParsePersistentPropertyFile(*file_contents);
+    }
+    if (persistent_properties.ok()) {
+        auto entries = ReplayPersistentPropertyJournal(&persistent_properties.value());
+        if (entries.ok()) {
+            journal_property_filename = persistent_property_filename;
+            journal_entries = *entries;
+            return persistent_properties;
+        }
+        persistent_properties = entries.error();
     }
+
+    // If the file cannot be parsed in either format, then we don't have any recovery
+    // mechanisms, so we delete it to allow for future writes to take place successfully.
+    unlink(persistent_property_filename.c_str());
+    unlink(JournalFilename().c_str());
     return persistent_properties;
 }
 
@@ -216,14 +349,34 @@ Result<void> WritePersistentPropertyFile(const PersistentProperties& persistent_
     if (dir_fd < 0) {
         return ErrnoError() << "Unable to open persistent properties directory for fsync()";
     }
-    fsync(dir_fd.get());
+    if (fsync(dir_fd.get()) == -1) {
+        // Keep the journal: until the rename is durable it may be the only copy of recent writes.
+        return ErrnoError() << "Unable to fsync persistent properties directory";
+    }
+
+    // The new file has everything that was in the journal, and the rename has reached storage.
+    // If removing the journal doesn't reach storage, replaying it again later is harmless.
+    unlink(JournalFilename().c_str());
+    journal_property_filename = persistent_property_filename;
+    journal_entries = 0;
 
     return {};
 }
 
-// Persistent properties are not written often, so we rather not keep any data in memory and read
-// then rewrite the persistent property file for each update.
+// Persistent properties are not written often, so we rather not keep any data in memory. Each
+// update is appended to the journal, and every kMaxJournalEntries updates the property file is
+// read and rewritten with the journal folded in.
 void WritePersistentProperty(const std::string& name, const std::string& value) {
+    if (journal_property_filename == persistent_property_filename &&
+        journal_entries < kMaxJournalEntries) {
+        if (auto result = AppendPersistentPropertyJournal(name, value); result.ok()) {
+            journal_entries++;
+            return;
+        } else {
+            LOG(ERROR) << "Rewriting persistent property file: " << result.error();
+        }
+    }
+
     auto persistent_properties = LoadPersistentPropertyFile();
 
     if (!persistent_properties.ok()) {
@@ -231,15 +384,7 @@ void WritePersistentProperty(const std::string& name, const std::string& value)
                    << persistent_properties.error();
         persistent_properties = LoadPersistentPropertiesFromMemory();
     }
-    auto it = std::find_if(persistent_properties->mutable_properties()->begin(),
-                           persistent_properties->mutable_properties()->end(),
-                           [&name](const auto& record) { return record.name() == name; });
-    if (it != persistent_properties->mutable_properties()->end()) {
-        it->set_name(name);
-        it->set_value(value);
-    } else {
-        AddPersistentProperty(name, value, &persistent_properties.value());
-    }
+    SetPersistentProperty(name, value, &persistent_properties.value());
 
     if (auto result = WritePersistentPropertyFile(*persistent_properties); !result.ok()) {
         LOG(ERROR) << "Could not store persistent property: " << result.error();
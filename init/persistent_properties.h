@@ -25,6 +25,9 @@
 namespace android {
 namespace init {
 
+// Reads and parses the persistent property file on a helper thread, so that a later
+// LoadPersistentProperties() only has to replay the journal.
+void PrefetchPersistentProperties();
 PersistentProperties LoadPersistentProperties();
 void WritePersistentProperty(const std::string& name, const std::string& value);
 
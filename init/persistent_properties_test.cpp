@@ -178,5 +178,74 @@ TEST(persistent_properties, RejectNonPersistProperty) {
     EXPECT_FALSE(it == read_back_properties.properties().end());
 }
 
+TEST(persistent_properties, Journal) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    persistent_property_filename = tf.path;
+    const std::string journal_filename = tf.path + ".journal"s;
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties = {
+        {"persist.sys.locale", "en-US"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+    };
+    ASSERT_RESULT_OK(
+            WritePersistentPropertyFile(VectorToPersistentProperties(persistent_properties)));
+    auto file_contents = ReadFile(tf.path);
+    ASSERT_RESULT_OK(file_contents);
+
+    // Updates go to the journal, and leave the property file alone.
+    WritePersistentProperty("persist.sys.locale", "pt-BR");
+    WritePersistentProperty("persist.test.journal", "1");
+    WritePersistentProperty("persist.test.journal", "2");
+    EXPECT_EQ(*file_contents, *ReadFile(tf.path));
+    EXPECT_EQ(0, access(journal_filename.c_str(), F_OK));
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties_expected = {
+        {"persist.sys.locale", "pt-BR"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+        {"persist.test.journal", "2"},
+    };
+    CheckPropertiesEqual(persistent_properties_expected, LoadPersistentProperties());
+
+    // An entry cut short by a crash is dropped.
+    auto journal_contents = ReadFile(journal_filename);
+    ASSERT_RESULT_OK(journal_contents);
+    ASSERT_RESULT_OK(WriteFile(journal_filename, *journal_contents + "\x40\0\0\0\x0a"s));
+    CheckPropertiesEqual(persistent_properties_expected, LoadPersistentProperties());
+    EXPECT_EQ(*journal_contents, *ReadFile(journal_filename));
+
+    // Enough updates fold the journal back into the property file.
+    for (int i = 0; i < 100; i++) {
+        WritePersistentProperty("persist.test.journal", std::to_string(i));
+    }
+    EXPECT_NE(*file_contents, *ReadFile(tf.path));
+    persistent_properties_expected[2].second = "99";
+    CheckPropertiesEqual(persistent_properties_expected, LoadPersistentProperties());
+
+    unlink(journal_filename.c_str());
+}
+
+TEST(persistent_properties, Prefetch) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    persistent_property_filename = tf.path;
+    const std::string journal_filename = tf.path + ".journal"s;
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties = {
+        {"persist.sys.locale", "en-US"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+    };
+    ASSERT_RESULT_OK(
+            WritePersistentPropertyFile(VectorToPersistentProperties(persistent_properties)));
+    PrefetchPersistentProperties();
+
+    // Updates made after the prefetch started must still be seen by the load.
+    WritePersistentProperty("persist.sys.locale", "pt-BR");
+    persistent_properties[0].second = "pt-BR";
+    CheckPropertiesEqual(persistent_properties, LoadPersistentProperties());
+
+    unlink(journal_filename.c_str());
+}
+
 }  // namespace init
 }  // namespace android
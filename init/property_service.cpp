@@ -39,11 +39,13 @@
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
 
+#include <future>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <queue>
+#include <set>
 #include <string_view>
 #include <thread>
 #include <vector>
@@ -57,6 +59,7 @@
 #include <android-base/result.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <cutils/properties.h>
 #include <property_info_parser/property_info_parser.h>
 #include <property_info_serializer/property_info_serializer.h>
 #include <selinux/android.h>
@@ -122,6 +125,8 @@ static std::thread property_service_thread;
 static std::unique_ptr<PersistWriteThread> persist_write_thread;
 
 static PropertyInfoAreaFile property_info_area;
+// The types of property_info_area, parsed, by type index.
+static std::vector<PropertyType> property_types;
 
 struct PropertyAuditData {
     const ucred* cr;
@@ -166,12 +171,22 @@ bool CanReadProperty(const std::string& source_context, const std::string& name)
                                 &audit_data) == 0;
 }
 
+// While the property files are loaded, the same couple of source contexts are checked against the
+// same target contexts for thousands of properties. PropertyLoadBootDefaults() points this at a
+// set that remembers the granted pairs until it's done. Denials are always rechecked, so that
+// each of them is still audited.
+static std::set<std::pair<std::string, const char*>>* granted_mac_perms = nullptr;
+
 static bool CheckMacPerms(const std::string& name, const char* target_context,
                           const char* source_context, const ucred& cr) {
     if (!target_context || !source_context) {
         return false;
     }
 
+    if (granted_mac_perms && granted_mac_perms->count({source_context, target_context})) {
+        return true;
+    }
+
     PropertyAuditData audit_data;
 
     audit_data.name = name.c_str();
@@ -180,10 +195,21 @@ static bool CheckMacPerms(const std::string& name, const char* target_context,
     bool has_access = (selinux_check_access(source_context, target_context, "property_service",
                                             "set", &audit_data) == 0);
 
+    if (has_access && granted_mac_perms) {
+        granted_mac_perms->emplace(source_context, target_context);
+    }
     return has_access;
 }
 
+// While set, property changes made on this thread are collected here instead of being sent to
+// init one at a time.
+static thread_local std::vector<std::pair<std::string, std::string>>* batched_property_changes;
+
 void NotifyPropertyChange(const std::string& name, const std::string& value) {
+    if (batched_property_changes) {
+        batched_property_changes->emplace_back(name, value);
+        return;
+    }
     // If init hasn't started its main loop, then it won't be handling property changed messages
     // anyway, so there's no need to try to send them.
     auto lock = std::lock_guard{accept_messages_lock};
@@ -277,6 +303,14 @@ class SocketConnection {
         return result == sizeof(value);
     }
 
+    bool SendUint32s(const std::vector<uint32_t>& values) {
+        if (!socket_.ok()) {
+            return true;
+        }
+        ssize_t size = values.size() * sizeof(uint32_t);
+        return TEMP_FAILURE_RETRY(send(socket_.get(), values.data(), size, 0)) == size;
+    }
+
     bool GetSourceContext(std::string* source_context) const {
         char* c_source_context = nullptr;
         if (getpeercon(socket_.get(), &c_source_context) != 0) {
@@ -507,16 +541,19 @@ uint32_t CheckPermissions(const std::string& name, const std::string& value,
         return PROP_SUCCESS;
     }
 
-    const char* target_context = nullptr;
-    const char* type = nullptr;
-    property_info_area->GetPropertyInfo(name.c_str(), &target_context, &type);
+    uint32_t context_index = ~0u;
+    uint32_t type_index = ~0u;
+    property_info_area->GetPropertyInfoIndexes(name.c_str(), &context_index, &type_index);
+    const char* target_context =
+            context_index == ~0u ? nullptr : property_info_area->context(context_index);
 
     if (!CheckMacPerms(name, target_context, source_context.c_str(), cr)) {
         *error = "SELinux permission check failed";
         return PROP_ERROR_PERMISSION_DENIED;
     }
 
-    if (!CheckType(type, value)) {
+    if (type_index >= property_types.size() || !property_types[type_index].Check(value)) {
+        const char* type = type_index == ~0u ? nullptr : property_info_area->type(type_index);
         *error = StringPrintf("Property type check failed, value doesn't match expected type '%s'",
                               (type ?: "(null)"));
         return PROP_ERROR_INVALID_VALUE;
@@ -670,6 +707,58 @@ static void handle_property_set_fd() {
         break;
       }
 
+    case PROP_MSG_SETPROP_BATCH: {
+        uint32_t count = 0;
+        if (!socket.RecvUint32(&count, &timeout_ms)) {
+            PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP_BATCH): error while reading count from the "
+                           "socket";
+            socket.SendUint32(PROP_ERROR_READ_DATA);
+            return;
+        }
+        if (count > PROP_SETPROP_BATCH_MAX) {
+            LOG(ERROR) << "sys_prop(PROP_MSG_SETPROP_BATCH): batch of " << count
+                       << " properties exceeds the limit of " << PROP_SETPROP_BATCH_MAX;
+            socket.SendUint32(PROP_ERROR_READ_DATA);
+            return;
+        }
+
+        std::vector<std::pair<std::string, std::string>> properties(count);
+        for (auto& [name, value] : properties) {
+            if (!socket.RecvString(&name, &timeout_ms) ||
+                !socket.RecvString(&value, &timeout_ms)) {
+                PLOG(ERROR) << "sys_prop(PROP_MSG_SETPROP_BATCH): error while reading name/value "
+                               "from the socket";
+                socket.SendUint32(PROP_ERROR_READ_DATA);
+                return;
+            }
+        }
+
+        std::string source_context;
+        if (!socket.GetSourceContext(&source_context)) {
+            PLOG(ERROR) << "Unable to set properties: getpeercon() failed";
+            socket.SendUint32(PROP_ERROR_PERMISSION_DENIED);
+            return;
+        }
+
+        // The batch is answered all at once, so sets that would be completed asynchronously
+        // (persistent properties, control messages) are handed a connection that doesn't reply,
+        // and reported as accepted.
+        const auto& cr = socket.cred();
+        std::vector<uint32_t> results;
+        for (const auto& [name, value] : properties) {
+            SocketConnection no_reply(-1, cr);
+            std::string error;
+            auto result = HandlePropertySet(name, value, source_context, cr, &no_reply, &error);
+            if (result && *result != PROP_SUCCESS) {
+                LOG(ERROR) << "Unable to set property '" << name << "' from uid:" << cr.uid
+                           << " gid:" << cr.gid << " pid:" << cr.pid << ": " << error;
+            }
+            results.emplace_back(result.value_or(PROP_SUCCESS));
+        }
+        socket.SendUint32s(results);
+        break;
+      }
+
     default:
         LOG(ERROR) << "sys_prop: invalid command " << cmd;
         socket.SendUint32(PROP_ERROR_INVALID_CMD);
@@ -691,6 +780,9 @@ uint32_t InitPropertySet(const std::string& name, const std::string& value) {
 static Result<void> load_properties_from_file(const char*, const char*,
                                               std::map<std::string, std::string>*);
 
+// Property files that PropertyLoadBootDefaults() started reading ahead of time, by path.
+static std::map<std::string, std::future<Result<std::string>>> prefetched_property_files;
+
 /*
  * Filter is used to decide which properties to load: NULL loads all keys,
  * "ro.foo.*" is a prefix match, and "ro.foo.bar" is an exact match.
@@ -803,7 +895,15 @@ static void LoadProperties(char* data, const char* filter, const char* filename,
 static Result<void> load_properties_from_file(const char* filename, const char* filter,
                                               std::map<std::string, std::string>* properties) {
     Timer t;
-    auto file_contents = ReadFile(filename);
+    auto file_contents = [filename]() -> Result<std::string> {
+        auto it = prefetched_property_files.find(filename);
+        if (it == prefetched_property_files.end()) {
+            return ReadFile(filename);
+        }
+        auto result = it->second.get();
+        prefetched_property_files.erase(it);
+        return result;
+    }();
     if (!file_contents.ok()) {
         return Error() << "Couldn't load property file '" << filename
                        << "': " << file_contents.error();
@@ -1120,6 +1220,25 @@ void PropertyLoadBootDefaults() {
     // property files, regardless of if they are "ro." properties or not.
     std::map<std::string, std::string> properties;
 
+    std::set<std::pair<std::string, const char*>> granted_perms;
+    granted_mac_perms = &granted_perms;
+
+    // The files below are parsed one at a time, in order, but reading them in parallel up front
+    // means that only the first one waits for storage.
+    std::vector<std::string> prefetch_paths = {
+            GetRamdiskPropForSecondStage(), "/system/build.prop",
+            "/system_ext/etc/build.prop",   "/system_dlkm/etc/build.prop",
+            "/vendor/default.prop",         "/vendor/build.prop",
+            "/vendor_dlkm/etc/build.prop",  "/odm_dlkm/etc/build.prop",
+            "/odm/etc/build.prop",          "/product/etc/build.prop",
+    };
+    if (IsRecoveryMode()) {
+        prefetch_paths.emplace_back("/prop.default");
+    }
+    for (const auto& path : prefetch_paths) {
+        prefetched_property_files.emplace(path, std::async(std::launch::async, ReadFile, path));
+    }
+
     if (IsRecoveryMode()) {
         if (auto res = load_properties_from_file("/prop.default", nullptr, &properties);
             !res.ok()) {
@@ -1199,6 +1318,9 @@ void PropertyLoadBootDefaults() {
         }
     }
 
+    prefetched_property_files.clear();
+    granted_mac_perms = nullptr;
+
     for (const auto& [name, value] : properties) {
         std::string error;
         if (PropertySetNoSocket(name, value, &error) != PROP_SUCCESS) {
@@ -1382,6 +1504,10 @@ void PropertyInit() {
     if (!property_info_area.LoadDefaultPath()) {
         LOG(FATAL) << "Failed to load serialized property info file";
     }
+    property_types.reserve(property_info_area->num_types());
+    for (uint32_t i = 0; i < property_info_area->num_types(); ++i) {
+        property_types.emplace_back(property_info_area->type(i));
+    }
 
     // Report a valid verified boot chain to make Google SafetyNet integrity
     // checks pass. This needs to be done before parsing the kernel cmdline as
@@ -1419,6 +1545,9 @@ static void HandleInitSocket() {
 
     switch (init_message.msg_case()) {
         case InitMessage::kLoadPersistentProperties: {
+            // Queue the triggers for all of these properties together once they're all set.
+            std::vector<std::pair<std::string, std::string>> changes;
+            batched_property_changes = &changes;
             load_override_properties();
             // Read persistent properties after all default values have been loaded.
             auto persistent_properties = LoadPersistentProperties();
@@ -1426,6 +1555,13 @@ static void HandleInitSocket() {
                 InitPropertySet(persistent_property_record.name(),
                                 persistent_property_record.value());
             }
+            batched_property_changes = nullptr;
+            {
+                auto lock = std::lock_guard{accept_messages_lock};
+                if (accept_messages) {
+                    PropertiesChanged(changes);
+                }
+            }
             // Apply debug ramdisk special settings after persistent properties are loaded.
             if (android::base::GetBoolProperty("ro.force.debuggable", false)) {
                 // Always enable usb adb if device is booted with debug ramdisk.
@@ -1435,6 +1571,11 @@ static void HandleInitSocket() {
             persistent_properties_loaded = true;
             break;
         }
+        case InitMessage::kPrefetchPersistentProperties:
+            if (!persistent_properties_loaded) {
+                PrefetchPersistentProperties();
+            }
+            break;
         default:
             LOG(ERROR) << "Unknown message type from init: " << init_message.msg_case();
     }
@@ -1446,7 +1587,8 @@ static void PropertyServiceThread() {
         LOG(FATAL) << result.error();
     }
 
-    if (auto result = epoll.RegisterHandler(property_set_fd, handle_property_set_fd);
+    if (auto result = epoll.RegisterHandler(property_set_fd, handle_property_set_fd, EPOLLIN,
+                                            Epoll::Priority::kHigh);
         !result.ok()) {
         LOG(FATAL) << result.error();
     }
@@ -16,6 +16,8 @@
 
 #include "property_type.h"
 
+#include <algorithm>
+
 #include <android-base/parsedouble.h>
 #include <android-base/parseint.h>
 #include <android-base/strings.h>
@@ -28,59 +30,81 @@ using android::base::Split;
 namespace android {
 namespace init {
 
-bool CheckType(const std::string& type_string, const std::string& value) {
-    // Always allow clearing a property such that the default value when it is not set takes over.
-    if (value.empty()) {
-        return true;
-    }
-
+PropertyType::PropertyType(const std::string& type_string) {
     auto type_strings = Split(type_string, " ");
     if (type_strings.empty()) {
-        return false;
+        return;
     }
-    auto type = type_strings[0];
+    const auto& type = type_strings[0];
 
     if (type == "string") {
-        return true;
-    }
-    if (type == "bool") {
-        return value == "true" || value == "false" || value == "1" || value == "0";
+        kind_ = Kind::String;
+    } else if (type == "bool") {
+        kind_ = Kind::Bool;
+    } else if (type == "int") {
+        kind_ = Kind::Int;
+    } else if (type == "uint") {
+        kind_ = Kind::Uint;
+    } else if (type == "double") {
+        kind_ = Kind::Double;
+    } else if (type == "size") {
+        kind_ = Kind::Size;
+    } else if (type == "enum") {
+        kind_ = Kind::Enum;
+        enum_values_.assign(std::next(type_strings.begin()), type_strings.end());
+        std::sort(enum_values_.begin(), enum_values_.end());
     }
-    if (type == "int") {
-        int64_t parsed;
-        return ParseInt(value, &parsed);
+}
+
+bool PropertyType::Check(const std::string& value) const {
+    // Always allow clearing a property such that the default value when it is not set takes over.
+    if (value.empty()) {
+        return true;
     }
-    if (type == "uint") {
-        uint64_t parsed;
-        if (value.empty() || value.front() == '-') {
-            return false;
+
+    switch (kind_) {
+        case Kind::String:
+            return true;
+        case Kind::Bool:
+            return value == "true" || value == "false" || value == "1" || value == "0";
+        case Kind::Int: {
+            int64_t parsed;
+            return ParseInt(value, &parsed);
         }
-        return ParseUint(value, &parsed);
-    }
-    if (type == "double") {
-        double parsed;
-        return ParseDouble(value.c_str(), &parsed);
-    }
-    if (type == "size") {
-        auto it = value.begin();
-        while (it != value.end() && isdigit(*it)) {
-            it++;
+        case Kind::Uint: {
+            uint64_t parsed;
+            if (value.front() == '-') {
+                return false;
+            }
+            return ParseUint(value, &parsed);
         }
-        if (it == value.begin() || it == value.end() || (*it != 'g' && *it != 'k' && *it != 'm')) {
-            return false;
+        case Kind::Double: {
+            double parsed;
+            return ParseDouble(value.c_str(), &parsed);
         }
-        it++;
-        return it == value.end();
-    }
-    if (type == "enum") {
-        for (auto it = std::next(type_strings.begin()); it != type_strings.end(); ++it) {
-            if (*it == value) {
-                return true;
+        case Kind::Size: {
+            auto it = value.begin();
+            while (it != value.end() && isdigit(*it)) {
+                it++;
+            }
+            if (it == value.begin() || it == value.end() ||
+                (*it != 'g' && *it != 'k' && *it != 'm')) {
+                return false;
             }
+            it++;
+            return it == value.end();
         }
+        case Kind::Enum:
+            return std::binary_search(enum_values_.begin(), enum_values_.end(), value);
+        case Kind::Invalid:
+            return false;
     }
     return false;
 }
 
+bool CheckType(const std::string& type_string, const std::string& value) {
+    return PropertyType(type_string).Check(value);
+}
+
 }  // namespace init
 }  // namespace android
@@ -18,10 +18,36 @@
 #define _INIT_PROPERTY_TYPE_H
 
 #include <string>
+#include <vector>
 
 namespace android {
 namespace init {
 
+// A property type from property_contexts, e.g. "int" or "enum a b c", parsed once so that values
+// can be checked against it without parsing the type again or allocating.
+class PropertyType {
+  public:
+    explicit PropertyType(const std::string& type_string);
+
+    bool Check(const std::string& value) const;
+
+  private:
+    enum class Kind {
+        Invalid,
+        String,
+        Bool,
+        Int,
+        Uint,
+        Double,
+        Size,
+        Enum,
+    };
+
+    Kind kind_ = Kind::Invalid;
+    // Sorted, for Kind::Enum.
+    std::vector<std::string> enum_values_;
+};
+
 bool CheckType(const std::string& type_string, const std::string& value);
 
 }  // namespace init
@@ -91,5 +91,21 @@ TEST(property_type, CheckType_enum) {
     EXPECT_TRUE(CheckType("enum 123 456 789", "789"));
 }
 
+TEST(property_type, PropertyType_reused) {
+    PropertyType type("enum c b a");
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_TRUE(type.Check(""));
+        EXPECT_TRUE(type.Check("a"));
+        EXPECT_TRUE(type.Check("b"));
+        EXPECT_TRUE(type.Check("c"));
+        EXPECT_FALSE(type.Check("d"));
+        EXPECT_FALSE(type.Check("c b"));
+    }
+
+    EXPECT_TRUE(PropertyType("unknown").Check(""));
+    EXPECT_FALSE(PropertyType("unknown").Check("value"));
+    EXPECT_FALSE(PropertyType("").Check("value"));
+}
+
 }  // namespace init
 }  // namespace android
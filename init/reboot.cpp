@@ -33,6 +33,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <algorithm>
 #include <chrono>
 #include <memory>
 #include <set>
@@ -170,6 +171,8 @@ class MountEntry {
         }
     }
 
+    const std::string& mnt_dir() const { return mnt_dir_; }
+
     static bool IsBlockDevice(const struct mntent& mntent) {
         return android::base::StartsWith(mntent.mnt_fsname, "/dev/block");
     }
@@ -278,6 +281,51 @@ static void DumpUmountDebuggingInfo() {
     WriteStringToFile("w", PROC_SYSRQ);
 }
 
+// Unmounts |entries|, which are innermost first as returned by FindPartitionsToUmount(). Mounts
+// that aren't nested inside one another are unmounted in parallel, since unmounting a block
+// device waits for its filesystem to write everything back. Returns false if any umount failed.
+static bool UmountInParallel(std::vector<MountEntry>* entries, bool force) {
+    std::vector<MountEntry*> pending;
+    for (auto& entry : *entries) {
+        pending.emplace_back(&entry);
+    }
+    bool unmount_done = true;
+    while (!pending.empty()) {
+        // Take every mount that doesn't have another pending mount below it, or on top of it in
+        // the same directory.
+        std::vector<MountEntry*> ready;
+        std::vector<MountEntry*> blocked;
+        for (auto it = pending.begin(); it != pending.end(); ++it) {
+            const std::string& dir = (*it)->mnt_dir();
+            std::string prefix = dir == "/" ? "/" : dir + "/";
+            bool is_blocked =
+                    std::any_of(pending.begin(), it, [&](auto* other) {
+                        return other->mnt_dir() == dir;
+                    }) ||
+                    std::any_of(pending.begin(), pending.end(), [&](auto* other) {
+                        return android::base::StartsWith(other->mnt_dir(), prefix);
+                    });
+            (is_blocked ? blocked : ready).emplace_back(*it);
+        }
+
+        // Not std::vector<bool>, whose elements can't be written from different threads.
+        std::vector<char> results(ready.size());
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < ready.size(); i++) {
+            threads.emplace_back([&, i] { results[i] = ready[i]->Umount(force); });
+        }
+        results[0] = ready[0]->Umount(force);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (std::find(results.begin(), results.end(), false) != results.end()) {
+            unmount_done = false;
+        }
+        pending = std::move(blocked);
+    }
+    return unmount_done;
+}
+
 static UmountStat UmountPartitions(std::chrono::milliseconds timeout) {
     Timer t;
     /* data partition needs all pending writes to be completed and all emulated partitions
@@ -302,9 +350,7 @@ static UmountStat UmountPartitions(std::chrono::milliseconds timeout) {
                 sync();
             }
         }
-        for (auto& entry : block_devices) {
-            if (!entry.Umount(timeout == 0ms)) unmount_done = false;
-        }
+        if (!UmountInParallel(&block_devices, timeout == 0ms)) unmount_done = false;
         if (unmount_done) {
             return UMOUNT_STAT_SUCCESS;
         }
@@ -754,12 +800,14 @@ static void DoReboot(unsigned int cmd, const std::string& reason, const std::str
     // logcat stopped here
     StopServices(kDebuggingServices, 0ms, false /* SIGKILL */);
     // 4. sync, try umount, and optionally run fsck for user shutdown
-    {
+    // The sync runs while the zram backing device is killed and apexes are unmounted below, since
+    // neither of those needs it to have finished; it's waited on before unmounting.
+    std::thread sync_thread([] {
         Timer sync_timer;
         LOG(INFO) << "sync() before umount...";
         sync();
         LOG(INFO) << "sync() before umount took" << sync_timer;
-    }
+    });
     // 5. drop caches and disable zram backing device, if exist
     KillZramBackingDevice();
 
@@ -768,6 +816,7 @@ static void DoReboot(unsigned int cmd, const std::string& reason, const std::str
     if (auto ret = UnmountAllApexes(); !ret.ok()) {
         LOG(ERROR) << ret.error();
     }
+    sync_thread.join();
     UmountStat stat =
             TryUmountAndFsck(cmd, run_fsck, shutdown_timeout - t.duration(), &reboot_semaphore);
     // Follow what linux shutdown is doing: one more sync with little bit delay
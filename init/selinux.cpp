@@ -58,7 +58,9 @@
 #include <fcntl.h>
 #include <linux/audit.h>
 #include <linux/netlink.h>
+#include <openssl/sha.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <fstream>
@@ -70,6 +72,7 @@
 #include <android-base/parseint.h>
 #include <android-base/result.h>
 #include <android-base/scopeguard.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <fs_avb/fs_avb.h>
@@ -329,6 +332,113 @@ struct PolicyFile {
     std::string path;
 };
 
+// On unlocked devices, e.g. when booting a GSI or DSU, the precompiled policy rarely matches and
+// the policy would be compiled on every boot. The output of secilc is kept in /metadata instead,
+// next to the sha256 of the compiler arguments and of the contents of every input file. Locked
+// devices never use it: /metadata is not covered by verified boot, and a policy read from it
+// could have been written by anyone with access to the partition.
+constexpr const char kCompiledSepolicyCacheDir[] = "/metadata/sepolicy_cache";
+constexpr const char kCompiledSepolicyCache[] = "/metadata/sepolicy_cache/compiled_sepolicy";
+constexpr const char kCompiledSepolicyCacheId[] =
+        "/metadata/sepolicy_cache/compiled_sepolicy.sha256";
+
+bool CanUseCompiledSepolicyCache() {
+    return AvbHandle::IsDeviceUnlocked() && access("/metadata", W_OK) == 0;
+}
+
+// Hashes the secilc arguments, except for the output files, and the contents of every input file.
+Result<std::string> GetCompileArgsId(const std::vector<const char*>& compile_args) {
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    auto update = [&](const std::string& data) -> void {
+        uint64_t size = data.size();
+        SHA256_Update(&ctx, &size, sizeof(size));
+        SHA256_Update(&ctx, data.data(), data.size());
+    };
+
+    for (size_t i = 0; i < compile_args.size(); i++) {
+        std::string arg = compile_args[i];
+        update(arg);
+        if (arg == "-o" || arg == "-f") {
+            i++;
+            continue;
+        }
+        if (android::base::StartsWith(arg, "/")) {
+            std::string contents;
+            if (!android::base::ReadFileToString(arg, &contents, true /* follow symlinks */)) {
+                return ErrnoError() << "Failed to read " << arg;
+            }
+            update(contents);
+        }
+    }
+
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    SHA256_Final(digest, &ctx);
+    std::string id;
+    for (uint8_t byte : digest) {
+        id += android::base::StringPrintf("%02x", byte);
+    }
+    return id;
+}
+
+bool OpenCompiledSepolicyCache(const std::string& id, PolicyFile* policy_file) {
+    std::string cached_id;
+    if (!ReadFirstLine(kCompiledSepolicyCacheId, &cached_id) || cached_id != id) {
+        return false;
+    }
+    unique_fd fd(open(kCompiledSepolicyCache, O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+    if (fd < 0) {
+        PLOG(ERROR) << "Failed to open " << kCompiledSepolicyCache;
+        return false;
+    }
+    policy_file->fd = std::move(fd);
+    policy_file->path = kCompiledSepolicyCache;
+    return true;
+}
+
+bool WriteFileAtomically(const std::string& path, const std::string& contents) {
+    std::string tmp_path = path + ".tmp";
+    unique_fd fd(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+                      0600));
+    if (fd < 0) {
+        PLOG(ERROR) << "Failed to create " << tmp_path;
+        return false;
+    }
+    if (!android::base::WriteStringToFd(contents, fd) || fsync(fd) < 0) {
+        PLOG(ERROR) << "Failed to write " << tmp_path;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+        PLOG(ERROR) << "Failed to rename " << tmp_path << " to " << path;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// The id is removed first and written last, so that it never names a policy it does not match.
+void WriteCompiledSepolicyCache(const std::string& id, int policy_fd) {
+    std::string policy;
+    if (!android::base::ReadFdToString(policy_fd, &policy) || lseek(policy_fd, 0, SEEK_SET) < 0) {
+        PLOG(ERROR) << "Failed to read compiled policy";
+        return;
+    }
+    if (mkdir(kCompiledSepolicyCacheDir, 0700) < 0 && errno != EEXIST) {
+        PLOG(ERROR) << "Failed to create " << kCompiledSepolicyCacheDir;
+        return;
+    }
+    if (unlink(kCompiledSepolicyCacheId) < 0 && errno != ENOENT) {
+        PLOG(ERROR) << "Failed to remove " << kCompiledSepolicyCacheId;
+        return;
+    }
+    if (!WriteFileAtomically(kCompiledSepolicyCache, policy) ||
+        !WriteFileAtomically(kCompiledSepolicyCacheId, id + "\n")) {
+        return;
+    }
+    LOG(INFO) << "Saved compiled SELinux policy to " << kCompiledSepolicyCache;
+}
+
 bool OpenSplitPolicy(PolicyFile* policy_file) {
     // IMPLEMENTATION NOTE: Split policy consists of three or more CIL files:
     // * platform -- policy needed due to logic contained in the system image,
@@ -482,6 +592,21 @@ bool OpenSplitPolicy(PolicyFile* policy_file) {
     if (!apex_policy_cil_file.empty()) {
         compile_args.push_back(apex_policy_cil_file.c_str());
     }
+
+    std::string compile_args_id;
+    if (CanUseCompiledSepolicyCache()) {
+        if (auto id = GetCompileArgsId(compile_args); id.ok()) {
+            compile_args_id = std::move(*id);
+        } else {
+            LOG(ERROR) << id.error();
+        }
+    }
+    if (!compile_args_id.empty() && OpenCompiledSepolicyCache(compile_args_id, policy_file)) {
+        LOG(INFO) << "Using cached compiled SELinux policy";
+        unlink(compiled_sepolicy);
+        return true;
+    }
+
     compile_args.push_back(nullptr);
 
     if (!ForkExecveAndWaitForCompletion(compile_args[0], (char**)compile_args.data())) {
@@ -490,6 +615,10 @@ bool OpenSplitPolicy(PolicyFile* policy_file) {
     }
     unlink(compiled_sepolicy);
 
+    if (!compile_args_id.empty()) {
+        WriteCompiledSepolicyCache(compile_args_id, compiled_sepolicy_fd);
+    }
+
     policy_file->fd = std::move(compiled_sepolicy_fd);
     policy_file->path = compiled_sepolicy;
     return true;
@@ -972,6 +1101,7 @@ static void LoadSelinuxPolicy(std::string& policy) {
 int SetupSelinux(char** argv) {
     SetStdioToDevNull(argv);
     InitKernelLogging(argv);
+    CloseSnapuserdOpIndexesOnExec();
 
     if (REBOOT_BOOTLOADER_ON_PANIC) {
         InstallRebootSignalHandlers();
@@ -26,6 +26,9 @@
 #include <sys/time.h>
 #include <termios.h>
 #include <unistd.h>
+#include <atomic>
+#include <map>
+#include <mutex>
 #include <thread>
 
 #include <android-base/file.h>
@@ -34,6 +37,7 @@
 #include <android-base/scopeguard.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/thread_annotations.h>
 #include <cutils/sockets.h>
 #include <processgroup/processgroup.h>
 #include <selinux/selinux.h>
@@ -74,7 +78,7 @@ using android::base::WriteStringToFile;
 namespace android {
 namespace init {
 
-static Result<std::string> ComputeContextFromExecutable(const std::string& service_path) {
+static Result<std::string> ComputeContextFromExecutableUncached(const std::string& service_path) {
     std::string computed_context;
 
     char* raw_con = nullptr;
@@ -115,6 +119,84 @@ static Result<std::string> ComputeContextFromExecutable(const std::string& servi
     return computed_context;
 }
 
+// ComputeContextFromExecutable() is called each time a service starts, including every restart
+// of a crashing or frequently triggered service, so its results are cached.  An entry is only
+// used while the executable and the loaded policy are unchanged.
+namespace {
+
+struct CachedExecutableContext {
+    dev_t dev;
+    ino_t ino;
+    timespec mtime;
+    timespec ctime;  // Relabeling changes the ctime.
+    bool enforcing;
+    std::string context;
+};
+
+std::mutex executable_context_cache_lock;
+std::map<std::string, CachedExecutableContext> executable_context_cache
+        GUARDED_BY(executable_context_cache_lock);
+int executable_context_cache_policyload GUARDED_BY(executable_context_cache_lock) = -1;
+uint64_t executable_context_cache_hits GUARDED_BY(executable_context_cache_lock) = 0;
+uint64_t executable_context_cache_misses GUARDED_BY(executable_context_cache_lock) = 0;
+
+bool SameTime(const timespec& lhs, const timespec& rhs) {
+    return lhs.tv_sec == rhs.tv_sec && lhs.tv_nsec == rhs.tv_nsec;
+}
+
+bool Matches(const CachedExecutableContext& entry, const struct stat& sb, bool enforcing) {
+    return entry.dev == sb.st_dev && entry.ino == sb.st_ino && SameTime(entry.mtime, sb.st_mtim) &&
+           SameTime(entry.ctime, sb.st_ctim) && entry.enforcing == enforcing;
+}
+
+}  // namespace
+
+static Result<std::string> ComputeContextFromExecutable(const std::string& service_path) {
+    // The status page gives the policy load count and enforcing state without a syscall.  If it
+    // isn't available, there's nothing to tell when the policy was reloaded, so don't cache.
+    static const bool status_available = selinux_status_open(/*fallback=*/0) == 0;
+    struct stat sb;
+    if (!status_available || stat(service_path.c_str(), &sb) == -1) {
+        return ComputeContextFromExecutableUncached(service_path);
+    }
+    int policyload = selinux_status_policyload();
+    if (policyload < 0) {
+        return ComputeContextFromExecutableUncached(service_path);
+    }
+    bool enforcing = selinux_status_getenforce() == 1;
+
+    {
+        auto lock = std::lock_guard{executable_context_cache_lock};
+        if (policyload != executable_context_cache_policyload) {
+            executable_context_cache.clear();
+            executable_context_cache_policyload = policyload;
+        }
+        if (auto it = executable_context_cache.find(service_path);
+            it != executable_context_cache.end() && Matches(it->second, sb, enforcing)) {
+            ++executable_context_cache_hits;
+            return it->second.context;
+        }
+        ++executable_context_cache_misses;
+    }
+
+    auto result = ComputeContextFromExecutableUncached(service_path);
+    if (result.ok()) {
+        auto lock = std::lock_guard{executable_context_cache_lock};
+        if (policyload == executable_context_cache_policyload) {
+            executable_context_cache[service_path] = {
+                    sb.st_dev, sb.st_ino, sb.st_mtim, sb.st_ctim, enforcing, *result};
+        }
+    }
+    return result;
+}
+
+void Service::DumpExecutableContextCacheState() {
+    auto lock = std::lock_guard{executable_context_cache_lock};
+    LOG(INFO) << "executable context cache: " << executable_context_cache.size() << " entries, "
+              << executable_context_cache_hits << " hits, " << executable_context_cache_misses
+              << " misses";
+}
+
 static bool ExpandArgsAndExecv(const std::vector<std::string>& args, bool sigstop) {
     std::vector<std::string> expanded_args;
     std::vector<char*> c_strings;
@@ -197,6 +279,10 @@ void Service::NotifyStateChange(const std::string& new_state) const {
     }
 }
 
+Service::~Service() {
+    SetPid(0);
+}
+
 void Service::KillProcessGroup(int signal, bool report_oneshot) {
     // If we've already seen a successful result from killProcessGroup*(), then we have removed
     // the cgroup already and calling these functions a second time will simply result in an error.
@@ -307,7 +393,7 @@ void Service::Reap(const siginfo_t& siginfo) {
 
     if (flags_ & SVC_TEMPORARY) return;
 
-    pid_ = 0;
+    SetPid(0);
     flags_ &= (~SVC_RUNNING);
     start_order_ = 0;
 
@@ -393,6 +479,7 @@ void Service::Reap(const siginfo_t& siginfo) {
 
     flags_ &= (~SVC_RESTART);
     flags_ |= SVC_RESTARTING;
+    ServiceList::GetInstance().ScheduleProcessAction(*this, time_started_ + restart_period_);
 
     // Execute all onrestart commands for this service.
     onrestart_.ExecuteAllCommands();
@@ -576,6 +663,10 @@ void Service::RunService(const std::vector<Descriptor>& descriptors,
 }
 
 Result<void> Service::Start() {
+    // Only this start may use a context computed by PrecomputeContexts().
+    auto precomputed_context = std::move(precomputed_context_);
+    precomputed_context_.reset();
+
     auto reboot_on_failure = make_scope_guard([this] {
         if (on_failure_reboot_target_) {
             trigger_shutdown(*on_failure_reboot_target_);
@@ -633,7 +724,8 @@ Result<void> Service::Start() {
     if (!seclabel_.empty()) {
         scon = seclabel_;
     } else {
-        auto result = ComputeContextFromExecutable(args_[0]);
+        auto result = precomputed_context ? std::move(*precomputed_context)
+                                          : ComputeContextFromExecutable(args_[0]);
         if (!result.ok()) {
             return result.error();
         }
@@ -685,7 +777,7 @@ Result<void> Service::Start() {
     }
 
     if (pid < 0) {
-        pid_ = 0;
+        SetPid(0);
         return ErrnoError() << "Failed to fork";
     }
 
@@ -700,10 +792,13 @@ Result<void> Service::Start() {
     }
 
     time_started_ = boot_clock::now();
-    pid_ = pid;
+    SetPid(pid);
     flags_ |= SVC_RUNNING;
     start_order_ = next_start_order_++;
     process_cgroup_empty_ = false;
+    if (timeout_period_) {
+        ServiceList::GetInstance().ScheduleProcessAction(*this, time_started_ + *timeout_period_);
+    }
 
     if (CgroupsAvailable()) {
         bool use_memcg = swappiness_ != -1 || soft_limit_in_bytes_ != -1 || limit_in_bytes_ != -1 ||
@@ -805,13 +900,21 @@ void Service::SetStartedInFirstStage(pid_t pid) {
     LOG(INFO) << "adding first-stage service '" << name_ << "'...";
 
     time_started_ = boot_clock::now();  // not accurate, but doesn't matter here
-    pid_ = pid;
+    SetPid(pid);
     flags_ |= SVC_RUNNING;
     start_order_ = next_start_order_++;
+    if (timeout_period_) {
+        ServiceList::GetInstance().ScheduleProcessAction(*this, time_started_ + *timeout_period_);
+    }
 
     NotifyStateChange("running");
 }
 
+void Service::SetPid(pid_t pid) {
+    ServiceList::GetInstance().UpdatePid(this, pid_, pid);
+    pid_ = pid;
+}
+
 void Service::ResetFlagsForStart() {
     // Starting a service removes it from the disabled or reset state and
     // immediately takes it out of the restarting state if it was in there.
@@ -823,10 +926,45 @@ Result<void> Service::StartIfNotDisabled() {
         return Start();
     } else {
         flags_ |= SVC_DISABLED_START;
+        precomputed_context_.reset();
     }
     return {};
 }
 
+void Service::PrecomputeContexts(const std::vector<Service*>& services) {
+    auto pending = std::vector<Service*>();
+    for (auto* service : services) {
+        if ((service->flags_ & (SVC_DISABLED | SVC_RUNNING)) || !service->seclabel_.empty() ||
+            (service->is_updatable() && !ServiceList::GetInstance().IsServicesUpdated())) {
+            continue;
+        }
+        pending.emplace_back(service);
+    }
+    if (pending.size() < 2) {
+        return;
+    }
+
+    // string_to_security_class() fills a cache the first time it's called, so do that here before
+    // ComputeContextFromExecutable() calls it from several threads.
+    string_to_security_class("process");
+
+    std::atomic<size_t> next_service = 0;
+    auto compute_contexts = [&pending, &next_service] {
+        for (size_t i; (i = next_service++) < pending.size();) {
+            pending[i]->precomputed_context_ = ComputeContextFromExecutable(pending[i]->args_[0]);
+        }
+    };
+    auto num_threads = std::min<size_t>(pending.size(), std::thread::hardware_concurrency());
+    auto threads = std::vector<std::thread>();
+    for (size_t i = 1; i < num_threads; ++i) {
+        threads.emplace_back(compute_contexts);
+    }
+    compute_contexts();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
 Result<void> Service::Enable() {
     flags_ &= ~(SVC_DISABLED | SVC_RC_DISABLED);
     if (flags_ & SVC_DISABLED_START) {
@@ -75,6 +75,7 @@ class Service {
             const std::vector<gid_t>& supp_gids, int namespace_flags, const std::string& seclabel,
             Subcontext* subcontext_for_restart_commands, const std::string& filename,
             const std::vector<std::string>& args);
+    ~Service();
     Service(const Service&) = delete;
     void operator=(const Service&) = delete;
 
@@ -86,6 +87,11 @@ class Service {
     Result<void> ExecStart();
     Result<void> Start();
     Result<void> StartIfNotDisabled();
+    // Computes the SELinux contexts that Start() would for each of |services| that
+    // StartIfNotDisabled() would start, on several threads at once rather than one at a time on
+    // the main thread.  Each is used, and dropped, by that service's next Start().
+    static void PrecomputeContexts(const std::vector<Service*>& services);
+    static void DumpExecutableContextCacheState();
     Result<void> Enable();
     void Reset();
     void Stop();
@@ -153,6 +159,7 @@ class Service {
     void KillProcessGroup(int signal, bool report_oneshot = false);
     void SetProcessAttributesAndCaps(InterprocessFifo setsid_finished);
     void ResetFlagsForStart();
+    void SetPid(pid_t pid);
     Result<void> CheckConsole();
     void ConfigureMemcg();
     void RunService(const std::vector<Descriptor>& descriptors, InterprocessFifo cgroups_activated,
@@ -178,6 +185,7 @@ class Service {
     NamespaceInfo namespaces_;
 
     std::string seclabel_;
+    std::optional<Result<std::string>> precomputed_context_;  // see PrecomputeContexts()
 
     std::vector<SocketDescriptor> sockets_;
     std::vector<FileDescriptor> files_;
@@ -62,10 +62,28 @@ void ServiceList::RemoveService(const Service& svc) {
     services_.erase(svc_it);
 }
 
+Service* ServiceList::FindServiceByPid(pid_t pid) const {
+    auto it = services_by_pid_.find(pid);
+    return it != services_by_pid_.end() ? it->second : nullptr;
+}
+
+void ServiceList::UpdatePid(Service* service, pid_t old_pid, pid_t new_pid) {
+    if (old_pid > 0) {
+        auto it = services_by_pid_.find(old_pid);
+        if (it != services_by_pid_.end() && it->second == service) {
+            services_by_pid_.erase(it);
+        }
+    }
+    if (new_pid > 0) {
+        services_by_pid_[new_pid] = service;
+    }
+}
+
 void ServiceList::DumpState() const {
     for (const auto& s : services_) {
         s->DumpState();
     }
+    Service::DumpExecutableContextCacheState();
 }
 
 void ServiceList::MarkPostData() {
@@ -102,5 +120,26 @@ void ServiceList::DelayService(const Service& service) {
     delayed_service_names_.emplace_back(service.name());
 }
 
+void ServiceList::ScheduleProcessAction(const Service& service, boot_clock::time_point time) {
+    process_actions_.emplace(time, service.name());
+}
+
+std::vector<std::string> ServiceList::TakeDueProcessActions(boot_clock::time_point now) {
+    std::vector<std::string> names;
+    auto it = process_actions_.begin();
+    for (; it != process_actions_.end() && it->first < now; ++it) {
+        names.emplace_back(it->second);
+    }
+    process_actions_.erase(process_actions_.begin(), it);
+    return names;
+}
+
+std::optional<boot_clock::time_point> ServiceList::NextProcessActionTime() const {
+    if (process_actions_.empty()) {
+        return {};
+    }
+    return process_actions_.begin()->first;
+}
+
 }  // namespace init
 }  // namespace android
@@ -18,6 +18,11 @@
 
 #include <iterator>
 #include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -67,6 +72,11 @@ class ServiceList {
         return matches;
     }
 
+    // Looks up a service in GetInstance() by pid, without scanning the whole list.
+    Service* FindServiceByPid(pid_t pid) const;
+    // Called by services when their pid changes, including when they're destroyed.
+    void UpdatePid(Service* service, pid_t old_pid, pid_t new_pid);
+
     Service* FindInterface(const std::string& interface_name) {
         for (const auto& svc : services_) {
             if (svc->interfaces().count(interface_name) > 0) {
@@ -89,9 +99,17 @@ class ServiceList {
     bool IsServicesUpdated() const { return services_update_finished_; }
     void DelayService(const Service& service);
 
+    // Records that |service| has a restart or timeout deadline at |time|, so that the main loop
+    // only needs to look at it again once that time has passed.
+    void ScheduleProcessAction(const Service& service, boot_clock::time_point time);
+    // Removes and returns the names of the services whose deadlines are before |now|.
+    std::vector<std::string> TakeDueProcessActions(boot_clock::time_point now);
+    std::optional<boot_clock::time_point> NextProcessActionTime() const;
+
     void ResetState() {
         post_data_ = false;
         services_update_finished_ = false;
+        process_actions_.clear();
     }
 
     auto size() const { return services_.size(); }
@@ -102,6 +120,9 @@ class ServiceList {
     bool post_data_ = false;
     bool services_update_finished_ = false;
     std::vector<std::string> delayed_service_names_;
+    // Entries may be stale; the service's flags are checked again when they come due.
+    std::set<std::pair<boot_clock::time_point, std::string>> process_actions_;
+    std::unordered_map<pid_t, Service*> services_by_pid_;
 };
 
 }  // namespace init
@@ -24,6 +24,7 @@
 #include <gtest/gtest.h>
 
 #include "lmkd_service.h"
+#include "service_list.h"
 #include "util.h"
 
 namespace android {
@@ -190,5 +191,47 @@ TEST(service, make_temporary_oneshot_service_with_just_command_no_dash) {
     Test_make_temporary_oneshot_service(false, false, false, false, false);
 }
 
+TEST(service_list, ProcessActions) {
+    ServiceList service_list;
+    auto first = Service::MakeTemporaryOneshotService({"exec", "--", "/system/bin/first"});
+    ASSERT_RESULT_OK(first);
+    auto second = Service::MakeTemporaryOneshotService({"exec", "--", "/system/bin/second"});
+    ASSERT_RESULT_OK(second);
+
+    auto now = boot_clock::now();
+    service_list.ScheduleProcessAction(**second, now + 2s);
+    service_list.ScheduleProcessAction(**first, now + 1s);
+    service_list.ScheduleProcessAction(**first, now + 1s);
+    EXPECT_EQ(now + 1s, service_list.NextProcessActionTime());
+
+    EXPECT_TRUE(service_list.TakeDueProcessActions(now).empty());
+    EXPECT_EQ(std::vector<std::string>{(*first)->name()},
+              service_list.TakeDueProcessActions(now + 1500ms));
+    EXPECT_EQ(now + 2s, service_list.NextProcessActionTime());
+    EXPECT_EQ(std::vector<std::string>{(*second)->name()},
+              service_list.TakeDueProcessActions(now + 3s));
+    EXPECT_EQ(std::nullopt, service_list.NextProcessActionTime());
+}
+
+TEST(service_list, FindServiceByPid) {
+    ServiceList service_list;
+    auto first = Service::MakeTemporaryOneshotService({"exec", "--", "/system/bin/first"});
+    ASSERT_RESULT_OK(first);
+    auto second = Service::MakeTemporaryOneshotService({"exec", "--", "/system/bin/second"});
+    ASSERT_RESULT_OK(second);
+
+    service_list.UpdatePid(first->get(), 0, 100);
+    service_list.UpdatePid(second->get(), 0, 200);
+    EXPECT_EQ(first->get(), service_list.FindServiceByPid(100));
+    EXPECT_EQ(second->get(), service_list.FindServiceByPid(200));
+    EXPECT_EQ(nullptr, service_list.FindServiceByPid(300));
+
+    // A pid that was reused by another service stays with the new one.
+    service_list.UpdatePid(second->get(), 200, 100);
+    service_list.UpdatePid(first->get(), 100, 0);
+    EXPECT_EQ(second->get(), service_list.FindServiceByPid(100));
+    EXPECT_EQ(nullptr, service_list.FindServiceByPid(200));
+}
+
 }  // namespace init
 }  // namespace android
@@ -16,9 +16,11 @@
 
 #include "sigchld_handler.h"
 
+#include <poll.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -28,7 +30,10 @@
 #include <android-base/logging.h>
 #include <android-base/scopeguard.h>
 #include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
 
+#include <algorithm>
+#include <map>
 #include <thread>
 
 #include "init.h"
@@ -40,6 +45,7 @@ using android::base::make_scope_guard;
 using android::base::ReadFileToString;
 using android::base::StringPrintf;
 using android::base::Timer;
+using android::base::unique_fd;
 
 namespace android {
 namespace init {
@@ -74,7 +80,7 @@ static pid_t ReapOneProcess() {
     if (SubcontextChildReap(pid)) {
         name = "Subcontext";
     } else {
-        service = ServiceList::GetInstance().FindService(pid, &Service::pid);
+        service = ServiceList::GetInstance().FindServiceByPid(pid);
 
         if (service) {
             name = StringPrintf("Service '%s' (pid %d)", service->name().c_str(), pid);
@@ -124,6 +130,21 @@ void ReapAnyOutstandingChildren() {
 void WaitToBeReaped(const std::vector<pid_t>& pids, std::chrono::milliseconds timeout) {
     Timer t;
     std::vector<pid_t> alive_pids(pids.begin(), pids.end());
+
+    // A pidfd becomes readable once its process has exited, so wait on those instead of polling
+    // if the kernel supports them.
+    std::map<pid_t, unique_fd> pidfds;
+    for (pid_t pid : alive_pids) {
+        unique_fd pidfd(syscall(__NR_pidfd_open, pid, 0));
+        if (pidfd == -1) {
+            PLOG(WARNING) << "pidfd_open(" << pid << ") failed, polling instead";
+            pidfds.clear();
+            break;
+        }
+        pidfds.emplace(pid, std::move(pidfd));
+    }
+
+    std::vector<pollfd> pollfds;
     while (!alive_pids.empty() && t.duration() < timeout) {
         pid_t pid;
         while ((pid = ReapOneProcess()) != 0) {
@@ -135,11 +156,24 @@ void WaitToBeReaped(const std::vector<pid_t>& pids, std::chrono::milliseconds ti
         if (alive_pids.empty()) {
             break;
         }
-        std::this_thread::sleep_for(50ms);
+        if (pidfds.empty()) {
+            std::this_thread::sleep_for(50ms);
+            continue;
+        }
+        pollfds.clear();
+        for (pid_t alive_pid : alive_pids) {
+            pollfds.push_back({.fd = pidfds[alive_pid].get(), .events = POLLIN});
+        }
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(timeout - t.duration());
+        if (TEMP_FAILURE_RETRY(poll(pollfds.data(), pollfds.size(),
+                                    std::max<int64_t>(remaining.count(), 0))) == -1) {
+            PLOG(ERROR) << "poll on pidfds failed";
+            std::this_thread::sleep_for(50ms);
+        }
     }
     LOG(INFO) << "Waiting for " << pids.size() << " pids to be reaped took " << t << " with "
               << alive_pids.size() << " of them still running";
-    for (pid_t pid : pids) {
+    for (pid_t pid : alive_pids) {
         std::string status = "(no-such-pid)";
         ReadFileToString(StringPrintf("/proc/%d/status", pid), &status);
         LOG(INFO) << "Still running: " << pid << ' ' << status;
@@ -16,6 +16,7 @@
 
 #include "snapuserd_transition.h"
 
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/syscall.h>
@@ -23,6 +24,7 @@
 #include <unistd.h>
 
 #include <filesystem>
+#include <map>
 #include <string>
 #include <string_view>
 
@@ -58,6 +60,7 @@ static constexpr char kSnapuserdPath[] = "/system/bin/snapuserd";
 static constexpr char kSnapuserdFirstStagePidVar[] = "FIRST_STAGE_SNAPUSERD_PID";
 static constexpr char kSnapuserdFirstStageFdVar[] = "FIRST_STAGE_SNAPUSERD_FD";
 static constexpr char kSnapuserdFirstStageInfoVar[] = "FIRST_STAGE_SNAPUSERD_INFO";
+static constexpr char kSnapuserdFirstStageOpIndexVar[] = "FIRST_STAGE_SNAPUSERD_OP_INDEX";
 static constexpr char kSnapuserdLabel[] = "u:object_r:snapuserd_exec:s0";
 static constexpr char kSnapuserdSocketLabel[] = "u:object_r:snapuserd_socket:s0";
 
@@ -233,6 +236,56 @@ void SnapuserdSelinuxHelper::StartTransition() {
     if (!sm_->PrepareSnapuserdArgsForSelinux(&argv_)) {
         LOG(FATAL) << "Could not perform selinux transition";
     }
+    AddOpIndexArgs();
+}
+
+// The op index fds saved by SaveSnapuserdOpIndexes().
+static std::vector<int> GetSnapuserdOpIndexFds() {
+    std::vector<int> fds;
+    const char* value = getenv(kSnapuserdFirstStageOpIndexVar);
+    if (!value) {
+        return fds;
+    }
+    for (const auto& entry : android::base::Split(value, ",")) {
+        auto pos = entry.find('=');
+        int fd;
+        if (pos != std::string::npos && android::base::ParseInt(entry.substr(pos + 1), &fd, 0)) {
+            fds.emplace_back(fd);
+        }
+    }
+    return fds;
+}
+
+// Pass the op indexes saved by SaveSnapuserdOpIndexes() to the new daemon,
+// as a fifth sub-argument of the matching user-space snapshot arguments.
+void SnapuserdSelinuxHelper::AddOpIndexArgs() {
+    const char* value = getenv(kSnapuserdFirstStageOpIndexVar);
+    if (!value) {
+        return;
+    }
+    std::map<std::string, std::string> op_indexes;
+    for (const auto& entry : android::base::Split(value, ",")) {
+        auto pos = entry.find('=');
+        if (pos == std::string::npos) {
+            continue;
+        }
+        op_indexes[entry.substr(0, pos)] = entry.substr(pos + 1);
+    }
+    op_index_fds_ = GetSnapuserdOpIndexFds();
+    unsetenv(kSnapuserdFirstStageOpIndexVar);
+
+    for (auto& arg : argv_) {
+        auto parts = android::base::Split(arg, ",");
+        if (parts.size() != 4) {
+            continue;
+        }
+        // First-stage handlers are named after the partition with an "-init"
+        // suffix.
+        auto iter = op_indexes.find(parts[0] + "-init");
+        if (iter != op_indexes.end()) {
+            arg += "," + iter->second;
+        }
+    }
 }
 
 void SnapuserdSelinuxHelper::FinishTransition() {
@@ -334,9 +387,13 @@ void SnapuserdSelinuxHelper::RelaunchFirstStageSnapuserd() {
         PLOG(FATAL) << "Fork to relaunch snapuserd failed";
     }
     if (pid > 0) {
-        // We don't need the descriptor anymore, and it should be closed to
+        // We don't need the descriptors anymore, and they should be closed to
         // avoid leaking into subprocesses.
         close(fd.value());
+        for (int op_index_fd : op_index_fds_) {
+            close(op_index_fd);
+        }
+        op_index_fds_.clear();
 
         setenv(kSnapuserdFirstStagePidVar, std::to_string(pid).c_str(), 1);
 
@@ -363,6 +420,12 @@ void SnapuserdSelinuxHelper::RelaunchFirstStageSnapuserd() {
     if (fcntl(fd.value(), F_SETFD, FD_CLOEXEC) < 0) {
         PLOG(FATAL) << "fcntl FD_CLOEXEC failed for snapuserd fd";
     }
+    // The op indexes, on the other hand, are only meant for the new daemon.
+    for (int op_index_fd : op_index_fds_) {
+        if (fcntl(op_index_fd, F_SETFD, 0) < 0) {
+            PLOG(FATAL) << "fcntl failed for op index fd " << op_index_fd;
+        }
+    }
 
     std::vector<char*> argv;
     for (auto& arg : argv_) {
@@ -402,12 +465,61 @@ void KillFirstStageSnapuserd(pid_t pid) {
     }
 }
 
+// Keep the op indexes built by first-stage snapuserd open, so that the daemon
+// relaunched for the selinux transition can map them instead of parsing the
+// COWs again. They stay close-on-exec until KeepSnapuserdOpIndexesAcrossExec().
+static void SaveSnapuserdOpIndexes() {
+    // There is no selinux transition of snapuserd in recovery.
+    if (IsRecoveryMode()) {
+        return;
+    }
+    auto client = SnapuserdClient::Connect(android::snapshot::kSnapuserdSocket, 3s);
+    if (!client) {
+        return;
+    }
+    std::map<std::string, unique_fd> op_indexes;
+    if (!client->ExportOpIndexes(&op_indexes)) {
+        LOG(INFO) << "snapuserd did not export op indexes";
+        return;
+    }
+
+    std::vector<std::string> entries;
+    for (auto& [misc_name, fd] : op_indexes) {
+        entries.emplace_back(misc_name + "=" + std::to_string(fd.release()));
+    }
+    if (!entries.empty()) {
+        setenv(kSnapuserdFirstStageOpIndexVar, android::base::Join(entries, ",").c_str(), 1);
+    }
+}
+
+void KeepSnapuserdOpIndexesAcrossExec() {
+    for (int fd : GetSnapuserdOpIndexFds()) {
+        if (fcntl(fd, F_SETFD, 0) < 0) {
+            // A closed fd number could be reused by the time the daemon is
+            // relaunched, so hand over all of them or none.
+            PLOG(ERROR) << "fcntl failed for op index fd " << fd;
+            unsetenv(kSnapuserdFirstStageOpIndexVar);
+            return;
+        }
+    }
+}
+
+void CloseSnapuserdOpIndexesOnExec() {
+    for (int fd : GetSnapuserdOpIndexFds()) {
+        if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+            PLOG(ERROR) << "fcntl FD_CLOEXEC failed for op index fd " << fd;
+        }
+    }
+}
+
 void CleanupSnapuserdSocket() {
     auto socket_path = ANDROID_SOCKET_DIR "/"s + android::snapshot::kSnapuserdSocket;
     if (access(socket_path.c_str(), F_OK) != 0) {
         return;
     }
 
+    SaveSnapuserdOpIndexes();
+
     // Tell the daemon to stop accepting connections and to gracefully exit
     // once all outstanding handlers have terminated.
     if (auto client = SnapuserdClient::Connect(android::snapshot::kSnapuserdSocket, 3s)) {
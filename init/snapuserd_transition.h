@@ -54,6 +54,7 @@ class SnapuserdSelinuxHelper final {
     static std::unique_ptr<SnapuserdSelinuxHelper> CreateIfNeeded();
 
   private:
+    void AddOpIndexArgs();
     void RelaunchFirstStageSnapuserd();
     void ExecSnapuserd();
     bool TestSnapuserdIsReady();
@@ -62,6 +63,8 @@ class SnapuserdSelinuxHelper final {
     BlockDevInitializer block_dev_init_;
     pid_t old_pid_;
     std::vector<std::string> argv_;
+    // Inherited op index memfds passed to the new daemon through argv_.
+    std::vector<int> op_index_fds_;
 };
 
 // Remove /dev/socket/snapuserd. This ensures that (1) the existing snapuserd
@@ -69,6 +72,13 @@ class SnapuserdSelinuxHelper final {
 // own the socket.
 void CleanupSnapuserdSocket();
 
+// The op indexes saved by CleanupSnapuserdSocket() are close-on-exec, except
+// across the exec of init from first stage into the selinux stage, and are
+// then inherited only by the relaunched snapuserd. Call the first right before
+// that exec, and the second as soon as the selinux stage starts.
+void KeepSnapuserdOpIndexesAcrossExec();
+void CloseSnapuserdOpIndexesOnExec();
+
 // Kill an instance of snapuserd given a pid.
 void KillFirstStageSnapuserd(pid_t pid);
 
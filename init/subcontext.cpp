@@ -22,6 +22,7 @@
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
@@ -68,6 +69,8 @@ class SubcontextProcess {
   private:
     void RunCommand(const SubcontextCommand::ExecuteCommand& execute_command,
                     SubcontextReply* reply) const;
+    void RunCommands(const SubcontextCommand::ExecuteBatchCommand& execute_batch_command,
+                     SubcontextReply* reply) const;
     void ExpandArgs(const SubcontextCommand::ExpandArgsCommand& expand_args_command,
                     SubcontextReply* reply) const;
 
@@ -101,6 +104,44 @@ void SubcontextProcess::RunCommand(const SubcontextCommand::ExecuteCommand& exec
     }
 }
 
+void SubcontextProcess::RunCommands(
+        const SubcontextCommand::ExecuteBatchCommand& execute_batch_command,
+        SubcontextReply* reply) const {
+    // Room in a reply for a result's tag and length, |last| and a trigger_shutdown command.
+    static constexpr size_t kReplySlack = 256;
+
+    for (const auto& execute_command : execute_batch_command.commands()) {
+        auto command_reply = SubcontextReply();
+        android::base::Timer t;
+        RunCommand(execute_command, &command_reply);
+
+        auto result = SubcontextReply::ExecuteBatchReply::Result();
+        if (command_reply.has_failure()) {
+            *result.mutable_failure() = command_reply.failure();
+        }
+        result.set_duration_ms(t.duration().count());
+
+        // Send the results so far once this one won't fit with them.  A single result that is
+        // too large on its own fails to send, just as it would for an ExecuteCommand.
+        auto* batch_reply = reply->mutable_execute_batch_reply();
+        if (batch_reply->results_size() > 0 &&
+            reply->ByteSizeLong() + result.ByteSizeLong() + kReplySlack > kBufferSize) {
+            if (auto send_result = SendMessage(init_fd_, *reply); !send_result.ok()) {
+                LOG(FATAL) << "Failed to send message to init: " << send_result.error();
+            }
+            reply->Clear();
+            batch_reply = reply->mutable_execute_batch_reply();
+        }
+        *batch_reply->add_results() = std::move(result);
+
+        // Init handles a shutdown before running any more commands.
+        if (!shutdown_command.empty()) {
+            break;
+        }
+    }
+    reply->mutable_execute_batch_reply()->set_last(true);
+}
+
 void SubcontextProcess::ExpandArgs(const SubcontextCommand::ExpandArgsCommand& expand_args_command,
                                    SubcontextReply* reply) const {
     for (const auto& arg : expand_args_command.args()) {
@@ -156,6 +197,10 @@ void SubcontextProcess::MainLoop() {
                 ExpandArgs(subcontext_command.expand_args_command(), &reply);
                 break;
             }
+            case SubcontextCommand::kExecuteBatchCommand: {
+                RunCommands(subcontext_command.execute_batch_command(), &reply);
+                break;
+            }
             default:
                 LOG(FATAL) << "Unknown message type from init: "
                            << subcontext_command.command_case();
@@ -273,6 +318,10 @@ Result<SubcontextReply> Subcontext::TransmitMessage(const SubcontextCommand& sub
         return ErrnoError() << "Failed to send message to subcontext";
     }
 
+    return ReceiveReply();
+}
+
+Result<SubcontextReply> Subcontext::ReceiveReply() {
     auto subcontext_message = ReadMessage(socket_.get());
     if (!subcontext_message.ok()) {
         Restart();
@@ -316,6 +365,76 @@ Result<void> Subcontext::Execute(const std::vector<std::string>& args) {
     return {};
 }
 
+std::vector<Subcontext::BatchResult> Subcontext::ExecuteBatch(
+        const std::vector<std::vector<std::string>>& commands) {
+    auto results = std::vector<BatchResult>();
+    if (commands.empty()) {
+        return results;
+    }
+
+    // Room in the message for the tags and lengths of subcontext_command's fields.
+    static constexpr size_t kCommandSlack = 16;
+
+    auto subcontext_command = SubcontextCommand();
+    auto* execute_batch_command = subcontext_command.mutable_execute_batch_command();
+    size_t message_size = kCommandSlack;
+    for (const auto& args : commands) {
+        auto* execute_command = execute_batch_command->add_commands();
+        std::copy(args.begin(), args.end(),
+                  RepeatedPtrFieldBackInserter(execute_command->mutable_args()));
+        message_size += execute_command->ByteSizeLong() + kCommandSlack;
+        // Leave the rest for the next batch if this one doesn't fit in a message.
+        if (execute_batch_command->commands_size() > 1 && message_size > kBufferSize) {
+            execute_batch_command->mutable_commands()->RemoveLast();
+            break;
+        }
+    }
+    size_t num_commands = execute_batch_command->commands_size();
+
+    android::base::Timer t;
+    auto subcontext_reply = TransmitMessage(subcontext_command);
+    while (true) {
+        if (subcontext_reply.ok()) {
+            // The subcontext may still be sending replies, so it must be restarted to get back in
+            // sync with it.
+            if (subcontext_reply->reply_case() != SubcontextReply::kExecuteBatchReply) {
+                Restart();
+                subcontext_reply = Error() << "Unexpected message type from subcontext: "
+                                           << subcontext_reply->reply_case();
+            } else if (results.size() + subcontext_reply->execute_batch_reply().results_size() >
+                       num_commands) {
+                Restart();
+                subcontext_reply = Error() << "Too many results from subcontext";
+            }
+        }
+        if (!subcontext_reply.ok()) {
+            results.emplace_back(BatchResult{subcontext_reply.error(), t.duration()});
+            return results;
+        }
+
+        const auto& batch_reply = subcontext_reply->execute_batch_reply();
+        for (const auto& result : batch_reply.results()) {
+            auto duration = std::chrono::milliseconds(result.duration_ms());
+            if (result.has_failure()) {
+                auto& failure = result.failure();
+                results.emplace_back(BatchResult{
+                        ResultError<>(failure.error_string(), failure.error_errno()), duration});
+            } else {
+                results.emplace_back(BatchResult{{}, duration});
+            }
+        }
+        if (batch_reply.last()) {
+            break;
+        }
+        subcontext_reply = ReceiveReply();
+    }
+
+    if (results.empty()) {
+        results.emplace_back(BatchResult{Error() << "No results from subcontext", t.duration()});
+    }
+    return results;
+}
+
 Result<std::vector<std::string>> Subcontext::ExpandArgs(const std::vector<std::string>& args) {
     auto subcontext_command = SubcontextCommand{};
     std::copy(args.begin(), args.end(),
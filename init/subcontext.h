@@ -18,6 +18,7 @@
 
 #include <signal.h>
 
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -45,7 +46,17 @@ class Subcontext {
         }
     }
 
+    struct BatchResult {
+        Result<void> result;
+        std::chrono::milliseconds duration;
+    };
+
     Result<void> Execute(const std::vector<std::string>& args);
+    // Executes the commands in order, sending as many of them as fit to the subcontext in one
+    // message, and returns the results of those that were executed.  This is at least one, unless
+    // |commands| is empty.  Fewer commands are executed than were sent if one triggers a shutdown,
+    // and if communication with the subcontext fails, the last result holds that error.
+    std::vector<BatchResult> ExecuteBatch(const std::vector<std::vector<std::string>>& commands);
     Result<std::vector<std::string>> ExpandArgs(const std::vector<std::string>& args);
     void Restart();
     bool PathMatchesSubcontext(const std::string& path) const;
@@ -57,6 +68,7 @@ class Subcontext {
   private:
     void Fork();
     Result<SubcontextReply> TransmitMessage(const SubcontextCommand& subcontext_command);
+    Result<SubcontextReply> ReceiveReply();
 
     std::vector<std::string> path_prefixes_;
     std::vector<std::string> apex_list_;
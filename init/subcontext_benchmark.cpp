@@ -48,6 +48,36 @@ static void BenchmarkSuccess(benchmark::State& state) {
 
 BENCHMARK(BenchmarkSuccess);
 
+static void BenchmarkBatchSuccess(benchmark::State& state) {
+    if (getuid() != 0) {
+        state.SkipWithError("Skipping benchmark, must be run as root.");
+        return;
+    }
+    char* context;
+    if (getcon(&context) != 0) {
+        state.SkipWithError("getcon() failed");
+        return;
+    }
+
+    auto subcontext = Subcontext({"path"}, context);
+    free(context);
+
+    // ExecuteBatch() may run fewer than all of the commands, so count those it did run.
+    auto commands = std::vector<std::vector<std::string>>(state.range(0), {"return_success"});
+    int64_t commands_executed = 0;
+    while (state.KeepRunning()) {
+        commands_executed += subcontext.ExecuteBatch(commands).size();
+    }
+    state.SetItemsProcessed(commands_executed);
+
+    if (subcontext.pid() > 0) {
+        kill(subcontext.pid(), SIGTERM);
+        kill(subcontext.pid(), SIGKILL);
+    }
+}
+
+BENCHMARK(BenchmarkBatchSuccess)->Arg(1)->Arg(16)->Arg(256);
+
 BuiltinFunctionMap BuildTestFunctionMap() {
     auto function = [](const BuiltinArguments& args) { return Result<void>{}; };
     BuiltinFunctionMap test_function_map = {
@@ -148,6 +148,80 @@ TEST(subcontext, TriggerShutdown) {
     EXPECT_EQ(kTestShutdownCommand, trigger_shutdown_command);
 }
 
+TEST(subcontext, ExecuteBatch) {
+    RunTest([](auto& subcontext) {
+        auto first_pid = subcontext.pid();
+
+        auto commands = std::vector<std::vector<std::string>>{
+                {"add_word", "this"},
+                {"generate_sane_error"},
+                {"add_word", "is"},
+                {"return_words_as_error"},
+        };
+        auto results = subcontext.ExecuteBatch(commands);
+        ASSERT_EQ(4U, results.size());
+        EXPECT_RESULT_OK(results[0].result);
+        ASSERT_FALSE(results[1].result.ok());
+        EXPECT_EQ("Sane error!", results[1].result.error().message());
+        EXPECT_RESULT_OK(results[2].result);
+        ASSERT_FALSE(results[3].result.ok());
+        EXPECT_EQ("this is", results[3].result.error().message());
+        EXPECT_EQ(first_pid, subcontext.pid());
+    });
+}
+
+TEST(subcontext, ExecuteBatchSplitsMessages) {
+    RunTest([](auto& subcontext) {
+        auto first_pid = subcontext.pid();
+
+        // Too many commands to send at once.
+        auto commands = std::vector<std::vector<std::string>>();
+        for (int i = 0; i < 1000; ++i) {
+            commands.emplace_back(std::vector<std::string>{"add_word", std::to_string(i)});
+        }
+        auto expected_words = std::vector<std::string>();
+        for (size_t i = 0; i < commands.size();) {
+            auto results = subcontext.ExecuteBatch(
+                    std::vector<std::vector<std::string>>(commands.begin() + i, commands.end()));
+            ASSERT_GT(results.size(), 0U);
+            ASSERT_LT(results.size(), commands.size());
+            for (const auto& result : results) {
+                ASSERT_RESULT_OK(result.result);
+                expected_words.emplace_back(std::to_string(i++));
+            }
+        }
+        auto result = subcontext.Execute(std::vector<std::string>{"return_words_as_error"});
+        ASSERT_FALSE(result.ok());
+        EXPECT_EQ(Join(expected_words, " "), result.error().message());
+
+        // Results that are too large to return at once.
+        commands = std::vector<std::vector<std::string>>(10, {"generate_long_error"});
+        auto results = subcontext.ExecuteBatch(commands);
+        ASSERT_EQ(10U, results.size());
+        for (const auto& result : results) {
+            ASSERT_FALSE(result.result.ok());
+            EXPECT_EQ(std::string(1000, 'e'), result.result.error().message());
+        }
+        EXPECT_EQ(first_pid, subcontext.pid());
+    });
+}
+
+TEST(subcontext, ExecuteBatchStopsOnShutdown) {
+    static constexpr const char kTestShutdownCommand[] = "reboot,test-shutdown-command";
+    static std::string trigger_shutdown_command;
+    trigger_shutdown = [](const std::string& command) { trigger_shutdown_command = command; };
+    RunTest([](auto& subcontext) {
+        auto commands = std::vector<std::vector<std::string>>{
+                {"trigger_shutdown", kTestShutdownCommand},
+                {"generate_sane_error"},
+        };
+        auto results = subcontext.ExecuteBatch(commands);
+        ASSERT_EQ(1U, results.size());
+        EXPECT_RESULT_OK(results[0].result);
+    });
+    EXPECT_EQ(kTestShutdownCommand, trigger_shutdown_command);
+}
+
 TEST(subcontext, ExpandArgs) {
     RunTest([](auto& subcontext) {
         auto args = std::vector<std::string>{
@@ -210,6 +284,11 @@ BuiltinFunctionMap BuildTestFunctionMap() {
         return Error() << "Sane error!";
     };
 
+    // For ExecuteBatchSplitsMessages
+    auto do_generate_long_error = [](const BuiltinArguments& args) -> Result<void> {
+        return Error() << std::string(1000, 'e');
+    };
+
     // For ContextString
     auto do_return_context_as_error = [](const BuiltinArguments& args) -> Result<void> {
         return Error() << args.context;
@@ -228,6 +307,7 @@ BuiltinFunctionMap BuildTestFunctionMap() {
         {"return_words_as_error",       {0,     0,      {true,  do_return_words_as_error}}},
         {"cause_log_fatal",             {0,     0,      {true,  do_cause_log_fatal}}},
         {"generate_sane_error",         {0,     0,      {true,  do_generate_sane_error}}},
+        {"generate_long_error",         {0,     0,      {true,  do_generate_long_error}}},
         {"return_context_as_error",     {0,     0,      {true,  do_return_context_as_error}}},
         {"trigger_shutdown",            {1,     1,      {true,  do_trigger_shutdown}}},
     };
@@ -17,8 +17,12 @@
 #ifndef _INIT_UEVENT_H
 #define _INIT_UEVENT_H
 
+#include <stdint.h>
+
 #include <string>
 
+#include <android-base/chrono_utils.h>
+
 namespace android {
 namespace init {
 
@@ -33,6 +37,9 @@ struct Uevent {
     int partition_num;
     int major;
     int minor;
+    uint64_t seqnum = 0;
+    // When ueventd read the uevent from the kernel.
+    android::base::boot_clock::time_point received;
 };
 
 }  // namespace init
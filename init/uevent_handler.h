@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <string>
+
 #include "uevent.h"
 
 namespace android {
@@ -28,6 +30,9 @@ class UeventHandler {
     virtual void HandleUevent(const Uevent& uevent) = 0;
 
     virtual void ColdbootDone() {}
+
+    // Used to tell handlers apart in statistics.
+    virtual std::string Name() const { return "uevent"; }
 };
 
 }  // namespace init
@@ -17,8 +17,11 @@
 #include "uevent_listener.h"
 
 #include <fcntl.h>
+#include <linux/netlink.h>
 #include <poll.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include <memory>
@@ -29,6 +32,22 @@
 namespace android {
 namespace init {
 
+// Number of uevents received by a single recvmmsg() call. Coldboot regenerates
+// thousands of uevents, and reading them one recvmsg() at a time dominates.
+static constexpr unsigned int kUeventBatchSize = 32;
+
+struct UeventBatch {
+    char msgs[kUeventBatchSize][UEVENT_MSG_LEN + 2];
+    iovec iovs[kUeventBatchSize];
+    sockaddr_nl addrs[kUeventBatchSize];
+    char controls[kUeventBatchSize][CMSG_SPACE(sizeof(ucred))];
+    mmsghdr hdrs[kUeventBatchSize];
+    // Messages [next, count) have been received but not yet parsed.
+    unsigned int next = 0;
+    unsigned int count = 0;
+    android::base::boot_clock::time_point received;
+};
+
 static void ParseEvent(const char* msg, Uevent* uevent) {
     uevent->partition_num = -1;
     uevent->major = -1;
@@ -40,7 +59,7 @@ static void ParseEvent(const char* msg, Uevent* uevent) {
     uevent->partition_name.clear();
     uevent->device_name.clear();
     uevent->modalias.clear();
-    // currently ignoring SEQNUM
+    uevent->seqnum = 0;
     while (*msg) {
         if (!strncmp(msg, "ACTION=", 7)) {
             msg += 7;
@@ -72,6 +91,9 @@ static void ParseEvent(const char* msg, Uevent* uevent) {
         } else if (!strncmp(msg, "MODALIAS=", 9)) {
             msg += 9;
             uevent->modalias = msg;
+        } else if (!strncmp(msg, "SEQNUM=", 7)) {
+            msg += 7;
+            uevent->seqnum = strtoull(msg, nullptr, 10);
         }
 
         // advance to after the next \0
@@ -93,30 +115,91 @@ UeventListener::UeventListener(size_t uevent_socket_rcvbuf_size) {
     }
 
     fcntl(device_fd_.get(), F_SETFL, O_NONBLOCK);
+
+    batch_ = std::make_unique<UeventBatch>();
 }
 
-ReadUeventResult UeventListener::ReadUevent(Uevent* uevent) const {
-    char msg[UEVENT_MSG_LEN + 2];
-    int n = uevent_kernel_multicast_recv(device_fd_.get(), msg, UEVENT_MSG_LEN);
+UeventListener::~UeventListener() = default;
+
+// Refills batch_ with as many pending uevents as are available, up to
+// kUeventBatchSize. Returns false if there are none.
+bool UeventListener::ReceiveUevents() const {
+    auto& batch = *batch_;
+    batch.next = 0;
+    batch.count = 0;
+
+    for (unsigned int i = 0; i < kUeventBatchSize; i++) {
+        batch.iovs[i] = {batch.msgs[i], UEVENT_MSG_LEN};
+        batch.hdrs[i] = {};
+        auto& hdr = batch.hdrs[i].msg_hdr;
+        hdr.msg_name = &batch.addrs[i];
+        hdr.msg_namelen = sizeof(batch.addrs[i]);
+        hdr.msg_iov = &batch.iovs[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = batch.controls[i];
+        hdr.msg_controllen = sizeof(batch.controls[i]);
+    }
+
+    int n = TEMP_FAILURE_RETRY(
+            recvmmsg(device_fd_.get(), batch.hdrs, kUeventBatchSize, 0, nullptr));
     if (n <= 0) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
             PLOG(ERROR) << "Error reading from Uevent Fd";
         }
+        return false;
+    }
+    batch.count = n;
+    batch.received = android::base::boot_clock::now();
+    return true;
+}
+
+ReadUeventResult UeventListener::ReadUevent(Uevent* uevent) const {
+    auto& batch = *batch_;
+    if (batch.next == batch.count && !ReceiveUevents()) {
         return ReadUeventResult::kFailed;
     }
+
+    unsigned int i = batch.next++;
+    auto& hdr = batch.hdrs[i].msg_hdr;
+    size_t n = batch.hdrs[i].msg_len;
     if (n >= UEVENT_MSG_LEN) {
         LOG(ERROR) << "Uevent overflowed buffer, discarding";
         return ReadUeventResult::kInvalid;
     }
 
+    // The same checks as uevent_kernel_multicast_recv(), plus the sender uid:
+    // only accept multicast messages from the kernel.
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_CREDENTIALS ||
+        reinterpret_cast<ucred*>(CMSG_DATA(cmsg))->uid != 0 || batch.addrs[i].nl_pid != 0 ||
+        batch.addrs[i].nl_groups == 0) {
+        LOG(ERROR) << "Ignoring uevent not multicast by the kernel";
+        return ReadUeventResult::kInvalid;
+    }
+
+    char* msg = batch.msgs[i];
     msg[n] = '\0';
     msg[n + 1] = '\0';
 
     ParseEvent(msg, uevent);
+    uevent->received = batch.received;
 
     return ReadUeventResult::kSuccess;
 }
 
+// Passes every pending uevent to |callback|, until there are none left or it
+// returns kStop.
+ListenerAction UeventListener::ReadUevents(const ListenerCallback& callback) const {
+    Uevent uevent;
+    ReadUeventResult result;
+    while ((result = ReadUevent(&uevent)) != ReadUeventResult::kFailed) {
+        // Skip processing the uevent if it is invalid.
+        if (result == ReadUeventResult::kInvalid) continue;
+        if (callback(uevent) == ListenerAction::kStop) return ListenerAction::kStop;
+    }
+    return ListenerAction::kContinue;
+}
+
 // RegenerateUevents*() walks parts of the /sys tree and pokes the uevent files to cause the kernel
 // to regenerate device add uevents that have already happened.  This is particularly useful when
 // starting ueventd, to regenerate all of the uevents that it had previously missed.
@@ -134,13 +217,7 @@ ListenerAction UeventListener::RegenerateUeventsForDir(DIR* d,
         write(fd, "add\n", 4);
         close(fd);
 
-        Uevent uevent;
-        ReadUeventResult result;
-        while ((result = ReadUevent(&uevent)) != ReadUeventResult::kFailed) {
-            // Skip processing the uevent if it is invalid.
-            if (result == ReadUeventResult::kInvalid) continue;
-            if (callback(uevent) == ListenerAction::kStop) return ListenerAction::kStop;
-        }
+        if (ReadUevents(callback) == ListenerAction::kStop) return ListenerAction::kStop;
     }
 
     dirent* de;
@@ -189,6 +266,12 @@ void UeventListener::Poll(const ListenerCallback& callback,
             .fd = device_fd_.get(),
     };
 
+    // The socket does not poll as readable for uevents that an earlier call
+    // already received, so hand those out first.
+    if (batch_->next != batch_->count && ReadUevents(callback) == ListenerAction::kStop) {
+        return;
+    }
+
     auto start_time = steady_clock::now();
 
     while (true) {
@@ -213,13 +296,7 @@ void UeventListener::Poll(const ListenerCallback& callback,
         if (ufd.revents & POLLIN) {
             // We're non-blocking, so if we receive a poll event keep processing until
             // we have exhausted all uevent messages.
-            Uevent uevent;
-            ReadUeventResult result;
-            while ((result = ReadUevent(&uevent)) != ReadUeventResult::kFailed) {
-                // Skip processing the uevent if it is invalid.
-                if (result == ReadUeventResult::kInvalid) continue;
-                if (callback(uevent) == ListenerAction::kStop) return;
-            }
+            if (ReadUevents(callback) == ListenerAction::kStop) return;
         }
     }
 }
@@ -21,6 +21,7 @@
 
 #include <chrono>
 #include <functional>
+#include <memory>
 #include <optional>
 
 #include <android-base/unique_fd.h>
@@ -45,9 +46,12 @@ enum class ReadUeventResult {
 
 using ListenerCallback = std::function<ListenerAction(const Uevent&)>;
 
+struct UeventBatch;
+
 class UeventListener {
   public:
     UeventListener(size_t uevent_socket_rcvbuf_size);
+    ~UeventListener();
 
     void RegenerateUevents(const ListenerCallback& callback) const;
     ListenerAction RegenerateUeventsForPath(const std::string& path,
@@ -57,9 +61,14 @@ class UeventListener {
 
   private:
     ReadUeventResult ReadUevent(Uevent* uevent) const;
+    bool ReceiveUevents() const;
+    ListenerAction ReadUevents(const ListenerCallback& callback) const;
     ListenerAction RegenerateUeventsForDir(DIR* d, const ListenerCallback& callback) const;
 
     android::base::unique_fd device_fd_;
+    // Uevents received from device_fd_ but not yet returned by ReadUevent(). They are kept
+    // across calls, so that a callback returning kStop does not lose the rest of a batch.
+    std::unique_ptr<UeventBatch> batch_;
 };
 
 }  // namespace init
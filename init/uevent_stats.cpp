@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "uevent_stats.h"
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+using android::base::boot_clock;
+using android::base::StringPrintf;
+using namespace std::chrono_literals;
+
+namespace android {
+namespace init {
+
+static constexpr auto kSlowUeventThreshold = 50ms;
+
+static std::string FormatMicroseconds(std::chrono::microseconds us) {
+    if (us >= 10ms) {
+        return std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(us).count()) +
+               "ms";
+    }
+    return std::to_string(us.count()) + "us";
+}
+
+void LatencyHistogram::Add(std::chrono::nanoseconds latency) {
+    uint64_t us = std::max<int64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), 0);
+    // Bucket i holds latencies of at most 2^i us.
+    size_t bucket = 0;
+    while (bucket + 1 < kNumBuckets && (uint64_t(1) << bucket) < us) {
+        bucket++;
+    }
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = max_us_.load(std::memory_order_relaxed);
+    while (us > max && !max_us_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::count() const {
+    uint64_t count = 0;
+    for (const auto& bucket : buckets_) {
+        count += bucket.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+std::chrono::microseconds LatencyHistogram::Percentile(double percentile) const {
+    uint64_t total = count();
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        // The last bucket has no upper bound but the maximum.
+        if (seen > 0 && seen * 100.0 >= total * percentile && i + 1 < kNumBuckets) {
+            return std::min(std::chrono::microseconds(uint64_t(1) << i), max());
+        }
+    }
+    return max();
+}
+
+std::string LatencyHistogram::ToString() const {
+    return StringPrintf("n=%" PRIu64 " p50<=%s p90<=%s p99<=%s max=%s", count(),
+                        FormatMicroseconds(Percentile(50)).c_str(),
+                        FormatMicroseconds(Percentile(90)).c_str(),
+                        FormatMicroseconds(Percentile(99)).c_str(),
+                        FormatMicroseconds(max()).c_str());
+}
+
+void HandleUeventWithStats(const std::vector<std::unique_ptr<UeventHandler>>& handlers,
+                           const Uevent& uevent, UeventStats* stats, bool log_slow_waits) {
+    for (size_t i = 0; i < handlers.size(); i++) {
+        auto start = boot_clock::now();
+        handlers[i]->HandleUevent(uevent);
+        auto duration = boot_clock::now() - start;
+
+        if (i < UeventStats::kMaxHandlers) {
+            stats->handlers[i].Add(duration);
+        }
+        if (duration > kSlowUeventThreshold) {
+            LOG(WARNING) << "Slow uevent: " << handlers[i]->Name() << " handler took "
+                         << std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()
+                         << "ms for seqnum " << uevent.seqnum << " " << uevent.action << " "
+                         << uevent.path;
+        }
+    }
+
+    if (uevent.received != boot_clock::time_point()) {
+        auto latency = boot_clock::now() - uevent.received;
+        stats->total.Add(latency);
+        if (log_slow_waits && latency > kSlowUeventThreshold) {
+            LOG(WARNING) << "Slow uevent: seqnum " << uevent.seqnum << " " << uevent.action << " "
+                         << uevent.path << " done "
+                         << std::chrono::duration_cast<std::chrono::milliseconds>(latency).count()
+                         << "ms after it was received";
+        }
+    }
+}
+
+void LogUeventStats(const std::string& title,
+                    const std::vector<std::unique_ptr<UeventHandler>>& handlers,
+                    const UeventStats& stats) {
+    LOG(INFO) << title << " uevent latency: " << stats.total.ToString();
+    for (size_t i = 0; i < handlers.size() && i < UeventStats::kMaxHandlers; i++) {
+        LOG(INFO) << title << " " << handlers[i]->Name()
+                  << " handler: " << stats.handlers[i].ToString();
+    }
+}
+
+}  // namespace init
+}  // namespace android
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "uevent.h"
+#include "uevent_handler.h"
+
+namespace android {
+namespace init {
+
+// Latencies counted in power-of-two microsecond buckets. Only lock-free atomics are used, so a
+// histogram can live in memory shared with the coldboot subprocesses.
+class LatencyHistogram {
+  public:
+    void Add(std::chrono::nanoseconds latency);
+
+    uint64_t count() const;
+    // Upper bound of the bucket that holds the given percentile (0-100) of latencies.
+    std::chrono::microseconds Percentile(double percentile) const;
+    std::chrono::microseconds max() const { return std::chrono::microseconds(max_us_.load()); }
+
+    // For example "n=812 p50<=64us p90<=512us p99<=8ms max=23ms".
+    std::string ToString() const;
+
+  private:
+    // The last bucket also holds everything above 2^(kNumBuckets - 1) us, about 8s.
+    static constexpr size_t kNumBuckets = 24;
+    std::atomic<uint64_t> buckets_[kNumBuckets] = {};
+    std::atomic<uint64_t> max_us_ = 0;
+};
+
+struct UeventStats {
+    static constexpr size_t kMaxHandlers = 4;
+    // Time spent in each handler, indexed like the handlers.
+    LatencyHistogram handlers[kMaxHandlers];
+    // From ueventd receiving the uevent until every handler is done with it.
+    LatencyHistogram total;
+};
+
+// Runs |uevent| through |handlers|, recording the time taken in |stats|. Logs handlers that take
+// longer than 50ms, and with |log_slow_waits|, uevents done more than 50ms after being received.
+void HandleUeventWithStats(const std::vector<std::unique_ptr<UeventHandler>>& handlers,
+                           const Uevent& uevent, UeventStats* stats, bool log_slow_waits);
+
+void LogUeventStats(const std::string& title,
+                    const std::vector<std::unique_ptr<UeventHandler>>& handlers,
+                    const UeventStats& stats);
+
+}  // namespace init
+}  // namespace android
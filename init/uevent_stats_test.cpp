@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "uevent_stats.h"
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+namespace android {
+namespace init {
+
+TEST(uevent_stats, Histogram) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(0u, histogram.count());
+
+    for (int i = 0; i < 98; i++) {
+        histogram.Add(100us);
+    }
+    histogram.Add(3ms);
+    histogram.Add(20ms);
+
+    EXPECT_EQ(100u, histogram.count());
+    EXPECT_EQ(128us, histogram.Percentile(50));
+    EXPECT_EQ(4096us, histogram.Percentile(99));
+    EXPECT_EQ(20ms, histogram.Percentile(100));
+    EXPECT_EQ(20ms, histogram.max());
+    EXPECT_EQ("n=100 p50<=128us p90<=128us p99<=4096us max=20ms", histogram.ToString());
+}
+
+TEST(uevent_stats, HistogramOverflow) {
+    LatencyHistogram histogram;
+    histogram.Add(1h);
+    histogram.Add(-1ms);
+    EXPECT_EQ(2u, histogram.count());
+    EXPECT_EQ(1h, histogram.max());
+    EXPECT_EQ(1h, histogram.Percentile(100));
+}
+
+class CountingHandler : public UeventHandler {
+  public:
+    void HandleUevent(const Uevent&) override { count++; }
+    int count = 0;
+};
+
+TEST(uevent_stats, HandleUevent) {
+    std::vector<std::unique_ptr<UeventHandler>> handlers;
+    handlers.emplace_back(std::make_unique<CountingHandler>());
+    handlers.emplace_back(std::make_unique<CountingHandler>());
+
+    UeventStats stats;
+    Uevent uevent = {};
+    uevent.action = "add";
+    uevent.path = "/devices/foo";
+    HandleUeventWithStats(handlers, uevent, &stats, true);
+    uevent.received = android::base::boot_clock::now();
+    HandleUeventWithStats(handlers, uevent, &stats, true);
+
+    EXPECT_EQ(2, static_cast<CountingHandler*>(handlers[0].get())->count);
+    EXPECT_EQ(2, static_cast<CountingHandler*>(handlers[1].get())->count);
+    EXPECT_EQ(2u, stats.handlers[0].count());
+    EXPECT_EQ(2u, stats.handlers[1].count());
+    // Only uevents that came from the kernel have a receive time.
+    EXPECT_EQ(1u, stats.total.count());
+}
+
+}  // namespace init
+}  // namespace android
@@ -24,10 +24,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <new>
+#include <optional>
 #include <set>
 #include <thread>
 
@@ -45,6 +49,7 @@
 #include "selinux.h"
 #include "uevent_handler.h"
 #include "uevent_listener.h"
+#include "uevent_stats.h"
 #include "ueventd_parser.h"
 #include "util.h"
 
@@ -88,13 +93,16 @@
 // 1) ueventd regenerates uevents by doing the /sys traversal and listens to the netlink socket for
 //    the generated uevents.  It writes these uevents into a queue represented by a vector.
 //
-// 2) ueventd forks 'n' separate uevent handler subprocesses and has each of them to handle the
-//    uevents in the queue based on a starting offset (their process number) and a stride (the total
-//    number of processes).  Note that no IPC happens at this point and only const functions from
-//    DeviceHandler should be called from this context.
+// 2) ueventd forks 'n' separate uevent handler subprocesses and has each of them claim the next
+//    unhandled uevent in the queue whenever it is idle, through a counter in shared memory.  This
+//    way one slow uevent, like a firmware load, does not hold back a fixed share of the queue.
+//    Note that no other IPC happens at this point and only const functions from DeviceHandler
+//    should be called from this context.
 //
 // 3) In parallel to the subprocesses handling the uevents, the main thread of ueventd calls
-//    selinux_android_restorecon() recursively on /sys/class, /sys/block, and /sys/devices.
+//    selinux_android_restorecon() recursively on /sys/class, /sys/block, and /sys/devices.  With
+//    parallel restorecon, it instead claims directories from the same queue that the subprocesses
+//    move on to once they run out of uevents.
 //
 // 4) Once the restorecon operation finishes, the main thread calls waitpid() to wait for all
 //    subprocess handlers to complete and exit.  Once this happens, it marks coldboot as having
@@ -111,6 +119,20 @@
 namespace android {
 namespace init {
 
+// After coldboot, log uevent statistics every this many uevents.
+static constexpr uint64_t kUeventStatsInterval = 1000;
+
+// Indices of the next uevent and restorecon directory to be handled. It is
+// mapped shared before the subprocesses are forked, so that each of them
+// claims work items as it becomes idle. The subprocesses also add up their
+// uevent statistics here.
+struct ColdBootWork {
+    std::atomic<uint32_t> next_uevent;
+    std::atomic<uint32_t> next_restorecon;
+    UeventStats stats;
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
 class ColdBoot {
   public:
     ColdBoot(UeventListener& uevent_listener,
@@ -126,11 +148,11 @@ class ColdBoot {
     void Run();
 
   private:
-    void UeventHandlerMain(unsigned int process_num, unsigned int total_processes);
+    void UeventHandlerMain();
     void RegenerateUevents();
     void ForkSubProcesses();
     void WaitForSubProcesses();
-    void RestoreConHandler(unsigned int process_num, unsigned int total_processes);
+    void RestoreConHandler(unsigned int process_num);
     void GenerateRestoreCon(const std::string& directory);
 
     UeventListener& uevent_listener_;
@@ -143,25 +165,25 @@ class ColdBoot {
 
     std::set<pid_t> subprocess_pids_;
 
+    ColdBootWork* work_ = nullptr;
+
     std::vector<std::string> restorecon_queue_;
 
     std::vector<std::string> parallel_restorecon_queue_;
 };
 
-void ColdBoot::UeventHandlerMain(unsigned int process_num, unsigned int total_processes) {
-    for (unsigned int i = process_num; i < uevent_queue_.size(); i += total_processes) {
-        auto& uevent = uevent_queue_[i];
-
-        for (auto& uevent_handler : uevent_handlers_) {
-            uevent_handler->HandleUevent(uevent);
-        }
+void ColdBoot::UeventHandlerMain() {
+    for (uint32_t i; (i = work_->next_uevent.fetch_add(1)) < uevent_queue_.size();) {
+        // Every uevent waits for those regenerated before it, so only slow handlers are
+        // worth logging.
+        HandleUeventWithStats(uevent_handlers_, uevent_queue_[i], &work_->stats, false);
     }
 }
 
-void ColdBoot::RestoreConHandler(unsigned int process_num, unsigned int total_processes) {
+void ColdBoot::RestoreConHandler(unsigned int process_num) {
     android::base::Timer t_process;
 
-    for (unsigned int i = process_num; i < restorecon_queue_.size(); i += total_processes) {
+    for (uint32_t i; (i = work_->next_restorecon.fetch_add(1)) < restorecon_queue_.size();) {
         android::base::Timer t;
         auto& dir = restorecon_queue_[i];
 
@@ -215,6 +237,13 @@ void ColdBoot::RegenerateUevents() {
 }
 
 void ColdBoot::ForkSubProcesses() {
+    void* work = mmap(nullptr, sizeof(ColdBootWork), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (work == MAP_FAILED) {
+        PLOG(FATAL) << "mmap() of coldboot work counters failed!";
+    }
+    work_ = new (work) ColdBootWork{};
+
     for (unsigned int i = 0; i < num_handler_subprocesses_; ++i) {
         auto pid = fork();
         if (pid < 0) {
@@ -222,9 +251,9 @@ void ColdBoot::ForkSubProcesses() {
         }
 
         if (pid == 0) {
-            UeventHandlerMain(i, num_handler_subprocesses_);
+            UeventHandlerMain();
             if (enable_parallel_restorecon_) {
-                RestoreConHandler(i, num_handler_subprocesses_);
+                RestoreConHandler(i);
             }
             _exit(EXIT_SUCCESS);
         }
@@ -243,6 +272,11 @@ void ColdBoot::WaitForSubProcesses() {
     //
     // When a subprocess gets stuck, keep ueventd spinning waiting for it.  init has a timeout for
     // cold boot and will reboot to the bootloader if ueventd does not complete in time.
+    //
+    // Each subprocess only exits once no work is left to claim, so the time between the first and
+    // the last exit is spent on the slowest remaining items.  Report it to help find those.
+    android::base::Timer wait_timer;
+    std::optional<std::chrono::milliseconds> first_exit;
     while (!subprocess_pids_.empty()) {
         int status;
         pid_t pid = TEMP_FAILURE_RETRY(waitpid(-1, &status, 0));
@@ -257,6 +291,7 @@ void ColdBoot::WaitForSubProcesses() {
         if (WIFEXITED(status)) {
             if (WEXITSTATUS(status) == EXIT_SUCCESS) {
                 subprocess_pids_.erase(it);
+                if (!first_exit) first_exit = wait_timer.duration();
             } else {
                 LOG(FATAL) << "subprocess exited with status " << WEXITSTATUS(status);
             }
@@ -264,13 +299,25 @@ void ColdBoot::WaitForSubProcesses() {
             LOG(FATAL) << "subprocess killed by signal " << WTERMSIG(status);
         }
     }
+
+    if (first_exit) {
+        auto tail = wait_timer.duration() - *first_exit;
+        LOG(INFO) << "Coldboot subprocesses finished " << tail.count() << "ms apart";
+    }
+
+    LogUeventStats("Coldboot", uevent_handlers_, work_->stats);
+    munmap(work_, sizeof(ColdBootWork));
+    work_ = nullptr;
 }
 
 void ColdBoot::Run() {
     android::base::Timer cold_boot_timer;
 
+    android::base::Timer phase_timer;
     RegenerateUevents();
+    auto regenerate_time = phase_timer.duration();
 
+    phase_timer = {};
     if (enable_parallel_restorecon_) {
         if (parallel_restorecon_queue_.empty()) {
             parallel_restorecon_queue_.emplace_back("/sys");
@@ -284,16 +331,31 @@ void ColdBoot::Run() {
         }
     }
 
+    auto prepare_time = phase_timer.duration();
+
+    phase_timer = {};
     ForkSubProcesses();
 
-    if (!enable_parallel_restorecon_) {
+    if (enable_parallel_restorecon_) {
+        // The subprocesses only reach the restorecon queue once the uevents run out, so have
+        // this process start on it right away, claiming directories from the same counter.
+        RestoreConHandler(num_handler_subprocesses_);
+    } else {
         selinux_android_restorecon("/sys", SELINUX_ANDROID_RESTORECON_RECURSE);
     }
+    auto restorecon_time = phase_timer.duration();
 
+    phase_timer = {};
     WaitForSubProcesses();
+    auto wait_time = phase_timer.duration();
 
     android::base::SetProperty(kColdBootDoneProp, "true");
     LOG(INFO) << "Coldboot took " << cold_boot_timer.duration().count() / 1000.0f << " seconds";
+    // Uevents are handled in the subprocesses while this process does restorecon, then waits.
+    LOG(INFO) << "Coldboot phases: regenerate " << regenerate_time.count() << "ms ("
+              << uevent_queue_.size() << " uevents), restorecon setup " << prepare_time.count()
+              << "ms, restorecon " << restorecon_time.count() << "ms, wait "
+              << wait_time.count() << "ms";
 }
 
 static UeventdConfiguration GetConfiguration() {
@@ -383,9 +445,13 @@ int ueventd_main(int argc, char** argv) {
 
     // Restore prio before main loop
     setpriority(PRIO_PROCESS, 0, 0);
-    uevent_listener.Poll([&uevent_handlers](const Uevent& uevent) {
-        for (auto& uevent_handler : uevent_handlers) {
-            uevent_handler->HandleUevent(uevent);
+    UeventStats stats;
+    uint64_t num_uevents = 0;
+    uevent_listener.Poll([&](const Uevent& uevent) {
+        HandleUeventWithStats(uevent_handlers, uevent, &stats, true);
+        if (++num_uevents % kUeventStatsInterval == 0) {
+            LogUeventStats("After " + std::to_string(num_uevents) + " uevents,", uevent_handlers,
+                           stats);
         }
         return ListenerAction::kContinue;
     });
@@ -19,6 +19,8 @@
 #include <sys/eventfd.h>
 #include <sys/stat.h>
 
+#include <thread>
+
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
 
@@ -86,10 +88,6 @@ bool HandleWrite(FuseAppLoop* loop, FuseBuffer* buffer, FuseAppLoopCallback* cal
 }
 
 bool HandleMessage(FuseAppLoop* loop, FuseBuffer* buffer, int fd, FuseAppLoopCallback* callback) {
-    if (!buffer->request.Read(fd)) {
-        return false;
-    }
-
     const uint32_t opcode = buffer->request.header.opcode;
     LOG(VERBOSE) << "Read a fuse packet, opcode=" << opcode;
     switch (opcode) {
@@ -131,7 +129,10 @@ bool HandleMessage(FuseAppLoop* loop, FuseBuffer* buffer, int fd, FuseAppLoopCal
 
 FuseAppLoopCallback::~FuseAppLoopCallback() = default;
 
-FuseAppLoop::FuseAppLoop(base::unique_fd&& fd) : fd_(std::move(fd)) {}
+FuseAppLoop::FuseAppLoop(base::unique_fd&& fd) : FuseAppLoop(std::move(fd), 0) {}
+
+FuseAppLoop::FuseAppLoop(base::unique_fd&& fd, size_t worker_count)
+    : fd_(std::move(fd)), worker_count_(worker_count), stopping_(false) {}
 
 void FuseAppLoop::Break() {
     const int64_t value = 1;
@@ -223,7 +224,18 @@ void FuseAppLoop::Start(FuseAppLoopCallback* callback) {
     last_event = 0;
     break_event = 0;
 
-    FuseBuffer buffer;
+    // Each worker owns at most one buffer, and the loop reads into another.
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = false;
+        for (size_t i = 0; i < worker_count_; ++i) {
+            free_buffers_.emplace_back(new FuseBuffer);
+            workers.emplace_back(&FuseAppLoop::RunWorker, this, callback);
+        }
+    }
+
+    std::unique_ptr<FuseBuffer> buffer(new FuseBuffer);
     while (true) {
         if (!epoll_controller->Wait(1)) {
             break;
@@ -236,13 +248,72 @@ void FuseAppLoop::Start(FuseAppLoopCallback* callback) {
             break;
         }
 
-        if (!HandleMessage(this, &buffer, fd_, callback)) {
+        if (!buffer->request.Read(fd_)) {
             break;
         }
+
+        const uint32_t opcode = buffer->request.header.opcode;
+        if (worker_count_ > 0 && (opcode == FUSE_READ || opcode == FUSE_WRITE)) {
+            buffer = QueueRequest(std::move(buffer));
+            continue;
+        }
+
+        if (!HandleMessage(this, buffer.get(), fd_, callback)) {
+            break;
+        }
+    }
+
+    // Let the workers finish the requests that are already queued.
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    pending_cv_.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
     }
+    free_buffers_.clear();
 
     LOG(VERBOSE) << "FuseAppLoop exit";
 }
 
+std::unique_ptr<FuseBuffer> FuseAppLoop::QueueRequest(std::unique_ptr<FuseBuffer> buffer) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    pending_.emplace_back(std::move(buffer));
+    pending_cv_.notify_one();
+
+    // Wait for a worker to give a buffer back if all of them are busy, which
+    // also bounds the number of requests in flight.
+    free_cv_.wait(lock, [this] { return !free_buffers_.empty(); });
+    buffer = std::move(free_buffers_.back());
+    free_buffers_.pop_back();
+    return buffer;
+}
+
+void FuseAppLoop::RunWorker(FuseAppLoopCallback* callback) {
+    while (true) {
+        std::unique_ptr<FuseBuffer> buffer;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            pending_cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) {
+                return;
+            }
+            buffer = std::move(pending_.front());
+            pending_.pop_front();
+        }
+
+        if (!HandleMessage(this, buffer.get(), fd_, callback)) {
+            Break();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_buffers_.emplace_back(std::move(buffer));
+        }
+        free_cv_.notify_one();
+    }
+}
+
 }  // namespace fuse
 }  // namespace android
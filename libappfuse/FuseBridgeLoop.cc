@@ -17,8 +17,11 @@
 #include "libappfuse/FuseBridgeLoop.h"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
+#include <thread>
 #include <unordered_map>
 
 #include <android-base/logging.h>
@@ -67,10 +70,12 @@ void LogResponseError(const std::string& message, const FuseResponse& response)
 
 class FuseBridgeEntry {
   public:
-    FuseBridgeEntry(int mount_id, base::unique_fd&& dev_fd, base::unique_fd&& proxy_fd)
+    FuseBridgeEntry(int mount_id, base::unique_fd&& dev_fd, base::unique_fd&& proxy_fd,
+                    const FuseInitOptions& init_options)
         : mount_id_(mount_id),
           device_fd_(std::move(dev_fd)),
           proxy_fd_(std::move(proxy_fd)),
+          init_options_(init_options),
           state_(FuseBridgeState::kWaitToReadEither),
           last_state_(FuseBridgeState::kWaitToReadEither),
           last_device_events_({this, 0}),
@@ -203,7 +208,7 @@ class FuseBridgeEntry {
                 return WriteToProxy();
 
             case FUSE_INIT:
-                buffer_.HandleInit();
+                buffer_.HandleInit(init_options_);
                 break;
 
             default:
@@ -217,7 +222,9 @@ class FuseBridgeEntry {
         }
 
         if (opcode == FUSE_INIT) {
+            FuseBridgeLoop::Lock();
             callback->OnMount(mount_id_);
+            FuseBridgeLoop::Unlock();
         }
 
         return FuseBridgeState::kWaitToReadEither;
@@ -242,6 +249,7 @@ class FuseBridgeEntry {
     const int mount_id_;
     base::unique_fd device_fd_;
     base::unique_fd proxy_fd_;
+    const FuseInitOptions init_options_;
     FuseBuffer buffer_;
     FuseBridgeState state_;
     FuseBridgeState last_state_;
@@ -265,6 +273,11 @@ class BridgeEpollController : private EpollController {
         return InvokeControl(EPOLL_CTL_ADD, bridge);
     }
 
+    // Events on |stop_fd| only wake up Wait(); they aren't reported.
+    bool AddStopPoll(int stop_fd) const {
+        return EpollController::InvokeControl(EPOLL_CTL_ADD, stop_fd, EPOLLIN, nullptr);
+    }
+
     bool UpdateOrDeleteBridgePoll(FuseBridgeEntry* bridge) const {
         return InvokeControl(
             bridge->state_ != FuseBridgeState::kClosing ? EPOLL_CTL_MOD : EPOLL_CTL_DEL, bridge);
@@ -272,7 +285,7 @@ class BridgeEpollController : private EpollController {
 
     bool Wait(size_t bridge_count, std::unordered_set<FuseBridgeEntry*>* entries_out) {
         CHECK(entries_out);
-        const size_t event_count = std::max<size_t>(bridge_count * 2, 1);
+        const size_t event_count = bridge_count * 2 + 1;
         if (!EpollController::Wait(event_count)) {
             return false;
         }
@@ -280,6 +293,9 @@ class BridgeEpollController : private EpollController {
         for (const auto& event : events()) {
             FuseBridgeEntryEvent* const entry_event =
                 reinterpret_cast<FuseBridgeEntryEvent*>(event.data.ptr);
+            if (entry_event == nullptr) {
+                continue;
+            }
             entry_event->events = event.events;
             entries_out->insert(entry_event->entry);
         }
@@ -311,25 +327,49 @@ class BridgeEpollController : private EpollController {
     }
 };
 
+struct FuseBridgeLoop::Shard {
+    std::unique_ptr<BridgeEpollController> epoll_controller;
+    // Number of bridges added to this shard, guarded by |mutex_|.
+    size_t bridge_count = 0;
+};
+
 std::recursive_mutex FuseBridgeLoop::mutex_;
 
-FuseBridgeLoop::FuseBridgeLoop() : opened_(true) {
-    base::unique_fd epoll_fd(epoll_create1(EPOLL_CLOEXEC));
-    if (epoll_fd.get() == -1) {
-        PLOG(ERROR) << "Failed to open FD for epoll";
+FuseBridgeLoop::FuseBridgeLoop() : FuseBridgeLoop(1) {}
+
+FuseBridgeLoop::FuseBridgeLoop(size_t thread_count) : opened_(true), stopping_(false) {
+    CHECK_GT(thread_count, 0u);
+    stop_fd_.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    if (stop_fd_.get() == -1) {
+        PLOG(ERROR) << "Failed to open FD for stopping the loop";
         opened_ = false;
         return;
     }
-    epoll_controller_.reset(new BridgeEpollController(std::move(epoll_fd)));
+    for (size_t i = 0; i < thread_count; ++i) {
+        base::unique_fd epoll_fd(epoll_create1(EPOLL_CLOEXEC));
+        if (epoll_fd.get() == -1) {
+            PLOG(ERROR) << "Failed to open FD for epoll";
+            opened_ = false;
+            return;
+        }
+        std::unique_ptr<Shard> shard(new Shard);
+        shard->epoll_controller.reset(new BridgeEpollController(std::move(epoll_fd)));
+        if (!shard->epoll_controller->AddStopPoll(stop_fd_)) {
+            opened_ = false;
+            return;
+        }
+        shards_.emplace_back(std::move(shard));
+    }
 }
 
 FuseBridgeLoop::~FuseBridgeLoop() { CHECK(bridges_.empty()); }
 
-bool FuseBridgeLoop::AddBridge(int mount_id, base::unique_fd dev_fd, base::unique_fd proxy_fd) {
+bool FuseBridgeLoop::AddBridge(int mount_id, base::unique_fd dev_fd, base::unique_fd proxy_fd,
+                               const FuseInitOptions& init_options) {
     LOG(VERBOSE) << "Adding bridge " << mount_id;
 
     std::unique_ptr<FuseBridgeEntry> bridge(
-        new FuseBridgeEntry(mount_id, std::move(dev_fd), std::move(proxy_fd)));
+        new FuseBridgeEntry(mount_id, std::move(dev_fd), std::move(proxy_fd), init_options));
     std::lock_guard<std::recursive_mutex> lock(mutex_);
     if (!opened_) {
         LOG(ERROR) << "Tried to add a mount to a closed bridge";
@@ -339,24 +379,39 @@ bool FuseBridgeLoop::AddBridge(int mount_id, base::unique_fd dev_fd, base::uniqu
         LOG(ERROR) << "Tried to add a mount point that has already been added";
         return false;
     }
-    if (!epoll_controller_->AddBridgePoll(bridge.get())) {
+
+    // Put the bridge on the least loaded shard. It's registered while |mutex_|
+    // is held, so its shard can't try to close it before it's in |bridges_|.
+    Shard* shard = shards_[0].get();
+    for (const auto& candidate : shards_) {
+        if (candidate->bridge_count < shard->bridge_count) {
+            shard = candidate.get();
+        }
+    }
+    if (!shard->epoll_controller->AddBridgePoll(bridge.get())) {
         return false;
     }
 
+    shard->bridge_count++;
     bridges_.emplace(mount_id, std::move(bridge));
     return true;
 }
 
-bool FuseBridgeLoop::ProcessEventLocked(const std::unordered_set<FuseBridgeEntry*>& entries,
-                                        FuseBridgeLoopCallback* callback) {
+bool FuseBridgeLoop::ProcessEvents(Shard* shard,
+                                   const std::unordered_set<FuseBridgeEntry*>& entries,
+                                   FuseBridgeLoopCallback* callback) {
+    // Entries are only ever touched by the thread of their shard, so the
+    // transfer itself runs without |mutex_|.
     for (auto entry : entries) {
         entry->Transfer(callback);
-        if (!epoll_controller_->UpdateOrDeleteBridgePoll(entry)) {
+        if (!shard->epoll_controller->UpdateOrDeleteBridgePoll(entry)) {
             return false;
         }
         if (entry->IsClosing()) {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
             const int mount_id = entry->mount_id();
             bridges_.erase(mount_id);
+            shard->bridge_count--;
             callback->OnClosed(mount_id);
             if (bridges_.size() == 0) {
                 // All bridges are now closed.
@@ -367,24 +422,57 @@ bool FuseBridgeLoop::ProcessEventLocked(const std::unordered_set<FuseBridgeEntry
     return true;
 }
 
-void FuseBridgeLoop::Start(FuseBridgeLoopCallback* callback) {
-    LOG(DEBUG) << "Start fuse bridge loop";
+void FuseBridgeLoop::RunShard(Shard* shard, FuseBridgeLoopCallback* callback) {
     std::unordered_set<FuseBridgeEntry*> entries;
-    while (true) {
-        const bool wait_result = epoll_controller_->Wait(bridges_.size(), &entries);
-        LOG(VERBOSE) << "Receive epoll events";
+    while (!stopping_) {
+        size_t bridge_count;
         {
             std::lock_guard<std::recursive_mutex> lock(mutex_);
-            if (!(wait_result && ProcessEventLocked(entries, callback))) {
-                for (auto it = bridges_.begin(); it != bridges_.end();) {
-                    callback->OnClosed(it->second->mount_id());
-                    it = bridges_.erase(it);
-                }
-                opened_ = false;
-                return;
-            }
+            bridge_count = shard->bridge_count;
         }
+        const bool wait_result = shard->epoll_controller->Wait(bridge_count, &entries);
+        LOG(VERBOSE) << "Receive epoll events";
+        if (!(wait_result && ProcessEvents(shard, entries, callback))) {
+            Stop();
+            return;
+        }
+    }
+}
+
+void FuseBridgeLoop::Stop() {
+    stopping_ = true;
+    const uint64_t value = 1;
+    if (TEMP_FAILURE_RETRY(write(stop_fd_, &value, sizeof(value))) == -1) {
+        PLOG(ERROR) << "Failed to stop the loop";
+    }
+}
+
+void FuseBridgeLoop::Start(FuseBridgeLoopCallback* callback) {
+    LOG(DEBUG) << "Start fuse bridge loop with " << shards_.size() << " threads";
+    if (!opened_) {
+        LOG(ERROR) << "Tried to start a closed bridge loop";
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < shards_.size(); ++i) {
+        threads.emplace_back(&FuseBridgeLoop::RunShard, this, shards_[i].get(), callback);
+    }
+    RunShard(shards_[0].get(), callback);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Every thread is gone, so whatever is left can be closed from here.
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    for (auto it = bridges_.begin(); it != bridges_.end();) {
+        callback->OnClosed(it->second->mount_id());
+        it = bridges_.erase(it);
+    }
+    for (auto& shard : shards_) {
+        shard->bridge_count = 0;
     }
+    opened_ = false;
 }
 
 void FuseBridgeLoop::Lock() {
@@ -208,13 +208,14 @@ void FuseResponseBase<N>::Reset(uint32_t data_length, int32_t error, uint64_t un
     ResetHeader(data_length, error, unique);
 }
 
-void FuseBuffer::HandleInit() {
+void FuseBuffer::HandleInit(const FuseInitOptions& options) {
   const fuse_init_in* const in = &request.init_in;
 
   // Before writing |out|, we need to copy data from |in|.
   const uint64_t unique = request.header.unique;
   const uint32_t minor = in->minor;
   const uint32_t max_readahead = in->max_readahead;
+  const uint32_t kernel_flags = in->flags;
 
   // Kernel 2.6.16 is the first stable kernel with struct fuse_init_out
   // defined (fuse version 7.6). The structure is the same from 7.6 through
@@ -241,11 +242,15 @@ void FuseBuffer::HandleInit() {
   fuse_init_out* const out = &response.init_out;
   out->major = FUSE_KERNEL_VERSION;
   out->minor = std::min(minor, 15u);
-  out->max_readahead = max_readahead;
+  out->max_readahead = options.max_readahead != 0
+      ? std::min(options.max_readahead, max_readahead) : max_readahead;
   out->flags = FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES;
+  if (options.async_read && (kernel_flags & FUSE_ASYNC_READ)) {
+    out->flags |= FUSE_ASYNC_READ;
+  }
   out->max_background = 32;
   out->congestion_threshold = 32;
-  out->max_write = kFuseMaxWrite;
+  out->max_write = std::min<uint32_t>(options.max_write, kFuseMaxWrite);
 }
 
 void FuseBuffer::HandleNotImpl() {
@@ -17,8 +17,11 @@
 #ifndef ANDROID_LIBAPPFUSE_FUSEAPPLOOP_H_
 #define ANDROID_LIBAPPFUSE_FUSEAPPLOOP_H_
 
+#include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 
@@ -46,6 +49,13 @@ class FuseAppLoop final {
   public:
     FuseAppLoop(base::unique_fd&& fd);
 
+    // Hands FUSE_READ and FUSE_WRITE requests to |worker_count| threads, so
+    // that many of them can be in flight at once. OnRead and OnWrite then run
+    // concurrently with each other and with the other callbacks, and replies
+    // may be sent in any order. The |data| passed to OnWrite stays valid only
+    // until OnWrite returns, as with a single thread.
+    FuseAppLoop(base::unique_fd&& fd, size_t worker_count);
+
     void Start(FuseAppLoopCallback* callback);
     void Break();
 
@@ -57,11 +67,23 @@ class FuseAppLoop final {
     bool ReplyRead(uint64_t unique, uint32_t size, const void* data);
 
   private:
+    std::unique_ptr<FuseBuffer> QueueRequest(std::unique_ptr<FuseBuffer> buffer);
+    void RunWorker(FuseAppLoopCallback* callback);
+
     base::unique_fd fd_;
     base::unique_fd break_fd_;
+    const size_t worker_count_;
 
     // Lock for multi-threading.
     std::mutex mutex_;
+
+    // Requests waiting for a worker, and buffers free to read the next request
+    // into. Guarded by |mutex_|.
+    std::deque<std::unique_ptr<FuseBuffer>> pending_;
+    std::vector<std::unique_ptr<FuseBuffer>> free_buffers_;
+    bool stopping_;
+    std::condition_variable pending_cv_;
+    std::condition_variable free_cv_;
 };
 
 bool StartFuseAppLoop(int fd, FuseAppLoopCallback* callback);
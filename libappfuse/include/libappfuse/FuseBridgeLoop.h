@@ -17,10 +17,13 @@
 #ifndef ANDROID_LIBAPPFUSE_FUSEBRIDGELOOP_H_
 #define ANDROID_LIBAPPFUSE_FUSEBRIDGELOOP_H_
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <unordered_set>
+#include <vector>
 
 #include <android-base/macros.h>
 
@@ -37,28 +40,40 @@ class FuseBridgeLoopCallback {
 };
 
 class FuseBridgeEntry;
-class BridgeEpollController;
 
 class FuseBridgeLoop final {
   public:
     FuseBridgeLoop();
+
+    // Spreads the bridges over |thread_count| threads, each with its own epoll
+    // FD. A bridge always stays on the thread it was added to, so their
+    // transfers don't block each other.
+    explicit FuseBridgeLoop(size_t thread_count);
     ~FuseBridgeLoop();
 
+    // Runs the loop until all bridges are closed. The calling thread serves
+    // as the first of the |thread_count| threads.
     void Start(FuseBridgeLoopCallback* callback);
 
     // Add bridge to the loop. It's OK to invoke the method from a different
-    // thread from one which invokes |Start|.
-    bool AddBridge(int mount_id, base::unique_fd dev_fd, base::unique_fd proxy_fd);
+    // thread from one which invokes |Start|. |init_options| shape the bridge's
+    // reply to FUSE_INIT.
+    bool AddBridge(int mount_id, base::unique_fd dev_fd, base::unique_fd proxy_fd,
+                   const FuseInitOptions& init_options = FuseInitOptions());
 
     static void Lock();
 
     static void Unlock();
 
   private:
-    bool ProcessEventLocked(const std::unordered_set<FuseBridgeEntry*>& entries,
-                            FuseBridgeLoopCallback* callback);
+    struct Shard;
+
+    void RunShard(Shard* shard, FuseBridgeLoopCallback* callback);
+    bool ProcessEvents(Shard* shard, const std::unordered_set<FuseBridgeEntry*>& entries,
+                       FuseBridgeLoopCallback* callback);
+    void Stop();
 
-    std::unique_ptr<BridgeEpollController> epoll_controller_;
+    std::vector<std::unique_ptr<Shard>> shards_;
 
     // Map between |mount_id| and bridge entry.
     std::map<int, std::unique_ptr<FuseBridgeEntry>> bridges_;
@@ -68,6 +83,10 @@ class FuseBridgeLoop final {
 
     bool opened_;
 
+    // Set, and |stop_fd_| signalled, to make every thread leave the loop.
+    std::atomic<bool> stopping_;
+    base::unique_fd stop_fd_;
+
     DISALLOW_COPY_AND_ASSIGN(FuseBridgeLoop);
 };
 
@@ -96,13 +96,24 @@ struct FuseResponseBase : public FuseMessage<FuseResponseBase<N>> {
 using FuseResponse = FuseResponseBase<kFuseMaxRead>;
 using FuseSimpleResponse = FuseResponseBase<0u>;
 
+// Parameters of the reply to FUSE_INIT.
+struct FuseInitOptions {
+    // Largest read-ahead window in bytes, or 0 to keep the kernel's value.
+    uint32_t max_readahead = 0;
+    // Largest payload of a FUSE_WRITE, at most kFuseMaxWrite.
+    uint32_t max_write = kFuseMaxWrite;
+    // Lets the kernel have several FUSE_READs for a file in flight at once.
+    // Only useful if the other end handles them concurrently, see FuseAppLoop.
+    bool async_read = false;
+};
+
 // To reduce memory usage, FuseBuffer shares the memory region for request and
 // response.
 union FuseBuffer final {
   FuseRequest request;
   FuseResponse response;
 
-  void HandleInit();
+  void HandleInit(const FuseInitOptions& options = FuseInitOptions());
   void HandleNotImpl();
 };
 
@@ -21,6 +21,9 @@
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 #include "libappfuse/EpollController.h"
@@ -295,5 +298,53 @@ TEST_F(FuseAppLoopTest, Break) {
     }
 }
 
+// Holds the reply to the first read until the second one has arrived.
+class ParallelReadCallback : public Callback {
+ public:
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool second_started = false;
+
+  void OnRead(uint64_t seq, uint64_t inode ATTRIBUTE_UNUSED, uint64_t offset ATTRIBUTE_UNUSED,
+              uint32_t size ATTRIBUTE_UNUSED) override {
+      if (seq == 1) {
+          std::unique_lock<std::mutex> lock(mutex);
+          EXPECT_TRUE(cv.wait_for(lock, std::chrono::seconds(5), [this] { return second_started; }));
+      } else {
+          std::lock_guard<std::mutex> lock(mutex);
+          second_started = true;
+          cv.notify_all();
+      }
+      loop->ReplySimple(seq, 0);
+  }
+};
+
+TEST(FuseAppLoopWorkersTest, ParallelReads) {
+  base::unique_fd sockets[2];
+  ASSERT_TRUE(SetupMessageSockets(&sockets));
+  FuseAppLoop loop(std::move(sockets[1]), 2);
+  ParallelReadCallback callback;
+  callback.loop = &loop;
+  std::thread thread([&] { loop.Start(&callback); });
+
+  FuseRequest request;
+  for (uint64_t unique = 1; unique <= 2; ++unique) {
+    request.Reset(sizeof(fuse_read_in), FUSE_READ, unique);
+    request.header.nodeid = 10;
+    ASSERT_TRUE(request.Write(sockets[0]));
+  }
+
+  // The second read is answered first, while the first one is still pending.
+  FuseResponse response;
+  ASSERT_TRUE(response.Read(sockets[0]));
+  EXPECT_EQ(2u, response.header.unique);
+  ASSERT_TRUE(response.Read(sockets[0]));
+  EXPECT_EQ(1u, response.header.unique);
+  EXPECT_EQ(kFuseSuccess, response.header.error);
+
+  sockets[0].reset();
+  thread.join();
+}
+
 }  // namespace fuse
 }  // namespace android
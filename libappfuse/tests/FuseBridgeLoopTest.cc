@@ -210,5 +210,55 @@ TEST_F(FuseBridgeLoopTest, Proxy) {
   Close();
 }
 
+TEST(FuseBridgeLoopThreadsTest, BridgesOnSeparateThreads) {
+  base::unique_fd dev_sockets[2][2];
+  base::unique_fd proxy_sockets[2][2];
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(SetupMessageSockets(&dev_sockets[i]));
+    ASSERT_TRUE(SetupMessageSockets(&proxy_sockets[i]));
+  }
+
+  Callback callback;
+  FuseBridgeLoop loop(2);
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(loop.AddBridge(i + 1, std::move(dev_sockets[i][1]),
+                               std::move(proxy_sockets[i][0])));
+  }
+  std::thread thread([&] { loop.Start(&callback); });
+
+  // Leave a request pending on the first bridge's proxy. The second bridge
+  // must still make progress.
+  FuseRequest request;
+  memset(&request, 0, sizeof(FuseRequest));
+  request.header.opcode = FUSE_GETATTR;
+  request.header.unique = 1u;
+  request.header.len = sizeof(fuse_in_header);
+  ASSERT_TRUE(request.Write(dev_sockets[0][0]));
+
+  memset(&request, 0, sizeof(FuseRequest));
+  request.header.opcode = FUSE_SETATTR;
+  request.header.unique = 2u;
+  request.header.len = sizeof(fuse_in_header);
+  ASSERT_TRUE(request.Write(dev_sockets[1][0]));
+
+  FuseResponse response;
+  memset(&response, 0, sizeof(FuseResponse));
+  ASSERT_TRUE(response.Read(dev_sockets[1][0]));
+  EXPECT_EQ(2u, response.header.unique);
+  EXPECT_EQ(-ENOSYS, response.header.error);
+
+  memset(&request, 0, sizeof(FuseRequest));
+  ASSERT_TRUE(request.Read(proxy_sockets[0][1]));
+  EXPECT_EQ(1u, request.header.unique);
+
+  // The loop exits once every bridge is closed.
+  for (int i = 0; i < 2; ++i) {
+    dev_sockets[i][0].reset();
+    proxy_sockets[i][1].reset();
+  }
+  thread.join();
+  EXPECT_TRUE(callback.closed);
+}
+
 }  // namespace fuse
 }  // namespace android
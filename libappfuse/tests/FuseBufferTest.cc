@@ -177,6 +177,30 @@ TEST(FuseBufferTest, HandleInit) {
   EXPECT_EQ(kFuseMaxWrite, buffer.response.init_out.max_write);
 }
 
+TEST(FuseBufferTest, HandleInitWithOptions) {
+  FuseBuffer buffer;
+  memset(&buffer, 0, sizeof(FuseBuffer));
+
+  buffer.request.header.opcode = FUSE_INIT;
+  buffer.request.init_in.major = FUSE_KERNEL_VERSION;
+  buffer.request.init_in.minor = FUSE_KERNEL_MINOR_VERSION;
+  buffer.request.init_in.max_readahead = 128 * 1024;
+  buffer.request.init_in.flags = FUSE_ASYNC_READ;
+
+  FuseInitOptions options;
+  options.max_readahead = 64 * 1024;
+  options.max_write = 2 * kFuseMaxWrite;
+  options.async_read = true;
+  buffer.HandleInit(options);
+
+  EXPECT_EQ(kFuseSuccess, buffer.response.header.error);
+  EXPECT_EQ(static_cast<unsigned int>(FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES | FUSE_ASYNC_READ),
+      buffer.response.init_out.flags);
+  EXPECT_EQ(64u * 1024, buffer.response.init_out.max_readahead);
+  // Never more than the buffer can hold.
+  EXPECT_EQ(kFuseMaxWrite, buffer.response.init_out.max_write);
+}
+
 TEST(FuseBufferTest, HandleNotImpl) {
   FuseBuffer buffer;
   memset(&buffer, 0, sizeof(FuseBuffer));
@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asyncio/AsyncIO.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+// io_uring with IORING_OP_READ/WRITE and opcode probing needs 5.6 headers; the
+// host sysroots can be older than that, in which case only aio is used.
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#if defined(IO_URING_OP_SUPPORTED) && defined(__NR_io_uring_setup)
+#define ASYNCIO_HAVE_IO_URING 1
+#endif
+#if defined(ASYNCIO_HAVE_IO_URING) && !defined(IORING_FEAT_SQPOLL_NONFIXED)
+#define IORING_FEAT_SQPOLL_NONFIXED (1U << 7)  // 5.11
+#endif
+
+struct asyncio_context {
+    aio_context_t aio = 0;
+    int ring_fd = -1;
+#ifdef ASYNCIO_HAVE_IO_URING
+    unsigned setup_flags = 0;
+
+    void* sq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    void* cq_ring = MAP_FAILED;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_flags = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    std::vector<iovec> buffers;
+#endif
+};
+
+#ifdef ASYNCIO_HAVE_IO_URING
+
+static int io_uring_setup(unsigned entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void ring_unmap(asyncio_context* ctx) {
+    if (ctx->sqes != MAP_FAILED) munmap(ctx->sqes, ctx->sqes_size);
+    if (ctx->cq_ring != MAP_FAILED && ctx->cq_ring != ctx->sq_ring) {
+        munmap(ctx->cq_ring, ctx->cq_ring_size);
+    }
+    if (ctx->sq_ring != MAP_FAILED) munmap(ctx->sq_ring, ctx->sq_ring_size);
+    if (ctx->ring_fd != -1) close(ctx->ring_fd);
+    ctx->sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    ctx->cq_ring = MAP_FAILED;
+    ctx->sq_ring = MAP_FAILED;
+    ctx->ring_fd = -1;
+}
+
+// Checks that the kernel implements every opcode that iocbs are mapped to.
+static bool ring_supports_opcodes(int ring_fd) {
+    const size_t size = sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+    io_uring_probe* probe = static_cast<io_uring_probe*>(calloc(1, size));
+    if (probe == nullptr) return false;
+    bool supported = false;
+    if (io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0) {
+        supported = true;
+        for (int op : {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV, IORING_OP_WRITEV,
+                       IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_FSYNC}) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                supported = false;
+            }
+        }
+    }
+    free(probe);
+    return supported;
+}
+
+static bool ring_setup(asyncio_context* ctx, unsigned nr, unsigned flags) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if (flags & ASYNCIO_SQPOLL) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 1000;  // ms
+    }
+    int fd = io_uring_setup(nr, &params);
+    if (fd != -1 && (params.flags & IORING_SETUP_SQPOLL) &&
+        !(params.features & IORING_FEAT_SQPOLL_NONFIXED)) {
+        // Before 5.11, the polling thread only accepts registered files, and
+        // every SQE here uses a plain fd.
+        close(fd);
+        fd = -1;
+    }
+    if (fd == -1 && (flags & ASYNCIO_SQPOLL)) {
+        // Before 5.11, SQPOLL also requires CAP_SYS_ADMIN. Carry on without it.
+        memset(&params, 0, sizeof(params));
+        fd = io_uring_setup(nr, &params);
+    }
+    if (fd == -1) return false;
+    ctx->ring_fd = fd;
+    ctx->setup_flags = params.flags;
+
+    if (!ring_supports_opcodes(fd)) {
+        ring_unmap(ctx);
+        return false;
+    }
+
+    ctx->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ctx->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ctx->cq_ring_size > ctx->sq_ring_size) ctx->sq_ring_size = ctx->cq_ring_size;
+        ctx->cq_ring_size = ctx->sq_ring_size;
+    }
+    ctx->sq_ring = mmap(nullptr, ctx->sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ctx->sq_ring == MAP_FAILED) {
+        ring_unmap(ctx);
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ctx->cq_ring = ctx->sq_ring;
+    } else {
+        ctx->cq_ring = mmap(nullptr, ctx->cq_ring_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ctx->cq_ring == MAP_FAILED) {
+            ring_unmap(ctx);
+            return false;
+        }
+    }
+    ctx->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ctx->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, ctx->sqes_size, PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (ctx->sqes == MAP_FAILED) {
+        ring_unmap(ctx);
+        return false;
+    }
+
+    char* sq = static_cast<char*>(ctx->sq_ring);
+    char* cq = static_cast<char*>(ctx->cq_ring);
+    ctx->sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    ctx->sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ctx->sq_flags = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+    ctx->sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ctx->sq_entries = params.sq_entries;
+    ctx->cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ctx->cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ctx->cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ctx->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // SQEs are always used in order, so the index array never changes.
+    unsigned* sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        sq_array[i] = i;
+    }
+    return true;
+}
+
+// Returns the index of the registered buffer that holds [buf, buf + len), or -1.
+static int ring_find_buffer(const asyncio_context* ctx, uint64_t buf, uint64_t len) {
+    for (size_t i = 0; i < ctx->buffers.size(); i++) {
+        uint64_t start = reinterpret_cast<uint64_t>(ctx->buffers[i].iov_base);
+        if (buf >= start && buf + len <= start + ctx->buffers[i].iov_len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool ring_prep_sqe(const asyncio_context* ctx, io_uring_sqe* sqe, const iocb* iocb) {
+    if (iocb->aio_flags != 0) return false;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = iocb->aio_fildes;
+    sqe->off = iocb->aio_offset;
+    sqe->addr = iocb->aio_buf;
+    sqe->len = iocb->aio_nbytes;
+    sqe->user_data = reinterpret_cast<uint64_t>(iocb);
+    switch (iocb->aio_lio_opcode) {
+        case IOCB_CMD_PREAD:
+        case IOCB_CMD_PWRITE: {
+            const bool read = iocb->aio_lio_opcode == IOCB_CMD_PREAD;
+            int index = ring_find_buffer(ctx, iocb->aio_buf, iocb->aio_nbytes);
+            if (index >= 0) {
+                sqe->opcode = read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                sqe->buf_index = index;
+            } else {
+                sqe->opcode = read ? IORING_OP_READ : IORING_OP_WRITE;
+            }
+            return true;
+        }
+        case IOCB_CMD_PREADV:
+            sqe->opcode = IORING_OP_READV;
+            return true;
+        case IOCB_CMD_PWRITEV:
+            sqe->opcode = IORING_OP_WRITEV;
+            return true;
+        case IOCB_CMD_FSYNC:
+        case IOCB_CMD_FDSYNC:
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->addr = 0;
+            sqe->len = 0;
+            sqe->off = 0;
+            if (iocb->aio_lio_opcode == IOCB_CMD_FDSYNC) sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static int ring_submit(asyncio_context* ctx, long nr, iocb** iocbpp) {
+    unsigned tail = *ctx->sq_tail;
+    const unsigned head = __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE);
+    const long space = ctx->sq_entries - (tail - head);
+    if (nr > space) nr = space;
+    if (nr == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    long queued = 0;
+    for (; queued < nr; queued++, tail++) {
+        if (!ring_prep_sqe(ctx, &ctx->sqes[tail & ctx->sq_mask], iocbpp[queued])) break;
+    }
+    if (queued == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    __atomic_store_n(ctx->sq_tail, tail, __ATOMIC_RELEASE);
+
+    if (ctx->setup_flags & IORING_SETUP_SQPOLL) {
+        // The kernel thread picks the entries up by itself, unless it has
+        // gone idle and needs waking up.
+        if (__atomic_load_n(ctx->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP) {
+            if (io_uring_enter(ctx->ring_fd, 0, 0, IORING_ENTER_SQ_WAKEUP) == -1) return -1;
+        }
+        return queued;
+    }
+    return io_uring_enter(ctx->ring_fd, queued, 0, 0);
+}
+
+static long ring_reap(asyncio_context* ctx, long max_nr, io_event* events) {
+    unsigned head = *ctx->cq_head;
+    const unsigned tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+    long count = 0;
+    for (; head != tail && count < max_nr; head++, count++) {
+        const io_uring_cqe* cqe = &ctx->cqes[head & ctx->cq_mask];
+        const iocb* iocb = reinterpret_cast<const struct iocb*>(cqe->user_data);
+        events[count].data = iocb->aio_data;
+        events[count].obj = cqe->user_data;
+        events[count].res = cqe->res;
+        events[count].res2 = 0;
+    }
+    __atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+static int ring_getevents(asyncio_context* ctx, long min_nr, long max_nr, io_event* events,
+                          timespec* timeout) {
+    long count = ring_reap(ctx, max_nr, events);
+    if (count >= min_nr) return count;
+
+    if (timeout != nullptr) {
+        // The ring FD polls readable while completions are pending.
+        pollfd pfd = {ctx->ring_fd, POLLIN, 0};
+        int ms = timeout->tv_sec * 1000 + timeout->tv_nsec / 1000000;
+        if (poll(&pfd, 1, ms) == -1 && count == 0) return -1;
+        return count + ring_reap(ctx, max_nr - count, events + count);
+    }
+    while (count < min_nr) {
+        if (io_uring_enter(ctx->ring_fd, 0, min_nr - count, IORING_ENTER_GETEVENTS) == -1) {
+            // Don't lose the completions that were already taken off the ring.
+            return count > 0 ? count : -1;
+        }
+        count += ring_reap(ctx, max_nr - count, events + count);
+    }
+    return count;
+}
+
+#endif  // ASYNCIO_HAVE_IO_URING
+
+int asyncio_setup(unsigned nr, unsigned flags, asyncio_context** ctxp) {
+    asyncio_context* ctx = new (std::nothrow) asyncio_context;
+    if (ctx == nullptr) {
+        errno = ENOMEM;
+        return -1;
+    }
+#ifdef ASYNCIO_HAVE_IO_URING
+    if (!(flags & ASYNCIO_AIO_ONLY) && ring_setup(ctx, nr, flags)) {
+        *ctxp = ctx;
+        return 0;
+    }
+#else
+    (void)flags;
+#endif
+    if (io_setup(nr, &ctx->aio) == -1) {
+        int saved_errno = errno;
+        delete ctx;
+        errno = saved_errno;
+        return -1;
+    }
+    *ctxp = ctx;
+    return 0;
+}
+
+int asyncio_destroy(asyncio_context* ctx) {
+    int ret = 0;
+    if (ctx->ring_fd == -1) {
+        ret = io_destroy(ctx->aio);
+    }
+#ifdef ASYNCIO_HAVE_IO_URING
+    ring_unmap(ctx);
+#endif
+    delete ctx;
+    return ret;
+}
+
+int asyncio_submit(asyncio_context* ctx, long nr, iocb** iocbpp) {
+#ifdef ASYNCIO_HAVE_IO_URING
+    if (ctx->ring_fd != -1) return ring_submit(ctx, nr, iocbpp);
+#endif
+    return io_submit(ctx->aio, nr, iocbpp);
+}
+
+int asyncio_getevents(asyncio_context* ctx, long min_nr, long max_nr, io_event* events,
+                      timespec* timeout) {
+#ifdef ASYNCIO_HAVE_IO_URING
+    if (ctx->ring_fd != -1) return ring_getevents(ctx, min_nr, max_nr, events, timeout);
+#endif
+    return io_getevents(ctx->aio, min_nr, max_nr, events, timeout);
+}
+
+bool asyncio_is_io_uring(const asyncio_context* ctx) {
+    return ctx->ring_fd != -1;
+}
+
+int asyncio_register_buffers(asyncio_context* ctx, const iovec* iovecs, unsigned nr) {
+#ifdef ASYNCIO_HAVE_IO_URING
+    if (ctx->ring_fd != -1) {
+        if (!ctx->buffers.empty()) {
+            io_uring_register(ctx->ring_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+            ctx->buffers.clear();
+        }
+        if (io_uring_register(ctx->ring_fd, IORING_REGISTER_BUFFERS, iovecs, nr) == -1) return -1;
+        ctx->buffers.assign(iovecs, iovecs + nr);
+        return 0;
+    }
+#else
+    (void)ctx;
+    (void)iovecs;
+    (void)nr;
+#endif
+    errno = EOPNOTSUPP;
+    return -1;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asyncio/AsyncIO.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+namespace {
+
+constexpr size_t kChunkSize = 4096;
+constexpr size_t kNumChunks = 8;
+
+class AsyncIOContextTest : public ::testing::TestWithParam<unsigned> {
+  protected:
+    void SetUp() override {
+        ASSERT_EQ(asyncio_setup(kNumChunks, GetParam(), &ctx_), 0) << strerror(errno);
+        if (GetParam() & ASYNCIO_AIO_ONLY) {
+            ASSERT_FALSE(asyncio_is_io_uring(ctx_));
+        }
+    }
+
+    void TearDown() override {
+        if (ctx_ != nullptr) {
+            ASSERT_EQ(asyncio_destroy(ctx_), 0);
+        }
+    }
+
+    // Submits |iocbs| and waits for all of them, checking that each one
+    // transferred |expected| bytes and that the events point at the iocbs.
+    void Run(std::vector<iocb>& iocbs, int64_t expected) {
+        std::vector<iocb*> ptrs;
+        for (size_t i = 0; i < iocbs.size(); i++) {
+            iocbs[i].aio_data = i;
+            ptrs.emplace_back(&iocbs[i]);
+        }
+        ASSERT_EQ(asyncio_submit(ctx_, ptrs.size(), ptrs.data()), static_cast<int>(ptrs.size()))
+                << strerror(errno);
+
+        std::vector<io_event> events(iocbs.size());
+        ASSERT_EQ(asyncio_getevents(ctx_, events.size(), events.size(), events.data(), nullptr),
+                  static_cast<int>(events.size()))
+                << strerror(errno);
+        std::vector<bool> seen(iocbs.size());
+        for (const io_event& event : events) {
+            ASSERT_LT(event.data, iocbs.size());
+            EXPECT_EQ(event.obj, reinterpret_cast<uint64_t>(&iocbs[event.data]));
+            EXPECT_EQ(event.res, expected);
+            seen[event.data] = true;
+        }
+        EXPECT_EQ(std::count(seen.begin(), seen.end(), true), static_cast<long>(seen.size()));
+    }
+
+    void WriteThenRead(char* out, char* in) {
+        for (size_t i = 0; i < kNumChunks * kChunkSize; i++) {
+            out[i] = i * 7 + i / kChunkSize;
+        }
+
+        std::vector<iocb> writes(kNumChunks);
+        for (size_t i = 0; i < kNumChunks; i++) {
+            io_prep(&writes[i], file_.fd, out + i * kChunkSize, kChunkSize, i * kChunkSize, false);
+        }
+        Run(writes, kChunkSize);
+
+        iocb sync;
+        memset(&sync, 0, sizeof(sync));
+        sync.aio_fildes = file_.fd;
+        sync.aio_lio_opcode = IOCB_CMD_FSYNC;
+        std::vector<iocb> syncs = {sync};
+        Run(syncs, 0);
+
+        std::vector<iocb> reads(kNumChunks);
+        for (size_t i = 0; i < kNumChunks; i++) {
+            io_prep(&reads[i], file_.fd, in + i * kChunkSize, kChunkSize, i * kChunkSize, true);
+        }
+        Run(reads, kChunkSize);
+        EXPECT_EQ(memcmp(out, in, kNumChunks * kChunkSize), 0);
+    }
+
+    asyncio_context* ctx_ = nullptr;
+    TemporaryFile file_;
+};
+
+TEST_P(AsyncIOContextTest, WriteThenRead) {
+    std::vector<char> out(kNumChunks * kChunkSize), in(kNumChunks * kChunkSize);
+    WriteThenRead(out.data(), in.data());
+}
+
+TEST_P(AsyncIOContextTest, RegisteredBuffers) {
+    std::vector<char> buffer(2 * kNumChunks * kChunkSize);
+    iovec iov = {buffer.data(), buffer.size()};
+    if (asyncio_register_buffers(ctx_, &iov, 1) != 0) {
+        ASSERT_FALSE(asyncio_is_io_uring(ctx_));
+        ASSERT_EQ(errno, EOPNOTSUPP);
+    }
+    WriteThenRead(buffer.data(), buffer.data() + kNumChunks * kChunkSize);
+}
+
+INSTANTIATE_TEST_SUITE_P(Flags, AsyncIOContextTest,
+                         ::testing::Values(0u, ASYNCIO_SQPOLL, ASYNCIO_AIO_ONLY));
+
+}  // namespace
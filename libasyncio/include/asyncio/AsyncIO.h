@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <sys/cdefs.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -44,6 +45,37 @@ void io_prep_pread(struct iocb* iocb, int fd, void* buf, size_t count, long long
 void io_prep_pwrite(struct iocb* iocb, int fd, void* buf, size_t count, long long offset);
 void io_prep(struct iocb* iocb, int fd, const void* buf, uint64_t count, int64_t offset, bool read);
 
+/**
+ * Runs iocbs prepared with io_prep() and friends through io_uring when the
+ * kernel supports it, and through the aio syscalls above otherwise. Completions
+ * are reported as io_events either way, with |obj| pointing at the iocb and
+ * |data| copied from its aio_data.
+ *
+ * Only IOCB_CMD_PREAD, PWRITE, PREADV, PWRITEV, FSYNC and FDSYNC without
+ * aio_flags are supported on io_uring. A context must not be used from several
+ * threads at once.
+ */
+struct asyncio_context;
+
+/* Let a kernel thread poll for submissions, so that most need no syscall. */
+#define ASYNCIO_SQPOLL 0x1
+/* Never use io_uring. */
+#define ASYNCIO_AIO_ONLY 0x2
+
+int asyncio_setup(unsigned nr, unsigned flags, struct asyncio_context** ctxp);
+int asyncio_destroy(struct asyncio_context* ctx);
+int asyncio_submit(struct asyncio_context* ctx, long nr, struct iocb** iocbpp);
+int asyncio_getevents(struct asyncio_context* ctx, long min_nr, long max_nr,
+                      struct io_event* events, struct timespec* timeout);
+bool asyncio_is_io_uring(const struct asyncio_context* ctx);
+
+/*
+ * Registers |nr| buffers with an io_uring context, so that reads and writes
+ * that fall inside one of them skip mapping the pages on every request. Fails
+ * with EOPNOTSUPP for an aio context.
+ */
+int asyncio_register_buffers(struct asyncio_context* ctx, const struct iovec* iovecs, unsigned nr);
+
 #ifdef __cplusplus
 };
 #endif
@@ -23,14 +23,17 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <algorithm>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 using android::base::ConsumePrefix;
@@ -38,16 +41,84 @@ using android::base::StartsWith;
 using android::base::Tokenize;
 
 struct Entry {
-    std::string path;
+    // The path is stored without its terminator in canned_paths.
+    size_t path_offset;
+    size_t path_length;
     unsigned uid;
     unsigned gid;
     unsigned mode;
     uint64_t capabilities;
 };
 
+static constexpr size_t kEmptySlot = SIZE_MAX;
+
+// All paths share a single arena, and canned_index is an open-addressing hash
+// table of indexes into canned_data keyed on the full path, probed linearly.
+static std::string canned_paths;
 static std::vector<Entry> canned_data;
+static std::vector<size_t> canned_index;
+
+static std::string_view entry_path(const Entry& entry) {
+    return std::string_view(canned_paths).substr(entry.path_offset, entry.path_length);
+}
+
+// Returns the slot of canned_index holding |path|, or the empty slot it would go in.
+static size_t find_slot(std::string_view path) {
+    const size_t mask = canned_index.size() - 1;
+    for (size_t slot = std::hash<std::string_view>{}(path) & mask;; slot = (slot + 1) & mask) {
+        const size_t index = canned_index[slot];
+        if (index == kEmptySlot || entry_path(canned_data[index]) == path) return slot;
+    }
+}
+
+static void grow_index() {
+    canned_index.assign(std::max<size_t>(64, canned_index.size() * 2), kEmptySlot);
+    for (size_t i = 0; i < canned_data.size(); i++) {
+        canned_index[find_slot(entry_path(canned_data[i]))] = i;
+    }
+}
+
+// Adds an entry for |path|, replacing any earlier entry for the same path.
+static void add_entry(std::string_view path, const Entry& e) {
+    // Keep the table at most half full.
+    if ((canned_data.size() + 1) * 2 > canned_index.size()) grow_index();
+
+    const size_t slot = find_slot(path);
+    if (canned_index[slot] != kEmptySlot) {
+        Entry& existing = canned_data[canned_index[slot]];
+        existing.uid = e.uid;
+        existing.gid = e.gid;
+        existing.mode = e.mode;
+        existing.capabilities = e.capabilities;
+        return;
+    }
+
+    Entry added = e;
+    added.path_offset = canned_paths.size();
+    added.path_length = path.size();
+    canned_paths.append(path);
+    canned_index[slot] = canned_data.size();
+    canned_data.emplace_back(added);
+}
+
+static const Entry* find_entry(const char* path) {
+    if (path != nullptr && path[0] == '/') path++;  // canned paths lack the leading '/'
+
+    const Entry* found = nullptr;
+    if (path != nullptr && !canned_index.empty()) {
+        const size_t index = canned_index[find_slot(path)];
+        if (index != kEmptySlot) found = &canned_data[index];
+    }
+
+    if (found == nullptr) {
+        std::cerr << "failed to find " << path << " in canned fs_config" << std::endl;
+        exit(1);
+    }
+    return found;
+}
 
 int load_canned_fs_config(const char* fn) {
+    size_t loaded = 0;
     std::ifstream input(fn);
     for (std::string line; std::getline(input, line);) {
         // Historical: the root dir can be represented as a space character.
@@ -66,10 +137,12 @@ int load_canned_fs_config(const char* fn) {
         }
 
         // Historical: remove the leading '/' if exists.
-        std::string path(tokens[0].front() == '/' ? std::string(tokens[0], 1) : tokens[0]);
+        std::string_view path(tokens[0]);
+        if (path.front() == '/') path.remove_prefix(1);
 
         Entry e{
-                .path = std::move(path),
+                .path_offset = 0,
+                .path_length = 0,
                 .uid = static_cast<unsigned int>(atoi(tokens[1].c_str())),
                 .gid = static_cast<unsigned int>(atoi(tokens[2].c_str())),
                 // mode is in octal
@@ -89,45 +162,33 @@ int load_canned_fs_config(const char* fn) {
             std::cerr << "info: ignored token \"" << sv << "\" in " << fn << std::endl;
         }
 
-        canned_data.emplace_back(std::move(e));
+        // There can be multiple entries for the same path. Then the one that comes the last
+        // wins. This is to allow overriding platform provided fs_config with a user provided
+        // fs_config by appending the latter to the former.
+        add_entry(path, e);
+        loaded++;
     }
 
-    // Note: we used to sort the entries by path names. This was to improve the lookup performance
-    // by doing binary search. However, this is no longer the case. The lookup performance is not
-    // critical because this tool runs on the host, not on the device. Now, there can be multiple
-    // entries for the same path. Then the one that comes the last wins. This is to allow overriding
-    // platform provided fs_config with a user provided fs_config by appending the latter to the
-    // former.
-    //
-    // To implement the strategy, reverse the entries order, and search from the top.
-    std::reverse(canned_data.begin(), canned_data.end());
-
-    std::cout << "loaded " << canned_data.size() << " fs_config entries" << std::endl;
+    std::cout << "loaded " << loaded << " fs_config entries" << std::endl;
     return 0;
 }
 
 void canned_fs_config(const char* path, [[maybe_unused]] int dir,
                       [[maybe_unused]] const char* target_out_path, unsigned* uid, unsigned* gid,
                       unsigned* mode, uint64_t* capabilities) {
-    if (path != nullptr && path[0] == '/') path++;  // canned paths lack the leading '/'
-
-    const Entry* found = nullptr;
-    // canned_data is already reversed. First match wins.
-    for (const auto& entry : canned_data) {
-        if (path == entry.path) {
-            found = &entry;
-            break;
-        }
-        continue;
-    }
-
-    if (found == nullptr) {
-        std::cerr << "failed to find " << path << " in canned fs_config" << std::endl;
-        exit(1);
-    }
-
+    const Entry* found = find_entry(path);
     *uid = found->uid;
     *gid = found->gid;
     *mode = found->mode;
     *capabilities = found->capabilities;
 }
+
+void canned_fs_config_many(struct fs_config_query* queries, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const Entry* found = find_entry(queries[i].path);
+        queries[i].uid = found->uid;
+        queries[i].gid = found->gid;
+        queries[i].mode = found->mode;
+        queries[i].capabilities = found->capabilities;
+    }
+}
@@ -32,7 +32,10 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <android-base/strings.h>
 #include <cutils/fs.h>
@@ -321,6 +324,33 @@ static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char*
 auto __for_testing_only__fs_config_cmp = fs_config_cmp;
 #endif
 
+// Reads the next entry of a <partition>/etc/fs_config_(dirs|files) file.
+// Returns false at the end of the file, or if the rest of it is corrupted.
+static bool fs_config_read_entry(int fd, const char* name, struct fs_path_config_from_file* header,
+                                 std::string* prefix) {
+    if (TEMP_FAILURE_RETRY(read(fd, header, sizeof(*header))) != sizeof(*header)) {
+        return false;
+    }
+    uint16_t host_len = header->len;
+    ssize_t remainder = host_len - sizeof(*header);
+    if (remainder <= 0) {
+        ALOGE("%s len is corrupted", name);
+        return false;
+    }
+    prefix->resize(remainder);
+    if (TEMP_FAILURE_RETRY(read(fd, &(*prefix)[0], remainder)) != remainder) {
+        ALOGE("%s prefix is truncated", name);
+        return false;
+    }
+    size_t len = strnlen(prefix->data(), remainder);
+    if (len >= static_cast<size_t>(remainder)) {  // missing a terminating null
+        ALOGE("%s is corrupted", name);
+        return false;
+    }
+    prefix->resize(len);
+    return true;
+}
+
 void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
                unsigned* mode, uint64_t* capabilities) {
     const struct fs_path_config* pc;
@@ -334,36 +364,13 @@ void fs_config(const char* path, int dir, const char* target_out_path, unsigned*
 
     for (which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
         struct fs_path_config_from_file header;
+        std::string prefix;
 
         int fd = fs_config_open(dir, which, target_out_path);
         if (fd < 0) continue;
 
-        while (TEMP_FAILURE_RETRY(read(fd, &header, sizeof(header))) == sizeof(header)) {
-            char* prefix;
-            uint16_t host_len = header.len;
-            ssize_t len, remainder = host_len - sizeof(header);
-            if (remainder <= 0) {
-                ALOGE("%s len is corrupted", conf[which][dir]);
-                break;
-            }
-            prefix = static_cast<char*>(calloc(1, remainder));
-            if (!prefix) {
-                ALOGE("%s out of memory", conf[which][dir]);
-                break;
-            }
-            if (TEMP_FAILURE_RETRY(read(fd, prefix, remainder)) != remainder) {
-                free(prefix);
-                ALOGE("%s prefix is truncated", conf[which][dir]);
-                break;
-            }
-            len = strnlen(prefix, remainder);
-            if (len >= remainder) {  // missing a terminating null
-                free(prefix);
-                ALOGE("%s is corrupted", conf[which][dir]);
-                break;
-            }
-            if (fs_config_cmp(dir, prefix, len, path, plen)) {
-                free(prefix);
+        while (fs_config_read_entry(fd, conf[which][dir], &header, &prefix)) {
+            if (fs_config_cmp(dir, prefix.c_str(), prefix.size(), path, plen)) {
                 close(fd);
                 *uid = header.uid;
                 *gid = header.gid;
@@ -371,7 +378,6 @@ void fs_config(const char* path, int dir, const char* target_out_path, unsigned*
                 *capabilities = header.capabilities;
                 return;
             }
-            free(prefix);
         }
         close(fd);
     }
@@ -386,3 +392,198 @@ void fs_config(const char* path, int dir, const char* target_out_path, unsigned*
     *mode = (*mode & (~07777)) | pc->mode;
     *capabilities = pc->capabilities;
 }
+
+namespace {
+
+// The rules for either directories or files, from the config files and the
+// built-in tables, in the order fs_config() tries them. Rules are filed in a
+// trie under the literal part of their pattern, up to the first wildcard, so a
+// lookup only has to look at the rules whose literal part is a prefix of the
+// path instead of calling fnmatch() for all of them.
+class FsConfigRules {
+  public:
+    explicit FsConfigRules(bool dir) : dir_(dir), nodes_(1) {}
+
+    void Add(const char* prefix, unsigned mode, unsigned uid, unsigned gid,
+             uint64_t capabilities);
+    void SetDefault(const struct fs_path_config& pc) { default_ = pc; }
+    const struct fs_path_config& Find(const char* path) const;
+
+  private:
+    struct Rule {
+        // The pattern as fs_config_cmp() would pass it to fnmatch().
+        std::string pattern;
+        enum { kExact, kPrefix, kGlob } kind;
+        struct fs_path_config pc;
+    };
+
+    struct Node {
+        std::vector<std::pair<char, uint32_t>> children;
+        std::vector<uint32_t> rules;
+    };
+
+    int32_t Child(uint32_t node, char c) const;
+    void Collect(const std::string& input, bool alias,
+                 std::vector<std::pair<uint32_t, bool>>* candidates) const;
+    bool Matches(const Rule& rule, const std::string& input) const;
+
+    bool dir_;
+    std::vector<Rule> rules_;
+    std::vector<Node> nodes_;
+    struct fs_path_config default_;
+};
+
+void FsConfigRules::Add(const char* prefix, unsigned mode, unsigned uid, unsigned gid,
+                        uint64_t capabilities) {
+    Rule rule;
+    rule.pattern = prefix;
+    if (dir_ && !EndsWith(rule.pattern, "/*")) {
+        rule.pattern.append(EndsWith(rule.pattern, "/") ? "*" : "/*");
+    }
+    size_t literal_len = rule.pattern.find_first_of("*?[");
+    if (literal_len == std::string::npos) {
+        rule.kind = Rule::kExact;
+        literal_len = rule.pattern.size();
+    } else if (literal_len == rule.pattern.size() - 1 && rule.pattern.back() == '*') {
+        rule.kind = Rule::kPrefix;
+    } else {
+        rule.kind = Rule::kGlob;
+    }
+    rule.pc = {mode, uid, gid, capabilities, nullptr};
+
+    uint32_t node = 0;
+    for (size_t i = 0; i < literal_len; i++) {
+        int32_t child = Child(node, rule.pattern[i]);
+        if (child < 0) {
+            child = nodes_.size();
+            nodes_[node].children.emplace_back(rule.pattern[i], child);
+            nodes_.emplace_back();
+        }
+        node = child;
+    }
+    nodes_[node].rules.push_back(rules_.size());
+    rules_.push_back(std::move(rule));
+}
+
+int32_t FsConfigRules::Child(uint32_t node, char c) const {
+    for (const auto& [child_c, child] : nodes_[node].children) {
+        if (child_c == c) return child;
+    }
+    return -1;
+}
+
+// Adds the rules whose literal part is a prefix of input.
+void FsConfigRules::Collect(const std::string& input, bool alias,
+                            std::vector<std::pair<uint32_t, bool>>* candidates) const {
+    int32_t node = 0;
+    for (size_t i = 0;; i++) {
+        for (uint32_t rule : nodes_[node].rules) {
+            candidates->emplace_back(rule, alias);
+        }
+        if (i == input.size() || (node = Child(node, input[i])) < 0) break;
+    }
+}
+
+bool FsConfigRules::Matches(const Rule& rule, const std::string& input) const {
+    switch (rule.kind) {
+        case Rule::kExact:
+            return input == rule.pattern;
+        case Rule::kPrefix:
+            return true;  // Collect() already matched the literal part.
+        case Rule::kGlob:
+            return fnmatch(rule.pattern.c_str(), input.c_str(), FNM_NOESCAPE) == 0;
+    }
+    return false;
+}
+
+// Same as trying fs_config_cmp() on each rule in order.
+const struct fs_path_config& FsConfigRules::Find(const char* path) const {
+    std::string input(path);
+    if (dir_ && !EndsWith(input, "/")) {
+        input.append("/");
+    }
+    std::string input_in_partition;
+    static constexpr const char* kLogicalPartitions[] = {"system/product/", "system/system_ext/",
+                                                         "system/vendor/", "vendor/odm/"};
+    for (auto& logical_partition : kLogicalPartitions) {
+        if (StartsWith(input, logical_partition)) {
+            std::string in_partition = input.substr(input.find('/') + 1);
+            if (is_partition(in_partition)) {
+                input_in_partition = std::move(in_partition);
+                break;
+            }
+        }
+    }
+
+    std::vector<std::pair<uint32_t, bool>> candidates;
+    Collect(input, false, &candidates);
+    if (!input_in_partition.empty()) {
+        Collect(input_in_partition, true, &candidates);
+    }
+    std::sort(candidates.begin(), candidates.end());
+    for (const auto& [rule, alias] : candidates) {
+        if (Matches(rules_[rule], alias ? input_in_partition : input)) {
+            return rules_[rule].pc;
+        }
+    }
+    return default_;
+}
+
+}  // namespace
+
+struct fs_config_context {
+    FsConfigRules rules[2] = {FsConfigRules(false), FsConfigRules(true)};
+};
+
+struct fs_config_context* fs_config_open_context(const char* target_out_path) {
+    auto context = new fs_config_context;
+    for (int dir = 0; dir < 2; dir++) {
+        FsConfigRules& rules = context->rules[dir];
+        for (size_t which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
+            int fd = fs_config_open(dir, which, target_out_path);
+            if (fd < 0) continue;
+
+            struct fs_path_config_from_file header;
+            std::string prefix;
+            while (fs_config_read_entry(fd, conf[which][dir], &header, &prefix)) {
+                rules.Add(prefix.c_str(), header.mode, header.uid, header.gid,
+                          header.capabilities);
+            }
+            close(fd);
+        }
+
+        const struct fs_path_config* pc;
+        for (pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
+            rules.Add(pc->prefix, pc->mode, pc->uid, pc->gid, pc->capabilities);
+        }
+        rules.SetDefault(*pc);
+    }
+    return context;
+}
+
+void fs_config_close_context(struct fs_config_context* context) {
+    delete context;
+}
+
+void fs_config_from_context(const struct fs_config_context* context, const char* path, int dir,
+                            unsigned* uid, unsigned* gid, unsigned* mode, uint64_t* capabilities) {
+    if (path[0] == '/') {
+        path++;
+    }
+
+    const struct fs_path_config& pc = context->rules[dir ? 1 : 0].Find(path);
+    *uid = pc.uid;
+    *gid = pc.gid;
+    *mode = (*mode & (~07777)) | pc.mode;
+    *capabilities = pc.capabilities;
+}
+
+void fs_config_many(const char* target_out_path, struct fs_config_query* queries,
+                    size_t count) {
+    struct fs_config_context* context = fs_config_open_context(target_out_path);
+    for (size_t i = 0; i < count; i++) {
+        fs_config_from_context(context, queries[i].path, queries[i].dir, &queries[i].uid,
+                               &queries[i].gid, &queries[i].mode, &queries[i].capabilities);
+    }
+    fs_config_close_context(context);
+}
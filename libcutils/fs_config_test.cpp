@@ -15,8 +15,11 @@
  */
 
 #include <inttypes.h>
+#include <sys/stat.h>
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -25,6 +28,8 @@
 #include <android-base/strings.h>
 
 #include <private/android_filesystem_config.h>
+#include <private/canned_fs_config.h>
+#include <private/fs_config.h>
 
 #include "fs_config.h"
 
@@ -258,3 +263,98 @@ TEST(fs_config, odm_files_alias) {
 TEST(fs_config, system_alias) {
     EXPECT_FALSE(check_fs_config_cmp(fs_config_cmp_tests));
 }
+
+static std::vector<std::string> context_test_paths(const fs_path_config* paths) {
+    std::vector<std::string> result = {"", "/", "system", "vendor/odm/etc/x", "odm/bin/x",
+                                       "system/vendor/bin/x", "system/product/lib/x"};
+    for (size_t idx = 0; paths[idx].prefix; ++idx) {
+        std::string path(paths[idx].prefix);
+        std::replace(path.begin(), path.end(), '*', 'x');
+        for (const std::string& p : {path, path + "/a", path + "y", "system/" + path,
+                                     "/" + path, path.substr(0, path.size() / 2)}) {
+            result.push_back(p);
+        }
+    }
+    return result;
+}
+
+static void check_context(const fs_path_config* paths, int dir) {
+    fs_config_context* context = fs_config_open_context(nullptr);
+    ASSERT_NE(nullptr, context);
+    for (const std::string& path : context_test_paths(paths)) {
+        unsigned uid = 0, gid = 0, mode = (dir ? S_IFDIR : S_IFREG) | 0777;
+        uint64_t capabilities = 0;
+        fs_config(path.c_str(), dir, nullptr, &uid, &gid, &mode, &capabilities);
+
+        unsigned context_uid = 0, context_gid = 0, context_mode = (dir ? S_IFDIR : S_IFREG) | 0777;
+        uint64_t context_capabilities = 0;
+        fs_config_from_context(context, path.c_str(), dir, &context_uid, &context_gid,
+                               &context_mode, &context_capabilities);
+        EXPECT_EQ(uid, context_uid) << path;
+        EXPECT_EQ(gid, context_gid) << path;
+        EXPECT_EQ(mode, context_mode) << path;
+        EXPECT_EQ(capabilities, context_capabilities) << path;
+    }
+    fs_config_close_context(context);
+}
+
+TEST(fs_config, context_dirs) {
+    check_context(__for_testing_only__android_dirs, 1);
+}
+
+TEST(fs_config, context_files) {
+    check_context(__for_testing_only__android_files, 0);
+}
+
+TEST(fs_config, many) {
+    std::vector<std::string> paths = context_test_paths(__for_testing_only__android_files);
+    std::vector<fs_config_query> queries;
+    for (const std::string& path : paths) {
+        queries.push_back({path.c_str(), 0, 0, 0, S_IFREG | 0777, 0});
+    }
+    fs_config_many(nullptr, queries.data(), queries.size());
+
+    for (const fs_config_query& query : queries) {
+        unsigned uid = 0, gid = 0, mode = S_IFREG | 0777;
+        uint64_t capabilities = 0;
+        fs_config(query.path, 0, nullptr, &uid, &gid, &mode, &capabilities);
+        EXPECT_EQ(uid, query.uid) << query.path;
+        EXPECT_EQ(gid, query.gid) << query.path;
+        EXPECT_EQ(mode, query.mode) << query.path;
+        EXPECT_EQ(capabilities, query.capabilities) << query.path;
+    }
+}
+
+TEST(fs_config, canned) {
+    TemporaryFile tf;
+    ASSERT_TRUE(android::base::WriteStringToFile(" 0 0 0755\n"
+                                                 "system/bin/sh 0 2000 0755\n"
+                                                 "/system/bin/ping 0 0 0750 capabilities=0x2000\n"
+                                                 "system/bin/sh 1000 1000 0700\n",
+                                                 tf.path));
+    ASSERT_EQ(0, load_canned_fs_config(tf.path));
+
+    unsigned uid = 0, gid = 0, mode = 0;
+    uint64_t capabilities = 0;
+    canned_fs_config("/", 1, nullptr, &uid, &gid, &mode, &capabilities);
+    EXPECT_EQ(0755U, mode);
+
+    // The last entry for a path wins.
+    canned_fs_config("system/bin/sh", 0, nullptr, &uid, &gid, &mode, &capabilities);
+    EXPECT_EQ(1000U, uid);
+    EXPECT_EQ(1000U, gid);
+    EXPECT_EQ(0700U, mode);
+
+    std::vector<fs_config_query> queries = {
+            {"/system/bin/ping", 0, 0, 0, 0, 0},
+            {"system/bin/sh", 0, 0, 0, 0, 0},
+    };
+    canned_fs_config_many(queries.data(), queries.size());
+    EXPECT_EQ(0750U, queries[0].mode);
+    EXPECT_EQ(0x2000U, queries[0].capabilities);
+    EXPECT_EQ(1000U, queries[1].uid);
+
+    EXPECT_EXIT(canned_fs_config("system/bin/missing", 0, nullptr, &uid, &gid, &mode,
+                                 &capabilities),
+                ::testing::ExitedWithCode(1), "failed to find system/bin/missing");
+}
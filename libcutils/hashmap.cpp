@@ -19,10 +19,85 @@
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
+// Build with -DCUTILS_HASHMAP_OPEN_ADDRESSING=1 to store entries inline in a
+// linearly probed table instead of chaining malloc'd nodes. The public API
+// behaves the same either way, except that hashmapForEach() visits entries in a
+// different order, which callers such as str_parms_to_str() expose.
+#ifndef CUTILS_HASHMAP_OPEN_ADDRESSING
+#define CUTILS_HASHMAP_OPEN_ADDRESSING 0
+#endif
+
+#if CUTILS_HASHMAP_OPEN_ADDRESSING
+
+enum SlotState : uint8_t {
+    SLOT_EMPTY = 0,
+    SLOT_FULL,
+    // Removed entries leave a tombstone so that probe sequences passing through
+    // the slot stay intact, and so that hashmapRemove() is safe to call from a
+    // hashmapForEach() callback.
+    SLOT_DELETED,
+};
+
+typedef struct Slot Slot;
+struct Slot {
+    void* key;
+    void* value;
+    int hash;
+    SlotState state;
+};
+
+struct Hashmap {
+    Slot* slots;
+    size_t slotCount;
+    int (*hash)(void* key);
+    bool (*equals)(void* keyA, void* keyB);
+    pthread_mutex_t lock;
+    size_t size;
+    size_t deletedCount;
+};
+
+Hashmap* hashmapCreate(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+    assert(hash != NULL);
+    assert(equals != NULL);
+
+    Hashmap* map = static_cast<Hashmap*>(malloc(sizeof(Hashmap)));
+    if (map == NULL) {
+        return NULL;
+    }
+
+    // 0.5 load factor: probe sequences get long quickly beyond that.
+    // Slot count must be a power of 2.
+    size_t minimumSlotCount = initialCapacity * 2;
+    map->slotCount = 4;
+    while (map->slotCount <= minimumSlotCount) {
+        map->slotCount <<= 1;
+    }
+
+    map->slots = static_cast<Slot*>(calloc(map->slotCount, sizeof(Slot)));
+    if (map->slots == NULL) {
+        free(map);
+        return NULL;
+    }
+
+    map->size = 0;
+    map->deletedCount = 0;
+
+    map->hash = hash;
+    map->equals = equals;
+
+    pthread_mutex_init(&map->lock, nullptr);
+
+    return map;
+}
+
+#else
+
 typedef struct Entry Entry;
 struct Entry {
     void* key;
@@ -74,6 +149,8 @@ Hashmap* hashmapCreate(size_t initialCapacity,
     return map;
 }
 
+#endif
+
 /**
  * Hashes the given key.
  */
@@ -97,6 +174,182 @@ static inline size_t calculateIndex(size_t bucketCount, int hash) {
     return ((size_t) hash) & (bucketCount - 1);
 }
 
+static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
+        bool (*equals)(void*, void*)) {
+    if (keyA == keyB) {
+        return true;
+    }
+    if (hashA != hashB) {
+        return false;
+    }
+    return equals(keyA, keyB);
+}
+
+void hashmapLock(Hashmap* map) {
+    pthread_mutex_lock(&map->lock);
+}
+
+void hashmapUnlock(Hashmap* map) {
+    pthread_mutex_unlock(&map->lock);
+}
+
+#ifdef __clang__
+__attribute__((no_sanitize("integer")))
+#endif
+/* FIXME: relies on signed integer overflow, which is undefined behavior */
+int hashmapHash(void* key, size_t keySize) {
+    int h = keySize;
+    char* data = (char*) key;
+    size_t i;
+    for (i = 0; i < keySize; i++) {
+        h = h * 31 + *data;
+        data++;
+    }
+    return h;
+}
+
+#if CUTILS_HASHMAP_OPEN_ADDRESSING
+
+// Linear probing is sensitive to clustering in the low bits, which hashKey()
+// alone does not spread well for sequential or strided keys.
+#ifdef __clang__
+__attribute__((no_sanitize("integer")))
+#endif
+static inline size_t calculateSlot(size_t slotCount, int hash) {
+    uint32_t h = static_cast<uint32_t>(hash);
+    h ^= h >> 16;
+    h *= 0x45d9f3bu;
+    h ^= h >> 16;
+    return h & (slotCount - 1);
+}
+
+// Rehashes all live entries into a table of newSlotCount slots, dropping
+// tombstones. Returns false, leaving the map untouched, if allocation fails.
+static bool rehash(Hashmap* map, size_t newSlotCount) {
+    Slot* newSlots = static_cast<Slot*>(calloc(newSlotCount, sizeof(Slot)));
+    if (newSlots == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < map->slotCount; i++) {
+        Slot* slot = &map->slots[i];
+        if (slot->state != SLOT_FULL) {
+            continue;
+        }
+        size_t index = calculateSlot(newSlotCount, slot->hash);
+        while (newSlots[index].state != SLOT_EMPTY) {
+            index = (index + 1) & (newSlotCount - 1);
+        }
+        newSlots[index] = *slot;
+    }
+
+    free(map->slots);
+    map->slots = newSlots;
+    map->slotCount = newSlotCount;
+    map->deletedCount = 0;
+    return true;
+}
+
+// Finds the slot holding key, or NULL.
+static Slot* findSlot(Hashmap* map, void* key, int hash) {
+    size_t index = calculateSlot(map->slotCount, hash);
+    while (true) {
+        Slot* slot = &map->slots[index];
+        if (slot->state == SLOT_EMPTY) {
+            return NULL;
+        }
+        if (slot->state == SLOT_FULL &&
+                equalKeys(slot->key, slot->hash, key, hash, map->equals)) {
+            return slot;
+        }
+        index = (index + 1) & (map->slotCount - 1);
+    }
+}
+
+void hashmapFree(Hashmap* map) {
+    free(map->slots);
+    pthread_mutex_destroy(&map->lock);
+    free(map);
+}
+
+void* hashmapPut(Hashmap* map, void* key, void* value) {
+    int hash = hashKey(map, key);
+
+    // Replace existing entry.
+    Slot* slot = findSlot(map, key, hash);
+    if (slot != NULL) {
+        void* oldValue = slot->value;
+        slot->value = value;
+        return oldValue;
+    }
+
+    // Tombstones count towards the load factor: they lengthen probe sequences
+    // just like live entries do.
+    if ((map->size + map->deletedCount + 1) > (map->slotCount / 2)) {
+        // Double the table if live entries alone would keep it over half of
+        // the limit, otherwise just sweep out the tombstones.
+        size_t newSlotCount = map->slotCount;
+        if ((map->size + 1) > (map->slotCount / 4)) {
+            newSlotCount <<= 1;
+        }
+        // If allocation fails, keep going in the current table as long as an
+        // empty slot remains to terminate probing.
+        if (!rehash(map, newSlotCount) &&
+                (map->size + map->deletedCount + 1) >= map->slotCount) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    // Add a new entry, reusing the first tombstone on the probe sequence.
+    size_t index = calculateSlot(map->slotCount, hash);
+    while (map->slots[index].state == SLOT_FULL) {
+        index = (index + 1) & (map->slotCount - 1);
+    }
+    slot = &map->slots[index];
+    if (slot->state == SLOT_DELETED) {
+        map->deletedCount--;
+    }
+    slot->key = key;
+    slot->value = value;
+    slot->hash = hash;
+    slot->state = SLOT_FULL;
+    map->size++;
+    return NULL;
+}
+
+void* hashmapGet(Hashmap* map, void* key) {
+    Slot* slot = findSlot(map, key, hashKey(map, key));
+    return slot != NULL ? slot->value : NULL;
+}
+
+void* hashmapRemove(Hashmap* map, void* key) {
+    Slot* slot = findSlot(map, key, hashKey(map, key));
+    if (slot == NULL) {
+        return NULL;
+    }
+
+    void* value = slot->value;
+    slot->key = NULL;
+    slot->value = NULL;
+    slot->state = SLOT_DELETED;
+    map->size--;
+    map->deletedCount++;
+    return value;
+}
+
+void hashmapForEach(Hashmap* map, bool (*callback)(void* key, void* value, void* context),
+                    void* context) {
+    for (size_t i = 0; i < map->slotCount; i++) {
+        Slot* slot = &map->slots[i];
+        if (slot->state == SLOT_FULL && !callback(slot->key, slot->value, context)) {
+            return;
+        }
+    }
+}
+
+#else
+
 static void expandIfNecessary(Hashmap* map) {
     // If the load factor exceeds 0.75...
     if (map->size > (map->bucketCount * 3 / 4)) {
@@ -128,14 +381,6 @@ static void expandIfNecessary(Hashmap* map) {
     }
 }
 
-void hashmapLock(Hashmap* map) {
-    pthread_mutex_lock(&map->lock);
-}
-
-void hashmapUnlock(Hashmap* map) {
-    pthread_mutex_unlock(&map->lock);
-}
-
 void hashmapFree(Hashmap* map) {
     size_t i;
     for (i = 0; i < map->bucketCount; i++) {
@@ -151,21 +396,6 @@ void hashmapFree(Hashmap* map) {
     free(map);
 }
 
-#ifdef __clang__
-__attribute__((no_sanitize("integer")))
-#endif
-/* FIXME: relies on signed integer overflow, which is undefined behavior */
-int hashmapHash(void* key, size_t keySize) {
-    int h = keySize;
-    char* data = (char*) key;
-    size_t i;
-    for (i = 0; i < keySize; i++) {
-        h = h * 31 + *data;
-        data++;
-    }
-    return h;
-}
-
 static Entry* createEntry(void* key, int hash, void* value) {
     Entry* entry = static_cast<Entry*>(malloc(sizeof(Entry)));
     if (entry == NULL) {
@@ -178,17 +408,6 @@ static Entry* createEntry(void* key, int hash, void* value) {
     return entry;
 }
 
-static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
-        bool (*equals)(void*, void*)) {
-    if (keyA == keyB) {
-        return true;
-    }
-    if (hashA != hashB) {
-        return false;
-    }
-    return equals(keyA, keyB);
-}
-
 void* hashmapPut(Hashmap* map, void* key, void* value) {
     int hash = hashKey(map, key);
     size_t index = calculateIndex(map->bucketCount, hash);
@@ -272,3 +491,5 @@ void hashmapForEach(Hashmap* map, bool (*callback)(void* key, void* value, void*
         }
     }
 }
+
+#endif
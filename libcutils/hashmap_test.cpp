@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap.h>
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+
+static int int_hash(void* key) {
+    return static_cast<int>(reinterpret_cast<uintptr_t>(key));
+}
+
+// Sends every key to the same probe sequence or chain.
+static int constant_hash(void*) {
+    return 42;
+}
+
+static bool int_equals(void* keyA, void* keyB) {
+    return keyA == keyB;
+}
+
+static void* key(uintptr_t i) {
+    return reinterpret_cast<void*>(i);
+}
+
+static bool count_entries(void*, void*, void* context) {
+    ++*static_cast<size_t*>(context);
+    return true;
+}
+
+static bool remove_entry(void* key, void*, void* context) {
+    hashmapRemove(static_cast<Hashmap*>(context), key);
+    return true;
+}
+
+TEST(hashmap, put_get_remove) {
+    Hashmap* map = hashmapCreate(0, int_hash, int_equals);
+    ASSERT_NE(nullptr, map);
+
+    EXPECT_EQ(nullptr, hashmapGet(map, key(1)));
+    EXPECT_EQ(nullptr, hashmapPut(map, key(1), key(100)));
+    EXPECT_EQ(key(100), hashmapGet(map, key(1)));
+    EXPECT_EQ(key(100), hashmapPut(map, key(1), key(101)));
+    EXPECT_EQ(key(101), hashmapGet(map, key(1)));
+    EXPECT_EQ(key(101), hashmapRemove(map, key(1)));
+    EXPECT_EQ(nullptr, hashmapGet(map, key(1)));
+    EXPECT_EQ(nullptr, hashmapRemove(map, key(1)));
+
+    hashmapFree(map);
+}
+
+TEST(hashmap, grows) {
+    for (auto hash : {int_hash, constant_hash}) {
+        Hashmap* map = hashmapCreate(4, hash, int_equals);
+        ASSERT_NE(nullptr, map);
+
+        constexpr uintptr_t kCount = 1000;
+        for (uintptr_t i = 1; i <= kCount; i++) {
+            ASSERT_EQ(nullptr, hashmapPut(map, key(i), key(i + kCount)));
+        }
+        for (uintptr_t i = 1; i <= kCount; i++) {
+            ASSERT_EQ(key(i + kCount), hashmapGet(map, key(i))) << i;
+        }
+        size_t count = 0;
+        hashmapForEach(map, count_entries, &count);
+        EXPECT_EQ(kCount, count);
+
+        hashmapFree(map);
+    }
+}
+
+TEST(hashmap, churn) {
+    Hashmap* map = hashmapCreate(8, int_hash, int_equals);
+    ASSERT_NE(nullptr, map);
+
+    // Repeatedly replacing the contents of a small map must not degrade
+    // lookups of keys that are still present.
+    for (uintptr_t round = 0; round < 100; round++) {
+        for (uintptr_t i = 1; i <= 8; i++) {
+            ASSERT_EQ(nullptr, hashmapPut(map, key(round * 8 + i), key(i)));
+        }
+        for (uintptr_t i = 1; i <= 8; i++) {
+            ASSERT_EQ(key(i), hashmapGet(map, key(round * 8 + i)));
+            ASSERT_EQ(key(i), hashmapRemove(map, key(round * 8 + i)));
+        }
+    }
+    size_t count = 0;
+    hashmapForEach(map, count_entries, &count);
+    EXPECT_EQ(0U, count);
+
+    hashmapFree(map);
+}
+
+TEST(hashmap, remove_during_for_each) {
+    Hashmap* map = hashmapCreate(0, constant_hash, int_equals);
+    ASSERT_NE(nullptr, map);
+
+    for (uintptr_t i = 1; i <= 100; i++) {
+        ASSERT_EQ(nullptr, hashmapPut(map, key(i), key(i)));
+    }
+    hashmapForEach(map, remove_entry, map);
+    for (uintptr_t i = 1; i <= 100; i++) {
+        EXPECT_EQ(nullptr, hashmapGet(map, key(i))) << i;
+    }
+
+    hashmapFree(map);
+}
@@ -110,8 +110,24 @@ int32_t property_get_int32(const char *key, int32_t default_value);
 */
 int property_set(const char *key, const char *value);
 
+/* property_set_batch: sets |count| properties with a single request to the
+** property service, rather than one request each. If |results| is not NULL,
+** it receives 0 for each property that was set and non-zero for each that
+** wasn't. Returns 0 if all of the properties were set, < 0 otherwise.
+*/
+int property_set_batch(size_t count, const char* const* keys, const char* const* values,
+                       int* results);
+
 int property_list(void (*propfn)(const char *key, const char *value, void *cookie), void *cookie);
 
+/* Property service message for property_set_batch(). The request is the
+** message, a uint32_t count, then count pairs of length-prefixed name and
+** value strings. The reply is count uint32_t results, PROP_SUCCESS or
+** PROP_ERROR_*. At most PROP_SETPROP_BATCH_MAX properties can be sent at once.
+*/
+#define PROP_MSG_SETPROP_BATCH 0x00020002
+#define PROP_SETPROP_BATCH_MAX 256
+
 #if defined(__BIONIC_FORTIFY)
 #define __property_get_err_str "property_get() called with too small of a buffer"
 
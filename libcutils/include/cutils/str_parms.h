@@ -17,6 +17,7 @@
 #ifndef __CUTILS_STR_PARMS_H
 #define __CUTILS_STR_PARMS_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/cdefs.h>
 
@@ -55,6 +56,51 @@ char *str_parms_to_str(struct str_parms *str_parms);
 /* debug */
 void str_parms_dump(struct str_parms *str_parms);
 
+/*
+ * A read-only alternative to str_parms_create_str() that doesn't allocate.
+ * The view records where each key and value is in the original string, which
+ * must outlive it, and parses the same way: pairs are separated by ';', a
+ * pair without '=' has an empty value, pairs with an empty key are ignored
+ * and the last value given for a key wins.
+ *
+ * Up to STR_PARMS_VIEW_MAX_PAIRS distinct keys are kept in the view itself;
+ * lookups in a string with more than that scan the string instead.
+ */
+struct str_parms_span {
+    const char *data;
+    size_t len;
+};
+
+#define STR_PARMS_VIEW_MAX_PAIRS 8
+
+struct str_parms_view {
+    const char *str;
+    size_t count;
+    int overflow;
+    struct {
+        struct str_parms_span key;
+        struct str_parms_span value;
+    } pairs[STR_PARMS_VIEW_MAX_PAIRS];
+};
+
+void str_parms_view_init(struct str_parms_view *view, const char *str);
+
+// Returns the next pair after *cursor, which should point to the start of the
+// string on the first call, and advances it. Returns zero at the end.
+int str_parms_view_next(const char **cursor, struct str_parms_span *key,
+                        struct str_parms_span *value);
+
+// Same as the str_parms_* equivalents.
+int str_parms_view_get(const struct str_parms_view *view, const char *key,
+                       struct str_parms_span *out_val);
+int str_parms_view_has_key(const struct str_parms_view *view, const char *key);
+int str_parms_view_get_str(const struct str_parms_view *view, const char *key,
+                           char *out_val, int len);
+int str_parms_view_get_int(const struct str_parms_view *view, const char *key,
+                           int *out_val);
+int str_parms_view_get_float(const struct str_parms_view *view, const char *key,
+                             float *out_val);
+
 __END_DECLS
 
 #endif /* __CUTILS_STR_PARMS_H */
@@ -109,6 +109,17 @@ void atrace_update_tags();
  */
 void atrace_set_tracing_enabled(bool enabled);
 
+/**
+ * When debug.atrace.buffered is set, events are collected per thread and
+ * written to trace_marker_raw in batches. A thread's events are written when
+ * its buffer fills, when it traces an event and the oldest buffered one is
+ * over 100ms old, and when it exits. atrace_flush writes the calling thread's
+ * events right away, e.g. before it blocks for a long time. Every thread's
+ * events are written when tracing starts or stops. trace_raw_decode converts
+ * the resulting raw_data events of a text trace back to tracing_mark_write.
+ */
+void atrace_flush();
+
 /**
  * This is always set to false. This forces code that uses an old version
  * of this header to always call into atrace_setup, in which we call
@@ -17,12 +17,21 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <sys/cdefs.h>
 
+#include <private/fs_config.h>
+
 __BEGIN_DECLS
 
 int load_canned_fs_config(const char* fn);
 void canned_fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid,
                       unsigned* gid, unsigned* mode, uint64_t* capabilities);
 
+/*
+ * Looks up count paths at once in the loaded canned fs_config. The dir field
+ * of each query is ignored, and mode is replaced by the canned mode.
+ */
+void canned_fs_config_many(struct fs_config_query* queries, size_t count);
+
 __END_DECLS
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/cdefs.h>
 
@@ -47,4 +48,33 @@ __BEGIN_DECLS
 void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
                unsigned* mode, uint64_t* capabilities);
 
+/*
+ * fs_config() reads the <partition>/etc/fs_config_(dirs|files) overrides
+ * every time it is called. Image builders that look up every file of a
+ * partition should instead open a context, which reads them once and indexes
+ * all the rules, and look paths up in it. The results are the same as
+ * fs_config()'s, provided the override files don't change in the meantime.
+ */
+struct fs_config_context;
+
+struct fs_config_context* fs_config_open_context(const char* target_out_path);
+void fs_config_close_context(struct fs_config_context* context);
+void fs_config_from_context(const struct fs_config_context* context, const char* path, int dir,
+                            unsigned* uid, unsigned* gid, unsigned* mode, uint64_t* capabilities);
+
+/*
+ * Looks up count paths at once. uid, gid, mode and capabilities are set as
+ * fs_config() would, and mode must hold the file type bits on entry.
+ */
+struct fs_config_query {
+    const char* path;
+    int dir;
+    unsigned uid;
+    unsigned gid;
+    unsigned mode;
+    uint64_t capabilities;
+};
+
+void fs_config_many(const char* target_out_path, struct fs_config_query* queries, size_t count);
+
 __END_DECLS
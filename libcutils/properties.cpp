@@ -20,9 +20,16 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include <android-base/properties.h>
+#include <android-base/unique_fd.h>
 
 int8_t property_get_bool(const char* key, int8_t default_value) {
     if (!key) return default_value;
@@ -115,4 +122,89 @@ int property_list(void (*fn)(const char* name, const char* value, void* cookie),
     return __system_property_foreach(property_list_callback, &data);
 }
 
+static void append_uint32(std::string* message, uint32_t value) {
+    message->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Sends the whole batch to the property service and reads back one result per property.
+static bool send_property_batch(size_t count, const char* const* keys, const char* const* values,
+                                int* results) {
+    android::base::unique_fd fd(socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (fd == -1) return false;
+
+    static const char property_service_socket[] = "/dev/socket/" PROP_SERVICE_NAME;
+    sockaddr_un addr = {};
+    addr.sun_family = AF_LOCAL;
+    strlcpy(addr.sun_path, property_service_socket, sizeof(addr.sun_path));
+    socklen_t addr_len = sizeof(property_service_socket) + offsetof(sockaddr_un, sun_path);
+    if (TEMP_FAILURE_RETRY(connect(fd.get(), reinterpret_cast<sockaddr*>(&addr), addr_len)) ==
+        -1) {
+        return false;
+    }
+
+    std::string message;
+    append_uint32(&message, PROP_MSG_SETPROP_BATCH);
+    append_uint32(&message, count);
+    for (size_t i = 0; i < count; i++) {
+        const char* value = values[i] ? values[i] : "";
+        append_uint32(&message, strlen(keys[i]));
+        message.append(keys[i]);
+        append_uint32(&message, strlen(value));
+        message.append(value);
+    }
+    for (size_t sent = 0; sent < message.size();) {
+        ssize_t n = TEMP_FAILURE_RETRY(
+                send(fd.get(), message.data() + sent, message.size() - sent, MSG_NOSIGNAL));
+        if (n <= 0) return false;
+        sent += n;
+    }
+
+    // A property service that doesn't know the message replies with a single error.
+    std::vector<uint32_t> replies(count);
+    ssize_t size = count * sizeof(uint32_t);
+    if (TEMP_FAILURE_RETRY(recv(fd.get(), replies.data(), size, MSG_WAITALL)) != size) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        results[i] = replies[i] == PROP_SUCCESS ? 0 : -1;
+    }
+    return true;
+}
+
+#else
+
+static bool send_property_batch(size_t, const char* const*, const char* const*, int*) {
+    return false;
+}
+
 #endif
+
+int property_set_batch(size_t count, const char* const* keys, const char* const* values,
+                       int* results) {
+    if (count == 0) return 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!keys[i]) return -1;
+    }
+
+    std::vector<int> batch_results(count);
+    for (size_t start = 0; start < count; start += PROP_SETPROP_BATCH_MAX) {
+        size_t n = std::min<size_t>(count - start, PROP_SETPROP_BATCH_MAX);
+        // A single property gains nothing from batching, and an older property service's
+        // PROP_ERROR_INVALID_CMD reply would be taken for its result.
+        if (n == 1 ||
+            !send_property_batch(n, keys + start, values + start, &batch_results[start])) {
+            // Fall back to one request per property, e.g. for an older property service.
+            for (size_t i = start; i < start + n; i++) {
+                batch_results[i] = property_set(keys[i], values[i]);
+            }
+        }
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (results) results[i] = batch_results[i];
+        if (batch_results[i] != 0) ret = -1;
+    }
+    return ret;
+}
+
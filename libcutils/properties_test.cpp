@@ -152,6 +152,39 @@ TEST_F(PropertiesTest, property_set_too_long) {
     ResetValue();
 }
 
+TEST_F(PropertiesTest, property_set_batch) {
+    const char* keys[] = {PROPERTY_TEST_KEY ".batch1", PROPERTY_TEST_KEY ".batch2",
+                          PROPERTY_TEST_KEY};
+    const char* values[] = {"one", "two", "three"};
+    int results[3] = {-1, -1, -1};
+    ASSERT_OK(property_set_batch(3, keys, values, results));
+    for (size_t i = 0; i < arraysize(keys); i++) {
+        EXPECT_OK(results[i]) << keys[i];
+        EXPECT_EQ(static_cast<int>(strlen(values[i])), property_get(keys[i], mValue, ""));
+        EXPECT_STREQ(values[i], mValue);
+    }
+
+    // A property that can't be set fails the batch, but not the others in it.
+    std::string too_long(PROPERTY_VALUE_MAX, 'a');
+    values[0] = too_long.c_str();
+    values[1] = "";
+    EXPECT_GT(0, property_set_batch(2, keys, values, results));
+    EXPECT_NE(0, results[0]);
+    EXPECT_OK(results[1]);
+    EXPECT_EQ(0, property_get(keys[1], mValue, ""));
+
+    // A batch of one is sent as a plain property_set().
+    EXPECT_GT(0, property_set_batch(1, keys, values, results));
+    EXPECT_NE(0, results[0]);
+    values[0] = "four";
+    EXPECT_OK(property_set_batch(1, keys, values, results));
+    EXPECT_OK(results[0]);
+    EXPECT_EQ(4, property_get(keys[0], mValue, ""));
+    EXPECT_STREQ("four", mValue);
+
+    EXPECT_OK(property_set(keys[0], ""));
+}
+
 TEST_F(PropertiesTest, property_get_too_long) {
     // Try to use a default value that's too long => get truncates the value
     ASSERT_OK(property_set(PROPERTY_TEST_KEY, ""));
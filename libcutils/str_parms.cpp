@@ -367,3 +367,157 @@ void str_parms_dump(struct str_parms *str_parms)
 {
     hashmapForEach(str_parms->map, dump_entry, str_parms);
 }
+
+int str_parms_view_next(const char **cursor, struct str_parms_span *key,
+                        struct str_parms_span *value)
+{
+    const char *p = *cursor;
+
+    for (;;) {
+        // Like strtok_r, skip empty pairs.
+        while (*p == ';')
+            p++;
+        if (*p == '\0') {
+            *cursor = p;
+            return 0;
+        }
+
+        const char *pair = p;
+        const char *eq = NULL;
+        for (; *p != '\0' && *p != ';'; p++) {
+            if (*p == '=' && !eq)
+                eq = p;
+        }
+
+        if (eq == pair)
+            continue;
+
+        key->data = pair;
+        if (eq) {
+            key->len = eq - pair;
+            value->data = eq + 1;
+            value->len = p - (eq + 1);
+        } else {
+            key->len = p - pair;
+            value->data = p;
+            value->len = 0;
+        }
+        *cursor = p;
+        return 1;
+    }
+}
+
+static bool span_eq(const struct str_parms_span *span, const char *str, size_t len)
+{
+    return span->len == len && !memcmp(span->data, str, len);
+}
+
+void str_parms_view_init(struct str_parms_view *view, const char *str)
+{
+    struct str_parms_span key, value;
+    const char *cursor = str;
+
+    view->str = str;
+    view->count = 0;
+    view->overflow = 0;
+
+    while (str_parms_view_next(&cursor, &key, &value)) {
+        size_t i;
+        for (i = 0; i < view->count; i++) {
+            if (span_eq(&view->pairs[i].key, key.data, key.len))
+                break;
+        }
+        if (i == STR_PARMS_VIEW_MAX_PAIRS) {
+            view->overflow = 1;
+            return;
+        }
+        view->pairs[i].key = key;
+        view->pairs[i].value = value;
+        if (i == view->count)
+            view->count++;
+    }
+}
+
+int str_parms_view_get(const struct str_parms_view *view, const char *key,
+                       struct str_parms_span *out_val)
+{
+    size_t key_len = strlen(key);
+
+    if (!view->overflow) {
+        for (size_t i = 0; i < view->count; i++) {
+            if (span_eq(&view->pairs[i].key, key, key_len)) {
+                *out_val = view->pairs[i].value;
+                return 0;
+            }
+        }
+        return -ENOENT;
+    }
+
+    struct str_parms_span k, v;
+    const char *cursor = view->str;
+    int ret = -ENOENT;
+    while (str_parms_view_next(&cursor, &k, &v)) {
+        if (span_eq(&k, key, key_len)) {
+            *out_val = v;
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
+int str_parms_view_has_key(const struct str_parms_view *view, const char *key)
+{
+    struct str_parms_span value;
+    return str_parms_view_get(view, key, &value) == 0;
+}
+
+int str_parms_view_get_str(const struct str_parms_view *view, const char *key,
+                           char *val, int len)
+{
+    struct str_parms_span value;
+    if (str_parms_view_get(view, key, &value))
+        return -ENOENT;
+
+    if (len > 0) {
+        size_t n = value.len < (size_t)len - 1 ? value.len : (size_t)len - 1;
+        memcpy(val, value.data, n);
+        val[n] = '\0';
+    }
+    return value.len;
+}
+
+/* The value is followed by ';' or the end of the string, neither of which can
+ * be part of a number, so strtol and strtof stop at its end. */
+int str_parms_view_get_int(const struct str_parms_view *view, const char *key,
+                           int *val)
+{
+    struct str_parms_span value;
+    char *end;
+
+    if (str_parms_view_get(view, key, &value))
+        return -ENOENT;
+
+    *val = (int)strtol(value.data, &end, 0);
+    if (value.len != 0 && end == value.data + value.len)
+        return 0;
+
+    return -EINVAL;
+}
+
+int str_parms_view_get_float(const struct str_parms_view *view, const char *key,
+                             float *val)
+{
+    struct str_parms_span value;
+    float out;
+    char *end;
+
+    if (str_parms_view_get(view, key, &value))
+        return -ENOENT;
+
+    out = strtof(value.data, &end);
+    if (value.len == 0 || end != value.data + value.len)
+        return -EINVAL;
+
+    *val = out;
+    return 0;
+}
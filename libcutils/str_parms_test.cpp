@@ -17,6 +17,8 @@
 #include <cutils/str_parms.h>
 #include <gtest/gtest.h>
 
+#include <string>
+
 static void test_str_parms_str(const char* str, const char* expected) {
     str_parms* str_parms = str_parms_create_str(str);
     str_parms_add_str(str_parms, "dude", "woah");
@@ -55,3 +57,73 @@ TEST(str_parms, put_ENOMEM) {
     ASSERT_EQ(ENOMEM, errno);
     test_str_parms_str("foo=bar;baz=", "foo=bar;baz=");
 }
+
+static void test_str_parms_view(const char* str, const char* key) {
+    str_parms* str_parms = str_parms_create_str(str);
+    str_parms_view view;
+    str_parms_view_init(&view, str);
+
+    char expected[64], actual[64];
+    int expected_ret = str_parms_get_str(str_parms, key, expected, sizeof(expected));
+    ASSERT_EQ(expected_ret, str_parms_view_get_str(&view, key, actual, sizeof(actual)))
+            << str << " " << key;
+    if (expected_ret >= 0) {
+        ASSERT_STREQ(expected, actual) << str << " " << key;
+    }
+    ASSERT_EQ(str_parms_has_key(str_parms, key), str_parms_view_has_key(&view, key));
+
+    int expected_int = 0, actual_int = 0;
+    ASSERT_EQ(str_parms_get_int(str_parms, key, &expected_int),
+              str_parms_view_get_int(&view, key, &actual_int))
+            << str << " " << key;
+    ASSERT_EQ(expected_int, actual_int);
+
+    float expected_float = 0, actual_float = 0;
+    ASSERT_EQ(str_parms_get_float(str_parms, key, &expected_float),
+              str_parms_view_get_float(&view, key, &actual_float))
+            << str << " " << key;
+    ASSERT_EQ(expected_float, actual_float);
+
+    str_parms_destroy(str_parms);
+}
+
+TEST(str_parms, view) {
+    for (const char* key : {"foo", "baz", "fo", "", "=", "routing"}) {
+        test_str_parms_view("", key);
+        test_str_parms_view(";;", key);
+        test_str_parms_view("=bar;", key);
+        test_str_parms_view("foo", key);
+        test_str_parms_view("foo=", key);
+        test_str_parms_view("foo=bar;baz", key);
+        test_str_parms_view("foo=a=b;;baz=bat;", key);
+        test_str_parms_view("foo=bar1;baz=bat;foo=bar2", key);
+        test_str_parms_view("routing=2;foo=0x10;baz=1.5", key);
+        test_str_parms_view("routing=2x;foo=;baz=1.5f", key);
+        test_str_parms_view("a=1;b=2;c=3;d=4;e=5;f=6;g=7;h=8;foo=9;routing=10;foo=11", key);
+    }
+}
+
+TEST(str_parms, view_spans) {
+    const char* str = "foo=bar;;baz;qux=1=2";
+    const char* cursor = str;
+    str_parms_span key, value;
+
+    ASSERT_TRUE(str_parms_view_next(&cursor, &key, &value));
+    EXPECT_EQ(str, key.data);
+    EXPECT_EQ("foo", std::string(key.data, key.len));
+    EXPECT_EQ("bar", std::string(value.data, value.len));
+    ASSERT_TRUE(str_parms_view_next(&cursor, &key, &value));
+    EXPECT_EQ("baz", std::string(key.data, key.len));
+    EXPECT_EQ(0U, value.len);
+    ASSERT_TRUE(str_parms_view_next(&cursor, &key, &value));
+    EXPECT_EQ("qux", std::string(key.data, key.len));
+    EXPECT_EQ("1=2", std::string(value.data, value.len));
+    ASSERT_FALSE(str_parms_view_next(&cursor, &key, &value));
+
+    str_parms_view view;
+    str_parms_view_init(&view, str);
+    EXPECT_EQ(3U, view.count);
+    EXPECT_FALSE(view.overflow);
+    ASSERT_EQ(0, str_parms_view_get(&view, "foo", &value));
+    EXPECT_EQ(str + 4, value.data);
+}
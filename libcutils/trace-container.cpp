@@ -190,6 +190,7 @@ void atrace_begin_body(const char* name)
 
     if (atrace_marker_fd < 0) return;
 
+    if (atrace_write_buffered('B', name)) return;
     WRITE_MSG("B|%d|", "%s", "", name, "");
 }
 
@@ -202,6 +203,7 @@ void atrace_end_body()
 
     if (atrace_marker_fd < 0) return;
 
+    if (atrace_write_buffered('E', nullptr)) return;
     WRITE_MSG("E|%d", "%s", "", "", "");
 }
 
@@ -259,6 +261,7 @@ void atrace_instant_body(const char* name) {
 
     if (atrace_marker_fd < 0) return;
 
+    if (atrace_write_buffered('I', name)) return;
     WRITE_MSG("I|%d|", "%s", "", name, "");
 }
 
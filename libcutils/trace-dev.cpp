@@ -71,11 +71,13 @@ void atrace_setup()
 
 void atrace_begin_body(const char* name)
 {
+    if (atrace_write_buffered('B', name)) return;
     WRITE_MSG("B|%d|", "%s", "", name, "");
 }
 
 void atrace_end_body()
 {
+    if (atrace_write_buffered('E', nullptr)) return;
     WRITE_MSG("E|%d", "%s", "", "", "");
 }
 
@@ -98,6 +100,7 @@ void atrace_async_for_track_end_body(const char* track_name, int32_t cookie) {
 }
 
 void atrace_instant_body(const char* name) {
+    if (atrace_write_buffered('I', name)) return;
     WRITE_MSG("I|%d|", "%s", "", name, "");
 }
 
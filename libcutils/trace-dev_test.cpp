@@ -14,11 +14,16 @@
  * limitations under the License.
  */
 
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
@@ -609,3 +614,193 @@ TEST_F(TraceDevTest, atrace_int64_body_truncated) {
   expected += android::base::StringPrintf("%.*s|17179869183", expected_len, name.c_str());
   ASSERT_STREQ(expected.c_str(), actual.c_str());
 }
+
+class TraceDevBufferedTest : public TraceDevTest {
+ protected:
+  struct Record {
+    uint64_t timestamp_ns;
+    std::string message;
+  };
+
+  void SetUp() override {
+    TraceDevTest::SetUp();
+    // SOCK_SEQPACKET keeps the boundaries between writes.
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, raw_fds_));
+    atrace_marker_raw_fd = raw_fds_[0];
+    atomic_store(&atrace_is_buffered, true);
+  }
+
+  void TearDown() override {
+    atomic_store(&atrace_is_buffered, false);
+    atrace_marker_raw_fd = -1;
+    close(raw_fds_[0]);
+    close(raw_fds_[1]);
+    TraceDevTest::TearDown();
+  }
+
+  // Reads one write made to trace_marker_raw, if there is one, and checks its
+  // header.
+  bool ReadRawWrite(std::vector<Record>* records, pid_t* tid = nullptr) {
+    char buf[ATRACE_BUFFER_SIZE];
+    ssize_t len = recv(raw_fds_[1], buf, sizeof(buf), MSG_DONTWAIT);
+    if (len <= 0) return false;
+
+    uint32_t header[3];
+    EXPECT_LE(sizeof(header), static_cast<size_t>(len));
+    memcpy(header, buf, sizeof(header));
+    EXPECT_EQ(ATRACE_RAW_MARKER_ID, header[0]);
+    EXPECT_EQ(static_cast<uint32_t>(getpid()), header[1]);
+    if (tid != nullptr) *tid = header[2];
+
+    size_t pos = sizeof(header);
+    while (pos + kRecordHeaderSize <= static_cast<size_t>(len)) {
+      Record record;
+      uint16_t length;
+      memcpy(&record.timestamp_ns, buf + pos, sizeof(record.timestamp_ns));
+      memcpy(&length, buf + pos + sizeof(record.timestamp_ns), sizeof(length));
+      pos += kRecordHeaderSize;
+      EXPECT_LE(pos + length, static_cast<size_t>(len));
+      record.message.assign(buf + pos, length);
+      pos += length;
+      records->push_back(record);
+    }
+    EXPECT_EQ(static_cast<size_t>(len), pos);
+    return true;
+  }
+
+  int raw_fds_[2];
+};
+
+TEST_F(TraceDevBufferedTest, events_held_until_flush) {
+  atrace_begin_body("fake_name");
+  atrace_int_body("fake_counter", 12345);
+  atrace_end_body();
+
+  std::vector<Record> records;
+  ASSERT_FALSE(ReadRawWrite(&records));
+  ASSERT_EQ(0, lseek(atrace_marker_fd, 0, SEEK_END));
+
+  atrace_flush();
+  pid_t tid;
+  ASSERT_TRUE(ReadRawWrite(&records, &tid));
+  ASSERT_FALSE(ReadRawWrite(&records));
+  EXPECT_EQ(gettid(), tid);
+
+  ASSERT_EQ(3U, records.size());
+  EXPECT_EQ(android::base::StringPrintf("B|%d|fake_name", getpid()), records[0].message);
+  EXPECT_EQ(android::base::StringPrintf("C|%d|fake_counter|12345", getpid()), records[1].message);
+  EXPECT_EQ(android::base::StringPrintf("E|%d", getpid()), records[2].message);
+  EXPECT_LE(records[0].timestamp_ns, records[1].timestamp_ns);
+  EXPECT_LE(records[1].timestamp_ns, records[2].timestamp_ns);
+}
+
+TEST_F(TraceDevBufferedTest, begin_truncated) {
+  std::string expected = android::base::StringPrintf("B|%d|", getpid());
+  std::string name = MakeName(2 * ATRACE_MESSAGE_LENGTH);
+  atrace_begin_body(name.c_str());
+  atrace_flush();
+
+  std::vector<Record> records;
+  ASSERT_TRUE(ReadRawWrite(&records));
+  ASSERT_EQ(1U, records.size());
+  expected += name.substr(0, ATRACE_MESSAGE_LENGTH - expected.length() - 1);
+  EXPECT_EQ(expected, records[0].message);
+}
+
+TEST_F(TraceDevBufferedTest, flushed_when_full) {
+  std::string name = MakeName(100);
+  for (size_t i = 0; i < 100; i++) {
+    atrace_begin_body(name.c_str());
+  }
+  atrace_flush();
+
+  std::vector<Record> records;
+  size_t writes = 0;
+  while (ReadRawWrite(&records)) {
+    writes++;
+  }
+  EXPECT_LT(1U, writes);
+  EXPECT_EQ(100U, records.size());
+}
+
+TEST_F(TraceDevBufferedTest, flushed_on_thread_exit) {
+  pid_t thread_tid = 0;
+  std::thread thread([&thread_tid]() {
+    thread_tid = gettid();
+    atrace_instant_body("fake_name");
+  });
+  thread.join();
+
+  std::vector<Record> records;
+  pid_t tid;
+  ASSERT_TRUE(ReadRawWrite(&records, &tid));
+  EXPECT_EQ(thread_tid, tid);
+  ASSERT_EQ(1U, records.size());
+  EXPECT_EQ(android::base::StringPrintf("I|%d|fake_name", getpid()), records[0].message);
+}
+
+TEST_F(TraceDevBufferedTest, flushed_when_disabled) {
+  atrace_begin_body("fake_name");
+  atomic_store(&atrace_is_buffered, false);
+  atrace_int_body("fake_counter", 1);
+
+  std::vector<Record> records;
+  ASSERT_TRUE(ReadRawWrite(&records));
+  ASSERT_EQ(1U, records.size());
+
+  ASSERT_EQ(0, lseek(atrace_marker_fd, 0, SEEK_SET));
+  std::string actual;
+  ASSERT_TRUE(android::base::ReadFdToString(atrace_marker_fd, &actual));
+  EXPECT_EQ(android::base::StringPrintf("C|%d|fake_counter|1", getpid()), actual);
+}
+
+TEST_F(TraceDevBufferedTest, flushed_at_tracing_boundary) {
+  if (property_get_bool("debug.atrace.buffered", false)) {
+    GTEST_SKIP() << "debug.atrace.buffered is set";
+  }
+
+  std::mutex lock;
+  std::condition_variable cv;
+  bool traced = false, done = false;
+  pid_t thread_tid = 0;
+  std::thread thread([&]() {
+    atrace_begin_body("fake_name");
+    std::unique_lock<std::mutex> guard(lock);
+    thread_tid = gettid();
+    traced = true;
+    cv.notify_all();
+    cv.wait(guard, [&done]() { return done; });
+  });
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    cv.wait(guard, [&traced]() { return traced; });
+  }
+
+  // Buffering goes off with the property unset, which flushes every thread,
+  // including ones that are not tracing anything right now.
+  atrace_update_tags();
+  ASSERT_FALSE(atomic_load(&atrace_is_buffered));
+  std::vector<Record> records;
+  pid_t tid;
+  bool flushed = ReadRawWrite(&records, &tid);
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    done = true;
+    cv.notify_all();
+  }
+  thread.join();
+
+  ASSERT_TRUE(flushed);
+  EXPECT_EQ(thread_tid, tid);
+  ASSERT_EQ(1U, records.size());
+  EXPECT_EQ(android::base::StringPrintf("B|%d|fake_name", getpid()), records[0].message);
+}
+
+TEST_F(TraceDevTest, marker_raw_opened_only_when_buffered) {
+  if (property_get_bool("debug.atrace.buffered", false)) {
+    GTEST_SKIP() << "debug.atrace.buffered is set";
+  }
+  atrace_update_tags();
+  EXPECT_EQ(-1, atrace_marker_raw_fd);
+}
@@ -0,0 +1,88 @@
+#! /usr/bin/env python3
+
+# Copyright (C) 2024 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Turns buffered atrace events back into tracing_mark_write lines.
+
+With debug.atrace.buffered set, libcutils writes atrace events to
+trace_marker_raw in batches (see libcutils/trace-dev.inc for the layout).
+ftrace prints each batch as a raw_data line:
+
+  <task>-<tid> [<cpu>] <flags> <timestamp>: # 43525441 buf: xx xx ...
+
+This rewrites a text trace, as read from /sys/kernel/tracing/trace or
+saved by atrace, so that each buffered event becomes the tracing_mark_write
+line it would have been without buffering, at the timestamp libcutils
+recorded for it. Trace viewers then read it like any other trace. Event
+lines are sorted by timestamp, since buffered events reach the trace late.
+"""
+
+import re
+import struct
+import sys
+
+ATRACE_RAW_MARKER_ID = 0x43525441
+
+RAW_DATA_LINE = re.compile(
+    r"^\s*(?:.+)-(?:\d+)\s+(?:\(\s*[\d-]+\)\s+)?\[(?P<cpu>\d+)\]\s+"
+    r"(?:(?P<flags>\S+)\s+)?(?P<ts>\d+\.\d+): # (?P<id>[0-9a-f]+) buf:"
+    r"(?P<buf>(?: [0-9a-f]{2})*)\s*$")
+EVENT_LINE = re.compile(r"^\s*.+-\d+\s.*?\s(?P<ts>\d+\.\d+):\s")
+
+
+def decode(buf):
+  """Yields (pid, tid, timestamp_ns, message) for each record in buf."""
+  if len(buf) < 8:
+    return
+  pid, tid = struct.unpack_from("<ii", buf, 0)
+  pos = 8
+  # The ring buffer pads events to 4 bytes, which is less than a record
+  # header.
+  while pos + 10 <= len(buf):
+    timestamp_ns, length = struct.unpack_from("<QH", buf, pos)
+    pos += 10
+    message = buf[pos:pos + length].decode("utf-8", "replace")
+    pos += length
+    yield pid, tid, timestamp_ns, message
+
+
+def main():
+  lines = sys.stdin if len(sys.argv) < 2 else open(sys.argv[1], errors="replace")
+  events = []
+  for line in lines:
+    line = line.rstrip("\n")
+    match = RAW_DATA_LINE.match(line)
+    if match and int(match.group("id"), 16) == ATRACE_RAW_MARKER_ID:
+      buf = bytes.fromhex(match.group("buf"))
+      flags = match.group("flags") or ""
+      for pid, tid, timestamp_ns, message in decode(buf):
+        seconds = "%d.%06d" % (timestamp_ns // 1000000000,
+                               timestamp_ns % 1000000000 // 1000)
+        events.append((float(seconds), len(events),
+                       "<...>-%d (%5d) [%s] %s %s: tracing_mark_write: %s" %
+                       (tid, pid, match.group("cpu"), flags, seconds, message)))
+      continue
+    match = EVENT_LINE.match(line)
+    if match and not line.lstrip().startswith("#"):
+      events.append((float(match.group("ts")), len(events), line))
+    else:
+      print(line)
+
+  for _, _, line in sorted(events):
+    print(line)
+
+
+if __name__ == "__main__":
+  main()
@@ -46,6 +46,8 @@ class Modprobe {
     std::string MakeCanonical(const std::string& module_path);
     bool InsmodWithDeps(const std::string& module_name, const std::string& parameters);
     bool Insmod(const std::string& path_name, const std::string& parameters);
+    void Prefetch(const std::string& path_name);
+    void PrefetchModules();
     bool Rmmod(const std::string& module_name);
     std::vector<std::string> GetDependencies(const std::string& module);
     bool ModuleExists(const std::string& module_name);
@@ -64,6 +66,9 @@ class Modprobe {
     void ParseCfg(const std::string& cfg, std::function<bool(const std::vector<std::string>&)> f);
 
     std::vector<std::pair<std::string, std::string>> module_aliases_;
+    // Indices into module_aliases_, keyed by the literal prefix of the alias.
+    std::unordered_map<std::string, std::vector<size_t>> module_alias_prefixes_;
+    std::set<size_t> module_alias_prefix_lengths_;
     std::unordered_map<std::string, std::vector<std::string>> module_deps_;
     std::vector<std::pair<std::string, std::string>> module_pre_softdep_;
     std::vector<std::pair<std::string, std::string>> module_post_softdep_;
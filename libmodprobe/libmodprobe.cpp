@@ -21,9 +21,11 @@
 #include <sys/syscall.h>
 
 #include <algorithm>
+#include <condition_variable>
 #include <map>
 #include <set>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
@@ -108,6 +110,12 @@ bool Modprobe::ParseAliasCallback(const std::vector<std::string>& args) {
     const std::string& module_name = *it++;
     this->module_aliases_.emplace_back(alias, module_name);
 
+    // Index the alias by its literal prefix, so that lookups only fnmatch() the aliases
+    // that can possibly match.
+    auto prefix = alias.substr(0, alias.find_first_of("*?[\\"));
+    this->module_alias_prefix_lengths_.emplace(prefix.size());
+    this->module_alias_prefixes_[prefix].emplace_back(this->module_aliases_.size() - 1);
+
     return true;
 }
 
@@ -229,13 +237,31 @@ void Modprobe::ParseCfg(const std::string& cfg,
         return;
     }
 
-    std::vector<std::string> lines = android::base::Split(cfg_contents, "\n");
-    for (const std::string line : lines) {
+    // Splits in place rather than through a vector of lines; modules.alias and modules.dep have
+    // thousands of them. |args| is reused so its strings keep their buffers between lines.
+    std::vector<std::string> args;
+    std::string_view contents(cfg_contents);
+    while (!contents.empty()) {
+        auto eol = contents.find('\n');
+        auto line = contents.substr(0, eol);
+        contents.remove_prefix(eol == std::string_view::npos ? contents.size() : eol + 1);
         if (line.empty() || line[0] == '#') {
             continue;
         }
-        const std::vector<std::string> args = android::base::Split(line, " ");
-        if (args.empty()) continue;
+
+        size_t num_args = 0;
+        for (size_t pos = 0;; num_args++) {
+            auto end = line.find(' ', pos);
+            auto arg = line.substr(pos, end == std::string_view::npos ? end : end - pos);
+            if (num_args < args.size()) {
+                args[num_args].assign(arg);
+            } else {
+                args.emplace_back(arg);
+            }
+            if (end == std::string_view::npos) break;
+            pos = end + 1;
+        }
+        args.resize(num_args + 1);
         f(args);
     }
     return;
@@ -407,11 +433,17 @@ bool Modprobe::LoadWithAliases(const std::string& module_name, bool strict,
 
     // use aliases to expand list of modules to load (multiple modules
     // may alias themselves to the requested name)
-    for (const auto& [alias, aliased_module] : module_aliases_) {
-        if (fnmatch(alias.c_str(), module_name.c_str(), 0) != 0) continue;
-        LOG(VERBOSE) << "Found alias for '" << module_name << "': '" << aliased_module;
-        if (module_loaded_.count(MakeCanonical(aliased_module))) continue;
-        modules_to_load.emplace(aliased_module);
+    for (auto length : module_alias_prefix_lengths_) {
+        if (length > module_name.size()) break;
+        auto candidates = module_alias_prefixes_.find(module_name.substr(0, length));
+        if (candidates == module_alias_prefixes_.end()) continue;
+        for (auto index : candidates->second) {
+            const auto& [alias, aliased_module] = module_aliases_[index];
+            if (fnmatch(alias.c_str(), module_name.c_str(), 0) != 0) continue;
+            LOG(VERBOSE) << "Found alias for '" << module_name << "': '" << aliased_module;
+            if (module_loaded_.count(MakeCanonical(aliased_module))) continue;
+            modules_to_load.emplace(aliased_module);
+        }
     }
 
     // attempt to load all modules aliased to this name
@@ -427,6 +459,20 @@ bool Modprobe::LoadWithAliases(const std::string& module_name, bool strict,
     return true;
 }
 
+// Starts reading every listed module and its dependencies into the page cache, so
+// that insertion doesn't wait on storage one module at a time.
+void Modprobe::PrefetchModules() {
+    std::set<std::string> paths;
+    for (const auto& module : module_load_) {
+        for (const auto& path : GetDependencies(MakeCanonical(module))) {
+            paths.emplace(path);
+        }
+    }
+    for (const auto& path : paths) {
+        Prefetch(path);
+    }
+}
+
 bool Modprobe::IsBlocklisted(const std::string& module_name) {
     if (!blocklist_enabled) return false;
 
@@ -439,14 +485,15 @@ bool Modprobe::IsBlocklisted(const std::string& module_name) {
     return module_blocklist_.count(canonical_name) > 0;
 }
 
-// Another option to load kernel modules. load in independent modules in parallel
-// and then update dependency list of other remaining modules, repeat these steps
-// until all modules are loaded.
+// Another option to load kernel modules. Each module is loaded as soon as all of
+// its dependencies are, by whichever thread is free, so that one slow module only
+// holds back the modules that depend on it.
 bool Modprobe::LoadModulesParallel(int num_threads) {
     bool ret = true;
-    int count = -1;
     std::map<std::string, std::set<std::string>> mod_with_deps;
 
+    PrefetchModules();
+
     // Get dependencies
     for (const auto& module : module_load_) {
         auto dependencies = GetDependencies(MakeCanonical(module));
@@ -472,64 +519,93 @@ bool Modprobe::LoadModulesParallel(int num_threads) {
         }
     }
 
-    while (!mod_with_deps.empty() &&  count != module_loaded_.size()) {
-        std::vector<std::thread> threads;
-        std::vector<std::string> mods_path_to_load;
-        std::mutex vector_lock;
-        count = module_loaded_.size();
-
-        // Find independent modules
-        for (const auto& [it_mod, it_dep] : mod_with_deps) {
-            if (it_dep.size() == 1) {
-                if (module_options_[it_mod].find("load_sequential=1") != std::string::npos) {
-                    if (!LoadWithAliases(it_mod, true) && !IsBlocklisted(it_mod)) {
-                      return false;
-                    }
-                } else {
-                    mods_path_to_load.emplace_back(it_mod);
-                }
+    std::mutex lock;
+    std::condition_variable cv;
+    // Modules whose dependencies are all loaded. Those with load_sequential=1 are only
+    // loaded while nothing else is.
+    std::vector<std::string> ready;
+    std::vector<std::string> ready_sequential;
+    int running = 0;
+    bool sequential_running = false;
+
+    // Moves modules whose dependencies have all been loaded, directly or as a
+    // dependency of another module, from mod_with_deps to the ready lists.
+    auto update_ready = [&] {
+        std::lock_guard guard(module_loaded_lock_);
+        for (auto it = mod_with_deps.begin(); it != mod_with_deps.end();) {
+            auto& [mod, deps] = *it;
+            if (module_loaded_.count(mod)) {
+                it = mod_with_deps.erase(it);
+                continue;
+            }
+            for (auto dep = deps.begin(); dep != deps.end();) {
+                dep = module_loaded_paths_.count(*dep) ? deps.erase(dep) : std::next(dep);
+            }
+            // The module's own path is always left.
+            if (deps.size() != 1) {
+                ++it;
+                continue;
             }
+            auto options = module_options_.find(mod);
+            if (options != module_options_.end() &&
+                options->second.find("load_sequential=1") != std::string::npos) {
+                ready_sequential.emplace_back(mod);
+            } else {
+                ready.emplace_back(mod);
+            }
+            it = mod_with_deps.erase(it);
         }
-
-        // Load independent modules in parallel
-        auto thread_function = [&] {
-            std::unique_lock lk(vector_lock);
-            while (!mods_path_to_load.empty()) {
-                auto ret_load = true;
-                auto mod_to_load = std::move(mods_path_to_load.back());
-                mods_path_to_load.pop_back();
-
-                lk.unlock();
-                ret_load &= LoadWithAliases(mod_to_load, true);
-                lk.lock();
-                if (!ret_load && !IsBlocklisted(mod_to_load)) {
-                    ret &= ret_load;
-                }
+    };
+
+    auto thread_function = [&] {
+        std::unique_lock lk(lock);
+        while (true) {
+            cv.wait(lk, [&] {
+                return !ret || running == 0 || (!sequential_running && !ready.empty());
+            });
+            if (!ret) return;
+
+            std::string mod_to_load;
+            bool sequential = false;
+            if (running == 0 && !ready_sequential.empty()) {
+                mod_to_load = std::move(ready_sequential.back());
+                ready_sequential.pop_back();
+                sequential = sequential_running = true;
+            } else if (!sequential_running && !ready.empty()) {
+                mod_to_load = std::move(ready.back());
+                ready.pop_back();
+            } else {
+                // Nothing is loading, so nothing else can become ready. Any modules left
+                // in mod_with_deps have dependencies that will never be loaded.
+                cv.notify_all();
+                return;
             }
-        };
 
-        std::generate_n(std::back_inserter(threads), num_threads,
-                        [&] { return std::thread(thread_function); });
-
-        // Wait for the threads.
-        for (auto& thread : threads) {
-            thread.join();
+            running++;
+            lk.unlock();
+            bool ret_load = LoadWithAliases(mod_to_load, true) || IsBlocklisted(mod_to_load);
+            lk.lock();
+            running--;
+            if (sequential) sequential_running = false;
+
+            if (ret_load) {
+                update_ready();
+            } else {
+                ret = false;
+            }
+            cv.notify_all();
         }
+    };
 
-        if (!ret) return ret;
+    update_ready();
 
-        std::lock_guard guard(module_loaded_lock_);
-        // Remove loaded module form mod_with_deps and soft dependencies of other modules
-        for (const auto& module_loaded : module_loaded_) {
-            mod_with_deps.erase(module_loaded);
-        }
+    std::vector<std::thread> threads;
+    std::generate_n(std::back_inserter(threads), num_threads,
+                    [&] { return std::thread(thread_function); });
 
-        // Remove loaded module form dependencies of other modules which are not loaded yet
-        for (const auto& module_loaded_path : module_loaded_paths_) {
-            for (auto& [mod, deps] : mod_with_deps) {
-                deps.erase(module_loaded_path);
-            }
-        }
+    // Wait for the threads.
+    for (auto& thread : threads) {
+        thread.join();
     }
 
     return ret;
@@ -537,6 +613,7 @@ bool Modprobe::LoadModulesParallel(int num_threads) {
 
 bool Modprobe::LoadListedModules(bool strict) {
     auto ret = true;
+    PrefetchModules();
     for (const auto& module : module_load_) {
         if (!LoadWithAliases(module, true)) {
             if (IsBlocklisted(module)) continue;
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include <modprobe/modprobe.h>
+
+using android::base::StringPrintf;
+
+// MODALIAS values seen during a coldboot.
+static const std::vector<std::string> kModaliases = {
+        "pci:v00008086d00009D71sv00001028sd000007A0bc04sc03i00",
+        "pci:v00008086d00009D2Fsv00001028sd000007A0bc0Csc03i30",
+        "pci:v000010ECd0000525Asv00001028sd000007A0bcFFsc00i00",
+        "pci:v00001AF4d00001041sv00001AF4sd00001100bc02sc00i00",
+        "usb:v1D6Bp0002d0510dc09dsc00dp01ic09isc00ip00in00",
+        "usb:v18D1p4EE7d0440dc00dsc00dp00icFFisc42ip01in00",
+        "of:NdwcN(null)T(null)Csnps,dwc3",
+        "of:NufsT(null)Cqcom,ufshc",
+        "platform:alarmtimer",
+        "platform:reg-dummy",
+        "acpi:PNP0C0A:",
+        "acpi:INT33D5:",
+        "virtio:d00000001v00001AF4",
+        "input:b0019v0000p0001e0000-e0,1,k74,ramlsfw",
+        "serio:ty06pr00id00ex00",
+        "hid:b0003g0001v000046Dp0000C52B",
+};
+
+// A modules.alias in the style of depmod: each module's aliases, most with wildcards.
+static std::string MakeModulesAlias() {
+    std::string content;
+    for (int i = 0; i < 1000; i++) {
+        content += StringPrintf("alias pci:v%08Xd%08Xsv*sd*bc*sc*i* pci_mod%d\n", 0x1000 + i % 64,
+                                i, i);
+        content += StringPrintf("alias usb:v%04Xp%04Xd*dc*dsc*dp*ic*isc*ip*in* usb_mod%d\n",
+                                0x1000 + i % 32, i, i);
+        content += StringPrintf("alias of:N*T*Cvendor%d,device%d of_mod%d\n", i % 50, i, i);
+        content += StringPrintf("alias platform:device%d platform_mod%d\n", i, i);
+    }
+    content += "alias pci:v00008086d00009D71sv*sd*bc*sc*i* snd_hda_intel\n";
+    content += "alias pci:v*d*sv*sd*bc0Csc03i30* xhci_pci\n";
+    content += "alias usb:v*p*d*dc*dsc*dp*ic09isc*ip*in* usbcore\n";
+    content += "alias virtio:d00000001v* virtio_net\n";
+    content += "alias acpi*:PNP0C0A:* battery\n";
+    content += "alias hid:b0003g*v0000046Dp0000C52B logitech_dj\n";
+    return content;
+}
+
+static void BM_LoadWithAliases(benchmark::State& state) {
+    TemporaryDir dir;
+    android::base::WriteStringToFile(MakeModulesAlias(), std::string(dir.path) + "/modules.alias");
+    Modprobe m({dir.path});
+    for (auto _ : state) {
+        // None of the aliased modules are in modules.dep, so this only does the matching.
+        for (const auto& modalias : kModaliases) {
+            benchmark::DoNotOptimize(m.LoadWithAliases(modalias, false));
+        }
+    }
+}
+BENCHMARK(BM_LoadWithAliases);
+
+// A modules.dep in the style of depmod, for the modules of MakeModulesAlias().
+static std::string MakeModulesDep() {
+    std::string content;
+    for (int i = 0; i < 4000; i++) {
+        content += StringPrintf("kernel/drivers/mod%d.ko: kernel/drivers/base%d.ko "
+                                "kernel/drivers/core%d.ko\n",
+                                i, i % 100, i % 10);
+    }
+    return content;
+}
+
+static void BM_ParseConfigs(benchmark::State& state) {
+    TemporaryDir dir;
+    android::base::WriteStringToFile(MakeModulesAlias(), std::string(dir.path) + "/modules.alias");
+    android::base::WriteStringToFile(MakeModulesDep(), std::string(dir.path) + "/modules.dep");
+    for (auto _ : state) {
+        Modprobe m({dir.path});
+        benchmark::DoNotOptimize(m);
+    }
+}
+BENCHMARK(BM_ParseConfigs);
+
+BENCHMARK_MAIN();
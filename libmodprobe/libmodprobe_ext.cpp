@@ -14,9 +14,11 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
@@ -50,6 +52,7 @@ bool Modprobe::Insmod(const std::string& path_name, const std::string& parameter
     }
 
     LOG(INFO) << "Loading module " << path_name << " with args '" << options << "'";
+    android::base::Timer t;
     int ret = syscall(__NR_finit_module, fd.get(), options.c_str(), 0);
     if (ret != 0) {
         if (errno == EEXIST) {
@@ -63,7 +66,8 @@ bool Modprobe::Insmod(const std::string& path_name, const std::string& parameter
         return false;
     }
 
-    LOG(INFO) << "Loaded kernel module " << path_name;
+    LOG(INFO) << "Loaded kernel module " << path_name << " (took " << t.duration().count()
+              << "ms)";
     std::lock_guard guard(module_loaded_lock_);
     module_loaded_paths_.emplace(path_name);
     module_loaded_.emplace(canonical_name);
@@ -71,6 +75,16 @@ bool Modprobe::Insmod(const std::string& path_name, const std::string& parameter
     return true;
 }
 
+void Modprobe::Prefetch(const std::string& path_name) {
+    android::base::unique_fd fd(
+            TEMP_FAILURE_RETRY(open(path_name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)));
+    if (fd == -1) {
+        // Insmod() will report it.
+        return;
+    }
+    posix_fadvise(fd.get(), 0, 0, POSIX_FADV_WILLNEED);
+}
+
 bool Modprobe::Rmmod(const std::string& module_name) {
     auto canonical_name = MakeCanonical(module_name);
     int ret = syscall(__NR_delete_module, canonical_name.c_str(), O_NONBLOCK);
@@ -41,6 +41,7 @@ bool Modprobe::Insmod(const std::string& path_name, const std::string& parameter
     if (std::find(test_modules.begin(), test_modules.end(), deps.front()) == test_modules.end()) {
         return false;
     }
+    std::lock_guard guard(module_loaded_lock_);
     for (auto it = modules_loaded.begin(); it != modules_loaded.end(); ++it) {
         if (android::base::StartsWith(*it, path_name)) {
             return true;
@@ -56,11 +57,17 @@ bool Modprobe::Insmod(const std::string& path_name, const std::string& parameter
     }
 
     modules_loaded.emplace_back(path_name + options);
+    module_loaded_paths_.emplace(path_name);
+    module_loaded_.emplace(MakeCanonical(path_name));
     module_count_++;
     return true;
 }
 
+void Modprobe::Prefetch(const std::string&) {}
+
 bool Modprobe::Rmmod(const std::string& module_name) {
+    std::lock_guard guard(module_loaded_lock_);
+    module_loaded_.erase(MakeCanonical(module_name));
     for (auto it = modules_loaded.begin(); it != modules_loaded.end(); it++) {
         if (*it == module_name || android::base::StartsWith(*it, module_name + " ")) {
             modules_loaded.erase(it);
@@ -14,10 +14,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <functional>
 
 #include <android-base/file.h>
 #include <android-base/macros.h>
+#include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
 
@@ -219,3 +221,105 @@ TEST(libmodprobe, ModuleDepLineWithoutColonIsSkipped) {
     Modprobe m({dir.path});
     EXPECT_FALSE(m.LoadWithAliases("no_colon", true));
 }
+
+TEST(libmodprobe, LoadModulesParallel) {
+    const std::string modules_dep =
+            "test1.ko:\n"
+            "test2.ko: test1.ko\n"
+            "test3.ko: test2.ko test1.ko\n"
+            "test4.ko:\n"
+            "test5.ko: test4.ko\n"
+            "test6.ko:\n";
+
+    const std::string modules_softdep = "softdep test3 pre: test4\n";
+
+    const std::string modules_options = "options test5.ko load_sequential=1\n";
+
+    const std::string modules_load =
+            "test3.ko\n"
+            "test5.ko\n"
+            "test2.ko\n"
+            "test1.ko\n"
+            "test4.ko\n"
+            "test6.ko\n";
+
+    TemporaryDir dir;
+    auto dir_path = std::string(dir.path);
+    ASSERT_TRUE(android::base::WriteStringToFile(modules_dep, dir_path + "/modules.dep", 0600,
+                                                 getuid(), getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile(modules_softdep, dir_path + "/modules.softdep",
+                                                 0600, getuid(), getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile(modules_options, dir_path + "/modules.options",
+                                                 0600, getuid(), getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile(modules_load, dir_path + "/modules.load", 0600,
+                                                 getuid(), getgid()));
+
+    kernel_cmdline = "";
+    test_modules.clear();
+    for (int i = 1; i <= 6; i++) {
+        test_modules.emplace_back(dir_path + "/test" + std::to_string(i) + ".ko");
+    }
+    modules_loaded.clear();
+
+    Modprobe m({dir.path}, "modules.load", false);
+    EXPECT_TRUE(m.LoadModulesParallel(4));
+    ASSERT_EQ(modules_loaded.size(), 6u);
+
+    auto position = [&](int module) {
+        auto path = dir_path + "/test" + std::to_string(module) + ".ko";
+        for (size_t i = 0; i < modules_loaded.size(); i++) {
+            if (modules_loaded[i] == path ||
+                android::base::StartsWith(modules_loaded[i], path + " ")) {
+                return i;
+            }
+        }
+        return modules_loaded.size();
+    };
+    EXPECT_LT(position(1), position(2));
+    EXPECT_LT(position(2), position(3));
+    EXPECT_LT(position(4), position(3));
+    EXPECT_LT(position(4), position(5));
+    EXPECT_LT(position(6), modules_loaded.size());
+}
+
+TEST(libmodprobe, WildcardAliases) {
+    const std::string modules_dep =
+            "test1.ko:\n"
+            "test2.ko:\n"
+            "test3.ko:\n"
+            "test4.ko:\n";
+
+    const std::string modules_alias =
+            "alias pci:v00008086d00001234sv*sd*bc*sc*i* test1\n"
+            "alias pci:v00008086d*sv*sd*bc02sc*i* test2\n"
+            "alias *:v00001AF4* test3\n"
+            "alias usb:v18D1p4EE? test4\n";
+
+    TemporaryDir dir;
+    auto dir_path = std::string(dir.path);
+    ASSERT_TRUE(android::base::WriteStringToFile(modules_dep, dir_path + "/modules.dep", 0600,
+                                                 getuid(), getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile(modules_alias, dir_path + "/modules.alias", 0600,
+                                                 getuid(), getgid()));
+
+    kernel_cmdline = "";
+    test_modules.clear();
+    for (int i = 1; i <= 4; i++) {
+        test_modules.emplace_back(dir_path + "/test" + std::to_string(i) + ".ko");
+    }
+
+    auto load = [&](const std::string& modalias) {
+        modules_loaded.clear();
+        Modprobe m({dir.path});
+        m.LoadWithAliases(modalias, false);
+        std::sort(modules_loaded.begin(), modules_loaded.end());
+        return modules_loaded;
+    };
+    EXPECT_EQ(load("pci:v00008086d00001234sv00001028sd00000001bc02sc00i00"),
+              (std::vector<std::string>{dir_path + "/test1.ko", dir_path + "/test2.ko"}));
+    EXPECT_EQ(load("pci:v00008086d00005678sv00001028sd00000001bc03sc00i00"),
+              std::vector<std::string>{});
+    EXPECT_EQ(load("virtio:v00001AF4d00000001"), std::vector<std::string>{dir_path + "/test3.ko"});
+    EXPECT_EQ(load("usb:v18D1p4EE1"), std::vector<std::string>{dir_path + "/test4.ko"});
+    EXPECT_EQ(load("usb:v18D1p4EE"), std::vector<std::string>{});
+}
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -60,8 +61,10 @@ msecs_t get_msecs(void)
     }
 }
 
+/* Keeps errno, so that callers can still report it after logging */
 void printerr(char *fmt, ...)
 {
+    int saved_errno = errno;
     va_list ap;
 
     va_start(ap, fmt);
@@ -69,6 +72,7 @@ void printerr(char *fmt, ...)
     va_end(ap);
 
     ALOGD("%s", errmsg);
+    errno = saved_errno;
 }
 
 const char *dhcp_lasterror()
@@ -107,6 +111,8 @@ struct dhcp_info {
 
     uint32_t serveraddr;
     uint32_t lease;
+
+    uint32_t rapid_commit;
 };
 
 dhcp_info last_good_info;
@@ -220,6 +226,9 @@ int decode_dhcp_msg(dhcp_msg *msg, int len, dhcp_info *info)
         case OPT_MESSAGE_TYPE:
             info->type = *x;
             break;
+        case OPT_RAPID_COMMIT:
+            info->rapid_commit = 1;
+            break;
         default:
             break;
         }
@@ -380,154 +389,299 @@ static int is_valid_reply(dhcp_msg *msg, dhcp_msg *reply, int sz)
 
 #define STATE_SELECTING  1
 #define STATE_REQUESTING 2
+#define STATE_DONE       3
 
 #define TIMEOUT_INITIAL   4000
 #define TIMEOUT_MAX      32000
+/* RFC 2131 4.1: retransmission delays are randomized by -1 to +1 second */
+#define TIMEOUT_JITTER    1000
 
-int dhcp_init_ifc(const char *ifname)
-{
-    dhcp_msg discover_msg;
-    dhcp_msg request_msg;
-    dhcp_msg reply;
-    dhcp_msg *msg;
-    dhcp_info info;
-    int s, r, size;
-    int valid_reply;
-    uint32_t xid;
+typedef struct dhcp_client dhcp_client;
+
+/* State of the lease acquisition on one interface. */
+struct dhcp_client {
+    const char *ifname;
+    int if_index;
+    int sock;
     unsigned char hwaddr[6];
-    struct pollfd pfd;
+    uint32_t xid;
     unsigned int state;
     unsigned int timeout;
-    int if_index;
+    msecs_t deadline;
+    dhcp_msg msg;
+    dhcp_info info;
+    unsigned int seed;
+    int result;
+    int error;
+};
 
-    xid = (uint32_t) get_msecs();
+/* errno after a failure, never 0 so that it cannot read as success */
+static int failure_errno(void)
+{
+    return errno != 0 ? errno : EIO;
+}
 
-    if (ifc_get_hwaddr(ifname, hwaddr)) {
-        return fatal("cannot obtain interface address");
-    }
-    if (ifc_get_ifindex(ifname, &if_index)) {
-        return fatal("cannot obtain interface index");
+/* Reports error as the outcome of each of count interfaces */
+static void fill_results(int results[], int count, int error)
+{
+    int i;
+
+    if (results == NULL) return;
+    for (i = 0; i < count; i++) {
+        results[i] = error;
     }
+}
 
-    s = open_raw_socket(ifname, hwaddr, if_index);
+static void dhcp_finish(dhcp_client *client, int result)
+{
+    client->error = result ? failure_errno() : 0;
+    client->result = result;
+    client->state = STATE_DONE;
+    if (client->sock >= 0) {
+        close(client->sock);
+        client->sock = -1;
+    }
+}
 
-    timeout = TIMEOUT_INITIAL;
-    state = STATE_SELECTING;
-    info.type = 0;
-    goto transmit;
+static void dhcp_transmit(dhcp_client *client)
+{
+    int size = 0;
+    int jitter;
+
+    switch(client->state) {
+    case STATE_SELECTING:
+        size = init_dhcp_discover_msg(&client->msg, client->hwaddr, client->xid);
+        break;
+    case STATE_REQUESTING:
+        size = init_dhcp_request_msg(&client->msg, client->hwaddr, client->xid,
+                                     client->info.ipaddr, client->info.serveraddr);
+        break;
+    default:
+        return;
+    }
+    if (send_message(client->sock, client->if_index, &client->msg, size) < 0) {
+        printerr("error sending dhcp msg on %s: %s\n", client->ifname, strerror(errno));
+    }
 
-    for (;;) {
-        pfd.fd = s;
-        pfd.events = POLLIN;
-        pfd.revents = 0;
-        r = poll(&pfd, 1, timeout);
+    jitter = (int) (rand_r(&client->seed) % (2 * TIMEOUT_JITTER + 1)) - TIMEOUT_JITTER;
+    client->deadline = get_msecs() + client->timeout + jitter;
+}
 
-        if (r == 0) {
+static void dhcp_timeout(dhcp_client *client)
+{
 #if VERBOSE
-            printerr("TIMEOUT\n");
+    printerr("TIMEOUT on %s\n", client->ifname);
 #endif
-            if (timeout >= TIMEOUT_MAX) {
-                printerr("timed out\n");
-                if ( info.type == DHCPOFFER ) {
-                    printerr("no acknowledgement from DHCP server\nconfiguring %s with offered parameters\n", ifname);
-                    return dhcp_configure(ifname, &info);
-                }
-                errno = ETIME;
-                close(s);
-                return -1;
-            }
-            timeout = timeout * 2;
-
-        transmit:
-            size = 0;
-            msg = NULL;
-            switch(state) {
-            case STATE_SELECTING:
-                msg = &discover_msg;
-                size = init_dhcp_discover_msg(msg, hwaddr, xid);
-                break;
-            case STATE_REQUESTING:
-                msg = &request_msg;
-                size = init_dhcp_request_msg(msg, hwaddr, xid, info.ipaddr, info.serveraddr);
-                break;
-            default:
-                r = 0;
-            }
-            if (size != 0) {
-                r = send_message(s, if_index, msg, size);
-                if (r < 0) {
-                    printerr("error sending dhcp msg: %s\n", strerror(errno));
-                }
-            }
-            continue;
-        }
-
-        if (r < 0) {
-            if ((errno == EAGAIN) || (errno == EINTR)) {
-                continue;
-            }
-            return fatal("poll failed");
+    if (client->timeout >= TIMEOUT_MAX) {
+        printerr("timed out\n");
+        if (client->info.type == DHCPOFFER) {
+            printerr("no acknowledgement from DHCP server\nconfiguring %s with offered parameters\n",
+                     client->ifname);
+            dhcp_finish(client, dhcp_configure(client->ifname, &client->info));
+            return;
         }
+        errno = ETIME;
+        dhcp_finish(client, -1);
+        return;
+    }
+    client->timeout = client->timeout * 2;
+    dhcp_transmit(client);
+}
 
-        errno = 0;
-        r = receive_packet(s, &reply);
-        if (r < 0) {
-            if (errno != 0) {
-                ALOGD("receive_packet failed (%d): %s", r, strerror(errno));
-                if (errno == ENETDOWN || errno == ENXIO) {
-                    return -1;
-                }
+static void dhcp_receive(dhcp_client *client)
+{
+    dhcp_msg reply;
+    dhcp_info info;
+    int r;
+
+    errno = 0;
+    r = receive_packet(client->sock, &reply);
+    if (r < 0) {
+        if (errno != 0) {
+            ALOGD("receive_packet failed (%d): %s", r, strerror(errno));
+            if (errno == ENETDOWN || errno == ENXIO) {
+                dhcp_finish(client, -1);
             }
-            continue;
         }
+        return;
+    }
 
 #if VERBOSE > 1
-        dump_dhcp_msg(&reply, r);
+    dump_dhcp_msg(&reply, r);
 #endif
-        decode_dhcp_msg(&reply, r, &info);
+    decode_dhcp_msg(&reply, r, &info);
+
+    if (!is_valid_reply(&client->msg, &reply, r)) {
+        printerr("invalid reply\n");
+        return;
+    }
 
-        if (state == STATE_SELECTING) {
-            valid_reply = is_valid_reply(&discover_msg, &reply, r);
+    if (verbose) dump_dhcp_info(&info);
+
+    switch(client->state) {
+    case STATE_SELECTING:
+        if (info.type == DHCPOFFER) {
+            client->info = info;
+            client->state = STATE_REQUESTING;
+            client->timeout = TIMEOUT_INITIAL;
+            client->xid++;
+            dhcp_transmit(client);
+        } else if (info.type == DHCPACK && info.rapid_commit) {
+            /* RFC 4039: the server committed the lease in reply to our discover */
+            printerr("configuring %s (rapid commit)\n", client->ifname);
+            dhcp_finish(client, dhcp_configure(client->ifname, &info));
+        }
+        break;
+    case STATE_REQUESTING:
+        if (info.type == DHCPACK) {
+            printerr("configuring %s\n", client->ifname);
+            dhcp_finish(client, dhcp_configure(client->ifname, &info));
+        } else if (info.type == DHCPNAK) {
+            printerr("configuration request denied\n");
+            dhcp_finish(client, -1);
         } else {
-            valid_reply = is_valid_reply(&request_msg, &reply, r);
+            printerr("ignoring %s message in state %d\n",
+                     dhcp_type_to_name(info.type), client->state);
         }
-        if (!valid_reply) {
-            printerr("invalid reply\n");
-            continue;
+        break;
+    }
+}
+
+static int dhcp_start(dhcp_client *client, const char *ifname, int epoll_fd)
+{
+    struct epoll_event ev;
+
+    memset(client, 0, sizeof(*client));
+    client->ifname = ifname;
+    client->sock = -1;
+    client->state = STATE_DONE;
+    client->result = -1;
+
+    if (ifc_get_hwaddr(ifname, client->hwaddr)) {
+        client->error = failure_errno();
+        return fatal("cannot obtain interface address");
+    }
+    if (ifc_get_ifindex(ifname, &client->if_index)) {
+        client->error = failure_errno();
+        return fatal("cannot obtain interface index");
+    }
+
+    client->sock = open_raw_socket(ifname, client->hwaddr, client->if_index);
+    if (client->sock < 0) {
+        client->error = failure_errno();
+        return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = client;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->sock, &ev)) {
+        client->error = failure_errno();
+        close(client->sock);
+        client->sock = -1;
+        return fatal("epoll_ctl failed");
+    }
+
+    /* Keep transaction ids distinct across interfaces started in the same millisecond. */
+    client->xid = (uint32_t) get_msecs() + (uint32_t) client->if_index * 0x10000;
+    client->seed = client->xid;
+    client->state = STATE_SELECTING;
+    client->timeout = TIMEOUT_INITIAL;
+    dhcp_transmit(client);
+    return 0;
+}
+
+/*
+ * Acquire a lease on each of the given interfaces at once, with one event loop driving the
+ * discover/offer/request/ack exchange of all of them. results, if not NULL, receives the
+ * outcome for each interface: 0 once it is configured, or the errno it failed with, which is
+ * never 0 (EIO if the failure did not set errno).
+ * Returns 0 if every interface was configured, -1 otherwise.
+ */
+int dhcp_init_ifcs(const char *ifnames[], int results[], int count)
+{
+    dhcp_client *clients;
+    struct epoll_event events[8];
+    int epoll_fd;
+    int active = 0;
+    int failed = 0;
+    int i, n;
+
+    clients = calloc(count, sizeof(dhcp_client));
+    if (clients == NULL) {
+        fill_results(results, count, failure_errno());
+        return fatal("cannot allocate dhcp clients");
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        fill_results(results, count, failure_errno());
+        free(clients);
+        return fatal("epoll_create1 failed");
+    }
+
+    for (i = 0; i < count; i++) {
+        if (dhcp_start(&clients[i], ifnames[i], epoll_fd) == 0) {
+            active++;
         }
+    }
+
+    while (active > 0) {
+        msecs_t now = get_msecs();
+        msecs_t next = 0;
+        int wait;
 
-        if (verbose) dump_dhcp_info(&info);
+        for (i = 0; i < count; i++) {
+            if (clients[i].state == STATE_DONE) continue;
+            if (next == 0 || clients[i].deadline < next) next = clients[i].deadline;
+        }
+        wait = next > now ? (int) (next - now) : 0;
 
-        switch(state) {
-        case STATE_SELECTING:
-            if (info.type == DHCPOFFER) {
-                state = STATE_REQUESTING;
-                timeout = TIMEOUT_INITIAL;
-                xid++;
-                goto transmit;
+        n = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), wait);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EINTR)) {
+                continue;
             }
-            break;
-        case STATE_REQUESTING:
-            if (info.type == DHCPACK) {
-                printerr("configuring %s\n", ifname);
-                close(s);
-                return dhcp_configure(ifname, &info);
-            } else if (info.type == DHCPNAK) {
-                printerr("configuration request denied\n");
-                close(s);
-                return -1;
-            } else {
-                printerr("ignoring %s message in state %d\n",
-                         dhcp_type_to_name(info.type), state);
+            fatal("epoll_wait failed");
+            for (i = 0; i < count; i++) {
+                if (clients[i].state != STATE_DONE) dhcp_finish(&clients[i], -1);
             }
             break;
         }
+
+        for (i = 0; i < n; i++) {
+            dhcp_client *client = events[i].data.ptr;
+            if (client->state != STATE_DONE) dhcp_receive(client);
+        }
+
+        now = get_msecs();
+        active = 0;
+        for (i = 0; i < count; i++) {
+            if (clients[i].state == STATE_DONE) continue;
+            if (clients[i].deadline <= now) dhcp_timeout(&clients[i]);
+            if (clients[i].state != STATE_DONE) active++;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (clients[i].result) failed++;
+        if (results != NULL) results[i] = clients[i].result ? clients[i].error : 0;
+    }
+    close(epoll_fd);
+    free(clients);
+    return failed ? -1 : 0;
+}
+
+int dhcp_init_ifc(const char *ifname)
+{
+    int error;
+
+    if (dhcp_init_ifcs(&ifname, &error, 1)) {
+        errno = error;
+        return -1;
     }
-    close(s);
     return 0;
 }
 
-int do_dhcp(char *iname)
+static int dhcp_prepare_ifc(char *iname)
 {
     if (ifc_set_addr(iname, 0)) {
         printerr("failed to set ip addr for %s to 0.0.0.0: %s\n", iname, strerror(errno));
@@ -539,5 +693,63 @@ int do_dhcp(char *iname)
         return -1;
     }
 
+    return 0;
+}
+
+int do_dhcp(char *iname)
+{
+    if (dhcp_prepare_ifc(iname)) {
+        return -1;
+    }
+
     return dhcp_init_ifc(iname);
 }
+
+/*
+ * Like do_dhcp(), for several interfaces at once. An interface that cannot be brought up
+ * is reported in results and does not stop the others.
+ */
+int do_dhcp_many(char *inames[], int results[], int count)
+{
+    const char **ready;
+    int *ready_results;
+    int *index;
+    int failed = 0;
+    int n = 0;
+    int i;
+
+    ready = calloc(count, sizeof(*ready));
+    ready_results = calloc(count, sizeof(*ready_results));
+    index = calloc(count, sizeof(*index));
+    if (ready == NULL || ready_results == NULL || index == NULL) {
+        fill_results(results, count, failure_errno());
+        free(ready);
+        free(ready_results);
+        free(index);
+        return fatal("cannot allocate dhcp clients");
+    }
+
+    for (i = 0; i < count; i++) {
+        if (dhcp_prepare_ifc(inames[i])) {
+            if (results != NULL) results[i] = failure_errno();
+            failed++;
+            continue;
+        }
+        index[n] = i;
+        ready[n++] = inames[i];
+    }
+
+    if (n > 0 && dhcp_init_ifcs(ready, ready_results, n)) {
+        failed++;
+    }
+    if (results != NULL) {
+        for (i = 0; i < n; i++) {
+            results[index[i]] = ready_results[i];
+        }
+    }
+
+    free(ready);
+    free(ready_results);
+    free(index);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+#include <netutils/ifc.h>
+
+extern "C" int dhcp_init_ifc(const char* ifname);
+extern "C" int dhcp_init_ifcs(const char* ifnames[], int results[], int count);
+extern "C" int do_dhcp_many(char* inames[], int results[], int count);
+
+class DhcpClientTest : public ::testing::Test {
+  protected:
+    void SetUp() override { ASSERT_EQ(0, ifc_init()) << strerror(errno); }
+    void TearDown() override { ifc_close(); }
+};
+
+// Interfaces that fail before any DHCP traffic is sent, so the tests don't wait on timeouts.
+static char kMissing0[] = "dhcptest_none0";
+static char kMissing1[] = "dhcptest_none1";
+
+TEST_F(DhcpClientTest, InitIfcsReportsEachFailedInterface) {
+    const char* names[] = {kMissing0, kMissing1};
+    int results[] = {0, 0};
+    ASSERT_EQ(-1, dhcp_init_ifcs(names, results, 2));
+    EXPECT_NE(0, results[0]);
+    EXPECT_NE(0, results[1]);
+}
+
+TEST_F(DhcpClientTest, InitIfcSetsErrno) {
+    errno = 0;
+    ASSERT_EQ(-1, dhcp_init_ifc(kMissing0));
+    EXPECT_NE(0, errno);
+}
+
+TEST_F(DhcpClientTest, DoDhcpManyReportsInterfacesThatCannotBeBroughtUp) {
+    char* names[] = {kMissing0, kMissing1};
+    int results[] = {0, 0};
+    ASSERT_EQ(-1, do_dhcp_many(names, results, 2));
+    EXPECT_NE(0, results[0]);
+    EXPECT_NE(0, results[1]);
+}
+
+TEST_F(DhcpClientTest, NullResults) {
+    char* names[] = {kMissing0};
+    ASSERT_EQ(-1, do_dhcp_many(names, nullptr, 1));
+}
@@ -65,6 +65,9 @@ int init_dhcp_discover_msg(dhcp_msg *msg, void *hwaddr, uint32_t xid)
     *x++ = OPT_DNS;
     *x++ = OPT_BROADCAST_ADDR;
 
+    *x++ = OPT_RAPID_COMMIT;
+    *x++ = 0;
+
     *x++ = OPT_END;
 
     return DHCP_MSG_FIXED_SIZE + (x - msg->options);
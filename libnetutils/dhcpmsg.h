@@ -86,6 +86,7 @@ struct dhcp_msg
 #define OPT_MESSAGE          56    /* n <errorstring> */
 #define OPT_CLASS_ID         60    /* n <opaque> */
 #define OPT_CLIENT_ID        61    /* n <opaque> */
+#define OPT_RAPID_COMMIT     80    /* 0 - see RFC 4039 */
 #define OPT_END              255
 
 /* DHCP message types */
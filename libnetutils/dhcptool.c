@@ -19,26 +19,35 @@
 #include <error.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <netutils/ifc.h>
 
-extern int do_dhcp(char*);
+extern int do_dhcp_many(char* inames[], int results[], int count);
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        error(EXIT_FAILURE, 0, "usage: %s INTERFACE", argv[0]);
+    if (argc < 2) {
+        error(EXIT_FAILURE, 0, "usage: %s INTERFACE...", argv[0]);
     }
 
-    char* interface = argv[1];
+    char** interfaces = argv + 1;
+    int count = argc - 1;
     if (ifc_init()) {
-        err(errno, "dhcptool %s: ifc_init failed", interface);
+        err(errno, "dhcptool %s: ifc_init failed", interfaces[0]);
         ifc_close();
         return EXIT_FAILURE;
     }
 
-    int rc = do_dhcp(interface);
+    int results[count];
+    memset(results, 0, sizeof(results));
+    int rc = do_dhcp_many(interfaces, results, count);
     if (rc) {
-        err(errno, "dhcptool %s: do_dhcp failed", interface);
+        for (int i = 0; i < count; i++) {
+            if (results[i]) {
+                errno = results[i];
+                warn("dhcptool %s: do_dhcp failed", interfaces[i]);
+            }
+        }
     }
     warn("IP assignment is for debug purposes ONLY");
     ifc_close();
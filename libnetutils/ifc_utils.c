@@ -693,7 +693,8 @@ ifc_configure(const char *ifname,
         in_addr_t dns1,
         in_addr_t dns2) {
 
-    char dns_prop_name[PROPERTY_KEY_MAX];
+    char dns_prop_names[2][PROPERTY_KEY_MAX];
+    char dns_values[2][INET_ADDRSTRLEN];
 
     ifc_init();
 
@@ -720,10 +721,13 @@ ifc_configure(const char *ifname,
 
     ifc_close();
 
-    snprintf(dns_prop_name, sizeof(dns_prop_name), "net.%s.dns1", ifname);
-    property_set(dns_prop_name, dns1 ? ipaddr_to_string(dns1) : "");
-    snprintf(dns_prop_name, sizeof(dns_prop_name), "net.%s.dns2", ifname);
-    property_set(dns_prop_name, dns2 ? ipaddr_to_string(dns2) : "");
+    snprintf(dns_prop_names[0], sizeof(dns_prop_names[0]), "net.%s.dns1", ifname);
+    snprintf(dns_prop_names[1], sizeof(dns_prop_names[1]), "net.%s.dns2", ifname);
+    strlcpy(dns_values[0], dns1 ? ipaddr_to_string(dns1) : "", sizeof(dns_values[0]));
+    strlcpy(dns_values[1], dns2 ? ipaddr_to_string(dns2) : "", sizeof(dns_values[1]));
+    const char *keys[] = {dns_prop_names[0], dns_prop_names[1]};
+    const char *values[] = {dns_values[0], dns_values[1]};
+    property_set_batch(2, keys, values, NULL);
 
     return 0;
 }
@@ -75,6 +75,22 @@ bool packagelist_parse(bool (*callback)(pkg_info* info, void* user_data), void*
 bool packagelist_parse_file(const char* path, bool (*callback)(pkg_info* info, void* user_data),
                             void* user_data);
 
+/**
+ * Looks up the package `name` in the system's default package list.
+ * Returns a `pkg_info*` owned by the caller, who should call packagelist_free(),
+ * or returns NULL and sets `errno`: 0 if there is no such package, otherwise
+ * the error that kept the list from being read (ENOENT if it doesn't exist).
+ */
+pkg_info* packagelist_lookup(const char* name);
+
+/**
+ * Looks up the package `name` in the given package list.
+ * Only the line for `name` is parsed, so unlike packagelist_parse_file(),
+ * malformed lines for other packages are not reported.
+ * Returns NULL and sets `errno` as packagelist_lookup() does.
+ */
+pkg_info* packagelist_lookup_file(const char* path, const char* name);
+
 /** Frees the given `pkg_info`. */
 void packagelist_free(pkg_info* info);
 
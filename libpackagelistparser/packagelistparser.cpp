@@ -19,12 +19,17 @@
 #include <packagelistparser/packagelistparser.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <memory>
+#include <string>
 
 #include <log/log.h>
 
@@ -129,6 +134,81 @@ bool packagelist_parse(bool (*callback)(pkg_info*, void*), void* user_data) {
   return packagelist_parse_file("/data/system/packages.list", callback, user_data);
 }
 
+pkg_info* packagelist_lookup_file(const char* path, const char* name) {
+  int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+  if (fd == -1) {
+    int saved_errno = errno;
+    ALOGE("couldn't open '%s': %s", path, strerror(saved_errno));
+    errno = saved_errno;
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    int saved_errno = errno;
+    ALOGE("couldn't stat '%s': %s", path, strerror(saved_errno));
+    close(fd);
+    errno = saved_errno;
+    return nullptr;
+  }
+
+  size_t size = st.st_size;
+  void* map = nullptr;
+  if (size > 0) {
+    map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  int saved_errno = errno;
+  close(fd);
+  if (map == MAP_FAILED) {
+    ALOGE("couldn't map '%s': %s", path, strerror(saved_errno));
+    errno = saved_errno;
+    return nullptr;
+  }
+
+  // Only compare the first field of each line, so that none but the
+  // matching line is copied or parsed.
+  const char* data = static_cast<const char*>(map);
+  const char* end = data + size;
+  size_t name_length = strlen(name);
+  size_t line_number = 0;
+  std::string line;
+  for (const char* p = data; p < end;) {
+    ++line_number;
+    const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (!eol) eol = end;
+    if (static_cast<size_t>(eol - p) > name_length && !memcmp(p, name, name_length) &&
+        p[name_length] == ' ') {
+      line.assign(p, eol);
+      break;
+    }
+    p = eol + 1;
+  }
+  if (map) munmap(map, size);
+
+  if (line.empty()) {
+    errno = 0;
+    return nullptr;
+  }
+
+  std::unique_ptr<pkg_info, decltype(&packagelist_free)> info(
+      static_cast<pkg_info*>(calloc(1, sizeof(pkg_info))), &packagelist_free);
+  if (!info) {
+    ALOGE("%s:%zu: couldn't allocate pkg_info", path, line_number);
+    errno = ENOMEM;
+    return nullptr;
+  }
+
+  if (!parse_line(path, line_number, line.c_str(), info.get())) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  return info.release();
+}
+
+pkg_info* packagelist_lookup(const char* name) {
+  return packagelist_lookup_file("/data/system/packages.list", name);
+}
+
 void packagelist_free(pkg_info* info) {
   if (!info) return;
 
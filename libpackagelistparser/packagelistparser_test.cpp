@@ -115,6 +115,47 @@ TEST(packagelistparser, early_exit) {
   for (auto& package : packages) packagelist_free(package);
 }
 
+TEST(packagelistparser, lookup) {
+  TemporaryFile tf;
+  android::base::WriteStringToFile(
+      "com.test.a0 10014 0 /data/user/0/com.test.a0 platform:privapp:targetSdkVersion=19 none\n"
+      "com.test.a 10007 1 /data/user/0/com.test.a platform 1023,3003\n"
+      "com.test.a2 10011 0 /data/user/0/com.test.a2 selabel:blah none 1 123",
+      tf.path);
+
+  std::unique_ptr<pkg_info, decltype(&packagelist_free)> info(
+      packagelist_lookup_file(tf.path, "com.test.a"), &packagelist_free);
+  ASSERT_NE(nullptr, info);
+  ASSERT_STREQ("com.test.a", info->name);
+  ASSERT_EQ(10007U, info->uid);
+  ASSERT_TRUE(info->debuggable);
+  ASSERT_STREQ("/data/user/0/com.test.a", info->data_dir);
+  ASSERT_STREQ("platform", info->seinfo);
+  ASSERT_EQ(2U, info->gids.cnt);
+  ASSERT_EQ(3003U, info->gids.gids[1]);
+
+  // The last line has no trailing newline.
+  info.reset(packagelist_lookup_file(tf.path, "com.test.a2"));
+  ASSERT_NE(nullptr, info);
+  ASSERT_EQ(10011U, info->uid);
+  ASSERT_TRUE(info->profileable_from_shell);
+  ASSERT_EQ(123, info->version_code);
+
+  errno = EINVAL;
+  info.reset(packagelist_lookup_file(tf.path, "com.test"));
+  ASSERT_EQ(nullptr, info);
+  ASSERT_EQ(0, errno);
+}
+
+TEST(packagelistparser, lookup_missing_list) {
+  TemporaryDir td;
+  std::string path = std::string(td.path) + "/packages.list";
+
+  errno = 0;
+  ASSERT_EQ(nullptr, packagelist_lookup_file(path.c_str(), "com.test.a"));
+  ASSERT_EQ(ENOENT, errno);
+}
+
 TEST(packagelistparser, system_package_list) {
   // Check that we can actually read the packages.list installed on the device.
   std::vector<pkg_info*> packages;
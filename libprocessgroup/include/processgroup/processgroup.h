@@ -47,6 +47,10 @@ bool SetProcessProfiles(uid_t uid, pid_t pid, std::initializer_list<std::string_
 bool SetTaskProfiles(int tid, std::span<const std::string_view> profiles,
                      bool use_fd_cache = false);
 bool SetProcessProfiles(uid_t uid, pid_t pid, std::span<const std::string_view> profiles);
+// Applies |profiles| to all of |tids| at once. This is cheaper than calling SetTaskProfiles() for
+// each thread, and thread groups whose threads are all in |tids| are moved as a whole.
+bool SetTaskProfilesBatch(std::span<const int> tids, std::span<const std::string_view> profiles,
+                          bool use_fd_cache = false);
 #endif
 
 __BEGIN_DECLS
@@ -57,6 +61,10 @@ bool SetProcessProfilesCached(uid_t uid, pid_t pid, const std::vector<std::strin
 
 static constexpr const char* CGROUPS_RC_PATH = "/dev/cgroup_info/cgroup.rc";
 
+// Compiles the task profiles JSON files into a binary file next to CGROUPS_RC_PATH, which other
+// processes load instead of parsing the JSON files. Called by init once cgroups are set up.
+bool CompileTaskProfiles();
+
 bool UsePerAppMemcg();
 
 // Drop the fd cache of cgroup path. It is used for when resource caching is enabled and a process
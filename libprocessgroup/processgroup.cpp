@@ -22,13 +22,16 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <map>
 #include <memory>
@@ -49,11 +52,15 @@
 using android::base::GetBoolProperty;
 using android::base::StartsWith;
 using android::base::StringPrintf;
+using android::base::unique_fd;
+using android::base::WriteStringToFd;
 using android::base::WriteStringToFile;
 
 using namespace std::chrono_literals;
 
 #define PROCESSGROUP_CGROUP_PROCS_FILE "/cgroup.procs"
+#define PROCESSGROUP_CGROUP_KILL_FILE "/cgroup.kill"
+#define PROCESSGROUP_CGROUP_EVENTS_FILE "/cgroup.events"
 
 bool CgroupsAvailable() {
     static bool cgroups_available = access("/proc/cgroups", F_OK) == 0;
@@ -147,6 +154,10 @@ static bool isMemoryCgroupSupported() {
     return memcg_supported;
 }
 
+bool CompileTaskProfiles() {
+    return TaskProfiles::Compile();
+}
+
 void DropTaskProfilesResourceCaching() {
     TaskProfiles::GetInstance().DropResourceCaching(ProfileAction::RCT_TASK);
     TaskProfiles::GetInstance().DropResourceCaching(ProfileAction::RCT_PROCESS);
@@ -185,6 +196,11 @@ bool SetTaskProfiles(int tid, std::span<const std::string_view> profiles, bool u
     return TaskProfiles::GetInstance().SetTaskProfiles(tid, profiles, use_fd_cache);
 }
 
+bool SetTaskProfilesBatch(std::span<const int> tids, std::span<const std::string_view> profiles,
+                          bool use_fd_cache) {
+    return TaskProfiles::GetInstance().SetTaskProfilesBatch(tids, profiles, use_fd_cache);
+}
+
 // C wrapper for SetProcessProfiles.
 // No need to have this in the header file because this function is specifically for crosvm. Crosvm
 // which is written in Rust has its own declaration of this foreign function and doesn't rely on the
@@ -449,6 +465,101 @@ static int DoKillProcessGroupOnce(const char* cgroup, uid_t uid, int initialPid,
     return (!fd || feof(fd.get())) ? processes : -1;
 }
 
+// Returns the number of processes listed in the cgroup.procs file of |uid_pid_path|, or -1. If
+// |pids| isn't null, the pids are stored there.
+static int ReadProcesses(const std::string& uid_pid_path, std::vector<pid_t>* pids) {
+    std::string content;
+    if (!android::base::ReadFileToString(uid_pid_path + PROCESSGROUP_CGROUP_PROCS_FILE, &content)) {
+        return -1;
+    }
+    int processes = 0;
+    for (const auto& line : android::base::Split(content, "\n")) {
+        if (line.empty()) continue;
+        processes++;
+        if (pid_t pid = atoi(line.c_str()); pids != nullptr && pid > 0) {
+            pids->emplace_back(pid);
+        }
+    }
+    return processes;
+}
+
+// Kills all processes in a cgroup v2 process group with a single write to cgroup.kill, then waits
+// up to |timeout| for the group to be empty. Returns false if the kernel doesn't support
+// cgroup.kill. Otherwise sets |processes| to the number of processes left in the group, or to -1
+// on error.
+static bool KillProcessGroupWithCgroupKill(const std::string& uid_pid_path,
+                                           std::chrono::milliseconds timeout, int* processes,
+                                           int* max_processes) {
+    unique_fd kill_fd(TEMP_FAILURE_RETRY(
+            open((uid_pid_path + PROCESSGROUP_CGROUP_KILL_FILE).c_str(), O_WRONLY | O_CLOEXEC)));
+    if (kill_fd < 0) {
+        if (errno == ENOENT && access(uid_pid_path.c_str(), F_OK) != 0) {
+            // This happens when process is already dead
+            *processes = 0;
+            return true;
+        }
+        return false;
+    }
+    unique_fd events_fd(TEMP_FAILURE_RETRY(
+            open((uid_pid_path + PROCESSGROUP_CGROUP_EVENTS_FILE).c_str(), O_RDONLY | O_CLOEXEC)));
+    if (events_fd < 0) {
+        return false;
+    }
+
+    // The kernel rate-limits cgroup.events notifications to one per 20ms, so wait for the exit of
+    // the processes through pidfds, which become readable as soon as their process has exited.
+    // cgroup.events still catches processes forked after cgroup.procs was read.
+    std::vector<pid_t> pids;
+    int listed = ReadProcesses(uid_pid_path, &pids);
+    if (max_processes != nullptr) {
+        *max_processes = std::max(listed, 0);
+    }
+    std::vector<struct pollfd> pfds = {{.fd = events_fd, .events = POLLPRI}};
+    std::vector<unique_fd> pidfds;
+    for (pid_t pid : pids) {
+        unique_fd pidfd(syscall(__NR_pidfd_open, pid, 0));
+        if (pidfd >= 0) {
+            pfds.push_back({.fd = pidfd, .events = POLLIN});
+            pidfds.emplace_back(std::move(pidfd));
+        }
+    }
+
+    if (!WriteStringToFd("1", kill_fd)) {
+        PLOG(WARNING) << "Failed to write to " << uid_pid_path << PROCESSGROUP_CGROUP_KILL_FILE;
+        *processes = -1;
+        return true;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+        // Reading cgroup.events also rearms its POLLPRI notification.
+        char buf[256];
+        ssize_t len = TEMP_FAILURE_RETRY(pread(events_fd, buf, sizeof(buf) - 1, 0));
+        if (len < 0) {
+            PLOG(WARNING) << "Failed to read " << uid_pid_path << PROCESSGROUP_CGROUP_EVENTS_FILE;
+            *processes = -1;
+            return true;
+        }
+        buf[len] = '\0';
+        if (strstr(buf, "populated 0") != nullptr) {
+            *processes = 0;
+            return true;
+        }
+
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0 ||
+            TEMP_FAILURE_RETRY(poll(pfds.data(), pfds.size(), remaining.count())) == 0) {
+            // Report at least one leftover process, even if they exited since the last check.
+            *processes = std::max(ReadProcesses(uid_pid_path, nullptr), 1);
+            return true;
+        }
+        pfds.erase(std::remove_if(pfds.begin() + 1, pfds.end(),
+                                  [](const struct pollfd& pfd) { return pfd.revents != 0; }),
+                   pfds.end());
+    }
+}
+
 static int KillProcessGroup(uid_t uid, int initialPid, int signal, int retries,
                             int* max_processes) {
     CHECK_GE(uid, 0);
@@ -468,7 +579,15 @@ static int KillProcessGroup(uid_t uid, int initialPid, int signal, int retries,
 
     int retry = retries;
     int processes;
-    while ((processes = DoKillProcessGroupOnce(cgroup, uid, initialPid, signal)) > 0) {
+    // SIGKILL can be delivered to the whole cgroup at once, without enumerating its processes.
+    // Waiting on cgroup.events also takes as long as the processes need to exit, instead of
+    // 5ms steps.
+    bool killed_with_cgroup_kill =
+            signal == SIGKILL && CgroupsAvailable() &&
+            KillProcessGroupWithCgroupKill(ConvertUidPidToPath(cgroup, uid, initialPid),
+                                           retries * 5ms, &processes, max_processes);
+    while (!killed_with_cgroup_kill &&
+           (processes = DoKillProcessGroupOnce(cgroup, uid, initialPid, signal)) > 0) {
         if (max_processes != nullptr && processes > *max_processes) {
             *max_processes = processes;
         }
@@ -502,9 +621,12 @@ static int KillProcessGroup(uid_t uid, int initialPid, int signal, int retries,
     // Logging anything regarding the number of 'processes' here does not make sense.
 
     if (processes == 0) {
+        ProcessFdCache::GetInstance().DropProcess(initialPid);
+
         if (retries > 0) {
             LOG(INFO) << "Successfully killed process cgroup uid " << uid << " pid " << initialPid
-                      << " in " << static_cast<int>(ms) << "ms";
+                      << " in " << static_cast<int>(ms) << "ms"
+                      << (killed_with_cgroup_kill ? " using cgroup.kill" : "");
         }
 
         if (!CgroupsAvailable()) {
@@ -602,6 +724,9 @@ int createProcessGroup(uid_t uid, int initialPid, bool memControl) {
     CHECK_GE(uid, 0);
     CHECK_GT(initialPid, 0);
 
+    // Anything cached for an earlier process with the same pid refers to a stale process group.
+    ProcessFdCache::GetInstance().DropProcess(initialPid);
+
     if (memControl && !UsePerAppMemcg()) {
         PLOG(ERROR) << "service memory controls are used without per-process memory cgroup support";
         return -EINVAL;
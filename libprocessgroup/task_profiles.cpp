@@ -17,9 +17,14 @@
 //#define LOG_NDEBUG 0
 #define LOG_TAG "libprocessgroup"
 
+#include <dirent.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <task_profiles.h>
+#include <algorithm>
 #include <string>
+#include <unordered_set>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -43,6 +48,7 @@ using android::base::GetUintProperty;
 using android::base::StringPrintf;
 using android::base::StringReplace;
 using android::base::unique_fd;
+using android::base::WriteStringToFd;
 using android::base::WriteStringToFile;
 
 static constexpr const char* TASK_PROFILE_DB_FILE = "/etc/task_profiles.json";
@@ -51,6 +57,8 @@ static constexpr const char* TASK_PROFILE_DB_VENDOR_FILE = "/vendor/etc/task_pro
 static constexpr const char* TEMPLATE_TASK_PROFILE_API_FILE =
         "/etc/task_profiles/task_profiles_%u.json";
 
+static constexpr const char* TASK_PROFILES_RC_FILE = "/dev/cgroup_info/task_profiles.rc";
+
 class FdCacheHelper {
   public:
     enum FdState {
@@ -63,8 +71,6 @@ class FdCacheHelper {
     static void Drop(android::base::unique_fd& fd);
     static void Init(const std::string& path, android::base::unique_fd& fd);
     static bool IsCached(const android::base::unique_fd& fd) { return fd > FDS_INACCESSIBLE; }
-
-  private:
     static bool IsAppDependentPath(const std::string& path);
 };
 
@@ -112,8 +118,80 @@ bool FdCacheHelper::IsAppDependentPath(const std::string& path) {
     return path.find("<uid>", 0) != std::string::npos || path.find("<pid>", 0) != std::string::npos;
 }
 
+ProcessFdCache& ProcessFdCache::GetInstance() {
+    // Deliberately leak this object to avoid a race between destruction on
+    // process exit and concurrent access from another thread.
+    static auto* instance = new ProcessFdCache;
+    return *instance;
+}
+
+bool ProcessFdCache::Write(const void* owner, uid_t uid, pid_t pid,
+                           const std::function<unique_fd()>& open,
+                           const std::function<bool(int fd)>& write) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Key key{owner, uid, pid};
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        entries_.splice(entries_.begin(), entries_, it->second);
+    } else {
+        unique_fd fd = open();
+        if (fd < 0) {
+            return false;
+        }
+        if (entries_.size() >= kMaxEntries) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+        entries_.emplace_front(key, std::move(fd));
+        it = index_.emplace(key, entries_.begin()).first;
+    }
+
+    if (!write(entries_.front().second)) {
+        // The file may belong to a process group that no longer exists, so reopen it next time.
+        entries_.erase(it->second);
+        index_.erase(it);
+        return false;
+    }
+    return true;
+}
+
+void ProcessFdCache::EraseIf(const std::function<bool(const Key&)>& pred) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        if (pred(it->first)) {
+            index_.erase(it->first);
+            it = entries_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ProcessFdCache::DropProcess(pid_t pid) {
+    EraseIf([pid](const Key& key) { return key.pid == pid; });
+}
+
+void ProcessFdCache::DropOwner(const void* owner) {
+    EraseIf([owner](const Key& key) { return key.owner == owner; });
+}
+
+size_t ProcessFdCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
 IProfileAttribute::~IProfileAttribute() = default;
 
+bool ProfileAction::ExecuteForTasks(std::span<const int> tids) const {
+    bool success = true;
+    for (int tid : tids) {
+        if (!ExecuteForTask(tid)) {
+            success = false;
+        }
+    }
+    return success;
+}
+
 const std::string& ProfileAttribute::file_name() const {
     if (controller()->version() == 2 && !file_v2_name_.empty()) return file_v2_name_;
     return file_name_;
@@ -239,7 +317,25 @@ bool SetAttributeAction::WriteValueToFile(const std::string& path) const {
     return true;
 }
 
+SetAttributeAction::~SetAttributeAction() {
+    ProcessFdCache::GetInstance().DropOwner(this);
+}
+
 bool SetAttributeAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
+    // Skip the path lookup while the attribute file of this process is cached. Failures are
+    // retried through the path below, which also takes care of reporting them.
+    if (attribute_->IsPathForProcessStable() &&
+        ProcessFdCache::GetInstance().Write(
+                this, uid, pid,
+                [&] {
+                    std::string path;
+                    if (!attribute_->GetPathForProcess(uid, pid, &path)) return unique_fd();
+                    return unique_fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_WRONLY | O_CLOEXEC)));
+                },
+                [&](int fd) { return WriteStringToFd(value_, fd); })) {
+        return true;
+    }
+
     std::string path;
 
     if (!attribute_->GetPathForProcess(uid, pid, &path)) {
@@ -310,12 +406,16 @@ bool SetAttributeAction::IsValidForTask(int tid) const {
 }
 
 SetCgroupAction::SetCgroupAction(const CgroupController& c, const std::string& p)
-    : controller_(c), path_(p) {
+    : controller_(c), path_(p), app_dependent_(FdCacheHelper::IsAppDependentPath(p)) {
     FdCacheHelper::Init(controller_.GetTasksFilePath(path_), fd_[ProfileAction::RCT_TASK]);
     // uid and pid don't matter because IsAppDependentPath ensures the path doesn't use them
     FdCacheHelper::Init(controller_.GetProcsFilePath(path_, 0, 0), fd_[ProfileAction::RCT_PROCESS]);
 }
 
+SetCgroupAction::~SetCgroupAction() {
+    ProcessFdCache::GetInstance().DropOwner(this);
+}
+
 bool SetCgroupAction::AddTidToCgroup(int tid, int fd, const char* controller_name) {
     if (tid <= 0) {
         return true;
@@ -384,6 +484,20 @@ bool SetCgroupAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
         return result == ProfileAction::SUCCESS;
     }
 
+    // The cgroup.procs file of an app-dependent path is cached per process instead. Failures are
+    // retried through the path below, which also takes care of reporting them.
+    if (app_dependent_ &&
+        ProcessFdCache::GetInstance().Write(
+                this, uid, pid,
+                [&] {
+                    std::string procs_path = controller()->GetProcsFilePath(path_, uid, pid);
+                    return unique_fd(
+                            TEMP_FAILURE_RETRY(open(procs_path.c_str(), O_WRONLY | O_CLOEXEC)));
+                },
+                [&](int fd) { return WriteStringToFd(std::to_string(pid), fd); })) {
+        return true;
+    }
+
     // fd was not cached or cached fd can't be used
     std::string procs_path = controller()->GetProcsFilePath(path_, uid, pid);
     unique_fd tmp_fd(TEMP_FAILURE_RETRY(open(procs_path.c_str(), O_WRONLY | O_CLOEXEC)));
@@ -420,6 +534,100 @@ bool SetCgroupAction::ExecuteForTask(int tid) const {
     return true;
 }
 
+// Lists the threads in the thread group of |tid|.
+static bool GetThreadGroup(int tid, std::vector<int>* threads) {
+    std::unique_ptr<DIR, decltype(&closedir)> dir(
+            opendir(StringPrintf("/proc/%d/task", tid).c_str()), closedir);
+    if (!dir) {
+        return false;
+    }
+    while (struct dirent* de = readdir(dir.get())) {
+        if (int thread = atoi(de->d_name); thread > 0) {
+            threads->push_back(thread);
+        }
+    }
+    return true;
+}
+
+bool SetCgroupAction::ExecuteForTasks(std::span<const int> tids) const {
+    if (tids.size() < 2) {
+        return ProfileAction::ExecuteForTasks(tids);
+    }
+
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    if (fd_[ProfileAction::RCT_TASK] == FdCacheHelper::FDS_INACCESSIBLE) {
+        // no permissions to access the file, ignore
+        return true;
+    }
+    if (app_dependent_) {
+        // application-dependent path can't be used with tid
+        LOG(ERROR) << Name() << ": application profile can't be applied to a thread";
+        return false;
+    }
+
+    // Each file is opened at most once for the whole batch, unless its fd is already cached.
+    unique_fd tmp_fd[ProfileAction::RCT_COUNT];
+    bool tried_open[ProfileAction::RCT_COUNT] = {};
+    auto get_fd = [&](ResourceCacheType cache_type) -> int {
+        if (FdCacheHelper::IsCached(fd_[cache_type])) {
+            return fd_[cache_type];
+        }
+        if (!tried_open[cache_type]) {
+            tried_open[cache_type] = true;
+            std::string path = cache_type == ProfileAction::RCT_TASK
+                                       ? controller()->GetTasksFilePath(path_)
+                                       : controller()->GetProcsFilePath(path_, 0, 0);
+            tmp_fd[cache_type].reset(TEMP_FAILURE_RETRY(open(path.c_str(), O_WRONLY | O_CLOEXEC)));
+            if (tmp_fd[cache_type] < 0) {
+                PLOG(WARNING) << Name() << "::" << __func__ << ": failed to open " << path;
+            }
+        }
+        return tmp_fd[cache_type];
+    };
+    // Writing one thread to cgroup.procs moves its whole thread group, which takes the cgroup
+    // locks once instead of once per thread.
+    const bool move_thread_groups =
+            fd_[ProfileAction::RCT_PROCESS] != FdCacheHelper::FDS_INACCESSIBLE;
+
+    std::unordered_set<int> pending(tids.begin(), tids.end());
+    // Threads whose thread group has been found not to be entirely in |tids|.
+    std::unordered_set<int> partial_groups;
+    bool success = true;
+    for (int tid : tids) {
+        if (!pending.erase(tid)) {
+            // already moved with its thread group
+            continue;
+        }
+
+        std::vector<int> threads;
+        if (move_thread_groups && !partial_groups.count(tid) && GetThreadGroup(tid, &threads)) {
+            if (std::all_of(threads.begin(), threads.end(),
+                            [&](int thread) { return thread == tid || pending.count(thread); })) {
+                if (int fd = get_fd(ProfileAction::RCT_PROCESS); fd >= 0) {
+                    for (int thread : threads) {
+                        pending.erase(thread);
+                    }
+                    if (!AddTidToCgroup(tid, fd, controller()->name())) {
+                        success = false;
+                    }
+                    continue;
+                }
+            } else {
+                partial_groups.insert(threads.begin(), threads.end());
+            }
+        }
+
+        int fd = get_fd(ProfileAction::RCT_TASK);
+        if (fd < 0) {
+            return false;
+        }
+        if (!AddTidToCgroup(tid, fd, controller()->name())) {
+            success = false;
+        }
+    }
+    return success;
+}
+
 void SetCgroupAction::EnableResourceCaching(ResourceCacheType cache_type) {
     std::lock_guard<std::mutex> lock(fd_mutex_);
     // Return early to prevent unnecessary calls to controller_.Get{Tasks|Procs}FilePath() which
@@ -660,6 +868,13 @@ bool ApplyProfileAction::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool ApplyProfileAction::ExecuteForTasks(std::span<const int> tids) const {
+    for (const auto& profile : profiles_) {
+        profile->ExecuteForTasks(tids);
+    }
+    return true;
+}
+
 void ApplyProfileAction::EnableResourceCaching(ResourceCacheType cache_type) {
     for (const auto& profile : profiles_) {
         profile->EnableResourceCaching(cache_type);
@@ -718,6 +933,16 @@ bool TaskProfile::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool TaskProfile::ExecuteForTasks(std::span<const int> tids) const {
+    for (const auto& element : elements_) {
+        if (!element->ExecuteForTasks(tids)) {
+            LOG(VERBOSE) << "Applying profile action " << element->Name() << " failed";
+            return false;
+        }
+    }
+    return true;
+}
+
 bool TaskProfile::ExecuteForUID(uid_t uid) const {
     for (const auto& element : elements_) {
         if (!element->ExecuteForUID(uid)) {
@@ -779,33 +1004,271 @@ TaskProfiles& TaskProfiles::GetInstance() {
     return *instance;
 }
 
+static constexpr uint32_t TASK_PROFILES_RC_MAGIC = 0x43525054;  // "TPRC"
+static constexpr uint32_t TASK_PROFILES_RC_VERSION = 1;
+
+// The compiled file is a header, followed by a stream of 32-bit words describing each file in
+// order, followed by a table of NUL-terminated strings. Strings are referenced by their offset in
+// that table, and every list is preceded by its length.
+struct TaskProfilesRcHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t desc_count;
+    uint32_t word_count;
+    uint32_t strings_size;
+};
+
+namespace {
+
+class RcWriter {
+  public:
+    void Word(uint32_t word) { words_.push_back(word); }
+    void String(const std::string& str) {
+        auto [it, inserted] = string_offsets_.emplace(str, strings_.size());
+        if (inserted) {
+            strings_.append(str).push_back('\0');
+        }
+        Word(it->second);
+    }
+
+    std::string Finish(uint32_t desc_count) const {
+        TaskProfilesRcHeader header = {
+                .magic = TASK_PROFILES_RC_MAGIC,
+                .version = TASK_PROFILES_RC_VERSION,
+                .desc_count = desc_count,
+                .word_count = static_cast<uint32_t>(words_.size()),
+                .strings_size = static_cast<uint32_t>(strings_.size()),
+        };
+        std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+        data.append(reinterpret_cast<const char*>(words_.data()), words_.size() * sizeof(uint32_t));
+        return data.append(strings_);
+    }
+
+  private:
+    std::vector<uint32_t> words_;
+    std::string strings_;
+    std::map<std::string, uint32_t> string_offsets_;
+};
+
+class RcReader {
+  public:
+    RcReader(const uint32_t* words, size_t word_count, std::string_view strings)
+        : words_(words), word_count_(word_count), strings_(strings) {}
+
+    bool Word(uint32_t* word) {
+        if (pos_ >= word_count_) return false;
+        *word = words_[pos_++];
+        return true;
+    }
+    // Reads a list length, which can't be larger than the number of words left.
+    bool Count(uint32_t* count) { return Word(count) && *count <= word_count_ - pos_; }
+    bool String(std::string* str) {
+        uint32_t offset;
+        if (!Word(&offset) || offset >= strings_.size()) return false;
+        size_t end = strings_.find('\0', offset);
+        if (end == std::string_view::npos) return false;
+        str->assign(strings_.substr(offset, end - offset));
+        return true;
+    }
+    bool AtEnd() const { return pos_ == word_count_; }
+
+  private:
+    const uint32_t* words_;
+    size_t word_count_;
+    size_t pos_ = 0;
+    std::string_view strings_;
+};
+
+}  // namespace
+
+std::string TaskProfilesDesc::Serialize(const std::vector<TaskProfilesDesc>& descs) {
+    RcWriter writer;
+    for (const auto& desc : descs) {
+        writer.Word(desc.attributes.size());
+        for (const auto& attribute : desc.attributes) {
+            writer.String(attribute.name);
+            writer.String(attribute.controller);
+            writer.String(attribute.file);
+            writer.String(attribute.file_v2);
+        }
+        writer.Word(desc.profiles.size());
+        for (const auto& profile : desc.profiles) {
+            writer.String(profile.name);
+            writer.Word(profile.actions.size());
+            for (const auto& action : profile.actions) {
+                writer.String(action.name);
+                writer.Word(action.params.size());
+                for (const auto& [key, value] : action.params) {
+                    writer.String(key);
+                    writer.String(value);
+                }
+            }
+        }
+        writer.Word(desc.aggregate_profiles.size());
+        for (const auto& aggregate_profile : desc.aggregate_profiles) {
+            writer.String(aggregate_profile.name);
+            writer.Word(aggregate_profile.profiles.size());
+            for (const auto& profile_name : aggregate_profile.profiles) {
+                writer.String(profile_name);
+            }
+        }
+    }
+    return writer.Finish(descs.size());
+}
+
+bool TaskProfilesDesc::Deserialize(std::string_view data, std::vector<TaskProfilesDesc>* descs) {
+    TaskProfilesRcHeader header;
+    if (data.size() < sizeof(header)) return false;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != TASK_PROFILES_RC_MAGIC || header.version != TASK_PROFILES_RC_VERSION ||
+        data.size() != sizeof(header) + uint64_t(header.word_count) * sizeof(uint32_t) +
+                               header.strings_size) {
+        return false;
+    }
+    // The header is a multiple of 4 bytes, so the words are aligned in an mmapped file.
+    RcReader reader(reinterpret_cast<const uint32_t*>(data.data() + sizeof(header)),
+                    header.word_count, data.substr(data.size() - header.strings_size));
+
+    // Each description takes at least three words.
+    if (header.desc_count > header.word_count) return false;
+    std::vector<TaskProfilesDesc> result(header.desc_count);
+    for (auto& desc : result) {
+        uint32_t count;
+        if (!reader.Count(&count)) return false;
+        desc.attributes.resize(count);
+        for (auto& attribute : desc.attributes) {
+            if (!reader.String(&attribute.name) || !reader.String(&attribute.controller) ||
+                !reader.String(&attribute.file) || !reader.String(&attribute.file_v2)) {
+                return false;
+            }
+        }
+        if (!reader.Count(&count)) return false;
+        desc.profiles.resize(count);
+        for (auto& profile : desc.profiles) {
+            if (!reader.String(&profile.name) || !reader.Count(&count)) return false;
+            profile.actions.resize(count);
+            for (auto& action : profile.actions) {
+                if (!reader.String(&action.name) || !reader.Count(&count)) return false;
+                for (uint32_t i = 0; i < count; i++) {
+                    std::string key, value;
+                    if (!reader.String(&key) || !reader.String(&value)) return false;
+                    action.params.emplace(std::move(key), std::move(value));
+                }
+            }
+        }
+        if (!reader.Count(&count)) return false;
+        desc.aggregate_profiles.resize(count);
+        for (auto& aggregate_profile : desc.aggregate_profiles) {
+            if (!reader.String(&aggregate_profile.name) || !reader.Count(&count)) return false;
+            aggregate_profile.profiles.resize(count);
+            for (auto& profile_name : aggregate_profile.profiles) {
+                if (!reader.String(&profile_name)) return false;
+            }
+        }
+    }
+    if (!reader.AtEnd()) return false;
+
+    *descs = std::move(result);
+    return true;
+}
+
 TaskProfiles::TaskProfiles() {
-    // load system task profiles
-    if (!Load(CgroupMap::GetInstance(), TASK_PROFILE_DB_FILE)) {
-        LOG(ERROR) << "Loading " << TASK_PROFILE_DB_FILE << " for [" << getpid() << "] failed";
+    // use the task profiles compiled by init if available
+    if (LoadCompiled(CgroupMap::GetInstance(), TASK_PROFILES_RC_FILE)) {
+        return;
     }
 
-    // load API-level specific system task profiles if available
+    for (const auto& file_name : ProfileFiles()) {
+        if (!Load(CgroupMap::GetInstance(), file_name)) {
+            LOG(ERROR) << "Loading " << file_name << " for [" << getpid() << "] failed";
+        }
+    }
+}
+
+// Returns the task profiles JSON files that apply to this device, in the order they are loaded.
+std::vector<std::string> TaskProfiles::ProfileFiles() {
+    // system task profiles
+    std::vector<std::string> files = {TASK_PROFILE_DB_FILE};
+
+    // API-level specific system task profiles if available
     unsigned int api_level = GetUintProperty<unsigned int>("ro.product.first_api_level", 0);
     if (api_level > 0) {
         std::string api_profiles_path =
                 android::base::StringPrintf(TEMPLATE_TASK_PROFILE_API_FILE, api_level);
         if (!access(api_profiles_path.c_str(), F_OK) || errno != ENOENT) {
-            if (!Load(CgroupMap::GetInstance(), api_profiles_path)) {
-                LOG(ERROR) << "Loading " << api_profiles_path << " for [" << getpid() << "] failed";
-            }
+            files.emplace_back(api_profiles_path);
         }
     }
 
-    // load vendor task profiles if the file exists
-    if (!access(TASK_PROFILE_DB_VENDOR_FILE, F_OK) &&
-        !Load(CgroupMap::GetInstance(), TASK_PROFILE_DB_VENDOR_FILE)) {
-        LOG(ERROR) << "Loading " << TASK_PROFILE_DB_VENDOR_FILE << " for [" << getpid()
-                   << "] failed";
+    // vendor task profiles if the file exists
+    if (!access(TASK_PROFILE_DB_VENDOR_FILE, F_OK)) {
+        files.emplace_back(TASK_PROFILE_DB_VENDOR_FILE);
     }
+    return files;
 }
 
-bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
+bool TaskProfiles::Compile() {
+    std::vector<TaskProfilesDesc> descs;
+    for (const auto& file_name : ProfileFiles()) {
+        TaskProfilesDesc desc;
+        if (!Parse(file_name, &desc)) {
+            LOG(ERROR) << "Compiling " << file_name << " failed";
+            return false;
+        }
+        descs.emplace_back(std::move(desc));
+    }
+
+    // Unlike cgroup.rc, which is written in place, write to a temporary file
+    // first and rename it into place, so that readers never see a partial file.
+    const std::string path = TASK_PROFILES_RC_FILE;
+    const std::string temp_path = path + ".tmp";
+    if (!WriteStringToFile(TaskProfilesDesc::Serialize(descs), temp_path, 0644, getuid(), getgid(),
+                           false)) {
+        PLOG(ERROR) << "Failed to write " << temp_path;
+        return false;
+    }
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        PLOG(ERROR) << "Failed to rename " << temp_path << " to " << path;
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool TaskProfiles::LoadCompiled(const CgroupMap& cg_map, const std::string& path) {
+    unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd < 0) {
+        if (errno != ENOENT) PLOG(ERROR) << "Failed to open " << path;
+        return false;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || sb.st_size == 0) {
+        LOG(ERROR) << "Invalid compiled task profiles " << path;
+        return false;
+    }
+    void* addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        PLOG(ERROR) << "Failed to mmap " << path;
+        return false;
+    }
+    std::vector<TaskProfilesDesc> descs;
+    bool valid = TaskProfilesDesc::Deserialize(
+            std::string_view(static_cast<const char*>(addr), sb.st_size), &descs);
+    munmap(addr, sb.st_size);
+    if (!valid) {
+        LOG(ERROR) << "Invalid compiled task profiles " << path;
+        return false;
+    }
+
+    for (const auto& desc : descs) {
+        if (!Apply(cg_map, desc)) {
+            LOG(ERROR) << "Loading compiled task profiles for [" << getpid() << "] failed";
+        }
+    }
+    return true;
+}
+
+bool TaskProfiles::Parse(const std::string& file_name, TaskProfilesDesc* desc) {
     std::string json_doc;
 
     if (!android::base::ReadFileToString(file_name, &json_doc)) {
@@ -824,10 +1287,69 @@ bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
 
     const Json::Value& attr = root["Attributes"];
     for (Json::Value::ArrayIndex i = 0; i < attr.size(); ++i) {
-        std::string name = attr[i]["Name"].asString();
-        std::string controller_name = attr[i]["Controller"].asString();
-        std::string file_attr = attr[i]["File"].asString();
-        std::string file_v2_attr = attr[i]["FileV2"].asString();
+        desc->attributes.push_back({
+                .name = attr[i]["Name"].asString(),
+                .controller = attr[i]["Controller"].asString(),
+                .file = attr[i]["File"].asString(),
+                .file_v2 = attr[i]["FileV2"].asString(),
+        });
+    }
+
+    const Json::Value& profiles_val = root["Profiles"];
+    for (Json::Value::ArrayIndex i = 0; i < profiles_val.size(); ++i) {
+        const Json::Value& profile_val = profiles_val[i];
+        TaskProfilesDesc::Profile& profile = desc->profiles.emplace_back();
+        profile.name = profile_val["Name"].asString();
+
+        const Json::Value& actions = profile_val["Actions"];
+        for (Json::Value::ArrayIndex act_idx = 0; act_idx < actions.size(); ++act_idx) {
+            const Json::Value& action_val = actions[act_idx];
+            TaskProfilesDesc::Action& action = profile.actions.emplace_back();
+            action.name = action_val["Name"].asString();
+            const Json::Value& params_val = action_val["Params"];
+            for (const auto& key : params_val.getMemberNames()) {
+                if (params_val[key].isConvertibleTo(Json::stringValue)) {
+                    action.params[key] = params_val[key].asString();
+                }
+            }
+        }
+    }
+
+    const Json::Value& aggregateprofiles_val = root["AggregateProfiles"];
+    for (Json::Value::ArrayIndex i = 0; i < aggregateprofiles_val.size(); ++i) {
+        const Json::Value& aggregateprofile_val = aggregateprofiles_val[i];
+        TaskProfilesDesc::AggregateProfile& aggregate_profile =
+                desc->aggregate_profiles.emplace_back();
+        aggregate_profile.name = aggregateprofile_val["Name"].asString();
+
+        const Json::Value& aggregateprofiles = aggregateprofile_val["Profiles"];
+        for (Json::Value::ArrayIndex pf_idx = 0; pf_idx < aggregateprofiles.size(); ++pf_idx) {
+            aggregate_profile.profiles.emplace_back(aggregateprofiles[pf_idx].asString());
+        }
+    }
+
+    return true;
+}
+
+bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
+    TaskProfilesDesc desc;
+    return Parse(file_name, &desc) && Apply(cg_map, desc);
+}
+
+// Returns the parameter |name| of |action|, or an empty string if it isn't set.
+static const std::string& GetParam(const TaskProfilesDesc::Action& action,
+                                   std::string_view name) {
+    static const std::string* const kEmpty = new std::string;
+    auto iter = action.params.find(name);
+    return iter != action.params.end() ? iter->second : *kEmpty;
+}
+
+bool TaskProfiles::Apply(const CgroupMap& cg_map, const TaskProfilesDesc& desc) {
+    for (const auto& attribute : desc.attributes) {
+        const std::string& name = attribute.name;
+        const std::string& controller_name = attribute.controller;
+        const std::string& file_attr = attribute.file;
+        const std::string& file_v2_attr = attribute.file_v2;
 
         if (!file_v2_attr.empty() && file_attr.empty()) {
             LOG(ERROR) << "Attribute " << name << " has FileV2 but no File property";
@@ -848,21 +1370,15 @@ bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
         }
     }
 
-    const Json::Value& profiles_val = root["Profiles"];
-    for (Json::Value::ArrayIndex i = 0; i < profiles_val.size(); ++i) {
-        const Json::Value& profile_val = profiles_val[i];
-
-        std::string profile_name = profile_val["Name"].asString();
-        const Json::Value& actions = profile_val["Actions"];
+    for (const auto& profile_desc : desc.profiles) {
+        const std::string& profile_name = profile_desc.name;
         auto profile = std::make_shared<TaskProfile>(profile_name);
 
-        for (Json::Value::ArrayIndex act_idx = 0; act_idx < actions.size(); ++act_idx) {
-            const Json::Value& action_val = actions[act_idx];
-            std::string action_name = action_val["Name"].asString();
-            const Json::Value& params_val = action_val["Params"];
+        for (const auto& action_desc : profile_desc.actions) {
+            const std::string& action_name = action_desc.name;
             if (action_name == "JoinCgroup") {
-                std::string controller_name = params_val["Controller"].asString();
-                std::string path = params_val["Path"].asString();
+                std::string controller_name = GetParam(action_desc, "Controller");
+                std::string path = GetParam(action_desc, "Path");
 
                 auto controller = cg_map.FindController(controller_name);
                 if (controller.HasValue()) {
@@ -871,7 +1387,7 @@ bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
                     LOG(WARNING) << "JoinCgroup: controller " << controller_name << " is not found";
                 }
             } else if (action_name == "SetTimerSlack") {
-                std::string slack_value = params_val["Slack"].asString();
+                std::string slack_value = GetParam(action_desc, "Slack");
                 char* end;
                 unsigned long slack;
 
@@ -882,9 +1398,9 @@ bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
                     LOG(WARNING) << "SetTimerSlack: invalid parameter: " << slack_value;
                 }
             } else if (action_name == "SetAttribute") {
-                std::string attr_name = params_val["Name"].asString();
-                std::string attr_value = params_val["Value"].asString();
-                bool optional = strcmp(params_val["Optional"].asString().c_str(), "true") == 0;
+                std::string attr_name = GetParam(action_desc, "Name");
+                std::string attr_value = GetParam(action_desc, "Value");
+                bool optional = strcmp(GetParam(action_desc, "Optional").c_str(), "true") == 0;
 
                 auto iter = attributes_.find(attr_name);
                 if (iter != attributes_.end()) {
@@ -894,8 +1410,8 @@ bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
                     LOG(WARNING) << "SetAttribute: unknown attribute: " << attr_name;
                 }
             } else if (action_name == "SetClamps") {
-                std::string boost_value = params_val["Boost"].asString();
-                std::string clamp_value = params_val["Clamp"].asString();
+                std::string boost_value = GetParam(action_desc, "Boost");
+                std::string clamp_value = GetParam(action_desc, "Clamp");
                 char* end;
                 unsigned long boost;
 
@@ -911,12 +1427,12 @@ bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
                     LOG(WARNING) << "SetClamps: invalid parameter: " << boost_value;
                 }
             } else if (action_name == "WriteFile") {
-                std::string attr_filepath = params_val["FilePath"].asString();
-                std::string attr_procfilepath = params_val["ProcFilePath"].asString();
-                std::string attr_value = params_val["Value"].asString();
+                std::string attr_filepath = GetParam(action_desc, "FilePath");
+                std::string attr_procfilepath = GetParam(action_desc, "ProcFilePath");
+                std::string attr_value = GetParam(action_desc, "Value");
                 // FilePath and Value are mandatory
                 if (!attr_filepath.empty() && !attr_value.empty()) {
-                    std::string attr_logfailures = params_val["LogFailures"].asString();
+                    std::string attr_logfailures = GetParam(action_desc, "LogFailures");
                     bool logfailures = attr_logfailures.empty() || attr_logfailures == "true";
                     profile->Add(std::make_unique<WriteFileAction>(attr_filepath, attr_procfilepath,
                                                                    attr_value, logfailures));
@@ -942,17 +1458,12 @@ bool TaskProfiles::Load(const CgroupMap& cg_map, const std::string& file_name) {
         }
     }
 
-    const Json::Value& aggregateprofiles_val = root["AggregateProfiles"];
-    for (Json::Value::ArrayIndex i = 0; i < aggregateprofiles_val.size(); ++i) {
-        const Json::Value& aggregateprofile_val = aggregateprofiles_val[i];
-
-        std::string aggregateprofile_name = aggregateprofile_val["Name"].asString();
-        const Json::Value& aggregateprofiles = aggregateprofile_val["Profiles"];
+    for (const auto& aggregateprofile_desc : desc.aggregate_profiles) {
+        const std::string& aggregateprofile_name = aggregateprofile_desc.name;
         std::vector<std::shared_ptr<TaskProfile>> profiles;
         bool ret = true;
 
-        for (Json::Value::ArrayIndex pf_idx = 0; pf_idx < aggregateprofiles.size(); ++pf_idx) {
-            std::string profile_name = aggregateprofiles[pf_idx].asString();
+        for (const auto& profile_name : aggregateprofile_desc.profiles) {
 
             if (profile_name == aggregateprofile_name) {
                 LOG(WARNING) << "AggregateProfiles: recursive profile name: " << profile_name;
@@ -1055,6 +1566,28 @@ bool TaskProfiles::SetTaskProfiles(int tid, std::span<const T> profiles, bool us
     return success;
 }
 
+template <typename T>
+bool TaskProfiles::SetTaskProfilesBatch(std::span<const int> tids, std::span<const T> profiles,
+                                        bool use_fd_cache) {
+    bool success = true;
+    for (const auto& name : profiles) {
+        TaskProfile* profile = GetProfile(name);
+        if (profile != nullptr) {
+            if (use_fd_cache) {
+                profile->EnableResourceCaching(ProfileAction::RCT_TASK);
+            }
+            if (!profile->ExecuteForTasks(tids)) {
+                LOG(WARNING) << "Failed to apply " << name << " task profile";
+                success = false;
+            }
+        } else {
+            LOG(WARNING) << "Failed to find " << name << " task profile";
+            success = false;
+        }
+    }
+    return success;
+}
+
 template bool TaskProfiles::SetProcessProfiles(uid_t uid, pid_t pid,
                                                std::span<const std::string> profiles,
                                                bool use_fd_cache);
@@ -1067,3 +1600,9 @@ template bool TaskProfiles::SetTaskProfiles(int tid, std::span<const std::string
                                             bool use_fd_cache);
 template bool TaskProfiles::SetUserProfiles(uid_t uid, std::span<const std::string> profiles,
                                             bool use_fd_cache);
+template bool TaskProfiles::SetTaskProfilesBatch(std::span<const int> tids,
+                                                 std::span<const std::string> profiles,
+                                                 bool use_fd_cache);
+template bool TaskProfiles::SetTaskProfilesBatch(std::span<const int> tids,
+                                                 std::span<const std::string_view> profiles,
+                                                 bool use_fd_cache);
@@ -19,11 +19,13 @@
 #include <sys/cdefs.h>
 #include <sys/types.h>
 #include <functional>
+#include <list>
 #include <map>
 #include <mutex>
 #include <span>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/unique_fd.h>
@@ -39,6 +41,9 @@ class IProfileAttribute {
     virtual bool GetPathForProcess(uid_t uid, pid_t pid, std::string* path) const = 0;
     virtual bool GetPathForTask(int tid, std::string* path) const = 0;
     virtual bool GetPathForUID(uid_t uid, std::string* path) const = 0;
+    // Returns true if the path returned by GetPathForProcess() only depends on the uid and pid, so
+    // that a file descriptor opened for it can be reused for the same process.
+    virtual bool IsPathForProcessStable() const { return false; }
 };
 
 class ProfileAttribute : public IProfileAttribute {
@@ -59,6 +64,7 @@ class ProfileAttribute : public IProfileAttribute {
     bool GetPathForProcess(uid_t uid, pid_t pid, std::string* path) const override;
     bool GetPathForTask(int tid, std::string* path) const override;
     bool GetPathForUID(uid_t uid, std::string* path) const override;
+    bool IsPathForProcessStable() const override { return controller()->version() == 2; }
 
   private:
     CgroupController controller_;
@@ -66,6 +72,51 @@ class ProfileAttribute : public IProfileAttribute {
     std::string file_v2_name_;
 };
 
+// Caches file descriptors of files whose path depends on the uid and pid of a process, such as the
+// cgroup.procs file of an app's process group. The entries of a process are dropped when its
+// process group is created or killed, and the least recently used entry is evicted once the
+// cache is full.
+class ProcessFdCache {
+  public:
+    static constexpr size_t kMaxEntries = 256;
+
+    static ProcessFdCache& GetInstance();
+
+    // Passes the file descriptor that |owner| cached for the process to |write|. On a cache miss
+    // |open| is called first and a valid result is cached. The entry is dropped if |write| fails.
+    // Returns false if no file descriptor could be opened or if |write| failed.
+    bool Write(const void* owner, uid_t uid, pid_t pid,
+               const std::function<android::base::unique_fd()>& open,
+               const std::function<bool(int fd)>& write);
+    void DropProcess(pid_t pid);
+    void DropOwner(const void* owner);
+    size_t size() const;
+
+  private:
+    struct Key {
+        const void* owner;
+        uid_t uid;
+        pid_t pid;
+
+        bool operator==(const Key& other) const {
+            return owner == other.owner && uid == other.uid && pid == other.pid;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return (std::hash<const void*>()(key.owner) * 31 + key.uid) * 31 + key.pid;
+        }
+    };
+    using Entry = std::pair<Key, android::base::unique_fd>;
+
+    // Most recently used first.
+    std::list<Entry> entries_;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+    mutable std::mutex mutex_;
+
+    void EraseIf(const std::function<bool(const Key&)>& pred);
+};
+
 // Abstract profile element
 class ProfileAction {
   public:
@@ -79,6 +130,8 @@ class ProfileAction {
     virtual bool ExecuteForProcess(uid_t, pid_t) const { return false; }
     virtual bool ExecuteForTask(int) const { return false; }
     virtual bool ExecuteForUID(uid_t) const { return false; }
+    // Calls ExecuteForTask() for each of |tids| unless overridden with something cheaper.
+    virtual bool ExecuteForTasks(std::span<const int> tids) const;
 
     virtual void EnableResourceCaching(ResourceCacheType) {}
     virtual void DropResourceCaching(ResourceCacheType) {}
@@ -123,6 +176,7 @@ class SetAttributeAction : public ProfileAction {
   public:
     SetAttributeAction(const IProfileAttribute* attribute, const std::string& value, bool optional)
         : attribute_(attribute), value_(value), optional_(optional) {}
+    ~SetAttributeAction();
 
     const char* Name() const override { return "SetAttribute"; }
     bool ExecuteForProcess(uid_t uid, pid_t pid) const override;
@@ -143,10 +197,12 @@ class SetAttributeAction : public ProfileAction {
 class SetCgroupAction : public ProfileAction {
   public:
     SetCgroupAction(const CgroupController& c, const std::string& p);
+    ~SetCgroupAction();
 
     const char* Name() const override { return "SetCgroup"; }
     bool ExecuteForProcess(uid_t uid, pid_t pid) const override;
     bool ExecuteForTask(int tid) const override;
+    bool ExecuteForTasks(std::span<const int> tids) const override;
     void EnableResourceCaching(ResourceCacheType cache_type) override;
     void DropResourceCaching(ResourceCacheType cache_type) override;
     bool IsValidForProcess(uid_t uid, pid_t pid) const override;
@@ -157,6 +213,8 @@ class SetCgroupAction : public ProfileAction {
   private:
     CgroupController controller_;
     std::string path_;
+    // true if the cgroup.procs path contains <uid> or <pid>
+    bool app_dependent_;
     android::base::unique_fd fd_[ProfileAction::RCT_COUNT];
     mutable std::mutex fd_mutex_;
 
@@ -199,6 +257,7 @@ class TaskProfile {
 
     bool ExecuteForProcess(uid_t uid, pid_t pid) const;
     bool ExecuteForTask(int tid) const;
+    bool ExecuteForTasks(std::span<const int> tids) const;
     bool ExecuteForUID(uid_t uid) const;
     void EnableResourceCaching(ProfileAction::ResourceCacheType cache_type);
     void DropResourceCaching(ProfileAction::ResourceCacheType cache_type);
@@ -220,6 +279,7 @@ class ApplyProfileAction : public ProfileAction {
     const char* Name() const override { return "ApplyProfileAction"; }
     bool ExecuteForProcess(uid_t uid, pid_t pid) const override;
     bool ExecuteForTask(int tid) const override;
+    bool ExecuteForTasks(std::span<const int> tids) const override;
     void EnableResourceCaching(ProfileAction::ResourceCacheType cache_type) override;
     void DropResourceCaching(ProfileAction::ResourceCacheType cache_type) override;
     bool IsValidForProcess(uid_t uid, pid_t pid) const override;
@@ -229,10 +289,44 @@ class ApplyProfileAction : public ProfileAction {
     std::vector<std::shared_ptr<TaskProfile>> profiles_;
 };
 
+// The attributes and profiles of one task profiles JSON file, before any of their names are
+// resolved. init compiles these into a binary file at boot, so that other processes don't have to
+// parse the JSON files.
+struct TaskProfilesDesc {
+    struct Attribute {
+        std::string name;
+        std::string controller;
+        std::string file;
+        std::string file_v2;
+    };
+    struct Action {
+        std::string name;
+        std::map<std::string, std::string, std::less<>> params;
+    };
+    struct Profile {
+        std::string name;
+        std::vector<Action> actions;
+    };
+    struct AggregateProfile {
+        std::string name;
+        std::vector<std::string> profiles;
+    };
+
+    std::vector<Attribute> attributes;
+    std::vector<Profile> profiles;
+    std::vector<AggregateProfile> aggregate_profiles;
+
+    static std::string Serialize(const std::vector<TaskProfilesDesc>& descs);
+    static bool Deserialize(std::string_view data, std::vector<TaskProfilesDesc>* descs);
+};
+
 class TaskProfiles {
   public:
     // Should be used by all users
     static TaskProfiles& GetInstance();
+    // Parses the task profiles JSON files and writes their compiled form, which is then loaded
+    // instead of the JSON files.
+    static bool Compile();
 
     TaskProfile* GetProfile(std::string_view name) const;
     const IProfileAttribute* GetAttribute(std::string_view name) const;
@@ -243,11 +337,18 @@ class TaskProfiles {
     bool SetTaskProfiles(int tid, std::span<const T> profiles, bool use_fd_cache);
     template <typename T>
     bool SetUserProfiles(uid_t uid, std::span<const T> profiles, bool use_fd_cache);
+    template <typename T>
+    bool SetTaskProfilesBatch(std::span<const int> tids, std::span<const T> profiles,
+                              bool use_fd_cache);
 
   private:
     TaskProfiles();
 
+    static std::vector<std::string> ProfileFiles();
+    static bool Parse(const std::string& file_name, TaskProfilesDesc* desc);
     bool Load(const CgroupMap& cg_map, const std::string& file_name);
+    bool LoadCompiled(const CgroupMap& cg_map, const std::string& path);
+    bool Apply(const CgroupMap& cg_map, const TaskProfilesDesc& desc);
 
     std::map<std::string, std::shared_ptr<TaskProfile>, std::less<>> profiles_;
     std::map<std::string, std::unique_ptr<IProfileAttribute>, std::less<>> attributes_;
@@ -18,6 +18,7 @@
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 #include <gtest/gtest.h>
+#include <fcntl.h>
 #include <mntent.h>
 #include <processgroup/processgroup.h>
 #include <stdio.h>
@@ -203,6 +204,99 @@ TEST_P(TaskProfileFixture, TaskProfile) {
     EXPECT_EQ(tp2.IsValidForTask(getpid()), params.result);
 }
 
+TEST(ProcessFdCache, ReuseAndDrop) {
+    ProcessFdCache& cache = ProcessFdCache::GetInstance();
+    const int owner = 0;
+    int opens = 0;
+    auto open_null = [&] {
+        ++opens;
+        return android::base::unique_fd(open("/dev/null", O_WRONLY | O_CLOEXEC));
+    };
+    auto write_ok = [](int fd) { return fd >= 0; };
+
+    EXPECT_TRUE(cache.Write(&owner, 1000, 1, open_null, write_ok));
+    EXPECT_TRUE(cache.Write(&owner, 1000, 1, open_null, write_ok));
+    EXPECT_EQ(opens, 1);
+
+    // A process group created again for the same pid gets a new file descriptor.
+    cache.DropProcess(1);
+    EXPECT_TRUE(cache.Write(&owner, 1000, 1, open_null, write_ok));
+    EXPECT_EQ(opens, 2);
+
+    // A failed write drops the entry.
+    EXPECT_FALSE(cache.Write(&owner, 1000, 1, open_null, [](int) { return false; }));
+    EXPECT_TRUE(cache.Write(&owner, 1000, 1, open_null, write_ok));
+    EXPECT_EQ(opens, 3);
+
+    // The least recently used entry is evicted once the cache is full.
+    for (pid_t pid = 2; pid <= static_cast<pid_t>(ProcessFdCache::kMaxEntries); pid++) {
+        EXPECT_TRUE(cache.Write(&owner, 1000, pid, open_null, write_ok));
+    }
+    EXPECT_TRUE(cache.Write(&owner, 1000, 1, open_null, write_ok));
+    EXPECT_TRUE(cache.Write(&owner, 1000, ProcessFdCache::kMaxEntries + 1, open_null, write_ok));
+    opens = 0;
+    EXPECT_TRUE(cache.Write(&owner, 1000, 1, open_null, write_ok));
+    EXPECT_TRUE(cache.Write(&owner, 1000, 2, open_null, write_ok));
+    EXPECT_EQ(opens, 1);
+
+    cache.DropOwner(&owner);
+    EXPECT_EQ(cache.size(), 0);
+}
+
+class CountingAction : public ProfileAction {
+  public:
+    const char* Name() const override { return "Counting"; }
+    bool ExecuteForTask(int tid) const override {
+        tids_.push_back(tid);
+        return true;
+    }
+    mutable std::vector<int> tids_;
+};
+
+TEST(TaskProfile, ExecuteForTasks) {
+    TaskProfile tp("test_profile");
+    auto action = std::make_unique<CountingAction>();
+    const CountingAction* counting = action.get();
+    tp.Add(std::move(action));
+    const std::vector<int> tids = {1, 2, 3};
+    EXPECT_TRUE(tp.ExecuteForTasks(tids));
+    EXPECT_EQ(counting->tids_, tids);
+}
+
+TEST(TaskProfilesDesc, SerializeRoundTrip) {
+    TaskProfilesDesc desc;
+    desc.attributes.push_back({.name = "UClampMin", .controller = "cpu", .file = "uclamp.min"});
+    desc.profiles.push_back(
+            {.name = "HighPerformance",
+             .actions = {{.name = "JoinCgroup",
+                          .params = {{"Controller", "schedtune"}, {"Path", "top-app"}}}}});
+    desc.aggregate_profiles.push_back({.name = "SCHED_SP_TOP_APP", .profiles = {"HighPerformance"}});
+    TaskProfilesDesc vendor_desc;
+    vendor_desc.attributes.push_back(
+            {.name = "UClampMin", .controller = "cpu", .file = "uclamp.min", .file_v2 = "min"});
+
+    std::string data = TaskProfilesDesc::Serialize({desc, vendor_desc});
+    std::vector<TaskProfilesDesc> descs;
+    ASSERT_TRUE(TaskProfilesDesc::Deserialize(data, &descs));
+    ASSERT_EQ(descs.size(), 2);
+    ASSERT_EQ(descs[0].attributes.size(), 1);
+    EXPECT_EQ(descs[0].attributes[0].file, "uclamp.min");
+    EXPECT_EQ(descs[0].attributes[0].file_v2, "");
+    ASSERT_EQ(descs[0].profiles.size(), 1);
+    ASSERT_EQ(descs[0].profiles[0].actions.size(), 1);
+    EXPECT_EQ(descs[0].profiles[0].actions[0].params, desc.profiles[0].actions[0].params);
+    ASSERT_EQ(descs[0].aggregate_profiles.size(), 1);
+    EXPECT_EQ(descs[0].aggregate_profiles[0].profiles, desc.aggregate_profiles[0].profiles);
+    ASSERT_EQ(descs[1].attributes.size(), 1);
+    EXPECT_EQ(descs[1].attributes[0].file_v2, "min");
+
+    // Truncated or corrupted files are rejected.
+    EXPECT_FALSE(TaskProfilesDesc::Deserialize(data.substr(0, data.size() - 1), &descs));
+    std::string corrupted = data;
+    corrupted[sizeof(uint32_t) * 5] = 0x7f;
+    EXPECT_FALSE(TaskProfilesDesc::Deserialize(corrupted, &descs));
+}
+
 // Test the four combinations of optional_attr {false, true} and cgroup attribute { does not exist,
 // exists }.
 INSTANTIATE_TEST_SUITE_P(
@@ -26,6 +26,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <string>
+
 #include <sparse/sparse.h>
 
 #ifndef O_BINARY
@@ -38,7 +40,27 @@
 #endif
 
 void usage() {
-  fprintf(stderr, "Usage: img2simg [-s] <raw_image_file> <sparse_image_file> [<block_size>]\n");
+  fprintf(stderr,
+          "Usage: img2simg [-s] [-j <threads>] [-m <max_size>] <raw_image_file> "
+          "<sparse_image_file> [<block_size>]\n"
+          "  -m <max_size>  split the output into sparse images of at most max_size bytes,\n"
+          "                 written to <sparse_image_file>.0, .1, ...\n");
+}
+
+/* Writes each piece to <sparse_image_file>.<index>. */
+static int write_piece(void* priv, struct sparse_file* s, unsigned int index) {
+  std::string path = std::string(static_cast<const char*>(priv)) + "." + std::to_string(index);
+  int out = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0664);
+  if (out < 0) {
+    fprintf(stderr, "Cannot open output file %s\n", path.c_str());
+    return -1;
+  }
+  int ret = sparse_file_write(s, out, false, true, false);
+  close(out);
+  if (ret) {
+    fprintf(stderr, "Failed to write sparse file %s\n", path.c_str());
+  }
+  return ret;
 }
 
 int main(int argc, char* argv[]) {
@@ -52,13 +74,25 @@ int main(int argc, char* argv[]) {
   int ret;
   struct sparse_file* s;
   unsigned int block_size = 4096;
+  unsigned int threads = 1;
+  unsigned int max_size = 0;
   off64_t len;
 
-  while ((opt = getopt(argc, argv, "s")) != -1) {
+  while ((opt = getopt(argc, argv, "sj:m:")) != -1) {
     switch (opt) {
       case 's':
         mode = SPARSE_READ_MODE_HOLE;
         break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'm':
+        max_size = strtoul(optarg, nullptr, 0);
+        if (!max_size) {
+          usage();
+          exit(EXIT_FAILURE);
+        }
+        break;
       default:
         usage();
         exit(EXIT_FAILURE);
@@ -92,6 +126,22 @@ int main(int argc, char* argv[]) {
   }
 
   arg_out = argv[optind + 1];
+  if (max_size) {
+    /* The pieces refer to the input instead of copying it, so it must be seekable. */
+    len = lseek64(in, 0, SEEK_END);
+    if (len < 0 || strcmp(arg_out, "-") == 0) {
+      usage();
+      exit(EXIT_FAILURE);
+    }
+    ret = sparse_file_read_stream(in, block_size, len, mode, max_size, write_piece, arg_out);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to split file\n");
+      exit(EXIT_FAILURE);
+    }
+    close(in);
+    exit(EXIT_SUCCESS);
+  }
+
   if (strcmp(arg_out, "-") == 0) {
     out = STDOUT_FILENO;
   } else {
@@ -112,7 +162,11 @@ int main(int argc, char* argv[]) {
   }
 
   sparse_file_verbose(s);
-  ret = sparse_file_read(s, in, mode, false);
+  if (threads != 1 && in != STDIN_FILENO) {
+    ret = sparse_file_read_parallel(s, in, mode, threads);
+  } else {
+    ret = sparse_file_read(s, in, mode, false);
+  }
   if (ret) {
     fprintf(stderr, "Failed to read file\n");
     exit(EXIT_FAILURE);
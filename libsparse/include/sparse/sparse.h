@@ -165,6 +165,25 @@ int sparse_file_add_fd(struct sparse_file* s, int fd, int64_t file_offset, uint6
 int sparse_file_write(struct sparse_file *s, int fd, bool gz, bool sparse,
 		bool crc);
 
+/**
+ * sparse_file_write_gz - write a gzipped sparse file to a file on threads
+ *
+ * @s - sparse file cookie
+ * @fd - file descriptor to write to
+ * @sparse - write in the Android sparse file format
+ * @crc - append a crc chunk
+ * @threads - number of compression threads, or 0 for one per CPU
+ *
+ * Like sparse_file_write() with gz set, but the output is split into blocks
+ * that are deflated in parallel and written as a single gzip stream. Unlike
+ * sparse_file_write(), @fd is not closed, whatever the number of threads. With
+ * one thread the output is the same as sparse_file_write()'s.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_write_gz(struct sparse_file *s, int fd, bool sparse, bool crc,
+                         unsigned int threads);
+
 /**
  * sparse_file_len - return the length of a sparse file if written to disk
  *
@@ -262,6 +281,52 @@ enum sparse_read_mode {
  */
 int sparse_file_read(struct sparse_file *s, int fd, enum sparse_read_mode mode, bool crc);
 
+/**
+ * sparse_file_read_parallel - read a file into a sparse file cookie on threads
+ *
+ * @s - sparse file cookie
+ * @fd - file descriptor to read from, must support pread
+ * @mode - mode to use when reading the input file
+ * @threads - number of threads to use, or 0 for one per CPU
+ *
+ * Like sparse_file_read() without crc verification, but for
+ * %SPARSE_READ_MODE_NORMAL and %SPARSE_READ_MODE_HOLE the input is split into
+ * stripes that are scanned for fill blocks in parallel. The resulting sparse
+ * file is the same as with sparse_file_read(). %SPARSE_READ_MODE_SPARSE input
+ * is read on the calling thread.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_read_parallel(struct sparse_file *s, int fd, enum sparse_read_mode mode,
+                              unsigned int threads);
+
+/**
+ * sparse_file_read_stream - read a file into sparse files of bounded size
+ *
+ * @fd - file descriptor to read from
+ * @block_size - block size of the sparse files
+ * @len - length of the input, in bytes
+ * @mode - %SPARSE_READ_MODE_NORMAL or %SPARSE_READ_MODE_HOLE
+ * @max_len - maximum length of each piece in the sparse format, or 0 for
+ *            a single piece
+ * @piece - called with each piece, in order, as soon as it is complete
+ * @priv - value passed to @piece
+ *
+ * Sparses the input like sparse_file_read(), but instead of building one
+ * sparse file for the whole input, hands pieces to @piece while the input is
+ * still being read. Each piece has the full length of the input, with the
+ * blocks outside it skipped, as with sparse_file_resparse(). Data chunks refer
+ * to @fd instead of being copied, and only the chunk list of the current piece
+ * is kept in memory. The piece is destroyed when @piece returns; a negative
+ * return value stops the read and is returned.
+ *
+ * Returns the number of pieces on success, negative errno on error.
+ */
+int sparse_file_read_stream(int fd, unsigned int block_size, int64_t len,
+                            enum sparse_read_mode mode, unsigned int max_len,
+                            int (*piece)(void *priv, struct sparse_file *s, unsigned int index),
+                            void *priv);
+
 /**
  * sparse_file_import - import an existing sparse file
  *
@@ -310,6 +375,24 @@ struct sparse_file* sparse_file_import_buf(char* buf, size_t len, bool verbose,
  */
 struct sparse_file *sparse_file_import_auto(int fd, bool crc, bool verbose);
 
+/**
+ * sparse_file_import_region - import a sparse or normal file stored in a larger file
+ *
+ * @fd - file descriptor to read from
+ * @offset - offset of the file within @fd
+ * @len - length of the file, in bytes
+ * @crc - verify the crc of a file in the Android sparse file format
+ * @verbose - whether to use verbose logging
+ *
+ * Like sparse_file_import_auto(), for the @len bytes at @offset in @fd, such as
+ * an uncompressed entry of an archive. Data chunks refer to their absolute
+ * offsets in @fd, so the file is used in place without being copied.
+ *
+ * Returns a new sparse file cookie on success, NULL on error.
+ */
+struct sparse_file *sparse_file_import_region(int fd, int64_t offset, int64_t len, bool crc,
+                                              bool verbose);
+
 /** sparse_file_resparse - rechunk an existing sparse file into smaller files
  *
  * @in_s - sparse file cookie of the existing sparse file
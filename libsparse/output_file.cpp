@@ -18,6 +18,12 @@
 #define _LARGEFILE64_SOURCE 1
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -27,6 +33,10 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
 #include <unistd.h>
 #include <zlib.h>
 
@@ -59,13 +69,18 @@
 #define container_of(inner, outer_t, elem) ((outer_t*)((char*)(inner)-offsetof(outer_t, elem)))
 
 static constexpr size_t kMaxMmapSize = 256 * 1024 * 1024;
+static constexpr size_t kMaxCopySize = 1024 * 1024 * 1024;
 
 struct output_file_ops {
   int (*open)(struct output_file*, int fd);
   int (*skip)(struct output_file*, int64_t);
   int (*pad)(struct output_file*, int64_t);
   int (*write)(struct output_file*, void*, size_t);
-  void (*close)(struct output_file*);
+  /* Returns 0, or a negative errno if the output could not be finished. */
+  int (*close)(struct output_file*);
+  /* Optional. Copies from an fd without going through user space, and
+   * returns how much was copied before the kernel stopped being able to. */
+  int64_t (*copy)(struct output_file*, int fd, int64_t offset, uint64_t len);
 };
 
 struct sparse_file_ops {
@@ -97,9 +112,28 @@ struct output_file_gz {
 
 #define to_output_file_gz(_o) container_of((_o), struct output_file_gz, out)
 
+#ifndef _WIN32
+class GzParallelWriter;
+
+struct output_file_gz_parallel {
+  struct output_file out;
+  GzParallelWriter* writer;
+  unsigned int threads;
+};
+
+#define to_output_file_gz_parallel(_o) container_of((_o), struct output_file_gz_parallel, out)
+#endif
+
+enum file_copy_mode {
+  FILE_COPY_NONE,
+  FILE_COPY_SENDFILE,
+  FILE_COPY_FILE_RANGE,
+};
+
 struct output_file_normal {
   struct output_file out;
   int fd;
+  enum file_copy_mode copy_mode;
 };
 
 #define to_output_file_normal(_o) container_of((_o), struct output_file_normal, out)
@@ -116,6 +150,13 @@ static int file_open(struct output_file* out, int fd) {
   struct output_file_normal* outn = to_output_file_normal(out);
 
   outn->fd = fd;
+  outn->copy_mode = FILE_COPY_NONE;
+#ifdef __linux__
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    outn->copy_mode = FILE_COPY_FILE_RANGE;
+  }
+#endif
   return 0;
 }
 
@@ -164,18 +205,62 @@ static int file_write(struct output_file* out, void* data, size_t len) {
   return 0;
 }
 
-static void file_close(struct output_file* out) {
+static int file_close(struct output_file* out) {
   struct output_file_normal* outn = to_output_file_normal(out);
 
   free(outn);
+  return 0;
 }
 
+#ifdef __linux__
+static int64_t file_copy(struct output_file* out, int fd, int64_t offset, uint64_t len) {
+  struct output_file_normal* outn = to_output_file_normal(out);
+  uint64_t copied = 0;
+
+  while (copied < len && outn->copy_mode != FILE_COPY_NONE) {
+    size_t to_copy = std::min(len - copied, (uint64_t)kMaxCopySize);
+    off64_t in_offset = offset + copied;
+    ssize_t ret;
+
+    /* Both copy at the file offset of the output, like file_write(). */
+    if (outn->copy_mode == FILE_COPY_FILE_RANGE) {
+      ret = syscall(__NR_copy_file_range, fd, &in_offset, outn->fd, nullptr, to_copy, 0);
+    } else {
+      ret = sendfile64(outn->fd, fd, &in_offset, to_copy);
+    }
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP ||
+          errno == EBADF) {
+        /* Not supported for these files, so fall back to the next method. */
+        outn->copy_mode = outn->copy_mode == FILE_COPY_FILE_RANGE ? FILE_COPY_SENDFILE
+                                                                  : FILE_COPY_NONE;
+        continue;
+      }
+      error_errno("copy");
+      return -1;
+    }
+    if (ret == 0) {
+      break;
+    }
+    copied += ret;
+  }
+
+  return copied;
+}
+#endif
+
 static struct output_file_ops file_ops = {
     .open = file_open,
     .skip = file_skip,
     .pad = file_pad,
     .write = file_write,
     .close = file_close,
+#ifdef __linux__
+    .copy = file_copy,
+#endif
 };
 
 static int gz_file_open(struct output_file* out, int fd) {
@@ -242,11 +327,16 @@ static int gz_file_write(struct output_file* out, void* data, size_t len) {
   return 0;
 }
 
-static void gz_file_close(struct output_file* out) {
+static int gz_file_close(struct output_file* out) {
   struct output_file_gz* outgz = to_output_file_gz(out);
+  int ret = 0;
 
-  gzclose(outgz->gz_fd);
+  if (outgz->gz_fd && gzclose(outgz->gz_fd) != Z_OK) {
+    error("gzclose failed");
+    ret = -EIO;
+  }
   free(outgz);
+  return ret;
 }
 
 static struct output_file_ops gz_file_ops = {
@@ -257,6 +347,293 @@ static struct output_file_ops gz_file_ops = {
     .close = gz_file_close,
 };
 
+#ifndef _WIN32
+/*
+ * Writes a gzip stream made of independently deflated blocks, compressed on
+ * worker threads and written out in order, in the style of pigz. Each block is
+ * primed with the tail of the previous one, so the ratio stays close to that of
+ * a single stream. Unlike gz_file_ops, the fd is not closed.
+ */
+class GzParallelWriter {
+  public:
+    GzParallelWriter(int fd, unsigned int threads) : fd_(fd) {
+      for (unsigned int i = 0; i < threads; i++) {
+        workers_.emplace_back([this] { Run(); });
+      }
+      max_in_flight_ = 2 * threads;
+    }
+
+    ~GzParallelWriter() {
+      {
+        std::lock_guard<std::mutex> lock(lock_);
+        stopped_ = true;
+      }
+      work_cv_.notify_all();
+      for (auto& worker : workers_) {
+        worker.join();
+      }
+    }
+
+    bool WriteHeader() {
+      /* DEFLATE, no name or mtime, maximum compression, Unix. */
+      static const uint8_t header[] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 2, 3};
+      return WriteFd(header, sizeof(header));
+    }
+
+    bool Write(const void* data, size_t len) {
+      const uint8_t* ptr = reinterpret_cast<const uint8_t*>(data);
+      while (len > 0) {
+        if (!cur_) {
+          cur_ = std::make_unique<Job>();
+          cur_->in.reserve(kBlockSize);
+        }
+        size_t to_copy = std::min(len, kBlockSize - cur_->in.size());
+        cur_->in.insert(cur_->in.end(), ptr, ptr + to_copy);
+        ptr += to_copy;
+        len -= to_copy;
+        pos_ += to_copy;
+        if (cur_->in.size() == kBlockSize && !Submit(false)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool WriteZeros(uint64_t len) {
+      static const uint8_t zeros[4096] = {};
+      while (len > 0) {
+        size_t to_write = std::min(len, (uint64_t)sizeof(zeros));
+        if (!Write(zeros, to_write)) {
+          return false;
+        }
+        len -= to_write;
+      }
+      return true;
+    }
+
+    uint64_t pos() const { return pos_; }
+
+    /* Finishes the deflate stream and writes the gzip trailer. */
+    bool Finish() {
+      if (!Submit(true) || !Drain(0)) {
+        return false;
+      }
+      uint8_t trailer[8];
+      for (int i = 0; i < 4; i++) {
+        trailer[i] = crc_ >> (8 * i);
+        trailer[4 + i] = pos_ >> (8 * i);
+      }
+      return WriteFd(trailer, sizeof(trailer));
+    }
+
+  private:
+    static constexpr size_t kBlockSize = 128 * 1024;
+    static constexpr size_t kDictSize = 32 * 1024;
+
+    struct Job {
+      std::vector<uint8_t> dict;
+      std::vector<uint8_t> in;
+      std::vector<uint8_t> out;
+      uint32_t crc = 0;
+      bool last = false;
+      bool done = false;
+      bool ok = false;
+    };
+
+    bool Submit(bool last) {
+      if (!cur_) {
+        cur_ = std::make_unique<Job>();
+      }
+      auto job = std::move(cur_);
+      job->last = last;
+      job->dict = std::move(next_dict_);
+      size_t dict_len = std::min(job->in.size(), kDictSize);
+      next_dict_.assign(job->in.end() - dict_len, job->in.end());
+
+      {
+        std::lock_guard<std::mutex> lock(lock_);
+        work_.push_back(job.get());
+        in_flight_.push_back(std::move(job));
+      }
+      work_cv_.notify_one();
+      return Drain(max_in_flight_);
+    }
+
+    /* Writes out completed blocks, in order, until at most |limit| remain. */
+    bool Drain(size_t limit) {
+      while (true) {
+        std::unique_ptr<Job> job;
+        {
+          std::unique_lock<std::mutex> lock(lock_);
+          if (in_flight_.size() <= limit) {
+            return true;
+          }
+          done_cv_.wait(lock, [this] { return in_flight_.front()->done; });
+          job = std::move(in_flight_.front());
+          in_flight_.pop_front();
+        }
+        if (!job->ok) {
+          error("deflate failed");
+          return false;
+        }
+        if (!WriteFd(job->out.data(), job->out.size())) {
+          return false;
+        }
+        crc_ = crc32_combine(crc_, job->crc, job->in.size());
+      }
+    }
+
+    void Run() {
+      while (true) {
+        Job* job;
+        {
+          std::unique_lock<std::mutex> lock(lock_);
+          work_cv_.wait(lock, [this] { return stopped_ || !work_.empty(); });
+          if (work_.empty()) {
+            return;
+          }
+          job = work_.front();
+          work_.pop_front();
+        }
+        job->ok = Compress(job);
+        {
+          std::lock_guard<std::mutex> lock(lock_);
+          job->done = true;
+        }
+        done_cv_.notify_all();
+      }
+    }
+
+    static bool Compress(Job* job) {
+      z_stream strm = {};
+      if (deflateInit2(&strm, 9, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+      }
+      bool ok = true;
+      if (!job->dict.empty()) {
+        ok = deflateSetDictionary(&strm, job->dict.data(), job->dict.size()) == Z_OK;
+      }
+
+      /* Room for the sync flush marker on top of the worst case. */
+      job->out.resize(deflateBound(&strm, job->in.size()) + 16);
+      strm.next_in = job->in.data();
+      strm.avail_in = job->in.size();
+      strm.next_out = job->out.data();
+      strm.avail_out = job->out.size();
+
+      /* A sync flush ends each block on a byte boundary without ending the stream. */
+      int flush = job->last ? Z_FINISH : Z_SYNC_FLUSH;
+      while (ok) {
+        int ret = deflate(&strm, flush);
+        if (ret == Z_STREAM_ERROR) {
+          ok = false;
+        } else if (strm.avail_out == 0) {
+          size_t used = job->out.size();
+          job->out.resize(used * 2);
+          strm.next_out = job->out.data() + used;
+          strm.avail_out = job->out.size() - used;
+        } else if (!job->last || ret == Z_STREAM_END) {
+          break;
+        }
+      }
+      job->out.resize(job->out.size() - strm.avail_out);
+      deflateEnd(&strm);
+
+      job->crc = crc32(0, job->in.data(), job->in.size());
+      return ok;
+    }
+
+    bool WriteFd(const void* data, size_t len) {
+      const char* ptr = reinterpret_cast<const char*>(data);
+      while (len > 0) {
+        ssize_t ret = write(fd_, ptr, len);
+        if (ret < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          error_errno("write");
+          return false;
+        }
+        ptr += ret;
+        len -= ret;
+      }
+      return true;
+    }
+
+    int fd_;
+    size_t max_in_flight_;
+    uint64_t pos_ = 0;
+    uint32_t crc_ = 0;
+    std::unique_ptr<Job> cur_;
+    std::vector<uint8_t> next_dict_;
+
+    std::mutex lock_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::deque<Job*> work_;
+    std::deque<std::unique_ptr<Job>> in_flight_;
+    bool stopped_ = false;
+    std::vector<std::thread> workers_;
+};
+
+static int gz_parallel_file_open(struct output_file* out, int fd) {
+  struct output_file_gz_parallel* outgzp = to_output_file_gz_parallel(out);
+
+  outgzp->writer = new GzParallelWriter(fd, outgzp->threads);
+  if (!outgzp->writer->WriteHeader()) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static int gz_parallel_file_skip(struct output_file* out, int64_t cnt) {
+  struct output_file_gz_parallel* outgzp = to_output_file_gz_parallel(out);
+
+  return outgzp->writer->WriteZeros(cnt) ? 0 : -1;
+}
+
+static int gz_parallel_file_pad(struct output_file* out, int64_t len) {
+  struct output_file_gz_parallel* outgzp = to_output_file_gz_parallel(out);
+  uint64_t pos = outgzp->writer->pos();
+
+  if (pos >= (uint64_t)len) {
+    return 0;
+  }
+
+  return outgzp->writer->WriteZeros(len - pos) ? 0 : -1;
+}
+
+static int gz_parallel_file_write(struct output_file* out, void* data, size_t len) {
+  struct output_file_gz_parallel* outgzp = to_output_file_gz_parallel(out);
+
+  return outgzp->writer->Write(data, len) ? 0 : -1;
+}
+
+static int gz_parallel_file_close(struct output_file* out) {
+  struct output_file_gz_parallel* outgzp = to_output_file_gz_parallel(out);
+  int ret = 0;
+
+  if (outgzp->writer) {
+    if (!outgzp->writer->Finish()) {
+      error("failed to finish the gzip stream");
+      ret = -EIO;
+    }
+    delete outgzp->writer;
+  }
+  free(outgzp);
+  return ret;
+}
+
+static struct output_file_ops gz_parallel_file_ops = {
+    .open = gz_parallel_file_open,
+    .skip = gz_parallel_file_skip,
+    .pad = gz_parallel_file_pad,
+    .write = gz_parallel_file_write,
+    .close = gz_parallel_file_close,
+};
+#endif
+
 static int callback_file_open(struct output_file* out __unused, int fd __unused) {
   return 0;
 }
@@ -288,10 +665,11 @@ static int callback_file_write(struct output_file* out, void* data, size_t len)
   return outc->write(outc->priv, data, len);
 }
 
-static void callback_file_close(struct output_file* out) {
+static int callback_file_close(struct output_file* out) {
   struct output_file_callback* outc = to_output_file_callback(out);
 
   free(outc);
+  return 0;
 }
 
 static struct output_file_ops callback_file_ops = {
@@ -341,6 +719,42 @@ static bool write_fd_chunk_range(int fd, int64_t offset, uint64_t len, T callbac
   return true;
 }
 
+/*
+ * Writes len bytes at offset in fd to out. The output copies what it can in
+ * the kernel, and the remainder is written from mapped pages. If crc is set,
+ * it is computed over mapped pages of the source.
+ */
+static int write_fd_chunk_data(struct output_file* out, int fd, int64_t offset, uint64_t len,
+                               bool crc) {
+  if (out->ops->copy) {
+    int64_t copied = out->ops->copy(out, fd, offset, len);
+    if (copied < 0) return -1;
+
+    if (crc && copied > 0) {
+      bool ok = write_fd_chunk_range(fd, offset, copied, [out](char* data, size_t size) -> bool {
+        out->crc32 = sparse_crc32(out->crc32, data, size);
+        return true;
+      });
+      if (!ok) return -1;
+    }
+    offset += copied;
+    len -= copied;
+  }
+
+  int ret = 0;
+  bool ok = write_fd_chunk_range(fd, offset, len, [&ret, out, crc](char* data, size_t size) -> bool {
+    ret = out->ops->write(out, data, size);
+    if (ret < 0) return false;
+    if (crc) {
+      out->crc32 = sparse_crc32(out->crc32, data, size);
+    }
+    return true;
+  });
+  if (!ok) return ret < 0 ? ret : -1;
+
+  return 0;
+}
+
 static int write_sparse_skip_chunk(struct output_file* out, uint64_t skip_len) {
   chunk_header_t chunk_header;
   int ret;
@@ -464,15 +878,8 @@ static int write_sparse_fd_chunk(struct output_file* out, uint64_t len, int fd,
   ret = out->ops->write(out, &chunk_header, sizeof(chunk_header));
 
   if (ret < 0) return -1;
-  bool ok = write_fd_chunk_range(fd, offset, len, [&ret, out](char* data, size_t size) -> bool {
-    ret = out->ops->write(out, data, size);
-    if (ret < 0) return false;
-    if (out->use_crc) {
-      out->crc32 = sparse_crc32(out->crc32, data, size);
-    }
-    return true;
-  });
-  if (!ok) return -1;
+  ret = write_fd_chunk_data(out, fd, offset, len, out->use_crc);
+  if (ret < 0) return -1;
   if (zero_len) {
     uint64_t len = zero_len;
     uint64_t write_len;
@@ -578,11 +985,8 @@ static int write_normal_fd_chunk(struct output_file* out, uint64_t len, int fd,
   int ret;
   uint64_t rnd_up_len = ALIGN(len, out->block_size);
 
-  bool ok = write_fd_chunk_range(fd, offset, len, [&ret, out](char* data, size_t size) -> bool {
-    ret = out->ops->write(out, data, size);
-    return ret >= 0;
-  });
-  if (!ok) return ret;
+  ret = write_fd_chunk_data(out, fd, offset, len, false);
+  if (ret < 0) return ret;
 
   if (rnd_up_len > len) {
     ret = out->ops->skip(out, rnd_up_len - len);
@@ -607,13 +1011,14 @@ static struct sparse_file_ops normal_file_ops = {
     .write_fd_chunk = write_normal_fd_chunk,
 };
 
-void output_file_close(struct output_file* out) {
-  out->sparse_ops->write_end_chunk(out);
+int output_file_close(struct output_file* out) {
+  int ret = out->sparse_ops->write_end_chunk(out);
   free(out->zero_buf);
   free(out->fill_buf);
   out->zero_buf = nullptr;
   out->fill_buf = nullptr;
-  out->ops->close(out);
+  int close_ret = out->ops->close(out);
+  return ret < 0 ? ret : close_ret;
 }
 
 static int output_file_init(struct output_file* out, int block_size, int64_t len, bool sparse,
@@ -692,6 +1097,22 @@ static struct output_file* output_file_new_gz(void) {
   return &outgz->out;
 }
 
+#ifndef _WIN32
+static struct output_file* output_file_new_gz_parallel(unsigned int threads) {
+  struct output_file_gz_parallel* outgzp = reinterpret_cast<struct output_file_gz_parallel*>(
+      calloc(1, sizeof(struct output_file_gz_parallel)));
+  if (!outgzp) {
+    error_errno("malloc struct outgzp");
+    return nullptr;
+  }
+
+  outgzp->out.ops = &gz_parallel_file_ops;
+  outgzp->threads = threads;
+
+  return &outgzp->out;
+}
+#endif
+
 static struct output_file* output_file_new_normal(void) {
   struct output_file_normal* outn =
       reinterpret_cast<struct output_file_normal*>(calloc(1, sizeof(struct output_file_normal)));
@@ -736,6 +1157,11 @@ struct output_file* output_file_open_fd(int fd, unsigned int block_size, int64_t
   int ret;
   struct output_file* out;
 
+#ifndef _WIN32
+  if (gz > 1) {
+    out = output_file_new_gz_parallel(gz);
+  } else
+#endif
   if (gz) {
     out = output_file_new_gz();
   } else {
@@ -745,11 +1171,15 @@ struct output_file* output_file_open_fd(int fd, unsigned int block_size, int64_t
     return nullptr;
   }
 
-  out->ops->open(out, fd);
+  ret = out->ops->open(out, fd);
+  if (ret < 0) {
+    out->ops->close(out);
+    return nullptr;
+  }
 
   ret = output_file_init(out, block_size, len, sparse, chunks, crc);
   if (ret < 0) {
-    free(out);
+    out->ops->close(out);
     return nullptr;
   }
 
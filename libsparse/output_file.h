@@ -25,6 +25,7 @@ extern "C" {
 
 struct output_file;
 
+/* gz is 0 for no compression, 1 for a zlib stream, or a number of threads. */
 struct output_file* output_file_open_fd(int fd, unsigned int block_size, int64_t len, int gz,
                                         int sparse, int chunks, int crc);
 struct output_file* output_file_open_callback(int (*write)(void*, const void*, size_t), void* priv,
@@ -35,7 +36,8 @@ int write_fill_chunk(struct output_file* out, uint64_t len, uint32_t fill_val);
 int write_file_chunk(struct output_file* out, uint64_t len, const char* file, int64_t offset);
 int write_fd_chunk(struct output_file* out, uint64_t len, int fd, int64_t offset);
 int write_skip_chunk(struct output_file* out, uint64_t len);
-void output_file_close(struct output_file* out);
+/* Returns 0, or a negative value if the output could not be completed. */
+int output_file_close(struct output_file* out);
 
 int read_all(int fd, void* buf, size_t len);
 
@@ -14,8 +14,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <thread>
+#include <unistd.h>
 
 #include <sparse/sparse.h>
 
@@ -142,7 +146,8 @@ static int write_all_blocks(struct sparse_file* s, struct output_file* out) {
  */
 #define MAX_BACKED_BLOCK_SIZE ((unsigned int) (64UL << 20))
 
-int sparse_file_write(struct sparse_file* s, int fd, bool gz, bool sparse, bool crc) {
+/* gz is 0 for no compression, 1 for a zlib stream, or a number of threads. */
+static int sparse_file_write_fd(struct sparse_file* s, int fd, int gz, bool sparse, bool crc) {
   struct backed_block* bb;
   int ret;
   int chunks;
@@ -160,9 +165,32 @@ int sparse_file_write(struct sparse_file* s, int fd, bool gz, bool sparse, bool
 
   ret = write_all_blocks(s, out);
 
-  output_file_close(out);
+  int close_ret = output_file_close(out);
 
-  return ret;
+  return ret < 0 ? ret : close_ret;
+}
+
+int sparse_file_write(struct sparse_file* s, int fd, bool gz, bool sparse, bool crc) {
+  return sparse_file_write_fd(s, fd, gz ? 1 : 0, sparse, crc);
+}
+
+int sparse_file_write_gz(struct sparse_file* s, int fd, bool sparse, bool crc,
+                         unsigned int threads) {
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+#ifdef _WIN32
+  threads = 1;
+#endif
+  if (threads == 1) {
+    // The zlib stream closes the fd it writes to, so give it one of its own.
+    int dup_fd = dup(fd);
+    if (dup_fd < 0) {
+      return -errno;
+    }
+    return sparse_file_write_fd(s, dup_fd, 1, sparse, crc);
+  }
+  return sparse_file_write_fd(s, fd, threads, sparse, crc);
 }
 
 int sparse_file_callback(struct sparse_file* s, bool sparse, bool crc,
@@ -26,7 +26,11 @@
 #include <string.h>
 #include <unistd.h>
 #include <algorithm>
+#include <atomic>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <sparse/sparse.h>
 
@@ -84,9 +88,11 @@ class SparseFileSource {
 class SparseFileFdSource : public SparseFileSource {
  private:
   int fd;
+  /* Offset of the start of the sparse file in fd. */
+  int64_t base;
 
  public:
-  SparseFileFdSource(int fd) : fd(fd) {}
+  SparseFileFdSource(int fd, int64_t base = 0) : fd(fd), base(base) {}
   ~SparseFileFdSource() override {}
 
   int Seek(int64_t off) override {
@@ -96,7 +102,7 @@ class SparseFileFdSource : public SparseFileSource {
   int64_t GetOffset() override { return lseek64(fd, 0, SEEK_CUR); }
 
   int Rewind() override {
-    return lseek64(fd, 0, SEEK_SET) == 0 ? 0 : -errno;
+    return lseek64(fd, base, SEEK_SET) == base ? 0 : -errno;
   }
 
   int AddToSparseFile(struct sparse_file* s, int64_t len, unsigned int block) override {
@@ -457,12 +463,24 @@ static int sparse_file_read_sparse(struct sparse_file* s, SparseFileSource* sour
   return 0;
 }
 
+/*
+ * A block is a fill block if it repeats its first 32-bit word. That holds
+ * exactly when the block equals itself shifted by one word, which lets the
+ * vectorised memcmp of the C library do the scan.
+ */
+static bool is_fill_block(const uint32_t* buf, unsigned int block_size) {
+  return memcmp(buf, buf + 1, block_size - sizeof(uint32_t)) == 0;
+}
+
+/*
+ * Reads |remain| bytes of the image from the current offset of |fd|, starting
+ * at |offset| in the image. |base| is the offset of the image itself in |fd|.
+ */
 static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* buf, int64_t offset,
-                                      int64_t remain) {
+                                      int64_t remain, int64_t base = 0) {
   int ret;
   unsigned int block = offset / s->block_size;
   unsigned int to_read;
-  unsigned int i;
   bool sparse_block;
 
   if (!buf) {
@@ -478,13 +496,7 @@ static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* b
     }
 
     if (to_read == s->block_size) {
-      sparse_block = true;
-      for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-        if (buf[0] != buf[i]) {
-          sparse_block = false;
-          break;
-        }
-      }
+      sparse_block = is_fill_block(buf, s->block_size);
     } else {
       sparse_block = false;
     }
@@ -493,7 +505,7 @@ static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* b
       /* TODO: add flag to use skip instead of fill for buf[0] == 0 */
       sparse_file_add_fill(s, buf[0], to_read, block);
     } else {
-      sparse_file_add_fd(s, fd, offset, to_read, block);
+      sparse_file_add_fd(s, fd, base + offset, to_read, block);
     }
 
     remain -= to_read;
@@ -504,28 +516,18 @@ static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* b
   return 0;
 }
 
-static int sparse_file_read_normal(struct sparse_file* s, int fd) {
-  int ret;
-  uint32_t* buf = (uint32_t*)malloc(s->block_size);
-
-  if (!buf)
-    return -ENOMEM;
-
-  ret = do_sparse_file_read_normal(s, fd, buf, 0, s->len);
-  free(buf);
-  return ret;
-}
+typedef std::vector<std::pair<int64_t, int64_t>> extent_list;
 
+/*
+ * Find the [start, end) ranges of the input that hold data, using
+ * SEEK_DATA/SEEK_HOLE, so that holes can be skipped without reading them.
+ * Ranges are widened to block boundaries, and the last partial block of the
+ * input is always part of a range.
+ */
 #ifdef __linux__
-static int sparse_file_read_hole(struct sparse_file* s, int fd) {
-  int ret;
-  uint32_t* buf = (uint32_t*)malloc(s->block_size);
-  int64_t end = 0;
+static int find_data_extents(struct sparse_file* s, int fd, extent_list* extents) {
   int64_t start = 0;
-
-  if (!buf) {
-    return -ENOMEM;
-  }
+  int64_t end = 0;
 
   do {
     start = lseek(fd, end, SEEK_DATA);
@@ -534,8 +536,6 @@ static int sparse_file_read_hole(struct sparse_file* s, int fd) {
         /* The rest of the file is a hole */
         break;
 
-      error("could not seek to data");
-      free(buf);
       return -errno;
     } else if (start > s->len) {
       break;
@@ -543,35 +543,113 @@ static int sparse_file_read_hole(struct sparse_file* s, int fd) {
 
     end = lseek(fd, start, SEEK_HOLE);
     if (end < 0) {
-      error("could not seek to end");
-      free(buf);
       return -errno;
     }
     end = std::min(end, s->len);
 
     start = ALIGN_DOWN(start, s->block_size);
-    end = ALIGN(end, s->block_size);
-    if (lseek(fd, start, SEEK_SET) < 0) {
-      free(buf);
-      return -errno;
-    }
-
-    ret = do_sparse_file_read_normal(s, fd, buf, start, end - start);
-    if (ret) {
-      free(buf);
-      return ret;
+    int64_t aligned_end = std::min((int64_t)ALIGN(end, s->block_size), s->len);
+    if (!extents->empty() && start <= extents->back().second) {
+      extents->back().second = std::max(extents->back().second, aligned_end);
+    } else {
+      extents->emplace_back(start, aligned_end);
     }
   } while (end < s->len);
 
-  free(buf);
+  int64_t tail = ALIGN_DOWN(s->len, s->block_size);
+  if (tail < s->len && (extents->empty() || extents->back().second < s->len)) {
+    if (!extents->empty() && extents->back().second >= tail) {
+      extents->back().second = s->len;
+    } else {
+      extents->emplace_back(tail, s->len);
+    }
+  }
   return 0;
 }
 #else
-static int sparse_file_read_hole(struct sparse_file* s __unused, int fd __unused) {
+static int find_data_extents(struct sparse_file* s __unused, int fd __unused,
+                             extent_list* extents __unused) {
   return -ENOTSUP;
 }
 #endif
 
+/*
+ * In SPARSE_READ_MODE_NORMAL holes read back as zeros, and become zero fill
+ * chunks without being read; if holes cannot be found, the whole input is
+ * read. In SPARSE_READ_MODE_HOLE they are left out, which makes them don't
+ * care chunks.
+ */
+static int get_data_extents(struct sparse_file* s, int fd, enum sparse_read_mode mode,
+                            extent_list* extents) {
+  int ret = find_data_extents(s, fd, extents);
+  if (ret < 0) {
+    if (mode == SPARSE_READ_MODE_HOLE) {
+      error("could not find data in file");
+      return ret;
+    }
+    extents->clear();
+    extents->emplace_back(0, s->len);
+  }
+  return 0;
+}
+
+/* Add a zero fill for the hole between |*pos| and |start|, and advance |*pos| to |end|. */
+static int fill_hole(struct sparse_file* s, enum sparse_read_mode mode, int64_t* pos,
+                     int64_t start, int64_t end) {
+  int ret = 0;
+  if (mode == SPARSE_READ_MODE_NORMAL && start > *pos) {
+    ret = sparse_file_add_fill(s, 0, start - *pos, *pos / s->block_size);
+  }
+  *pos = end;
+  return ret;
+}
+
+static int sparse_file_read_extents(struct sparse_file* s, int fd, enum sparse_read_mode mode) {
+  extent_list extents;
+  int ret = get_data_extents(s, fd, mode, &extents);
+  if (ret < 0) {
+    return ret;
+  }
+
+  uint32_t* buf = (uint32_t*)malloc(s->block_size);
+  if (!buf) {
+    return -ENOMEM;
+  }
+
+  int64_t pos = 0;
+  for (const auto& [start, end] : extents) {
+    ret = fill_hole(s, mode, &pos, start, end);
+    if (ret < 0) {
+      break;
+    }
+
+    /* Finding the extents moves the file offset. Unseekable input is read whole. */
+    if (lseek64(fd, start, SEEK_SET) < 0 && !(start == 0 && errno == ESPIPE)) {
+      ret = -errno;
+      break;
+    }
+
+    ret = do_sparse_file_read_normal(s, fd, buf, start, end - start);
+    if (ret < 0) {
+      break;
+    }
+  }
+  if (ret >= 0) {
+    ret = fill_hole(s, mode, &pos, s->len, s->len);
+  }
+
+  free(buf);
+  return ret < 0 ? ret : 0;
+}
+
+static int sparse_file_read_normal(struct sparse_file* s, int fd) {
+  return sparse_file_read_extents(s, fd, SPARSE_READ_MODE_NORMAL);
+}
+
+static int sparse_file_read_hole(struct sparse_file* s, int fd) {
+  return sparse_file_read_extents(s, fd, SPARSE_READ_MODE_HOLE);
+}
+
 int sparse_file_read(struct sparse_file* s, int fd, enum sparse_read_mode mode, bool crc) {
   if (crc && mode != SPARSE_READ_MODE_SPARSE) {
     return -EINVAL;
@@ -591,6 +669,333 @@ int sparse_file_read(struct sparse_file* s, int fd, enum sparse_read_mode mode,
   }
 }
 
+/*
+ * Parallel reads split the input into stripes that are classified on worker
+ * threads. Each stripe yields a list of runs of fill or data blocks, which are
+ * added to the sparse file in order once every stripe is done, so the
+ * resulting backed block list is the same as for a sequential read.
+ */
+static constexpr int64_t PARALLEL_STRIPE_SIZE = 64 * 1024 * 1024;
+
+struct block_run {
+  int64_t offset;
+  uint64_t len;
+  bool fill;
+  uint32_t fill_val;
+};
+
+struct read_stripe {
+  int64_t offset;
+  int64_t len;
+  int ret;
+  std::vector<block_run> runs;
+};
+
+#ifndef _WIN32
+static int pread_all(int fd, void* buf, size_t len, int64_t offset) {
+  size_t total = 0;
+  char* ptr = reinterpret_cast<char*>(buf);
+
+  while (total < len) {
+    ssize_t ret = pread64(fd, ptr, len - total, offset + total);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return -errno;
+    }
+    if (ret == 0) return -EINVAL;
+    ptr += ret;
+    total += ret;
+  }
+  return 0;
+}
+
+static void classify_stripe(int fd, unsigned int block_size, read_stripe* stripe, char* buf) {
+  int64_t offset = stripe->offset;
+  int64_t end = stripe->offset + stripe->len;
+
+  while (offset < end) {
+    int64_t read_len = std::min(end - offset, COPY_BUF_SIZE);
+    stripe->ret = pread_all(fd, buf, read_len, offset);
+    if (stripe->ret < 0) {
+      return;
+    }
+
+    for (int64_t pos = 0; pos < read_len; pos += block_size) {
+      unsigned int to_read = std::min(read_len - pos, (int64_t)block_size);
+      uint32_t* block = reinterpret_cast<uint32_t*>(buf + pos);
+      bool fill = to_read == block_size && is_fill_block(block, block_size);
+
+      block_run* last = stripe->runs.empty() ? nullptr : &stripe->runs.back();
+      if (last && last->fill == fill && (!fill || last->fill_val == block[0]) &&
+          last->offset + (int64_t)last->len == offset + pos) {
+        last->len += to_read;
+      } else {
+        stripe->runs.push_back({offset + pos, to_read, fill, fill ? block[0] : 0});
+      }
+    }
+    offset += read_len;
+  }
+}
+
+int sparse_file_read_parallel(struct sparse_file* s, int fd, enum sparse_read_mode mode,
+                              unsigned int threads) {
+  if (mode == SPARSE_READ_MODE_SPARSE) {
+    return sparse_file_read(s, fd, mode, false);
+  }
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  if (threads == 1) {
+    return sparse_file_read(s, fd, mode, false);
+  }
+
+  extent_list extents;
+  int ret = get_data_extents(s, fd, mode, &extents);
+  if (ret < 0) {
+    return ret;
+  }
+
+  /* Stripes stay block aligned, so that only the last block can be short. */
+  int64_t stripe_size = ALIGN(PARALLEL_STRIPE_SIZE, s->block_size);
+  std::vector<read_stripe> stripes;
+  for (const auto& [start, end] : extents) {
+    for (int64_t offset = start; offset < end; offset += stripe_size) {
+      stripes.push_back({offset, std::min(stripe_size, end - offset), 0, {}});
+    }
+  }
+
+  std::atomic<size_t> next_stripe = 0;
+  auto worker = [&]() {
+    char* buf = reinterpret_cast<char*>(malloc(COPY_BUF_SIZE));
+    for (size_t i = next_stripe++; i < stripes.size(); i = next_stripe++) {
+      if (!buf) {
+        stripes[i].ret = -ENOMEM;
+        continue;
+      }
+      classify_stripe(fd, s->block_size, &stripes[i], buf);
+    }
+    free(buf);
+  };
+
+  std::vector<std::thread> workers;
+  threads = std::min<size_t>(threads, stripes.size());
+  for (unsigned int i = 0; i < threads; i++) {
+    workers.emplace_back(worker);
+  }
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  int64_t pos = 0;
+  for (const auto& stripe : stripes) {
+    if (stripe.ret < 0) {
+      error("failed to read sparse file");
+      return stripe.ret;
+    }
+    ret = fill_hole(s, mode, &pos, stripe.offset, stripe.offset + stripe.len);
+    if (ret < 0) {
+      return ret;
+    }
+    for (const auto& run : stripe.runs) {
+      unsigned int block = run.offset / s->block_size;
+      if (run.fill) {
+        /* TODO: add flag to use skip instead of fill for fill_val == 0 */
+        ret = sparse_file_add_fill(s, run.fill_val, run.len, block);
+      } else {
+        ret = sparse_file_add_fd(s, fd, run.offset, run.len, block);
+      }
+      if (ret < 0) {
+        return ret;
+      }
+    }
+  }
+  return fill_hole(s, mode, &pos, s->len, s->len);
+}
+#else
+int sparse_file_read_parallel(struct sparse_file* s, int fd, enum sparse_read_mode mode,
+                              unsigned int threads __unused) {
+  return sparse_file_read(s, fd, mode, false);
+}
+#endif
+
+/*
+ * State of sparse_file_read_stream(). Blocks are appended to the current piece
+ * while keeping a running count of its size in the sparse format, mirroring
+ * the accounting of sparse_file_resparse().
+ */
+struct sparse_stream {
+  int fd;
+  unsigned int block_size;
+  int64_t len;
+  unsigned int max_len;
+  int (*piece)(void* priv, struct sparse_file* s, unsigned int index);
+  void* priv;
+
+  struct sparse_file* cur;
+  unsigned int count;
+  int64_t cur_len;
+  unsigned int last_end;
+  bool last_fill;
+  uint32_t last_fill_val;
+};
+
+/* Sparse header, a trailing skip chunk and the crc chunk. */
+static constexpr int64_t STREAM_PIECE_OVERHEAD =
+    SPARSE_HEADER_LEN + 2 * CHUNK_HEADER_LEN + sizeof(uint32_t);
+
+static int sparse_stream_flush(struct sparse_stream* st) {
+  if (!st->cur) {
+    return 0;
+  }
+  int ret = st->piece(st->priv, st->cur, st->count++);
+  sparse_file_destroy(st->cur);
+  st->cur = nullptr;
+  return ret < 0 ? ret : 0;
+}
+
+/* Size the current piece grows by if the given run is added to it. */
+static int64_t sparse_stream_growth(struct sparse_stream* st, unsigned int block, uint64_t len,
+                                    bool fill, uint32_t fill_val) {
+  if (st->cur && block == st->last_end && fill == st->last_fill &&
+      (!fill || fill_val == st->last_fill_val)) {
+    return fill ? 0 : len;
+  }
+
+  int64_t growth = CHUNK_HEADER_LEN + (fill ? sizeof(uint32_t) : len);
+  if (block > (st->cur ? st->last_end : 0)) {
+    growth += CHUNK_HEADER_LEN;
+  }
+  return growth;
+}
+
+static int sparse_stream_add(struct sparse_stream* st, int64_t offset, uint64_t len, bool fill,
+                             uint32_t fill_val) {
+  unsigned int block = offset / st->block_size;
+  int64_t growth = sparse_stream_growth(st, block, len, fill, fill_val);
+
+  if (st->cur && st->max_len && st->cur_len + growth > st->max_len) {
+    int ret = sparse_stream_flush(st);
+    if (ret < 0) {
+      return ret;
+    }
+    growth = sparse_stream_growth(st, block, len, fill, fill_val);
+  }
+
+  if (!st->cur) {
+    if (st->max_len && STREAM_PIECE_OVERHEAD + growth > st->max_len) {
+      error("block %u does not fit in a sparse file of %u bytes", block, st->max_len);
+      return -EINVAL;
+    }
+    st->cur = sparse_file_new(st->block_size, st->len);
+    if (!st->cur) {
+      return -ENOMEM;
+    }
+    st->cur_len = STREAM_PIECE_OVERHEAD;
+  }
+
+  int ret;
+  if (fill) {
+    ret = sparse_file_add_fill(st->cur, fill_val, len, block);
+  } else {
+    ret = sparse_file_add_fd(st->cur, st->fd, offset, len, block);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+
+  st->cur_len += growth;
+  st->last_end = block + DIV_ROUND_UP(len, st->block_size);
+  st->last_fill = fill;
+  st->last_fill_val = fill_val;
+  return 0;
+}
+
+static int sparse_stream_read_extent(struct sparse_stream* st, char* buf, int64_t start,
+                                     int64_t end) {
+  /* Finding the extents moves the file offset. Unseekable input is read whole. */
+  if (lseek64(st->fd, start, SEEK_SET) < 0 && !(start == 0 && errno == ESPIPE)) {
+    return -errno;
+  }
+
+  for (int64_t offset = start; offset < end;) {
+    int64_t read_len = std::min(end - offset, COPY_BUF_SIZE);
+    int ret = read_all(st->fd, buf, read_len);
+    if (ret < 0) {
+      error("failed to read sparse file");
+      return ret;
+    }
+
+    for (int64_t pos = 0; pos < read_len; pos += st->block_size) {
+      unsigned int to_read = std::min(read_len - pos, (int64_t)st->block_size);
+      uint32_t* block = reinterpret_cast<uint32_t*>(buf + pos);
+      bool fill = to_read == st->block_size && is_fill_block(block, st->block_size);
+
+      ret = sparse_stream_add(st, offset + pos, to_read, fill, fill ? block[0] : 0);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+    offset += read_len;
+  }
+  return 0;
+}
+
+int sparse_file_read_stream(int fd, unsigned int block_size, int64_t len,
+                            enum sparse_read_mode mode, unsigned int max_len,
+                            int (*piece)(void* priv, struct sparse_file* s, unsigned int index),
+                            void* priv) {
+  if (mode == SPARSE_READ_MODE_SPARSE || !block_size || block_size % 4 || len < 0) {
+    return -EINVAL;
+  }
+
+  struct sparse_stream st = {};
+  st.fd = fd;
+  st.block_size = block_size;
+  st.len = len;
+  st.max_len = max_len;
+  st.piece = piece;
+  st.priv = priv;
+
+  /* Only used for block_size and len while looking for extents. */
+  struct sparse_file* layout = sparse_file_new(block_size, len);
+  if (!layout) {
+    return -ENOMEM;
+  }
+  extent_list extents;
+  int ret = get_data_extents(layout, fd, mode, &extents);
+  sparse_file_destroy(layout);
+  if (ret < 0) {
+    return ret;
+  }
+
+  char* buf = reinterpret_cast<char*>(malloc(COPY_BUF_SIZE));
+  if (!buf) {
+    return -ENOMEM;
+  }
+
+  int64_t pos = 0;
+  for (const auto& [start, end] : extents) {
+    if (mode == SPARSE_READ_MODE_NORMAL && start > pos) {
+      ret = sparse_stream_add(&st, pos, start - pos, true, 0);
+      if (ret < 0) break;
+    }
+    ret = sparse_stream_read_extent(&st, buf, start, end);
+    if (ret < 0) break;
+    pos = end;
+  }
+  if (ret >= 0 && mode == SPARSE_READ_MODE_NORMAL && len > pos) {
+    ret = sparse_stream_add(&st, pos, len - pos, true, 0);
+  }
+  free(buf);
+
+  if (ret >= 0) {
+    ret = sparse_stream_flush(&st);
+  } else if (st.cur) {
+    sparse_file_destroy(st.cur);
+  }
+  return ret < 0 ? ret : st.count;
+}
+
 static struct sparse_file* sparse_file_import_source(SparseFileSource* source, bool verbose,
                                                      bool crc) {
   int ret;
@@ -698,3 +1103,41 @@ struct sparse_file* sparse_file_import_auto(int fd, bool crc, bool verbose) {
 
   return s;
 }
+
+struct sparse_file* sparse_file_import_region(int fd, int64_t offset, int64_t len, bool crc,
+                                              bool verbose) {
+  if (offset < 0 || len <= 0) {
+    return nullptr;
+  }
+
+  if (lseek64(fd, offset, SEEK_SET) != offset) {
+    return nullptr;
+  }
+  SparseFileFdSource source(fd, offset);
+  struct sparse_file* s = sparse_file_import_source(&source, false, crc);
+  if (s) {
+    return s;
+  }
+
+  if (lseek64(fd, offset, SEEK_SET) != offset) {
+    return nullptr;
+  }
+
+  s = sparse_file_new(4096, len);
+  if (!s) {
+    return nullptr;
+  }
+  if (verbose) {
+    sparse_file_verbose(s);
+  }
+
+  uint32_t* buf = (uint32_t*)malloc(s->block_size);
+  int ret = do_sparse_file_read_normal(s, fd, buf, 0, len, offset);
+  free(buf);
+  if (ret < 0) {
+    sparse_file_destroy(s);
+    return nullptr;
+  }
+
+  return s;
+}
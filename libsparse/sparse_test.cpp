@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+#include <sparse/sparse.h>
+#include <zlib.h>
+
+using android::base::unique_fd;
+
+namespace {
+
+constexpr unsigned int kBlockSize = 4096;
+constexpr int64_t kLen = 1024 * kBlockSize;
+
+struct SparseFileDeleter {
+  void operator()(sparse_file* s) const { sparse_file_destroy(s); }
+};
+using SparseFilePtr = std::unique_ptr<sparse_file, SparseFileDeleter>;
+
+// A data chunk spanning several compression blocks, a fill chunk and holes.
+// *image receives the raw image the sparse file describes.
+SparseFilePtr MakeSparseFile(std::vector<uint8_t>* data, std::vector<uint8_t>* image) {
+  SparseFilePtr s(sparse_file_new(kBlockSize, kLen));
+  if (!s) return nullptr;
+
+  image->assign(kLen, 0);
+
+  data->resize(100 * kBlockSize);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < data->size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    // Half random, half runs, so that both compress differently.
+    (*data)[i] = (i / kBlockSize) % 2 ? seed >> 24 : i / 512;
+  }
+  if (sparse_file_add_data(s.get(), data->data(), data->size(), 10) < 0) return nullptr;
+  std::copy(data->begin(), data->end(), image->begin() + 10 * kBlockSize);
+
+  uint32_t fill = 0xdeadbeef;
+  if (sparse_file_add_fill(s.get(), fill, 16 * kBlockSize, 500) < 0) return nullptr;
+  for (size_t i = 0; i < 16 * kBlockSize; i += sizeof(fill)) {
+    memcpy(image->data() + 500 * kBlockSize + i, &fill, sizeof(fill));
+  }
+  return s;
+}
+
+bool Gunzip(const std::string& path, std::vector<uint8_t>* out) {
+  gzFile gz = gzopen(path.c_str(), "rb");
+  if (!gz) return false;
+  out->clear();
+  uint8_t buf[65536];
+  int n;
+  while ((n = gzread(gz, buf, sizeof(buf))) > 0) {
+    out->insert(out->end(), buf, buf + n);
+  }
+  return gzclose(gz) == Z_OK && n == 0;
+}
+
+// Writes |image| to |tf| and rewinds it.
+bool WriteRawImage(const std::vector<uint8_t>& image, TemporaryFile* tf) {
+  return android::base::WriteFully(tf->fd, image.data(), image.size()) &&
+         lseek(tf->fd, 0, SEEK_SET) == 0;
+}
+
+int AppendToString(void* priv, const void* data, size_t len) {
+  static_cast<std::string*>(priv)->append(static_cast<const char*>(data), len);
+  return 0;
+}
+
+std::string SparseImage(sparse_file* s) {
+  std::string out;
+  if (sparse_file_callback(s, true, true, AppendToString, &out) < 0) return "";
+  return out;
+}
+
+}  // namespace
+
+TEST(SparseWriteGz, RoundTrip) {
+  std::vector<uint8_t> data, image;
+  SparseFilePtr s = MakeSparseFile(&data, &image);
+  ASSERT_NE(s, nullptr);
+
+  for (unsigned int threads : {1u, 4u}) {
+    TemporaryFile tf;
+    ASSERT_EQ(sparse_file_write_gz(s.get(), tf.fd, false, false, threads), 0) << threads;
+    // The caller's fd stays open, whichever backend wrote it.
+    ASSERT_NE(fcntl(tf.fd, F_GETFD), -1) << threads;
+
+    std::vector<uint8_t> out;
+    ASSERT_TRUE(Gunzip(tf.path, &out)) << threads;
+    ASSERT_EQ(out, image) << threads;
+  }
+}
+
+TEST(SparseWriteGz, SparseRoundTrip) {
+  std::vector<uint8_t> data, image;
+  SparseFilePtr s = MakeSparseFile(&data, &image);
+  ASSERT_NE(s, nullptr);
+
+  TemporaryFile gz_file;
+  ASSERT_EQ(sparse_file_write_gz(s.get(), gz_file.fd, true, false, 4), 0);
+
+  std::vector<uint8_t> sparse_image;
+  ASSERT_TRUE(Gunzip(gz_file.path, &sparse_image));
+  TemporaryFile sparse_file;
+  ASSERT_TRUE(android::base::WriteFully(sparse_file.fd, sparse_image.data(), sparse_image.size()));
+  ASSERT_EQ(lseek(sparse_file.fd, 0, SEEK_SET), 0);
+
+  SparseFilePtr imported(sparse_file_import(sparse_file.fd, true, true));
+  ASSERT_NE(imported, nullptr);
+  TemporaryFile raw_file;
+  ASSERT_EQ(sparse_file_write(imported.get(), raw_file.fd, false, false, false), 0);
+
+  std::string raw;
+  ASSERT_TRUE(android::base::ReadFileToString(raw_file.path, &raw));
+  ASSERT_EQ(std::vector<uint8_t>(raw.begin(), raw.end()), image);
+}
+
+TEST(SparseWriteGz, ReportsWriteErrors) {
+  std::vector<uint8_t> data, image;
+  SparseFilePtr s = MakeSparseFile(&data, &image);
+  ASSERT_NE(s, nullptr);
+
+  for (unsigned int threads : {1u, 4u}) {
+    unique_fd full(open("/dev/full", O_WRONLY | O_CLOEXEC));
+    ASSERT_NE(full.get(), -1);
+    ASSERT_LT(sparse_file_write_gz(s.get(), full.get(), false, false, threads), 0) << threads;
+  }
+}
+
+struct StreamPieces {
+  std::vector<std::string> sparse_images;
+  // The raw image, put together from the blocks of every piece.
+  std::vector<uint8_t> image;
+  size_t pos;
+};
+
+int CollectPiece(void* priv, sparse_file* s, unsigned int index) {
+  auto* pieces = static_cast<StreamPieces*>(priv);
+  if (index != pieces->sparse_images.size()) return -EINVAL;
+  pieces->sparse_images.emplace_back(SparseImage(s));
+
+  pieces->pos = 0;
+  return sparse_file_callback(
+      s, false, false,
+      [](void* priv, const void* data, size_t len) {
+        auto* pieces = static_cast<StreamPieces*>(priv);
+        if (pieces->pos + len > pieces->image.size()) return -EINVAL;
+        if (data) {
+          memcpy(pieces->image.data() + pieces->pos, data, len);
+        }
+        pieces->pos += len;
+        return 0;
+      },
+      pieces);
+}
+
+TEST(SparseReadStream, SinglePieceMatchesSparseFileRead) {
+  std::vector<uint8_t> data, image;
+  ASSERT_NE(MakeSparseFile(&data, &image), nullptr);
+  TemporaryFile raw;
+  ASSERT_TRUE(WriteRawImage(image, &raw));
+
+  SparseFilePtr whole(sparse_file_new(kBlockSize, kLen));
+  ASSERT_EQ(sparse_file_read(whole.get(), raw.fd, SPARSE_READ_MODE_NORMAL, false), 0);
+  std::string expected = SparseImage(whole.get());
+  ASSERT_FALSE(expected.empty());
+
+  StreamPieces pieces = {.image = std::vector<uint8_t>(kLen)};
+  ASSERT_EQ(sparse_file_read_stream(raw.fd, kBlockSize, kLen, SPARSE_READ_MODE_NORMAL, 0,
+                                    CollectPiece, &pieces),
+            1);
+  ASSERT_EQ(pieces.sparse_images.size(), 1);
+  ASSERT_EQ(pieces.sparse_images[0], expected);
+  ASSERT_EQ(pieces.image, image);
+}
+
+TEST(SparseReadStream, PiecesFitAndCoverTheImage) {
+  std::vector<uint8_t> data, image;
+  ASSERT_NE(MakeSparseFile(&data, &image), nullptr);
+  TemporaryFile raw;
+  ASSERT_TRUE(WriteRawImage(image, &raw));
+
+  constexpr unsigned int kMaxLen = 64 * 1024;
+  StreamPieces pieces = {.image = std::vector<uint8_t>(kLen, 0xa5)};
+  int count = sparse_file_read_stream(raw.fd, kBlockSize, kLen, SPARSE_READ_MODE_NORMAL, kMaxLen,
+                                      CollectPiece, &pieces);
+  ASSERT_GT(count, 1);
+  ASSERT_EQ(pieces.sparse_images.size(), static_cast<size_t>(count));
+  for (const auto& sparse_image : pieces.sparse_images) {
+    EXPECT_LE(sparse_image.size(), kMaxLen);
+  }
+  ASSERT_EQ(pieces.image, image);
+
+  // A block that cannot fit in a piece is an error, not an oversized piece.
+  StreamPieces tiny = {.image = std::vector<uint8_t>(kLen)};
+  ASSERT_EQ(sparse_file_read_stream(raw.fd, kBlockSize, kLen, SPARSE_READ_MODE_NORMAL, 1024,
+                                    CollectPiece, &tiny),
+            -EINVAL);
+}
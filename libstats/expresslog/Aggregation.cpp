@@ -0,0 +1,40 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Aggregation.h"
+
+#include <statslog_express.h>
+#include <time.h>
+
+namespace android {
+namespace expresslog {
+
+int64_t elapsedRealtimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void writeCounterAtom(int64_t metricIdHash, int64_t amount) {
+    stats_write(EXPRESS_EVENT_REPORTED, metricIdHash, amount);
+}
+
+void writeHistogramAtom(int64_t metricIdHash, int64_t count, int binIndex) {
+    stats_write(EXPRESS_HISTOGRAM_SAMPLE_REPORTED, metricIdHash, count, binIndex);
+}
+
+}  // namespace expresslog
+}  // namespace android
@@ -0,0 +1,34 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include <stdint.h>
+
+namespace android {
+namespace expresslog {
+
+// Clock and atom writes used by Counter::Aggregator and Histogram::Aggregator. Implemented in
+// Aggregation.cpp; expresslog_test replaces them to observe the Aggregators.
+
+/** CLOCK_BOOTTIME in nanoseconds, so flush intervals include time spent suspended */
+int64_t elapsedRealtimeNs();
+
+void writeCounterAtom(int64_t metricIdHash, int64_t amount);
+
+void writeHistogramAtom(int64_t metricIdHash, int64_t count, int binIndex);
+
+}  // namespace expresslog
+}  // namespace android
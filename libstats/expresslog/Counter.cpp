@@ -20,6 +20,8 @@
 #include <string.h>
 #include <utils/hash/farmhash.h>
 
+#include "Aggregation.h"
+
 namespace android {
 namespace expresslog {
 
@@ -33,5 +35,35 @@ void Counter::logIncrementWithUid(const char* metricName, int32_t uid, int64_t a
     stats_write(EXPRESS_UID_EVENT_REPORTED, metricIdHash, amount, uid);
 }
 
+Counter::Aggregator::Aggregator(const char* metricName, int64_t flushThreshold,
+                                std::chrono::milliseconds flushInterval)
+    : mMetricIdHash(farmhash::Fingerprint64(metricName, strlen(metricName))),
+      mFlushThreshold(flushThreshold),
+      mFlushIntervalNs(std::chrono::nanoseconds(flushInterval).count()),
+      mLastFlushNs(elapsedRealtimeNs()) {
+}
+
+Counter::Aggregator::~Aggregator() {
+    flush();
+}
+
+void Counter::Aggregator::logIncrement(int64_t amount) {
+    const int64_t pending =
+            mPendingAmount.fetch_add(amount, std::memory_order_relaxed) + amount;
+    if (pending >= mFlushThreshold ||
+        elapsedRealtimeNs() - mLastFlushNs.load(std::memory_order_relaxed) >= mFlushIntervalNs) {
+        flush();
+    }
+}
+
+void Counter::Aggregator::flush() {
+    mLastFlushNs.store(elapsedRealtimeNs(), std::memory_order_relaxed);
+    // Only the thread that takes the sum logs it, so concurrent flushes log each increment once.
+    const int64_t amount = mPendingAmount.exchange(0, std::memory_order_relaxed);
+    if (amount != 0) {
+        writeCounterAtom(mMetricIdHash, amount);
+    }
+}
+
 }  // namespace expresslog
 }  // namespace android
@@ -23,6 +23,8 @@
 #include <string.h>
 #include <utils/hash/farmhash.h>
 
+#include "Aggregation.h"
+
 namespace android {
 namespace expresslog {
 
@@ -76,5 +78,44 @@ void Histogram::logSampleWithUid(int32_t uid, float sample) const {
     stats_write(EXPRESS_UID_HISTOGRAM_SAMPLE_REPORTED, mMetricIdHash, /*count*/ 1, binIndex, uid);
 }
 
+Histogram::Aggregator::Aggregator(const char* metricName, std::shared_ptr<BinOptions> binOptions,
+                                  int64_t flushThreshold, std::chrono::milliseconds flushInterval)
+    : mMetricIdHash(farmhash::Fingerprint64(metricName, strlen(metricName))),
+      mBinOptions(std::move(binOptions)),
+      mFlushThreshold(flushThreshold),
+      mFlushIntervalNs(std::chrono::nanoseconds(flushInterval).count()),
+      mBinCounts(new std::atomic<int64_t>[mBinOptions->getBinsCount()]()),
+      mLastFlushNs(elapsedRealtimeNs()) {
+}
+
+Histogram::Aggregator::~Aggregator() {
+    flush();
+}
+
+void Histogram::Aggregator::logSample(float sample) {
+    const int binIndex = mBinOptions->getBinForSample(sample);
+    mBinCounts[binIndex].fetch_add(1, std::memory_order_relaxed);
+    const int64_t pending = mPendingSamples.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (pending >= mFlushThreshold ||
+        elapsedRealtimeNs() - mLastFlushNs.load(std::memory_order_relaxed) >= mFlushIntervalNs) {
+        flush();
+    }
+}
+
+void Histogram::Aggregator::flush() {
+    mLastFlushNs.store(elapsedRealtimeNs(), std::memory_order_relaxed);
+    if (mPendingSamples.exchange(0, std::memory_order_relaxed) == 0) {
+        // No sample since the last flush, so there is no bin to log
+        return;
+    }
+    // Only the thread that takes a bin's count logs it, so concurrent flushes log each sample once.
+    for (int i = 0, bins = mBinOptions->getBinsCount(); i < bins; i++) {
+        const int64_t count = mBinCounts[i].exchange(0, std::memory_order_relaxed);
+        if (count != 0) {
+            writeHistogramAtom(mMetricIdHash, count, i);
+        }
+    }
+}
+
 }  // namespace expresslog
 }  // namespace android
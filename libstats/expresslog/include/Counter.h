@@ -17,6 +17,9 @@
 #pragma once
 #include <stdint.h>
 
+#include <atomic>
+#include <chrono>
+
 namespace android {
 namespace expresslog {
 
@@ -26,6 +29,40 @@ public:
     static void logIncrement(const char* metricId, int64_t amount = 1);
 
     static void logIncrementWithUid(const char* metricId, int32_t uid, int64_t amount = 1);
+
+    /**
+     * Sums increments in process and logs them as a single atom, for counters incremented in
+     * hot paths. The sum is logged once it reaches flushThreshold, on the first increment after
+     * flushInterval has passed since the last flush, on flush(), and when the Aggregator is
+     * destroyed.
+     *
+     * The atom is timestamped when it is logged, not when the increments happened, so increments
+     * can land in a later statsd bucket than they would have without aggregation, by up to
+     * flushInterval. Increments that are pending when the process dies are lost.
+     */
+    class Aggregator final {
+    public:
+        Aggregator(const char* metricName, int64_t flushThreshold,
+                   std::chrono::milliseconds flushInterval);
+        ~Aggregator();
+
+        Aggregator(const Aggregator&) = delete;
+        Aggregator& operator=(const Aggregator&) = delete;
+
+        void logIncrement(int64_t amount = 1);
+
+        /**
+         * Logs the pending sum, if there is one
+         */
+        void flush();
+
+    private:
+        const int64_t mMetricIdHash;
+        const int64_t mFlushThreshold;
+        const int64_t mFlushIntervalNs;
+        std::atomic<int64_t> mPendingAmount = 0;
+        std::atomic<int64_t> mLastFlushNs;
+    };
 };
 
 }  // namespace expresslog
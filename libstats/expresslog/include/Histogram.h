@@ -17,6 +17,8 @@
 #pragma once
 #include <stdint.h>
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 
 namespace android {
@@ -77,6 +79,43 @@ public:
      */
     void logSampleWithUid(int32_t uid, float sample) const;
 
+    /**
+     * Counts samples per bin in process and logs each non-empty bin as a single atom, for
+     * histograms sampled in hot paths. Samples are binned locally with getBinForSample(). The
+     * counts are logged once the number of pending samples reaches flushThreshold, on the first
+     * sample after flushInterval has passed since the last flush, on flush(), and when the
+     * Aggregator is destroyed.
+     *
+     * The atoms are timestamped when they are logged, not when the samples were taken, so samples
+     * can land in a later statsd bucket than they would have without aggregation, by up to
+     * flushInterval. Samples that are pending when the process dies are lost.
+     */
+    class Aggregator final {
+    public:
+        Aggregator(const char* metricName, std::shared_ptr<BinOptions> binOptions,
+                   int64_t flushThreshold, std::chrono::milliseconds flushInterval);
+        ~Aggregator();
+
+        Aggregator(const Aggregator&) = delete;
+        Aggregator& operator=(const Aggregator&) = delete;
+
+        void logSample(float sample);
+
+        /**
+         * Logs the pending bin counts, if there are any
+         */
+        void flush();
+
+    private:
+        const int64_t mMetricIdHash;
+        const std::shared_ptr<BinOptions> mBinOptions;
+        const int64_t mFlushThreshold;
+        const int64_t mFlushIntervalNs;
+        const std::unique_ptr<std::atomic<int64_t>[]> mBinCounts;
+        std::atomic<int64_t> mPendingSamples = 0;
+        std::atomic<int64_t> mLastFlushNs;
+    };
+
 private:
     const int64_t mMetricIdHash;
     const std::shared_ptr<BinOptions> mBinOptions;
@@ -0,0 +1,165 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <utils/hash/farmhash.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "Aggregation.h"
+#include "Counter.h"
+#include "Histogram.h"
+
+namespace android {
+namespace expresslog {
+
+// Replace Aggregation.cpp, so that the tests control the clock and see the atoms written.
+static std::atomic<int64_t> sNowNs = 0;
+static std::mutex sAtomsLock;
+static std::vector<std::tuple<int64_t, int64_t>> sCounterAtoms;
+static std::vector<std::tuple<int64_t, int64_t, int>> sHistogramAtoms;
+
+int64_t elapsedRealtimeNs() {
+    return sNowNs;
+}
+
+void writeCounterAtom(int64_t metricIdHash, int64_t amount) {
+    std::lock_guard<std::mutex> lock(sAtomsLock);
+    sCounterAtoms.emplace_back(metricIdHash, amount);
+}
+
+void writeHistogramAtom(int64_t metricIdHash, int64_t count, int binIndex) {
+    std::lock_guard<std::mutex> lock(sAtomsLock);
+    sHistogramAtoms.emplace_back(metricIdHash, count, binIndex);
+}
+
+static constexpr char kMetric[] = "expresslog_test.aggregated";
+static const int64_t kMetricIdHash = farmhash::Fingerprint64(kMetric, strlen(kMetric));
+
+class AggregatorTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        sNowNs = 0;
+        sCounterAtoms.clear();
+        sHistogramAtoms.clear();
+    }
+};
+
+TEST_F(AggregatorTest, CounterFlushesAtThreshold) {
+    Counter::Aggregator counter(kMetric, 10, std::chrono::hours(1));
+    counter.logIncrement(4);
+    counter.logIncrement(5);
+    EXPECT_TRUE(sCounterAtoms.empty());
+    counter.logIncrement(3);
+    ASSERT_EQ(1u, sCounterAtoms.size());
+    EXPECT_EQ(std::make_tuple(kMetricIdHash, int64_t{12}), sCounterAtoms[0]);
+}
+
+TEST_F(AggregatorTest, CounterFlushesAfterInterval) {
+    Counter::Aggregator counter(kMetric, 1000, std::chrono::seconds(1));
+    counter.logIncrement();
+    sNowNs = 999'999'999;
+    counter.logIncrement();
+    EXPECT_TRUE(sCounterAtoms.empty());
+    sNowNs = 1'000'000'000;
+    counter.logIncrement();
+    ASSERT_EQ(1u, sCounterAtoms.size());
+    EXPECT_EQ(std::make_tuple(kMetricIdHash, int64_t{3}), sCounterAtoms[0]);
+}
+
+TEST_F(AggregatorTest, CounterFlushesOnDestruction) {
+    {
+        Counter::Aggregator counter(kMetric, 1000, std::chrono::hours(1));
+        counter.flush();
+        EXPECT_TRUE(sCounterAtoms.empty());
+        counter.logIncrement(7);
+    }
+    ASSERT_EQ(1u, sCounterAtoms.size());
+    EXPECT_EQ(std::make_tuple(kMetricIdHash, int64_t{7}), sCounterAtoms[0]);
+}
+
+TEST_F(AggregatorTest, CounterLogsEachIncrementOnce) {
+    constexpr int kThreads = 4;
+    constexpr int kIncrements = 10000;
+    {
+        Counter::Aggregator counter(kMetric, 100, std::chrono::hours(1));
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; i++) {
+            threads.emplace_back([&counter] {
+                for (int j = 0; j < kIncrements; j++) {
+                    counter.logIncrement();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    int64_t total = 0;
+    for (const auto& [hash, amount] : sCounterAtoms) {
+        total += amount;
+    }
+    EXPECT_EQ(kThreads * kIncrements, total);
+}
+
+TEST_F(AggregatorTest, HistogramCountsPerBin) {
+    Histogram::Aggregator histogram(kMetric, Histogram::UniformOptions::create(10, 0, 100), 5,
+                                    std::chrono::hours(1));
+    histogram.logSample(-1);
+    histogram.logSample(15);
+    histogram.logSample(15);
+    histogram.logSample(1000);
+    EXPECT_TRUE(sHistogramAtoms.empty());
+    histogram.logSample(19);
+    // Underflow, 10..20 and overflow, in bin order.
+    ASSERT_EQ(3u, sHistogramAtoms.size());
+    EXPECT_EQ(std::make_tuple(kMetricIdHash, int64_t{1}, 0), sHistogramAtoms[0]);
+    EXPECT_EQ(std::make_tuple(kMetricIdHash, int64_t{3}, 2), sHistogramAtoms[1]);
+    EXPECT_EQ(std::make_tuple(kMetricIdHash, int64_t{1}, 11), sHistogramAtoms[2]);
+
+    // The pending count starts over after a flush.
+    for (int i = 0; i < 4; i++) {
+        histogram.logSample(50);
+    }
+    EXPECT_EQ(3u, sHistogramAtoms.size());
+}
+
+TEST_F(AggregatorTest, HistogramFlushesAfterIntervalAndOnDestruction) {
+    {
+        Histogram::Aggregator histogram(kMetric, Histogram::UniformOptions::create(10, 0, 100),
+                                        1000, std::chrono::seconds(1));
+        histogram.logSample(5);
+        sNowNs = 1'000'000'000;
+        histogram.logSample(5);
+        ASSERT_EQ(1u, sHistogramAtoms.size());
+        EXPECT_EQ(std::make_tuple(kMetricIdHash, int64_t{2}, 1), sHistogramAtoms[0]);
+
+        histogram.flush();
+        EXPECT_EQ(1u, sHistogramAtoms.size());
+        histogram.logSample(95);
+    }
+    ASSERT_EQ(2u, sHistogramAtoms.size());
+    EXPECT_EQ(std::make_tuple(kMetricIdHash, int64_t{1}, 10), sHistogramAtoms[1]);
+}
+
+}  // namespace expresslog
+}  // namespace android
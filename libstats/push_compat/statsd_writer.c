@@ -195,8 +195,10 @@ static int statsdWrite(struct timespec* ts, struct iovec* vec, size_t nr) {
     newVec[0].iov_base = (unsigned char*)&header;
     newVec[0].iov_len = sizeof(header);
 
-    // If we dropped events before, try to tell statsd.
-    if (sock >= 0) {
+    // If we dropped events before, try to tell statsd. Check before taking the
+    // count, so that threads logging at a high rate only share a read of
+    // |dropped| rather than all writing to it.
+    if (sock >= 0 && atomic_load_explicit(&dropped, memory_order_relaxed)) {
         int32_t snapshot = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
         if (snapshot) {
             android_log_event_long_t buffer;
@@ -113,3 +113,15 @@ void autosuspend_set_wakeup_callback(void (*func)(bool success)) {
 
     autosuspend_ops->set_wakeup_callback(func);
 }
+
+int autosuspend_get_stats(struct autosuspend_stats* stats) {
+    int ret;
+
+    ret = autosuspend_init();
+    if (ret) {
+        return ret;
+    }
+
+    autosuspend_ops->get_stats(stats);
+    return 0;
+}
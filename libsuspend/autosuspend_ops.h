@@ -22,10 +22,19 @@ struct autosuspend_ops {
     int (*disable)(void);
     int (*force_suspend)(int timeout_ms);
     void (*set_wakeup_callback)(void (*func)(bool success));
+    void (*get_stats)(struct autosuspend_stats* stats);
 };
 
 __BEGIN_DECLS
 struct autosuspend_ops *autosuspend_wakeup_count_init(void);
 __END_DECLS
 
+#ifdef __cplusplus
+#include <string>
+
+// Appends the names of the active wakeup sources in |table|, the contents of
+// /sys/kernel/debug/wakeup_sources, to *names. Returns whether any are active.
+bool parse_wakeup_sources_table(const std::string& table, std::string* names);
+#endif
+
 #endif
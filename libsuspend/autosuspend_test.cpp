@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <gtest/gtest.h>
+#include <suspend/autosuspend.h>
+
+#include "autosuspend_ops.h"
+
+// As printed by the kernel's wakeup_sources_stats_show().
+static constexpr char kTable[] =
+        "name\t\tactive_count\tevent_count\twakeup_count\texpire_count\tactive_since\t"
+        "total_time\tmax_time\tlast_change\tprevent_suspend_time\n"
+        "idle        \t3\t\t3\t\t0\t\t0\t\t0\t\t12\t\t5\t\t1000\t\t0\n"
+        "PowerManagerService.WakeLocks\t7\t\t7\t\t0\t\t0\t\t4200\t\t900\t\t300\t\t2000\t\t0\n"
+        "radio-interface\t1\t\t1\t\t0\t\t0\t\t0\t\t10\t\t10\t\t1500\t\t0\n"
+        "battery event\t2\t\t2\t\t1\t\t0\t\t17\t\t30\t\t20\t\t3000\t\t0\n";
+
+TEST(AutosuspendTest, ParseWakeupSourcesTable) {
+    std::string names;
+    ASSERT_TRUE(parse_wakeup_sources_table(kTable, &names));
+    EXPECT_EQ(names, "PowerManagerService.WakeLocks battery event");
+}
+
+TEST(AutosuspendTest, ParseWakeupSourcesTableNoneActive) {
+    std::string names;
+    EXPECT_FALSE(parse_wakeup_sources_table(
+            "name\t\tactive_count\tevent_count\twakeup_count\texpire_count\tactive_since\n"
+            "idle        \t3\t\t3\t\t0\t\t0\t\t0\t\t12\t\t5\t\t1000\t\t0\n"
+            "truncated\t1\t\t1\n"
+            "\n",
+            &names));
+    EXPECT_EQ(names, "");
+}
@@ -17,6 +17,7 @@
 #define LOG_TAG "libsuspend"
 //#define LOG_NDEBUG 0
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -26,21 +27,34 @@
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
+#include <suspend/autosuspend.h>
 
 #include "autosuspend_ops.h"
 
 #define BASE_SLEEP_TIME 100000
 #define MAX_SLEEP_TIME 60000000
+// number of quick retries after wakeup events that left no wakeup source active
+#define MAX_TRANSIENT_RETRIES 3
 
 static int state_fd = -1;
 static int wakeup_count_fd;
 
+using android::base::ParseUint;
 using android::base::ReadFdToString;
+using android::base::ReadFileToString;
+using android::base::Split;
 using android::base::Trim;
 using android::base::WriteStringToFd;
 
@@ -49,26 +63,139 @@ static sem_t suspend_lockout;
 static constexpr char sleep_state[] = "mem";
 static void (*wakeup_func)(bool success) = NULL;
 static int sleep_time = BASE_SLEEP_TIME;
+static int transient_retries = 0;
 static constexpr char sys_power_state[] = "/sys/power/state";
 static constexpr char sys_power_wakeup_count[] = "/sys/power/wakeup_count";
+static constexpr char sys_class_wakeup[] = "/sys/class/wakeup";
+static constexpr char debugfs_wakeup_sources[] = "/sys/kernel/debug/wakeup_sources";
 static bool autosuspend_is_init = false;
 
-static void update_sleep_time(bool success) {
-    if (success) {
+static std::atomic<uint64_t> stat_attempts;
+static std::atomic<uint64_t> stat_failures;
+static std::atomic<uint64_t> stat_wakeup_aborts;
+static std::atomic<uint64_t> stat_failed_time_us;
+static std::atomic<uint64_t> stat_last_attempt_time_us;
+static std::atomic<uint64_t> stat_backoff_us{BASE_SLEEP_TIME};
+
+enum attempt_result {
+    ATTEMPT_SUCCESS,
+    // a wakeup event arrived between reading and writing back wakeup_count
+    ATTEMPT_WAKEUP_ABORT,
+    ATTEMPT_FAILURE,
+};
+
+static uint64_t boottime_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Append the names of the wakeup sources currently held to *names. Sources
+// are read from sysfs, or from debugfs on kernels without /sys/class/wakeup.
+static bool get_active_wakeup_sources(std::string* names) {
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(sys_class_wakeup), closedir);
+    if (dir) {
+        bool active = false;
+        while (struct dirent* de = readdir(dir.get())) {
+            if (de->d_name[0] == '.') continue;
+            std::string path = std::string(sys_class_wakeup) + "/" + de->d_name;
+            std::string value;
+            uint64_t active_time_ms;
+            // active_time_ms is non-zero only while the source is held
+            if (!ReadFileToString(path + "/active_time_ms", &value) ||
+                !ParseUint(Trim(value), &active_time_ms) || active_time_ms == 0) {
+                continue;
+            }
+            if (!ReadFileToString(path + "/name", &value)) value = de->d_name;
+            if (active) names->append(" ");
+            names->append(Trim(value));
+            active = true;
+        }
+        return active;
+    }
+
+    std::string table;
+    if (!ReadFileToString(debugfs_wakeup_sources, &table)) {
+        return false;
+    }
+    return parse_wakeup_sources_table(table, names);
+}
+
+bool parse_wakeup_sources_table(const std::string& table, std::string* names) {
+    // name active_count event_count wakeup_count expire_count active_since ...
+    // The name ends at the first tab; the columns after it are separated by
+    // runs of tabs, so empty fields are dropped.
+    bool active = false;
+    bool header = true;
+    for (const auto& line : Split(table, "\n")) {
+        if (header) {
+            header = false;
+            continue;
+        }
+        size_t name_end = line.find('\t');
+        if (name_end == std::string::npos) continue;
+        std::vector<std::string> fields;
+        for (auto& field : Split(line.substr(name_end), " \t")) {
+            if (!field.empty()) fields.emplace_back(std::move(field));
+        }
+        uint64_t active_since;
+        if (fields.size() < 5 || !ParseUint(fields[4], &active_since) || active_since == 0) {
+            continue;
+        }
+        if (active) names->append(" ");
+        names->append(Trim(line.substr(0, name_end)));
+        active = true;
+    }
+    return active;
+}
+
+static void update_sleep_time(attempt_result result) {
+    if (result == ATTEMPT_SUCCESS) {
         sleep_time = BASE_SLEEP_TIME;
+        transient_retries = 0;
         return;
     }
+
+    // A wakeup event that has already been handled, and left no wakeup source
+    // held, does not make the next attempt any more likely to fail. Retry
+    // quickly rather than staying awake for the back-off, but only a few times
+    // so that a steady stream of events still backs off.
+    if (result == ATTEMPT_WAKEUP_ABORT && transient_retries < MAX_TRANSIENT_RETRIES) {
+        std::string names;
+        if (!get_active_wakeup_sources(&names)) {
+            transient_retries++;
+            sleep_time = BASE_SLEEP_TIME;
+            return;
+        }
+        LOG(INFO) << "suspend aborted, active wakeup sources: " << names;
+    }
+
     // double sleep time after each failure up to one minute
+    transient_retries = 0;
     sleep_time = MIN(sleep_time * 2, MAX_SLEEP_TIME);
 }
 
+static void record_attempt(attempt_result result, uint64_t start_us) {
+    uint64_t elapsed_us = boottime_us() - start_us;
+    stat_attempts++;
+    stat_last_attempt_time_us = elapsed_us;
+    if (result != ATTEMPT_SUCCESS) {
+        stat_failures++;
+        stat_failed_time_us += elapsed_us;
+    }
+    if (result == ATTEMPT_WAKEUP_ABORT) {
+        stat_wakeup_aborts++;
+    }
+}
+
 static void* suspend_thread_func(void* arg __attribute__((unused))) {
-    bool success = true;
+    attempt_result result = ATTEMPT_SUCCESS;
 
     while (true) {
-        update_sleep_time(success);
+        update_sleep_time(result);
+        stat_backoff_us = sleep_time;
         usleep(sleep_time);
-        success = false;
+        result = ATTEMPT_FAILURE;
         LOG(VERBOSE) << "read wakeup_count";
         lseek(wakeup_count_fd, 0, SEEK_SET);
         std::string wakeup_count;
@@ -91,9 +218,11 @@ static void* suspend_thread_func(void* arg __attribute__((unused))) {
         }
 
         LOG(VERBOSE) << "write " << wakeup_count << " to wakeup_count";
+        uint64_t start_us = boottime_us();
         if (WriteStringToFd(wakeup_count, wakeup_count_fd)) {
             LOG(VERBOSE) << "write " << sleep_state << " to " << sys_power_state;
-            success = WriteStringToFd(sleep_state, state_fd);
+            bool success = WriteStringToFd(sleep_state, state_fd);
+            result = success ? ATTEMPT_SUCCESS : ATTEMPT_FAILURE;
 
             void (*func)(bool success) = wakeup_func;
             if (func != NULL) {
@@ -101,7 +230,9 @@ static void* suspend_thread_func(void* arg __attribute__((unused))) {
             }
         } else {
             PLOG(ERROR) << "error writing to " << sys_power_wakeup_count;
+            result = ATTEMPT_WAKEUP_ABORT;
         }
+        record_attempt(result, start_us);
 
         LOG(VERBOSE) << "release sem";
         ret = sem_post(&suspend_lockout);
@@ -216,7 +347,7 @@ static int force_suspend(int timeout_ms) {
     return WriteStringToFd(sleep_state, state_fd) ? 0 : -1;
 }
 
-static void autosuspend_set_wakeup_callback(void (*func)(bool success)) {
+static void autosuspend_wakeup_count_set_wakeup_callback(void (*func)(bool success)) {
     if (wakeup_func != NULL) {
         LOG(ERROR) << "duplicate wakeup callback applied, keeping original";
         return;
@@ -224,11 +355,21 @@ static void autosuspend_set_wakeup_callback(void (*func)(bool success)) {
     wakeup_func = func;
 }
 
+static void autosuspend_wakeup_count_get_stats(struct autosuspend_stats* stats) {
+    stats->attempts = stat_attempts;
+    stats->failures = stat_failures;
+    stats->wakeup_aborts = stat_wakeup_aborts;
+    stats->failed_time_us = stat_failed_time_us;
+    stats->last_attempt_time_us = stat_last_attempt_time_us;
+    stats->backoff_us = stat_backoff_us;
+}
+
 struct autosuspend_ops autosuspend_wakeup_count_ops = {
     .enable = autosuspend_wakeup_count_enable,
     .disable = autosuspend_wakeup_count_disable,
     .force_suspend = force_suspend,
-    .set_wakeup_callback = autosuspend_set_wakeup_callback,
+    .set_wakeup_callback = autosuspend_wakeup_count_set_wakeup_callback,
+    .get_stats = autosuspend_wakeup_count_get_stats,
 };
 
 struct autosuspend_ops* autosuspend_wakeup_count_init(void) {
@@ -19,6 +19,7 @@
 
 #include <sys/cdefs.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 __BEGIN_DECLS
 
@@ -64,6 +65,30 @@ int autosuspend_force_suspend(int timeout_ms);
  */
 void autosuspend_set_wakeup_callback(void (*func)(bool success));
 
+struct autosuspend_stats {
+    /* Suspend attempts, i.e. writes to /sys/power/wakeup_count. */
+    uint64_t attempts;
+    /* Attempts that did not suspend, including those aborted by a wakeup event. */
+    uint64_t failures;
+    /* Failures where a wakeup event arrived after wakeup_count was read. */
+    uint64_t wakeup_aborts;
+    /* Time spent in failed attempts, in microseconds. */
+    uint64_t failed_time_us;
+    /* Duration of the last attempt, including time suspended, in microseconds. */
+    uint64_t last_attempt_time_us;
+    /* Current delay before the next attempt, in microseconds. */
+    uint64_t backoff_us;
+};
+
+/*
+ * autosuspend_get_stats
+ *
+ * Fills stats with counters on autosuspend attempts since the process started.
+ *
+ * Returns 0 on success, -1 if autosuspend could not be initialized.
+ */
+int autosuspend_get_stats(struct autosuspend_stats* stats);
+
 __END_DECLS
 
 #endif
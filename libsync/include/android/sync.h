@@ -37,6 +37,8 @@
  * break builds.
  */
 
+#include <stddef.h>
+
 #include "../ndk/sync.h"
 
 __BEGIN_DECLS
@@ -44,6 +46,28 @@ __BEGIN_DECLS
 /* timeout in msecs */
 int sync_wait(int fd, int timeout);
 
+enum sync_wait_mode {
+    SYNC_WAIT_ALL = 0,
+    SYNC_WAIT_ANY = 1,
+};
+
+/* Waits on |count| sync files with a single poll() set, for up to |timeout|
+ * msecs in total (-1 waits forever).
+ *
+ * With SYNC_WAIT_ALL, returns 0 once every sync file has signaled. With
+ * SYNC_WAIT_ANY, returns the index in |fds| of a signaled sync file. On
+ * timeout returns -1 with errno set to ETIME, and on error returns -1 with
+ * errno set as sync_wait() does.
+ */
+int sync_wait_many(const int* fds, size_t count, int timeout, enum sync_wait_mode mode);
+
+/* Merges |count| sync files into a single new one, like repeated calls to
+ * sync_merge() but without handing back the intermediate sync files. With a
+ * single input, returns a dup() of it. The inputs remain valid, and the caller
+ * is responsible for closing them and the result.
+ */
+int sync_merge_many(const char* name, const int* fds, size_t count);
+
 __END_DECLS
 
 #endif /* __SYS_CORE_SYNC_H */
@@ -23,6 +23,8 @@
 #include <stdatomic.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -151,6 +153,91 @@ int sync_wait(int fd, int timeout)
     return ret;
 }
 
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int sync_wait_many(const int *fds, size_t count, int timeout, enum sync_wait_mode mode)
+{
+    struct pollfd *pfds;
+    size_t remaining;
+    int64_t deadline;
+    size_t i;
+    int ret;
+
+    if (fds == NULL || count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (fds[i] < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    pfds = malloc(count * sizeof(*pfds));
+    if (pfds == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+    }
+
+    deadline = timeout < 0 ? -1 : now_ms() + timeout;
+    remaining = count;
+    while (1) {
+        int wait_ms = timeout;
+        if (deadline >= 0) {
+            int64_t left = deadline - now_ms();
+            wait_ms = left > 0 ? (int)left : 0;
+        }
+
+        ret = poll(pfds, count, wait_ms);
+        if (ret == -1) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            break;
+        }
+        if (ret == 0) {
+            errno = ETIME;
+            ret = -1;
+            break;
+        }
+
+        for (i = 0; i < count; i++) {
+            if (pfds[i].revents == 0)
+                continue;
+            if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+                errno = EINVAL;
+                ret = -1;
+                goto out;
+            }
+            if (mode == SYNC_WAIT_ANY) {
+                ret = (int)i;
+                goto out;
+            }
+            // Signaled fences stay signaled; stop polling this one.
+            pfds[i].fd = -1;
+            remaining--;
+        }
+        if (remaining == 0) {
+            ret = 0;
+            break;
+        }
+    }
+
+out:
+    free(pfds);
+    return ret;
+}
+
 static int legacy_sync_merge(const char *name, int fd1, int fd2)
 {
     struct sync_legacy_merge_data data;
@@ -206,6 +293,72 @@ int sync_merge(const char *name, int fd1, int fd2)
     return ret;
 }
 
+int sync_merge_many(const char *name, const int *fds, size_t count)
+{
+    int *merged;
+    size_t n;
+    size_t i;
+    int ret;
+
+    if (fds == NULL || count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (count == 1)
+        return dup(fds[0]);
+
+    // Merge pairwise as a balanced tree, so each fence is copied into
+    // log2(count) intermediate sync files rather than up to count of them.
+    n = (count + 1) / 2;
+    merged = malloc(n * sizeof(*merged));
+    if (merged == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        merged[i] = 2 * i + 1 < count ? sync_merge(name, fds[2 * i], fds[2 * i + 1])
+                                      : dup(fds[2 * i]);
+        if (merged[i] < 0)
+            goto fail;
+    }
+
+    while (n > 1) {
+        size_t next = (n + 1) / 2;
+        for (i = 0; i < next; i++) {
+            int fd;
+            if (2 * i + 1 >= n) {
+                merged[i] = merged[2 * i];
+                continue;
+            }
+            fd = sync_merge(name, merged[2 * i], merged[2 * i + 1]);
+            close(merged[2 * i]);
+            close(merged[2 * i + 1]);
+            merged[i] = fd;
+            if (fd < 0) {
+                size_t j;
+                ret = errno;
+                for (j = 2 * i + 2; j < n; j++)
+                    close(merged[j]);
+                errno = ret;
+                goto fail;
+            }
+        }
+        n = next;
+    }
+
+    ret = merged[0];
+    free(merged);
+    return ret;
+
+fail:
+    ret = errno;
+    while (i-- > 0)
+        close(merged[i]);
+    free(merged);
+    errno = ret;
+    return -1;
+}
+
 static struct sync_fence_info_data *legacy_sync_fence_info(int fd)
 {
     struct sync_fence_info_data *legacy_info;
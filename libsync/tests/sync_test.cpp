@@ -477,6 +477,78 @@ TEST(FenceTest, MultiTimelineWait) {
     ASSERT_EQ(mergedFence.wait(100), 0);
 }
 
+TEST(FenceTest, WaitManyAll) {
+    SyncTimeline timelineA, timelineB;
+
+    SyncFence fenceA(timelineA, 5);
+    SyncFence fenceB(timelineB, 5);
+    ASSERT_TRUE(fenceA.isValid());
+    ASSERT_TRUE(fenceB.isValid());
+    int fds[] = {fenceA.getFd(), fenceB.getFd()};
+
+    ASSERT_EQ(sync_wait_many(fds, 2, 0, SYNC_WAIT_ALL), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    timelineA.inc(5);
+    ASSERT_EQ(sync_wait_many(fds, 2, 0, SYNC_WAIT_ALL), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    timelineB.inc(5);
+    ASSERT_EQ(sync_wait_many(fds, 2, 100, SYNC_WAIT_ALL), 0);
+}
+
+TEST(FenceTest, WaitManyAny) {
+    SyncTimeline timelineA, timelineB;
+
+    SyncFence fenceA(timelineA, 5);
+    SyncFence fenceB(timelineB, 5);
+    int fds[] = {fenceA.getFd(), fenceB.getFd()};
+
+    ASSERT_EQ(sync_wait_many(fds, 2, 0, SYNC_WAIT_ANY), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    timelineB.inc(5);
+    ASSERT_EQ(sync_wait_many(fds, 2, 100, SYNC_WAIT_ANY), 1);
+}
+
+TEST(FenceTest, WaitManyInvalid) {
+    int fds[] = {-1};
+    ASSERT_EQ(sync_wait_many(fds, 1, 0, SYNC_WAIT_ALL), -1);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_EQ(sync_wait_many(fds, 0, 0, SYNC_WAIT_ALL), -1);
+    ASSERT_EQ(errno, EINVAL);
+}
+
+TEST(FenceTest, MergeMany) {
+    SyncTimeline timelines[5];
+    vector<SyncFence> fences;
+    vector<int> fds;
+    for (auto& timeline : timelines) {
+        fences.emplace_back(timeline, 5);
+        ASSERT_TRUE(fences.back().isValid());
+    }
+    for (auto& fence : fences) {
+        fds.push_back(fence.getFd());
+    }
+
+    int fd = sync_merge_many("mergeMany", fds.data(), fds.size());
+    ASSERT_GE(fd, 0);
+
+    struct sync_file_info* info = sync_file_info(fd);
+    ASSERT_TRUE(info != NULL);
+    EXPECT_EQ(info->num_fences, 5u);
+    sync_file_info_free(info);
+
+    for (int i = 0; i < 4; i++) {
+        timelines[i].inc(5);
+        ASSERT_EQ(sync_wait(fd, 0), -1);
+        ASSERT_EQ(errno, ETIME);
+    }
+    timelines[4].inc(5);
+    ASSERT_EQ(sync_wait(fd, 100), 0);
+    close(fd);
+}
+
 TEST(FenceTest, GetInfoActive) {
     SyncTimeline timeline;
     ASSERT_TRUE(timeline.isValid());
@@ -34,7 +34,6 @@ private:
     int mCommandCount;
     bool mWithSeq;
     std::vector<FrameworkCommand*> mCommands;
-    bool mSkipToNextNullByte;
 
 public:
     FrameworkListener(const char *socketName);
@@ -16,6 +16,8 @@
 #ifndef _NETLINKEVENT_H
 #define _NETLINKEVENT_H
 
+#include <stdint.h>
+
 #include <sysutils/NetlinkListener.h>
 
 #define NL_PARAMS_MAX 32
@@ -42,12 +44,21 @@ private:
     Action mAction;
     char *mSubsystem;
     char *mParams[NL_PARAMS_MAX];
+    // Length of each param's name, to skip most comparisons in findParam().
+    uint32_t mParamNameLens[NL_PARAMS_MAX];
+    // Whether mPath, mSubsystem and mParams point into the decoded buffer.
+    bool mInPlace;
 
 public:
     NetlinkEvent();
     virtual ~NetlinkEvent();
 
     bool decode(char *buffer, int size, int format = NetlinkListener::NETLINK_FORMAT_ASCII);
+    // Same as decode(), but an ASCII uevent's path, subsystem and params are
+    // left in the buffer instead of being copied, so the buffer must not
+    // change until the event is destroyed.
+    bool decodeInPlace(char *buffer, int size,
+                       int format = NetlinkListener::NETLINK_FORMAT_ASCII);
     const char *findParam(const char *paramName);
 
     const char *getSubsystem() { return mSubsystem; }
@@ -65,6 +76,9 @@ public:
     bool parseRtMessage(const struct nlmsghdr *nh);
     bool parseNdUserOptMessage(const struct nlmsghdr *nh);
     struct nlattr* findNlAttr(const nlmsghdr* nl, size_t hdrlen, uint16_t attr);
+
+  private:
+    void indexParams();
 };
 
 #endif
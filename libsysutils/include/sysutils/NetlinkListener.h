@@ -23,6 +23,7 @@ class NetlinkEvent;
 class NetlinkListener : public SocketListener {
     char mBuffer[64 * 1024] __attribute__((aligned(4)));
     int mFormat;
+    bool mBatchedRecv;
 
 public:
     static const int NETLINK_FORMAT_ASCII = 0;
@@ -41,9 +42,19 @@ public:
 #endif
     virtual ~NetlinkListener() {}
 
+    // Receives up to kRecvBatchSize messages per wakeup with recvmmsg()
+    // instead of one. Each message then gets kRecvBatchSize-th of the buffer,
+    // and any message that doesn't fit is dropped.
+    static const int kRecvBatchSize = 4;
+    void setBatchedRecv(bool batched) { mBatchedRecv = batched; }
+
 protected:
     virtual bool onDataAvailable(SocketClient *cli);
     virtual void onEvent(NetlinkEvent *evt) = 0;
+
+private:
+    bool recvBatch(int socket);
+    void dispatchEvent(char *buffer, ssize_t count);
 };
 
 #endif
@@ -28,6 +28,8 @@ class SocketClient {
 
     bool mUseCmdNum;
 
+    bool mSkipToNextNullByte;
+
 public:
     SocketClient(int sock, bool owned);
     SocketClient(int sock, bool owned, bool useCmdNum);
@@ -42,6 +44,11 @@ public:
     }
     int getCmdNum() { return mCmdNum; }
 
+    // Set by FrameworkListener when a command was too long for its buffer,
+    // to drop what is left of it.
+    bool getSkipToNextNullByte() const { return mSkipToNextNullByte; }
+    void setSkipToNextNullByte(bool skip) { mSkipToNextNullByte = skip; }
+
     // Send null-terminated C strings:
     int sendMsg(int code, const char *msg, bool addErrno);
     int sendMsg(int code, const char *msg, bool addErrno, bool useCmdNum);
@@ -33,6 +33,9 @@ class SocketListener {
     pthread_t               mThread;
     bool                    mUseCmdNum;
 
+    struct EpollState;
+    EpollState              *mEpoll;
+
 public:
     SocketListener(const char *socketName, bool listen);
     SocketListener(const char *socketName, bool listen, bool useCmdNum);
@@ -43,6 +46,14 @@ public:
     int startListener(int backlog);
     int stopListener();
 
+    // Waits for clients with epoll instead of rebuilding a poll() set on
+    // each loop. If numWorkers is nonzero, onDataAvailable() runs on a pool
+    // of that many threads rather than on the listener thread. A client is
+    // only handed to one thread at a time, so its data is still processed
+    // in order, but onDataAvailable() must cope with being called for
+    // different clients at once. Must be called before startListener().
+    void setUseEpoll(int numWorkers);
+
     void sendBroadcast(int code, const char *msg, bool addErrno);
 
     void runOnEachSocket(SocketClientCommand *command);
@@ -61,6 +72,11 @@ private:
 
     bool release(SocketClient *c, bool wakeup);
     void runListener();
+    void runEpollListener();
+    void runWorker();
+    void handleClient(SocketClient *c);
+    bool startEpoll();
+    void stopEpoll();
     void init(const char *socketName, int socketFd, bool listen, bool useCmdNum);
 };
 #endif
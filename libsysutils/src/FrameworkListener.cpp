@@ -47,7 +47,6 @@ void FrameworkListener::init(const char* /*socketName*/, bool withSeq) {
     errorRate = 0;
     mCommandCount = 0;
     mWithSeq = withSeq;
-    mSkipToNextNullByte = false;
 }
 
 bool FrameworkListener::onDataAvailable(SocketClient *c) {
@@ -64,7 +63,7 @@ bool FrameworkListener::onDataAvailable(SocketClient *c) {
         SLOGW("String is not zero-terminated");
         android_errorWriteLog(0x534e4554, "29831647");
         c->sendMsg(500, "Command too large for buffer", false);
-        mSkipToNextNullByte = true;
+        c->setSkipToNextNullByte(true);
         return true;
     }
 
@@ -74,8 +73,8 @@ bool FrameworkListener::onDataAvailable(SocketClient *c) {
     for (i = 0; i < len; i++) {
         if (buffer[i] == '\0') {
             /* IMPORTANT: dispatchCommand() expects a zero-terminated string */
-            if (mSkipToNextNullByte) {
-                mSkipToNextNullByte = false;
+            if (c->getSkipToNextNullByte()) {
+                c->setSkipToNextNullByte(false);
             } else {
                 dispatchCommand(c, buffer + offset);
             }
@@ -83,7 +82,7 @@ bool FrameworkListener::onDataAvailable(SocketClient *c) {
         }
     }
 
-    mSkipToNextNullByte = false;
+    c->setSkipToNextNullByte(false);
     return true;
 }
 
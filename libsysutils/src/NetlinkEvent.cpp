@@ -197,12 +197,16 @@ static bool isKernel64Bit(void) {
 NetlinkEvent::NetlinkEvent() {
     mAction = Action::kUnknown;
     memset(mParams, 0, sizeof(mParams));
+    memset(mParamNameLens, 0, sizeof(mParamNameLens));
     mPath = nullptr;
     mSubsystem = nullptr;
+    mInPlace = false;
 }
 
 NetlinkEvent::~NetlinkEvent() {
     int i;
+    if (mInPlace)
+        return;
     if (mPath)
         free(mPath);
     if (mSubsystem)
@@ -791,7 +795,7 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     return false;
                 }
             }
-            mPath = strdup(p+1);
+            mPath = mInPlace ? const_cast<char*>(p + 1) : strdup(p + 1);
             first = 0;
         } else {
             const char* a;
@@ -807,9 +811,9 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     SLOGE("NetlinkEvent::parseAsciiNetlinkMessage: failed to parse SEQNUM=%s", a);
                 }
             } else if ((a = HAS_CONST_PREFIX(s, end, "SUBSYSTEM=")) != nullptr) {
-                mSubsystem = strdup(a);
+                mSubsystem = mInPlace ? const_cast<char*>(a) : strdup(a);
             } else if (param_idx < NL_PARAMS_MAX) {
-                mParams[param_idx++] = strdup(s);
+                mParams[param_idx++] = mInPlace ? const_cast<char*>(s) : strdup(s);
             }
         }
         s += strlen(s) + 1;
@@ -818,20 +822,35 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
 }
 
 bool NetlinkEvent::decode(char *buffer, int size, int format) {
+    bool ret;
     if (format == NetlinkListener::NETLINK_FORMAT_BINARY
             || format == NetlinkListener::NETLINK_FORMAT_BINARY_UNICAST) {
-        return parseBinaryNetlinkMessage(buffer, size);
+        ret = parseBinaryNetlinkMessage(buffer, size);
     } else {
-        return parseAsciiNetlinkMessage(buffer, size);
+        ret = parseAsciiNetlinkMessage(buffer, size);
+    }
+    indexParams();
+    return ret;
+}
+
+bool NetlinkEvent::decodeInPlace(char *buffer, int size, int format) {
+    // The binary parsers always format their params into new strings.
+    mInPlace = format == NetlinkListener::NETLINK_FORMAT_ASCII;
+    return decode(buffer, size, format);
+}
+
+void NetlinkEvent::indexParams() {
+    for (int i = 0; i < NL_PARAMS_MAX && mParams[i] != nullptr; ++i) {
+        mParamNameLens[i] = strcspn(mParams[i], "=");
     }
 }
 
 const char *NetlinkEvent::findParam(const char *paramName) {
     size_t len = strlen(paramName);
     for (int i = 0; i < NL_PARAMS_MAX && mParams[i] != nullptr; ++i) {
-        const char *ptr = mParams[i] + len;
-        if (!strncmp(mParams[i], paramName, len) && *ptr == '=')
-            return ++ptr;
+        if (mParamNameLens[i] == len && mParams[i][len] == '=' &&
+            !memcmp(mParams[i], paramName, len))
+            return mParams[i] + len + 1;
     }
 
     SLOGE("NetlinkEvent::FindParam(): Parameter '%s' not found", paramName);
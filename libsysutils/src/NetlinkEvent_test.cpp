@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sysutils/NetlinkEvent.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+// A uevent as the kernel sends it: NUL-separated, starting with action@path.
+std::string MakeUevent() {
+    const char kUevent[] =
+            "add@/devices/virtual/block/loop0\0"
+            "ACTION=add\0"
+            "DEVPATH=/devices/virtual/block/loop0\0"
+            "SUBSYSTEM=block\0"
+            "MAJOR=7\0"
+            "MINOR=0\0"
+            "DEVNAME=loop0\0"
+            "DEVTYPE=disk\0"
+            "SEQNUM=1234\0";
+    return std::string(kUevent, sizeof(kUevent));
+}
+
+void CheckEvent(NetlinkEvent* evt) {
+    EXPECT_EQ(NetlinkEvent::Action::kAdd, evt->getAction());
+    EXPECT_STREQ("block", evt->getSubsystem());
+    EXPECT_STREQ("/devices/virtual/block/loop0", evt->findParam("DEVPATH"));
+    EXPECT_STREQ("7", evt->findParam("MAJOR"));
+    EXPECT_STREQ("0", evt->findParam("MINOR"));
+    EXPECT_STREQ("loop0", evt->findParam("DEVNAME"));
+    // Prefixes and extensions of a name must not match it.
+    EXPECT_EQ(nullptr, evt->findParam("DEV"));
+    EXPECT_EQ(nullptr, evt->findParam("DEVNAMES"));
+    EXPECT_EQ(nullptr, evt->findParam("SUBSYSTEM"));
+}
+
+}  // namespace
+
+TEST(NetlinkEventTest, DecodeAscii) {
+    std::string buffer = MakeUevent();
+    NetlinkEvent evt;
+    ASSERT_TRUE(evt.decode(buffer.data(), buffer.size()));
+    // decode() copies, so the buffer can be reused right away.
+    buffer.assign(buffer.size(), 'x');
+    CheckEvent(&evt);
+}
+
+TEST(NetlinkEventTest, DecodeAsciiInPlace) {
+    std::string buffer = MakeUevent();
+    NetlinkEvent evt;
+    ASSERT_TRUE(evt.decodeInPlace(buffer.data(), buffer.size()));
+    CheckEvent(&evt);
+
+    // The values point into the buffer.
+    const char* devname = evt.findParam("DEVNAME");
+    EXPECT_GE(devname, buffer.data());
+    EXPECT_LT(devname, buffer.data() + buffer.size());
+}
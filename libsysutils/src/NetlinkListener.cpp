@@ -36,11 +36,12 @@
 NetlinkListener::NetlinkListener(int socket) :
                             SocketListener(socket, false) {
     mFormat = NETLINK_FORMAT_ASCII;
+    mBatchedRecv = false;
 }
 #endif
 
 NetlinkListener::NetlinkListener(int socket, int format) :
-                            SocketListener(socket, false), mFormat(format) {
+                            SocketListener(socket, false), mFormat(format), mBatchedRecv(false) {
 }
 
 bool NetlinkListener::onDataAvailable(SocketClient *cli)
@@ -49,6 +50,10 @@ bool NetlinkListener::onDataAvailable(SocketClient *cli)
     ssize_t count;
     uid_t uid = -1;
 
+    if (mBatchedRecv) {
+        return recvBatch(socket);
+    }
+
     bool require_group = true;
     if (mFormat == NETLINK_FORMAT_BINARY_UNICAST) {
         require_group = false;
@@ -65,8 +70,70 @@ bool NetlinkListener::onDataAvailable(SocketClient *cli)
         return false;
     }
 
+    dispatchEvent(mBuffer, count);
+    return true;
+}
+
+// Same checks as uevent_kernel_recv(), for each message of a recvmmsg() batch.
+bool NetlinkListener::recvBatch(int socket) {
+    const size_t length = sizeof(mBuffer) / kRecvBatchSize;
+    struct mmsghdr msgs[kRecvBatchSize];
+    struct iovec iovs[kRecvBatchSize];
+    struct sockaddr_nl addrs[kRecvBatchSize];
+    char controls[kRecvBatchSize][CMSG_SPACE(sizeof(struct ucred))];
+
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < kRecvBatchSize; i++) {
+        iovs[i] = {mBuffer + i * length, length};
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = controls[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+    }
+
+    // Only wait for the first message; take whatever else is already queued.
+    int n = TEMP_FAILURE_RETRY(recvmmsg(socket, msgs, kRecvBatchSize, MSG_WAITFORONE, nullptr));
+    if (n < 0) {
+#ifdef __ANDROID_RECOVERY__
+        SLOGW("recvmmsg failed (%s)", strerror(errno));
+#else
+        SLOGE("recvmmsg failed (%s)", strerror(errno));
+#endif
+        return false;
+    }
+
+    bool require_group = mFormat != NETLINK_FORMAT_BINARY_UNICAST;
+    for (int i = 0; i < n; i++) {
+        const struct msghdr& hdr = msgs[i].msg_hdr;
+        char* buffer = static_cast<char*>(iovs[i].iov_base);
+        if (msgs[i].msg_len == 0) {
+            continue;
+        }
+        if (hdr.msg_flags & MSG_TRUNC) {
+            SLOGE("Dropping netlink message larger than %zu bytes", length);
+            continue;
+        }
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        if (cmsg == nullptr || cmsg->cmsg_type != SCM_CREDENTIALS ||
+            reinterpret_cast<struct ucred*>(CMSG_DATA(cmsg))->uid != 0 || addrs[i].nl_pid != 0 ||
+            (require_group && addrs[i].nl_groups == 0)) {
+            // Ignore messages that don't come from the kernel, and clear them
+            // out of the buffer.
+            memset(buffer, 0, length);
+            continue;
+        }
+        dispatchEvent(buffer, msgs[i].msg_len);
+    }
+    return true;
+}
+
+void NetlinkListener::dispatchEvent(char *buffer, ssize_t count) {
+    // The buffer is only reused once the event is gone, so the event can
+    // point into it.
     NetlinkEvent *evt = new NetlinkEvent();
-    if (evt->decode(mBuffer, count, mFormat)) {
+    if (evt->decodeInPlace(buffer, count, mFormat)) {
         onEvent(evt);
     } else if (mFormat != NETLINK_FORMAT_BINARY) {
         // Don't complain if parseBinaryNetlinkMessage returns false. That can
@@ -75,5 +142,4 @@ bool NetlinkListener::onDataAvailable(SocketClient *cli)
     }
 
     delete evt;
-    return true;
 }
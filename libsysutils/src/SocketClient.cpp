@@ -44,6 +44,7 @@ void SocketClient::init(int socket, bool owned, bool useCmdNum) {
     mSocket = socket;
     mSocketOwned = owned;
     mUseCmdNum = useCmdNum;
+    mSkipToNextNullByte = false;
     pthread_mutex_init(&mWriteMutex, nullptr);
     pthread_mutex_init(&mRefCountMutex, nullptr);
     mPid = -1;
@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -26,6 +27,10 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <cutils/sockets.h>
@@ -36,6 +41,33 @@
 #define CtrlPipe_Shutdown 0
 #define CtrlPipe_Wakeup   1
 
+struct SocketListener::EpollState {
+    explicit EpollState(int numWorkers) : numWorkers(numWorkers) {}
+
+    int numWorkers;
+    int fd = -1;
+
+    // Clients waiting for a worker, each holding a reference.
+    std::mutex queueLock;
+    std::condition_variable queueCond;
+    std::deque<SocketClient*> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+static bool addToEpoll(int epollFd, int op, int fd, uint32_t events) {
+    struct epoll_event ev = {.events = events, .data = {.fd = fd}};
+    if (epoll_ctl(epollFd, op, fd, &ev)) {
+        SLOGE("epoll_ctl(%d) failed for fd %d (%s)", op, fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// EPOLLONESHOT keeps a client from being reported again, and so from being
+// handed to a second worker, until handleClient() has re-armed it.
+static const uint32_t kClientEvents = EPOLLIN | EPOLLONESHOT;
+
 SocketListener::SocketListener(const char *socketName, bool listen) {
     init(socketName, -1, listen, false);
 }
@@ -53,9 +85,15 @@ void SocketListener::init(const char *socketName, int socketFd, bool listen, boo
     mSocketName = socketName;
     mSock = socketFd;
     mUseCmdNum = useCmdNum;
+    mEpoll = nullptr;
     pthread_mutex_init(&mClientsLock, nullptr);
 }
 
+void SocketListener::setUseEpoll(int numWorkers) {
+    delete mEpoll;
+    mEpoll = new EpollState(numWorkers);
+}
+
 SocketListener::~SocketListener() {
     if (mSocketName && mSock > -1)
         close(mSock);
@@ -67,6 +105,7 @@ SocketListener::~SocketListener() {
     for (auto pair : mClients) {
         pair.second->decRef();
     }
+    delete mEpoll;
 }
 
 int SocketListener::startListener() {
@@ -100,6 +139,10 @@ int SocketListener::startListener(int backlog) {
         return -1;
     }
 
+    if (mEpoll && !startEpoll()) {
+        return -1;
+    }
+
     if (pthread_create(&mThread, nullptr, SocketListener::threadStart, this)) {
         SLOGE("pthread_create (%s)", strerror(errno));
         return -1;
@@ -123,6 +166,9 @@ int SocketListener::stopListener() {
         SLOGE("Error joining to listener thread (%s)", strerror(errno));
         return -1;
     }
+    if (mEpoll) {
+        stopEpoll();
+    }
     close(mCtrlPipe[0]);
     close(mCtrlPipe[1]);
     mCtrlPipe[0] = -1;
@@ -149,6 +195,11 @@ void *SocketListener::threadStart(void *obj) {
 }
 
 void SocketListener::runListener() {
+    if (mEpoll) {
+        runEpollListener();
+        return;
+    }
+
     while (true) {
         std::vector<pollfd> fds;
 
@@ -223,6 +274,139 @@ void SocketListener::runListener() {
     }
 }
 
+bool SocketListener::startEpoll() {
+    mEpoll->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpoll->fd < 0) {
+        SLOGE("epoll_create1 failed (%s)", strerror(errno));
+        return false;
+    }
+    if (!addToEpoll(mEpoll->fd, EPOLL_CTL_ADD, mCtrlPipe[0], EPOLLIN) ||
+        !addToEpoll(mEpoll->fd, EPOLL_CTL_ADD, mSock, mListen ? EPOLLIN : kClientEvents)) {
+        close(mEpoll->fd);
+        mEpoll->fd = -1;
+        return false;
+    }
+
+    mEpoll->stopping = false;
+    for (int i = 0; i < mEpoll->numWorkers; i++) {
+        mEpoll->workers.emplace_back(&SocketListener::runWorker, this);
+    }
+    return true;
+}
+
+void SocketListener::stopEpoll() {
+    {
+        std::lock_guard<std::mutex> lock(mEpoll->queueLock);
+        mEpoll->stopping = true;
+    }
+    mEpoll->queueCond.notify_all();
+    for (std::thread& worker : mEpoll->workers) {
+        worker.join();
+    }
+    mEpoll->workers.clear();
+    for (SocketClient* c : mEpoll->queue) {
+        c->decRef();
+    }
+    mEpoll->queue.clear();
+
+    close(mEpoll->fd);
+    mEpoll->fd = -1;
+}
+
+void SocketListener::runEpollListener() {
+    struct epoll_event events[16];
+
+    while (true) {
+        int rc = TEMP_FAILURE_RETRY(epoll_wait(mEpoll->fd, events, 16, -1));
+        if (rc < 0) {
+            SLOGE("epoll_wait failed (%s) mListen=%d", strerror(errno), mListen);
+            sleep(1);
+            continue;
+        }
+
+        for (int i = 0; i < rc; i++) {
+            const int fd = events[i].data.fd;
+            if (fd == mCtrlPipe[0]) {
+                char c = CtrlPipe_Shutdown;
+                TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
+                if (c == CtrlPipe_Shutdown) {
+                    return;
+                }
+                continue;
+            }
+            if (mListen && fd == mSock) {
+                int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
+                if (c < 0) {
+                    SLOGE("accept failed (%s)", strerror(errno));
+                    sleep(1);
+                    continue;
+                }
+                pthread_mutex_lock(&mClientsLock);
+                mClients[c] = new SocketClient(c, true, mUseCmdNum);
+                addToEpoll(mEpoll->fd, EPOLL_CTL_ADD, c, kClientEvents);
+                pthread_mutex_unlock(&mClientsLock);
+                continue;
+            }
+
+            pthread_mutex_lock(&mClientsLock);
+            auto it = mClients.find(fd);
+            if (it == mClients.end()) {
+                pthread_mutex_unlock(&mClientsLock);
+                SLOGE("fd vanished: %d", fd);
+                continue;
+            }
+            SocketClient* c = it->second;
+            c->incRef();
+            pthread_mutex_unlock(&mClientsLock);
+
+            if (mEpoll->numWorkers > 0) {
+                {
+                    std::lock_guard<std::mutex> lock(mEpoll->queueLock);
+                    mEpoll->queue.push_back(c);
+                }
+                mEpoll->queueCond.notify_one();
+            } else {
+                handleClient(c);
+            }
+        }
+    }
+}
+
+void SocketListener::runWorker() {
+    while (true) {
+        SocketClient* c;
+        {
+            std::unique_lock<std::mutex> lock(mEpoll->queueLock);
+            mEpoll->queueCond.wait(lock,
+                                   [this] { return mEpoll->stopping || !mEpoll->queue.empty(); });
+            if (mEpoll->stopping) {
+                return;
+            }
+            c = mEpoll->queue.front();
+            mEpoll->queue.pop_front();
+        }
+        handleClient(c);
+    }
+}
+
+// Processes a client reported by epoll, and consumes the reference taken when
+// it was.
+void SocketListener::handleClient(SocketClient* c) {
+    SLOGV("processing fd %d", c->getSocket());
+    if (!onDataAvailable(c)) {
+        release(c, false);
+    }
+
+    // Re-arm the client, unless it was released meanwhile.
+    pthread_mutex_lock(&mClientsLock);
+    auto it = mClients.find(c->getSocket());
+    if (it != mClients.end() && it->second == c) {
+        addToEpoll(mEpoll->fd, EPOLL_CTL_MOD, c->getSocket(), kClientEvents);
+    }
+    pthread_mutex_unlock(&mClientsLock);
+    c->decRef();
+}
+
 bool SocketListener::release(SocketClient* c, bool wakeup) {
     bool ret = false;
     /* if our sockets are connection-based, remove and destroy it */
@@ -231,10 +415,16 @@ bool SocketListener::release(SocketClient* c, bool wakeup) {
         SLOGV("going to zap %d for %s", c->getSocket(), mSocketName);
         pthread_mutex_lock(&mClientsLock);
         ret = (mClients.erase(c->getSocket()) != 0);
+        if (ret && mEpoll) {
+            // Done under the lock, so that handleClient() can't re-arm it.
+            epoll_ctl(mEpoll->fd, EPOLL_CTL_DEL, c->getSocket(), nullptr);
+        }
         pthread_mutex_unlock(&mClientsLock);
         if (ret) {
             ret = c->decRef();
-            if (wakeup) {
+            // The epoll set doesn't need rebuilding, so there is nothing to
+            // wake the listener up for.
+            if (wakeup && !mEpoll) {
                 char b = CtrlPipe_Wakeup;
                 TEMP_FAILURE_RETRY(write(mCtrlPipe[1], &b, 1));
             }
@@ -24,6 +24,8 @@
 
 #include <algorithm>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -110,11 +112,25 @@ class TestCommand : public FrameworkCommand {
     }
 };
 
-// A test listener with a single command.
+// Test command which waits for a second before replying "43 slept".
+class SleepCommand : public FrameworkCommand {
+  public:
+    SleepCommand() : FrameworkCommand("sleep") {}
+    ~SleepCommand() override {}
+
+    int runCommand(SocketClient* cli, int /*argc*/, char** /*argv*/) {
+        sleep(1);
+        cli->sendMsg(43, "slept", /*addErrno=*/false, /*useCmdNum=*/false);
+        return 0;
+    }
+};
+
+// A test listener with a couple of commands.
 class TestListener : public FrameworkListener {
   public:
     TestListener(int fd) : FrameworkListener(fd) {
         registerCmd(new TestCommand);  // Leaked :-(
+        registerCmd(new SleepCommand);
     }
 };
 
@@ -122,10 +138,14 @@ class TestListener : public FrameworkListener {
 
 class FrameworkListenerTest : public testing::Test {
   public:
-    FrameworkListenerTest() {
+    FrameworkListenerTest() : FrameworkListenerTest(-1) {}
+
+    // Uses epoll with the given number of workers, unless negative.
+    explicit FrameworkListenerTest(int epollWorkers) {
         mSocketPath = testSocketPath();
         mSserverFd = serverSocket(mSocketPath);
         mListener = std::make_unique<TestListener>(mSserverFd.get());
+        if (epollWorkers >= 0) mListener->setUseEpoll(epollWorkers);
         EXPECT_EQ(0, mListener->startListener());
     }
 
@@ -181,3 +201,71 @@ TEST_F(FrameworkListenerTest, MultipleClients) {
     EXPECT_EQ(std::string("42 test,2") + '\0', recvReply(client2.get()));
     EXPECT_EQ(std::string("42 test,1") + '\0', recvReply(client1.get()));
 }
+
+class FrameworkListenerEpollTest : public FrameworkListenerTest {
+  public:
+    FrameworkListenerEpollTest() : FrameworkListenerTest(0) {}
+};
+
+class FrameworkListenerWorkersTest : public FrameworkListenerTest {
+  public:
+    FrameworkListenerWorkersTest() : FrameworkListenerTest(4) {}
+
+    // Reads count replies, however the socket splits them up.
+    std::vector<std::string> recvReplies(int fd, size_t count) {
+        std::string data;
+        while (static_cast<size_t>(std::count(data.begin(), data.end(), '\0')) < count) {
+            std::string reply = recvReply(fd);
+            if (reply.empty()) break;
+            data += reply;
+        }
+        return android::base::Split(data.substr(0, data.size() - 1), std::string(1, '\0'));
+    }
+};
+
+TEST_F(FrameworkListenerEpollTest, DispatchesValidCommands) {
+    testCommand("test", "42 test");
+    testCommand("test arg1 arg2", "42 test,arg1,arg2");
+    testCommand("unknown arg1 arg2", "500 Command not recognized");
+}
+
+TEST_F(FrameworkListenerEpollTest, MultipleClients) {
+    unique_fd client1 = clientSocket(mSocketPath);
+    unique_fd client2 = clientSocket(mSocketPath);
+    sendCmd(client1.get(), "test 1");
+    sendCmd(client2.get(), "test 2");
+
+    EXPECT_EQ(std::string("42 test,2") + '\0', recvReply(client2.get()));
+    EXPECT_EQ(std::string("42 test,1") + '\0', recvReply(client1.get()));
+}
+
+TEST_F(FrameworkListenerWorkersTest, DispatchesValidCommands) {
+    testCommand("test", "42 test");
+    testCommand("test arg1 arg2", "42 test,arg1,arg2");
+    testCommand("unknown arg1 arg2", "500 Command not recognized");
+}
+
+TEST_F(FrameworkListenerWorkersTest, KeepsClientOrder) {
+    unique_fd client = clientSocket(mSocketPath);
+    std::vector<std::string> expected;
+    for (int i = 0; i < 100; i++) {
+        std::string cmd = "test " + std::to_string(i);
+        sendCmd(client.get(), cmd.c_str());
+        expected.push_back("42 test," + std::to_string(i));
+    }
+    EXPECT_EQ(expected, recvReplies(client.get(), expected.size()));
+}
+
+TEST_F(FrameworkListenerWorkersTest, SlowClientDoesNotBlockOthers) {
+    unique_fd slow_client = clientSocket(mSocketPath);
+    unique_fd client = clientSocket(mSocketPath);
+    sendCmd(slow_client.get(), "sleep");
+    // Give a worker time to pick the slow command up.
+    usleep(100000);
+    sendCmd(client.get(), "test 1");
+
+    EXPECT_EQ(std::string("42 test,1") + '\0', recvReply(client.get()));
+    pollfd fds = {.fd = slow_client.get(), .events = POLLIN};
+    EXPECT_EQ(0, poll(&fds, 1, 0));
+    EXPECT_EQ(std::string("43 slept") + '\0', recvReply(slow_client.get()));
+}
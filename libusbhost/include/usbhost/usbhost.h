@@ -267,6 +267,27 @@ struct usb_request *usb_request_wait(struct usb_device *dev, int timeoutMillis);
 /* Cancels a pending usb_request_queue() operation. */
 int usb_request_cancel(struct usb_request *req);
 
+/* Submits |count| requests, so that they are all in flight at once.
+ * Returns the number of requests submitted, which is less than |count| if one
+ * of them failed, or -1 if the first one failed.
+ */
+int usb_request_queue_many(struct usb_request **requests, int count);
+
+/* Reaps up to |max| completed requests without blocking.
+ * The device fd returned by usb_device_get_fd() polls POLLOUT while completions
+ * are pending, so it can be added to an epoll set to wait for them. To keep a
+ * fixed number of requests in flight on an endpoint, queue each reaped request
+ * again once its buffer has been consumed or refilled.
+ * Returns the number of requests stored in |requests|, 0 if none had
+ * completed, or -1 for error.
+ */
+int usb_request_reap_many(struct usb_device *dev, struct usb_request **requests, int max);
+
+/* Returns the completion status of a reaped request: 0 on success or a
+ * negative errno value, e.g. -EPIPE for a stalled endpoint.
+ */
+int usb_request_get_status(const struct usb_request *req);
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,6 +29,7 @@
 #include <stddef.h>
 
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/inotify.h>
@@ -37,6 +38,7 @@
 #include <errno.h>
 #include <ctype.h>
 #include <poll.h>
+#include <pthread.h>
 
 #include <linux/usbdevice_fs.h>
 
@@ -80,6 +82,118 @@ struct usb_device {
     int writeable;
 };
 
+/* Descriptors read by this process, keyed by usb_device_get_unique_id().
+ * Device numbers are reused once a device goes away, so each entry also
+ * records the inode and change time of the node it was read from, which lets
+ * usb_device_new() tell a new device from the old one even in processes that
+ * never see the inotify events. usb_host_read_event() drops entries as soon as
+ * their node is created or deleted, and bumps the generation so that a read
+ * which raced with that is not cached.
+ */
+struct usb_descriptor_cache_entry {
+    struct usb_descriptor_cache_entry *next;
+    int unique_id;
+    dev_t rdev;
+    ino_t ino;
+    struct timespec ctime;
+    int desc_length;
+    unsigned char desc[];
+};
+
+static pthread_mutex_t descriptor_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct usb_descriptor_cache_entry *descriptor_cache;
+static unsigned descriptor_cache_generation;
+
+static int descriptor_cache_matches(const struct usb_descriptor_cache_entry *entry,
+                                    const struct stat *st)
+{
+    return entry->rdev == st->st_rdev && entry->ino == st->st_ino &&
+           entry->ctime.tv_sec == st->st_ctim.tv_sec &&
+           entry->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+/* Copies cached descriptors into |desc| and returns their length, or returns -1
+ * with the current generation in |generation| if there are none. */
+static int descriptor_cache_lookup(int unique_id, const struct stat *st, unsigned char *desc,
+                                   unsigned *generation)
+{
+    struct usb_descriptor_cache_entry *entry;
+    int length = -1;
+
+    pthread_mutex_lock(&descriptor_cache_lock);
+    for (entry = descriptor_cache; entry; entry = entry->next) {
+        if (entry->unique_id == unique_id) {
+            if (descriptor_cache_matches(entry, st)) {
+                memcpy(desc, entry->desc, entry->desc_length);
+                length = entry->desc_length;
+            }
+            break;
+        }
+    }
+    *generation = descriptor_cache_generation;
+    pthread_mutex_unlock(&descriptor_cache_lock);
+    return length;
+}
+
+static void descriptor_cache_remove_locked(int unique_id)
+{
+    struct usb_descriptor_cache_entry **link = &descriptor_cache;
+    while (*link) {
+        struct usb_descriptor_cache_entry *entry = *link;
+        if (entry->unique_id == unique_id) {
+            *link = entry->next;
+            free(entry);
+            return;
+        }
+        link = &entry->next;
+    }
+}
+
+static void descriptor_cache_store(int unique_id, const struct stat *st, unsigned generation,
+                                   const unsigned char *desc, int length)
+{
+    struct usb_descriptor_cache_entry *entry = malloc(sizeof(*entry) + length);
+    if (!entry)
+        return;
+    entry->unique_id = unique_id;
+    entry->rdev = st->st_rdev;
+    entry->ino = st->st_ino;
+    entry->ctime = st->st_ctim;
+    entry->desc_length = length;
+    memcpy(entry->desc, desc, length);
+
+    pthread_mutex_lock(&descriptor_cache_lock);
+    if (generation == descriptor_cache_generation) {
+        descriptor_cache_remove_locked(unique_id);
+        entry->next = descriptor_cache;
+        descriptor_cache = entry;
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&descriptor_cache_lock);
+    free(entry);
+}
+
+/* Drops the entry for one device, every device on bus |bus| if |dev| is -1, or
+ * every device if |bus| is -1 too. */
+static void descriptor_cache_invalidate(int bus, int dev)
+{
+    struct usb_descriptor_cache_entry **link = &descriptor_cache;
+
+    pthread_mutex_lock(&descriptor_cache_lock);
+    descriptor_cache_generation++;
+    while (*link) {
+        struct usb_descriptor_cache_entry *entry = *link;
+        if ((bus < 0 || entry->unique_id / 1000 == bus) &&
+                (dev < 0 || entry->unique_id % 1000 == dev)) {
+            *link = entry->next;
+            free(entry);
+        } else {
+            link = &entry->next;
+        }
+    }
+    pthread_mutex_unlock(&descriptor_cache_lock);
+}
+
 static inline int badname(const char *name)
 {
     while(*name) {
@@ -250,6 +364,7 @@ int usb_host_read_event(struct usb_host_context *context)
                     watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
                     done = find_existing_devices(context->cb_added, context->data);
                 } else if ((event->mask & IN_DELETE) && !strcmp(event->name, "usb")) {
+                    descriptor_cache_invalidate(-1, -1);
                     for (i = 0; i < MAX_USBFS_WD_COUNT; i++) {
                         if (context->wds[i] >= 0) {
                             inotify_rm_watch(context->fd, context->wds[i]);
@@ -264,6 +379,7 @@ int usb_host_read_event(struct usb_host_context *context)
                         "new" : "gone", path, i);
                 if (i > 0 && i < MAX_USBFS_WD_COUNT) {
                     int local_ret = 0;
+                    descriptor_cache_invalidate(i, -1);
                     if (event->mask & IN_CREATE) {
                         local_ret = inotify_add_watch(context->fd, path,
                                 IN_CREATE | IN_DELETE);
@@ -280,6 +396,8 @@ int usb_host_read_event(struct usb_host_context *context)
                 for (i = 1; (i < MAX_USBFS_WD_COUNT) && !done; i++) {
                     if (wd == context->wds[i]) {
                         snprintf(path, sizeof(path), USB_FS_DIR "/%03d/%s", i, event->name);
+                        if (event->mask & (IN_CREATE | IN_DELETE))
+                            descriptor_cache_invalidate(i, atoi(event->name));
                         if (event->mask == IN_CREATE) {
                             D("new device %s\n", path);
                             done = context->cb_added(path, context->data);
@@ -364,16 +482,26 @@ void usb_device_close(struct usb_device *device)
 struct usb_device *usb_device_new(const char *dev_name, int fd)
 {
     struct usb_device *device = calloc(1, sizeof(struct usb_device));
-    int length;
+    int length = -1;
+    int unique_id = usb_device_get_unique_id_from_name(dev_name);
+    unsigned generation = 0;
+    struct stat st;
+    int cacheable = unique_id > 0 && fstat(fd, &st) == 0;
 
     D("usb_device_new %s fd: %d\n", dev_name, fd);
 
     if (lseek(fd, 0, SEEK_SET) != 0)
         goto failed;
-    length = read(fd, device->desc, sizeof(device->desc));
-    D("usb_device_new read returned %d errno %d\n", length, errno);
-    if (length < 0)
-        goto failed;
+    if (cacheable)
+        length = descriptor_cache_lookup(unique_id, &st, device->desc, &generation);
+    if (length < 0) {
+        length = read(fd, device->desc, sizeof(device->desc));
+        D("usb_device_new read returned %d errno %d\n", length, errno);
+        if (length < 0)
+            goto failed;
+        if (cacheable)
+            descriptor_cache_store(unique_id, &st, generation, device->desc, length);
+    }
 
     strncpy(device->dev_name, dev_name, sizeof(device->dev_name) - 1);
     device->fd = fd;
@@ -777,3 +905,42 @@ int usb_request_cancel(struct usb_request *req)
     struct usbdevfs_urb *urb = ((struct usbdevfs_urb*)req->private_data);
     return ioctl(req->dev->fd, USBDEVFS_DISCARDURB, urb);
 }
+
+int usb_request_queue_many(struct usb_request **requests, int count)
+{
+    // usbdevfs has no batched submit, but queueing everything before reaping
+    // anything keeps the host controller busy between completions.
+    int i;
+    for (i = 0; i < count; i++) {
+        if (usb_request_queue(requests[i]) < 0) {
+            D("[ submit urb %d of %d - error %d]\n", i, count, errno);
+            return i == 0 ? -1 : i;
+        }
+    }
+    return count;
+}
+
+int usb_request_reap_many(struct usb_device *dev, struct usb_request **requests, int max)
+{
+    int count = 0;
+    while (count < max) {
+        struct usbdevfs_urb *urb = NULL;
+        int res = TEMP_FAILURE_RETRY(ioctl(dev->fd, USBDEVFS_REAPURBNDELAY, &urb));
+        if (res < 0) {
+            if (errno == EAGAIN)
+                break;
+            D("[ reap urb - error %d]\n", errno);
+            return count == 0 ? -1 : count;
+        }
+
+        struct usb_request *req = (struct usb_request*)urb->usercontext;
+        req->actual_length = urb->actual_length;
+        requests[count++] = req;
+    }
+    return count;
+}
+
+int usb_request_get_status(const struct usb_request *req)
+{
+    return ((const struct usbdevfs_urb*)req->private_data)->status;
+}
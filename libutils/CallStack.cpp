@@ -20,6 +20,12 @@
 #include <utils/Errors.h>
 #include <utils/Log.h>
 
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+
 #include <unwindstack/AndroidUnwinder.h>
 
 #define CALLSTACK_WEAK  // Don't generate weak definitions.
@@ -86,6 +92,135 @@ void CallStack::print(Printer& printer) const {
     }
 }
 
+// A frame record as laid out by the frame pointer of each supported architecture.
+struct FrameRecord {
+    uintptr_t next;
+    uintptr_t pc;
+};
+
+#if defined(__aarch64__) || defined(__x86_64__) || defined(__i386__)
+// The frame pointer points at the record.
+static constexpr uintptr_t kFrameRecordOffset = 0;
+#define FRAME_POINTER_UNWIND 1
+#elif defined(__riscv)
+// The frame pointer points just past the record.
+static constexpr uintptr_t kFrameRecordOffset = sizeof(FrameRecord);
+#define FRAME_POINTER_UNWIND 1
+#endif
+
+// Deep enough for any stack we would usefully print.
+static constexpr size_t kMaxRawFrames = 256;
+
+#if defined(FRAME_POINTER_UNWIND)
+// Returns the bounds of the current thread's stack, looked up once per thread.
+static void getStackBounds(uintptr_t* low, uintptr_t* high) {
+    static thread_local uintptr_t tLow = 0;
+    static thread_local uintptr_t tHigh = 0;
+    if (tHigh == 0) {
+        pthread_attr_t attr;
+        void* addr;
+        size_t size;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+                tLow = reinterpret_cast<uintptr_t>(addr);
+                tHigh = tLow + size;
+            }
+            pthread_attr_destroy(&attr);
+        }
+    }
+    *low = tLow;
+    *high = tHigh;
+}
+#endif
+
+__attribute__((noinline)) void RawCallStack::update(int32_t ignoreDepth) {
+    // Our own frame is never recorded, so the default of 1 starts at the caller.
+    size_t skip = ignoreDepth > 1 ? ignoreDepth - 1 : 0;
+
+    mPcs.clear();
+
+#if defined(FRAME_POINTER_UNWIND)
+    uintptr_t low, high;
+    getStackBounds(&low, &high);
+    if (high == 0) return;
+
+    // Stacks grow down, so each caller's record must be above the last one.
+    // Stop at anything else, since it means a frame without a frame pointer.
+    uintptr_t fp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+    while (mPcs.size() < kMaxRawFrames) {
+        uintptr_t record = fp - kFrameRecordOffset;
+        if (fp < kFrameRecordOffset || record < low || record > high - sizeof(FrameRecord) ||
+            (record % alignof(FrameRecord)) != 0) {
+            break;
+        }
+        const FrameRecord* frame = reinterpret_cast<const FrameRecord*>(record);
+        if (frame->pc == 0) break;
+        if (skip > 0) {
+            --skip;
+        } else {
+            mPcs.push_back(frame->pc);
+        }
+        if (frame->next <= fp) break;
+        fp = frame->next;
+    }
+#else
+    unwindstack::AndroidLocalUnwinder unwinder;
+    unwindstack::AndroidUnwinderData data(kMaxRawFrames);
+    if (!unwinder.Unwind(data)) {
+        ALOGW("%s: Failed to unwind callstack: %s", __FUNCTION__, data.GetErrorString().c_str());
+    }
+    // The first frame is this function.
+    for (size_t i = skip + 1; i < data.frames.size(); i++) {
+        mPcs.push_back(data.frames[i].pc);
+    }
+#endif
+}
+
+void RawCallStack::log(const char* logtag, android_LogPriority priority,
+                       const char* prefix) const {
+    LogPrinter printer(logtag, priority, prefix, /*ignoreBlankLines*/false);
+    print(printer);
+}
+
+void RawCallStack::dump(int fd, int indent, const char* prefix) const {
+    FdPrinter printer(fd, indent, prefix);
+    print(printer);
+}
+
+String8 RawCallStack::toString(const char* prefix) const {
+    String8 str;
+
+    String8Printer printer(&str, prefix);
+    print(printer);
+
+    return str;
+}
+
+// Lines follow the format of unwindstack's frames, with the pc relative to
+// the library's load address.
+void RawCallStack::print(Printer& printer) const {
+    for (size_t i = 0; i < mPcs.size(); i++) {
+        // Look up the call instruction rather than the return address, which
+        // may belong to the next function.
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void*>(mPcs[i] - 1), &info) == 0 || info.dli_fname == nullptr) {
+            printer.printFormatLine("#%02zu pc %016" PRIxPTR "  <unknown>", i, mPcs[i]);
+            continue;
+        }
+
+        const uintptr_t base = reinterpret_cast<uintptr_t>(info.dli_fbase);
+        String8 line = String8::format("#%02zu pc %016" PRIxPTR "  %s", i, mPcs[i] - base,
+                                       info.dli_fname);
+        if (info.dli_sname != nullptr) {
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, nullptr);
+            line.appendFormat(" (%s+%" PRIuPTR ")", demangled ? demangled : info.dli_sname,
+                              mPcs[i] - reinterpret_cast<uintptr_t>(info.dli_saddr));
+            free(demangled);
+        }
+        printer.printLine(line.c_str());
+    }
+}
+
 // The following four functions may be used via weak symbol references from libutils.
 // Clients assume that if any of these symbols are available, then deleteStack() is.
 
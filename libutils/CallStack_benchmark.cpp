@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/CallStack.h>
+
+using android::CallStack;
+using android::RawCallStack;
+
+static void BM_CallStack_update(benchmark::State& state) {
+    CallStack stack;
+    for (auto _ : state) {
+        stack.update();
+        benchmark::DoNotOptimize(stack.size());
+    }
+}
+BENCHMARK(BM_CallStack_update);
+
+static void BM_RawCallStack_update(benchmark::State& state) {
+    RawCallStack stack;
+    for (auto _ : state) {
+        stack.update();
+        benchmark::DoNotOptimize(stack.size());
+    }
+}
+BENCHMARK(BM_RawCallStack_update);
+
+static void BM_RawCallStack_toString(benchmark::State& state) {
+    RawCallStack stack;
+    stack.update();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(stack.toString());
+    }
+}
+BENCHMARK(BM_RawCallStack_toString);
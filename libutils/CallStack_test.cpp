@@ -61,3 +61,19 @@ TEST(CallStackTest, thread_backtrace) {
 
     ASSERT_NE(-1, cs.toString().find("(ThreadBusyWait")) << "Full backtrace:\n" << cs.toString();
 }
+
+__attribute__((__noinline__)) extern "C" void RawCaller(android::RawCallStack& stack) {
+    stack.update();
+}
+
+TEST(CallStackTest, raw_backtrace) {
+    android::RawCallStack stack;
+    RawCaller(stack);
+    ASSERT_NE(0U, stack.size());
+
+    android::String8 backtrace = stack.toString();
+    ASSERT_NE(-1, backtrace.find("#00 pc ")) << "Full backtrace:\n" << backtrace;
+
+    stack.clear();
+    ASSERT_EQ(0U, stack.size());
+}
@@ -134,6 +134,13 @@ FileMap::~FileMap(void)
 // Returns "false" on failure.
 bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t length,
         bool readOnly)
+{
+    return create(origFileName, fd, offset, length, readOnly, CREATE_DEFAULT);
+}
+
+// Create a new mapping on an open file, with usage hints.
+bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t length,
+        bool readOnly, [[maybe_unused]] int createFlags)
 {
 #if defined(__MINGW32__)
     int     adjust;
@@ -196,6 +203,9 @@ bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t le
     }
 
     int flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+    if (createFlags & CREATE_POPULATE) flags |= MAP_POPULATE;
+#endif
     int prot = PROT_READ;
     if (!readOnly) prot |= PROT_WRITE;
 
@@ -210,6 +220,15 @@ bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t le
         }
     }
     mBasePtr = ptr;
+
+#if defined(MADV_HUGEPAGE)
+    // Huge pages for file mappings need kernel support that is often absent,
+    // so failure only costs us the hint.
+    if ((createFlags & CREATE_HUGEPAGE) && ptr != nullptr &&
+        madvise(ptr, adjLength, MADV_HUGEPAGE) != 0) {
+        ALOGV("madvise(MADV_HUGEPAGE) failed: %s\n", strerror(errno));
+    }
+#endif
 #endif // !defined(__MINGW32__)
 
     mFileName = origFileName != nullptr ? strdup(origFileName) : nullptr;
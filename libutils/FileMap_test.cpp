@@ -65,3 +65,20 @@ TEST(FileMap, offset_overflow) {
     android::FileMap m;
     ASSERT_FALSE(m.create("test", tf.fd, offset, length, true));
 }
+
+TEST(FileMap, create_flags) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+
+    std::string content(3 * 4096, 'x');
+    ASSERT_TRUE(android::base::WriteStringToFd(content, tf.fd));
+
+    // The flags are only hints, so the mapping must work whether or not the
+    // kernel honors them.
+    android::FileMap m;
+    ASSERT_TRUE(m.create("test", tf.fd, 100, content.size() - 100, true,
+                         android::FileMap::CREATE_POPULATE | android::FileMap::CREATE_HUGEPAGE));
+    ASSERT_EQ(content.size() - 100, m.getDataLength());
+    ASSERT_EQ(std::string(content.size() - 100, 'x'),
+              std::string(static_cast<char*>(m.getDataPtr()), m.getDataLength()));
+}
@@ -19,8 +19,23 @@
 
 #include <utils/Looper.h>
 
+#include <cutils/trace.h>
 #include <sys/eventfd.h>
+#include <algorithm>
+#include <atomic>
 #include <cinttypes>
+#include <memory>
+#include <mutex>
+
+// Only use epoll_pwait2() where libc declares it. On Android, that also means that the
+// seccomp policy for apps allows it.
+#if defined(__BIONIC__)
+#define LOOPER_HAVE_EPOLL_PWAIT2 (__ANDROID_API__ >= 35)
+#elif defined(__GLIBC__)
+#define LOOPER_HAVE_EPOLL_PWAIT2 __GLIBC_PREREQ(2, 35)
+#else
+#define LOOPER_HAVE_EPOLL_PWAIT2 0
+#endif
 
 namespace android {
 
@@ -32,6 +47,141 @@ epoll_event createEpollEvent(uint32_t events, uint64_t seq) {
     return {.events = events, .data = {.u64 = seq}};
 }
 
+// Stale requests are allowed to pile up to this many, or to the number of live requests if
+// that is larger, before the epoll set is rebuilt to get rid of them.
+constexpr size_t MIN_STALE_REQUESTS_BEFORE_REBUILD = 16;
+
+// When a file descriptor is closed before it is unregistered, it can no longer be removed from
+// the epoll set. The kernel drops the registration by itself once the last reference to the
+// file goes away, which is by far the common case. Only a file that is still open elsewhere
+// (e.g. because the fd was dup()ed) keeps its registration, and nothing short of rebuilding the
+// epoll set gets rid of it. Rather than rebuilding up front, the request stays in mRequests
+// with fd == -1 until an event for it shows up or too many stale requests accumulate.
+template <typename Request>
+void markRequestStale(Request& request) {
+    request.fd = -1;
+    request.callback.clear();
+    request.data = nullptr;
+}
+
+// Waits for at most timeoutNanos, or forever if it is negative. epoll_wait() rounds the timeout up
+// to whole milliseconds, which makes messages that are due soon arrive up to 1ms late, so use
+// epoll_pwait2() where libc and the kernel have it.
+int epollWait(int epollFd, epoll_event* events, int maxEvents, nsecs_t timeoutNanos) {
+#if LOOPER_HAVE_EPOLL_PWAIT2
+    static std::atomic<bool> sHaveEpollPwait2 = true;
+    if (timeoutNanos > 0 && sHaveEpollPwait2.load(std::memory_order_relaxed)) {
+        timespec timeout = {.tv_sec = static_cast<time_t>(timeoutNanos / 1000000000),
+                            .tv_nsec = static_cast<long>(timeoutNanos % 1000000000)};
+        int result = epoll_pwait2(epollFd, events, maxEvents, &timeout, nullptr);
+        if (result >= 0 || errno != ENOSYS) {
+            return result;
+        }
+        sHaveEpollPwait2.store(false, std::memory_order_relaxed);
+    }
+#endif
+    int timeoutMillis = timeoutNanos < 0 ? -1 : toMillisecondTimeoutDelay(0, timeoutNanos);
+    return epoll_wait(epollFd, events, maxEvents, timeoutMillis);
+}
+
+template <typename Requests, typename SequenceNumbers>
+bool tooManyStaleRequests(const Requests& requests, const SequenceNumbers& sequenceNumberByFd) {
+    // Every live request has exactly one entry in sequenceNumberByFd.
+    size_t staleRequests = requests.size() - sequenceNumberByFd.size();
+    return staleRequests > std::max(MIN_STALE_REQUESTS_BEFORE_REBUILD, sequenceNumberByFd.size());
+}
+
+// Dispatch tracing and timing state, settable from any thread. Looper is part of the VNDK ABI,
+// so this lives in a side table keyed by the looper rather than in the class itself. Only
+// loopers that opted in have an entry.
+struct DispatchState {
+    std::atomic<uint64_t> traceTag = 0;
+    std::atomic<nsecs_t> slowThreshold = 0;
+    std::atomic<uint64_t> dispatches = 0;
+    std::atomic<uint64_t> slowDispatches = 0;
+    std::atomic<nsecs_t> maxDispatchTime = 0;
+};
+
+struct DispatchStart {
+    uint64_t traceTag;
+    nsecs_t time;  // 0 when not timed
+};
+
+std::mutex gDispatchStatesLock;
+// Never destroyed, so that loopers torn down during exit can still erase their entry.
+auto& gDispatchStates =
+        *new std::unordered_map<const Looper*, std::shared_ptr<DispatchState>>();
+// Lets loopers skip the lock while no looper has opted in, which is the common case.
+std::atomic<size_t> gDispatchStateCount = 0;
+
+std::shared_ptr<DispatchState> findDispatchState(const Looper* looper, bool create = false) {
+    if (!create && gDispatchStateCount.load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(gDispatchStatesLock);
+    auto it = gDispatchStates.find(looper);
+    if (it != gDispatchStates.end()) {
+        return it->second;
+    }
+    if (!create) {
+        return nullptr;
+    }
+    auto state = std::make_shared<DispatchState>();
+    gDispatchStates.emplace(looper, state);
+    gDispatchStateCount.store(gDispatchStates.size(), std::memory_order_relaxed);
+    return state;
+}
+
+void eraseDispatchState(const Looper* looper) {
+    if (gDispatchStateCount.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(gDispatchStatesLock);
+    gDispatchStates.erase(looper);
+    gDispatchStateCount.store(gDispatchStates.size(), std::memory_order_relaxed);
+}
+
+DispatchStart beginDispatch(DispatchState* state, const char* kind, int id) {
+    DispatchStart start = {0, 0};
+    if (state == nullptr) {
+        return start;
+    }
+    uint64_t tag = state->traceTag.load(std::memory_order_relaxed);
+    if (tag != 0 && atrace_is_tag_enabled(tag)) {
+        char name[64];
+        snprintf(name, sizeof(name), "Looper::%s=%d", kind, id);
+        atrace_begin(tag, name);
+        start.traceTag = tag;
+    }
+    if (state->slowThreshold.load(std::memory_order_relaxed) > 0) {
+        start.time = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+    return start;
+}
+
+void endDispatch(const Looper* looper, DispatchState* state, const DispatchStart& start,
+                 const char* kind, int id) {
+    if (start.traceTag != 0) {
+        atrace_end(start.traceTag);
+    }
+    if (start.time == 0) {
+        return;
+    }
+
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start.time;
+    state->dispatches.fetch_add(1, std::memory_order_relaxed);
+    // Only the looper thread dispatches, so there is no competing writer.
+    if (elapsed > state->maxDispatchTime.load(std::memory_order_relaxed)) {
+        state->maxDispatchTime.store(elapsed, std::memory_order_relaxed);
+    }
+    nsecs_t threshold = state->slowThreshold.load(std::memory_order_relaxed);
+    if (threshold > 0 && elapsed > threshold) {
+        state->slowDispatches.fetch_add(1, std::memory_order_relaxed);
+        ALOGW("%p ~ slow dispatch: %s=%d took %" PRId64 "ms", looper, kind, id,
+              ns2ms(elapsed));
+    }
+}
+
 }  // namespace
 
 // --- WeakMessageHandler ---
@@ -73,6 +223,39 @@ static const int EPOLL_MAX_EVENTS = 16;
 static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t gTLSKey = 0;
 
+// Breaks ties between messages that are due at the same time, so that they are sent in FIFO
+// order. Shared by all loopers so that Looper's layout doesn't change.
+static std::atomic<uint32_t> gNextMessageSeq = 0;
+
+// Heap ordering for the message queue: the message that is due first ends up at the front.
+template <typename Envelope>
+static bool isLaterMessage(const Envelope& a, const Envelope& b) {
+    if (a.uptime != b.uptime) {
+        return a.uptime > b.uptime;
+    }
+    // The sequence number may wrap around, which is fine as long as the messages
+    // being compared weren't sent more than 2^31 messages apart.
+    return static_cast<int32_t>(a.seq - b.seq) > 0;
+}
+
+// Removes the messages that match the predicate and restores the heap order afterwards.
+template <typename Envelope, typename Predicate>
+static void removeMessagesIf(Vector<Envelope>& envelopes, Predicate match) {
+    size_t kept = 0;
+    for (size_t i = 0; i < envelopes.size(); i++) {
+        if (!match(envelopes.itemAt(i))) {
+            if (kept != i) {
+                envelopes.editItemAt(kept) = envelopes.itemAt(i);
+            }
+            kept += 1;
+        }
+    }
+    if (kept != envelopes.size()) {
+        envelopes.removeItemsAt(kept, envelopes.size() - kept);
+        std::make_heap(envelopes.begin(), envelopes.end(), isLaterMessage<Envelope>);
+    }
+}
+
 Looper::Looper(bool allowNonCallbacks)
     : mAllowNonCallbacks(allowNonCallbacks),
       mSendingMessage(false),
@@ -89,6 +272,7 @@ Looper::Looper(bool allowNonCallbacks)
 }
 
 Looper::~Looper() {
+    eraseDispatchState(this);
 }
 
 void Looper::initTLSKey() {
@@ -161,7 +345,15 @@ void Looper::rebuildEpollLocked() {
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake event fd to epoll instance: %s",
                         strerror(errno));
 
-    for (const auto& [seq, request] : mRequests) {
+    for (auto it = mRequests.begin(); it != mRequests.end();) {
+        const auto& [seq, request] = *it;
+        if (request.fd < 0) {
+            // Stale requests are no longer in the new epoll set.
+            it = mRequests.erase(it);
+            continue;
+        }
+        ++it;
+
         epoll_event eventItem = createEpollEvent(request.getEpollEvents(), seq);
 
         int epollResult = epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, request.fd, &eventItem);
@@ -224,16 +416,16 @@ int Looper::pollInner(int timeoutMillis) {
 #endif
 
     // Adjust the timeout based on when the next message is due.
+    nsecs_t timeoutNanos = timeoutMillis < 0 ? -1 : ms2ns(timeoutMillis);
     if (timeoutMillis != 0 && mNextMessageUptime != LLONG_MAX) {
         nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-        int messageTimeoutMillis = toMillisecondTimeoutDelay(now, mNextMessageUptime);
-        if (messageTimeoutMillis >= 0
-                && (timeoutMillis < 0 || messageTimeoutMillis < timeoutMillis)) {
-            timeoutMillis = messageTimeoutMillis;
+        nsecs_t messageTimeoutNanos = std::max<nsecs_t>(mNextMessageUptime - now, 0);
+        if (timeoutNanos < 0 || messageTimeoutNanos < timeoutNanos) {
+            timeoutNanos = messageTimeoutNanos;
         }
 #if DEBUG_POLL_AND_WAKE
-        ALOGD("%p ~ pollOnce - next message in %" PRId64 "ns, adjusted timeout: timeoutMillis=%d",
-                this, mNextMessageUptime - now, timeoutMillis);
+        ALOGD("%p ~ pollOnce - next message in %" PRId64 "ns, adjusted timeout: timeoutNanos=%"
+              PRId64, this, mNextMessageUptime - now, timeoutNanos);
 #endif
     }
 
@@ -246,7 +438,7 @@ int Looper::pollInner(int timeoutMillis) {
     mPolling = true;
 
     struct epoll_event eventItems[EPOLL_MAX_EVENTS];
-    int eventCount = epoll_wait(mEpollFd.get(), eventItems, EPOLL_MAX_EVENTS, timeoutMillis);
+    int eventCount = epollWait(mEpollFd.get(), eventItems, EPOLL_MAX_EVENTS, timeoutNanos);
 
     // No longer idling.
     mPolling = false;
@@ -296,7 +488,13 @@ int Looper::pollInner(int timeoutMillis) {
             }
         } else {
             const auto& request_it = mRequests.find(seq);
-            if (request_it != mRequests.end()) {
+            if (request_it != mRequests.end() && request_it->second.fd < 0) {
+                // A closed fd whose file is still open elsewhere is still in the epoll set.
+                ALOGW("Ignoring epoll events 0x%x for sequence number %" PRIu64
+                      " of a closed file descriptor, rebuilding epoll set.",
+                      epollEvents, seq);
+                scheduleEpollRebuildLocked();
+            } else if (request_it != mRequests.end()) {
                 const auto& request = request_it->second;
                 int events = 0;
                 if (epollEvents & EPOLLIN) events |= EVENT_INPUT;
@@ -312,6 +510,8 @@ int Looper::pollInner(int timeoutMillis) {
         }
     }
 Done: ;
+    // Looked up once per poll, since dispatch tracing and timing are rarely enabled.
+    const std::shared_ptr<DispatchState> dispatchState = findDispatchState(this);
 
     // Invoke pending message callbacks.
     mNextMessageUptime = LLONG_MAX;
@@ -319,14 +519,16 @@ Done: ;
         nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
         const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(0);
         if (messageEnvelope.uptime <= now) {
-            // Remove the envelope from the list.
+            // Remove the envelope from the heap.
             // We keep a strong reference to the handler until the call to handleMessage
             // finishes.  Then we drop it so that the handler can be deleted *before*
             // we reacquire our lock.
             { // obtain handler
                 sp<MessageHandler> handler = messageEnvelope.handler;
                 Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                std::pop_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                              isLaterMessage<MessageEnvelope>);
+                mMessageEnvelopes.removeAt(mMessageEnvelopes.size() - 1);
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -334,7 +536,10 @@ Done: ;
                 ALOGD("%p ~ pollOnce - sending message: handler=%p, what=%d",
                         this, handler.get(), message.what);
 #endif
+                DispatchStart start =
+                        beginDispatch(dispatchState.get(), "handleMessage what", message.what);
                 handler->handleMessage(message);
+                endDispatch(this, dispatchState.get(), start, "handleMessage what", message.what);
             } // release handler
 
             mLock.lock();
@@ -364,7 +569,9 @@ Done: ;
             // Invoke the callback.  Note that the file descriptor may be closed by
             // the callback (and potentially even reused) before the function returns so
             // we need to be a little careful when removing the file descriptor afterwards.
+            DispatchStart start = beginDispatch(dispatchState.get(), "handleEvent fd", fd);
             int callbackResult = response.request.callback->handleEvent(fd, events, data);
+            endDispatch(this, dispatchState.get(), start, "handleEvent fd", fd);
             if (callbackResult == 0) {
                 AutoMutex _l(mLock);
                 removeSequenceNumberLocked(response.seq);
@@ -379,6 +586,25 @@ Done: ;
     return result;
 }
 
+void Looper::setDispatchTraceTag(uint64_t tag) {
+    findDispatchState(this, true)->traceTag.store(tag, std::memory_order_relaxed);
+}
+
+void Looper::setSlowDispatchThreshold(nsecs_t threshold) {
+    findDispatchState(this, true)->slowThreshold.store(threshold, std::memory_order_relaxed);
+}
+
+Looper::DispatchStats Looper::getDispatchStats() const {
+    DispatchStats stats;
+    std::shared_ptr<DispatchState> state = findDispatchState(this);
+    if (state != nullptr) {
+        stats.dispatches = state->dispatches.load(std::memory_order_relaxed);
+        stats.slowDispatches = state->slowDispatches.load(std::memory_order_relaxed);
+        stats.maxDispatchTime = state->maxDispatchTime.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
 int Looper::pollAll(int timeoutMillis, int* outFd, int* outEvents, void** outData) {
     if (timeoutMillis <= 0) {
         int result;
@@ -481,6 +707,7 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
             mRequests.emplace(seq, request);
             mSequenceNumberByFd.emplace(fd, seq);
         } else {
+            bool oldRequestIsStale = false;
             int epollResult = epoll_ctl(mEpollFd.get(), EPOLL_CTL_MOD, fd, &eventItem);
             if (epollResult < 0) {
                 if (errno == ENOENT) {
@@ -492,9 +719,9 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
                     // before returning and unregistering itself.  Callback sequence number
                     // checks further ensure that the race is benign.
                     //
-                    // Unfortunately due to kernel limitations we need to rebuild the epoll
-                    // set from scratch because it may contain an old file handle that we are
-                    // now unable to remove since its file descriptor is no longer valid.
+                    // Unfortunately due to kernel limitations the epoll set may still contain
+                    // an old file handle that we are now unable to remove since its file
+                    // descriptor is no longer valid, see markRequestStale().
                     // No such problem would have occurred if we were using the poll system
                     // call instead, but that approach carries other disadvantages.
 #if DEBUG_CALLBACKS
@@ -508,14 +735,21 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
                                 fd, strerror(errno));
                         return -1;
                     }
-                    scheduleEpollRebuildLocked();
+                    oldRequestIsStale = true;
                 } else {
                     ALOGE("Error modifying epoll events for fd %d: %s", fd, strerror(errno));
                     return -1;
                 }
             }
             const SequenceNumber oldSeq = seq_it->second;
-            mRequests.erase(oldSeq);
+            if (oldRequestIsStale) {
+                markRequestStale(mRequests[oldSeq]);
+                if (tooManyStaleRequests(mRequests, mSequenceNumberByFd)) {
+                    scheduleEpollRebuildLocked();
+                }
+            } else {
+                mRequests.erase(oldSeq);
+            }
             mRequests.emplace(seq, request);
             seq_it->second = seq;
         }
@@ -538,14 +772,14 @@ int Looper::removeSequenceNumberLocked(SequenceNumber seq) {
 #endif
 
     const auto& request_it = mRequests.find(seq);
-    if (request_it == mRequests.end()) {
+    if (request_it == mRequests.end() || request_it->second.fd < 0) {
         return 0;
     }
     const int fd = request_it->second.fd;
 
     // Always remove the FD from the request map even if an error occurs while
     // updating the epoll set so that we avoid accidentally leaking callbacks.
-    mRequests.erase(request_it);
+    // Stale requests keep their entry, but without the callback.
     mSequenceNumberByFd.erase(fd);
 
     int epollResult = epoll_ctl(mEpollFd.get(), EPOLL_CTL_DEL, fd, nullptr);
@@ -556,9 +790,9 @@ int Looper::removeSequenceNumberLocked(SequenceNumber seq) {
             // callback has the side-effect of closing the file descriptor before returning and
             // unregistering itself.
             //
-            // Unfortunately due to kernel limitations we need to rebuild the epoll
-            // set from scratch because it may contain an old file handle that we are
-            // now unable to remove since its file descriptor is no longer valid.
+            // Unfortunately due to kernel limitations the epoll set may still contain
+            // an old file handle that we are now unable to remove since its file
+            // descriptor is no longer valid, see markRequestStale().
             // No such problem would have occurred if we were using the poll system
             // call instead, but that approach carries other disadvantages.
 #if DEBUG_CALLBACKS
@@ -566,16 +800,22 @@ int Looper::removeSequenceNumberLocked(SequenceNumber seq) {
                   "being closed: %s",
                   this, strerror(errno));
 #endif
-            scheduleEpollRebuildLocked();
+            markRequestStale(request_it->second);
+            if (tooManyStaleRequests(mRequests, mSequenceNumberByFd)) {
+                scheduleEpollRebuildLocked();
+            }
         } else {
             // Some other error occurred.  This is really weird because it means
             // our list of callbacks got out of sync with the epoll set somehow.
             // We defensively rebuild the epoll set to avoid getting spurious
             // notifications with nowhere to go.
             ALOGE("Error removing epoll events for fd %d: %s", fd, strerror(errno));
+            mRequests.erase(request_it);
             scheduleEpollRebuildLocked();
             return -1;
         }
+    } else {
+        mRequests.erase(request_it);
     }
     return 1;
 }
@@ -598,17 +838,15 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
             this, uptime, handler.get(), message.what);
 #endif
 
-    size_t i = 0;
+    bool atHead;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
-
-        MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        uint32_t seq = gNextMessageSeq.fetch_add(1, std::memory_order_relaxed);
+        mMessageEnvelopes.push(MessageEnvelope(uptime, handler, message, seq));
+        std::push_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                       isLaterMessage<MessageEnvelope>);
+        atHead = mMessageEnvelopes.itemAt(0).seq == seq;
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
@@ -620,7 +858,7 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
     } // release lock
 
     // Wake the poll loop only when we enqueue a new message at the head.
-    if (i == 0) {
+    if (atHead) {
         wake();
     }
 }
@@ -633,12 +871,9 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        removeMessagesIf(mMessageEnvelopes, [&](const MessageEnvelope& messageEnvelope) {
+            return messageEnvelope.handler == handler;
+        });
     } // release lock
 }
 
@@ -650,13 +885,9 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler
-                    && messageEnvelope.message.what == what) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        removeMessagesIf(mMessageEnvelopes, [&](const MessageEnvelope& messageEnvelope) {
+            return messageEnvelope.handler == handler && messageEnvelope.message.what == what;
+        });
     } // release lock
 }
 
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/Looper.h>
+
+#include <random>
+#include <vector>
+
+using android::Looper;
+using android::Message;
+using android::MessageHandler;
+using android::sp;
+
+class NullMessageHandler : public MessageHandler {
+  public:
+    void handleMessage(const Message&) override {}
+};
+
+static std::vector<nsecs_t> RandomDelays(size_t count) {
+    std::mt19937 rng(count);
+    std::uniform_int_distribution<nsecs_t> dist(ms2ns(1), s2ns(60));
+    std::vector<nsecs_t> delays(count);
+    for (auto& delay : delays) {
+        delay = dist(rng);
+    }
+    return delays;
+}
+
+// Queues messages at random times in the future, then drops them again.
+void BM_Looper_sendMessageAtTime(benchmark::State& state) {
+    sp<Looper> looper = new Looper(false);
+    sp<MessageHandler> handler = new NullMessageHandler();
+    std::vector<nsecs_t> delays = RandomDelays(state.range(0));
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    while (state.KeepRunning()) {
+        for (nsecs_t delay : delays) {
+            looper->sendMessageAtTime(now + delay, handler, Message(0));
+        }
+        looper->removeMessages(handler);
+    }
+    state.SetItemsProcessed(state.iterations() * delays.size());
+}
+BENCHMARK(BM_Looper_sendMessageAtTime)->Range(8, 4096);
+
+// Queues messages that are already due in random order and dispatches all of them.
+void BM_Looper_dispatchMessages(benchmark::State& state) {
+    sp<Looper> looper = new Looper(false);
+    sp<MessageHandler> handler = new NullMessageHandler();
+    std::vector<nsecs_t> delays = RandomDelays(state.range(0));
+    nsecs_t past = systemTime(SYSTEM_TIME_MONOTONIC) - s2ns(3600);
+    while (state.KeepRunning()) {
+        for (nsecs_t delay : delays) {
+            looper->sendMessageAtTime(past + delay, handler, Message(0));
+        }
+        looper->pollOnce(0);
+    }
+    state.SetItemsProcessed(state.iterations() * delays.size());
+}
+BENCHMARK(BM_Looper_dispatchMessages)->Range(8, 4096);
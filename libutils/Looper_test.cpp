@@ -316,6 +316,33 @@ TEST_F(LooperTest, PollOnce_WhenCallbackAddedThenRemoved_CallbackShouldNotBeInvo
             << "callback should not be invoked";
 }
 
+TEST_F(LooperTest, PollOnce_WhenFdClosedBeforeRemovedButFileStillOpen_CallbackShouldNotBeInvoked) {
+    Pipe pipe;
+    StubCallbackHandler handler(true);
+
+    handler.setCallback(mLooper, pipe.receiveFd, Looper::EVENT_INPUT);
+
+    // Keep the file open through a duplicate, so that the kernel doesn't drop its
+    // registration from the epoll set when the registered fd is closed.
+    int closedFd = pipe.receiveFd;
+    pipe.receiveFd = dup(closedFd);
+    close(closedFd);
+    EXPECT_EQ(1, mLooper->removeFd(closedFd))
+            << "removeFd should succeed even though the fd was already closed";
+
+    pipe.writeSignal(); // signals the registration that could not be removed
+    for (int i = 0; i < 5 && mLooper->pollOnce(0) != Looper::POLL_TIMEOUT; i++) {
+    }
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_TIMEOUT, result)
+            << "pollOnce result should be Looper::POLL_TIMEOUT once the epoll set was rebuilt";
+    EXPECT_EQ(0, handler.callbackCount)
+            << "callback should not be invoked";
+    ASSERT_EQ(OK, pipe.readSignal())
+            << "signal should actually have been written";
+}
+
 TEST_F(LooperTest, PollOnce_WhenCallbackReturnsFalse_CallbackShouldNotBeInvokedAgainLater) {
     Pipe pipe;
     StubCallbackHandler handler(false);
@@ -713,6 +740,114 @@ TEST_F(LooperTest, RemoveMessage_WhenRemovingSomeMessagesForHandler_ShouldRemove
             << "no more messages to handle";
 }
 
+TEST_F(LooperTest, SendMessageAtTime_WhenSentOutOfOrder_ShouldInvokeHandlersInUptimeOrder) {
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    const int uptimesMs[] = {30, 10, 50, 20, 40, 0};
+    for (int uptimeMs : uptimesMs) {
+        mLooper->sendMessageAtTime(now - ms2ns(1000 - uptimeMs), handler, Message(uptimeMs));
+    }
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    ASSERT_EQ(size_t(6), handler->messages.size())
+            << "handled all messages";
+    for (size_t i = 0; i < handler->messages.size(); i++) {
+        EXPECT_EQ(int(i * 10), handler->messages[i].what)
+                << "messages should be handled in order of their uptime";
+    }
+}
+
+TEST_F(LooperTest, SendMessageAtTime_WhenSentWithSameUptime_ShouldInvokeHandlersInSendOrder) {
+    nsecs_t uptime = systemTime(SYSTEM_TIME_MONOTONIC) - ms2ns(1000);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    for (int i = 0; i < 100; i++) {
+        mLooper->sendMessageAtTime(uptime, handler, Message(i));
+    }
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    ASSERT_EQ(size_t(100), handler->messages.size())
+            << "handled all messages";
+    for (size_t i = 0; i < handler->messages.size(); i++) {
+        EXPECT_EQ(int(i), handler->messages[i].what)
+                << "messages with the same uptime should be handled in the order they were sent";
+    }
+}
+
+TEST_F(LooperTest, RemoveMessage_WhenRemovingSomeDelayedMessages_ShouldKeepOrderOfTheRest) {
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    sp<StubMessageHandler> otherHandler = new StubMessageHandler();
+    for (int i = 19; i >= 0; i--) {
+        mLooper->sendMessageAtTime(now - ms2ns(1000 - i), i % 2 ? otherHandler : handler,
+                                   Message(i % 4 == 0 ? MSG_TEST1 : MSG_TEST2));
+    }
+    mLooper->removeMessages(otherHandler);
+    mLooper->removeMessages(handler, MSG_TEST2);
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    EXPECT_EQ(size_t(5), handler->messages.size())
+            << "only messages that were not removed should be handled";
+    EXPECT_EQ(size_t(0), otherHandler->messages.size())
+            << "all messages for the other handler were removed";
+
+    mLooper->sendMessageAtTime(now - ms2ns(2000), otherHandler, Message(MSG_TEST3));
+    result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because a message was sent";
+    EXPECT_EQ(size_t(1), otherHandler->messages.size())
+            << "message sent after removal should be handled";
+}
+
+class SleepingMessageHandler : public MessageHandler {
+public:
+    virtual void handleMessage(const Message& message) {
+        usleep(message.what * 1000);
+    }
+};
+
+TEST_F(LooperTest, DispatchStats_WhenNoThresholdSet_ShouldNotCount) {
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    mLooper->sendMessage(handler, Message(MSG_TEST1));
+    mLooper->pollOnce(0);
+
+    Looper::DispatchStats stats = mLooper->getDispatchStats();
+    EXPECT_EQ(0u, stats.dispatches);
+    EXPECT_EQ(0u, stats.slowDispatches);
+}
+
+TEST_F(LooperTest, DispatchStats_WhenThresholdSet_ShouldCountSlowDispatches) {
+    mLooper->setSlowDispatchThreshold(ms2ns(20));
+
+    // Messages' what is the time in milliseconds they take to handle.
+    sp<SleepingMessageHandler> handler = new SleepingMessageHandler();
+    mLooper->sendMessage(handler, Message(0));
+    mLooper->sendMessage(handler, Message(50));
+
+    Pipe pipe;
+    StubCallbackHandler callback(true);
+    ASSERT_EQ(OK, pipe.writeSignal());
+    callback.setCallback(mLooper, pipe.receiveFd, Looper::EVENT_INPUT);
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result);
+    EXPECT_EQ(1, callback.callbackCount);
+    Looper::DispatchStats stats = mLooper->getDispatchStats();
+    EXPECT_EQ(3u, stats.dispatches) << "both messages and the fd callback should be counted";
+    EXPECT_EQ(1u, stats.slowDispatches) << "only the 50ms message is over the threshold";
+    EXPECT_GE(stats.maxDispatchTime, ms2ns(50));
+}
+
 class LooperEventCallback : public LooperCallback {
   public:
     using Callback = std::function<int(int fd, int events)>;
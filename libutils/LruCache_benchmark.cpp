@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/LruCache.h>
+#include <utils/ShardedLruCache.h>
+
+#include <mutex>
+
+static constexpr uint32_t kCapacity = 1024;
+// Twice the capacity, so that about half of the lookups miss and evict.
+static constexpr uint32_t kKeySpace = 2 * kCapacity;
+
+// Each thread walks a different stride through the key space, so the threads
+// mostly touch different keys, as render threads looking up glyphs would.
+template <typename Cache>
+static void lookUpOrInsert(benchmark::State& state, Cache& cache) {
+    uint32_t key = state.thread_index() * 7919;
+    for (auto _ : state) {
+        key = (key + 4099) % kKeySpace;
+        int value = cache.get(key);
+        if (value == 0) {
+            cache.put(key, key + 1);
+        }
+        benchmark::DoNotOptimize(value);
+    }
+}
+
+// The existing LruCache is single-threaded, so shared users wrap it in a lock.
+class LockedLruCache {
+  public:
+    int get(uint32_t key) {
+        std::lock_guard<std::mutex> guard(mLock);
+        return mCache.get(key);
+    }
+    bool put(uint32_t key, int value) {
+        std::lock_guard<std::mutex> guard(mLock);
+        return mCache.put(key, value);
+    }
+
+  private:
+    std::mutex mLock;
+    android::LruCache<uint32_t, int> mCache{kCapacity};
+};
+
+// The caches are shared by all the threads of a run, and stay warm across runs.
+void BM_locked_lru_cache(benchmark::State& state) {
+    static LockedLruCache cache;
+    lookUpOrInsert(state, cache);
+}
+BENCHMARK(BM_locked_lru_cache)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_sharded_lru_cache(benchmark::State& state) {
+    static android::ShardedLruCache<uint32_t, int> cache(kCapacity);
+    lookUpOrInsert(state, cache);
+}
+BENCHMARK(BM_sharded_lru_cache)->ThreadRange(1, 8)->UseRealTime();
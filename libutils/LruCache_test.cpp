@@ -16,10 +16,14 @@
 
 #include <stdlib.h>
 
+#include <thread>
+#include <vector>
+
 #include <android/log.h>
 #include <gtest/gtest.h>
 #include <utils/JenkinsHash.h>
 #include <utils/LruCache.h>
+#include <utils/ShardedLruCache.h>
 
 namespace {
 
@@ -456,4 +460,97 @@ TEST_F(LruCacheTest, DontCopyKeyInGet) {
     cache.get(KeyFailsOnCopy(0));
 }
 
+TEST_F(LruCacheTest, ShardedSimple) {
+    ShardedLruCache<SimpleKey, StringValue> cache(100);
+
+    EXPECT_EQ(nullptr, cache.get(1));
+    EXPECT_TRUE(cache.put(1, "one"));
+    EXPECT_TRUE(cache.put(2, "two"));
+    EXPECT_FALSE(cache.put(2, "deux"));
+    EXPECT_STREQ("one", cache.get(1));
+    EXPECT_STREQ("two", cache.get(2));
+    EXPECT_EQ(2u, cache.size());
+
+    EXPECT_TRUE(cache.remove(1));
+    EXPECT_FALSE(cache.remove(1));
+    EXPECT_EQ(nullptr, cache.get(1));
+    EXPECT_EQ(1u, cache.size());
+
+    cache.clear();
+    EXPECT_EQ(nullptr, cache.get(2));
+    EXPECT_EQ(0u, cache.size());
+}
+
+TEST_F(LruCacheTest, ShardedMaxCapacity) {
+    ShardedLruCache<SimpleKey, StringValue, 4> cache(64);
+
+    for (int i = 0; i < 1000; i++) {
+        cache.put(i, "value");
+    }
+    EXPECT_GE(64u, cache.size());
+    // Keys are spread evenly enough that every shard fills up.
+    EXPECT_LT(48u, cache.size());
+    // The most recent key is never the one evicted.
+    EXPECT_STREQ("value", cache.get(999));
+}
+
+TEST_F(LruCacheTest, ShardedCapacityNotMultipleOfShards) {
+    ShardedLruCache<SimpleKey, StringValue, 4> cache(10);
+
+    for (int i = 0; i < 1000; i++) {
+        cache.put(i, "value");
+    }
+    EXPECT_EQ(10u, cache.size());
+}
+
+TEST_F(LruCacheTest, ShardedCapacityBelowShards) {
+    ShardedLruCache<SimpleKey, StringValue> cache(3);
+
+    for (int i = 0; i < 1000; i++) {
+        cache.put(i, "value");
+    }
+    EXPECT_EQ(3u, cache.size());
+}
+
+TEST_F(LruCacheTest, ShardedCallback) {
+    ShardedLruCache<SimpleKey, StringValue> cache(100);
+    EntryRemovedCallback callback;
+    cache.setOnEntryRemovedListener(&callback);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    cache.put(3, "three");
+    cache.remove(2);
+    EXPECT_EQ(1, callback.callbackCount);
+    EXPECT_EQ(2, callback.lastKey);
+    EXPECT_STREQ("two", callback.lastValue);
+
+    cache.clear();
+    EXPECT_EQ(3, callback.callbackCount);
+}
+
+TEST_F(LruCacheTest, ShardedConcurrentAccess) {
+    constexpr int kThreadCount = 8;
+    constexpr int kKeysPerThread = 1000;
+    ShardedLruCache<SimpleKey, SimpleKey> cache(LruCache<SimpleKey, SimpleKey>::kUnlimitedCapacity);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreadCount; t++) {
+        threads.emplace_back([&cache, t] {
+            for (int i = 0; i < kKeysPerThread; i++) {
+                int key = t * kKeysPerThread + i;
+                cache.put(key, key + 1);
+                EXPECT_EQ(key + 1, cache.get(key));
+            }
+            for (int i = 0; i < kKeysPerThread; i += 2) {
+                EXPECT_TRUE(cache.remove(t * kKeysPerThread + i));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(size_t(kThreadCount * kKeysPerThread / 2), cache.size());
+}
+
 }
@@ -22,7 +22,12 @@
 #include <dirent.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <utils/Printer.h>
 
@@ -126,16 +131,14 @@ void ProcessCallStack::clear() {
     mTimeUpdated = tm();
 }
 
-void ProcessCallStack::update() {
+bool ProcessCallStack::listThreads() {
     std::unique_ptr<DIR, decltype(&closedir)> dp(opendir(PATH_SELF_TASK), closedir);
     if (dp == nullptr) {
         ALOGE("%s: Failed to update the process's call stacks: %s",
               __FUNCTION__, strerror(errno));
-        return;
+        return false;
     }
 
-    pid_t selfPid = getpid();
-
     clear();
 
     // Get current time.
@@ -170,7 +173,20 @@ void ProcessCallStack::update() {
             continue;
         }
 
-        ThreadInfo& threadInfo = mThreadMap.editValueAt(static_cast<size_t>(idx));
+        // Read/save thread name
+        mThreadMap.editValueAt(static_cast<size_t>(idx)).threadName = getThreadName(tid);
+    }
+    return true;
+}
+
+void ProcessCallStack::update() {
+    if (!listThreads()) return;
+
+    pid_t selfPid = getpid();
+
+    for (size_t i = 0; i < mThreadMap.size(); ++i) {
+        pid_t tid = mThreadMap.keyAt(i);
+        ThreadInfo& threadInfo = mThreadMap.editValueAt(i);
 
         /*
          * Ignore CallStack::update and ProcessCallStack::update for current thread
@@ -181,14 +197,80 @@ void ProcessCallStack::update() {
         // Update thread's call stacks
         threadInfo.callStack.update(ignoreDepth, tid);
 
-        // Read/save thread name
-        threadInfo.threadName = getThreadName(tid);
-
         ALOGV("%s: Got call stack for tid %d (size %zu)",
               __FUNCTION__, tid, threadInfo.callStack.size());
     }
 }
 
+void ProcessCallStack::update(std::chrono::milliseconds timeout, size_t maxWorkers) {
+    if (!listThreads()) return;
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    pid_t selfPid = getpid();
+
+    // Shared with the workers, which are detached so that a stuck unwind
+    // cannot hold us past the deadline. Late results are dropped.
+    struct UnwindState {
+        std::mutex lock;
+        std::condition_variable cond;
+        std::vector<pid_t> tids;
+        std::vector<CallStack> stacks;
+        std::vector<bool> finished;
+        size_t next = 0;
+        size_t pending = 0;
+    };
+    auto state = std::make_shared<UnwindState>();
+    for (size_t i = 0; i < mThreadMap.size(); ++i) {
+        if (mThreadMap.keyAt(i) != selfPid) state->tids.push_back(mThreadMap.keyAt(i));
+    }
+    state->stacks.resize(state->tids.size());
+    state->finished.resize(state->tids.size());
+    state->pending = state->tids.size();
+
+    size_t workers = std::min(std::max<size_t>(maxWorkers, 1), state->tids.size());
+    for (size_t i = 0; i < workers; ++i) {
+        std::thread([state, deadline]() {
+            std::unique_lock<std::mutex> lock(state->lock);
+            while (state->next < state->tids.size()) {
+                size_t index = state->next++;
+                if (std::chrono::steady_clock::now() >= deadline) continue;
+
+                pid_t tid = state->tids[index];
+                lock.unlock();
+                CallStack callStack;
+                callStack.update(0, tid);
+                lock.lock();
+
+                state->stacks[index] = callStack;
+                state->finished[index] = true;
+                if (--state->pending == 0) state->cond.notify_all();
+            }
+        }).detach();
+    }
+
+    // The current thread has to be unwound in place.
+    ssize_t selfIdx = mThreadMap.indexOfKey(selfPid);
+    if (selfIdx >= 0) {
+        mThreadMap.editValueAt(static_cast<size_t>(selfIdx))
+                .callStack.update(IGNORE_DEPTH_CURRENT_THREAD, selfPid);
+    }
+
+    std::unique_lock<std::mutex> lock(state->lock);
+    state->cond.wait_until(lock, deadline, [&state]() { return state->pending == 0; });
+    // Stop the workers from starting any thread that is left.
+    state->next = state->tids.size();
+
+    for (size_t i = 0; i < state->tids.size(); ++i) {
+        ThreadInfo& threadInfo = mThreadMap.editValueFor(state->tids[i]);
+        if (state->finished[i]) {
+            threadInfo.callStack = state->stacks[i];
+        } else {
+            threadInfo.timedOut = true;
+            ALOGW("%s: Timed out unwinding tid %d", __FUNCTION__, state->tids[i]);
+        }
+    }
+}
+
 void ProcessCallStack::log(const char* logtag, android_LogPriority priority,
                            const char* prefix) const {
     LogPrinter printer(logtag, priority, prefix, /*ignoreBlankLines*/false);
@@ -216,7 +298,11 @@ void ProcessCallStack::printInternal(Printer& printer, Printer& csPrinter) const
         printer.printLine("");
         printer.printFormatLine("\"%s\" sysTid=%d", threadName.string(), tid);
 
-        threadInfo.callStack.print(csPrinter);
+        if (threadInfo.timedOut) {
+            csPrinter.printLine("<unwind timed out>");
+        } else {
+            threadInfo.callStack.print(csPrinter);
+        }
     }
 
     dumpProcessFooter(printer, getpid());
@@ -49,7 +49,12 @@ void spawnThreads(FuzzedDataProvider* dataProvider) {
 
     // Collect thread information
     ProcessCallStack callStack = ProcessCallStack();
-    callStack.update();
+    if (dataProvider->ConsumeBool()) {
+        callStack.update();
+    } else {
+        callStack.update(std::chrono::milliseconds(dataProvider->ConsumeIntegralInRange(0, 100)),
+                         dataProvider->ConsumeIntegralInRange<size_t>(1, 8));
+    }
 
     // Tell our patiently waiting threads they can be done now.
     ranCallStackUpdate.store(true);
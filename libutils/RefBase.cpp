@@ -95,6 +95,14 @@ namespace android {
 // Between calls, and ignoring memory ordering effects, mWeak includes strong
 // references, and is thus >= mStrong.
 //
+// OBJECT_FAST_STRONG_REFS changes this so that strong reference changes only
+// touch mStrong. extendObjectLifetime() takes a single weak reference on
+// behalf of all strong references, before the first one exists, and the
+// decStrong() that drops the last strong reference releases it. mWeak then
+// counts weak references plus one while the object is alive. This is the
+// scheme std::shared_ptr uses. It requires OBJECT_LIFETIME_STRONG, since a
+// strong count that drops to zero can then never be revived.
+//
 // A weakref_impl holds all the information, including both reference counts,
 // required to perform wp<> operations.  Thus these can continue to be performed
 // after the RefBase object has been destroyed.
@@ -190,6 +198,12 @@ public:
     RefBase* const          mBase;
     std::atomic<int32_t>    mFlags;
 
+    // Whether strong references share a single weak reference. Set before the
+    // first strong reference and never cleared, so a relaxed load is enough.
+    bool hasFastStrongRefs() const {
+        return (mFlags.load(std::memory_order_relaxed) & OBJECT_FAST_STRONG_REFS) != 0;
+    }
+
 #if !DEBUG_REFS
 
     explicit weakref_impl(RefBase* base)
@@ -451,7 +465,9 @@ private:
 void RefBase::incStrong(const void* id) const
 {
     weakref_impl* const refs = mRefs;
-    refs->incWeak(id);
+    if (!refs->hasFastStrongRefs()) {
+        refs->incWeak(id);
+    }
 
     refs->addStrongRef(id);
     const int32_t c = refs->mStrong.fetch_add(1, std::memory_order_relaxed);
@@ -473,7 +489,9 @@ void RefBase::incStrong(const void* id) const
 
 void RefBase::incStrongRequireStrong(const void* id) const {
     weakref_impl* const refs = mRefs;
-    refs->incWeak(id);
+    if (!refs->hasFastStrongRefs()) {
+        refs->incWeak(id);
+    }
 
     refs->addStrongRef(id);
     const int32_t c = refs->mStrong.fetch_add(1, std::memory_order_relaxed);
@@ -488,6 +506,9 @@ void RefBase::incStrongRequireStrong(const void* id) const {
 void RefBase::decStrong(const void* id) const
 {
     weakref_impl* const refs = mRefs;
+    // Must be read before the decrement; in the OBJECT_FAST_STRONG_REFS case
+    // we hold no weak reference of our own, so refs may be gone after it.
+    const bool fastStrongRefs = refs->hasFastStrongRefs();
     refs->removeStrongRef(id);
     const int32_t c = refs->mStrong.fetch_sub(1, std::memory_order_release);
 #if PRINT_REFS
@@ -515,7 +536,12 @@ void RefBase::decStrong(const void* id) const
     // they can change between `delete this;` and `refs->decWeak(id);`. This is
     // not the case. The analyzer may become more okay with this patten when
     // https://bugs.llvm.org/show_bug.cgi?id=34365 gets resolved. NOLINTNEXTLINE
-    refs->decWeak(id);
+    if (!fastStrongRefs) {
+        refs->decWeak(id);
+    } else if (c == 1) {
+        // Release the weak reference shared by all strong references.
+        refs->decWeak(refs);
+    }
 }
 
 void RefBase::forceIncStrong(const void* id) const
@@ -523,7 +549,9 @@ void RefBase::forceIncStrong(const void* id) const
     // Allows initial mStrong of 0 in addition to INITIAL_STRONG_VALUE.
     // TODO: Better document assumptions.
     weakref_impl* const refs = mRefs;
-    refs->incWeak(id);
+    if (!refs->hasFastStrongRefs()) {
+        refs->incWeak(id);
+    }
 
     refs->addStrongRef(id);
     const int32_t c = refs->mStrong.fetch_add(1, std::memory_order_relaxed);
@@ -707,6 +735,14 @@ bool RefBase::weakref_type::attemptIncStrong(const void* id)
                 std::memory_order_relaxed);
     }
 
+    if (impl->hasFastStrongRefs()) {
+        // The new strong reference is covered by the shared weak reference,
+        // so give back the one taken above. The caller's own weak reference
+        // keeps this from being the last one.
+        impl->removeWeakRef(id);
+        impl->mWeak.fetch_sub(1, std::memory_order_relaxed);
+    }
+
     return true;
 }
 
@@ -809,7 +845,20 @@ void RefBase::extendObjectLifetime(int32_t mode)
 
     // Must be happens-before ordered with respect to construction or any
     // operation that could destroy the object.
-    mRefs->mFlags.fetch_or(mode, std::memory_order_relaxed);
+    if ((mode & OBJECT_FAST_STRONG_REFS) != 0) {
+        LOG_ALWAYS_FATAL_IF(mRefs->mStrong.load(std::memory_order_relaxed) != INITIAL_STRONG_VALUE,
+                            "OBJECT_FAST_STRONG_REFS set on %p after its first strong reference",
+                            this);
+    }
+    const int32_t oldFlags = mRefs->mFlags.fetch_or(mode, std::memory_order_relaxed);
+    const int32_t flags = oldFlags | mode;
+    LOG_ALWAYS_FATAL_IF((flags & OBJECT_FAST_STRONG_REFS) != 0 &&
+                                (flags & OBJECT_LIFETIME_MASK) != OBJECT_LIFETIME_STRONG,
+                        "OBJECT_FAST_STRONG_REFS requires OBJECT_LIFETIME_STRONG (%p)", this);
+    if ((oldFlags & OBJECT_FAST_STRONG_REFS) == 0 && (flags & OBJECT_FAST_STRONG_REFS) != 0) {
+        // Take the weak reference shared by all strong references.
+        mRefs->incWeak(mRefs);
+    }
 }
 
 void RefBase::onFirstRef()
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/RefBase.h>
+#include <utils/StrongPointer.h>
+
+using android::RefBase;
+using android::sp;
+using android::wp;
+
+class Plain : public RefBase {};
+
+class Fast : public RefBase {
+  public:
+    Fast() { extendObjectLifetime(OBJECT_FAST_STRONG_REFS); }
+};
+
+template <typename T>
+static void BM_sp_copy(benchmark::State& state) {
+    sp<T> obj = sp<T>::make();
+    for (auto _ : state) {
+        sp<T> copy = obj;
+        benchmark::DoNotOptimize(copy.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_sp_copy, Plain);
+BENCHMARK_TEMPLATE(BM_sp_copy, Fast);
+
+// Threads share one object, so every copy bounces its reference counts
+// between cores.
+template <typename T>
+static void BM_sp_copy_shared(benchmark::State& state) {
+    static sp<T> obj = sp<T>::make();
+    for (auto _ : state) {
+        sp<T> copy = obj;
+        benchmark::DoNotOptimize(copy.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_sp_copy_shared, Plain)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_sp_copy_shared, Fast)->ThreadRange(1, 8)->UseRealTime();
+
+template <typename T>
+static void BM_sp_make(benchmark::State& state) {
+    for (auto _ : state) {
+        sp<T> obj = sp<T>::make();
+        benchmark::DoNotOptimize(obj.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_sp_make, Plain);
+BENCHMARK_TEMPLATE(BM_sp_make, Fast);
+
+template <typename T>
+static void BM_wp_promote(benchmark::State& state) {
+    sp<T> obj = sp<T>::make();
+    wp<T> weak = obj;
+    for (auto _ : state) {
+        sp<T> promoted = weak.promote();
+        benchmark::DoNotOptimize(promoted.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_wp_promote, Plain);
+BENCHMARK_TEMPLATE(BM_wp_promote, Fast);
@@ -280,6 +280,78 @@ TEST(RefBase, StackOwnershipDeath) {
     EXPECT_DEATH({ Foo foo(&isDeleted); foo.incStrong(nullptr); }, "");
 }
 
+// A version of Foo whose strong references share a single weak reference.
+class FastFoo : public RefBase {
+public:
+    FastFoo(bool* deleted_check) : mDeleted(deleted_check) {
+        *mDeleted = false;
+        extendObjectLifetime(OBJECT_FAST_STRONG_REFS);
+    }
+
+    ~FastFoo() {
+        *mDeleted = true;
+    }
+
+    void setFastStrongRefs() { extendObjectLifetime(OBJECT_FAST_STRONG_REFS); }
+    void extendToWeakLifetime() { extendObjectLifetime(OBJECT_LIFETIME_WEAK); }
+private:
+    bool* mDeleted;
+};
+
+TEST(RefBase, FastStrongRefs) {
+    bool isDeleted;
+    FastFoo* foo = new FastFoo(&isDeleted);
+    ASSERT_EQ(INITIAL_STRONG_VALUE, foo->getStrongCount());
+    // The weak reference shared by all strong references.
+    ASSERT_EQ(1, foo->getWeakRefs()->getWeakCount());
+    sp<FastFoo> sp1(foo);
+    {
+        sp<FastFoo> sp2 = sp1;
+        ASSERT_EQ(2, foo->getStrongCount());
+        ASSERT_EQ(1, foo->getWeakRefs()->getWeakCount());
+    }
+    wp<FastFoo> wp1(sp1);
+    ASSERT_EQ(1, foo->getStrongCount());
+    ASSERT_EQ(2, foo->getWeakRefs()->getWeakCount());
+    {
+        sp<FastFoo> sp2 = wp1.promote();
+        ASSERT_EQ(foo, sp2.get());
+        ASSERT_EQ(2, foo->getStrongCount());
+        ASSERT_EQ(2, foo->getWeakRefs()->getWeakCount());
+    }
+    ASSERT_FALSE(isDeleted);
+    sp1 = nullptr;
+    ASSERT_TRUE(isDeleted) << "foo was leaked!";
+    ASSERT_EQ(nullptr, wp1.promote().get());
+}
+
+TEST(RefBase, FastStrongRefsWeakFirst) {
+    bool isDeleted;
+    FastFoo* foo = new FastFoo(&isDeleted);
+    wp<FastFoo> wp1(foo);
+    // Promotion may take the first strong reference.
+    sp<FastFoo> sp1 = wp1.promote();
+    ASSERT_EQ(foo, sp1.get());
+    ASSERT_EQ(1, foo->getStrongCount());
+    wp1 = nullptr;
+    ASSERT_FALSE(isDeleted);
+    sp1 = nullptr;
+    ASSERT_TRUE(isDeleted);
+}
+
+TEST(RefBase, FastStrongRefsAfterFirstRefDeath) {
+    bool isDeleted;
+    sp<FastFoo> foo = sp<FastFoo>::make(&isDeleted);
+    // Too late: the existing strong reference holds no weak reference.
+    EXPECT_DEATH(foo->setFastStrongRefs(), "");
+}
+
+TEST(RefBase, FastStrongRefsWeakLifetimeDeath) {
+    bool isDeleted;
+    sp<FastFoo> foo = sp<FastFoo>::make(&isDeleted);
+    EXPECT_DEATH(foo->extendToWeakLifetime(), "");
+}
+
 // Set up a situation in which we race with visit2AndRremove() to delete
 // 2 strong references.  Bar destructor checks that there are no early
 // deletions and prior updates are visible to destructor.
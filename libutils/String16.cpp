@@ -29,6 +29,13 @@ static inline char16_t* getEmptyString() {
     return const_cast<char16_t*>(emptyString.string());
 }
 
+static inline bool isAscii(const char* str, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (static_cast<uint8_t>(str[i]) >= 0x80) return false;
+    }
+    return true;
+}
+
 // ---------------------------------------------------------------------------
 
 void* String16::alloc(size_t size)
@@ -42,6 +49,19 @@ char16_t* String16::allocFromUTF8(const char* u8str, size_t u8len)
 {
     if (u8len == 0) return getEmptyString();
 
+    // Interface descriptors, keys and the like are plain ASCII. Those map to one UTF-16 code
+    // unit per byte, so skip the separate length pass and the decoder for them.
+    if (u8len < SIZE_MAX / sizeof(char16_t) && isAscii(u8str, u8len)) {
+        SharedBuffer* buf = static_cast<SharedBuffer*>(alloc(sizeof(char16_t) * (u8len + 1)));
+        if (!buf) return getEmptyString();
+        char16_t* u16str = (char16_t*)buf->data();
+        for (size_t i = 0; i < u8len; i++) {
+            u16str[i] = static_cast<char16_t>(u8str[i]);
+        }
+        u16str[u8len] = 0;
+        return u16str;
+    }
+
     const uint8_t* u8cur = (const uint8_t*) u8str;
 
     const ssize_t u16len = utf8_to_utf16_length(u8cur, u8len);
@@ -71,6 +91,7 @@ char16_t* String16::allocFromUTF16(const char16_t* u16str, size_t u16len) {
         android_errorWriteLog(0x534e4554, "73826242");
         abort();
     }
+    if (u16len == 0) return getEmptyString();
 
     SharedBuffer* buf = static_cast<SharedBuffer*>(alloc((u16len + 1) * sizeof(char16_t)));
     ALOG_ASSERT(buf, "Unable to allocate shared buffer");
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+static const char kDescriptor[] = "android.hardware.graphics.composer3.IComposer";
+static const char16_t kDescriptor16[] = u"android.hardware.graphics.composer3.IComposer";
+
+void BM_String16_fromUTF8(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        android::String16 s(kDescriptor);
+        benchmark::DoNotOptimize(s.string());
+    }
+}
+BENCHMARK(BM_String16_fromUTF8);
+
+void BM_String16_fromUTF16(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        android::String16 s(kDescriptor16);
+        benchmark::DoNotOptimize(s.string());
+    }
+}
+BENCHMARK(BM_String16_fromUTF16);
+
+void BM_String16_fromEmptyUTF16(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        android::String16 s(u"");
+        benchmark::DoNotOptimize(s.string());
+    }
+}
+BENCHMARK(BM_String16_fromEmptyUTF16);
+
+void BM_String8_fromUTF16(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        android::String8 s(kDescriptor16);
+        benchmark::DoNotOptimize(s.c_str());
+    }
+}
+BENCHMARK(BM_String8_fromUTF16);
@@ -212,6 +212,13 @@ TEST(String16Test, EmptyStringIsStatic) {
     EXPECT_TRUE(tmp.isStaticString());
 }
 
+TEST(String16Test, EmptyChar16_tStringIsStatic) {
+    String16 tmp(u"");
+    EXPECT_TRUE(tmp.isStaticString());
+    String16 sized(u"Verify me", 0);
+    EXPECT_TRUE(sized.isStaticString());
+}
+
 TEST(String16Test, OverreadUtf8Conversion) {
     char tmp[] = {'a', static_cast<char>(0xe0), '\0'};
     String16 another(tmp);
@@ -224,6 +231,12 @@ TEST(String16Test, ValidUtf8Conversion) {
     EXPECT_STR16EQ(another, u"abcdef");
 }
 
+TEST(String16Test, NonAsciiUtf8Conversion) {
+    String16 another("ab\xc3\xa9\xf0\x9f\x98\x80");
+    EXPECT_EQ(5U, another.size());
+    EXPECT_STR16EQ(another, u"ab\u00e9\U0001f600");
+}
+
 TEST(String16Test, append) {
     String16 s;
     EXPECT_EQ(OK, s.append(String16(u"foo")));
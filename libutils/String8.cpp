@@ -81,6 +81,24 @@ static char* allocFromUTF16(const char16_t* in, size_t len)
 {
     if (len == 0) return getEmptyString();
 
+    // Most strings coming from String16 are plain ASCII, which maps to one byte per code unit,
+    // so skip the separate length pass and the encoder for them.
+    size_t asciiLen = 0;
+    while (asciiLen < len && in[asciiLen] < 0x80) asciiLen++;
+    if (asciiLen == len && len != SIZE_MAX) {
+        SharedBuffer* buf = SharedBuffer::alloc(len + 1);
+        ALOG_ASSERT(buf, "Unable to allocate shared buffer");
+        if (!buf) {
+            return getEmptyString();
+        }
+        char* resultStr = (char*)buf->data();
+        for (size_t i = 0; i < len; i++) {
+            resultStr[i] = static_cast<char>(in[i]);
+        }
+        resultStr[len] = 0;
+        return resultStr;
+    }
+
      // Allow for closing '\0'
     const ssize_t resultStrLen = utf16_to_utf8_length(in, len) + 1;
     if (resultStrLen < 1) {
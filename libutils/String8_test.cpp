@@ -103,6 +103,12 @@ TEST_F(String8Test, ValidUtf16Conversion) {
     EXPECT_STREQ(valid, "abcdef");
 }
 
+TEST_F(String8Test, NonAsciiUtf16Conversion) {
+    String8 valid(u"ab\u00e9\U0001f600");
+    EXPECT_EQ(8U, valid.length());
+    EXPECT_STREQ(valid, "ab\xc3\xa9\xf0\x9f\x98\x80");
+}
+
 TEST_F(String8Test, append) {
     String8 s;
     EXPECT_EQ(OK, s.append("foo"));
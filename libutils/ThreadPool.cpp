@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ThreadPool"
+
+#include <utils/ThreadPool.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <utils/Log.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+static constexpr size_t kNumPriorities = 3;
+
+// Hidden, so that none of it becomes part of the library's ABI.
+struct __attribute__((visibility("hidden"))) ThreadPool::Impl {
+    struct Entry {
+        Task task;
+        int64_t submitNs;
+    };
+
+    struct alignas(64) Worker {
+        std::mutex lock;
+        std::deque<Entry> queues[kNumPriorities];
+        std::thread thread;
+    };
+
+    explicit Impl(const Options& options) : options(options) {}
+
+    bool isWorkerThread() const;
+    bool submit(Task task, Priority priority);
+    void threadLoop(size_t index);
+    void setupWorker(size_t index);
+    bool takeTask(size_t index, Entry* entry);
+    void runTask(Entry& entry);
+    void wait();
+    void shutdown();
+
+    Options options;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> nextWorker = 0;
+
+    // Tasks queued and not yet taken, and tasks submitted and not yet done.
+    std::atomic<size_t> queued = 0;
+    std::atomic<size_t> pending = 0;
+    std::mutex lock;
+    std::condition_variable workAvailable;
+    std::condition_variable idle;
+    bool stopping = false;
+
+    std::atomic<uint64_t> tasksRun = 0;
+    std::atomic<uint64_t> tasksStolen = 0;
+    std::atomic<uint64_t> totalQueueNs = 0;
+    std::atomic<uint64_t> maxQueueNs = 0;
+    std::atomic<uint64_t> totalRunNs = 0;
+    std::atomic<uint64_t> maxRunNs = 0;
+};
+
+// The pool and worker index of the calling thread, if it is a worker.
+static thread_local const void* tCurrentPool = nullptr;
+static thread_local size_t tCurrentIndex = 0;
+
+static void updateMax(std::atomic<uint64_t>& max, uint64_t value) {
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (value > current &&
+           !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+ThreadPool::ThreadPool(const Options& options) : mImpl(std::make_unique<Impl>(options)) {
+    size_t numThreads = options.numThreads;
+    if (numThreads == 0) {
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    // All workers must exist before any thread starts stealing from them.
+    for (size_t i = 0; i < numThreads; i++) {
+        mImpl->workers.push_back(std::make_unique<Impl::Worker>());
+    }
+    for (size_t i = 0; i < numThreads; i++) {
+        mImpl->workers[i]->thread = std::thread(&Impl::threadLoop, mImpl.get(), i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    shutdown();
+}
+
+bool ThreadPool::Impl::isWorkerThread() const {
+    return tCurrentPool == this;
+}
+
+bool ThreadPool::Impl::submit(Task task, Priority priority) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (stopping) {
+            return false;
+        }
+        pending++;
+    }
+
+    size_t index = isWorkerThread()
+                           ? tCurrentIndex
+                           : nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    Worker& worker = *workers[index];
+    {
+        std::lock_guard<std::mutex> guard(worker.lock);
+        worker.queues[static_cast<size_t>(priority)].push_back(
+                {std::move(task), systemTime(SYSTEM_TIME_MONOTONIC)});
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queued++;
+    }
+    workAvailable.notify_one();
+    return true;
+}
+
+bool ThreadPool::Impl::takeTask(size_t index, Entry* entry) {
+    for (size_t p = kNumPriorities; p-- > 0;) {
+        // Newest task of our own queue first, as its data is likely still in
+        // this CPU's caches.
+        {
+            Worker& own = *workers[index];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.queues[p].empty()) {
+                *entry = std::move(own.queues[p].back());
+                own.queues[p].pop_back();
+                queued--;
+                return true;
+            }
+        }
+        // Then the oldest task of another worker.
+        for (size_t i = 1; i < workers.size(); i++) {
+            Worker& victim = *workers[(index + i) % workers.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.queues[p].empty()) {
+                *entry = std::move(victim.queues[p].front());
+                victim.queues[p].pop_front();
+                queued--;
+                tasksStolen.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::Impl::runTask(Entry& entry) {
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    entry.task();
+    nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    uint64_t queueNs = start - entry.submitNs;
+    uint64_t runNs = end - start;
+    tasksRun.fetch_add(1, std::memory_order_relaxed);
+    totalQueueNs.fetch_add(queueNs, std::memory_order_relaxed);
+    totalRunNs.fetch_add(runNs, std::memory_order_relaxed);
+    updateMax(maxQueueNs, queueNs);
+    updateMax(maxRunNs, runNs);
+
+    // Drop anything the task captured before reporting it done.
+    entry.task = nullptr;
+    if (pending.fetch_sub(1) == 1) {
+        // Taking the lock orders this with the waiters' checks of pending.
+        { std::lock_guard<std::mutex> guard(lock); }
+        idle.notify_all();
+        workAvailable.notify_all();
+    }
+}
+
+void ThreadPool::Impl::setupWorker(size_t index) {
+    tCurrentPool = this;
+    tCurrentIndex = index;
+
+    std::string name = options.name + ":" + std::to_string(index);
+    // The kernel limits names to 15 characters.
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+
+    if (!options.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : options.cpus) {
+            CPU_SET(cpu, &set);
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            ALOGW("%s: failed to set affinity: %s", name.c_str(), strerror(errno));
+        }
+    }
+
+    if (options.niceness != 0 && setpriority(PRIO_PROCESS, 0, options.niceness) != 0) {
+        ALOGW("%s: failed to set niceness %d: %s", name.c_str(), options.niceness,
+              strerror(errno));
+    }
+
+    if (options.onThreadStart) {
+        options.onThreadStart(index);
+    }
+}
+
+void ThreadPool::Impl::threadLoop(size_t index) {
+    setupWorker(index);
+
+    while (true) {
+        Entry entry;
+        if (takeTask(index, &entry)) {
+            runTask(entry);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(lock);
+        workAvailable.wait(guard, [this] { return queued > 0 || (stopping && pending == 0); });
+        if (queued == 0 && stopping && pending == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::Impl::wait() {
+    LOG_ALWAYS_FATAL_IF(isWorkerThread(), "ThreadPool::wait() called from a worker");
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return pending == 0; });
+}
+
+void ThreadPool::Impl::shutdown() {
+    LOG_ALWAYS_FATAL_IF(isWorkerThread(), "ThreadPool::shutdown() called from a worker");
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+bool ThreadPool::isWorkerThread() const {
+    return mImpl->isWorkerThread();
+}
+
+bool ThreadPool::submit(Task task, Priority priority) {
+    return mImpl->submit(std::move(task), priority);
+}
+
+void ThreadPool::wait() {
+    mImpl->wait();
+}
+
+void ThreadPool::shutdown() {
+    mImpl->shutdown();
+}
+
+size_t ThreadPool::getThreadCount() const {
+    return mImpl->workers.size();
+}
+
+ThreadPool::Stats ThreadPool::getStats() const {
+    Stats stats;
+    stats.tasksRun = mImpl->tasksRun.load(std::memory_order_relaxed);
+    stats.tasksStolen = mImpl->tasksStolen.load(std::memory_order_relaxed);
+    stats.totalQueueNs = mImpl->totalQueueNs.load(std::memory_order_relaxed);
+    stats.maxQueueNs = mImpl->maxQueueNs.load(std::memory_order_relaxed);
+    stats.totalRunNs = mImpl->totalRunNs.load(std::memory_order_relaxed);
+    stats.maxRunNs = mImpl->maxRunNs.load(std::memory_order_relaxed);
+    return stats;
+}
+
+}  // namespace android
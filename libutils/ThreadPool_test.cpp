@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/ThreadPool.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+static ThreadPool::Options makeOptions(size_t numThreads) {
+    ThreadPool::Options options;
+    options.numThreads = numThreads;
+    options.name = "test";
+    return options;
+}
+
+TEST(ThreadPool, RunsAllTasks) {
+    ThreadPool pool(makeOptions(4));
+    EXPECT_EQ(4u, pool.getThreadCount());
+
+    std::atomic<int> count = 0;
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_TRUE(pool.submit([&count] { count++; }));
+    }
+    pool.wait();
+    EXPECT_EQ(1000, count);
+    EXPECT_EQ(1000u, pool.getStats().tasksRun);
+}
+
+TEST(ThreadPool, Async) {
+    ThreadPool pool(makeOptions(2));
+    auto future = pool.async([] { return 42; });
+    ASSERT_TRUE(future.valid());
+    EXPECT_EQ(42, future.get());
+}
+
+TEST(ThreadPool, NestedSubmit) {
+    ThreadPool pool(makeOptions(3));
+    std::atomic<int> count = 0;
+    for (int i = 0; i < 10; i++) {
+        pool.submit([&pool, &count] {
+            EXPECT_TRUE(pool.isWorkerThread());
+            for (int j = 0; j < 10; j++) {
+                pool.submit([&count] { count++; });
+            }
+        });
+    }
+    // wait() also covers tasks submitted by tasks.
+    pool.wait();
+    EXPECT_EQ(100, count);
+    EXPECT_FALSE(pool.isWorkerThread());
+}
+
+TEST(ThreadPool, HighPriorityFirst) {
+    ThreadPool pool(makeOptions(1));
+
+    // Keep the only worker busy while the other tasks are queued.
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    pool.submit([released] { released.wait(); });
+
+    std::mutex lock;
+    std::vector<int> order;
+    auto record = [&](int value) {
+        return [&, value] {
+            std::lock_guard<std::mutex> guard(lock);
+            order.push_back(value);
+        };
+    };
+    pool.submit(record(0), ThreadPool::Priority::LOW);
+    pool.submit(record(1), ThreadPool::Priority::NORMAL);
+    pool.submit(record(2), ThreadPool::Priority::HIGH);
+    release.set_value();
+    pool.wait();
+
+    EXPECT_EQ((std::vector<int>{2, 1, 0}), order);
+}
+
+TEST(ThreadPool, Stealing) {
+    ThreadPool pool(makeOptions(4));
+    std::atomic<int> count = 0;
+
+    // A single task fans out onto its own worker's queue; the other workers
+    // can only get at that work by stealing it.
+    pool.submit([&pool, &count] {
+        for (int i = 0; i < 64; i++) {
+            pool.submit([&count] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                count++;
+            });
+        }
+    });
+    pool.wait();
+    EXPECT_EQ(64, count);
+    EXPECT_GT(pool.getStats().tasksStolen, 0u);
+}
+
+TEST(ThreadPool, ShutdownRunsQueuedTasks) {
+    std::atomic<int> count = 0;
+    {
+        ThreadPool pool(makeOptions(2));
+        for (int i = 0; i < 100; i++) {
+            pool.submit([&count] { count++; });
+        }
+    }
+    EXPECT_EQ(100, count);
+}
+
+TEST(ThreadPool, OnThreadStart) {
+    std::mutex lock;
+    std::set<size_t> started;
+    ThreadPool::Options options = makeOptions(3);
+    options.onThreadStart = [&](size_t index) {
+        std::lock_guard<std::mutex> guard(lock);
+        started.insert(index);
+    };
+    {
+        ThreadPool pool(options);
+        pool.wait();
+    }
+    EXPECT_EQ((std::set<size_t>{0, 1, 2}), started);
+}
+
+TEST(ThreadPool, SubmitAfterShutdown) {
+    ThreadPool pool(makeOptions(2));
+    pool.shutdown();
+    EXPECT_FALSE(pool.submit([] {}));
+    EXPECT_FALSE(pool.async([] { return 1; }).valid());
+}
+
+}  // namespace android
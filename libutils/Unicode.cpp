@@ -20,8 +20,16 @@
 #include <limits.h>
 #include <utils/Unicode.h>
 
+#include <algorithm>
+
 #include <log/log.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 extern "C" {
 
 static const char32_t kByteMask = 0x000000BF;
@@ -52,6 +60,112 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+// --------------------------------------------------------------------------
+// ASCII runs
+// --------------------------------------------------------------------------
+
+// Most text that goes through these conversions is ASCII, so the helpers below handle runs of
+// ASCII characters 16 bytes or 8 code units at a time. SSE2 and NEON are part of the baseline
+// of x86 and arm64 respectively, so other architectures just get the scalar loop. The helpers
+// are kept out of line: inlining them into the per-character loops slows those down for text
+// that has few ASCII characters, such as CJK.
+
+// Returns the number of ASCII characters at the start of src.
+__attribute__((noinline))
+static size_t utf8_ascii_prefix_length(const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        const int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(src + i)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+#elif defined(__aarch64__)
+    for (; i + 16 <= len; i += 16) {
+        if (vmaxvq_u8(vld1q_u8(src + i)) >= 0x80) break;
+    }
+#endif
+    while (i < len && src[i] < 0x80) i++;
+    return i;
+}
+
+// Returns the number of ASCII characters at the start of src.
+__attribute__((noinline))
+static size_t utf16_ascii_prefix_length(const char16_t* src, size_t len)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i nonAscii = _mm_set1_epi16((short)0xff80);
+    for (; i + 8 <= len; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, nonAscii),
+                                              _mm_setzero_si128())) != 0xffff) break;
+    }
+#elif defined(__aarch64__)
+    for (; i + 8 <= len; i += 8) {
+        if (vmaxvq_u16(vld1q_u16((const uint16_t*)(src + i))) >= 0x80) break;
+    }
+#endif
+    while (i < len && src[i] < 0x80) i++;
+    return i;
+}
+
+// Copies the ASCII characters at the start of src to dst, as long as there are at most len.
+// Returns the number of characters copied.
+__attribute__((noinline))
+static size_t utf8_to_utf16_ascii(const uint8_t* src, size_t len, char16_t* dst)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        if (_mm_movemask_epi8(v) != 0) break;
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+    }
+#elif defined(__aarch64__)
+    for (; i + 16 <= len; i += 16) {
+        const uint8x16_t v = vld1q_u8(src + i);
+        if (vmaxvq_u8(v) >= 0x80) break;
+        vst1q_u16((uint16_t*)(dst + i), vmovl_u8(vget_low_u8(v)));
+        vst1q_u16((uint16_t*)(dst + i + 8), vmovl_high_u8(v));
+    }
+#endif
+    for (; i < len && src[i] < 0x80; i++) {
+        dst[i] = src[i];
+    }
+    return i;
+}
+
+// Copies the ASCII characters at the start of src to dst, as long as there are at most len.
+// Returns the number of characters copied.
+__attribute__((noinline))
+static size_t utf16_to_utf8_ascii(const char16_t* src, size_t len, char* dst)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i nonAscii = _mm_set1_epi16((short)0xff80);
+    for (; i + 16 <= len; i += 16) {
+        const __m128i lo = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i hi = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        const __m128i high_bits = _mm_and_si128(_mm_or_si128(lo, hi), nonAscii);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high_bits, _mm_setzero_si128())) != 0xffff) break;
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(__aarch64__)
+    for (; i + 16 <= len; i += 16) {
+        const uint16x8_t lo = vld1q_u16((const uint16_t*)(src + i));
+        const uint16x8_t hi = vld1q_u16((const uint16_t*)(src + i + 8));
+        if (vmaxvq_u16(vorrq_u16(lo, hi)) >= 0x80) break;
+        vst1q_u8((uint8_t*)(dst + i), vmovn_high_u16(vmovn_u16(lo), hi));
+    }
+#endif
+    for (; i < len && src[i] < 0x80; i++) {
+        dst[i] = (char)src[i];
+    }
+    return i;
+}
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -290,6 +404,16 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst, size_t dst_le
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
+        if (*cur_utf16 < 0x80) {
+            const size_t n = utf16_to_utf8_ascii(
+                    cur_utf16, std::min<size_t>(end_utf16 - cur_utf16, dst_len), cur);
+            if (n > 0) {
+                cur_utf16 += n;
+                cur += n;
+                dst_len -= n;
+                continue;
+            }
+        }
         char32_t utf32;
         // surrogate pairs
         if((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16
@@ -324,7 +448,11 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     const char16_t* const end = src + src_len;
     while (src < end) {
         size_t char_len;
-        if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
+        if (*src < 0x80) {
+            // A run of ASCII characters, one byte each.
+            char_len = utf16_ascii_prefix_length(src, end - src);
+            src += char_len;
+        } else if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
                 && (*(src + 1) & 0xFC00) == 0xDC00) {
             // surrogate pairs are always 4 bytes.
             char_len = 4;
@@ -402,6 +530,12 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len, bool overreadIs
     /* Validate that the UTF-8 is the correct len */
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
+        if (*u8cur < 0x80) {
+            const size_t n = utf8_ascii_prefix_length(u8cur, u8end - u8cur);
+            u16measuredLen += n;
+            u8cur += n;
+            continue;
+        }
         u16measuredLen++;
         int u8charLen = utf8_codepoint_len(*u8cur);
         // Malformed utf8, some characters are beyond the end.
@@ -455,6 +589,13 @@ char16_t* utf8_to_utf16_no_null_terminator(
     char16_t* u16cur = dst;
 
     while (u8cur < u8end && u16cur < u16end) {
+        if (*u8cur < 0x80) {
+            const size_t n = utf8_to_utf16_ascii(
+                    u8cur, std::min<size_t>(u8end - u8cur, u16end - u16cur), u16cur);
+            u8cur += n;
+            u16cur += n;
+            continue;
+        }
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
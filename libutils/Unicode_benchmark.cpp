@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/Unicode.h>
+
+#include <string>
+
+// About 1KiB of text of the given kind.
+static std::string MakeText(const char* phrase) {
+    std::string text;
+    while (text.size() < 1024) text += phrase;
+    return text;
+}
+
+static const char kAscii[] = "android.hardware.graphics.composer3.IComposer/default ";
+static const char kLatin[] = "Gr\xc3\xbc\xc3\x9f Gott, willkommen in der sch\xc3\xb6nen Stra\xc3\x9f" "e! ";
+static const char kCjk[] = "\xe4\xbd\xa0\xe5\xa5\xbd\xef\xbc\x8c\xe4\xb8\x96\xe7\x95\x8c\xe3\x80\x82";
+
+static std::u16string ToUtf16(const std::string& utf8) {
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(utf8.data());
+    std::u16string utf16(utf8_to_utf16_length(src, utf8.size()), u'\0');
+    utf8_to_utf16(src, utf8.size(), utf16.data(), utf16.size() + 1);
+    return utf16;
+}
+
+static void BM_utf8_to_utf16(benchmark::State& state, const char* phrase) {
+    const std::string text = MakeText(phrase);
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(text.data());
+    std::u16string out(text.size() + 1, u'\0');
+    while (state.KeepRunning()) {
+        ssize_t len = utf8_to_utf16_length(src, text.size());
+        utf8_to_utf16(src, text.size(), out.data(), len + 1);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK_CAPTURE(BM_utf8_to_utf16, ascii, kAscii);
+BENCHMARK_CAPTURE(BM_utf8_to_utf16, latin, kLatin);
+BENCHMARK_CAPTURE(BM_utf8_to_utf16, cjk, kCjk);
+
+static void BM_utf16_to_utf8(benchmark::State& state, const char* phrase) {
+    const std::u16string text = ToUtf16(MakeText(phrase));
+    std::string out(text.size() * 3 + 1, '\0');
+    while (state.KeepRunning()) {
+        ssize_t len = utf16_to_utf8_length(text.data(), text.size());
+        utf16_to_utf8(text.data(), text.size(), out.data(), len + 1);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * text.size() * sizeof(char16_t));
+}
+BENCHMARK_CAPTURE(BM_utf16_to_utf8, ascii, kAscii);
+BENCHMARK_CAPTURE(BM_utf16_to_utf8, latin, kLatin);
+BENCHMARK_CAPTURE(BM_utf16_to_utf8, cjk, kCjk);
@@ -19,6 +19,8 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <string>
+
 #include <log/log.h>
 #include <utils/Unicode.h>
 
@@ -297,6 +299,42 @@ TEST_F(UnicodeTest, strstr16TargetNotPresent) {
     EXPECT_EQ(nullptr, result);
 }
 
+// Long inputs go through the vectorized ASCII loops, so check that characters that aren't
+// ASCII are still converted correctly at every possible offset within a block.
+TEST_F(UnicodeTest, UTF8toUTF16MixedLongString) {
+    for (size_t pos = 0; pos < 40; pos++) {
+        std::string utf8(40, 'a');
+        utf8.replace(pos, 1, "\xc3\xa9");  // U+00E9
+        utf8 += "\xf0\x9f\x98\x80";        // U+1F600
+        std::u16string expect(40, u'a');
+        expect[pos] = u'\u00e9';
+        expect += u"\U0001f600";
+
+        const uint8_t* input = reinterpret_cast<const uint8_t*>(utf8.data());
+        ASSERT_EQ(static_cast<ssize_t>(expect.size()), utf8_to_utf16_length(input, utf8.size()));
+        std::u16string output(expect.size(), u'\0');
+        utf8_to_utf16(input, utf8.size(), output.data(), output.size() + 1);
+        EXPECT_EQ(expect, output) << "non-ASCII character at " << pos;
+    }
+}
+
+TEST_F(UnicodeTest, UTF16toUTF8MixedLongString) {
+    for (size_t pos = 0; pos < 40; pos++) {
+        std::u16string utf16(40, u'a');
+        utf16[pos] = u'\u0080';
+        utf16 += u"\U0001f600";
+        std::string expect(40, 'a');
+        expect.replace(pos, 1, "\xc2\x80");
+        expect += "\xf0\x9f\x98\x80";
+
+        ASSERT_EQ(static_cast<ssize_t>(expect.size()),
+                  utf16_to_utf8_length(utf16.data(), utf16.size()));
+        std::string output(expect.size(), '\0');
+        utf16_to_utf8(utf16.data(), utf16.size(), output.data(), output.size() + 1);
+        EXPECT_EQ(expect, output) << "non-ASCII character at " << pos;
+    }
+}
+
 // http://b/29267949
 // Test that overreading in utf8_to_utf16_length is detected
 TEST_F(UnicodeTest, InvalidUtf8OverreadDetected) {
@@ -39,6 +39,13 @@ static inline size_t max(size_t a, size_t b) {
     return a>b ? a : b;
 }
 
+// Whether the vector owning storage is its only user. Its items can then be
+// moved to a new buffer, which is much cheaper than copying them and
+// destroying the originals for types like sp<> or std::string.
+static inline bool isOnlyOwner(const void* storage) {
+    return storage && SharedBuffer::bufferFromData(storage)->onlyOwner();
+}
+
 // ----------------------------------------------------------------------------
 
 VectorImpl::VectorImpl(size_t itemSize, uint32_t flags)
@@ -342,8 +349,13 @@ ssize_t VectorImpl::setCapacity(size_t new_capacity)
     SharedBuffer* sb = SharedBuffer::alloc(new_allocation_size);
     if (sb) {
         void* array = sb->data();
-        _do_copy(array, mStorage, size());
-        release_storage();
+        if (isOnlyOwner(mStorage)) {
+            _do_move_backward(array, mStorage, size());
+            SharedBuffer::dealloc(SharedBuffer::bufferFromData(mStorage));
+        } else {
+            _do_copy(array, mStorage, size());
+            release_storage();
+        }
         mStorage = const_cast<void*>(array);
     } else {
         return NO_MEMORY;
@@ -421,15 +433,28 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_alloc_size);
             if (sb) {
                 void* array = sb->data();
+                const bool relocate = isOnlyOwner(mStorage);
                 if (where != 0) {
-                    _do_copy(array, mStorage, where);
+                    if (relocate) {
+                        _do_move_backward(array, mStorage, where);
+                    } else {
+                        _do_copy(array, mStorage, where);
+                    }
                 }
                 if (where != mCount) {
                     const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
                     void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
-                    _do_copy(dest, from, mCount-where);
+                    if (relocate) {
+                        _do_move_backward(dest, from, mCount-where);
+                    } else {
+                        _do_copy(dest, from, mCount-where);
+                    }
+                }
+                if (relocate) {
+                    SharedBuffer::dealloc(SharedBuffer::bufferFromData(mStorage));
+                } else {
+                    release_storage();
                 }
-                release_storage();
                 mStorage = const_cast<void*>(array);
             } else {
                 return nullptr;
@@ -463,9 +488,11 @@ void VectorImpl::_shrink(size_t where, size_t amount)
     size_t new_size;
     LOG_ALWAYS_FATAL_IF(__builtin_sub_overflow(mCount, amount, &new_size));
 
-    if (new_size < (capacity() / 2)) {
+    // Only give memory back once the vector is a quarter full. Shrinking to twice the new size
+    // as soon as it drops below half would reallocate on every single removal after that.
+    if (new_size < (capacity() / 4)) {
         // NOTE: (new_size * 2) is safe because capacity didn't overflow and
-        // new_size < (capacity / 2)).
+        // new_size < (capacity / 4)).
         const size_t new_capacity = max(kMinVectorCapacity, new_size * 2);
 
         // NOTE: (new_capacity * mItemSize), (where * mItemSize) and
@@ -488,15 +515,30 @@ void VectorImpl::_shrink(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
                 void* array = sb->data();
+                const bool relocate = isOnlyOwner(mStorage);
                 if (where != 0) {
-                    _do_copy(array, mStorage, where);
+                    if (relocate) {
+                        _do_move_backward(array, mStorage, where);
+                    } else {
+                        _do_copy(array, mStorage, where);
+                    }
                 }
                 if (where != new_size) {
                     const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
                     void* dest = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
-                    _do_copy(dest, from, new_size - where);
+                    if (relocate) {
+                        _do_move_backward(dest, from, new_size - where);
+                    } else {
+                        _do_copy(dest, from, new_size - where);
+                    }
+                }
+                if (relocate) {
+                    // Only the removed items are left in the old buffer.
+                    _do_destroy(reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize, amount);
+                    SharedBuffer::dealloc(SharedBuffer::bufferFromData(mStorage));
+                } else {
+                    release_storage();
                 }
-                release_storage();
                 mStorage = const_cast<void*>(array);
             } else{
                 return;
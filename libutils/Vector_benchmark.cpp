@@ -15,7 +15,9 @@
  */
 
 #include <benchmark/benchmark.h>
+#include <utils/KeyedVector.h>
 #include <utils/Vector.h>
+#include <string>
 #include <vector>
 
 void BM_fill_android_vector(benchmark::State& state) {
@@ -50,4 +52,50 @@ void BM_prepend_std_vector(benchmark::State& state) {
 }
 BENCHMARK(BM_prepend_std_vector);
 
+struct Point {
+    int x, y;
+};
+
+void BM_fill_android_vector_struct(benchmark::State& state) {
+    android::Vector<Point> v;
+    while (state.KeepRunning()) {
+        v.push(Point{1, 2});
+    }
+}
+BENCHMARK(BM_fill_android_vector_struct);
+
+void BM_prepend_android_vector_struct(benchmark::State& state) {
+    for (auto _ : state) {
+        android::Vector<Point> v;
+        for (int i = 0; i < 1024; i++) {
+            v.insertAt(Point{i, i}, 0);
+        }
+    }
+}
+BENCHMARK(BM_prepend_android_vector_struct);
+
+void BM_fill_android_vector_string(benchmark::State& state) {
+    const std::string s(64, 'A');
+    for (auto _ : state) {
+        android::Vector<std::string> v;
+        for (int i = 0; i < 1024; i++) {
+            v.push(s);
+        }
+    }
+}
+BENCHMARK(BM_fill_android_vector_string);
+
+void BM_keyed_vector_indexOfKey(benchmark::State& state) {
+    android::KeyedVector<int, int> v;
+    for (int i = 0; i < 1024; i++) {
+        v.add(i * 2, i);
+    }
+    int key = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(v.indexOfKey(key));
+        key = (key + 7) % 2048;
+    }
+}
+BENCHMARK(BM_keyed_vector_indexOfKey);
+
 BENCHMARK_MAIN();
@@ -22,6 +22,7 @@
 
 #include <android/log.h>
 #include <gtest/gtest.h>
+#include <utils/KeyedVector.h>
 #include <utils/Vector.h>
 
 namespace android {
@@ -145,4 +146,96 @@ TEST_F(VectorTest, removeItemsAt_overflow) {
     ASSERT_DEATH(v.removeItemsAt(SIZE_MAX, SIZE_MAX), "overflow");
 }
 
+TEST_F(VectorTest, removeAt_ShrinksGeometrically) {
+    android::Vector<int> v;
+    for (int i = 0; i < 1024; i++) v.add(i);
+
+    size_t shrinks = 0;
+    size_t capacity = v.capacity();
+    while (!v.isEmpty()) {
+        v.removeAt(v.size() - 1);
+        if (v.capacity() != capacity) {
+            ASSERT_LT(v.capacity(), capacity);
+            capacity = v.capacity();
+            shrinks++;
+        }
+    }
+    EXPECT_LE(shrinks, 10U);
+}
+
+namespace {
+
+struct Pod {
+    int a;
+    float b;
+};
+
+// Counts how an item got to where it is.
+struct Tracked {
+    Tracked() {}
+    Tracked(const Tracked&) { copies++; }
+    Tracked(Tracked&&) { moves++; }
+    Tracked& operator=(const Tracked&) {
+        copies++;
+        return *this;
+    }
+
+    static int copies;
+    static int moves;
+};
+
+int Tracked::copies = 0;
+int Tracked::moves = 0;
+
+}  // namespace
+
+TEST_F(VectorTest, TrivialTypesDetected) {
+    static_assert(traits<Pod>::has_trivial_ctor, "");
+    static_assert(traits<Pod>::has_trivial_dtor, "");
+    static_assert(traits<Pod>::has_trivial_copy, "");
+    static_assert(!traits<Tracked>::has_trivial_copy, "");
+
+    Vector<Pod> v;
+    for (int i = 0; i < 100; i++) v.add(Pod{i, 0.5f});
+    v.insertAt(Pod{-1, 0.f}, 0);
+    ASSERT_EQ(101U, v.size());
+    EXPECT_EQ(-1, v[0].a);
+    EXPECT_EQ(99, v[100].a);
+}
+
+TEST_F(VectorTest, ItemsMovedWhenGrowing) {
+    Vector<Tracked> v;
+    Tracked item;
+    Tracked::copies = Tracked::moves = 0;
+    for (int i = 0; i < 100; i++) v.add(item);
+    // Only the items added were copied; reallocations moved the rest.
+    EXPECT_EQ(100, Tracked::copies);
+    EXPECT_LT(0, Tracked::moves);
+
+    // A shared buffer must still be copied.
+    Vector<Tracked> other = v;
+    Tracked::copies = Tracked::moves = 0;
+    v.setCapacity(v.capacity() * 2);
+    EXPECT_EQ(100, Tracked::copies);
+    EXPECT_EQ(0, Tracked::moves);
+    EXPECT_EQ(100U, other.size());
+}
+
+TEST_F(VectorTest, KeyedVector_indexOfKey) {
+    KeyedVector<int, int> kv;
+    for (int i = 0; i < 100; i += 2) kv.add(i, -i);
+
+    for (int i = 0; i < 100; i++) {
+        ssize_t index = kv.indexOfKey(i);
+        if (i % 2 == 0) {
+            ASSERT_EQ(i / 2, index);
+            EXPECT_EQ(-i, kv.valueAt(index));
+        } else {
+            EXPECT_EQ(NAME_NOT_FOUND, index);
+        }
+    }
+    EXPECT_EQ(NAME_NOT_FOUND, kv.indexOfKey(-1));
+    EXPECT_EQ(NAME_NOT_FOUND, (KeyedVector<int, int>().indexOfKey(0)));
+}
+
 } // namespace android
@@ -18,6 +18,7 @@
 #define ANDROID_CALLSTACK_H
 
 #include <memory>
+#include <vector>
 
 #include <android/log.h>
 #include <utils/String8.h>
@@ -163,6 +164,49 @@ public:
     Vector<String8> mFrameLines;
 };
 
+// Collect the return addresses of the current thread's stack, and only
+// symbolize them when the stack is printed. This is much cheaper than
+// CallStack::update() for stacks that are captured often and seldom printed.
+//
+// Frames are found by following frame pointers where the architecture keeps
+// them in a known layout, and by a full unwind elsewhere. Frames of code built
+// without frame pointers may be missing. Symbols come from the dynamic symbol
+// tables of the libraries mapped when the stack is printed.
+class RawCallStack {
+public:
+    RawCallStack() = default;
+
+    // Reset the stack frames (same as creating an empty call stack).
+    void clear() { mPcs.clear(); }
+
+    // Immediately collect the return addresses of the current thread's stack.
+    // As for CallStack::update(), the default starts at the caller.
+    void update(int32_t ignoreDepth = 1);
+
+    // Dump a stack trace to the log using the supplied logtag.
+    void log(const char* logtag,
+             android_LogPriority priority = ANDROID_LOG_DEBUG,
+             const char* prefix = nullptr) const;
+
+    // Dump a stack trace to the specified file descriptor.
+    void dump(int fd, int indent = 0, const char* prefix = nullptr) const;
+
+    // Return a string (possibly very long) containing the complete stack trace.
+    String8 toString(const char* prefix = nullptr) const;
+
+    // Dump a serialized representation of the stack trace to the specified printer.
+    void print(Printer& printer) const;
+
+    // Get the count of stack frames that are in this call stack.
+    size_t size() const { return mPcs.size(); }
+
+    // Get the return address of the given frame.
+    uintptr_t pc(size_t frame) const { return mPcs[frame]; }
+
+private:
+    std::vector<uintptr_t> mPcs;
+};
+
 }  // namespace android
 
 #endif // ANDROID_CALLSTACK_H
@@ -66,6 +66,24 @@ public:
     bool create(const char* origFileName, int fd,
                 off64_t offset, size_t length, bool readOnly);
 
+    /*
+     * Hints for create() about how the mapping will be used.
+     */
+    enum CreateFlags {
+        CREATE_DEFAULT = 0,
+        /* Fault in the whole region up front, for callers that read all of it. */
+        CREATE_POPULATE = 1 << 0,
+        /* Ask for huge pages where the kernel supports them for file mappings. */
+        CREATE_HUGEPAGE = 1 << 1,
+    };
+
+    /*
+     * As above, applying the CreateFlags in "createFlags". The flags are
+     * hints: a mapping is still returned if the system ignores them.
+     */
+    bool create(const char* origFileName, int fd,
+                off64_t offset, size_t length, bool readOnly, int createFlags);
+
     ~FileMap(void);
 
     /*
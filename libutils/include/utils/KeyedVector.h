@@ -129,7 +129,23 @@ bool KeyedVector<KEY,VALUE>::isIdenticalTo(const KeyedVector<KEY,VALUE>& rhs) co
 
 template<typename KEY, typename VALUE> inline
 ssize_t KeyedVector<KEY,VALUE>::indexOfKey(const KEY& key) const {
-    return mVector.indexOf( key_value_pair_t<KEY,VALUE>(key) );
+    // The same binary search as SortedVector::indexOf(), minus building a
+    // key_value_pair_t to search for and a virtual do_compare() per step.
+    const key_value_pair_t<KEY,VALUE>* items = mVector.array();
+    ssize_t l = 0;
+    ssize_t h = ssize_t(mVector.size()) - 1;
+    while (l <= h) {
+        const ssize_t mid = l + (h - l)/2;
+        const KEY& curr = items[mid].key;
+        if (strictly_order_type(curr, key)) {
+            l = mid + 1;
+        } else if (strictly_order_type(key, curr)) {
+            h = mid - 1;
+        } else {
+            return mid;
+        }
+    }
+    return NAME_NOT_FOUND;
 }
 
 template<typename KEY, typename VALUE> inline
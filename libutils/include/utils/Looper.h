@@ -239,6 +239,37 @@ public:
      */
     bool getAllowNonCallbacks() const;
 
+    /**
+     * Counters kept while a slow dispatch threshold is set.
+     */
+    struct DispatchStats {
+        // Fd callbacks and messages dispatched.
+        uint64_t dispatches = 0;
+        // Dispatches that took longer than the threshold.
+        uint64_t slowDispatches = 0;
+        // The longest dispatch seen.
+        nsecs_t maxDispatchTime = 0;
+    };
+
+    /**
+     * Emits a trace section with the given ATRACE_TAG_* around each fd callback
+     * and message handler this looper invokes, named after the fd or the
+     * message's what.  A tag of 0, the default, disables these sections.
+     */
+    void setDispatchTraceTag(uint64_t tag);
+
+    /**
+     * Times each fd callback and message handler this looper invokes, and logs a
+     * warning for those that run longer than the threshold.  A threshold of 0,
+     * the default, disables the timing and the counters of getDispatchStats().
+     */
+    void setSlowDispatchThreshold(nsecs_t threshold);
+
+    /**
+     * Returns the counters kept since a slow dispatch threshold was first set.
+     */
+    DispatchStats getDispatchStats() const;
+
     /**
      * Waits for events to be available, with optional timeout in milliseconds.
      * Invokes callbacks for all file descriptors on which an event occurred.
@@ -441,14 +472,16 @@ private:
     };
 
     struct MessageEnvelope {
-        MessageEnvelope() : uptime(0) { }
+        MessageEnvelope() : uptime(0), seq(0) { }
 
-        MessageEnvelope(nsecs_t u, sp<MessageHandler> h, const Message& m)
-            : uptime(u), handler(std::move(h)), message(m) {}
+        MessageEnvelope(nsecs_t u, sp<MessageHandler> h, const Message& m, uint32_t s)
+            : uptime(u), handler(std::move(h)), message(m), seq(s) {}
 
         nsecs_t uptime;
         sp<MessageHandler> handler;
         Message message;
+        // Orders messages with the same uptime by the time they were sent.
+        uint32_t seq;
     };
 
     const bool mAllowNonCallbacks; // immutable
@@ -456,6 +489,7 @@ private:
     android::base::unique_fd mWakeEventFd;  // immutable
     Mutex mLock;
 
+    // A binary heap with the next message to send at its front.
     Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
 
@@ -25,6 +25,8 @@
 #include <time.h>
 #include <sys/types.h>
 
+#include <chrono>
+
 namespace android {
 
 class Printer;
@@ -41,6 +43,12 @@ public:
     // Immediately collect the stack traces for all threads.
     void update();
 
+    // Collect the stack traces for all threads, unwinding up to maxWorkers
+    // threads at once, and give up on the threads whose unwind has not finished
+    // within timeout. Those threads are still listed, and reported as timed
+    // out when printed.
+    void update(std::chrono::milliseconds timeout, size_t maxWorkers = 4);
+
     // Print all stack traces to the log using the supplied logtag.
     void log(const char* logtag, android_LogPriority priority = ANDROID_LOG_DEBUG,
              const char* prefix = nullptr) const;
@@ -63,9 +71,14 @@ private:
     // Reset the process's stack frames and metadata.
     void clear();
 
+    // Reset, then list every thread of the process with its name and no stack.
+    // Returns false if the threads could not be listed.
+    bool listThreads();
+
     struct ThreadInfo {
         CallStack callStack;
         String8 threadName;
+        bool timedOut = false;
     };
 
     // tid -> ThreadInfo
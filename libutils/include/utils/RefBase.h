@@ -150,6 +150,10 @@
 // object while there are still weak references. This is really special purpose
 // functionality to support Binder.
 
+// RefBase::extendObjectLifetime(OBJECT_FAST_STRONG_REFS), called from the
+// constructor, makes sp<> copies cheaper: each strong reference change is then a
+// single atomic operation instead of two. wp<> keeps working as before.
+
 // Wp::promote(), implemented via the attemptIncStrong() member function, is
 // used to try to convert a weak pointer back to a strong pointer.  It's the
 // normal way to try to access the fields of an object referenced only through
@@ -350,7 +354,13 @@ protected:
     enum {
         OBJECT_LIFETIME_STRONG  = 0x0000,
         OBJECT_LIFETIME_WEAK    = 0x0001,
-        OBJECT_LIFETIME_MASK    = 0x0001
+        OBJECT_LIFETIME_MASK    = 0x0001,
+        // Strong references share a single weak reference instead of each
+        // holding one, halving the atomic operations per sp<> copy. Must be set
+        // before the first strong reference, usually in the constructor.
+        // Requires OBJECT_LIFETIME_STRONG. getWeakCount() then returns the
+        // number of weak references, plus one until the last strong one is gone.
+        OBJECT_FAST_STRONG_REFS = 0x0002
     };
     
             void            extendObjectLifetime(int32_t mode);
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UTILS_SHARDED_LRU_CACHE_H
+#define ANDROID_UTILS_SHARDED_LRU_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+
+#include "utils/LruCache.h"
+
+namespace android {
+
+/**
+ * A thread-safe LruCache for caches shared by many threads.
+ *
+ * Keys are spread over kShardCount independent LruCaches, each behind its own
+ * lock, so threads touching different keys rarely contend. The capacity is
+ * divided between the shards, which never hold more than maxCapacity entries
+ * together, and eviction is least-recently-used within a shard. This
+ * approximates a global LRU once the cache holds more than a few entries per
+ * shard; with a maxCapacity below kShardCount, some shards hold nothing.
+ *
+ * get() returns the value by copy since the entry may be evicted by another
+ * thread as soon as the shard is unlocked. TValue should be cheap to copy,
+ * e.g. a pointer or an sp<>. The OnEntryRemoved listener is invoked with the
+ * shard's lock held and must not call back into the cache.
+ */
+template <typename TKey, typename TValue, size_t kShardCount = 16>
+class ShardedLruCache {
+    static_assert(kShardCount > 0, "kShardCount must be positive");
+
+public:
+    explicit ShardedLruCache(uint32_t maxCapacity);
+
+    void setOnEntryRemovedListener(OnEntryRemoved<TKey, TValue>* listener);
+    size_t size() const;
+    TValue get(const TKey& key);
+    bool put(const TKey& key, const TValue& value);
+    bool remove(const TKey& key);
+    void clear();
+
+private:
+    ShardedLruCache(const ShardedLruCache& that);  // disallow copy constructor
+
+    // Aligned so that shards never share a cache line, and locking one shard
+    // does not slow down threads working on its neighbours.
+    struct alignas(64) Shard {
+        explicit Shard(uint32_t maxCapacity) : cache(maxCapacity) {}
+
+        mutable std::mutex lock;
+        LruCache<TKey, TValue> cache;
+        // False for a shard whose share of the capacity is 0, which LruCache
+        // can't express since 0 is kUnlimitedCapacity.
+        bool enabled = true;
+    };
+
+    Shard& shardFor(const TKey& key) const {
+        // hash_type() is the identity for integers, so scramble it and pick
+        // the shard from the high bits; otherwise sequential keys would all
+        // land in the same few shards.
+        uint32_t h = static_cast<uint32_t>(hash_type(key)) * 0x9e3779b9u;
+        return *mShards[(static_cast<uint64_t>(h) * kShardCount) >> 32];
+    }
+
+    std::unique_ptr<Shard> mShards[kShardCount];
+};
+
+// Implementation is here, because it's fully templated
+template <typename TKey, typename TValue, size_t kShardCount>
+ShardedLruCache<TKey, TValue, kShardCount>::ShardedLruCache(uint32_t maxCapacity) {
+    if (maxCapacity == LruCache<TKey, TValue>::kUnlimitedCapacity) {
+        for (auto& shard : mShards) {
+            shard.reset(new Shard(maxCapacity));
+        }
+        return;
+    }
+    // The first maxCapacity % kShardCount shards take one entry more, so that
+    // the shards add up to exactly maxCapacity.
+    for (size_t i = 0; i < kShardCount; i++) {
+        uint32_t shardCapacity = maxCapacity / kShardCount + (i < maxCapacity % kShardCount);
+        mShards[i].reset(new Shard(shardCapacity == 0 ? 1 : shardCapacity));
+        mShards[i]->enabled = shardCapacity != 0;
+    }
+}
+
+template <typename TKey, typename TValue, size_t kShardCount>
+void ShardedLruCache<TKey, TValue, kShardCount>::setOnEntryRemovedListener(
+        OnEntryRemoved<TKey, TValue>* listener) {
+    for (auto& shard : mShards) {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        shard->cache.setOnEntryRemovedListener(listener);
+    }
+}
+
+template <typename TKey, typename TValue, size_t kShardCount>
+size_t ShardedLruCache<TKey, TValue, kShardCount>::size() const {
+    size_t size = 0;
+    for (auto& shard : mShards) {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        size += shard->cache.size();
+    }
+    return size;
+}
+
+template <typename TKey, typename TValue, size_t kShardCount>
+TValue ShardedLruCache<TKey, TValue, kShardCount>::get(const TKey& key) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.cache.get(key);
+}
+
+template <typename TKey, typename TValue, size_t kShardCount>
+bool ShardedLruCache<TKey, TValue, kShardCount>::put(const TKey& key, const TValue& value) {
+    Shard& shard = shardFor(key);
+    if (!shard.enabled) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.cache.put(key, value);
+}
+
+template <typename TKey, typename TValue, size_t kShardCount>
+bool ShardedLruCache<TKey, TValue, kShardCount>::remove(const TKey& key) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.cache.remove(key);
+}
+
+template <typename TKey, typename TValue, size_t kShardCount>
+void ShardedLruCache<TKey, TValue, kShardCount>::clear() {
+    for (auto& shard : mShards) {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        shard->cache.clear();
+    }
+}
+
+}  // namespace android
+
+#endif  // ANDROID_UTILS_SHARDED_LRU_CACHE_H
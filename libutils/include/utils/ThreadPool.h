@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UTILS_THREAD_POOL_H
+#define ANDROID_UTILS_THREAD_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace android {
+
+/**
+ * A fixed-size pool of worker threads running short tasks.
+ *
+ * Each worker has its own deque per priority. A task submitted from a worker
+ * goes to that worker's deque, and one submitted from elsewhere is spread over
+ * the workers in turn. A worker runs the newest task of its own deque and, when
+ * that is empty, steals the oldest task of another worker's. Higher priority
+ * tasks are always taken first, across all workers.
+ *
+ * Tasks must not block waiting for other tasks of the same pool unless the
+ * pool has a thread to spare for them.
+ */
+class ThreadPool {
+public:
+    enum class Priority { LOW = 0, NORMAL = 1, HIGH = 2 };
+
+    using Task = std::function<void()>;
+
+    struct Options {
+        // Number of workers; 0 means one per online CPU.
+        size_t numThreads = 0;
+        // Workers are named "<name>:<index>", truncated to what the kernel allows.
+        std::string name = "ThreadPool";
+        // CPUs the workers may run on; empty leaves the affinity alone.
+        std::vector<int> cpus;
+        // Nice value of the workers.
+        int niceness = 0;
+        // Called on each worker, with its index, before it runs any task. Use
+        // it for per-thread setup such as applying task profiles.
+        std::function<void(size_t)> onThreadStart;
+    };
+
+    struct Stats {
+        uint64_t tasksRun = 0;
+        uint64_t tasksStolen = 0;
+        // Time from submit() to the task starting, and the task's run time.
+        uint64_t totalQueueNs = 0;
+        uint64_t maxQueueNs = 0;
+        uint64_t totalRunNs = 0;
+        uint64_t maxRunNs = 0;
+    };
+
+    ThreadPool() : ThreadPool(Options()) {}
+    explicit ThreadPool(const Options& options);
+    // Runs the tasks still queued, then joins the workers.
+    ~ThreadPool();
+
+    // Queue |task|. Returns false once shutdown() has been called.
+    bool submit(Task task, Priority priority = Priority::NORMAL);
+
+    // Queue |fn| and return a future for its result. The future is invalid if
+    // the pool is shutting down.
+    template <typename Fn>
+    std::future<std::invoke_result_t<Fn>> async(Fn&& fn, Priority priority = Priority::NORMAL) {
+        using Result = std::invoke_result_t<Fn>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Fn>(fn));
+        auto future = task->get_future();
+        if (!submit([task] { (*task)(); }, priority)) {
+            return {};
+        }
+        return future;
+    }
+
+    // Wait until every task submitted so far, and every task they submitted,
+    // has run. Must not be called from a worker.
+    void wait();
+
+    // Stop accepting tasks, run the ones queued, and join the workers.
+    void shutdown();
+
+    size_t getThreadCount() const;
+    Stats getStats() const;
+
+    // True if the calling thread is one of this pool's workers.
+    bool isWorkerThread() const;
+
+private:
+    struct Impl;
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // The pool's state lives in Impl, so that it can change without changing
+    // the layout of this class, which is part of the libutils ABI.
+    std::unique_ptr<Impl> mImpl;
+};
+
+}  // namespace android
+
+#endif  // ANDROID_UTILS_THREAD_POOL_H
@@ -19,6 +19,7 @@
 
 #include <new>
 #include <type_traits>
+#include <utility>
 
 #include <stdint.h>
 #include <string.h>
@@ -32,10 +33,16 @@ namespace android {
  * Types traits
  */
 
-template <typename T> struct trait_trivial_ctor { enum { value = false }; };
-template <typename T> struct trait_trivial_dtor { enum { value = false }; };
-template <typename T> struct trait_trivial_copy { enum { value = false }; };
-template <typename T> struct trait_trivial_move { enum { value = false }; };
+// Types the compiler can prove trivial get the fast paths without having to be
+// declared with the ANDROID_*_TRAIT macros below.
+template <typename T> struct trait_trivial_ctor
+{ enum { value = std::is_trivially_default_constructible<T>::value }; };
+template <typename T> struct trait_trivial_dtor
+{ enum { value = std::is_trivially_destructible<T>::value }; };
+template <typename T> struct trait_trivial_copy
+{ enum { value = std::is_trivially_copyable<T>::value }; };
+template <typename T> struct trait_trivial_move
+{ enum { value = std::is_trivially_copyable<T>::value }; };
 template <typename T> struct trait_pointer      { enum { value = false }; };
 template <typename T> struct trait_pointer<T*>  { enum { value = true }; };
 
@@ -180,7 +187,10 @@ void splat_type(TYPE* where, const TYPE* what, size_t n) {
     } else {
         while (n > 0) {
             n--;
-            *where++ = *what;
+            // Not an assignment: trivially copyable types may still have a
+            // deleted assignment operator.
+            memcpy(static_cast<void*>(where), what, sizeof(TYPE));
+            where++;
         }
     }
 }
@@ -208,7 +218,8 @@ move_forward_type(TYPE* d, const TYPE* s, size_t n = 1) {
         n--;
         --d, --s;
         if (!traits<TYPE>::has_trivial_copy) {
-            new(d) TYPE(*s);
+            // The source is destroyed right after, so it can be moved from.
+            new(d) TYPE(std::move(*const_cast<TYPE*>(s)));
         } else {
             *d = *s;
         }
@@ -232,7 +243,8 @@ move_backward_type(TYPE* d, const TYPE* s, size_t n = 1) {
     while (n > 0) {
         n--;
         if (!traits<TYPE>::has_trivial_copy) {
-            new(d) TYPE(*s);
+            // The source is destroyed right after, so it can be moved from.
+            new(d) TYPE(std::move(*const_cast<TYPE*>(s)));
         } else {
             *d = *s;
         }
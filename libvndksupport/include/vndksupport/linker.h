@@ -30,6 +30,13 @@ extern "C" {
  */
 int android_is_in_vendor_process();
 
+/*
+ * Loads a library from the sphal namespace.
+ *
+ * Loading a library again with the same flags returns the same handle after an
+ * RTLD_NOLOAD lookup, without a full load. Each load must be balanced by a call
+ * to android_unload_sphal_library, and the library is only closed by the last one.
+ */
 void* android_load_sphal_library(const char* name, int flag);
 
 int android_unload_sphal_library(void* handle);
@@ -22,9 +22,14 @@
 #include <dlfcn.h>
 #include <log/log.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <initializer_list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
 
 extern "C" android_namespace_t* android_get_exported_namespace(const char*);
 
@@ -35,6 +40,31 @@ struct VendorNamespace {
     const char* name = nullptr;
 };
 
+// Loads that take longer than this are logged.
+constexpr int64_t kSlowLoadMs = 50;
+
+// Libraries loaded through android_load_sphal_library, so that loading one again only needs an
+// RTLD_NOLOAD lookup in the vendor namespace rather than a full load. Every load returned to a
+// caller holds a linker reference of its own, so a handle closed directly with dlclose() cannot
+// leave the cache pointing at an unloaded library: hits are checked with RTLD_NOLOAD, and
+// entries are dropped once android_unload_sphal_library has balanced all loads.
+struct LoadedLibraries {
+    std::mutex lock;
+    std::map<std::pair<std::string, int>, void*> handles;
+    std::map<void*, int> refs;
+};
+
+LoadedLibraries& loaded_libraries() {
+    static LoadedLibraries* libraries = new LoadedLibraries;
+    return *libraries;
+}
+
+int64_t now_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 }  // anonymous namespace
 
 static VendorNamespace get_vendor_namespace() {
@@ -61,25 +91,81 @@ int android_is_in_vendor_process() {
     return android_get_exported_namespace("vndk") == nullptr;
 }
 
-void* android_load_sphal_library(const char* name, int flag) {
+static void* dlopen_in_vendor_namespace(const VendorNamespace& vendor_namespace, const char* name,
+                                        int flag) {
+    if (vendor_namespace.ptr == nullptr) {
+        return dlopen(name, flag);
+    }
+    const android_dlextinfo dlextinfo = {
+            .flags = ANDROID_DLEXT_USE_NAMESPACE,
+            .library_namespace = vendor_namespace.ptr,
+    };
+    return android_dlopen_ext(name, flag, &dlextinfo);
+}
+
+static void* load_sphal_library(const char* name, int flag) {
     VendorNamespace vendor_namespace = get_vendor_namespace();
-    if (vendor_namespace.ptr != nullptr) {
-        const android_dlextinfo dlextinfo = {
-                .flags = ANDROID_DLEXT_USE_NAMESPACE,
-                .library_namespace = vendor_namespace.ptr,
-        };
-        void* handle = android_dlopen_ext(name, flag, &dlextinfo);
-        if (!handle) {
-            ALOGE("Could not load %s from %s namespace: %s.", name, vendor_namespace.name,
-                  dlerror());
-        }
-        return handle;
-    } else {
+    if (vendor_namespace.ptr == nullptr) {
         ALOGD("Loading %s from current namespace instead of sphal namespace.", name);
-        return dlopen(name, flag);
     }
+    void* handle = dlopen_in_vendor_namespace(vendor_namespace, name, flag);
+    if (!handle && vendor_namespace.ptr != nullptr) {
+        ALOGE("Could not load %s from %s namespace: %s.", name, vendor_namespace.name, dlerror());
+    }
+    return handle;
+}
+
+// Drops every cache entry for |handle|, whose references are no longer tracked.
+static void forget_sphal_library(LoadedLibraries& libraries, void* handle) {
+    for (auto it = libraries.handles.begin(); it != libraries.handles.end();) {
+        it = it->second == handle ? libraries.handles.erase(it) : std::next(it);
+    }
+    libraries.refs.erase(handle);
+}
+
+void* android_load_sphal_library(const char* name, int flag) {
+    LoadedLibraries& libraries = loaded_libraries();
+    std::lock_guard<std::mutex> lock(libraries.lock);
+
+    auto key = std::make_pair(std::string(name), flag);
+    auto it = libraries.handles.find(key);
+    if (it != libraries.handles.end()) {
+        void* cached = it->second;
+        // Takes the linker reference for this load, and checks that nobody dlclose()'d the
+        // library behind the cache's back.
+        void* handle = dlopen_in_vendor_namespace(get_vendor_namespace(), name, flag | RTLD_NOLOAD);
+        if (handle == cached) {
+            libraries.refs[cached]++;
+            return cached;
+        }
+        if (handle != nullptr) dlclose(handle);
+        forget_sphal_library(libraries, cached);
+    }
+
+    int64_t start = now_ms();
+    void* handle = load_sphal_library(name, flag);
+    int64_t elapsed = now_ms() - start;
+    if (elapsed >= kSlowLoadMs) {
+        ALOGI("Loading %s took %lld ms.", name, static_cast<long long>(elapsed));
+    }
+    if (handle == nullptr) {
+        return nullptr;
+    }
+
+    // The handle may already be known under another name or flags.
+    libraries.refs[handle]++;
+    libraries.handles.emplace(std::move(key), handle);
+    return handle;
 }
 
 int android_unload_sphal_library(void* handle) {
+    LoadedLibraries& libraries = loaded_libraries();
+    std::lock_guard<std::mutex> lock(libraries.lock);
+
+    auto ref = libraries.refs.find(handle);
+    if (ref != libraries.refs.end() && --ref->second == 0) {
+        forget_sphal_library(libraries, handle);
+    }
+    // Every load holds its own linker reference.
     return dlclose(handle);
 }
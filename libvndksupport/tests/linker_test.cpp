@@ -16,11 +16,29 @@
 #include <gtest/gtest.h>
 
 #include <android-base/strings.h>
+#include <android/dlext.h>
 #include <dirent.h>
 #include <dlfcn.h>
 #include <vndksupport/linker.h>
 #include <string>
 
+extern "C" android_namespace_t* android_get_exported_namespace(const char*);
+
+// Returns a new reference to |name| if it is loaded in the namespace
+// android_load_sphal_library uses.
+static void* find_loaded_sphal_lib(const std::string& name, int flag) {
+    for (const char* ns_name : {"sphal", "vendor", "default"}) {
+        if (android_namespace_t* ns = android_get_exported_namespace(ns_name)) {
+            const android_dlextinfo dlextinfo = {
+                    .flags = ANDROID_DLEXT_USE_NAMESPACE,
+                    .library_namespace = ns,
+            };
+            return android_dlopen_ext(name.c_str(), flag | RTLD_NOLOAD, &dlextinfo);
+        }
+    }
+    return dlopen(name.c_str(), flag | RTLD_NOLOAD);
+}
+
 // Let's use libEGL_<chipset>.so as a SP-HAL in test
 static std::string find_sphal_lib() {
     const char* path =
@@ -49,6 +67,38 @@ TEST(linker, load_existing_lib) {
     android_unload_sphal_library(handle);
 }
 
+TEST(linker, load_existing_lib_twice) {
+    std::string name = find_sphal_lib();
+    ASSERT_NE("", name);
+    void* handle = android_load_sphal_library(name.c_str(), RTLD_NOW | RTLD_LOCAL);
+    ASSERT_NE(nullptr, handle);
+    void* again = android_load_sphal_library(name.c_str(), RTLD_NOW | RTLD_LOCAL);
+    ASSERT_EQ(handle, again);
+
+    // The first unload must leave the library loaded for the second user.
+    ASSERT_EQ(0, android_unload_sphal_library(handle));
+    void* loaded = find_loaded_sphal_lib(name, RTLD_NOW | RTLD_LOCAL);
+    ASSERT_EQ(handle, loaded);
+    dlclose(loaded);
+    ASSERT_EQ(0, android_unload_sphal_library(again));
+}
+
+TEST(linker, load_after_direct_dlclose) {
+    std::string name = find_sphal_lib();
+    ASSERT_NE("", name);
+    void* handle = android_load_sphal_library(name.c_str(), RTLD_NOW | RTLD_LOCAL);
+    ASSERT_NE(nullptr, handle);
+    // Closing the handle directly must not leave a stale entry in the cache.
+    ASSERT_EQ(0, dlclose(handle));
+
+    void* again = android_load_sphal_library(name.c_str(), RTLD_NOW | RTLD_LOCAL);
+    ASSERT_NE(nullptr, again);
+    void* loaded = find_loaded_sphal_lib(name, RTLD_NOW | RTLD_LOCAL);
+    ASSERT_EQ(again, loaded);
+    dlclose(loaded);
+    ASSERT_EQ(0, android_unload_sphal_library(again));
+}
+
 TEST(linker, load_nonexisting_lib) {
     void* handle = android_load_sphal_library("libNeverUseThisName.so", RTLD_NOW | RTLD_LOCAL);
     ASSERT_EQ(nullptr, handle);
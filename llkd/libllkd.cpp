@@ -35,6 +35,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <ios>
 #include <sstream>
@@ -233,6 +234,16 @@ std::string ReadFile(std::string&& path) {
     return content;
 }
 
+// As above, but reads into a caller supplied buffer so that the monitoring
+// pass over every thread can reuse its allocation. Returns false if empty.
+bool ReadFile(const std::string& path, std::string* content) {
+    if (!android::base::ReadFileToString(path, content)) {
+        PLOG(DEBUG) << "Read " << path << " failed";
+        content->clear();
+    }
+    return !content->empty();
+}
+
 std::string llkProcGetName(pid_t tid, const char* node = "/cmdline") {
     std::string content = ReadFile(procdir + std::to_string(tid) + node);
     static constexpr char needles[] = " \t\r\n";  // including trailing nul
@@ -777,6 +788,52 @@ bool getValidTidDir(dirent* dp, std::string* piddir) {
     return true;
 }
 
+// Parses the fields of /proc/<tid>/stat that llkCheck() needs, in place.
+// comm is located by the last ')' since the name itself may contain one.
+bool llkParseStat(const char* stat, unsigned* tid, char (&comm)[TASK_COMM_LEN + 1], char* state,
+                  unsigned* ppid, unsigned* utime, unsigned* stime) {
+    char* end;
+    *tid = ::strtoul(stat, &end, 10);
+    if ((end == stat) || (end[0] != ' ') || (end[1] != '(')) return false;
+    const char* name = end + 2;
+    const char* close = ::strrchr(name, ')');
+    if (close == nullptr) return false;
+    size_t len = std::min(static_cast<size_t>(close - name), size_t(TASK_COMM_LEN));
+    ::memcpy(comm, name, len);
+    comm[len] = '\0';
+
+    const char* p = close + 1;
+    if ((*p++ != ' ') || (*p == '\0')) return false;
+    *state = *p++;
+
+    // Fields are numbered from 1 as in proc(5); we are positioned after 3.
+    auto field = [&p](unsigned long* value) {
+        if (*p != ' ') return false;
+        ++p;
+        char* end;
+        *value = ::strtoul(p, &end, 10);
+        if (end == p) return false;
+        p = end;
+        return true;
+    };
+    unsigned long value;
+    for (int i = 4; i <= 16; ++i) {  // stop at 16 to see that cutime is there
+        if (!field(&value)) return false;
+        switch (i) {
+            case 4:
+                *ppid = value;
+                break;
+            case 14:
+                *utime = value;
+                break;
+            case 15:
+                *stime = value;
+                break;
+        }
+    }
+    return true;
+}
+
 bool llkIsMonitorState(char state) {
     return (state == 'Z') || (state == 'D');
 }
@@ -812,8 +869,8 @@ bool llkCheckStack(proc* procp, const std::string& piddir) {
 
     // Don't check process that are known to block ptrace, save sepolicy noise.
     if (llkSkipProc(procp, llkIgnorelistStack)) return false;
-    auto kernel_stack = ReadFile(piddir + "/stack");
-    if (kernel_stack.empty()) {
+    static std::string kernel_stack;
+    if (!ReadFile(piddir + "/stack", &kernel_stack)) {
         LOG(VERBOSE) << piddir << "/stack empty comm=" << procp->getComm()
                      << " cmdline=" << procp->getCmdline();
         return false;
@@ -856,13 +913,12 @@ void llkCheckSchedUpdate(proc* procp, const std::string& piddir) {
     // Proc entries can not be read >1K atomically via libbase,
     // but if there are problems we assume at least a few
     // samples of reads occur before we take any real action.
-    std::string schedString = ReadFile(piddir + "/sched");
-    if (schedString.empty()) {
+    static std::string schedString;
+    if (!ReadFile(piddir + "/sched", &schedString)) {
         // /schedstat is not as standardized, but in 3.1+
         // Android devices, the third field is nr_switches
         // from /sched:
-        schedString = ReadFile(piddir + "/schedstat");
-        if (schedString.empty()) {
+        if (!ReadFile(piddir + "/schedstat", &schedString)) {
             return;
         }
         auto val = static_cast<unsigned long long>(-1);
@@ -999,6 +1055,10 @@ milliseconds llkCheck(bool checkRunning) {
     auto myPid = ::getpid();
     auto myTid = ::gettid();
     auto dump = true;
+    // Reused for every thread, this loop runs over thousands of them.
+    static std::string path;
+    static std::string stat;
+    static std::string cgroup;
     for (auto dp = llkTopDirectory.read(); dp != nullptr; dp = llkTopDirectory.read()) {
         std::string piddir;
 
@@ -1021,8 +1081,8 @@ milliseconds llkCheck(bool checkRunning) {
             }
 
             // Get the process stat
-            std::string stat = ReadFile(piddir + "/stat");
-            if (stat.empty()) {
+            path.assign(piddir).append("/stat");
+            if (!ReadFile(path, &stat)) {
                 continue;
             }
             unsigned tid = -1;
@@ -1031,35 +1091,24 @@ milliseconds llkCheck(bool checkRunning) {
             unsigned ppid = -1;
             unsigned utime = -1;
             unsigned stime = -1;
-            int dummy;
             pdir[0] = '\0';
             // tid should not change value
-            auto match = ::sscanf(
-                stat.c_str(),
-                "%u (%" ___STRING(
-                    TASK_COMM_LEN) "[^)]) %c %u %*d %*d %*d %*d %*d %*d %*d %*d %*d %u %u %d",
-                &tid, pdir, &state, &ppid, &utime, &stime, &dummy);
+            auto match = llkParseStat(stat.c_str(), &tid, pdir, &state, &ppid, &utime, &stime);
             if (pid == -1) {
                 pid = tid;
             }
             LOG(VERBOSE) << "match " << match << ' ' << tid << " (" << pdir << ") " << state << ' '
-                         << ppid << " ... " << utime << ' ' << stime << ' ' << dummy;
-            if (match != 7) {
+                         << ppid << " ... " << utime << ' ' << stime;
+            if (!match) {
                 continue;
             }
 
-            // Get the process cgroup
-            auto cgroup = ReadFile(piddir + "/cgroup");
-            auto frozen = cgroup.find(":freezer:/frozen") != std::string::npos;
-
             auto procp = llkTidLookup(tid);
             if (procp == nullptr) {
-                procp = llkTidAlloc(tid, pid, ppid, pdir, utime + stime, state, frozen);
+                procp = llkTidAlloc(tid, pid, ppid, pdir, utime + stime, state, false);
             } else {
                 // comm can change ...
                 procp->setComm(pdir);
-                // frozen can change, too...
-                procp->setFrozen(frozen);
                 procp->updated = true;
                 // pid/ppid/tid wrap?
                 if (((procp->update != prevUpdate) && (procp->update != llkUpdate)) ||
@@ -1099,6 +1148,11 @@ milliseconds llkCheck(bool checkRunning) {
             if ((tid == myTid) || llkSkipPid(tid)) {
                 continue;
             }
+            // Get the process cgroup, only for the few threads that got this
+            // far; frozen can change, too...
+            path.assign(piddir).append("/cgroup");
+            ReadFile(path, &cgroup);
+            procp->setFrozen(cgroup.find(":freezer:/frozen") != std::string::npos);
             if (procp->isFrozen()) {
                 break;
             }
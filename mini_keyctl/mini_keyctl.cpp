@@ -40,6 +40,7 @@ static void Usage(int exit_code) {
   fprintf(stderr, "usage: mini-keyctl <action> [args,]\n");
   fprintf(stderr, "       mini-keyctl add <type> <desc> <data> <keyring>\n");
   fprintf(stderr, "       mini-keyctl padd <type> <desc> <keyring>\n");
+  fprintf(stderr, "       mini-keyctl dadd <type> <desc_prefix> <dir> <keyring>\n");
   fprintf(stderr, "       mini-keyctl unlink <key> <keyring>\n");
   fprintf(stderr, "       mini-keyctl restrict_keyring <keyring>\n");
   fprintf(stderr, "       mini-keyctl security <key>\n");
@@ -105,6 +106,18 @@ int Padd(const std::string& type, const std::string& desc, const std::string& ke
   return 0;
 }
 
+int Dadd(const std::string& type, const std::string& desc_prefix, const std::string& dir,
+         const std::string& keyring) {
+  int loaded = android::LoadKeysFromDirectory(type, desc_prefix, dir, keyring);
+  if (loaded < 0) {
+    error(1, 0, "Failed to add keys from %s", dir.c_str());
+    return 1;
+  }
+
+  std::cout << loaded << std::endl;
+  return 0;
+}
+
 int RestrictKeyring(const std::string& keyring) {
   key_serial_t keyring_id = android::GetKeyringId(keyring);
   if (keyctl_restrict_keyring(keyring_id, nullptr, nullptr) < 0) {
@@ -149,6 +162,13 @@ int main(int argc, const char** argv) {
     std::string desc = argv[3];
     std::string keyring = argv[4];
     return Padd(type, desc, keyring);
+  } else if (action == "dadd") {
+    if (argc != 6) Usage(1);
+    std::string type = argv[2];
+    std::string desc_prefix = argv[3];
+    std::string dir = argv[4];
+    std::string keyring = argv[5];
+    return Dadd(type, desc_prefix, dir, keyring);
   } else if (action == "restrict_keyring") {
     if (argc != 3) Usage(1);
     std::string keyring = argv[2];
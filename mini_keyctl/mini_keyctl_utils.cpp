@@ -16,12 +16,19 @@
 
 #include <mini_keyctl_utils.h>
 
+#include <dirent.h>
+
+#include <algorithm>
 #include <fstream>
 #include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
 
@@ -29,12 +36,20 @@ namespace android {
 
 namespace {
 
+constexpr size_t kMaxCertSize = 4096;
+
 std::vector<std::string> SplitBySpace(const std::string& s) {
   std::istringstream iss(s);
   return std::vector<std::string>{std::istream_iterator<std::string>{iss},
                                   std::istream_iterator<std::string>{}};
 }
 
+// Ids of the kernel's own keyrings found in /proc/keys, by description. Those (e.g. .fs-verity)
+// keep their id until shutdown, so entries are never invalidated. Other keyrings can be revoked
+// and replaced, so they are looked up every time.
+std::mutex keyring_id_lock;
+std::map<std::string, key_serial_t> keyring_ids;
+
 }  // namespace
 
 // Find the keyring id. request_key(2) only finds keys in the process, session or thread keyring
@@ -49,6 +64,12 @@ key_serial_t GetKeyringId(const std::string& keyring_desc) {
     return keyring_id;
   }
 
+  std::lock_guard<std::mutex> lock(keyring_id_lock);
+  auto cached = keyring_ids.find(keyring_desc);
+  if (cached != keyring_ids.end()) {
+    return cached->second;
+  }
+
   // Only keys allowed by SELinux rules will be shown here.
   std::ifstream proc_keys_file("/proc/keys");
   if (!proc_keys_file.is_open()) {
@@ -67,17 +88,65 @@ key_serial_t GetKeyringId(const std::string& keyring_desc) {
     // The key description may contain space.
     std::string key_desc_prefix = tokens[8];
     // The prefix has a ":" at the end
-    std::string key_desc_pattern = keyring_desc + ":";
-    if (key_type != "keyring" || key_desc_prefix != key_desc_pattern) {
+    if (key_type != "keyring" || key_desc_prefix.empty() || key_desc_prefix.back() != ':') {
       continue;
     }
+    key_desc_prefix.pop_back();
     if (!android::base::ParseInt(key_id.c_str(), &keyring_id)) {
       LOG(ERROR) << "Unexpected key format in /proc/keys: " << key_id;
-      return -1;
+      if (key_desc_prefix == keyring_desc) return -1;
+      continue;
+    }
+    if (key_desc_prefix == keyring_desc) {
+      // The kernel's keyrings are the ones whose description starts with a dot.
+      if (keyring_desc[0] == '.') {
+        keyring_ids.emplace(keyring_desc, keyring_id);
+      }
+      return keyring_id;
     }
-    return keyring_id;
   }
   return -1;
 }
 
+int LoadKeysFromDirectory(const std::string& type, const std::string& desc_prefix,
+                          const std::string& dir, const std::string& keyring_desc) {
+  key_serial_t keyring_id = GetKeyringId(keyring_desc);
+  if (keyring_id < 0) {
+    LOG(ERROR) << "Failed to find keyring " << keyring_desc;
+    return -1;
+  }
+
+  std::unique_ptr<DIR, decltype(&closedir)> d(opendir(dir.c_str()), closedir);
+  if (!d) {
+    PLOG(ERROR) << "Failed to open " << dir;
+    return -1;
+  }
+  std::vector<std::string> names;
+  while (struct dirent* de = readdir(d.get())) {
+    if (de->d_type == DT_REG) names.emplace_back(de->d_name);
+  }
+  std::sort(names.begin(), names.end());
+
+  int loaded = 0;
+  for (const auto& name : names) {
+    std::string path = dir + "/" + name;
+    std::string data;
+    if (!android::base::ReadFileToString(path, &data)) {
+      PLOG(ERROR) << "Failed to read " << path;
+      continue;
+    }
+    if (data.size() > kMaxCertSize) {
+      LOG(ERROR) << "Certificate too large: " << path;
+      continue;
+    }
+    std::string desc = desc_prefix + name.substr(0, name.rfind('.'));
+    if (add_key(type.c_str(), desc.c_str(), data.data(), data.size(), keyring_id) < 0) {
+      PLOG(ERROR) << "Failed to add key " << desc << " from " << path;
+      continue;
+    }
+    loaded++;
+  }
+  return loaded;
+}
+
 }  // namespace android
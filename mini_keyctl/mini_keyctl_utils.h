@@ -23,6 +23,13 @@
 
 namespace android {
 key_serial_t GetKeyringId(const std::string& keyring_desc);
+
+// Add every regular file in dir as a key of the given type to the keyring. Each key is described
+// as desc_prefix followed by the file name without its extension. Files are added in name order.
+// Returns the number of keys added, or -1 if the keyring or the directory cannot be found. Keys
+// that fail to load are logged and skipped.
+int LoadKeysFromDirectory(const std::string& type, const std::string& desc_prefix,
+                          const std::string& dir, const std::string& keyring_desc);
 }  // namespace android
 
 #endif  // _MINI_KEYCTL_MINI_KEYCTL_UTILS_H_
@@ -30,35 +30,49 @@
 struct fs_config_entry {
     char* name;
     int uid, gid, mode;
+    int line;
 };
 
+// Sorted by name, then by line in the canned file, so that the first entry
+// given for a path wins as it would with a linear scan.
 static struct fs_config_entry* canned_config = NULL;
+static size_t canned_config_count = 0;
+static struct fs_config_entry* empty_path_config = NULL;
 static const char* target_out_path = NULL;
+static struct fs_config_context* fs_config_ctx = NULL;
 
 #define TRAILER "TRAILER!!!"
 
 static int total_size = 0;
 
+static int compare_canned_config_name(const void* a, const void* b) {
+    return strcmp(((const struct fs_config_entry*)a)->name,
+                  ((const struct fs_config_entry*)b)->name);
+}
+
+static int compare_canned_config(const void* a, const void* b) {
+    int ret = compare_canned_config_name(a, b);
+    if (ret != 0) return ret;
+    return ((const struct fs_config_entry*)a)->line - ((const struct fs_config_entry*)b)->line;
+}
+
 static void fix_stat(const char *path, struct stat *s)
 {
     uint64_t capabilities;
     if (canned_config) {
         // Use the list of file uid/gid/modes loaded from the file
         // given with -f.
-
-        struct fs_config_entry* empty_path_config = NULL;
-        struct fs_config_entry* p;
-        for (p = canned_config; p->name; ++p) {
-            if (!p->name[0]) {
-                empty_path_config = p;
-            }
-            if (strcmp(p->name, path) == 0) {
-                s->st_uid = p->uid;
-                s->st_gid = p->gid;
-                s->st_mode = p->mode | (s->st_mode & ~07777);
-                return;
-            }
+        struct fs_config_entry key = { .name = (char*) path };
+        struct fs_config_entry* p = bsearch(&key, canned_config, canned_config_count,
+                                            sizeof(*canned_config), compare_canned_config_name);
+        if (p) {
+            while (p > canned_config && strcmp((p - 1)->name, path) == 0) --p;
+            s->st_uid = p->uid;
+            s->st_gid = p->gid;
+            s->st_mode = p->mode | (s->st_mode & ~07777);
+            return;
         }
+        if (empty_path_config == NULL) errx(1, "no canned config for '%s'", path);
         s->st_uid = empty_path_config->uid;
         s->st_gid = empty_path_config->gid;
         s->st_mode = empty_path_config->mode | (s->st_mode & ~07777);
@@ -66,7 +80,11 @@ static void fix_stat(const char *path, struct stat *s)
         // Use the compiled-in fs_config() function.
         unsigned st_mode = s->st_mode;
         int is_dir = S_ISDIR(s->st_mode) || strcmp(path, TRAILER) == 0;
-        fs_config(path, is_dir, target_out_path, &s->st_uid, &s->st_gid, &st_mode, &capabilities);
+        if (!fs_config_ctx) {
+            fs_config_ctx = fs_config_open_context(target_out_path);
+        }
+        fs_config_from_context(fs_config_ctx, path, is_dir, &s->st_uid, &s->st_gid, &st_mode,
+                               &capabilities);
         s->st_mode = (typeof(s->st_mode)) st_mode;
     }
 
@@ -75,7 +93,7 @@ static void fix_stat(const char *path, struct stat *s)
     }
 }
 
-static void _eject(struct stat *s, char *out, int olen, char *data, unsigned datasize)
+static void _eject_header(struct stat *s, char *out, int olen, unsigned datasize)
 {
     // Nothing is special about this value, just picked something in the
     // approximate range that was being used already, and avoiding small
@@ -118,6 +136,11 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
         total_size++;
         putchar(0);
     }
+}
+
+static void _eject(struct stat *s, char *out, int olen, char *data, unsigned datasize)
+{
+    _eject_header(s, out, olen, datasize);
 
     if(datasize) {
         fwrite(data, datasize, 1, stdout);
@@ -125,6 +148,26 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
     }
 }
 
+// Like _eject, but streams the data from |fd| through a fixed-size buffer
+// rather than requiring the whole file in memory.
+static void _eject_fd(struct stat *s, char *out, int olen, const char *in, int fd)
+{
+    static char buf[64 * 1024];
+    off_t remaining = s->st_size;
+
+    _eject_header(s, out, olen, s->st_size);
+
+    while(remaining > 0) {
+        ssize_t n = read(fd, buf, remaining < (off_t) sizeof(buf) ? (size_t) remaining
+                                                                  : sizeof(buf));
+        if(n < 0) err(1, "cannot read '%s'", in);
+        if(n == 0) errx(1, "'%s' shrank while being read", in);
+        fwrite(buf, n, 1, stdout);
+        total_size += n;
+        remaining -= n;
+    }
+}
+
 static void _eject_trailer()
 {
     struct stat s;
@@ -214,16 +257,8 @@ static void _archive(char *in, char *out, int ilen, int olen)
         int fd = open(in, O_RDONLY);
         if(fd < 0) err(1, "cannot open '%s' for read", in);
 
-        char* tmp = (char*) malloc(s.st_size);
-        if(tmp == 0) errx(1, "cannot allocate %zd bytes", s.st_size);
+        _eject_fd(&s, out, olen, in, fd);
 
-        if(read(fd, tmp, s.st_size) != s.st_size) {
-            err(1, "cannot read %zd bytes", s.st_size);
-        }
-
-        _eject(&s, out, olen, tmp, s.st_size);
-
-        free(tmp);
         close(fd);
     } else if(S_ISDIR(s.st_mode)) {
         _eject(&s, out, olen, 0, 0);
@@ -285,6 +320,7 @@ static void read_canned_config(char* filename)
         }
         cc->gid = atoi(strtok(NULL, " \n"));
         cc->mode = strtol(strtok(NULL, " \n"), NULL, 8);
+        cc->line = used;
         ++used;
     }
     if (used >= allocated) {
@@ -295,6 +331,13 @@ static void read_canned_config(char* filename)
     }
     canned_config[used].name = NULL;
 
+    canned_config_count = used;
+    qsort(canned_config, canned_config_count, sizeof(*canned_config), compare_canned_config);
+    // Paths without an entry of their own take the last entry with an empty name.
+    for (size_t i = 0; i < canned_config_count && !canned_config[i].name[0]; ++i) {
+        empty_path_config = &canned_config[i];
+    }
+
     free(line);
     fclose(fp);
 }
@@ -422,6 +465,10 @@ int main(int argc, char *argv[])
 {
     int opt, unused;
 
+    // The archive is written in many small pieces; buffer them into large writes.
+    static char stdout_buf[1024 * 1024];
+    setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+
     while ((opt = getopt_long(argc, argv, "hd:f:n:", long_options, &unused)) != -1) {
         switch (opt) {
         case 'd':
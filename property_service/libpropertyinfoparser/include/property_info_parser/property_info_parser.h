@@ -52,6 +52,10 @@ struct TrieNodeInternal {
   // Exact matches are a sorted list of exact matches at this node_; binary search them.
   uint32_t num_exact_matches;
   uint32_t exact_match_entries;
+
+  // Added in version 2: an array of num_child_nodes bytes, in the same order as child_nodes, each
+  // being TrieNode::ChildNameHash() of that child's name.
+  uint32_t child_name_hashes;
 };
 
 struct PropertyInfoAreaHeader {
@@ -71,6 +75,10 @@ class SerializedData {
     return reinterpret_cast<const PropertyInfoAreaHeader*>(data_base_)->size;
   }
 
+  uint32_t current_version() const {
+    return reinterpret_cast<const PropertyInfoAreaHeader*>(data_base_)->current_version;
+  }
+
   const char* c_string(uint32_t offset) const {
     if (offset != 0 && offset > size()) return nullptr;
     return static_cast<const char*>(data_base_ + offset);
@@ -115,6 +123,21 @@ class TrieNode {
 
   bool FindChildForString(const char* input, uint32_t namelen, TrieNode* child) const;
 
+  // The hash of each child's name, or nullptr if this data predates version 2.
+  const char* child_name_hashes() const {
+    if (serialized_data_->current_version() < 2) return nullptr;
+    return serialized_data_->c_string(trie_node_base_->child_name_hashes);
+  }
+
+  // FNV-1a, folded down to a byte.
+  static uint8_t ChildNameHash(const char* name, uint32_t namelen) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < namelen; ++i) {
+      hash = (hash ^ static_cast<uint8_t>(name[i])) * 16777619u;
+    }
+    return hash ^ (hash >> 8) ^ (hash >> 16) ^ (hash >> 24);
+  }
+
   uint32_t num_prefixes() const { return trie_node_base_->num_prefixes; }
   const PropertyEntry* prefix(int n) const {
     uint32_t prefix_entry_offset =
@@ -132,6 +155,8 @@ class TrieNode {
   }
 
  private:
+  int CompareChildName(int n, const char* name, uint32_t namelen) const;
+
   const PropertyEntry* node_property_entry() const {
     return reinterpret_cast<const PropertyEntry*>(serialized_data_->data_base() +
                                                   trie_node_base_->property_entry);
@@ -65,20 +65,42 @@ int PropertyInfoArea::FindTypeIndex(const char* type) const {
   });
 }
 
-// Binary search the list of children nodes to find a TrieNode for a given property piece.
+int TrieNode::CompareChildName(int n, const char* name, uint32_t namelen) const {
+  const char* child_name = child_node(n).name();
+  int cmp = strncmp(child_name, name, namelen);
+  if (cmp == 0 && child_name[namelen] != '\0') {
+    // We use strncmp() since name isn't null terminated, but we don't want to match only a
+    // prefix of a child node's name, so we check here if we did only match a prefix and
+    // return 1, to indicate to the binary search to search earlier in the array for the real
+    // match.
+    return 1;
+  }
+  return cmp;
+}
+
+// Search the list of children nodes to find a TrieNode for a given property piece.
 // Used to traverse the Trie in GetPropertyInfoIndexes().
 bool TrieNode::FindChildForString(const char* name, uint32_t namelen, TrieNode* child) const {
-  auto node_index = Find(trie_node_base_->num_child_nodes, [this, name, namelen](auto array_offset) {
-    const char* child_name = child_node(array_offset).name();
-    int cmp = strncmp(child_name, name, namelen);
-    if (cmp == 0 && child_name[namelen] != '\0') {
-      // We use strncmp() since name isn't null terminated, but we don't want to match only a
-      // prefix of a child node's name, so we check here if we did only match a prefix and
-      // return 1, to indicate to the binary search to search earlier in the array for the real
-      // match.
-      return 1;
+  uint32_t num_children = trie_node_base_->num_child_nodes;
+
+  // If there's a hash of each child's name, memchr() can scan them all a word or vector at a
+  // time, and only the names of the children with a matching hash need to be compared.
+  const char* hashes = child_name_hashes();
+  if (hashes != nullptr) {
+    const char hash = static_cast<char>(ChildNameHash(name, namelen));
+    const char* end = hashes + num_children;
+    for (auto it = static_cast<const char*>(memchr(hashes, hash, num_children)); it != nullptr;
+         it = static_cast<const char*>(memchr(it + 1, hash, end - it - 1))) {
+      if (CompareChildName(it - hashes, name, namelen) == 0) {
+        *child = child_node(it - hashes);
+        return true;
+      }
     }
-    return cmp;
+    return false;
+  }
+
+  auto node_index = Find(num_children, [this, name, namelen](auto array_offset) {
+    return CompareChildName(array_offset, name, namelen);
   });
 
   if (node_index == -1) {
@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include "property_info_parser/property_info_parser.h"
+#include "property_info_serializer/property_info_serializer.h"
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace properties {
+
+// Roughly the shape of a device's property_contexts: a few wide top level namespaces, each with
+// many children.
+static const char* const kNamespaces[] = {
+    "audio", "bluetooth", "camera", "dalvik", "debug", "init", "log", "net", "persist",
+    "ril", "ro", "sys", "telephony", "vendor", "vold", "wifi",
+};
+
+static std::vector<PropertyInfoEntry> MakePropertyInfo() {
+  auto property_info = std::vector<PropertyInfoEntry>();
+  for (const char* ns : kNamespaces) {
+    for (int i = 0; i < 64; ++i) {
+      property_info.emplace_back(PropertyInfoEntry{StringPrintf("%s.feature%d.", ns, i),
+                                                   StringPrintf("u:object_r:%s_prop:s0", ns),
+                                                   "string", false});
+      property_info.emplace_back(PropertyInfoEntry{StringPrintf("%s.feature%d.enabled", ns, i),
+                                                   StringPrintf("u:object_r:%s_prop:s0", ns),
+                                                   "bool", true});
+    }
+  }
+  return property_info;
+}
+
+static std::vector<std::string> MakeLookups() {
+  auto lookups = std::vector<std::string>();
+  for (const char* ns : kNamespaces) {
+    for (int i = 0; i < 64; i += 7) {
+      lookups.emplace_back(StringPrintf("%s.feature%d.enabled", ns, i));
+      lookups.emplace_back(StringPrintf("%s.feature%d.some.sub.property", ns, i));
+      lookups.emplace_back(StringPrintf("%s.unknown%d", ns, i));
+    }
+  }
+  return lookups;
+}
+
+static void LookupProperties(benchmark::State& state, uint32_t version) {
+  auto serialized_trie = std::string();
+  auto error = std::string();
+  if (!BuildTrie(MakePropertyInfo(), "u:object_r:default_prop:s0", "string", &serialized_trie,
+                 &error)) {
+    state.SkipWithError(error.c_str());
+    return;
+  }
+  // Lowering the version makes the parser ignore child_name_hashes, as a version 1 parser would.
+  reinterpret_cast<PropertyInfoAreaHeader*>(serialized_trie.data())->current_version = version;
+
+  auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
+  auto lookups = MakeLookups();
+  for (auto _ : state) {
+    for (const auto& name : lookups) {
+      const char* context;
+      const char* type;
+      property_info_area->GetPropertyInfo(name.c_str(), &context, &type);
+      benchmark::DoNotOptimize(context);
+      benchmark::DoNotOptimize(type);
+    }
+  }
+}
+
+static void BM_GetPropertyInfo(benchmark::State& state) {
+  LookupProperties(state, 2);
+}
+BENCHMARK(BM_GetPropertyInfo);
+
+static void BM_GetPropertyInfo_v1(benchmark::State& state) {
+  LookupProperties(state, 1);
+}
+BENCHMARK(BM_GetPropertyInfo_v1);
+
+}  // namespace properties
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -39,7 +39,7 @@ TEST(propertyinfoserializer, TrieNodeCheck) {
   auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
 
   // Initial checks for property area.
-  EXPECT_EQ(1U, property_info_area->current_version());
+  EXPECT_EQ(2U, property_info_area->current_version());
   EXPECT_EQ(1U, property_info_area->minimum_supported_version());
 
   // Check the root node
@@ -887,5 +887,96 @@ TEST(propertyinfoserializer, GetPropertyInfo_empty_context_and_type) {
   EXPECT_STREQ("5th", type);
 }
 
+TEST(propertyinfoserializer, GetPropertyInfo_child_name_hashes) {
+  auto property_info = std::vector<PropertyInfoEntry>{
+      {"sys.", "sys", "sys", false},
+      {"s.", "s", "s", false},
+      {"sysprop.", "sysprop", "sysprop", false},
+      {"ss.", "ss", "ss", false},
+      {"a.", "a", "a", false},
+      {"z.", "z", "z", false},
+      {"empty..piece", "empty", "empty", true},
+  };
+  // More children than there are hash values, so some of them must collide.
+  for (int i = 0; i < 300; ++i) {
+    auto name = "many.child" + std::to_string(i);
+    property_info.emplace_back(PropertyInfoEntry{name + ".", name, name, false});
+  }
+
+  auto serialized_trie = std::string();
+  auto build_trie_error = std::string();
+  ASSERT_TRUE(BuildTrie(property_info, "default", "default", &serialized_trie, &build_trie_error))
+      << build_trie_error;
+
+  auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
+  auto test_lookups = [&]() {
+    const char* context;
+    for (const char* name : {"sys", "s", "sysprop", "ss", "a", "z"}) {
+      property_info_area->GetPropertyInfo((std::string(name) + ".x").c_str(), &context, nullptr);
+      EXPECT_STREQ(name, context);
+    }
+    for (const char* name : {"sy.x", "sysp.x", "b.x", "zz.x", "{.x", "sys", ".x"}) {
+      property_info_area->GetPropertyInfo(name, &context, nullptr);
+      EXPECT_STREQ("default", context) << name;
+    }
+    property_info_area->GetPropertyInfo("empty..piece", &context, nullptr);
+    EXPECT_STREQ("empty", context);
+    for (int i = 0; i < 300; ++i) {
+      auto name = "many.child" + std::to_string(i);
+      property_info_area->GetPropertyInfo((name + ".x").c_str(), &context, nullptr);
+      EXPECT_EQ(name, context);
+    }
+    property_info_area->GetPropertyInfo("many.child300.x", &context, nullptr);
+    EXPECT_STREQ("default", context);
+  };
+
+  ASSERT_NE(nullptr, property_info_area->root_node().child_name_hashes());
+  test_lookups();
+
+  // Version 1 parsers don't know about child_name_hashes, so make sure that binary searching the
+  // names directly, as they do, still works on the same data.
+  reinterpret_cast<PropertyInfoAreaHeader*>(serialized_trie.data())->current_version = 1;
+  ASSERT_EQ(nullptr, property_info_area->root_node().child_name_hashes());
+  test_lookups();
+}
+
+TEST(propertyinfoserializer, SharedNamesAndEntries) {
+  auto property_info = std::vector<PropertyInfoEntry>{
+      {"a.foo", "1st", "string", true},
+      {"a.xfoo", "2nd", "string", true},
+      {"b.foo", "1st", "string", true},
+      {"b.xfoo", "3rd", "string", true},
+  };
+
+  auto serialized_trie = std::string();
+  auto build_trie_error = std::string();
+  ASSERT_TRUE(BuildTrie(property_info, "default", "default", &serialized_trie, &build_trie_error))
+      << build_trie_error;
+
+  auto property_info_area = reinterpret_cast<const PropertyInfoArea*>(serialized_trie.data());
+  auto root_node = property_info_area->root_node();
+  TrieNode a_node;
+  TrieNode b_node;
+  ASSERT_TRUE(root_node.FindChildForString("a", 1, &a_node));
+  ASSERT_TRUE(root_node.FindChildForString("b", 1, &b_node));
+  ASSERT_EQ(2U, a_node.num_exact_matches());
+  ASSERT_EQ(2U, b_node.num_exact_matches());
+
+  // The identical entries of a.foo and b.foo are written once.
+  EXPECT_EQ(a_node.exact_match(0), b_node.exact_match(0));
+  // "foo" is stored as the tail of "xfoo".
+  EXPECT_NE(a_node.exact_match(1), b_node.exact_match(1));
+  EXPECT_EQ(a_node.exact_match(1)->name_offset + 1, a_node.exact_match(0)->name_offset);
+  EXPECT_EQ(a_node.exact_match(1)->name_offset, b_node.exact_match(1)->name_offset);
+
+  const char* context;
+  for (const auto& [name, expected_context, type, exact_match] : property_info) {
+    property_info_area->GetPropertyInfo(name.c_str(), &context, nullptr);
+    EXPECT_EQ(expected_context, context) << name;
+  }
+  property_info_area->GetPropertyInfo("a.oo", &context, nullptr);
+  EXPECT_STREQ("default", context);
+}
+
 }  // namespace properties
 }  // namespace android
@@ -102,7 +102,7 @@ class TrieBuilder {
   bool AddToTrie(const std::string& name, const std::string& context, const std::string& type,
                  bool exact, std::string* error);
 
-  const TrieBuilderNode builder_root() const { return builder_root_; }
+  const TrieBuilderNode& builder_root() const { return builder_root_; }
   const std::set<std::string>& contexts() const { return contexts_; }
   const std::set<std::string>& types() const { return types_; }
 
@@ -51,6 +51,11 @@ class TrieNodeArena {
     return ArenaObjectPointer<T>(data_, offset);
   }
 
+  template <typename T>
+  ArenaObjectPointer<T> object(uint32_t offset) {
+    return ArenaObjectPointer<T>(data_, offset);
+  }
+
   uint32_t AllocateUint32Array(int length) {
     uint32_t offset;
     AllocateData(sizeof(uint32_t) * length, &offset);
@@ -68,6 +73,14 @@ class TrieNodeArena {
     return offset;
   }
 
+  // Unlike AllocateAndWriteString(), this doesn't add a terminator, and |bytes| may contain '\0'.
+  uint32_t AllocateAndWriteBytes(const std::string& bytes) {
+    uint32_t offset;
+    char* data = static_cast<char*>(AllocateData(bytes.size(), &offset));
+    memcpy(data, bytes.data(), bytes.size());
+    return offset;
+  }
+
   void AllocateAndWriteUint32(uint32_t value) {
     auto location = static_cast<uint32_t*>(AllocateData(sizeof(uint32_t), nullptr));
     *location = value;
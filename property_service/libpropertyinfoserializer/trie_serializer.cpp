@@ -16,6 +16,8 @@
 
 #include "trie_serializer.h"
 
+#include <algorithm>
+
 namespace android {
 namespace properties {
 
@@ -39,6 +41,51 @@ void TrieSerializer::SerializeStrings(const std::set<std::string>& strings) {
   }
 }
 
+// Names are written once each to a pool ahead of the trie, and a name that is a suffix of another
+// one is stored inside it rather than on its own: "ro.foo" reuses the tail of "vendor.ro.foo".
+// Entries only refer to names by offset and length, and each stored name is null terminated, so
+// parsers are unaffected by this sharing.
+void TrieSerializer::WriteNamePool(const TrieBuilderNode& root) {
+  std::set<std::string> names;
+  std::vector<const TrieBuilderNode*> stack = {&root};
+  while (!stack.empty()) {
+    const TrieBuilderNode* node = stack.back();
+    stack.pop_back();
+    names.emplace(node->name());
+    for (const auto& prefix : node->prefixes()) names.emplace(prefix.name);
+    for (const auto& exact_match : node->exact_matches()) names.emplace(exact_match.name);
+    for (const auto& child : node->children()) stack.emplace_back(&child);
+  }
+
+  // Sorted by their reversal, a name that is a suffix of another is directly followed by a name it
+  // is also a suffix of, so walking backwards finds the longest name each one can live in.
+  std::vector<std::string> reversed;
+  reversed.reserve(names.size());
+  for (const auto& name : names) reversed.emplace_back(name.rbegin(), name.rend());
+  std::sort(reversed.begin(), reversed.end());
+
+  std::vector<size_t> owner(reversed.size());
+  for (size_t i = reversed.size(); i-- > 0;) {
+    owner[i] = i;
+    if (i + 1 < reversed.size() &&
+        reversed[i + 1].compare(0, reversed[i].size(), reversed[i]) == 0) {
+      owner[i] = owner[i + 1];
+    }
+  }
+
+  name_offsets_.clear();
+  std::vector<uint32_t> owner_offsets(reversed.size());
+  for (size_t i = reversed.size(); i-- > 0;) {
+    std::string name(reversed[i].rbegin(), reversed[i].rend());
+    if (owner[i] == i) {
+      owner_offsets[i] = arena_->AllocateAndWriteString(name);
+      name_offsets_[name] = owner_offsets[i];
+    } else {
+      name_offsets_[name] = owner_offsets[owner[i]] + reversed[owner[i]].size() - name.size();
+    }
+  }
+}
+
 uint32_t TrieSerializer::WritePropertyEntry(const PropertyEntryBuilder& property_entry) {
   uint32_t context_index = property_entry.context != nullptr && !property_entry.context->empty()
                                ? serialized_info()->FindContextIndex(property_entry.context->c_str())
@@ -46,20 +93,25 @@ uint32_t TrieSerializer::WritePropertyEntry(const PropertyEntryBuilder& property
   uint32_t type_index = property_entry.type != nullptr && !property_entry.type->empty()
                             ? serialized_info()->FindTypeIndex(property_entry.type->c_str())
                             : ~0u;
+
+  // Identical entries, such as a node and a prefix match of the same name, are written once.
+  auto key = std::make_tuple(property_entry.name, context_index, type_index);
+  auto it = property_entry_offsets_.find(key);
+  if (it != property_entry_offsets_.end()) return it->second;
+
   uint32_t offset;
   auto serialized_property_entry = arena_->AllocateObject<PropertyEntry>(&offset);
-  serialized_property_entry->name_offset = arena_->AllocateAndWriteString(property_entry.name);
+  serialized_property_entry->name_offset = name_offsets_.at(property_entry.name);
   serialized_property_entry->namelen = property_entry.name.size();
   serialized_property_entry->context_index = context_index;
   serialized_property_entry->type_index = type_index;
+  property_entry_offsets_.emplace(std::move(key), offset);
   return offset;
 }
 
-uint32_t TrieSerializer::WriteTrieNode(const TrieBuilderNode& builder_node) {
-  uint32_t trie_offset;
-  auto trie = arena_->AllocateObject<TrieNodeInternal>(&trie_offset);
-
-  trie->property_entry = WritePropertyEntry(builder_node.property_entry());
+void TrieSerializer::WriteTrieNode(const TrieBuilderNode& builder_node, uint32_t trie_offset,
+                                   std::deque<PendingTrieNode>* pending) {
+  auto trie = arena_->object<TrieNodeInternal>(trie_offset);
 
   // Write prefix matches
   auto sorted_prefix_matches = builder_node.prefixes();
@@ -95,18 +147,37 @@ uint32_t TrieSerializer::WriteTrieNode(const TrieBuilderNode& builder_node) {
   }
 
   // Write children
-  auto sorted_children = builder_node.children();
+  std::vector<const TrieBuilderNode*> sorted_children;
+  for (const auto& child : builder_node.children()) sorted_children.emplace_back(&child);
   std::sort(sorted_children.begin(), sorted_children.end(),
-            [](const auto& lhs, const auto& rhs) { return lhs.name() < rhs.name(); });
+            [](const auto* lhs, const auto* rhs) { return lhs->name() < rhs->name(); });
 
   trie->num_child_nodes = sorted_children.size();
   uint32_t children_offset_array_offset = arena_->AllocateUint32Array(sorted_children.size());
   trie->child_nodes = children_offset_array_offset;
 
+  // Write the hash of each child's name, in the same order, for FindChildForString().
+  auto child_name_hashes = std::string();
+  for (const auto* child : sorted_children) {
+    child_name_hashes.push_back(
+        TrieNode::ChildNameHash(child->name().data(), child->name().size()));
+  }
+  trie->child_name_hashes = arena_->AllocateAndWriteBytes(child_name_hashes);
+
+  // The children's nodes, then their entries, are written back to back, since a lookup compares
+  // its input against several siblings' names. Their own arrays follow in breadth-first order.
   for (unsigned int i = 0; i < sorted_children.size(); ++i) {
-    arena_->uint32_array(children_offset_array_offset)[i] = WriteTrieNode(sorted_children[i]);
+    uint32_t child_offset;
+    arena_->AllocateObject<TrieNodeInternal>(&child_offset);
+    arena_->uint32_array(children_offset_array_offset)[i] = child_offset;
+    pending->push_back({sorted_children[i], child_offset});
+  }
+  for (unsigned int i = 0; i < sorted_children.size(); ++i) {
+    uint32_t child_offset = arena_->uint32_array(children_offset_array_offset)[i];
+    uint32_t property_entry_offset = WritePropertyEntry(sorted_children[i]->property_entry());
+    arena_->object<TrieNodeInternal>(child_offset)->property_entry =
+        property_entry_offset;
   }
-  return trie_offset;
 }
 
 TrieSerializer::TrieSerializer() {}
@@ -115,7 +186,8 @@ std::string TrieSerializer::SerializeTrie(const TrieBuilder& trie_builder) {
   arena_.reset(new TrieNodeArena());
 
   auto header = arena_->AllocateObject<PropertyInfoAreaHeader>(nullptr);
-  header->current_version = 1;
+  // Version 2 only appends fields that version 1 parsers ignore.
+  header->current_version = 2;
   header->minimum_supported_version = 1;
 
   // Store where we're about to write the contexts.
@@ -129,9 +201,25 @@ std::string TrieSerializer::SerializeTrie(const TrieBuilder& trie_builder) {
   // We need to store size() up to this point now for Find*Offset() to work.
   header->size = arena_->size();
 
-  uint32_t root_trie_offset = WriteTrieNode(trie_builder.builder_root());
+  const auto& root = trie_builder.builder_root();
+  WriteNamePool(root);
+  property_entry_offsets_.clear();
+
+  uint32_t root_trie_offset;
+  arena_->AllocateObject<TrieNodeInternal>(&root_trie_offset);
+  uint32_t root_property_entry_offset = WritePropertyEntry(root.property_entry());
+  arena_->object<TrieNodeInternal>(root_trie_offset)->property_entry =
+      root_property_entry_offset;
   header->root_offset = root_trie_offset;
 
+  // Nodes are written breadth first, so the nodes visited early in every lookup share pages.
+  std::deque<PendingTrieNode> pending = {{&root, root_trie_offset}};
+  while (!pending.empty()) {
+    PendingTrieNode node = pending.front();
+    pending.pop_front();
+    WriteTrieNode(*node.builder_node, node.offset, &pending);
+  }
+
   // Record the real size now that we've written everything
   header->size = arena_->size();
 
@@ -17,7 +17,11 @@
 #ifndef PROPERTY_INFO_SERIALIZER_TRIE_SERIALIZER_H
 #define PROPERTY_INFO_SERIALIZER_TRIE_SERIALIZER_H
 
+#include <deque>
+#include <map>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "property_info_parser/property_info_parser.h"
@@ -35,18 +39,28 @@ class TrieSerializer {
   std::string SerializeTrie(const TrieBuilder& trie_builder);
 
  private:
+  // A node allocated in arena whose prefixes, exact matches and children are yet to be written.
+  struct PendingTrieNode {
+    const TrieBuilderNode* builder_node;
+    uint32_t offset;
+  };
+
   void SerializeStrings(const std::set<std::string>& strings);
+  void WriteNamePool(const TrieBuilderNode& root);
   uint32_t WritePropertyEntry(const PropertyEntryBuilder& property_entry);
 
-  // Writes a new TrieNode to arena, and recursively writes its children.
-  // Returns the offset within arena.
-  uint32_t WriteTrieNode(const TrieBuilderNode& builder_node);
+  // Fills in the TrieNode allocated at trie_offset, and allocates its children, which are added to
+  // pending to be filled in later.
+  void WriteTrieNode(const TrieBuilderNode& builder_node, uint32_t trie_offset,
+                     std::deque<PendingTrieNode>* pending);
 
   const PropertyInfoArea* serialized_info() const {
     return reinterpret_cast<const PropertyInfoArea*>(arena_->data().data());
   }
 
   std::unique_ptr<TrieNodeArena> arena_;
+  std::unordered_map<std::string, uint32_t> name_offsets_;
+  std::map<std::tuple<std::string, uint32_t, uint32_t>, uint32_t> property_entry_offsets_;
 };
 
 }  // namespace properties
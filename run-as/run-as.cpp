@@ -60,16 +60,6 @@
 //  - Run the 'gdbserver' binary executable to allow native debugging
 //
 
-static bool packagelist_parse_callback(pkg_info* this_package, void* userdata) {
-  pkg_info* p = reinterpret_cast<pkg_info*>(userdata);
-  if (strcmp(p->name, this_package->name) == 0) {
-    *p = *this_package;
-    return false; // Stop searching.
-  }
-  packagelist_free(this_package);
-  return true; // Keep searching.
-}
-
 static void check_directory(const char* path, uid_t uid) {
   struct stat st;
   if (TEMP_FAILURE_RETRY(lstat(path, &st)) == -1) {
@@ -196,8 +186,12 @@ int main(int argc, char* argv[]) {
   pkg_info info;
   memset(&info, 0, sizeof(info));
   info.name = pkgname;
-  if (!packagelist_parse(packagelist_parse_callback, &info)) {
-    error(1, errno, "packagelist_parse failed");
+  pkg_info* package = packagelist_lookup(pkgname);
+  if (package) {
+    info = *package;
+    free(package);
+  } else if (errno != 0) {
+    error(1, errno, "couldn't read the package list");
   }
 
   // Handle a multi-user data path
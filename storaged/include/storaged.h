@@ -109,16 +109,37 @@ class storaged_t : public RefBase {
     static const uint32_t current_version;
     Mutex proto_lock;
     unordered_map<userid_t, bool> proto_loaded;
+    // Between full rewrites of a user's proto, new uid io records are only
+    // appended to a journal next to it. This is what is known about the
+    // files on disk.
+    struct proto_journal {
+        uint64_t last_end_ts = 0;    // end_ts of the newest record on disk
+        size_t base_size = 0;        // size of the full proto
+        size_t size = 0;             // size of the journal
+        bool needs_rewrite = true;   // the full proto is missing or stale
+    };
+    unordered_map<userid_t, proto_journal> journals;
     void load_proto(userid_t user_id);
+    bool load_proto_data(userid_t user_id, const string& data);
+    void load_proto_journal(userid_t user_id);
     char* prepare_proto(userid_t user_id, StoragedProto* proto);
     void flush_proto(userid_t user_id, StoragedProto* proto);
-    void flush_proto_data(userid_t user_id, const char* data, ssize_t size);
+    bool flush_proto_data(userid_t user_id, const char* data, ssize_t size);
+    bool append_proto_journal(userid_t user_id, const StoragedProto& proto);
+    bool write_benchmarked(int fd, const char* data, ssize_t size);
+    void benchmark_storage();
+    // Where the users' storaged directories live; tests point it elsewhere.
+    string proto_root = "/data/misc_ce/";
     string proto_path(userid_t user_id) {
-        return string("/data/misc_ce/") + to_string(user_id) +
-               "/storaged/storaged.proto";
+        return proto_root + to_string(user_id) + "/storaged/storaged.proto";
+    }
+    string journal_path(userid_t user_id) {
+        return proto_path(user_id) + ".journal";
     }
     void init_health_service();
 
+    FRIEND_TEST(storaged_test, proto_journal);
+
   public:
     storaged_t(void);
     void init(void);
@@ -142,6 +163,10 @@ class storaged_t : public RefBase {
 
     uint32_t get_recent_perf(void) { return storage_info->get_recent_perf(); }
 
+    vector<disk_latency> get_latency_history(void) {
+        return mDsm ? mDsm->get_latency_history() : vector<disk_latency>();
+    }
+
     map<uint64_t, struct uid_records> get_uid_records(
             double hours, uint64_t threshold, bool force_report) {
         return mUidm.dump(hours, threshold, force_report);
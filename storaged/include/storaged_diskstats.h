@@ -19,7 +19,11 @@
 
 #include <stdint.h>
 
+#include <deque>
+#include <vector>
+
 #include <aidl/android/hardware/health/IHealth.h>
+#include <utils/Mutex.h>
 
 // number of attributes diskstats has
 #define DISK_STATS_SIZE ( 11 )
@@ -141,9 +145,36 @@ public:
     }
 };
 
+/*
+ * Distribution of I/O latency in microseconds. Buckets are a quarter of a
+ * power of two wide (about 19%), from 1us up to over a minute.
+ */
+class latency_histogram {
+public:
+    static constexpr int BUCKETS_PER_DOUBLING = 4;
+    static constexpr int NR_BUCKETS = 27 * BUCKETS_PER_DOUBLING;
+
+    latency_histogram() : mBuckets{}, mCount(0) {};
+    void add(uint64_t latency_us, uint64_t count);
+    // upper bound of the bucket holding the p-th quantile, 0 if empty
+    uint32_t percentile(double p) const;
+    uint64_t count() const { return mCount; }
+
+private:
+    uint64_t mBuckets[NR_BUCKETS];
+    uint64_t mCount;
+};
+
+struct disk_latency {
+    uint64_t end_time;          // wall time the period ended (seconds)
+    uint32_t read[3];           // p50, p99 and p999 read latency (us)
+    uint32_t write[3];          // p50, p99 and p999 write latency (us)
+};
+
 class disk_stats_monitor {
 private:
     FRIEND_TEST(storaged_test, disk_stats_monitor);
+    FRIEND_TEST(storaged_test, disk_latency_history);
     const char* const DISK_STATS_PATH;
     struct disk_stats mPrevious;
     struct disk_stats mAccumulate;      /* reset after stall */
@@ -163,6 +194,16 @@ private:
     struct disk_perf mMean;
     struct disk_perf mStd;
     std::shared_ptr<aidl::android::hardware::health::IHealth> mHealth;
+    /*
+     * Diskstats only has the total time spent by all requests, so each
+     * sample adds the mean latency of its interval, weighted by the number of
+     * requests in it. The histograms cover one publishing period.
+     */
+    latency_histogram mReadLatency;
+    latency_histogram mWriteLatency;
+    // most recent first, at most MAX_LATENCY_HISTORY entries
+    std::deque<disk_latency> mLatencyHistory;
+    android::Mutex mLatencyLock;
 
     void update_mean();
     void update_std();
@@ -171,8 +212,11 @@ private:
     bool detect(struct disk_perf* perf);
 
     void update(struct disk_stats* stats);
+    void add_latency(const struct disk_stats& inc);
 
 public:
+    static constexpr size_t MAX_LATENCY_HISTORY = 24;
+
   disk_stats_monitor(const std::shared_ptr<aidl::android::hardware::health::IHealth>& healthService,
                      uint32_t window_size = 5, double sigma = 1.0)
       : DISK_STATS_PATH(
@@ -195,6 +239,7 @@ public:
   bool enabled() { return mHealth != nullptr || DISK_STATS_PATH != nullptr; }
   void update(void);
   void publish(void);
+  std::vector<disk_latency> get_latency_history();
 };
 
 #endif /* _STORAGED_DISKSTATS_H_ */
@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -39,7 +40,7 @@ using namespace android::os::storaged;
 
 class uid_info : public UidInfo {
 public:
-    bool parse_uid_io_stats(string&& s);
+    bool parse_uid_io_stats(std::string_view s);
 };
 
 class io_usage {
@@ -83,6 +84,10 @@ private:
 
     // last dump from /proc/uid_io/stats, uid -> uid_info
     unordered_map<uint32_t, uid_info> last_uid_io_stats_;
+    // package names looked up so far, uid -> name
+    unordered_map<uint32_t, string> uid_names_;
+    // contents of /proc/uid_io/stats, kept to reuse the allocation
+    string uid_io_stats_buffer_;
     // current io usage for next report, app name -> uid_io_usage
     unordered_map<string, uid_io_usage> curr_io_stats_;
     // io usage records, end timestamp -> {start timestamp, vector of records}
@@ -19,6 +19,7 @@
 #include <dirent.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <zlib.h>
@@ -65,6 +66,10 @@ constexpr ssize_t benchmark_unit_size = 16 * 1024;  // 16KB
 
 constexpr size_t min_benchmark_size = 128 * 1024;  // 128KB
 
+// The journal is folded back into the full proto once it outgrows it, so the
+// bytes written over time stay proportional to the new records.
+constexpr size_t min_journal_size = 64 * 1024;  // 64KB
+
 }  // namespace
 
 const uint32_t storaged_t::current_version = 4;
@@ -229,45 +234,94 @@ void storaged_t::remove_user_ce(userid_t user_id) {
     Mutex::Autolock _l(proto_lock);
 
     proto_loaded[user_id] = false;
+    journals.erase(user_id);
     mUidm.clear_user_history(user_id);
     RemoveFileIfExists(proto_path(user_id), nullptr);
+    RemoveFileIfExists(journal_path(user_id), nullptr);
+}
+
+static uint32_t compute_crc(const UidIOUsage& uid_io_usage, uint32_t version) {
+    return crc32(version,
+                 reinterpret_cast<const Bytef*>(uid_io_usage.SerializeAsString().c_str()),
+                 uid_io_usage.ByteSizeLong());
 }
 
 void storaged_t::load_proto(userid_t user_id) {
+    proto_journal& journal = journals[user_id];
+    journal = {};
+
     string proto_file = proto_path(user_id);
     ifstream in(proto_file, ofstream::in | ofstream::binary);
 
-    if (!in.good()) return;
+    if (in.good()) {
+        stringstream ss;
+        ss << in.rdbuf();
+        if (load_proto_data(user_id, ss.str())) {
+            journal.base_size = ss.str().size();
+            journal.needs_rewrite = false;
+        } else {
+            LOG(WARNING) << "CRC mismatch in " << proto_file;
+        }
+    }
+
+    load_proto_journal(user_id);
+}
 
-    stringstream ss;
-    ss << in.rdbuf();
+// Loads one StoragedProto, either the full proto or a journal record.
+bool storaged_t::load_proto_data(userid_t user_id, const string& data) {
     StoragedProto proto;
-    proto.ParseFromString(ss.str());
+    proto.ParseFromString(data);
 
     const UidIOUsage& uid_io_usage = proto.uid_io_usage();
-    uint32_t computed_crc =
-            crc32(current_version,
-                  reinterpret_cast<const Bytef*>(uid_io_usage.SerializeAsString().c_str()),
-                  uid_io_usage.ByteSizeLong());
-    if (proto.crc() != computed_crc) {
-        LOG(WARNING) << "CRC mismatch in " << proto_file;
-        return;
+    if (proto.crc() != compute_crc(uid_io_usage, current_version)) {
+        return false;
     }
 
-    mUidm.load_uid_io_proto(user_id, proto.uid_io_usage());
+    mUidm.load_uid_io_proto(user_id, uid_io_usage);
 
     if (user_id == USER_SYSTEM) {
         storage_info->load_perf_history_proto(proto.perf_history());
     }
+
+    proto_journal& journal = journals[user_id];
+    for (const auto& item : uid_io_usage.uid_io_items()) {
+        journal.last_end_ts = std::max(journal.last_end_ts, item.end_ts());
+    }
+    return true;
+}
+
+// The journal is a sequence of records, each a StoragedProto holding only the
+// uid io items that are newer than everything before it, preceded by its size.
+void storaged_t::load_proto_journal(userid_t user_id) {
+    string journal_file = journal_path(user_id);
+    string data;
+    if (!ReadFileToString(journal_file, &data)) return;
+
+    proto_journal& journal = journals[user_id];
+    journal.size = data.size();
+
+    size_t offset = 0;
+    while (offset < data.size()) {
+        uint32_t record_size;
+        if (data.size() - offset < sizeof(record_size)) break;
+        memcpy(&record_size, data.data() + offset, sizeof(record_size));
+        offset += sizeof(record_size);
+        if (data.size() - offset < record_size) break;
+        if (!load_proto_data(user_id, data.substr(offset, record_size))) break;
+        offset += record_size;
+    }
+
+    if (offset != data.size()) {
+        // Most likely the last append was cut short. Whatever was read is
+        // kept, and the next flush writes everything out again.
+        LOG(WARNING) << "Corrupt record at offset " << offset << " in " << journal_file;
+        journal.needs_rewrite = true;
+    }
 }
 
 char* storaged_t:: prepare_proto(userid_t user_id, StoragedProto* proto) {
     proto->set_version(current_version);
-
-    const UidIOUsage& uid_io_usage = proto->uid_io_usage();
-    proto->set_crc(crc32(current_version,
-                         reinterpret_cast<const Bytef*>(uid_io_usage.SerializeAsString().c_str()),
-                         uid_io_usage.ByteSizeLong()));
+    proto->set_crc(compute_crc(proto->uid_io_usage(), current_version));
 
     uint32_t pagesize = sysconf(_SC_PAGESIZE);
     if (user_id == USER_SYSTEM) {
@@ -292,7 +346,41 @@ char* storaged_t:: prepare_proto(userid_t user_id, StoragedProto* proto) {
     return data;
 }
 
-void storaged_t::flush_proto_data(userid_t user_id,
+bool storaged_t::write_benchmarked(int fd, const char* data, ssize_t size) {
+    time_point<steady_clock> start, end;
+    uint32_t benchmark_size = 0;
+    uint64_t benchmark_time_ns = 0;
+    ssize_t ret;
+    bool first_write = true;
+
+    while (size > 0) {
+        start = steady_clock::now();
+        ret = write(fd, data, std::min(benchmark_unit_size, size));
+        if (ret <= 0) {
+            return false;
+        }
+        end = steady_clock::now();
+        /*
+        * compute bandwidth after the first write and if write returns
+        * exactly unit size.
+        */
+        if (!first_write && ret == benchmark_unit_size) {
+            benchmark_size += benchmark_unit_size;
+            benchmark_time_ns += duration_cast<nanoseconds>(end - start).count();
+        }
+        size -= ret;
+        data += ret;
+        first_write = false;
+    }
+
+    if (benchmark_size && benchmark_time_ns) {
+        int perf = benchmark_size * 1000000LLU / benchmark_time_ns;
+        storage_info->update_perf_history(perf, system_clock::now());
+    }
+    return true;
+}
+
+bool storaged_t::flush_proto_data(userid_t user_id,
                                   const char* data, ssize_t size) {
     string proto_file = proto_path(user_id);
     string tmp_file = proto_file + "_tmp";
@@ -302,57 +390,133 @@ void storaged_t::flush_proto_data(userid_t user_id,
                  S_IRUSR | S_IWUSR)));
     if (fd == -1) {
         PLOG(ERROR) << "Faied to open tmp file: " << tmp_file;
-        return;
+        return false;
     }
 
     if (user_id == USER_SYSTEM) {
-        time_point<steady_clock> start, end;
-        uint32_t benchmark_size = 0;
-        uint64_t benchmark_time_ns = 0;
-        ssize_t ret;
-        bool first_write = true;
-
-        while (size > 0) {
-            start = steady_clock::now();
-            ret = write(fd, data, std::min(benchmark_unit_size, size));
-            if (ret <= 0) {
-                PLOG(ERROR) << "Faied to write tmp file: " << tmp_file;
-                return;
-            }
-            end = steady_clock::now();
-            /*
-            * compute bandwidth after the first write and if write returns
-            * exactly unit size.
-            */
-            if (!first_write && ret == benchmark_unit_size) {
-                benchmark_size += benchmark_unit_size;
-                benchmark_time_ns += duration_cast<nanoseconds>(end - start).count();
-            }
-            size -= ret;
-            data += ret;
-            first_write = false;
-        }
-
-        if (benchmark_size && benchmark_time_ns) {
-            int perf = benchmark_size * 1000000LLU / benchmark_time_ns;
-            storage_info->update_perf_history(perf, system_clock::now());
+        if (!write_benchmarked(fd, data, size)) {
+            PLOG(ERROR) << "Faied to write tmp file: " << tmp_file;
+            return false;
         }
     } else {
         if (!WriteFully(fd, data, size)) {
             PLOG(ERROR) << "Faied to write tmp file: " << tmp_file;
-            return;
+            return false;
         }
     }
 
     fd.reset(-1);
-    rename(tmp_file.c_str(), proto_file.c_str());
+    if (rename(tmp_file.c_str(), proto_file.c_str()) != 0) {
+        PLOG(ERROR) << "Faied to rename tmp file: " << tmp_file;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * The perf history is sampled while writing the system user's proto. When
+ * only the journal is written, write the same minimum amount to a scratch
+ * file instead, so that a sample is still taken every flush.
+ */
+void storaged_t::benchmark_storage() {
+    string tmp_file = proto_path(USER_SYSTEM) + "_tmp";
+    unique_fd fd(TEMP_FAILURE_RETRY(open(tmp_file.c_str(),
+                 O_SYNC | O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC | O_DIRECT,
+                 S_IRUSR | S_IWUSR)));
+    if (fd == -1) {
+        PLOG(ERROR) << "Faied to open tmp file: " << tmp_file;
+        return;
+    }
+
+    char* data = nullptr;
+    if (posix_memalign(reinterpret_cast<void**>(&data), sysconf(_SC_PAGESIZE),
+                       min_benchmark_size)) {
+        PLOG(ERROR) << "Faied to alloc aligned buffer (size: " << min_benchmark_size << ")";
+        return;
+    }
+    unique_ptr<char, decltype(&free)> buffer(data, free);
+    memset(data, 0xFD, min_benchmark_size);
+
+    if (!write_benchmarked(fd, data, min_benchmark_size)) {
+        PLOG(ERROR) << "Faied to write tmp file: " << tmp_file;
+    }
+    unlink(tmp_file.c_str());
+}
+
+/*
+ * Appends the items of proto that aren't on disk yet to the journal. Returns
+ * false if the full proto should be rewritten instead.
+ */
+bool storaged_t::append_proto_journal(userid_t user_id, const StoragedProto& proto) {
+    proto_journal& journal = journals[user_id];
+    if (journal.needs_rewrite || journal.size > std::max(journal.base_size, min_journal_size)) {
+        return false;
+    }
+
+    StoragedProto record;
+    uint64_t last_end_ts = journal.last_end_ts;
+    for (const auto& item : proto.uid_io_usage().uid_io_items()) {
+        if (item.end_ts() > journal.last_end_ts) {
+            *record.mutable_uid_io_usage()->add_uid_io_items() = item;
+            last_end_ts = std::max(last_end_ts, item.end_ts());
+        }
+    }
+    if (user_id == USER_SYSTEM) {
+        *record.mutable_perf_history() = proto.perf_history();
+    } else if (record.uid_io_usage().uid_io_items_size() == 0) {
+        return true;
+    }
+    record.set_version(current_version);
+    record.set_crc(compute_crc(record.uid_io_usage(), current_version));
+
+    uint32_t record_size = record.ByteSizeLong();
+    string data(reinterpret_cast<const char*>(&record_size), sizeof(record_size));
+    data += record.SerializeAsString();
+
+    string journal_file = journal_path(user_id);
+    unique_fd fd(TEMP_FAILURE_RETRY(open(journal_file.c_str(),
+                 O_APPEND | O_CREAT | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR)));
+    if (fd == -1) {
+        PLOG(ERROR) << "Faied to open journal: " << journal_file;
+        return false;
+    }
+    if (!WriteFully(fd, data.data(), data.size()) || fdatasync(fd) != 0) {
+        PLOG(ERROR) << "Faied to append to journal: " << journal_file;
+        // The journal may now end in a partial record, which only a rewrite
+        // gets rid of.
+        journal.needs_rewrite = true;
+        return false;
+    }
+
+    journal.size += data.size();
+    journal.last_end_ts = last_end_ts;
+    return true;
 }
 
 void storaged_t::flush_proto(userid_t user_id, StoragedProto* proto) {
+    if (append_proto_journal(user_id, *proto)) {
+        if (user_id == USER_SYSTEM) {
+            benchmark_storage();
+        }
+        return;
+    }
+
     unique_ptr<char> proto_data(prepare_proto(user_id, proto));
     if (proto_data == nullptr) return;
 
-    flush_proto_data(user_id, proto_data.get(), proto->ByteSizeLong());
+    if (!flush_proto_data(user_id, proto_data.get(), proto->ByteSizeLong())) return;
+
+    // The full proto has everything the journal had, so start a new one.
+    // Should storaged die before the journal is gone, the records it holds
+    // are skipped as duplicates on the next load.
+    proto_journal& journal = journals[user_id];
+    RemoveFileIfExists(journal_path(user_id), nullptr);
+    journal.base_size = proto->ByteSizeLong();
+    journal.size = 0;
+    journal.needs_rewrite = false;
+    for (const auto& item : proto->uid_io_usage().uid_io_items()) {
+        journal.last_end_ts = std::max(journal.last_end_ts, item.end_ts());
+    }
 }
 
 void storaged_t::flush_protos(unordered_map<int, StoragedProto>* protos) {
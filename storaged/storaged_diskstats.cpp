@@ -16,9 +16,12 @@
 
 #define LOG_TAG "storaged"
 
+#include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 
+#include <algorithm>
 #include <sstream>
 
 #include <android-base/file.h>
@@ -207,6 +210,31 @@ void add_disk_stats(struct disk_stats* src, struct disk_stats* dst)
     }
 }
 
+/* latency_histogram */
+void latency_histogram::add(uint64_t latency_us, uint64_t count)
+{
+    if (count == 0) return;
+    int bucket = 0;
+    if (latency_us > 1) {
+        bucket = std::min<int>(log2((double)latency_us) * BUCKETS_PER_DOUBLING, NR_BUCKETS - 1);
+    }
+    mBuckets[bucket] += count;
+    mCount += count;
+}
+
+uint32_t latency_histogram::percentile(double p) const
+{
+    if (mCount == 0) return 0;
+    uint64_t rank = ceil(p * mCount);
+    uint64_t seen = 0;
+    int bucket = 0;
+    for (; bucket < NR_BUCKETS - 1; ++bucket) {
+        seen += mBuckets[bucket];
+        if (seen >= rank) break;
+    }
+    return ceil(exp2((double)(bucket + 1) / BUCKETS_PER_DOUBLING));
+}
+
 /* disk_stats_monitor */
 void disk_stats_monitor::update_mean()
 {
@@ -252,11 +280,26 @@ bool disk_stats_monitor::detect(struct disk_perf* perf)
         ((double)perf->write_perf < (double)mMean.write_perf - mSigma * (double)mStd.write_perf);
 }
 
+void disk_stats_monitor::add_latency(const struct disk_stats& inc)
+{
+    Mutex::Autolock _l(mLatencyLock);
+    if (inc.read_ios) {
+        mReadLatency.add(inc.read_ticks * MSEC_TO_USEC / inc.read_ios, inc.read_ios);
+    }
+    if (inc.write_ios) {
+        mWriteLatency.add(inc.write_ticks * MSEC_TO_USEC / inc.write_ios, inc.write_ios);
+    }
+}
+
 void disk_stats_monitor::update(struct disk_stats* curr)
 {
     disk_stats inc;
     get_inc_disk_stats(&mPrevious, curr, &inc);
     add_disk_stats(&inc, &mAccumulate_pub);
+    // The first sample covers everything since boot.
+    if (mPrevious.end_time != 0) {
+        add_latency(inc);
+    }
 
     struct disk_perf perf = get_disk_perf(&inc);
     log_debug_disk_perf(&perf, "regular");
@@ -315,4 +358,26 @@ void disk_stats_monitor::publish(void)
     log_event_disk_stats(&mAccumulate_pub, "regular");
     // Reset global structures
     memset(&mAccumulate_pub, 0, sizeof(struct disk_stats));
+
+    Mutex::Autolock _l(mLatencyLock);
+    if (mReadLatency.count() || mWriteLatency.count()) {
+        disk_latency latency = {.end_time = (uint64_t)time(nullptr)};
+        const double quantiles[] = {0.5, 0.99, 0.999};
+        for (int i = 0; i < 3; ++i) {
+            latency.read[i] = mReadLatency.percentile(quantiles[i]);
+            latency.write[i] = mWriteLatency.percentile(quantiles[i]);
+        }
+        mLatencyHistory.push_front(latency);
+        if (mLatencyHistory.size() > MAX_LATENCY_HISTORY) {
+            mLatencyHistory.pop_back();
+        }
+    }
+    mReadLatency = {};
+    mWriteLatency = {};
+}
+
+std::vector<disk_latency> disk_stats_monitor::get_latency_history()
+{
+    Mutex::Autolock _l(mLatencyLock);
+    return std::vector<disk_latency>(mLatencyHistory.begin(), mLatencyHistory.end());
 }
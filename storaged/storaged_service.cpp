@@ -107,6 +107,7 @@ status_t StoragedService::dump(int fd, const Vector<String16>& args) {
     uint64_t threshold = 0;
     bool force_report = false;
     bool debug = false;
+    bool latency = false;
     for (size_t i = 0; i < args.size(); i++) {
         const auto& arg = args[i];
         if (arg == String16("--hours")) {
@@ -138,6 +139,19 @@ status_t StoragedService::dump(int fd, const Vector<String16>& args) {
             debug = true;
             continue;
         }
+        if (arg == String16("--latency")) {
+            latency = true;
+            continue;
+        }
+    }
+
+    if (latency) {
+        dprintf(fd, "end_time,read_p50,read_p99,read_p999,write_p50,write_p99,write_p999 (us)\n");
+        for (const auto& l : storaged_sp->get_latency_history()) {
+            dprintf(fd, "%" PRIu64 ",%u,%u,%u,%u,%u,%u\n", l.end_time,
+                    l.read[0], l.read[1], l.read[2], l.write[0], l.write[1], l.write[2]);
+        }
+        return OK;
     }
 
     uint64_t last_ts = 0;
@@ -209,6 +223,15 @@ binder::Status StoragedPrivateService::dumpPerfHistory(
     return binder::Status::ok();
 }
 
+binder::Status StoragedPrivateService::dumpLatencyHistory(
+        vector<int32_t>* _aidl_return) {
+    for (const auto& l : storaged_sp->get_latency_history()) {
+        _aidl_return->insert(_aidl_return->end(), std::begin(l.read), std::end(l.read));
+        _aidl_return->insert(_aidl_return->end(), std::begin(l.write), std::end(l.write));
+    }
+    return binder::Status::ok();
+}
+
 sp<IStoragedPrivate> get_storaged_pri_service() {
     sp<IServiceManager> sm = defaultServiceManager();
     if (sm == NULL) return NULL;
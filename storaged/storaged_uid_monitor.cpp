@@ -19,10 +19,14 @@
 #include <stdint.h>
 #include <time.h>
 
+#include <atomic>
+#include <charconv>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 
+#include <android/content/pm/BnPackageChangeObserver.h>
 #include <android/content/pm/IPackageManagerNative.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -44,9 +48,41 @@ using namespace storaged_proto;
 
 namespace {
 
-bool refresh_uid_names;
+// set when a package changes, as the cached uid names may be stale
+std::atomic<bool> uid_names_stale;
 const char* UID_IO_STATS_PATH = "/proc/uid_io/stats";
 
+// Returns the part of *s up to the first sep, and removes it and sep from *s.
+std::string_view next_field(std::string_view* s, char sep)
+{
+    size_t end = s->find(sep);
+    std::string_view field = s->substr(0, end);
+    s->remove_prefix(end == std::string_view::npos ? s->size() : end + 1);
+    return field;
+}
+
+// Same as next_field, from the back of *s.
+std::string_view last_field(std::string_view* s, char sep)
+{
+    size_t start = s->rfind(sep);
+    if (start == std::string_view::npos) {
+        std::string_view field = *s;
+        *s = {};
+        return field;
+    }
+    std::string_view field = s->substr(start + 1);
+    s->remove_suffix(field.size() + 1);
+    return field;
+}
+
+template <typename T>
+bool parse_field(std::string_view field, T* value)
+{
+    const char* end = field.data() + field.size();
+    auto [ptr, ec] = std::from_chars(field.data(), end, *value);
+    return ec == std::errc() && ptr == end && !field.empty();
+}
+
 } // namepsace
 
 std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats()
@@ -56,21 +92,22 @@ std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats()
 };
 
 /* return true on parse success and false on failure */
-bool uid_info::parse_uid_io_stats(std::string&& s)
+bool uid_info::parse_uid_io_stats(std::string_view s)
 {
-    std::vector<std::string> fields = Split(s, " ");
-    if (fields.size() < 11 ||
-        !ParseUint(fields[0],  &uid) ||
-        !ParseUint(fields[1],  &io[FOREGROUND].rchar) ||
-        !ParseUint(fields[2],  &io[FOREGROUND].wchar) ||
-        !ParseUint(fields[3],  &io[FOREGROUND].read_bytes) ||
-        !ParseUint(fields[4],  &io[FOREGROUND].write_bytes) ||
-        !ParseUint(fields[5],  &io[BACKGROUND].rchar) ||
-        !ParseUint(fields[6],  &io[BACKGROUND].wchar) ||
-        !ParseUint(fields[7],  &io[BACKGROUND].read_bytes) ||
-        !ParseUint(fields[8],  &io[BACKGROUND].write_bytes) ||
-        !ParseUint(fields[9],  &io[FOREGROUND].fsync) ||
-        !ParseUint(fields[10], &io[BACKGROUND].fsync)) {
+    uint64_t* values[] = {
+        &io[FOREGROUND].rchar, &io[FOREGROUND].wchar,
+        &io[FOREGROUND].read_bytes, &io[FOREGROUND].write_bytes,
+        &io[BACKGROUND].rchar, &io[BACKGROUND].wchar,
+        &io[BACKGROUND].read_bytes, &io[BACKGROUND].write_bytes,
+        &io[FOREGROUND].fsync, &io[BACKGROUND].fsync,
+    };
+
+    std::string_view rest = s;
+    bool ok = parse_field(next_field(&rest, ' '), &uid);
+    for (uint64_t* value : values) {
+        ok = ok && parse_field(next_field(&rest, ' '), value);
+    }
+    if (!ok) {
         LOG(WARNING) << "Invalid uid I/O stats: \"" << s << "\"";
         return false;
     }
@@ -78,27 +115,30 @@ bool uid_info::parse_uid_io_stats(std::string&& s)
 }
 
 /* return true on parse success and false on failure */
-bool task_info::parse_task_io_stats(std::string&& s)
+bool task_info::parse_task_io_stats(std::string_view s)
 {
-    std::vector<std::string> fields = Split(s, ",");
-    size_t size = fields.size();
-    if (size < 13 ||
-        !ParseInt(fields[size - 11],  &pid) ||
-        !ParseUint(fields[size - 10],  &io[FOREGROUND].rchar) ||
-        !ParseUint(fields[size - 9],  &io[FOREGROUND].wchar) ||
-        !ParseUint(fields[size - 8],  &io[FOREGROUND].read_bytes) ||
-        !ParseUint(fields[size - 7],  &io[FOREGROUND].write_bytes) ||
-        !ParseUint(fields[size - 6],  &io[BACKGROUND].rchar) ||
-        !ParseUint(fields[size - 5],  &io[BACKGROUND].wchar) ||
-        !ParseUint(fields[size - 4],  &io[BACKGROUND].read_bytes) ||
-        !ParseUint(fields[size - 3], &io[BACKGROUND].write_bytes) ||
-        !ParseUint(fields[size - 2], &io[FOREGROUND].fsync) ||
-        !ParseUint(fields[size - 1], &io[BACKGROUND].fsync)) {
+    // The comm may contain commas, so the fields are taken from the back.
+    uint64_t* values[] = {
+        &io[BACKGROUND].fsync, &io[FOREGROUND].fsync,
+        &io[BACKGROUND].write_bytes, &io[BACKGROUND].read_bytes,
+        &io[BACKGROUND].wchar, &io[BACKGROUND].rchar,
+        &io[FOREGROUND].write_bytes, &io[FOREGROUND].read_bytes,
+        &io[FOREGROUND].wchar, &io[FOREGROUND].rchar,
+    };
+
+    std::string_view rest = s;
+    bool ok = true;
+    for (uint64_t* value : values) {
+        ok = ok && parse_field(last_field(&rest, ','), value);
+    }
+    ok = ok && parse_field(last_field(&rest, ','), &pid);
+    // What's left is "task,<comm>".
+    size_t comm_start = rest.find(',');
+    if (!ok || comm_start == std::string_view::npos) {
         LOG(WARNING) << "Invalid task I/O stats: \"" << s << "\"";
         return false;
     }
-    comm = Join(std::vector<std::string>(
-                fields.begin() + 1, fields.end() - 11), ',');
+    comm = rest.substr(comm_start + 1);
     return true;
 }
 
@@ -117,35 +157,60 @@ bool io_usage::is_zero() const
 
 namespace {
 
-void get_uid_names(const vector<int>& uids, const vector<std::string*>& uid_names)
+class PackageChangeObserver : public BnPackageChangeObserver {
+  public:
+    binder::Status onPackageChanged(const PackageChangeEvent&) override {
+        uid_names_stale = true;
+        return binder::Status::ok();
+    }
+};
+
+// Looks up the package names of |uids|. Uids without a package get an empty
+// name. Returns false if the package manager couldn't be asked.
+bool get_uid_names(const vector<int>& uids, vector<std::string>* names)
 {
     sp<IServiceManager> sm = defaultServiceManager();
     if (sm == NULL) {
         LOG(ERROR) << "defaultServiceManager failed";
-        return;
+        return false;
     }
 
     sp<IBinder> binder = sm->getService(String16("package_native"));
     if (binder == NULL) {
         LOG(ERROR) << "getService package_native failed";
-        return;
+        return false;
     }
 
     sp<IPackageManagerNative> package_mgr = interface_cast<IPackageManagerNative>(binder);
-    std::vector<std::string> names;
-    binder::Status status = package_mgr->getNamesForUids(uids, &names);
-    if (!status.isOk()) {
-        LOG(ERROR) << "package_native::getNamesForUids failed: " << status.exceptionMessage();
-        return;
-    }
 
-    for (uint32_t i = 0; i < uid_names.size(); i++) {
-        if (!names[i].empty()) {
-            *uid_names[i] = names[i];
+    // Names are only looked up for uids that haven't been seen before, so
+    // have the package manager say when one of the known ones may change.
+    // A new package manager doesn't know about the old observer. Names cached
+    // while no observer was registered may have changed unnoticed.
+    static sp<IBinder> observed_binder;
+    if (observed_binder != binder) {
+        binder::Status status =
+                package_mgr->registerPackageChangeObserver(sp<PackageChangeObserver>::make());
+        if (status.isOk()) {
+            uid_names_stale = true;
+            observed_binder = binder;
+        } else {
+            LOG(WARNING) << "package_native::registerPackageChangeObserver failed: "
+                         << status.exceptionMessage();
         }
     }
 
-    refresh_uid_names = false;
+    binder::Status status = package_mgr->getNamesForUids(uids, names);
+    if (!status.isOk()) {
+        LOG(ERROR) << "package_native::getNamesForUids failed: " << status.exceptionMessage();
+        return false;
+    }
+    if (names->size() != uids.size()) {
+        LOG(ERROR) << "package_native::getNamesForUids returned " << names->size()
+                   << " names for " << uids.size() << " uids";
+        return false;
+    }
+    return true;
 }
 
 } // namespace
@@ -153,44 +218,59 @@ void get_uid_names(const vector<int>& uids, const vector<std::string*>& uid_name
 std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats_locked()
 {
     std::unordered_map<uint32_t, uid_info> uid_io_stats;
-    std::string buffer;
-    if (!ReadFileToString(UID_IO_STATS_PATH, &buffer)) {
+    if (!ReadFileToString(UID_IO_STATS_PATH, &uid_io_stats_buffer_)) {
         PLOG(ERROR) << UID_IO_STATS_PATH << ": ReadFileToString failed";
         return uid_io_stats;
     }
 
-    std::vector<std::string> io_stats = Split(std::move(buffer), "\n");
-    uid_info u;
+    if (uid_names_stale.exchange(false)) {
+        uid_names_.clear();
+    }
+
+    uid_io_stats.reserve(last_uid_io_stats_.size());
+    std::string_view io_stats = uid_io_stats_buffer_;
+    uid_info* u = nullptr;
     vector<int> uids;
     vector<std::string*> uid_names;
 
-    for (uint32_t i = 0; i < io_stats.size(); i++) {
-        if (io_stats[i].empty()) {
+    while (!io_stats.empty()) {
+        std::string_view line = next_field(&io_stats, '\n');
+        if (line.empty()) {
             continue;
         }
 
-        if (io_stats[i].compare(0, 4, "task")) {
-            if (!u.parse_uid_io_stats(std::move(io_stats[i])))
+        if (line.compare(0, 4, "task")) {
+            uid_info parsed;
+            if (!parsed.parse_uid_io_stats(line))
                 continue;
-            uid_io_stats[u.uid] = u;
-            uid_io_stats[u.uid].name = std::to_string(u.uid);
-            uids.push_back(u.uid);
-            uid_names.push_back(&uid_io_stats[u.uid].name);
-            if (last_uid_io_stats_.find(u.uid) == last_uid_io_stats_.end()) {
-                refresh_uid_names = true;
+            u = &uid_io_stats[parsed.uid];
+            *u = std::move(parsed);
+            auto name = uid_names_.find(u->uid);
+            if (name != uid_names_.end()) {
+                u->name = name->second;
             } else {
-                uid_io_stats[u.uid].name = last_uid_io_stats_[u.uid].name;
+                u->name = std::to_string(u->uid);
+                uids.push_back(u->uid);
+                uid_names.push_back(&u->name);
             }
-        } else {
+        } else if (u != nullptr) {
             task_info t;
-            if (!t.parse_task_io_stats(std::move(io_stats[i])))
+            if (!t.parse_task_io_stats(line))
                 continue;
-            uid_io_stats[u.uid].tasks[t.pid] = t;
+            u->tasks[t.pid] = std::move(t);
         }
     }
 
-    if (!uids.empty() && refresh_uid_names) {
-        get_uid_names(uids, uid_names);
+    // Only resolved names are cached; the other uids keep their number and
+    // are looked up again on the next poll.
+    vector<std::string> names;
+    if (!uids.empty() && get_uid_names(uids, &names)) {
+        for (size_t i = 0; i < uids.size(); i++) {
+            if (!names[i].empty()) {
+                *uid_names[i] = names[i];
+                uid_names_[uids[i]] = names[i];
+            }
+        }
     }
 
     return uid_io_stats;
@@ -310,21 +390,18 @@ void uid_monitor::update_curr_io_stats_locked()
 
     for (const auto& it : uid_io_stats) {
         const uid_info& uid = it.second;
-        if (curr_io_stats_.find(uid.name) == curr_io_stats_.end()) {
-            curr_io_stats_[uid.name] = {};
-        }
-
         struct uid_io_usage& usage = curr_io_stats_[uid.name];
         usage.user_id = multiuser_get_user_id(uid.uid);
 
+        uid_info& last = last_uid_io_stats_[uid.uid];
         int64_t fg_rd_delta = uid.io[FOREGROUND].read_bytes -
-            last_uid_io_stats_[uid.uid].io[FOREGROUND].read_bytes;
+            last.io[FOREGROUND].read_bytes;
         int64_t bg_rd_delta = uid.io[BACKGROUND].read_bytes -
-            last_uid_io_stats_[uid.uid].io[BACKGROUND].read_bytes;
+            last.io[BACKGROUND].read_bytes;
         int64_t fg_wr_delta = uid.io[FOREGROUND].write_bytes -
-            last_uid_io_stats_[uid.uid].io[FOREGROUND].write_bytes;
+            last.io[FOREGROUND].write_bytes;
         int64_t bg_wr_delta = uid.io[BACKGROUND].write_bytes -
-            last_uid_io_stats_[uid.uid].io[BACKGROUND].write_bytes;
+            last.io[BACKGROUND].write_bytes;
 
         usage.uid_ios.bytes[READ][FOREGROUND][charger_stat_] +=
             (fg_rd_delta < 0) ? 0 : fg_rd_delta;
@@ -339,14 +416,15 @@ void uid_monitor::update_curr_io_stats_locked()
             const task_info& task = task_it.second;
             const pid_t pid = task_it.first;
             const std::string& comm = task_it.second.comm;
+            const task_info& last_task = last.tasks[pid];
             int64_t task_fg_rd_delta = task.io[FOREGROUND].read_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[FOREGROUND].read_bytes;
+                last_task.io[FOREGROUND].read_bytes;
             int64_t task_bg_rd_delta = task.io[BACKGROUND].read_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[BACKGROUND].read_bytes;
+                last_task.io[BACKGROUND].read_bytes;
             int64_t task_fg_wr_delta = task.io[FOREGROUND].write_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[FOREGROUND].write_bytes;
+                last_task.io[FOREGROUND].write_bytes;
             int64_t task_bg_wr_delta = task.io[BACKGROUND].write_bytes -
-                last_uid_io_stats_[uid.uid].tasks[pid].io[BACKGROUND].write_bytes;
+                last_task.io[BACKGROUND].write_bytes;
 
             io_usage& task_usage = usage.task_ios[comm];
             task_usage.bytes[READ][FOREGROUND][charger_stat_] +=
@@ -360,7 +438,7 @@ void uid_monitor::update_curr_io_stats_locked()
         }
     }
 
-    last_uid_io_stats_ = uid_io_stats;
+    last_uid_io_stats_ = std::move(uid_io_stats);
 }
 
 void uid_monitor::report(unordered_map<int, StoragedProto>* protos)
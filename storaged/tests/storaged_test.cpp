@@ -23,6 +23,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <android-base/file.h>
 #include <gtest/gtest.h>
 
 #include <aidl/android/hardware/health/IHealth.h>
@@ -697,3 +698,158 @@ TEST(storaged_test, load_uid_io_proto) {
     uidm.load_uid_io_proto(0, user_0);
     ASSERT_LE(io_history.size(), size_t(uid_monitor::MAX_UID_RECORDS_SIZE));
 }
+
+TEST(storaged_test, parse_uid_io_stats) {
+    uid_info u;
+    ASSERT_TRUE(u.parse_uid_io_stats("10001 1 2 3 4 5 6 7 8 9 10"));
+    EXPECT_EQ(u.uid, 10001U);
+    EXPECT_EQ(u.io[FOREGROUND].rchar, 1U);
+    EXPECT_EQ(u.io[FOREGROUND].write_bytes, 4U);
+    EXPECT_EQ(u.io[BACKGROUND].rchar, 5U);
+    EXPECT_EQ(u.io[BACKGROUND].write_bytes, 8U);
+    EXPECT_EQ(u.io[FOREGROUND].fsync, 9U);
+    EXPECT_EQ(u.io[BACKGROUND].fsync, 10U);
+
+    EXPECT_FALSE(u.parse_uid_io_stats("10001 1 2 3 4 5 6 7 8 9"));
+    EXPECT_FALSE(u.parse_uid_io_stats("10001 1 2 3 4 5 6 7 8 9 -10"));
+
+    // The comm may contain commas.
+    task_info t;
+    ASSERT_TRUE(t.parse_task_io_stats("task,Binder:1,2,123,1,2,3,4,5,6,7,8,9,10"));
+    EXPECT_EQ(t.comm, "Binder:1,2");
+    EXPECT_EQ(t.pid, 123);
+    EXPECT_EQ(t.io[FOREGROUND].rchar, 1U);
+    EXPECT_EQ(t.io[BACKGROUND].write_bytes, 8U);
+    EXPECT_EQ(t.io[BACKGROUND].fsync, 10U);
+
+    EXPECT_FALSE(t.parse_task_io_stats("task,123,1,2,3,4,5,6,7,8,9,10"));
+}
+
+TEST(storaged_test, latency_histogram) {
+    latency_histogram hist;
+    EXPECT_EQ(hist.percentile(0.5), 0U);
+
+    hist.add(100, 990);
+    hist.add(10000, 9);
+    hist.add(1000000, 1);
+    EXPECT_EQ(hist.count(), 1000U);
+
+    // Each percentile lands in the bucket of its latency, buckets are ~19% wide.
+    EXPECT_GE(hist.percentile(0.5), 100U);
+    EXPECT_LE(hist.percentile(0.5), 120U);
+    EXPECT_GE(hist.percentile(0.99), 100U);
+    EXPECT_LE(hist.percentile(0.99), 120U);
+    EXPECT_GE(hist.percentile(0.999), 10000U);
+    EXPECT_LE(hist.percentile(0.999), 12000U);
+    EXPECT_GE(hist.percentile(1), 1000000U);
+    EXPECT_LE(hist.percentile(1), 1200000U);
+}
+
+TEST(storaged_test, disk_latency_history) {
+    disk_stats_monitor dsm{nullptr};
+    struct disk_stats stats = {};
+    stats.end_time = 1;
+    // The first sample covers everything since boot and isn't counted.
+    stats.read_ios = 1;
+    stats.read_ticks = 1000;
+    dsm.update(&stats);
+
+    // 100 reads of 2ms each and 10 writes of 10ms each, per sample
+    for (int i = 0; i < 10; ++i) {
+        stats.read_ios += 100;
+        stats.read_ticks += 200;
+        stats.write_ios += 10;
+        stats.write_ticks += 100;
+        stats.end_time += 60000;
+        dsm.update(&stats);
+    }
+    dsm.publish();
+    // Nothing happened during the second period.
+    dsm.publish();
+
+    std::vector<disk_latency> history = dsm.get_latency_history();
+    ASSERT_EQ(history.size(), 1U);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_GE(history[0].read[i], 2000U);
+        EXPECT_LE(history[0].read[i], 2400U);
+        EXPECT_GE(history[0].write[i], 10000U);
+        EXPECT_LE(history[0].write[i], 12000U);
+    }
+}
+
+TEST(storaged_test, proto_journal) {
+    static const userid_t kUser = 10;
+    TemporaryDir root;
+    ASSERT_EQ(0, mkdir((string(root.path) + "/10").c_str(), 0700));
+    ASSERT_EQ(0, mkdir((string(root.path) + "/10/storaged").c_str(), 0700));
+
+    auto new_storaged = [&root]() {
+        sp<storaged_t> storaged = new storaged_t();
+        storaged->proto_root = string(root.path) + "/";
+        return storaged;
+    };
+    auto add_record = [](uid_monitor* uidm, uint64_t end_ts, const char* name) {
+        uidm->io_history()[end_ts] = {
+            .start_ts = end_ts - 100,
+            .entries = {{name, {.user_id = kUser}}},
+        };
+    };
+    auto flush = [](storaged_t* storaged) {
+        unordered_map<int, StoragedProto> protos;
+        storaged->mUidm.update_uid_io_proto(&protos);
+        storaged->flush_proto(kUser, &protos[kUser]);
+    };
+
+    sp<storaged_t> storaged = new_storaged();
+    if (!storaged->mUidm.enabled()) GTEST_SKIP() << "uid io stats are not supported";
+    string proto_file = storaged->proto_path(kUser);
+    string journal_file = storaged->journal_path(kUser);
+
+    // Without a proto on disk, the first flush writes it in full.
+    storaged->load_proto(kUser);
+    add_record(&storaged->mUidm, 200, "app1");
+    flush(storaged.get());
+    string proto_data;
+    ASSERT_TRUE(android::base::ReadFileToString(proto_file, &proto_data));
+    ASSERT_NE(0, access(journal_file.c_str(), F_OK));
+
+    // Newer records are only appended to the journal, and nothing is written
+    // when there are none.
+    add_record(&storaged->mUidm, 300, "app2");
+    flush(storaged.get());
+    string journal_data;
+    ASSERT_TRUE(android::base::ReadFileToString(journal_file, &journal_data));
+    ASSERT_FALSE(journal_data.empty());
+    flush(storaged.get());
+    string unchanged;
+    ASSERT_TRUE(android::base::ReadFileToString(journal_file, &unchanged));
+    EXPECT_EQ(journal_data, unchanged);
+    ASSERT_TRUE(android::base::ReadFileToString(proto_file, &unchanged));
+    EXPECT_EQ(proto_data, unchanged);
+
+    // Loading replays the journal on top of the proto.
+    storaged = new_storaged();
+    storaged->load_proto(kUser);
+    auto& io_history = storaged->mUidm.io_history();
+    ASSERT_EQ(2u, io_history.size());
+    EXPECT_EQ("app1", io_history[200].entries[0].name);
+    EXPECT_EQ("app2", io_history[300].entries[0].name);
+    EXPECT_FALSE(storaged->journals[kUser].needs_rewrite);
+    EXPECT_EQ(300u, storaged->journals[kUser].last_end_ts);
+
+    // A torn last record is dropped, and the next flush rewrites the proto
+    // with everything still known and removes the journal.
+    ASSERT_EQ(0, truncate(journal_file.c_str(), journal_data.size() - 1));
+    storaged = new_storaged();
+    storaged->load_proto(kUser);
+    ASSERT_EQ(1u, storaged->mUidm.io_history().size());
+    EXPECT_TRUE(storaged->journals[kUser].needs_rewrite);
+
+    add_record(&storaged->mUidm, 400, "app3");
+    flush(storaged.get());
+    ASSERT_NE(0, access(journal_file.c_str(), F_OK));
+    storaged = new_storaged();
+    storaged->load_proto(kUser);
+    EXPECT_EQ(2u, storaged->mUidm.io_history().size());
+    EXPECT_EQ(1u, storaged->mUidm.io_history().count(400));
+}
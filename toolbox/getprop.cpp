@@ -15,10 +15,13 @@
  */
 
 #include <getopt.h>
+#include <string.h>
 #include <sys/system_properties.h>
 
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <android-base/properties.h>
@@ -35,39 +38,79 @@ enum class ResultType {
     Type,
 };
 
+// Names and values are appended to one buffer rather than allocated one by one; entries refer to
+// them by offset, since the buffer moves as it grows.
+struct PropertyList {
+    struct Entry {
+        size_t name_offset;
+        size_t name_length;
+        size_t value_offset;
+        size_t value_length;
+    };
+
+    std::string buffer;
+    std::vector<Entry> entries;
+    bool with_values;
+
+    std::string_view name(const Entry& entry) const {
+        return std::string_view(buffer).substr(entry.name_offset, entry.name_length);
+    }
+    std::string_view value(const Entry& entry) const {
+        return std::string_view(buffer).substr(entry.value_offset, entry.value_length);
+    }
+};
+
 void PrintAllProperties(ResultType result_type) {
-    std::vector<std::pair<std::string, std::string>> properties;
+    PropertyList properties;
+    properties.with_values = result_type == ResultType::Value;
+    properties.buffer.reserve(128 * 1024);
+    properties.entries.reserve(4096);
     __system_property_foreach(
         [](const prop_info* pi, void* cookie) {
             __system_property_read_callback(
                 pi,
                 [](void* cookie, const char* name, const char* value, unsigned) {
-                    auto properties =
-                        reinterpret_cast<std::vector<std::pair<std::string, std::string>>*>(cookie);
-                    properties->emplace_back(name, value);
+                    auto properties = reinterpret_cast<PropertyList*>(cookie);
+                    // The name is kept with a terminating NUL for GetPropertyInfo().
+                    size_t name_length = strlen(name);
+                    size_t name_offset = properties->buffer.size();
+                    properties->buffer.append(name, name_length + 1);
+                    size_t value_length = 0;
+                    size_t value_offset = properties->buffer.size();
+                    if (properties->with_values) {
+                        value_length = strlen(value);
+                        properties->buffer.append(value, value_length);
+                    }
+                    properties->entries.push_back(
+                        {name_offset, name_length, value_offset, value_length});
                 },
                 cookie);
         },
         &properties);
 
-    std::sort(properties.begin(), properties.end());
-
-    if (result_type != ResultType::Value) {
-        for (auto& [name, value] : properties) {
+    std::sort(properties.entries.begin(), properties.entries.end(),
+              [&properties](const PropertyList::Entry& a, const PropertyList::Entry& b) {
+                  return properties.name(a) < properties.name(b);
+              });
+
+    std::string output;
+    output.reserve(properties.buffer.size() + properties.entries.size() * 64);
+    for (const auto& entry : properties.entries) {
+        std::string_view name = properties.name(entry);
+        output.append("[").append(name).append("]: [");
+        if (result_type == ResultType::Value) {
+            output.append(properties.value(entry));
+        } else {
             const char* context = nullptr;
             const char* type = nullptr;
-            property_info_file->GetPropertyInfo(name.c_str(), &context, &type);
-            if (result_type == ResultType::Context) {
-                value = context;
-            } else {
-                value = type;
-            }
+            property_info_file->GetPropertyInfo(name.data(), &context, &type);
+            const char* info = result_type == ResultType::Context ? context : type;
+            if (info != nullptr) output.append(info);
         }
+        output.append("]\n");
     }
-
-    for (const auto& [name, value] : properties) {
-        std::cout << "[" << name << "]: [" << value << "]" << std::endl;
-    }
+    std::cout.write(output.data(), output.size());
+    std::cout.flush();
 }
 
 void PrintProperty(const char* name, const char* default_value, ResultType result_type) {
@@ -54,7 +54,8 @@ CoverageRecord::CoverageRecord(string tipc_dev, struct uuid* uuid)
       sancov_filename_(),
       record_len_(0),
       shm_(NULL),
-      shm_len_(0) {}
+      shm_len_(0),
+      edges_() {}
 
 CoverageRecord::CoverageRecord(string tipc_dev, struct uuid* uuid, string module_name)
     : tipc_dev_(std::move(tipc_dev)),
@@ -63,7 +64,8 @@ CoverageRecord::CoverageRecord(string tipc_dev, struct uuid* uuid, string module
       sancov_filename_(module_name + "." + to_string(getpid()) + ".sancov"),
       record_len_(0),
       shm_(NULL),
-      shm_len_(0) {}
+      shm_len_(0),
+      edges_() {}
 
 CoverageRecord::~CoverageRecord() {
     if (shm_) {
@@ -184,7 +186,16 @@ void CoverageRecord::ResetCounts() {
     volatile uint8_t* end = nullptr;
     GetRawCounts(&begin, &end);
 
-    for (volatile uint8_t* x = begin; x < end; x++) {
+    // The TA may bump any counter at any time, so all of them are cleared,
+    // but a word at a time where they are aligned.
+    volatile uint8_t* x = begin;
+    for (; x < end && (uintptr_t)x % sizeof(uint64_t); x++) {
+        *x = 0;
+    }
+    for (; x + sizeof(uint64_t) <= end; x += sizeof(uint64_t)) {
+        *(volatile uint64_t*)x = 0;
+    }
+    for (; x < end; x++) {
         *x = 0;
     }
 }
@@ -272,6 +283,40 @@ uint64_t CoverageRecord::TotalEdgeCounts() {
     return counter;
 }
 
+const std::vector<CoverageEdge>& CoverageRecord::GetEdges() {
+    edges_.clear();
+
+    volatile uint8_t* begin = NULL;
+    volatile uint8_t* end = NULL;
+    GetRawCounts(&begin, &end);
+
+    auto add_edge = [&](volatile uint8_t* x) {
+        uint8_t count = *x;
+        if (count) {
+            edges_.push_back({static_cast<uint32_t>(x - begin), count});
+        }
+    };
+
+    volatile uint8_t* x = begin;
+    for (; x < end && (uintptr_t)x % sizeof(uint64_t); x++) {
+        add_edge(x);
+    }
+    for (; x + sizeof(uint64_t) <= end; x += sizeof(uint64_t)) {
+        // Most counters are zero; only look at the bytes of non-zero words.
+        if (*(volatile uint64_t*)x == 0) {
+            continue;
+        }
+        for (size_t i = 0; i < sizeof(uint64_t); i++) {
+            add_edge(x + i);
+        }
+    }
+    for (; x < end; x++) {
+        add_edge(x);
+    }
+
+    return edges_;
+}
+
 Result<void> CoverageRecord::SaveSancovFile(const std::string& filename) {
     android::base::unique_fd output_fd(TEMP_FAILURE_RETRY(creat(filename.c_str(), 00644)));
     if (!output_fd.ok()) {
@@ -97,6 +97,32 @@ TEST_F(CoverageTest, TestServerCoverage) {
     ASSERT_GT(high_watermark, 0);
 }
 
+TEST_F(CoverageTest, TestServerEdges) {
+    unique_fd test_srv(tipc_connect(TIPC_DEV, TEST_SRV_PORT));
+    ASSERT_GE(test_srv, 0);
+
+    record_->ResetCounts();
+
+    uint32_t msg = 0xdeadbeef;
+    int rc = write(test_srv, &msg, sizeof(msg));
+    ASSERT_EQ(rc, sizeof(msg));
+    rc = read(test_srv, &msg, sizeof(msg));
+    ASSERT_EQ(rc, sizeof(msg));
+
+    /* The edge list must account for every count */
+    uint64_t counter = 0;
+    for (const auto& edge : record_->GetEdges()) {
+        ASSERT_GT(edge.count, 0);
+        counter += edge.count;
+    }
+    ASSERT_GT(counter, 0);
+    ASSERT_EQ(counter, record_->TotalEdgeCounts());
+
+    record_->ResetCounts();
+    ASSERT_EQ(record_->TotalEdgeCounts(), 0);
+    ASSERT_TRUE(record_->GetEdges().empty());
+}
+
 }  // namespace coverage
 }  // namespace trusty
 }  // namespace android
@@ -18,6 +18,7 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <android-base/result.h>
 #include <android-base/unique_fd.h>
@@ -31,6 +32,12 @@ namespace coverage {
 using android::base::Result;
 using android::base::unique_fd;
 
+/* A counter that was hit, see CoverageRecord::GetEdges(). */
+struct CoverageEdge {
+    uint32_t index;
+    uint8_t count;
+};
+
 class CoverageRecord {
   public:
     /**
@@ -56,6 +63,13 @@ class CoverageRecord {
     void GetRawPCs(volatile uintptr_t** begin, volatile uintptr_t** end);
     uint64_t TotalEdgeCounts();
 
+    /**
+     * Return the index and count of every non-zero counter. The counters are
+     * scanned a word at a time, so sparse coverage is cheap to collect. The
+     * returned list is valid until the next call.
+     */
+    const std::vector<CoverageEdge>& GetEdges();
+
     /**
      * Save the current set of observed PCs to the given filename.
      * The resulting .sancov file can be parsed via the LLVM sancov tool to see
@@ -75,6 +89,7 @@ class CoverageRecord {
     size_t record_len_;
     volatile void* shm_;
     size_t shm_len_;
+    std::vector<CoverageEdge> edges_;
 };
 
 }  // namespace coverage
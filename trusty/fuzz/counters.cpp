@@ -84,10 +84,13 @@ void ExtraCounters::Flush() {
     size_t num_counters = end - begin;
     if (num_counters > kMaxNumCounters) {
         ALOGE("Too many counters (%zu) to fit in the extra counters section!\n", num_counters);
-        num_counters = kMaxNumCounters;
     }
-    for (size_t i = 0; i < num_counters; i++) {
-        *(counters + i) = *(begin + i);
+    // The extra counters were cleared by Reset(), so only the hit ones need
+    // to be copied.
+    for (const auto& edge : record_->GetEdges()) {
+        if (edge.index < kMaxNumCounters) {
+            counters[edge.index] = edge.count;
+        }
     }
 }
 
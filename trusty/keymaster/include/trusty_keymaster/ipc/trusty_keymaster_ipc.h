@@ -25,6 +25,8 @@ __BEGIN_DECLS
 const uint32_t TRUSTY_KEYMASTER_RECV_BUF_SIZE = 2 * PAGE_SIZE;
 const uint32_t TRUSTY_KEYMASTER_SEND_BUF_SIZE =
         (PAGE_SIZE - sizeof(struct keymaster_message) - 16 /* tipc header */);
+// Number of channels to the TA that concurrent callers in one process may use.
+const uint32_t TRUSTY_KEYMASTER_MAX_CONNECTIONS = 4;
 
 int trusty_keymaster_connect(void);
 int trusty_keymaster_call(uint32_t cmd, void* in, uint32_t in_size, uint8_t* out,
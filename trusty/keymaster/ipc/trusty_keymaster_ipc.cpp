@@ -26,6 +26,8 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
 #include <variant>
 #include <vector>
 
@@ -38,18 +40,112 @@
 
 #define TRUSTY_DEVICE_NAME "/dev/trusty-ipc-dev0"
 
-static int handle_ = -1;
-
 static const int timeout_ms = 10 * 1000;
 static const int max_timeout_ms = 60 * 1000;
 
-int trusty_keymaster_connect() {
+/*
+ * One tipc channel to the keymaster TA. Each channel is used by one caller at
+ * a time, so that independent requests don't queue behind each other.
+ */
+struct keymaster_connection {
+    int handle = -1;
+    uint64_t generation = 0;
+};
+
+static std::mutex connections_lock_;
+static std::condition_variable connection_released_;
+static std::vector<keymaster_connection*> idle_connections_;
+// Connections open in the current generation, idle or in use.
+static uint32_t open_connections_ = 0;
+// Bumped on disconnect so that connections in use are closed when released.
+static uint64_t generation_ = 0;
+static bool connected_ = false;
+
+static void close_connection(keymaster_connection* conn) {
+    if (conn->handle >= 0) {
+        tipc_close(conn->handle);
+    }
+    delete conn;
+}
+
+static int open_connection(keymaster_connection** out) {
     int rc = tipc_connect(TRUSTY_DEVICE_NAME, KEYMASTER_PORT);
     if (rc < 0) {
         return rc;
     }
+    keymaster_connection* conn = new keymaster_connection;
+    conn->handle = rc;
+    *out = conn;
+    return 0;
+}
+
+static int acquire_connection(keymaster_connection** out) {
+    std::unique_lock<std::mutex> lock(connections_lock_);
+    connection_released_.wait(lock, [] {
+        return !connected_ || !idle_connections_.empty() ||
+               open_connections_ < TRUSTY_KEYMASTER_MAX_CONNECTIONS;
+    });
+    if (!connected_) {
+        ALOGE("not connected\n");
+        return -EINVAL;
+    }
+    if (!idle_connections_.empty()) {
+        *out = idle_connections_.back();
+        idle_connections_.pop_back();
+        return 0;
+    }
+
+    open_connections_++;
+    uint64_t generation = generation_;
+    lock.unlock();
+
+    int rc = open_connection(out);
+    if (rc < 0) {
+        ALOGE("failed to open keymaster connection: %d\n", rc);
+        lock.lock();
+        if (generation == generation_) {
+            open_connections_--;
+        }
+        lock.unlock();
+        connection_released_.notify_one();
+        return rc;
+    }
+    (*out)->generation = generation;
+    return 0;
+}
+
+static void release_connection(keymaster_connection* conn, bool reuse) {
+    {
+        std::lock_guard<std::mutex> lock(connections_lock_);
+        if (conn->generation != generation_) {
+            // already accounted for by trusty_keymaster_disconnect()
+            reuse = false;
+        } else if (reuse) {
+            idle_connections_.push_back(conn);
+        } else {
+            open_connections_--;
+        }
+    }
+    connection_released_.notify_one();
+    if (!reuse) {
+        close_connection(conn);
+    }
+}
+
+int trusty_keymaster_connect() {
+    trusty_keymaster_disconnect();
+
+    keymaster_connection* conn;
+    int rc = open_connection(&conn);
+    if (rc < 0) {
+        return rc;
+    }
 
-    handle_ = rc;
+    std::lock_guard<std::mutex> lock(connections_lock_);
+    conn->generation = generation_;
+    idle_connections_.push_back(conn);
+    open_connections_ = 1;
+    connected_ = true;
     return 0;
 }
 
@@ -72,12 +168,10 @@ class VectorEraser {
     std::vector<uint8_t>* _v;
 };
 
-std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, void* in,
-                                                                uint32_t in_size) {
-    if (handle_ < 0) {
-        ALOGE("not connected\n");
-        return -EINVAL;
-    }
+static std::variant<int, std::vector<uint8_t>> call_on_connection(keymaster_connection* conn,
+                                                                  uint32_t cmd, void* in,
+                                                                  uint32_t in_size) {
+    const int handle = conn->handle;
 
     size_t msg_size = in_size + sizeof(struct keymaster_message);
     struct keymaster_message* msg = reinterpret_cast<struct keymaster_message*>(malloc(msg_size));
@@ -94,7 +188,7 @@ std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, vo
     int poll_timeout_ms = timeout_ms;
     while (true) {
         struct pollfd pfd;
-        pfd.fd = handle_;
+        pfd.fd = handle;
         pfd.events = POLLOUT;
         pfd.revents = 0;
 
@@ -116,7 +210,7 @@ std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, vo
         break;
     }
 
-    ssize_t rc = write(handle_, msg, msg_size);
+    ssize_t rc = write(handle, msg, msg_size);
     if (timed_out) {
         ALOGW("write for cmd %d finished after %lld nsecs", cmd,
               (long long)(systemTime(SYSTEM_TIME_MONOTONIC) - start_time_ns));
@@ -163,7 +257,7 @@ std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, vo
         poll_timeout_ms = timeout_ms;
         while (true) {
             struct pollfd pfd;
-            pfd.fd = handle_;
+            pfd.fd = handle;
             pfd.events = POLLIN;
             pfd.revents = 0;
 
@@ -184,7 +278,7 @@ std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, vo
             }
             break;
         }
-        rc = readv(handle_, iov, 2);
+        rc = readv(handle, iov, 2);
         if (timed_out) {
             ALOGW("readv for cmd %d finished after %lld nsecs", cmd,
                   (long long)(systemTime(SYSTEM_TIME_MONOTONIC) - start_time_ns));
@@ -215,6 +309,21 @@ std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, vo
     return out;
 }
 
+std::variant<int, std::vector<uint8_t>> trusty_keymaster_call_2(uint32_t cmd, void* in,
+                                                                uint32_t in_size) {
+    keymaster_connection* conn;
+    int rc = acquire_connection(&conn);
+    if (rc < 0) {
+        return rc;
+    }
+
+    auto result = call_on_connection(conn, cmd, in, in_size);
+    // A channel that failed mid-call is in an unknown state; drop it and let
+    // a later call open a new one.
+    release_connection(conn, std::holds_alternative<std::vector<uint8_t>>(result));
+    return result;
+}
+
 int trusty_keymaster_call(uint32_t cmd, void* in, uint32_t in_size, uint8_t* out,
                           uint32_t* out_size) {
     auto result = trusty_keymaster_call_2(cmd, in, in_size);
@@ -237,10 +346,18 @@ int trusty_keymaster_call(uint32_t cmd, void* in, uint32_t in_size, uint8_t* out
 }
 
 void trusty_keymaster_disconnect() {
-    if (handle_ >= 0) {
-        tipc_close(handle_);
+    std::vector<keymaster_connection*> idle;
+    {
+        std::lock_guard<std::mutex> lock(connections_lock_);
+        idle.swap(idle_connections_);
+        open_connections_ = 0;
+        generation_++;
+        connected_ = false;
+    }
+    connection_released_.notify_all();
+    for (auto conn : idle) {
+        close_connection(conn);
     }
-    handle_ = -1;
 }
 
 keymaster_error_t translate_error(int err) {
@@ -303,9 +420,7 @@ keymaster_error_t trusty_keymaster_send(uint32_t command, const keymaster::Seria
         return rsp->error;
     } else {
         auto rc = std::get<int>(response);
-        // Reset the connection on tipc error
-        trusty_keymaster_disconnect();
-        trusty_keymaster_connect();
+        // The failed channel has already been dropped; the next request gets a new one.
         ALOGE("tipc error: %d\n", rc);
         // TODO(swillden): Distinguish permanent from transient errors and set error_ appropriately.
         return translate_error(rc);
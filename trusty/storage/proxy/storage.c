@@ -105,10 +105,13 @@ static int lookup_fd(uint32_t handle, bool dirty)
     return handle;
 }
 
-static int remove_fd(uint32_t handle)
+static int remove_fd(uint32_t handle, bool *dirty)
 {
     if (handle < FD_TBL_SIZE) {
+        *dirty = fd_state[handle] == SS_DIRTY;
         fd_state[handle] = SS_UNUSED; /* set to uninstalled */
+    } else {
+        *dirty = true; /* untracked, assume the worst */
     }
     return handle;
 }
@@ -390,12 +393,20 @@ int storage_file_close(struct storage_msg* msg, const void* r, size_t req_len,
         goto err_response;
     }
 
-    int fd = remove_fd(req->handle);
+    bool dirty;
+    int fd = remove_fd(req->handle, &dirty);
     ALOGV("%s: handle = %u: fd = %u\n", __func__, req->handle, fd);
 
-    watch_progress(watcher, "fsyncing before file close");
-    int rc = fsync(fd);
-    watch_progress(watcher, "done fsyncing before file close");
+    /*
+     * Nothing to flush if the file has not been written since the last
+     * checkpoint sync, e.g. if it was only read.
+     */
+    int rc = 0;
+    if (dirty) {
+        watch_progress(watcher, "fsyncing before file close");
+        rc = fdatasync(fd);
+        watch_progress(watcher, "done fsyncing before file close");
+    }
     if (rc < 0) {
         rc = errno;
         ALOGE("%s: fsync failed for fd=%u: %s\n",
@@ -623,8 +634,11 @@ int storage_sync_checkpoint(struct watcher* watcher) {
     for (uint fd = 0; fd < FD_TBL_SIZE; fd++) {
          if (fd_state[fd] == SS_DIRTY) {
              if (fs_state == SS_CLEAN) {
-                 /* need to sync individual fd */
-                 rc = fsync(fd);
+                 /*
+                  * need to sync individual fd; timestamps are of no use to
+                  * the storage service, only the data and size matter.
+                  */
+                 rc = fdatasync(fd);
                  if (rc < 0) {
                      ALOGE("fsync for fd=%d failed: %s\n", fd, strerror(errno));
                      return rc;
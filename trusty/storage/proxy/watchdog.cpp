@@ -18,6 +18,7 @@
 
 #include <chrono>
 #include <cstdint>
+#include <map>
 #include <optional>
 #include <thread>
 #include <vector>
@@ -40,6 +41,7 @@ struct watcher {
     clock::time_point start_;
     clock::time_point state_change_;
     std::chrono::milliseconds Elapsed(clock::time_point end);
+    std::chrono::microseconds ElapsedUs(clock::time_point end);
 
     bool triggered_;
 };
@@ -83,15 +85,21 @@ std::chrono::milliseconds watcher::Elapsed(watcher::clock::time_point end) {
     return std::chrono::duration_cast<std::chrono::milliseconds>(end - start_);
 }
 
+std::chrono::microseconds watcher::ElapsedUs(watcher::clock::time_point end) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start_);
+}
+
 namespace {
 
 class Watchdog {
   private:
     static constexpr std::chrono::milliseconds kDefaultTimeoutMs = std::chrono::milliseconds(500);
     static constexpr std::chrono::milliseconds kMaxTimeoutMs = std::chrono::seconds(10);
+    // Number of finished requests between latency summaries.
+    static constexpr uint32_t kLatencyLogInterval = 1000;
 
   public:
-    Watchdog() : watcher_(), done_(false) {}
+    Watchdog() : watcher_(), done_(false), finished_(0) {}
     ~Watchdog();
     struct watcher* RegisterWatch(const char* id, const struct storage_msg* request);
     void AddProgress(struct watcher* watcher, const char* state);
@@ -108,8 +116,19 @@ class Watchdog {
     std::thread watchdog_thread_;
     bool done_;
 
+    // Latency of the requests finished since the last summary, per command.
+    // Only touched by the main thread.
+    struct LatencyStats {
+        uint32_t count;
+        std::chrono::microseconds total;
+        std::chrono::microseconds max;
+    };
+    std::map<uint32_t, LatencyStats> latency_stats_;
+    uint32_t finished_;
+
     void WatchdogLoop();
     void LogWatchdogTriggerLocked();
+    void RecordLatency(uint32_t cmd, std::chrono::microseconds elapsed);
 };
 
 Watchdog gWatchdog;
@@ -140,6 +159,8 @@ struct watcher* Watchdog::RegisterWatch(const char* id, const struct storage_msg
 }
 
 void Watchdog::UnRegisterWatch(struct watcher* watcher) {
+    uint32_t cmd;
+    std::chrono::microseconds elapsed;
     {
         std::lock_guard<std::mutex> watcherLock(watcher_mutex_);
         if (!watcher_) {
@@ -150,9 +171,28 @@ void Watchdog::UnRegisterWatch(struct watcher* watcher) {
             LOG(ERROR) << "Unregistering watcher that doesn't match current watcher";
         }
         watcher_->LogFinished();
+        cmd = watcher_->cmd_;
+        elapsed = watcher_->ElapsedUs(watcher::clock::now());
         watcher_.reset(nullptr);
     }
     watcher_change_.notify_one();
+    RecordLatency(cmd, elapsed);
+}
+
+void Watchdog::RecordLatency(uint32_t cmd, std::chrono::microseconds elapsed) {
+    LatencyStats& stats = latency_stats_[cmd];
+    stats.count++;
+    stats.total += elapsed;
+    stats.max = std::max(stats.max, elapsed);
+
+    if (++finished_ < kLatencyLogInterval) return;
+    for (const auto& [stats_cmd, stats] : latency_stats_) {
+        LOG(INFO) << "Storageproxyd latency cmd: " << stats_cmd << " count: " << stats.count
+                  << " avg: " << (stats.total / stats.count).count()
+                  << "us max: " << stats.max.count() << "us";
+    }
+    latency_stats_.clear();
+    finished_ = 0;
 }
 
 void Watchdog::AddProgress(struct watcher* watcher, const char* state) {